@@ -18,10 +18,12 @@
 
 #include <sys/epoll.h>
 
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <set>
 #include <shared_mutex>
+#include <vector>
 
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/result.h"
@@ -50,6 +52,8 @@ Epoll::Epoll(Epoll&& other) {
 
   epoll_fd_ = std::move(other.epoll_fd_);
   watched_ = std::move(other.watched_);
+  watched_by_key_ = std::move(other.watched_by_key_);
+  next_key_ = other.next_key_;
 }
 
 Epoll& Epoll::operator=(Epoll&& other) {
@@ -61,9 +65,22 @@ Epoll& Epoll::operator=(Epoll&& other) {
 
   epoll_fd_ = std::move(other.epoll_fd_);
   watched_ = std::move(other.watched_);
+  watched_by_key_ = std::move(other.watched_by_key_);
+  next_key_ = other.next_key_;
   return *this;
 }
 
+Result<void> Epoll::Control(int operation, uint64_t key, const SharedFD& fd,
+                            uint32_t events) {
+  epoll_event event;
+  event.events = events;
+  event.data.u64 = key;
+  if (epoll_ctl(epoll_fd_->fd_, operation, fd->fd_, &event) != 0) {
+    return CF_ERRNO("epoll_ctl failed");
+  }
+  return {};
+}
+
 Result<void> Epoll::Add(SharedFD fd, uint32_t events) {
   std::unique_lock watched_lock(watched_mutex_, std::defer_lock);
   std::shared_lock epoll_lock(epoll_mutex_, std::defer_lock);
@@ -73,9 +90,10 @@ Result<void> Epoll::Add(SharedFD fd, uint32_t events) {
   if (watched_.count(fd) != 0) {
     return CF_ERRNO("Watched set already contains fd");
   }
+  auto key = next_key_++;
   epoll_event event;
   event.events = events;
-  event.data.fd = fd->fd_;
+  event.data.u64 = key;
   int success = epoll_ctl(epoll_fd_->fd_, EPOLL_CTL_ADD, fd->fd_, &event);
   if (success != 0 && errno == EEXIST) {
     // We're already tracking this fd, don't drop it from the set.
@@ -83,7 +101,8 @@ Result<void> Epoll::Add(SharedFD fd, uint32_t events) {
   } else if (success != 0) {
     return CF_ERRNO("epoll_ctl: Add failed");
   }
-  watched_.insert(fd);
+  watched_[fd] = key;
+  watched_by_key_[key] = fd;
   return {};
 }
 
@@ -93,35 +112,32 @@ Result<void> Epoll::AddOrModify(SharedFD fd, uint32_t events) {
   std::lock(watched_lock, epoll_lock);
   CF_EXPECT(epoll_fd_->IsOpen(), "Empty Epoll instance");
 
-  epoll_event event;
-  event.events = events;
-  event.data.fd = fd->fd_;
-  int operation = watched_.count(fd) == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
-  int success = epoll_ctl(epoll_fd_->fd_, operation, fd->fd_, &event);
-  if (success != 0) {
-    std::string operation_str = operation == EPOLL_CTL_ADD ? "add" : "modify";
-    return CF_ERRNO("epoll_ctl: Operation " << operation_str << " failed");
+  auto it = watched_.find(fd);
+  if (it != watched_.end()) {
+    CF_EXPECT(Control(EPOLL_CTL_MOD, it->second, fd, events),
+              "epoll_ctl: Operation modify failed");
+    return {};
   }
-  watched_.insert(fd);
+  auto key = next_key_++;
+  CF_EXPECT(Control(EPOLL_CTL_ADD, key, fd, events),
+            "epoll_ctl: Operation add failed");
+  watched_[fd] = key;
+  watched_by_key_[key] = fd;
   return {};
 }
 
 Result<void> Epoll::Modify(SharedFD fd, uint32_t events) {
-  std::unique_lock watched_lock(watched_mutex_, std::defer_lock);
+  std::shared_lock watched_lock(watched_mutex_, std::defer_lock);
   std::shared_lock epoll_lock(epoll_mutex_, std::defer_lock);
   std::lock(watched_lock, epoll_lock);
   CF_EXPECT(epoll_fd_->IsOpen(), "Empty Epoll instance");
 
-  if (watched_.count(fd) == 0) {
+  auto it = watched_.find(fd);
+  if (it == watched_.end()) {
     return CF_ERR("Watched set did not contain fd");
   }
-  epoll_event event;
-  event.events = events;
-  event.data.fd = fd->fd_;
-  int success = epoll_ctl(epoll_fd_->fd_, EPOLL_CTL_MOD, fd->fd_, &event);
-  if (success != 0) {
-    return CF_ERRNO("epoll_ctl: Modify failed");
-  }
+  CF_EXPECT(Control(EPOLL_CTL_MOD, it->second, fd, events),
+            "epoll_ctl: Modify failed");
   return {};
 }
 
@@ -131,48 +147,74 @@ Result<void> Epoll::Delete(SharedFD fd) {
   std::lock(watched_lock, epoll_lock);
   CF_EXPECT(epoll_fd_->IsOpen(), "Empty Epoll instance");
 
-  if (watched_.count(fd) == 0) {
+  auto it = watched_.find(fd);
+  if (it == watched_.end()) {
     return CF_ERR("Watched set did not contain fd");
   }
   int success = epoll_ctl(epoll_fd_->fd_, EPOLL_CTL_DEL, fd->fd_, nullptr);
   if (success != 0) {
     return CF_ERRNO("epoll_ctl: Delete failed");
   }
-  watched_.erase(fd);
+  watched_by_key_.erase(it->second);
+  watched_.erase(it);
+  return {};
+}
+
+Result<void> Epoll::AddEdgeTriggered(SharedFD fd, uint32_t events) {
+  CF_EXPECT(Add(fd, events | EPOLLET));
+  return {};
+}
+
+Result<void> Epoll::AddOneShot(SharedFD fd, uint32_t events) {
+  CF_EXPECT(Add(fd, events | EPOLLONESHOT));
+  return {};
+}
+
+Result<void> Epoll::Rearm(SharedFD fd, uint32_t events) {
+  CF_EXPECT(Modify(fd, events | EPOLLONESHOT));
   return {};
 }
 
 Result<std::optional<EpollEvent>> Epoll::Wait() {
-  epoll_event event;
-  int success;
+  auto events = CF_EXPECT(Wait(1));
+  if (events.empty()) {
+    return {};
+  }
+  return events[0];
+}
+
+Result<std::vector<EpollEvent>> Epoll::Wait(
+    std::size_t max_events, std::optional<std::chrono::milliseconds> timeout) {
+  CF_EXPECT(max_events > 0, "Must wait for at least one event");
+  // Reused between calls on the same thread to avoid an allocation per wait.
+  thread_local std::vector<epoll_event> raw_events;
+  if (raw_events.size() < max_events) {
+    raw_events.resize(max_events);
+  }
+  int timeout_ms = timeout ? static_cast<int>(timeout->count()) : -1;
+  int ready;
   {
     std::shared_lock lock(epoll_mutex_);
     CF_EXPECT(epoll_fd_->IsOpen(), "Empty Epoll instance");
-    success = epoll_wait(epoll_fd_->fd_, &event, 1, -1);
+    ready = epoll_wait(epoll_fd_->fd_, raw_events.data(), max_events,
+                       timeout_ms);
   }
-  if (success == -1) {
+  if (ready == -1) {
     return CF_ERRNO("epoll_wait failed");
-  } else if (success == 0) {
-    return {};
-  } else if (success != 1) {
-    return CF_ERR("epoll_wait returned an unexpected value");
   }
-  EpollEvent ret;
-  ret.events = event.events;
+  std::vector<EpollEvent> events;
+  events.reserve(ready);
   std::shared_lock lock(watched_mutex_);
-  for (const auto& watched : watched_) {
-    if (watched->fd_ == event.data.fd) {
-      ret.fd = watched;
-      break;
+  for (int i = 0; i < ready; i++) {
+    auto it = watched_by_key_.find(raw_events[i].data.u64);
+    if (it == watched_by_key_.end()) {
+      // The file descriptor was deleted after epoll_wait returned, treat this
+      // as a spurious wakeup.
+      continue;
     }
+    events.emplace_back(EpollEvent{it->second, raw_events[i].events});
   }
-  if (!ret.fd->IsOpen()) {
-    // Couldn't find the matching SharedFD to the file descriptor. We probably
-    // lost the race to lock watched_mutex_ against a delete call. Treat this
-    // as a spurious wakeup.
-    return {};
-  }
-  return ret;
+  return events;
 }
 
 }  // namespace cuttlefish
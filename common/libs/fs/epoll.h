@@ -18,10 +18,14 @@
 
 #include <sys/epoll.h>
 
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
-#include <set>
 #include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/result.h"
@@ -45,10 +49,30 @@ class Epoll {
   Result<void> AddOrModify(SharedFD fd, uint32_t events);
   Result<void> Delete(SharedFD fd);
   Result<std::optional<EpollEvent>> Wait();
+  /**
+   * Returns up to max_events ready file descriptors from a single epoll_wait
+   * call. Blocks until at least one is ready or the timeout expires, forever
+   * if no timeout is given. An empty result means the timeout expired or the
+   * wakeup was for a file descriptor deleted in the meantime.
+   */
+  Result<std::vector<EpollEvent>> Wait(
+      std::size_t max_events,
+      std::optional<std::chrono::milliseconds> timeout = std::nullopt);
+
+  /**
+   * Helpers for the two common non level-triggered registrations. A one shot
+   * registration is disabled after reporting an event until Rearm is called.
+   */
+  Result<void> AddEdgeTriggered(SharedFD fd, uint32_t events);
+  Result<void> AddOneShot(SharedFD fd, uint32_t events);
+  Result<void> Rearm(SharedFD fd, uint32_t events);
 
  private:
   Epoll(SharedFD);
 
+  Result<void> Control(int operation, uint64_t key, const SharedFD& fd,
+                       uint32_t events);
+
   /**
    * This read-write mutex is read-locked to perform epoll operations, and
    * write-locked to replace the file descriptor.
@@ -61,11 +85,18 @@ class Epoll {
   std::shared_mutex epoll_mutex_;
   SharedFD epoll_fd_;
   /**
-   * This read-write mutex is read-locked when interacting with it as a const
-   * std::set, and write-locked when interacting with it as a std::set.
+   * This read-write mutex is read-locked when looking up watched entries, and
+   * write-locked when adding or removing them.
+   *
+   * Every registration gets a unique key which is stored in the epoll_event
+   * data, so events resolve to their SharedFD with a single hash lookup.
+   * Keys are never reused, an event for a file descriptor deleted (and maybe
+   * re-added) while the event was in flight simply doesn't resolve.
    */
   std::shared_mutex watched_mutex_;
-  std::set<SharedFD> watched_;
+  std::map<SharedFD, uint64_t> watched_;
+  std::unordered_map<uint64_t, SharedFD> watched_by_key_;
+  uint64_t next_key_ = 0;
 };
 
 }  // namespace cuttlefish
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/resource.h>
+
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace {
+
+// Watches `count` eventfds which all stay readable, so every wait returns
+// immediately and only the dispatch cost is measured.
+struct ReadyFds {
+  explicit ReadyFds(std::size_t count) {
+    epoll = std::move(*Epoll::Create());
+    for (std::size_t i = 0; i < count; i++) {
+      auto fd = SharedFD::Event(1);
+      CHECK(fd->IsOpen()) << fd->StrError();
+      CHECK(epoll.Add(fd, EPOLLIN).ok());
+      fds.push_back(fd);
+    }
+  }
+
+  Epoll epoll;
+  std::vector<SharedFD> fds;
+};
+
+void RaiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+void BM_EpollWaitSingle(benchmark::State& state) {
+  RaiseFileLimit();
+  ReadyFds ready(state.range(0));
+  for (auto _ : state) {
+    auto event = ready.epoll.Wait();
+    benchmark::DoNotOptimize(event);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EpollWaitSingle)->Arg(16)->Arg(1024)->Arg(4096);
+
+void BM_EpollWaitBatch(benchmark::State& state) {
+  RaiseFileLimit();
+  ReadyFds ready(state.range(0));
+  std::size_t events = 0;
+  for (auto _ : state) {
+    auto batch = ready.epoll.Wait(state.range(1));
+    events += batch.ok() ? batch->size() : 0;
+    benchmark::DoNotOptimize(batch);
+  }
+  state.SetItemsProcessed(events);
+}
+BENCHMARK(BM_EpollWaitBatch)
+    ->Args({16, 16})
+    ->Args({1024, 64})
+    ->Args({4096, 64})
+    ->Args({4096, 256});
+
+// Registration churn while the set is large, e.g. the cvd server adding and
+// removing per-request callbacks.
+void BM_EpollAddDelete(benchmark::State& state) {
+  RaiseFileLimit();
+  ReadyFds ready(state.range(0));
+  auto fd = SharedFD::Event();
+  for (auto _ : state) {
+    CHECK(ready.epoll.Add(fd, EPOLLIN).ok());
+    CHECK(ready.epoll.Delete(fd).ok());
+  }
+}
+BENCHMARK(BM_EpollAddDelete)->Arg(16)->Arg(4096);
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
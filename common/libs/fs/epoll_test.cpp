@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/fs/epoll.h"
+
+#include <sys/epoll.h>
+
+#include <chrono>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace {
+
+// Long enough to tell "no event" from a slow wakeup, short enough to keep the
+// tests fast.
+constexpr std::chrono::milliseconds kNoEventTimeout(50);
+
+class EpollTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    auto epoll = Epoll::Create();
+    ASSERT_TRUE(epoll.ok()) << epoll.error();
+    epoll_ = std::move(*epoll);
+    ASSERT_TRUE(SharedFD::Pipe(&read_, &write_));
+  }
+
+  void WriteByte() { ASSERT_EQ(write_->Write("x", 1), 1); }
+
+  void ReadByte() {
+    char byte;
+    ASSERT_EQ(read_->Read(&byte, 1), 1);
+  }
+
+  std::vector<EpollEvent> Poll() {
+    auto events = epoll_.Wait(4, kNoEventTimeout);
+    EXPECT_TRUE(events.ok()) << events.error();
+    return events.ok() ? *events : std::vector<EpollEvent>{};
+  }
+
+  Epoll epoll_;
+  SharedFD read_;
+  SharedFD write_;
+};
+
+TEST_F(EpollTest, WaitTimesOutWithoutEvents) {
+  ASSERT_TRUE(epoll_.Add(read_, EPOLLIN).ok());
+  EXPECT_TRUE(Poll().empty());
+}
+
+TEST_F(EpollTest, WaitReportsReadableFd) {
+  ASSERT_TRUE(epoll_.Add(read_, EPOLLIN).ok());
+  WriteByte();
+
+  auto event = epoll_.Wait();
+  ASSERT_TRUE(event.ok()) << event.error();
+  ASSERT_TRUE(event->has_value());
+  EXPECT_EQ((*event)->fd, read_);
+  EXPECT_TRUE((*event)->events & EPOLLIN);
+}
+
+TEST_F(EpollTest, WaitReportsEveryReadyFd) {
+  auto event_fd = SharedFD::Event();
+  ASSERT_TRUE(event_fd->IsOpen()) << event_fd->StrError();
+  ASSERT_TRUE(epoll_.Add(read_, EPOLLIN).ok());
+  ASSERT_TRUE(epoll_.Add(event_fd, EPOLLIN).ok());
+  WriteByte();
+  ASSERT_EQ(event_fd->EventfdWrite(1), 0);
+
+  auto events = Poll();
+  ASSERT_EQ(events.size(), 2u);
+  EXPECT_NE(events[0].fd, events[1].fd);
+  for (const auto& event : events) {
+    EXPECT_TRUE(event.fd == read_ || event.fd == event_fd);
+  }
+}
+
+TEST_F(EpollTest, WaitRejectsZeroEvents) {
+  EXPECT_FALSE(epoll_.Wait(0, kNoEventTimeout).ok());
+}
+
+TEST_F(EpollTest, WaitIgnoresDeletedFd) {
+  ASSERT_TRUE(epoll_.Add(read_, EPOLLIN).ok());
+  WriteByte();
+  ASSERT_TRUE(epoll_.Delete(read_).ok());
+  EXPECT_TRUE(Poll().empty());
+}
+
+TEST_F(EpollTest, LevelTriggeredRepeatsUntilDrained) {
+  ASSERT_TRUE(epoll_.Add(read_, EPOLLIN).ok());
+  WriteByte();
+  EXPECT_EQ(Poll().size(), 1u);
+  EXPECT_EQ(Poll().size(), 1u);
+  ReadByte();
+  EXPECT_TRUE(Poll().empty());
+}
+
+TEST_F(EpollTest, EdgeTriggeredReportsOncePerEdge) {
+  ASSERT_TRUE(epoll_.AddEdgeTriggered(read_, EPOLLIN).ok());
+  WriteByte();
+  auto events = Poll();
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].fd, read_);
+
+  // Still readable, but no new data arrived.
+  EXPECT_TRUE(Poll().empty());
+
+  // New data is a new edge, even though the old byte is still unread.
+  WriteByte();
+  EXPECT_EQ(Poll().size(), 1u);
+  EXPECT_TRUE(Poll().empty());
+}
+
+TEST_F(EpollTest, EdgeTriggeredRejectsDuplicateAdd) {
+  ASSERT_TRUE(epoll_.AddEdgeTriggered(read_, EPOLLIN).ok());
+  EXPECT_FALSE(epoll_.AddEdgeTriggered(read_, EPOLLIN).ok());
+  EXPECT_FALSE(epoll_.Add(read_, EPOLLIN).ok());
+}
+
+TEST_F(EpollTest, OneShotDisablesAfterFirstEvent) {
+  ASSERT_TRUE(epoll_.AddOneShot(read_, EPOLLIN).ok());
+  WriteByte();
+  auto events = Poll();
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].fd, read_);
+
+  // Disabled: neither the unread byte nor new data are reported.
+  EXPECT_TRUE(Poll().empty());
+  WriteByte();
+  EXPECT_TRUE(Poll().empty());
+}
+
+TEST_F(EpollTest, RearmReenablesOneShot) {
+  ASSERT_TRUE(epoll_.AddOneShot(read_, EPOLLIN).ok());
+  WriteByte();
+  ASSERT_EQ(Poll().size(), 1u);
+  ASSERT_TRUE(Poll().empty());
+
+  // The byte is still unread, so the rearmed registration fires right away,
+  // and only once.
+  ASSERT_TRUE(epoll_.Rearm(read_, EPOLLIN).ok());
+  auto events = Poll();
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].fd, read_);
+  EXPECT_TRUE(Poll().empty());
+
+  // Rearmed with nothing to read, it waits for the next write.
+  ReadByte();
+  ASSERT_TRUE(epoll_.Rearm(read_, EPOLLIN).ok());
+  EXPECT_TRUE(Poll().empty());
+  WriteByte();
+  EXPECT_EQ(Poll().size(), 1u);
+}
+
+TEST_F(EpollTest, RearmRequiresRegistration) {
+  EXPECT_FALSE(epoll_.Rearm(read_, EPOLLIN).ok());
+}
+
+TEST_F(EpollTest, OneShotWithEventfd) {
+  auto event_fd = SharedFD::Event();
+  ASSERT_TRUE(event_fd->IsOpen()) << event_fd->StrError();
+  ASSERT_TRUE(epoll_.AddOneShot(event_fd, EPOLLIN).ok());
+  ASSERT_EQ(event_fd->EventfdWrite(1), 0);
+  ASSERT_EQ(Poll().size(), 1u);
+  ASSERT_EQ(event_fd->EventfdWrite(1), 0);
+  EXPECT_TRUE(Poll().empty());
+
+  eventfd_t value;
+  ASSERT_EQ(event_fd->EventfdRead(&value), 0);
+  EXPECT_EQ(value, 2u);
+  ASSERT_TRUE(epoll_.Rearm(event_fd, EPOLLIN).ok());
+  EXPECT_TRUE(Poll().empty());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,808 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/fs/io_uring.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kStreamBufferSize = 64 * 1024;
+constexpr std::size_t kFileChunkSize = 256 * 1024;
+// Provided buffers a multishot receive from a socket fills in turns.
+constexpr unsigned kSocketBufferCount = 8;
+constexpr unsigned kSocketBufferSize = 16 * 1024;
+constexpr std::uint16_t kSocketBufferGroup = 0;
+// Read and write pairs in flight while copying files.
+constexpr std::size_t kFileCopyDepth = 4;
+// Completions of cancel requests.
+constexpr std::uint64_t kCancelUserData = -1;
+
+int IoUringSetup(unsigned entries, struct io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+int IoUringRegister(int fd, unsigned opcode, const void* arg,
+                    unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Keeps buffers registered for the duration of one copy.
+class RegisteredBuffers {
+ public:
+  explicit RegisteredBuffers(IoUring& ring) : ring_(ring) {}
+  ~RegisteredBuffers() {
+    if (registered_) {
+      ring_.UnregisterBuffers();
+    }
+  }
+
+  Result<void> Register(const std::vector<struct iovec>& buffers) {
+    CF_EXPECT(ring_.RegisterBuffers(buffers));
+    registered_ = true;
+    return {};
+  }
+
+ private:
+  IoUring& ring_;
+  bool registered_ = false;
+};
+
+// Cancels the operations of a copy that returns early and waits for them,
+// before the buffers they read into or write from are freed.
+class DrainOnExit {
+ public:
+  DrainOnExit(IoUring& ring, std::vector<std::uint64_t> user_data)
+      : ring_(ring), user_data_(std::move(user_data)) {}
+  ~DrainOnExit() {
+    auto drained = ring_.CancelAndDrain(user_data_);
+    CHECK(drained.ok()) << "The kernel may still use freed buffers: "
+                        << drained.error().message();
+  }
+
+ private:
+  IoUring& ring_;
+  std::vector<std::uint64_t> user_data_;
+};
+
+template <typename T>
+T* RingField(void* ring, std::uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+}  // namespace
+
+Result<IoUring> IoUring::Create(unsigned entries) {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  IoUring ring;
+  ring.ring_fd_ = IoUringSetup(entries, &params);
+  if (ring.ring_fd_ < 0) {
+    return CF_ERRNO("io_uring_setup failed");
+  }
+
+  ring.sq_ring_size_ =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring.cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    ring.sq_ring_size_ = ring.cq_ring_size_ =
+        std::max(ring.sq_ring_size_, ring.cq_ring_size_);
+  }
+  ring.sq_ring_ = mmap(nullptr, ring.sq_ring_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring.ring_fd_,
+                       IORING_OFF_SQ_RING);
+  if (ring.sq_ring_ == MAP_FAILED) {
+    ring.sq_ring_ = nullptr;
+    return CF_ERRNO("Failed to map the io_uring submission ring");
+  }
+  if (single_mmap) {
+    ring.cq_ring_ = ring.sq_ring_;
+  } else {
+    ring.cq_ring_ = mmap(nullptr, ring.cq_ring_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring.ring_fd_,
+                         IORING_OFF_CQ_RING);
+    if (ring.cq_ring_ == MAP_FAILED) {
+      ring.cq_ring_ = nullptr;
+      return CF_ERRNO("Failed to map the io_uring completion ring");
+    }
+  }
+  ring.sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, ring.sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring.ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return CF_ERRNO("Failed to map the io_uring submission entries");
+  }
+  ring.sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  ring.sq_head_ = RingField<unsigned>(ring.sq_ring_, params.sq_off.head);
+  ring.sq_tail_ = RingField<unsigned>(ring.sq_ring_, params.sq_off.tail);
+  ring.sq_mask_ = *RingField<unsigned>(ring.sq_ring_, params.sq_off.ring_mask);
+  ring.sq_entries_ =
+      *RingField<unsigned>(ring.sq_ring_, params.sq_off.ring_entries);
+  ring.sq_array_ = RingField<unsigned>(ring.sq_ring_, params.sq_off.array);
+  ring.cq_head_ = RingField<unsigned>(ring.cq_ring_, params.cq_off.head);
+  ring.cq_tail_ = RingField<unsigned>(ring.cq_ring_, params.cq_off.tail);
+  ring.cq_mask_ = *RingField<unsigned>(ring.cq_ring_, params.cq_off.ring_mask);
+  ring.cqes_ =
+      RingField<struct io_uring_cqe>(ring.cq_ring_, params.cq_off.cqes);
+  ring.sqe_tail_ = ring.sqe_submitted_ = *ring.sq_tail_;
+  return ring;
+}
+
+bool IoUring::Available() {
+  static const bool available = IoUring::Create(2).ok();
+  return available;
+}
+
+bool IoUring::RecvMultishotAvailable() {
+  static const bool available = []() {
+    if (!Available()) {
+      return false;
+    }
+    auto ring = IoUring::Create(4);
+    if (!ring.ok()) {
+      return false;
+    }
+    // Kernels before 5.19 can't register the buffer ring, those before 6.0
+    // fail the receive with -EINVAL.
+    auto buffers = IoUringBufferRing::Create(*ring, 0, 1, 16);
+    if (!buffers.ok()) {
+      return false;
+    }
+    SharedFD sender, receiver;
+    if (!SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &sender, &receiver)) {
+      return false;
+    }
+    char byte = 0;
+    if (sender->Write(&byte, 1) != 1 ||
+        !ring->PrepareRecvMultishot(receiver, 0, 0).ok()) {
+      return false;
+    }
+    auto completions = ring->Reap(1);
+    bool received = completions.ok() && (*completions)[0].result == 1 &&
+                    (*completions)[0].HasBuffer();
+    return ring->CancelAndDrain({0}).ok() && received;
+  }();
+  return available;
+}
+
+IoUring::IoUring(IoUring&& other) { *this = std::move(other); }
+
+IoUring& IoUring::operator=(IoUring&& other) {
+  if (this == &other) {
+    return *this;
+  }
+  Release();
+  ring_fd_ = std::exchange(other.ring_fd_, -1);
+  sq_ring_ = std::exchange(other.sq_ring_, nullptr);
+  sq_ring_size_ = other.sq_ring_size_;
+  cq_ring_ = std::exchange(other.cq_ring_, nullptr);
+  cq_ring_size_ = other.cq_ring_size_;
+  sqes_ = std::exchange(other.sqes_, nullptr);
+  sqes_size_ = other.sqes_size_;
+  sq_head_ = other.sq_head_;
+  sq_tail_ = other.sq_tail_;
+  sq_mask_ = other.sq_mask_;
+  sq_entries_ = other.sq_entries_;
+  sq_array_ = other.sq_array_;
+  cq_head_ = other.cq_head_;
+  cq_tail_ = other.cq_tail_;
+  cq_mask_ = other.cq_mask_;
+  cqes_ = other.cqes_;
+  sqe_tail_ = other.sqe_tail_;
+  sqe_submitted_ = other.sqe_submitted_;
+  in_flight_ = std::exchange(other.in_flight_, 0);
+  return *this;
+}
+
+IoUring::~IoUring() { Release(); }
+
+void IoUring::Release() {
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = nullptr;
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  cq_ring_ = nullptr;
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = nullptr;
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+    ring_fd_ = -1;
+  }
+}
+
+Result<void> IoUring::RegisterBuffers(
+    const std::vector<struct iovec>& buffers) {
+  if (IoUringRegister(ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                      buffers.size()) != 0) {
+    return CF_ERRNO("Failed to register io_uring buffers");
+  }
+  return {};
+}
+
+Result<void> IoUring::UnregisterBuffers() {
+  if (IoUringRegister(ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0) != 0) {
+    return CF_ERRNO("Failed to unregister io_uring buffers");
+  }
+  return {};
+}
+
+Result<struct io_uring_sqe*> IoUring::NextSqe() {
+  auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    // Full, make room by handing the queued operations to the kernel.
+    CF_EXPECT(Submit());
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    CF_EXPECT(sqe_tail_ - head < sq_entries_,
+              "io_uring submission queue full");
+  }
+  auto index = sqe_tail_ & sq_mask_;
+  auto sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  sqe_tail_++;
+  in_flight_++;
+  return sqe;
+}
+
+Result<void> IoUring::PrepareRw(int opcode, SharedFD fd, const void* buffer,
+                                unsigned length, std::uint64_t offset,
+                                std::uint64_t user_data, unsigned flags) {
+  CF_EXPECT(fd->IsOpen(), "Invalid file descriptor");
+  auto sqe = CF_EXPECT(NextSqe());
+  sqe->opcode = opcode;
+  sqe->flags = flags;
+  sqe->fd = fd->fd_;
+  sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+  sqe->len = length;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  return {};
+}
+
+Result<void> IoUring::PrepareRead(SharedFD fd, void* buffer, unsigned length,
+                                  std::uint64_t offset,
+                                  std::uint64_t user_data, unsigned flags) {
+  CF_EXPECT(PrepareRw(IORING_OP_READ, fd, buffer, length, offset, user_data,
+                      flags));
+  return {};
+}
+
+Result<void> IoUring::PrepareWrite(SharedFD fd, const void* buffer,
+                                   unsigned length, std::uint64_t offset,
+                                   std::uint64_t user_data, unsigned flags) {
+  CF_EXPECT(PrepareRw(IORING_OP_WRITE, fd, buffer, length, offset, user_data,
+                      flags));
+  return {};
+}
+
+Result<void> IoUring::PrepareReadFixed(SharedFD fd, void* buffer,
+                                       unsigned length, std::uint64_t offset,
+                                       std::uint16_t buffer_index,
+                                       std::uint64_t user_data,
+                                       unsigned flags) {
+  CF_EXPECT(PrepareRw(IORING_OP_READ_FIXED, fd, buffer, length, offset,
+                      user_data, flags));
+  sqes_[(sqe_tail_ - 1) & sq_mask_].buf_index = buffer_index;
+  return {};
+}
+
+Result<void> IoUring::PrepareWriteFixed(SharedFD fd, const void* buffer,
+                                        unsigned length, std::uint64_t offset,
+                                        std::uint16_t buffer_index,
+                                        std::uint64_t user_data,
+                                        unsigned flags) {
+  CF_EXPECT(PrepareRw(IORING_OP_WRITE_FIXED, fd, buffer, length, offset,
+                      user_data, flags));
+  sqes_[(sqe_tail_ - 1) & sq_mask_].buf_index = buffer_index;
+  return {};
+}
+
+Result<void> IoUring::PrepareRecvMultishot(SharedFD fd, std::uint16_t group,
+                                           std::uint64_t user_data) {
+  CF_EXPECT(PrepareRw(IORING_OP_RECV, fd, nullptr, 0, 0, user_data,
+                      IOSQE_BUFFER_SELECT));
+  auto sqe = &sqes_[(sqe_tail_ - 1) & sq_mask_];
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->buf_group = group;
+  return {};
+}
+
+Result<unsigned> IoUring::Submit(unsigned wait_for) {
+  unsigned to_submit = sqe_tail_ - sqe_submitted_;
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  sqe_submitted_ = sqe_tail_;
+  if (to_submit == 0 && wait_for == 0) {
+    return 0;
+  }
+  int submitted;
+  do {
+    submitted = IoUringEnter(ring_fd_, to_submit, wait_for,
+                             wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+  } while (submitted < 0 && errno == EINTR && (to_submit = 0, true));
+  if (submitted < 0) {
+    return CF_ERRNO("io_uring_enter failed");
+  }
+  return submitted;
+}
+
+Result<std::vector<IoCompletion>> IoUring::Reap(unsigned min_completions) {
+  CF_EXPECT(min_completions <= in_flight_,
+            "Waiting for " << min_completions << " completions with "
+                           << in_flight_ << " operations in flight");
+  CF_EXPECT(Submit());
+  std::vector<IoCompletion> completions;
+  for (;;) {
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const auto& cqe = cqes_[head & cq_mask_];
+      completions.push_back({cqe.user_data, cqe.res, cqe.flags});
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        in_flight_--;
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    if (completions.size() >= min_completions) {
+      return completions;
+    }
+    CF_EXPECT(Submit(min_completions - completions.size()));
+  }
+}
+
+Result<void> IoUring::CancelAndDrain(
+    const std::vector<std::uint64_t>& user_data) {
+  in_flight_ -= sqe_tail_ - sqe_submitted_;
+  sqe_tail_ = sqe_submitted_;
+  if (in_flight_ == 0) {
+    return {};
+  }
+  for (auto target : user_data) {
+    auto sqe = CF_EXPECT(NextSqe());
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = kCancelUserData;
+  }
+  while (in_flight_ > 0) {
+    // Operations that already started may complete normally instead.
+    CF_EXPECT(Reap(1));
+  }
+  return {};
+}
+
+IoUringBufferRing::IoUringBufferRing(IoUring& ring, std::uint16_t group,
+                                     unsigned count, unsigned size)
+    : ring_(ring),
+      group_(group),
+      count_(count),
+      size_(size),
+      storage_(static_cast<std::size_t>(count) * size) {}
+
+Result<std::unique_ptr<IoUringBufferRing>> IoUringBufferRing::Create(
+    IoUring& ring, std::uint16_t group, unsigned count, unsigned size) {
+  CF_EXPECT(count > 0 && count <= 32768 && (count & (count - 1)) == 0,
+            "Buffer ring size " << count << " is not a power of two");
+  std::unique_ptr<IoUringBufferRing> buffers(
+      new IoUringBufferRing(ring, group, count, size));
+  // The kernel requires page aligned entries, which start zeroed and so with
+  // a tail of 0.
+  buffers->entries_size_ = count * sizeof(struct io_uring_buf);
+  void* entries = mmap(nullptr, buffers->entries_size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (entries == MAP_FAILED) {
+    return CF_ERRNO("Failed to map the io_uring buffer ring");
+  }
+  buffers->entries_ = entries;
+  struct io_uring_buf_reg registration;
+  std::memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = reinterpret_cast<std::uint64_t>(entries);
+  registration.ring_entries = count;
+  registration.bgid = group;
+  if (IoUringRegister(ring.ring_fd_, IORING_REGISTER_PBUF_RING, &registration,
+                      1) != 0) {
+    return CF_ERRNO("Failed to register the io_uring buffer ring");
+  }
+  buffers->registered_ = true;
+  for (unsigned id = 0; id < count; id++) {
+    buffers->Recycle(id);
+  }
+  return buffers;
+}
+
+IoUringBufferRing::~IoUringBufferRing() {
+  if (registered_) {
+    struct io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.bgid = group_;
+    IoUringRegister(ring_.ring_fd_, IORING_UNREGISTER_PBUF_RING, &registration,
+                    1);
+  }
+  if (entries_) {
+    munmap(entries_, entries_size_);
+  }
+}
+
+void IoUringBufferRing::Recycle(std::uint16_t id) {
+  // Not through struct io_uring_buf_ring: its bufs member follows an empty
+  // struct, which takes up space in C++ and shifts the entries.
+  auto entries = static_cast<struct io_uring_buf*>(entries_);
+  auto& entry = entries[tail_ & (count_ - 1)];
+  entry.addr = reinterpret_cast<std::uint64_t>(Buffer(id));
+  entry.len = size_;
+  entry.bid = id;
+  tail_++;
+  // The tail overlays the reserved field of the first entry.
+  __atomic_store_n(&entries[0].resv, tail_, __ATOMIC_RELEASE);
+}
+
+namespace {
+
+std::vector<struct iovec> StreamBuffers(std::vector<char>& storage) {
+  return {{storage.data(), kStreamBufferSize},
+          {storage.data() + kStreamBufferSize, kStreamBufferSize}};
+}
+
+// Forwards through the two halves of storage, already registered with ring.
+Result<std::uint64_t> ForwardRegistered(IoUring& ring,
+                                        std::vector<char>& storage,
+                                        SharedFD from, SharedFD to) {
+  // Two buffers used in turns: while one is being written out the next chunk
+  // is read into the other, and both operations go out in the same syscall.
+  enum : std::uint64_t { kRead, kWrite };
+  char* buffers[2] = {storage.data(), storage.data() + kStreamBufferSize};
+  DrainOnExit drain(ring, {kRead, kWrite});
+  std::size_t filled[2] = {0, 0};
+  std::size_t read_index = 0;
+  std::size_t write_index = 0;
+  // Buffers holding data not completely written yet.
+  std::size_t pending = 0;
+  std::size_t write_offset = 0;
+  bool read_in_flight = false;
+  bool write_in_flight = false;
+  bool eof = false;
+  std::uint64_t total = 0;
+
+  for (;;) {
+    if (!read_in_flight && !eof && pending < 2) {
+      CF_EXPECT(ring.PrepareReadFixed(from, buffers[read_index],
+                                      kStreamBufferSize,
+                                      IoUring::kCurrentPosition, read_index,
+                                      kRead));
+      read_in_flight = true;
+    }
+    if (!write_in_flight && pending > 0) {
+      CF_EXPECT(ring.PrepareWriteFixed(
+          to, buffers[write_index] + write_offset,
+          filled[write_index] - write_offset, IoUring::kCurrentPosition,
+          write_index, kWrite));
+      write_in_flight = true;
+    }
+    if (!read_in_flight && !write_in_flight) {
+      return total;
+    }
+    for (const auto& completion : CF_EXPECT(ring.Reap(1))) {
+      if (completion.result == -EINTR || completion.result == -EAGAIN) {
+        (completion.user_data == kRead ? read_in_flight : write_in_flight) =
+            false;
+        continue;
+      }
+      if (completion.user_data == kRead) {
+        read_in_flight = false;
+        CF_EXPECT(completion.result >= 0,
+                  "Read failed: " << strerror(-completion.result));
+        if (completion.result == 0) {
+          eof = true;
+          continue;
+        }
+        filled[read_index] = completion.result;
+        read_index ^= 1;
+        pending++;
+      } else {
+        write_in_flight = false;
+        CF_EXPECT(completion.result >= 0,
+                  "Write failed: " << strerror(-completion.result));
+        write_offset += completion.result;
+        total += completion.result;
+        if (write_offset == filled[write_index]) {
+          write_offset = 0;
+          write_index ^= 1;
+          pending--;
+        }
+      }
+    }
+  }
+}
+
+Result<std::uint64_t> BlockingForwardStream(SharedFD from, SharedFD to) {
+  std::vector<char> buffer(kStreamBufferSize);
+  std::uint64_t total = 0;
+  for (;;) {
+    auto read = from->Read(buffer.data(), buffer.size());
+    CF_EXPECT(read >= 0, "Read failed: " << from->StrError());
+    if (read == 0) {
+      return total;
+    }
+    auto written = WriteAll(to, buffer.data(), read);
+    CF_EXPECT(written == read, "Write failed: " << to->StrError());
+    total += read;
+  }
+}
+
+// Forwards what a multishot receive puts in the buffers of the ring, which
+// keeps receiving into the free ones while each is written out in turn.
+Result<std::uint64_t> ForwardProvided(IoUring& ring,
+                                      IoUringBufferRing& buffers,
+                                      SharedFD from, SharedFD to) {
+  enum : std::uint64_t { kRecv, kWrite };
+  DrainOnExit drain(ring, {kRecv, kWrite});
+  // Buffer ids and lengths of received data not completely written yet.
+  std::deque<std::pair<std::uint16_t, std::size_t>> received;
+  std::size_t write_offset = 0;
+  bool recv_armed = false;
+  bool write_in_flight = false;
+  bool eof = false;
+  std::uint64_t total = 0;
+
+  for (;;) {
+    // After running out of buffers the receive ends, it's armed again once
+    // one of them was written out.
+    if (!recv_armed && !eof && received.size() < kSocketBufferCount) {
+      CF_EXPECT(ring.PrepareRecvMultishot(from, kSocketBufferGroup, kRecv));
+      recv_armed = true;
+    }
+    if (!write_in_flight && !received.empty()) {
+      const auto& [id, length] = received.front();
+      CF_EXPECT(ring.PrepareWrite(to, buffers.Buffer(id) + write_offset,
+                                  length - write_offset,
+                                  IoUring::kCurrentPosition, kWrite));
+      write_in_flight = true;
+    }
+    if (!recv_armed && !write_in_flight) {
+      return total;
+    }
+    for (const auto& completion : CF_EXPECT(ring.Reap(1))) {
+      if (completion.user_data == kRecv) {
+        if (!completion.More()) {
+          recv_armed = false;
+        }
+        if (completion.result == 0 && completion.HasBuffer()) {
+          buffers.Recycle(completion.BufferId());
+        }
+        if (completion.result == -ENOBUFS || completion.result == -EINTR ||
+            completion.result == -EAGAIN) {
+          continue;
+        }
+        CF_EXPECT(completion.result >= 0,
+                  "Receive failed: " << strerror(-completion.result));
+        if (completion.result == 0) {
+          eof = true;
+          continue;
+        }
+        received.emplace_back(completion.BufferId(), completion.result);
+      } else {
+        write_in_flight = false;
+        if (completion.result == -EINTR || completion.result == -EAGAIN) {
+          continue;
+        }
+        CF_EXPECT(completion.result >= 0,
+                  "Write failed: " << strerror(-completion.result));
+        write_offset += completion.result;
+        total += completion.result;
+        if (write_offset == received.front().second) {
+          buffers.Recycle(received.front().first);
+          received.pop_front();
+          write_offset = 0;
+        }
+      }
+    }
+  }
+}
+
+bool IsStreamSocket(SharedFD fd) {
+  int type = 0;
+  socklen_t length = sizeof(type);
+  return fd->GetSockOpt(SOL_SOCKET, SO_TYPE, &type, &length) == 0 &&
+         type == SOCK_STREAM;
+}
+
+void LogBlockingFallback(const std::string& reason) {
+  static std::once_flag logged;
+  std::call_once(logged, [&reason]() {
+    LOG(WARNING) << "Forwarding streams without io_uring: " << reason;
+  });
+}
+
+}  // namespace
+
+Result<std::uint64_t> IoUringForwardStream(IoUring& ring, SharedFD from,
+                                           SharedFD to) {
+  std::vector<char> storage(2 * kStreamBufferSize);
+  RegisteredBuffers registered(ring);
+  CF_EXPECT(registered.Register(StreamBuffers(storage)));
+  return CF_EXPECT(ForwardRegistered(ring, storage, from, to));
+}
+
+Result<std::uint64_t> IoUringForwardSocket(IoUring& ring, SharedFD from,
+                                           SharedFD to) {
+  auto buffers = CF_EXPECT(IoUringBufferRing::Create(
+      ring, kSocketBufferGroup, kSocketBufferCount, kSocketBufferSize));
+  return CF_EXPECT(ForwardProvided(ring, *buffers, from, to));
+}
+
+Result<std::uint64_t> IoUringCopyFile(IoUring& ring, SharedFD from,
+                                      SharedFD to, std::uint64_t size) {
+  std::vector<char> storage(kFileCopyDepth * kFileChunkSize);
+  std::vector<struct iovec> iovecs;
+  for (std::size_t i = 0; i < kFileCopyDepth; i++) {
+    iovecs.push_back({storage.data() + i * kFileChunkSize, kFileChunkSize});
+  }
+  RegisteredBuffers registered(ring);
+  CF_EXPECT(registered.Register(iovecs));
+  std::vector<std::uint64_t> user_data;
+  for (std::uint64_t i = 0; i < kFileCopyDepth; i++) {
+    user_data.push_back(i << 1);
+    user_data.push_back((i << 1) | 1);
+  }
+  DrainOnExit drain(ring, std::move(user_data));
+
+  // Each slot copies one chunk with a linked read and write, the kernel starts
+  // the write as soon as the read completes without a round trip through this
+  // thread. A short read cancels the linked write, the rest of the chunk is
+  // then read and written with separate operations, as is the rest of a short
+  // write. user_data is (slot << 1) | is_write.
+  struct Slot {
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+    std::uint64_t read = 0;
+    std::uint64_t written = 0;
+    bool read_in_flight = false;
+    bool write_in_flight = false;
+  };
+  std::vector<Slot> slots(kFileCopyDepth);
+  std::vector<std::size_t> free_slots;
+  for (std::size_t i = 0; i < kFileCopyDepth; i++) {
+    free_slots.push_back(i);
+  }
+  std::uint64_t next_offset = 0;
+  std::uint64_t copied = 0;
+  while (copied < size) {
+    while (next_offset < size && !free_slots.empty()) {
+      auto index = free_slots.back();
+      free_slots.pop_back();
+      auto& slot = slots[index];
+      slot = Slot{};
+      slot.offset = next_offset;
+      slot.length = std::min<std::uint64_t>(kFileChunkSize, size - next_offset);
+      slot.read_in_flight = slot.write_in_flight = true;
+      auto buffer = static_cast<char*>(iovecs[index].iov_base);
+      CF_EXPECT(ring.PrepareReadFixed(from, buffer, slot.length, slot.offset,
+                                      index, index << 1, IoUring::kLink));
+      CF_EXPECT(ring.PrepareWriteFixed(to, buffer, slot.length, slot.offset,
+                                       index, (index << 1) | 1));
+      next_offset += slot.length;
+    }
+    for (const auto& completion : CF_EXPECT(ring.Reap(1))) {
+      auto index = completion.user_data >> 1;
+      bool is_write = completion.user_data & 1;
+      auto& slot = slots[index];
+      auto buffer = static_cast<char*>(iovecs[index].iov_base);
+      auto result = completion.result;
+      CF_EXPECT(is_write || result != 0,
+                "File shrank while copying, offset "
+                    << slot.offset + slot.read << " is past its end");
+      if (result == -EINTR || result == -EAGAIN) {
+        result = 0;
+      } else if (is_write && result == -ECANCELED) {
+        // The linked read came up short, the write is issued once the rest
+        // of the chunk is read.
+        result = 0;
+      } else {
+        CF_EXPECT(result >= 0, (is_write ? "Write" : "Read")
+                                   << " at offset " << slot.offset
+                                   << " failed: " << strerror(-result));
+      }
+      if (is_write) {
+        slot.write_in_flight = false;
+        slot.written += result;
+      } else {
+        slot.read_in_flight = false;
+        slot.read += result;
+        if (slot.read < slot.length) {
+          CF_EXPECT(ring.PrepareReadFixed(
+              from, buffer + slot.read, slot.length - slot.read,
+              slot.offset + slot.read, index, index << 1));
+          slot.read_in_flight = true;
+        }
+      }
+      if (slot.read_in_flight || slot.write_in_flight) {
+        continue;
+      }
+      if (slot.written < slot.length) {
+        CF_EXPECT(ring.PrepareWriteFixed(
+            to, buffer + slot.written, slot.length - slot.written,
+            slot.offset + slot.written, index, (index << 1) | 1));
+        slot.write_in_flight = true;
+        continue;
+      }
+      copied += slot.length;
+      free_slots.push_back(index);
+    }
+  }
+  return copied;
+}
+
+Result<std::uint64_t> ForwardStream(SharedFD from, SharedFD to) {
+  if (IoUring::Available()) {
+    // Creating the ring or pinning its buffers can still fail at runtime, for
+    // example once the registered buffers of many connections exceed
+    // RLIMIT_MEMLOCK. The blocking loop below works in every case.
+    auto ring = IoUring::Create(8);
+    if (!ring.ok()) {
+      LogBlockingFallback(ring.error().message());
+      return CF_EXPECT(BlockingForwardStream(from, to));
+    }
+    if (IsStreamSocket(from) && IoUring::RecvMultishotAvailable()) {
+      auto buffers = IoUringBufferRing::Create(
+          *ring, kSocketBufferGroup, kSocketBufferCount, kSocketBufferSize);
+      if (buffers.ok()) {
+        return CF_EXPECT(ForwardProvided(*ring, **buffers, from, to));
+      }
+    }
+    std::vector<char> storage(2 * kStreamBufferSize);
+    RegisteredBuffers registered(*ring);
+    auto registration = registered.Register(StreamBuffers(storage));
+    if (registration.ok()) {
+      return CF_EXPECT(ForwardRegistered(*ring, storage, from, to));
+    }
+    LogBlockingFallback(registration.error().message());
+  }
+  return CF_EXPECT(BlockingForwardStream(from, to));
+}
+
+}  // namespace cuttlefish
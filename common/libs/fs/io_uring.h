@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+struct IoCompletion {
+  std::uint64_t user_data;
+  // Bytes transferred or a negative errno value.
+  std::int32_t result;
+  std::uint32_t flags;
+
+  // Whether the operation picked a buffer from a provided buffer ring.
+  bool HasBuffer() const { return flags & IORING_CQE_F_BUFFER; }
+  std::uint16_t BufferId() const { return flags >> IORING_CQE_BUFFER_SHIFT; }
+  // Set while a multishot operation stays armed after this completion.
+  bool More() const { return flags & IORING_CQE_F_MORE; }
+};
+
+/**
+ * Minimal io_uring wrapper used to move bulk data with fewer syscalls than
+ * the blocking SharedFD calls.
+ *
+ * Operations are queued with the Prepare* functions and handed to the kernel
+ * in a single io_uring_enter call by Submit or Reap. Passing kLink in the
+ * flags chains the operation with the next one, which starts only once this
+ * one completes in full.
+ *
+ * Not thread safe: every thread should use its own instance. The kernel may
+ * not support io_uring or a seccomp policy may block it, callers should check
+ * Available() and fall back to the blocking SharedFD calls.
+ */
+class IoUring {
+ public:
+  // Offset meaning "the current file position", required for sockets and
+  // pipes.
+  static constexpr std::uint64_t kCurrentPosition = -1;
+  static constexpr unsigned kLink = IOSQE_IO_LINK;
+
+  static Result<IoUring> Create(unsigned entries);
+  // Whether an io_uring instance can be created in this process.
+  static bool Available();
+  // Whether multishot receives into provided buffer rings work (Linux 6.0+).
+  static bool RecvMultishotAvailable();
+
+  IoUring(IoUring&&);
+  IoUring& operator=(IoUring&&);
+  ~IoUring();
+
+  /**
+   * Pins the buffers for use with the *Fixed operations, which skip the page
+   * lookups of regular reads and writes. Buffers are referred to by their
+   * index in the vector.
+   */
+  Result<void> RegisterBuffers(const std::vector<struct iovec>& buffers);
+  Result<void> UnregisterBuffers();
+
+  Result<void> PrepareRead(SharedFD fd, void* buffer, unsigned length,
+                           std::uint64_t offset, std::uint64_t user_data,
+                           unsigned flags = 0);
+  Result<void> PrepareWrite(SharedFD fd, const void* buffer, unsigned length,
+                            std::uint64_t offset, std::uint64_t user_data,
+                            unsigned flags = 0);
+  Result<void> PrepareReadFixed(SharedFD fd, void* buffer, unsigned length,
+                                std::uint64_t offset,
+                                std::uint16_t buffer_index,
+                                std::uint64_t user_data, unsigned flags = 0);
+  Result<void> PrepareWriteFixed(SharedFD fd, const void* buffer,
+                                 unsigned length, std::uint64_t offset,
+                                 std::uint16_t buffer_index,
+                                 std::uint64_t user_data, unsigned flags = 0);
+  /**
+   * Receives from a stream socket into buffers of `group` as data arrives,
+   * producing one completion per buffer filled until one comes without
+   * More(). That happens on EOF, on errors and with -ENOBUFS when the group
+   * ran out of buffers, after which the receive has to be prepared again.
+   */
+  Result<void> PrepareRecvMultishot(SharedFD fd, std::uint16_t group,
+                                    std::uint64_t user_data);
+  // Sends the queued operations to the kernel and optionally waits for some
+  // completions. Returns the number of operations submitted.
+  Result<unsigned> Submit(unsigned wait_for = 0);
+  // Submits queued operations and returns at least min_completions results.
+  // Fails instead of blocking forever when fewer operations are in flight.
+  Result<std::vector<IoCompletion>> Reap(unsigned min_completions);
+  /**
+   * Cancels the operations with the given user_data and waits for every
+   * operation in flight to complete, after which the kernel no longer uses
+   * their buffers. Operations queued but not submitted yet are dropped.
+   */
+  Result<void> CancelAndDrain(const std::vector<std::uint64_t>& user_data);
+
+ private:
+  friend class IoUringBufferRing;
+
+  IoUring() = default;
+
+  Result<struct io_uring_sqe*> NextSqe();
+  Result<void> PrepareRw(int opcode, SharedFD fd, const void* buffer,
+                         unsigned length, std::uint64_t offset,
+                         std::uint64_t user_data, unsigned flags);
+  void Release();
+
+  int ring_fd_ = -1;
+  void* sq_ring_ = nullptr;
+  std::size_t sq_ring_size_ = 0;
+  void* cq_ring_ = nullptr;
+  std::size_t cq_ring_size_ = 0;
+  struct io_uring_sqe* sqes_ = nullptr;
+  std::size_t sqes_size_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  struct io_uring_cqe* cqes_ = nullptr;
+
+  // Queued operations not yet visible to the kernel.
+  unsigned sqe_tail_ = 0;
+  unsigned sqe_submitted_ = 0;
+  // Operations queued or submitted whose completion wasn't reaped yet.
+  unsigned in_flight_ = 0;
+};
+
+/**
+ * Buffers the kernel picks from for receives of one group, returned with
+ * Recycle once their data was consumed. Unlike registered buffers they are
+ * not pinned, so they don't count against RLIMIT_MEMLOCK.
+ */
+class IoUringBufferRing {
+ public:
+  // `count` must be a power of two.
+  static Result<std::unique_ptr<IoUringBufferRing>> Create(IoUring& ring,
+                                                           std::uint16_t group,
+                                                           unsigned count,
+                                                           unsigned size);
+  ~IoUringBufferRing();
+
+  char* Buffer(std::uint16_t id) { return storage_.data() + id * size_; }
+  unsigned BufferSize() const { return size_; }
+  // Makes the buffer available to the kernel again.
+  void Recycle(std::uint16_t id);
+
+ private:
+  IoUringBufferRing(IoUring& ring, std::uint16_t group, unsigned count,
+                    unsigned size);
+
+  IoUring& ring_;
+  std::uint16_t group_;
+  unsigned count_;
+  unsigned size_;
+  std::vector<char> storage_;
+  void* entries_ = nullptr;
+  std::size_t entries_size_ = 0;
+  bool registered_ = false;
+  std::uint16_t tail_ = 0;
+};
+
+/**
+ * Copies from a stream (socket or pipe) until EOF, keeping a read and a
+ * write in flight at the same time in registered buffers.
+ */
+Result<std::uint64_t> IoUringForwardStream(IoUring& ring, SharedFD from,
+                                           SharedFD to);
+/**
+ * Copies from a stream socket until EOF with a single multishot receive into
+ * a buffer ring, which keeps receiving while earlier data is written out.
+ * Requires RecvMultishotAvailable().
+ */
+Result<std::uint64_t> IoUringForwardSocket(IoUring& ring, SharedFD from,
+                                           SharedFD to);
+/**
+ * Copies `size` bytes from the start of `from` to the start of `to` with
+ * linked read and write pairs, several pairs in flight. Short reads and
+ * writes are resubmitted for the remainder of their chunk.
+ */
+Result<std::uint64_t> IoUringCopyFile(IoUring& ring, SharedFD from,
+                                      SharedFD to, std::uint64_t size);
+
+/**
+ * Copies from a stream until EOF, with io_uring when available and with
+ * blocking reads and writes otherwise. Stream sockets use a multishot
+ * receive when the kernel supports it.
+ */
+Result<std::uint64_t> ForwardStream(SharedFD from, SharedFD to);
+
+}  // namespace cuttlefish
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "common/libs/fs/io_uring.h"
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kStreamBytes = 64 * 1024 * 1024;
+constexpr std::size_t kFileBytes = 64 * 1024 * 1024;
+
+// Pushes kStreamBytes through a proxy built from two socket pairs, the same
+// shape as socket2socket_proxy, with `forward` copying between them.
+template <typename Forward>
+void RunStream(benchmark::State& state, Forward forward) {
+  std::vector<char> chunk(64 * 1024, 'x');
+  for (auto _ : state) {
+    SharedFD producer, proxy_in, proxy_out, consumer;
+    CHECK(SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &producer, &proxy_in));
+    CHECK(SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &proxy_out, &consumer));
+    std::thread writer([&]() {
+      for (std::size_t sent = 0; sent < kStreamBytes; sent += chunk.size()) {
+        WriteAll(producer, chunk.data(), chunk.size());
+      }
+      producer->Shutdown(SHUT_WR);
+    });
+    std::thread reader([&]() {
+      std::vector<char> buffer(64 * 1024);
+      while (consumer->Read(buffer.data(), buffer.size()) > 0) {
+      }
+    });
+    forward(proxy_in, proxy_out);
+    proxy_out->Shutdown(SHUT_WR);
+    writer.join();
+    reader.join();
+  }
+  state.SetBytesProcessed(state.iterations() * kStreamBytes);
+}
+
+void BM_StreamBlocking(benchmark::State& state) {
+  RunStream(state, [](SharedFD from, SharedFD to) {
+    CHECK(to->CopyAllFrom(*from));
+  });
+}
+BENCHMARK(BM_StreamBlocking)->UseRealTime();
+
+void BM_StreamIoUring(benchmark::State& state) {
+  if (!IoUring::Available()) {
+    state.SkipWithError("io_uring is not available");
+    return;
+  }
+  RunStream(state, [](SharedFD from, SharedFD to) {
+    auto ring = IoUring::Create(8);
+    CHECK(ring.ok()) << ring.error().message();
+    CHECK(IoUringForwardStream(*ring, from, to).ok());
+  });
+}
+BENCHMARK(BM_StreamIoUring)->UseRealTime();
+
+void BM_StreamIoUringMultishot(benchmark::State& state) {
+  if (!IoUring::RecvMultishotAvailable()) {
+    state.SkipWithError("Multishot receive is not available");
+    return;
+  }
+  RunStream(state, [](SharedFD from, SharedFD to) {
+    auto ring = IoUring::Create(8);
+    CHECK(ring.ok()) << ring.error().message();
+    CHECK(IoUringForwardSocket(*ring, from, to).ok());
+  });
+}
+BENCHMARK(BM_StreamIoUringMultishot)->UseRealTime();
+
+struct FilePair {
+  FilePair() {
+    from = SharedFD::Open(dir.path + std::string("/from"),
+                          O_RDWR | O_CREAT | O_TRUNC, 0600);
+    to = SharedFD::Open(dir.path + std::string("/to"),
+                        O_RDWR | O_CREAT | O_TRUNC, 0600);
+    std::vector<char> chunk(1024 * 1024, 'x');
+    for (std::size_t written = 0; written < kFileBytes;
+         written += chunk.size()) {
+      WriteAll(from, chunk.data(), chunk.size());
+    }
+  }
+
+  TemporaryDir dir;
+  SharedFD from;
+  SharedFD to;
+};
+
+void BM_FileBlocking(benchmark::State& state) {
+  FilePair files;
+  for (auto _ : state) {
+    files.from->LSeek(0, SEEK_SET);
+    files.to->LSeek(0, SEEK_SET);
+    CHECK(files.to->CopyAllFrom(*files.from));
+  }
+  state.SetBytesProcessed(state.iterations() * kFileBytes);
+}
+BENCHMARK(BM_FileBlocking)->UseRealTime();
+
+void BM_FileIoUring(benchmark::State& state) {
+  if (!IoUring::Available()) {
+    state.SkipWithError("io_uring is not available");
+    return;
+  }
+  FilePair files;
+  auto ring = IoUring::Create(16);
+  CHECK(ring.ok()) << ring.error().message();
+  for (auto _ : state) {
+    CHECK(IoUringCopyFile(*ring, files.from, files.to, kFileBytes).ok());
+  }
+  state.SetBytesProcessed(state.iterations() * kFileBytes);
+}
+BENCHMARK(BM_FileIoUring)->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
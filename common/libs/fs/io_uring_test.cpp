@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/fs/io_uring.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace {
+
+// Spans several of the chunks IoUringCopyFile copies at once, plus a partial
+// one.
+constexpr std::size_t kCopySize = 3 * 1024 * 1024 + 123;
+
+std::vector<char> Pattern(std::size_t size) {
+  std::vector<char> data(size);
+  for (std::size_t i = 0; i < size; i++) {
+    data[i] = static_cast<char>(i * 7 + i / 4096);
+  }
+  return data;
+}
+
+class IoUringTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    if (!IoUring::Available()) {
+      GTEST_SKIP() << "io_uring is not available";
+    }
+    auto ring = IoUring::Create(16);
+    ASSERT_TRUE(ring.ok()) << ring.error();
+    ring_ = std::make_unique<IoUring>(std::move(*ring));
+  }
+
+  SharedFD OpenFile(const std::string& name, const std::vector<char>& data) {
+    auto fd = SharedFD::Open(std::string(dir_.path) + "/" + name,
+                             O_RDWR | O_CREAT | O_TRUNC, 0644);
+    EXPECT_TRUE(fd->IsOpen()) << fd->StrError();
+    EXPECT_EQ(WriteAll(fd, data.data(), data.size()),
+              static_cast<ssize_t>(data.size()));
+    return fd;
+  }
+
+  std::vector<char> Contents(SharedFD fd, std::size_t size) {
+    std::vector<char> data(size);
+    EXPECT_EQ(fd->LSeek(0, SEEK_SET), 0);
+    EXPECT_EQ(ReadExact(fd, data.data(), size), static_cast<ssize_t>(size));
+    return data;
+  }
+
+  TemporaryDir dir_;
+  std::unique_ptr<IoUring> ring_;
+};
+
+TEST_F(IoUringTest, ReapFailsWithNothingInFlight) {
+  EXPECT_FALSE(ring_->Reap(1).ok());
+}
+
+TEST_F(IoUringTest, ReapFailsWaitingForMoreThanInFlight) {
+  SharedFD read, write;
+  ASSERT_TRUE(SharedFD::Pipe(&read, &write));
+  char byte = 'x';
+  ASSERT_TRUE(
+      ring_->PrepareWrite(write, &byte, 1, IoUring::kCurrentPosition, 1).ok());
+  EXPECT_FALSE(ring_->Reap(2).ok());
+  auto completions = ring_->Reap(1);
+  ASSERT_TRUE(completions.ok()) << completions.error();
+  ASSERT_EQ(completions->size(), 1u);
+  EXPECT_EQ((*completions)[0].result, 1);
+  EXPECT_FALSE(ring_->Reap(1).ok());
+}
+
+TEST_F(IoUringTest, FixedBufferReadAndWrite) {
+  auto file = OpenFile("fixed", {});
+  auto expected = Pattern(8192);
+  std::vector<char> write_buffer = expected;
+  std::vector<char> read_buffer(expected.size());
+  ASSERT_TRUE(ring_
+                  ->RegisterBuffers({{write_buffer.data(), write_buffer.size()},
+                                     {read_buffer.data(), read_buffer.size()}})
+                  .ok());
+
+  ASSERT_TRUE(ring_
+                  ->PrepareWriteFixed(file, write_buffer.data(),
+                                      write_buffer.size(), 0, 0, 1,
+                                      IoUring::kLink)
+                  .ok());
+  ASSERT_TRUE(ring_
+                  ->PrepareReadFixed(file, read_buffer.data(),
+                                     read_buffer.size(), 0, 1, 2)
+                  .ok());
+  auto completions = ring_->Reap(2);
+  ASSERT_TRUE(completions.ok()) << completions.error();
+  ASSERT_EQ(completions->size(), 2u);
+  for (const auto& completion : *completions) {
+    EXPECT_EQ(completion.result, static_cast<int>(expected.size()))
+        << "user_data " << completion.user_data;
+  }
+  EXPECT_EQ(read_buffer, expected);
+  EXPECT_TRUE(ring_->UnregisterBuffers().ok());
+}
+
+TEST_F(IoUringTest, CopyFile) {
+  auto expected = Pattern(kCopySize);
+  auto from = OpenFile("from", expected);
+  auto to = OpenFile("to", {});
+  auto copied = IoUringCopyFile(*ring_, from, to, kCopySize);
+  ASSERT_TRUE(copied.ok()) << copied.error();
+  EXPECT_EQ(*copied, kCopySize);
+  EXPECT_EQ(Contents(to, kCopySize), expected);
+}
+
+TEST_F(IoUringTest, CopyFileFailsWhenSourceIsShort) {
+  auto from = OpenFile("from", Pattern(kCopySize / 2));
+  auto to = OpenFile("to", {});
+  EXPECT_FALSE(IoUringCopyFile(*ring_, from, to, kCopySize).ok());
+}
+
+TEST_F(IoUringTest, CopyFileResubmitsShortReads) {
+  // Reads from a pipe return whatever was written so far, well short of the
+  // requested length. Pipe reads aren't positioned, so the copy is kept
+  // within a single chunk for the data to land in order.
+  constexpr std::size_t kSize = 200 * 1000;
+  SharedFD read, write;
+  ASSERT_TRUE(SharedFD::Pipe(&read, &write));
+  auto expected = Pattern(kSize);
+  std::thread writer([&write, &expected]() {
+    constexpr std::size_t kPiece = 1000;
+    for (std::size_t i = 0; i < expected.size(); i += kPiece) {
+      ASSERT_EQ(WriteAll(write, expected.data() + i, kPiece),
+                static_cast<ssize_t>(kPiece));
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+  auto to = OpenFile("to", {});
+  auto copied = IoUringCopyFile(*ring_, read, to, kSize);
+  writer.join();
+  ASSERT_TRUE(copied.ok()) << copied.error();
+  EXPECT_EQ(*copied, kSize);
+  EXPECT_EQ(Contents(to, kSize), expected);
+}
+
+TEST_F(IoUringTest, CopyFileResubmitsShortWrites) {
+  // A write crossing the file size limit stops at the limit, the resubmitted
+  // remainder then fails with EFBIG instead of being silently dropped. The
+  // copy fits in one chunk so that the first write is the short one.
+  constexpr std::size_t kSize = 200 * 1000;
+  constexpr rlim_t kLimit = kSize / 2 + 17;
+  auto expected = Pattern(kSize);
+  auto from = OpenFile("from", expected);
+  auto to = OpenFile("to", {});
+  struct rlimit old_limit;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+  struct rlimit limit = old_limit;
+  limit.rlim_cur = kLimit;
+  auto old_handler = signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+  auto copied = IoUringCopyFile(*ring_, from, to, kSize);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &old_limit), 0);
+  signal(SIGXFSZ, old_handler);
+
+  ASSERT_FALSE(copied.ok());
+  EXPECT_NE(copied.error().message().find(strerror(EFBIG)), std::string::npos)
+      << copied.error().message();
+  EXPECT_EQ(to->LSeek(0, SEEK_END), static_cast<off_t>(kLimit));
+  auto contents = Contents(to, kLimit);
+  EXPECT_TRUE(std::equal(contents.begin(), contents.end(), expected.begin()));
+}
+
+TEST_F(IoUringTest, ForwardStream) {
+  SharedFD from_read, from_write, to_read, to_write;
+  ASSERT_TRUE(SharedFD::Pipe(&from_read, &from_write));
+  ASSERT_TRUE(SharedFD::Pipe(&to_read, &to_write));
+  auto expected = Pattern(kCopySize);
+  std::thread writer([&from_write, &expected]() {
+    ASSERT_EQ(WriteAll(from_write, expected.data(), expected.size()),
+              static_cast<ssize_t>(expected.size()));
+    from_write->Close();
+  });
+  std::vector<char> received(expected.size());
+  std::thread reader([&to_read, &received]() {
+    ASSERT_EQ(ReadExact(to_read, received.data(), received.size()),
+              static_cast<ssize_t>(received.size()));
+  });
+  auto forwarded = IoUringForwardStream(*ring_, from_read, to_write);
+  writer.join();
+  reader.join();
+  ASSERT_TRUE(forwarded.ok()) << forwarded.error();
+  EXPECT_EQ(*forwarded, kCopySize);
+  EXPECT_EQ(received, expected);
+}
+
+TEST_F(IoUringTest, ForwardStreamResubmitsShortWrites) {
+  // A non blocking socket with a small send buffer accepts a fraction of each
+  // write while the other end reads slowly.
+  SharedFD from_read, from_write, to_write, to_read;
+  ASSERT_TRUE(SharedFD::Pipe(&from_read, &from_write));
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &to_write, &to_read));
+  int sndbuf = 4096;
+  ASSERT_EQ(to_write->SetSockOpt(SOL_SOCKET, SO_SNDBUF, &sndbuf,
+                                 sizeof(sndbuf)),
+            0);
+  ASSERT_EQ(to_write->Fcntl(F_SETFL, O_NONBLOCK), 0);
+  auto expected = Pattern(kCopySize);
+  std::thread writer([&from_write, &expected]() {
+    ASSERT_EQ(WriteAll(from_write, expected.data(), expected.size()),
+              static_cast<ssize_t>(expected.size()));
+    from_write->Close();
+  });
+  std::vector<char> received;
+  std::thread reader([&to_read, &received]() {
+    char buffer[1500];
+    for (;;) {
+      auto read = to_read->Read(buffer, sizeof(buffer));
+      ASSERT_GE(read, 0) << to_read->StrError();
+      if (read == 0) {
+        return;
+      }
+      received.insert(received.end(), buffer, buffer + read);
+    }
+  });
+  auto forwarded = IoUringForwardStream(*ring_, from_read, to_write);
+  to_write->Close();
+  writer.join();
+  reader.join();
+  ASSERT_TRUE(forwarded.ok()) << forwarded.error();
+  EXPECT_EQ(*forwarded, kCopySize);
+  EXPECT_EQ(received, expected);
+}
+
+TEST_F(IoUringTest, ForwardStreamCancelsReadOnWriteFailure) {
+  // The destination's peer goes away while the source stays open without
+  // data, the read still in flight has to be cancelled before returning.
+  SharedFD from_read, from_write, to_write, to_read;
+  ASSERT_TRUE(SharedFD::Pipe(&from_read, &from_write));
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &to_write, &to_read));
+  to_read->Close();
+  auto old_handler = signal(SIGPIPE, SIG_IGN);
+  char byte = 'x';
+  ASSERT_EQ(WriteAll(from_write, &byte, 1), 1);
+  auto forwarded = IoUringForwardStream(*ring_, from_read, to_write);
+  signal(SIGPIPE, old_handler);
+  EXPECT_FALSE(forwarded.ok());
+  // Nothing was left behind in the ring.
+  EXPECT_FALSE(ring_->Reap(1).ok());
+}
+
+TEST_F(IoUringTest, ForwardSocket) {
+  if (!IoUring::RecvMultishotAvailable()) {
+    GTEST_SKIP() << "Multishot receive is not available";
+  }
+  SharedFD from_write, from_read, to_read, to_write;
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &from_write, &from_read));
+  ASSERT_TRUE(SharedFD::Pipe(&to_read, &to_write));
+  auto expected = Pattern(kCopySize);
+  std::thread writer([&from_write, &expected]() {
+    ASSERT_EQ(WriteAll(from_write, expected.data(), expected.size()),
+              static_cast<ssize_t>(expected.size()));
+    from_write->Close();
+  });
+  std::vector<char> received(expected.size());
+  std::thread reader([&to_read, &received]() {
+    ASSERT_EQ(ReadExact(to_read, received.data(), received.size()),
+              static_cast<ssize_t>(received.size()));
+  });
+  auto forwarded = IoUringForwardSocket(*ring_, from_read, to_write);
+  writer.join();
+  reader.join();
+  ASSERT_TRUE(forwarded.ok()) << forwarded.error();
+  EXPECT_EQ(*forwarded, kCopySize);
+  EXPECT_EQ(received, expected);
+}
+
+TEST_F(IoUringTest, ForwardSocketRearmsWhenOutOfBuffers) {
+  // A slow destination leaves every provided buffer waiting to be written,
+  // which ends the multishot receive with -ENOBUFS.
+  if (!IoUring::RecvMultishotAvailable()) {
+    GTEST_SKIP() << "Multishot receive is not available";
+  }
+  SharedFD from_write, from_read, to_write, to_read;
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &from_write, &from_read));
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &to_write, &to_read));
+  int sndbuf = 4096;
+  ASSERT_EQ(to_write->SetSockOpt(SOL_SOCKET, SO_SNDBUF, &sndbuf,
+                                 sizeof(sndbuf)),
+            0);
+  auto expected = Pattern(kCopySize);
+  std::thread writer([&from_write, &expected]() {
+    ASSERT_EQ(WriteAll(from_write, expected.data(), expected.size()),
+              static_cast<ssize_t>(expected.size()));
+    from_write->Close();
+  });
+  std::vector<char> received;
+  std::thread reader([&to_read, &received]() {
+    char buffer[1500];
+    for (;;) {
+      auto read = to_read->Read(buffer, sizeof(buffer));
+      ASSERT_GE(read, 0) << to_read->StrError();
+      if (read == 0) {
+        return;
+      }
+      received.insert(received.end(), buffer, buffer + read);
+    }
+  });
+  auto forwarded = IoUringForwardSocket(*ring_, from_read, to_write);
+  to_write->Close();
+  writer.join();
+  reader.join();
+  ASSERT_TRUE(forwarded.ok()) << forwarded.error();
+  EXPECT_EQ(*forwarded, kCopySize);
+  EXPECT_EQ(received, expected);
+}
+
+TEST_F(IoUringTest, ForwardSocketCancelsReceiveOnWriteFailure) {
+  if (!IoUring::RecvMultishotAvailable()) {
+    GTEST_SKIP() << "Multishot receive is not available";
+  }
+  SharedFD from_write, from_read, to_write, to_read;
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &from_write, &from_read));
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &to_write, &to_read));
+  to_read->Close();
+  auto old_handler = signal(SIGPIPE, SIG_IGN);
+  char byte = 'x';
+  ASSERT_EQ(WriteAll(from_write, &byte, 1), 1);
+  auto forwarded = IoUringForwardSocket(*ring_, from_read, to_write);
+  signal(SIGPIPE, old_handler);
+  EXPECT_FALSE(forwarded.ok());
+  EXPECT_FALSE(ring_->Reap(1).ok());
+}
+
+TEST(ForwardStreamTest, FallsBackWhenRingCantBeCreated) {
+  // Without free file descriptors io_uring_setup fails, the data still goes
+  // through the blocking loop. The payload fits in the pipe buffers so that
+  // no threads are needed.
+  SharedFD from_read, from_write, to_read, to_write;
+  ASSERT_TRUE(SharedFD::Pipe(&from_read, &from_write));
+  ASSERT_TRUE(SharedFD::Pipe(&to_read, &to_write));
+  auto expected = Pattern(4000);
+  ASSERT_EQ(WriteAll(from_write, expected.data(), expected.size()),
+            static_cast<ssize_t>(expected.size()));
+  from_write->Close();
+  struct rlimit old_limit;
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &old_limit), 0);
+  struct rlimit limit = old_limit;
+  limit.rlim_cur = 0;
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+  auto forwarded = ForwardStream(from_read, to_write);
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &old_limit), 0);
+
+  ASSERT_TRUE(forwarded.ok()) << forwarded.error();
+  EXPECT_EQ(*forwarded, expected.size());
+  std::vector<char> received(expected.size());
+  ASSERT_EQ(ReadExact(to_read, received.data(), received.size()),
+            static_cast<ssize_t>(received.size()));
+  EXPECT_EQ(received, expected);
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -624,6 +624,19 @@ ScopedMMap::ScopedMMap(ScopedMMap&& other)
   other.len_ = 0;
 }
 
+ScopedMMap& ScopedMMap::operator=(ScopedMMap&& other) {
+  if (this != &other) {
+    if (ptr_ != MAP_FAILED) {
+      munmap(ptr_, len_);
+    }
+    ptr_ = other.ptr_;
+    len_ = other.len_;
+    other.ptr_ = MAP_FAILED;
+    other.len_ = 0;
+  }
+  return *this;
+}
+
 ScopedMMap::~ScopedMMap() {
   if (ptr_ != MAP_FAILED) {
     munmap(ptr_, len_);
@@ -205,6 +205,7 @@ class ScopedMMap {
   ScopedMMap(const ScopedMMap& other) = delete;
   ScopedMMap& operator=(const ScopedMMap& other) = delete;
   ScopedMMap(ScopedMMap&& other);
+  ScopedMMap& operator=(ScopedMMap&& other);
 
   ~ScopedMMap();
 
@@ -236,6 +237,7 @@ class FileInstance {
   // Give SharedFD access to the aliasing constructor.
   friend class SharedFD;
   friend class Epoll;
+  friend class IoUring;
 
  public:
   virtual ~FileInstance() { Close(); }
@@ -193,6 +193,24 @@ std::chrono::system_clock::time_point FileModificationTime(const std::string& pa
   return std::chrono::system_clock::time_point(seconds);
 }
 
+static std::int64_t ToNanoseconds(const struct timespec& time) {
+  return static_cast<std::int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+std::optional<FileFingerprint> GetFileFingerprint(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return {};
+  }
+  FileFingerprint fingerprint;
+  fingerprint.device = st.st_dev;
+  fingerprint.inode = st.st_ino;
+  fingerprint.size = st.st_size;
+  fingerprint.mtime_ns = ToNanoseconds(st.st_mtim);
+  fingerprint.ctime_ns = ToNanoseconds(st.st_ctim);
+  return fingerprint;
+}
+
 bool RenameFile(const std::string& old_name, const std::string& new_name) {
   LOG(DEBUG) << "Renaming " << old_name << " to " << new_name;
   if(rename(old_name.c_str(), new_name.c_str())) {
@@ -44,9 +44,11 @@
 #include <vector>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 
 #include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
 #include "common/libs/utils/subprocess.h"
 
 namespace cuttlefish {
@@ -98,6 +100,11 @@ bool ParseIpAddress(const std::string& address, std::uint8_t ip[4]) {
 }  // namespace
 
 SharedFD OpenTapInterface(const std::string& interface_name) {
+  return OpenTapInterface(interface_name, TapOptions());
+}
+
+SharedFD OpenTapInterface(const std::string& interface_name,
+                          const TapOptions& options) {
   constexpr auto TUNTAP_DEV = "/dev/net/tun";
 
   auto tap_fd = SharedFD::Open(TUNTAP_DEV, O_RDWR | O_NONBLOCK);
@@ -109,6 +116,14 @@ SharedFD OpenTapInterface(const std::string& interface_name) {
   struct ifreq ifr;
   memset(&ifr, 0, sizeof(ifr));
   ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+  // The kernel refuses to attach to an existing interface unless this matches
+  // the way it was created.
+  bool multi_queue = NetworkInterfaceExists(interface_name)
+                         ? IsMultiQueueTap(interface_name)
+                         : options.queues > 1;
+  if (multi_queue) {
+    ifr.ifr_flags |= IFF_MULTI_QUEUE;
+  }
   strncpy(ifr.ifr_name, interface_name.c_str(), IFNAMSIZ);
 
   int err = tap_fd->Ioctl(TUNSETIFF, &ifr);
@@ -123,14 +138,42 @@ SharedFD OpenTapInterface(const std::string& interface_name) {
   // correctly on creation. While qemu checks this and enforces the right
   // configuration, crosvm does not, so it needs to be set before it's passed to
   // it.
-  tap_fd->Ioctl(TUNSETOFFLOAD,
-                reinterpret_cast<void*>(TUN_F_CSUM | TUN_F_UFO | TUN_F_TSO4 |
-                                        TUN_F_TSO6));
+  unsigned long offloads = 0;
+  if (options.offloads) {
+    offloads = TUN_F_CSUM | TUN_F_UFO | TUN_F_TSO4 | TUN_F_TSO6;
+  }
+  tap_fd->Ioctl(TUNSETOFFLOAD, reinterpret_cast<void*>(offloads));
   int len = SIZE_OF_VIRTIO_NET_HDR_V1;
   tap_fd->Ioctl(TUNSETVNETHDRSZ, &len);
+  if (options.sndbuf > 0) {
+    int sndbuf = options.sndbuf;
+    if (tap_fd->Ioctl(TUNSETSNDBUF, &sndbuf) < 0) {
+      LOG(WARNING) << "Unable to set the send buffer of " << interface_name
+                   << ": " << tap_fd->StrError();
+    }
+  }
   return tap_fd;
 }
 
+bool NetworkInterfaceExists(const std::string& interface_name) {
+  return DirectoryExists("/sys/class/net/" + interface_name);
+}
+
+bool IsMultiQueueTap(const std::string& interface_name) {
+  auto flags_path = "/sys/class/net/" + interface_name + "/tun_flags";
+  if (!FileExists(flags_path)) {
+    return false;
+  }
+  unsigned int flags = 0;
+  auto flags_str = android::base::Trim(ReadFile(flags_path));
+  if (!android::base::ParseUint(flags_str, &flags)) {
+    LOG(WARNING) << "Unexpected contents of " << flags_path << ": \""
+                 << flags_str << "\"";
+    return false;
+  }
+  return (flags & IFF_MULTI_QUEUE) != 0;
+}
+
 std::set<std::string> TapInterfacesInUse() {
   Command cmd("/bin/bash");
   cmd.AddParameter("-c");
@@ -24,10 +24,31 @@
 #include "common/libs/fs/shared_fd.h"
 
 namespace cuttlefish {
+
+struct TapOptions {
+  // Segmentation and checksum offloads the guest is allowed to hand over.
+  bool offloads = true;
+  // Bytes of packets sent by the guest the queue may have queued, 0 keeps the
+  // kernel's default, which is unlimited.
+  int sndbuf = 0;
+  // Queue pairs the device will use. Interfaces created by OpenTapInterface are
+  // created as multi queue when more than one is requested.
+  int queues = 1;
+};
+
 // Creates, or connects to if it already exists, a tap network interface. The
 // user needs CAP_NET_ADMIN to create such interfaces or be the owner to connect
-// to one.
+// to one. Interfaces created as multi queue are attached as one more queue.
 SharedFD OpenTapInterface(const std::string& interface_name);
+SharedFD OpenTapInterface(const std::string& interface_name,
+                          const TapOptions& options);
+
+// Whether a network interface with that name exists on the host.
+bool NetworkInterfaceExists(const std::string& interface_name);
+
+// Whether the tap interface was created with IFF_MULTI_QUEUE, as done by
+// `ip tuntap add ... multi_queue`. Only those can have more than one queue.
+bool IsMultiQueueTap(const std::string& interface_name);
 
 // Returns a list of TAP devices that have open file descriptors
 std::set<std::string> TapInterfacesInUse();
@@ -27,18 +27,15 @@
 
 #include <android-base/logging.h>
 
+#include "common/libs/fs/io_uring.h"
+
 namespace cuttlefish {
 namespace {
 
 void Forward(const std::string& label, SharedFD from, SharedFD to) {
-  auto success = to->CopyAllFrom(*from);
-  if (!success) {
-    if (from->GetErrno()) {
-      LOG(ERROR) << label << ": Error reading: " << from->StrError();
-    }
-    if (to->GetErrno()) {
-      LOG(ERROR) << label << ": Error writing: " << to->StrError();
-    }
+  auto forwarded = ForwardStream(from, to);
+  if (!forwarded.ok()) {
+    LOG(ERROR) << label << ": " << forwarded.error().message();
   }
   to->Shutdown(SHUT_WR);
   LOG(DEBUG) << label << " completed";
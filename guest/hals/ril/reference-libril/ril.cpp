@@ -58,6 +58,8 @@ namespace android {
 #define BLUETOOTH_PROCESS "bluetooth"
 
 #define ANDROID_WAKE_LOCK_NAME "radio-interface"
+// Held while coalesced unsolicited responses wait for delivery
+#define ANDROID_COALESCE_WAKE_LOCK_NAME "radio-interface-coalesce"
 
 #define ANDROID_WAKE_LOCK_SECS 0
 #define ANDROID_WAKE_LOCK_USECS 200000
@@ -682,12 +684,18 @@ grabPartialWakeLock() {
         int ret;
         ret = pthread_mutex_lock(&s_wakeLockCountMutex);
         assert(ret == 0);
-        acquire_wake_lock(PARTIAL_WAKE_LOCK, ANDROID_WAKE_LOCK_NAME);
+        // The lock is held whenever the count is non-zero, so a burst of
+        // responses only writes to sysfs for the first one.
+        if (s_wakelock_count == 0) {
+            acquire_wake_lock(PARTIAL_WAKE_LOCK, ANDROID_WAKE_LOCK_NAME);
+        }
 
         UserCallbackInfo *p_info =
                 internalRequestTimedCallback(wakeTimeoutCallback, NULL, &TIMEVAL_WAKE_TIMEOUT);
         if (p_info == NULL) {
-            release_wake_lock(ANDROID_WAKE_LOCK_NAME);
+            if (s_wakelock_count == 0) {
+                release_wake_lock(ANDROID_WAKE_LOCK_NAME);
+            }
         } else {
             s_wakelock_count++;
             if (s_last_wake_timeout_info != NULL) {
@@ -749,57 +757,16 @@ wakeTimeoutCallback (void *param) {
     }
 }
 
-#if defined(ANDROID_MULTI_SIM)
-extern "C"
-void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
-                                size_t datalen, RIL_SOCKET_ID socket_id)
-#else
-extern "C"
-void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
-                                size_t datalen)
-#endif
-{
-    int unsolResponseIndex;
-    int ret;
+static void
+deliverUnsolicitedResponse(int unsolResponse, UnsolResponseInfo *pURI,
+                                const void *data, size_t datalen, RIL_SOCKET_ID soc_id) {
+    int ret = 0;
     bool shouldScheduleTimeout = false;
-    RIL_SOCKET_ID soc_id = RIL_SOCKET_1;
-    UnsolResponseInfo *pURI = NULL;
-
-#if defined(ANDROID_MULTI_SIM)
-    soc_id = socket_id;
-#endif
-
-
-    if (s_registerCalled == 0) {
-        // Ignore RIL_onUnsolicitedResponse before RIL_register
-        RLOGW("RIL_onUnsolicitedResponse called before RIL_register");
-        return;
-    }
-
-    unsolResponseIndex = unsolResponse - RIL_UNSOL_RESPONSE_BASE;
-
-    if ((unsolResponse < RIL_UNSOL_RESPONSE_BASE)
-        || (unsolResponse > RIL_UNSOL_RESPONSE_LAST
-                && unsolResponse < RIL_UNSOL_RESPONSE_RADIO_CONFIG_BASE)
-        || (unsolResponse > RIL_UNSOL_RESPONSE_RADIO_CONFIG_LAST)) {
-        RLOGE("unsupported unsolicited response code %d", unsolResponse);
-        return;
-    }
-
-    if (unsolResponse >= RIL_UNSOL_RESPONSE_BASE
-            && unsolResponse <= RIL_UNSOL_RESPONSE_LAST) {
-        unsolResponseIndex = unsolResponse - RIL_UNSOL_RESPONSE_BASE;
-        pURI = &(s_unsolResponses[unsolResponseIndex]);
-    } else if (unsolResponse >= RIL_UNSOL_RESPONSE_RADIO_CONFIG_BASE
-            && unsolResponse <= RIL_UNSOL_RESPONSE_RADIO_CONFIG_LAST) {
-        unsolResponseIndex = unsolResponse - RIL_UNSOL_RESPONSE_RADIO_CONFIG_BASE;
-        pURI = &(s_configUnsolResponses[unsolResponseIndex]);
-    }
 
     // Grab a wake lock if needed for this reponse,
     // as we exit we'll either release it immediately
     // or set a timer to release it later.
-    switch (s_unsolResponses[unsolResponseIndex].wakeType) {
+    switch (pURI->wakeType) {
         case WAKE_PARTIAL:
             grabPartialWakeLock();
             shouldScheduleTimeout = true;
@@ -815,8 +782,7 @@ void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
     appendPrintBuf("[UNSL]< %s", requestToString(unsolResponse));
 
     int responseType;
-    if (s_callbacks.version >= 13
-                && s_unsolResponses[unsolResponseIndex].wakeType == WAKE_PARTIAL) {
+    if (s_callbacks.version >= 13 && pURI->wakeType == WAKE_PARTIAL) {
         responseType = RESPONSE_UNSOLICITED_ACK_EXP;
     } else {
         responseType = RESPONSE_UNSOLICITED;
@@ -835,7 +801,7 @@ void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
         assert(rwlockRet == 0);
     }
 
-    if (pURI != NULL && pURI->responseFunction != NULL) {
+    if (pURI->responseFunction != NULL) {
         ret = pURI->responseFunction((int) soc_id, responseType, 0, RIL_E_SUCCESS,
                 const_cast<void*>(data), datalen);
     } else {
@@ -896,6 +862,289 @@ error_exit:
     }
 }
 
+/* Coalescing of state-replacing unsolicited responses @{
+ *
+ * Each of these responses carries the complete current state (or none, when
+ * the framework queries it in return), so only the latest one of a burst
+ * matters. The first response of a type is delivered right away and opens a
+ * window; responses arriving within it replace each other and the last one is
+ * delivered when the window closes, which opens the next window.
+ */
+
+static void *copyFlatUnsolData(const void *data, size_t datalen);
+static void freeFlatUnsolData(void *data, size_t datalen);
+static void *copyDataCallList(const void *data, size_t datalen);
+static void freeDataCallList(void *data, size_t datalen);
+static void unsolCoalesceWindowCallback(void *param);
+
+typedef struct {
+    int unsolResponse;
+    struct timeval window;
+    void *(*copyFunction)(const void *data, size_t datalen);
+    void (*freeFunction)(void *data, size_t datalen);
+} UnsolCoalesceInfo;
+
+static const UnsolCoalesceInfo s_unsolCoalesceInfo[] = {
+    {RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED, {0, 200000},
+            copyFlatUnsolData, freeFlatUnsolData},
+    {RIL_UNSOL_RESPONSE_IMS_NETWORK_STATE_CHANGED, {0, 200000},
+            copyFlatUnsolData, freeFlatUnsolData},
+    {RIL_UNSOL_SIGNAL_STRENGTH, {1, 0}, copyFlatUnsolData, freeFlatUnsolData},
+    {RIL_UNSOL_DATA_CALL_LIST_CHANGED, {0, 200000}, copyDataCallList, freeDataCallList},
+    {RIL_UNSOL_CELL_INFO_LIST, {1, 0}, copyFlatUnsolData, freeFlatUnsolData},
+};
+
+#define NUM_COALESCED_UNSOLS NUM_ELEMS(s_unsolCoalesceInfo)
+
+// Effectiveness is logged every time this many more responses were dropped
+#define UNSOL_COALESCE_LOG_INTERVAL 100
+
+typedef struct {
+    bool windowOpen;
+    bool pending;       /* a response waits for the window to close */
+    void *data;
+    size_t datalen;
+    unsigned int received;
+    unsigned int delivered;
+    unsigned int dropped;
+} UnsolCoalesceState;
+
+static pthread_mutex_t s_unsolCoalesceMutex = PTHREAD_MUTEX_INITIALIZER;
+static UnsolCoalesceState s_unsolCoalesceState[SIM_COUNT][NUM_COALESCED_UNSOLS];
+// Number of pending responses, which share one wake lock until delivered
+static int s_unsolCoalescePendingCount = 0;
+
+// Copy functions are only called for responses with data
+static void *
+copyFlatUnsolData(const void *data, size_t datalen) {
+    void *copy = malloc(datalen);
+    if (copy != NULL) {
+        memcpy(copy, data, datalen);
+    }
+    return copy;
+}
+
+static void
+freeFlatUnsolData(void *data, size_t datalen) {
+    free(data);
+}
+
+static char *
+strdupOrNull(const char *s) {
+    return s == NULL ? NULL : strdup(s);
+}
+
+static void *
+copyDataCallList(const void *data, size_t datalen) {
+    if (datalen % sizeof(RIL_Data_Call_Response_v11) != 0) {
+        // Rejected by dataCallListChangedInd anyway
+        return copyFlatUnsolData(data, datalen);
+    }
+    RIL_Data_Call_Response_v11 *copy = (RIL_Data_Call_Response_v11 *)
+            copyFlatUnsolData(data, datalen);
+    if (copy == NULL) {
+        return NULL;
+    }
+    size_t num = datalen / sizeof(RIL_Data_Call_Response_v11);
+    for (size_t i = 0; i < num; i++) {
+        copy[i].type = strdupOrNull(copy[i].type);
+        copy[i].ifname = strdupOrNull(copy[i].ifname);
+        copy[i].addresses = strdupOrNull(copy[i].addresses);
+        copy[i].dnses = strdupOrNull(copy[i].dnses);
+        copy[i].gateways = strdupOrNull(copy[i].gateways);
+        copy[i].pcscf = strdupOrNull(copy[i].pcscf);
+    }
+    return copy;
+}
+
+static void
+freeDataCallList(void *data, size_t datalen) {
+    if (datalen % sizeof(RIL_Data_Call_Response_v11) == 0) {
+        RIL_Data_Call_Response_v11 *list = (RIL_Data_Call_Response_v11 *)data;
+        size_t num = datalen / sizeof(RIL_Data_Call_Response_v11);
+        for (size_t i = 0; i < num; i++) {
+            free(list[i].type);
+            free(list[i].ifname);
+            free(list[i].addresses);
+            free(list[i].dnses);
+            free(list[i].gateways);
+            free(list[i].pcscf);
+        }
+    }
+    freeFlatUnsolData(data, datalen);
+}
+
+static int
+unsolCoalesceIndex(int unsolResponse) {
+    for (size_t i = 0; i < NUM_COALESCED_UNSOLS; i++) {
+        if (s_unsolCoalesceInfo[i].unsolResponse == unsolResponse) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Returns true if the response was held back for the end of the window,
+ * false if it has to be delivered now.
+ */
+static bool
+coalesceUnsolicitedResponse(int index, const void *data, size_t datalen,
+                                RIL_SOCKET_ID soc_id) {
+    const UnsolCoalesceInfo *info = &s_unsolCoalesceInfo[index];
+    UnsolCoalesceState *state = &s_unsolCoalesceState[soc_id][index];
+    bool coalesced = false;
+
+    int ret = pthread_mutex_lock(&s_unsolCoalesceMutex);
+    assert(ret == 0);
+
+    state->received++;
+    if (!state->windowOpen) {
+        if (internalRequestTimedCallback(unsolCoalesceWindowCallback, state,
+                &info->window) != NULL) {
+            state->windowOpen = true;
+        }
+        state->delivered++;
+    } else {
+        void *copy = data != NULL ? info->copyFunction(data, datalen) : NULL;
+        if (data != NULL && copy == NULL) {
+            RLOGE("Memory allocation failed in coalesceUnsolicitedResponse");
+            state->delivered++;
+        } else {
+            if (state->pending) {
+                info->freeFunction(state->data, state->datalen);
+                state->dropped++;
+                if (state->dropped % UNSOL_COALESCE_LOG_INTERVAL == 0) {
+                    RLOGI("%s %s: coalesced %u responses into %u",
+                            rilSocketIdToString(soc_id),
+                            requestToString(info->unsolResponse),
+                            state->received, state->delivered);
+                }
+            } else {
+                state->pending = true;
+                if (s_unsolCoalescePendingCount++ == 0) {
+                    acquire_wake_lock(PARTIAL_WAKE_LOCK, ANDROID_COALESCE_WAKE_LOCK_NAME);
+                }
+            }
+            state->data = copy;
+            state->datalen = copy != NULL ? datalen : 0;
+            coalesced = true;
+        }
+    }
+
+    ret = pthread_mutex_unlock(&s_unsolCoalesceMutex);
+    assert(ret == 0);
+    return coalesced;
+}
+
+/**
+ * Timer callback closing a window, delivering the response it held back.
+ */
+static void
+unsolCoalesceWindowCallback(void *param) {
+    UnsolCoalesceState *state = (UnsolCoalesceState *)param;
+    size_t offset = state - &s_unsolCoalesceState[0][0];
+    int index = offset % NUM_COALESCED_UNSOLS;
+    RIL_SOCKET_ID soc_id = (RIL_SOCKET_ID)(offset / NUM_COALESCED_UNSOLS);
+    const UnsolCoalesceInfo *info = &s_unsolCoalesceInfo[index];
+    void *data = NULL;
+    size_t datalen = 0;
+    bool deliver = false;
+
+    int ret = pthread_mutex_lock(&s_unsolCoalesceMutex);
+    assert(ret == 0);
+    if (state->pending) {
+        data = state->data;
+        datalen = state->datalen;
+        deliver = true;
+        state->pending = false;
+        state->data = NULL;
+        state->datalen = 0;
+        state->delivered++;
+        // Responses arriving while this one is delivered wait for the next
+        // window, so they can't overtake it.
+        state->windowOpen = internalRequestTimedCallback(unsolCoalesceWindowCallback,
+                state, &info->window) != NULL;
+    } else {
+        state->windowOpen = false;
+    }
+    ret = pthread_mutex_unlock(&s_unsolCoalesceMutex);
+    assert(ret == 0);
+
+    if (!deliver) {
+        return;
+    }
+
+    int unsolResponseIndex = info->unsolResponse - RIL_UNSOL_RESPONSE_BASE;
+    deliverUnsolicitedResponse(info->unsolResponse, &s_unsolResponses[unsolResponseIndex],
+            data, datalen, soc_id);
+    info->freeFunction(data, datalen);
+
+    ret = pthread_mutex_lock(&s_unsolCoalesceMutex);
+    assert(ret == 0);
+    if (--s_unsolCoalescePendingCount == 0) {
+        release_wake_lock(ANDROID_COALESCE_WAKE_LOCK_NAME);
+    }
+    ret = pthread_mutex_unlock(&s_unsolCoalesceMutex);
+    assert(ret == 0);
+}
+
+/* }@ */
+
+#if defined(ANDROID_MULTI_SIM)
+extern "C"
+void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
+                                size_t datalen, RIL_SOCKET_ID socket_id)
+#else
+extern "C"
+void RIL_onUnsolicitedResponse(int unsolResponse, const void *data,
+                                size_t datalen)
+#endif
+{
+    int unsolResponseIndex;
+    RIL_SOCKET_ID soc_id = RIL_SOCKET_1;
+    UnsolResponseInfo *pURI = NULL;
+
+#if defined(ANDROID_MULTI_SIM)
+    soc_id = socket_id;
+#endif
+
+
+    if (s_registerCalled == 0) {
+        // Ignore RIL_onUnsolicitedResponse before RIL_register
+        RLOGW("RIL_onUnsolicitedResponse called before RIL_register");
+        return;
+    }
+
+    unsolResponseIndex = unsolResponse - RIL_UNSOL_RESPONSE_BASE;
+
+    if ((unsolResponse < RIL_UNSOL_RESPONSE_BASE)
+        || (unsolResponse > RIL_UNSOL_RESPONSE_LAST
+                && unsolResponse < RIL_UNSOL_RESPONSE_RADIO_CONFIG_BASE)
+        || (unsolResponse > RIL_UNSOL_RESPONSE_RADIO_CONFIG_LAST)) {
+        RLOGE("unsupported unsolicited response code %d", unsolResponse);
+        return;
+    }
+
+    if (unsolResponse >= RIL_UNSOL_RESPONSE_BASE
+            && unsolResponse <= RIL_UNSOL_RESPONSE_LAST) {
+        unsolResponseIndex = unsolResponse - RIL_UNSOL_RESPONSE_BASE;
+        pURI = &(s_unsolResponses[unsolResponseIndex]);
+    } else if (unsolResponse >= RIL_UNSOL_RESPONSE_RADIO_CONFIG_BASE
+            && unsolResponse <= RIL_UNSOL_RESPONSE_RADIO_CONFIG_LAST) {
+        unsolResponseIndex = unsolResponse - RIL_UNSOL_RESPONSE_RADIO_CONFIG_BASE;
+        pURI = &(s_configUnsolResponses[unsolResponseIndex]);
+    }
+
+    int coalesceIndex = unsolCoalesceIndex(unsolResponse);
+    if (coalesceIndex >= 0 && soc_id < SIM_COUNT && (data != NULL || datalen == 0)
+            && coalesceUnsolicitedResponse(coalesceIndex, data, datalen, soc_id)) {
+        return;
+    }
+
+    deliverUnsolicitedResponse(unsolResponse, pURI, data, datalen, soc_id);
+}
+
 /** FIXME generalize this if you track UserCAllbackInfo, clear it
     when the callback occurs
 */
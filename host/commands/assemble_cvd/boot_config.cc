@@ -16,20 +16,23 @@
 
 #include "host/commands/assemble_cvd/boot_config.h"
 
-#include <fstream>
 #include <sstream>
 #include <string>
 
+#include <string.h>
 #include <sys/stat.h>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
+#include <zlib.h>
 
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/environment.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/size_utils.h"
-#include "common/libs/utils/subprocess.h"
+#include "host/libs/avb/avb.h"
 #include "host/libs/config/bootconfig_args.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/kernel_args.h"
@@ -47,9 +50,12 @@ DECLARE_string(vm_manager);
 namespace cuttlefish {
 namespace {
 
-size_t WriteEnvironment(const CuttlefishConfig& config,
-                        const std::string& kernel_args,
-                        const std::string& env_path) {
+// Same layout as mkenvimage from u-boot: the CRC32 of the rest of the image,
+// the NUL separated variables and 0xff padding.
+constexpr size_t kUbootEnvSize = 4096;
+
+std::string BuildEnvironment(const CuttlefishConfig& config,
+                             const std::string& kernel_args) {
   std::ostringstream env;
 
   if (!kernel_args.empty()) {
@@ -67,16 +73,31 @@ size_t WriteEnvironment(const CuttlefishConfig& config,
     env << "android_slot_suffix=_" << config.boot_slot() << '\0';
   }
   env << '\0';
+  return env.str();
+}
 
-  std::string env_str = env.str();
-  std::ofstream file_out(env_path.c_str(), std::ios::binary);
-  file_out << env_str;
-
-  if (!file_out.good()) {
-    return 0;
+bool WriteEnvironmentImage(const std::string& env,
+                           const std::string& image_path) {
+  if (env.size() + sizeof(uint32_t) + 1 > kUbootEnvSize) {
+    LOG(ERROR) << "Bootloader environment of " << env.size()
+               << " bytes does not fit in " << kUbootEnvSize;
+    return false;
   }
-
-  return env_str.length();
+  std::string image(kUbootEnvSize, '\xff');
+  auto data = reinterpret_cast<uint8_t*>(image.data()) + sizeof(uint32_t);
+  memcpy(data, env.data(), env.size());
+  // The final byte after the env must be NULL.
+  data[env.size()] = 0;
+  uint32_t crc = crc32(0, data, kUbootEnvSize - sizeof(uint32_t));
+  memcpy(image.data(), &crc, sizeof(crc));
+
+  auto fd = SharedFD::Creat(image_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+  if (!fd->IsOpen() || WriteAll(fd, image) != image.size()) {
+    LOG(ERROR) << "Unable to write \"" << image_path
+               << "\": " << fd->StrError();
+    return false;
+  }
+  return true;
 }
 
 }  // namespace
@@ -97,7 +118,6 @@ class InitBootloaderEnvPartitionImpl : public InitBootloaderEnvPartition {
   bool Setup() override {
     auto boot_env_image_path = instance_.uboot_env_image_path();
     auto tmp_boot_env_image_path = boot_env_image_path + ".tmp";
-    auto uboot_env_path = instance_.PerInstancePath("mkenvimg_input");
     auto kernel_cmdline =
         android::base::Join(KernelCommandLineFromConfig(config_), " ");
     // If the bootconfig isn't supported in the guest kernel, the bootconfig
@@ -120,46 +140,24 @@ class InitBootloaderEnvPartitionImpl : public InitBootloaderEnvPartition {
       kernel_cmdline += " ";
       kernel_cmdline += bootconfig_args;
     }
-    if (!WriteEnvironment(config_, kernel_cmdline, uboot_env_path)) {
-      LOG(ERROR) << "Unable to write out plaintext env '" << uboot_env_path
-                 << ".'";
-      return false;
-    }
-
-    auto mkimage_path = HostBinaryPath("mkenvimage_slim");
-    Command cmd(mkimage_path);
-    cmd.AddParameter("-output_path");
-    cmd.AddParameter(tmp_boot_env_image_path);
-    cmd.AddParameter("-input_path");
-    cmd.AddParameter(uboot_env_path);
-    int success = cmd.Start().Wait();
-    if (success != 0) {
-      LOG(ERROR) << "Unable to run mkenvimage_slim. Exited with status "
-                 << success;
+    auto env = BuildEnvironment(config_, kernel_cmdline);
+    if (!WriteEnvironmentImage(env, tmp_boot_env_image_path)) {
       return false;
     }
 
     const off_t boot_env_size_bytes = AlignToPowerOf2(
         MAX_AVB_METADATA_SIZE + 4096, PARTITION_SIZE_SHIFT);
 
-    auto avbtool_path = HostBinaryPath("avbtool");
-    Command boot_env_hash_footer_cmd(avbtool_path);
-    boot_env_hash_footer_cmd.AddParameter("add_hash_footer");
-    boot_env_hash_footer_cmd.AddParameter("--image");
-    boot_env_hash_footer_cmd.AddParameter(tmp_boot_env_image_path);
-    boot_env_hash_footer_cmd.AddParameter("--partition_size");
-    boot_env_hash_footer_cmd.AddParameter(boot_env_size_bytes);
-    boot_env_hash_footer_cmd.AddParameter("--partition_name");
-    boot_env_hash_footer_cmd.AddParameter("uboot_env");
-    boot_env_hash_footer_cmd.AddParameter("--key");
-    boot_env_hash_footer_cmd.AddParameter(
-        DefaultHostArtifactsPath("etc/cvd_avb_testkey.pem"));
-    boot_env_hash_footer_cmd.AddParameter("--algorithm");
-    boot_env_hash_footer_cmd.AddParameter("SHA256_RSA4096");
-    success = boot_env_hash_footer_cmd.Start().Wait();
-    if (success != 0) {
-      LOG(ERROR) << "Unable to run append hash footer. Exited with status "
-                 << success;
+    auto avb = Avb::Create("SHA256_RSA4096",
+                           DefaultHostArtifactsPath("etc/cvd_avb_testkey.pem"));
+    if (!avb.ok()) {
+      LOG(ERROR) << avb.error();
+      return false;
+    }
+    auto footer = avb->AddHashFooter(tmp_boot_env_image_path, "uboot_env",
+                                     boot_env_size_bytes);
+    if (!footer.ok()) {
+      LOG(ERROR) << "Unable to append hash footer: " << footer.error();
       return false;
     }
 
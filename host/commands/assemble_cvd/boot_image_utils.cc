@@ -28,6 +28,7 @@
 
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/libs/avb/avb.h"
 
 const char TMP_EXTENSION[] = ".tmp";
 const char CPIO_EXT[] = ".cpio";
@@ -222,18 +223,10 @@ bool RepackBootImage(const std::string& new_kernel_path,
     return false;
   }
 
-  auto avbtool_path = HostBinaryPath("avbtool");
-  Command avb_cmd(avbtool_path);
-  avb_cmd.AddParameter("add_hash_footer");
-  avb_cmd.AddParameter("--image");
-  avb_cmd.AddParameter(tmp_boot_image_path);
-  avb_cmd.AddParameter("--partition_size");
-  avb_cmd.AddParameter(FileSize(boot_image_path));
-  avb_cmd.AddParameter("--partition_name");
-  avb_cmd.AddParameter("boot");
-  success = avb_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run avbtool. Exited with status " << success;
+  auto footer = Avb::Unsigned().AddHashFooter(tmp_boot_image_path, "boot",
+                                              FileSize(boot_image_path));
+  if (!footer.ok()) {
+    LOG(ERROR) << "Unable to append hash footer: " << footer.error();
     return false;
   }
 
@@ -305,18 +298,11 @@ bool RepackVendorBootImage(const std::string& new_ramdisk,
     return false;
   }
 
-  auto avbtool_path = HostBinaryPath("avbtool");
-  Command avb_cmd(avbtool_path);
-  avb_cmd.AddParameter("add_hash_footer");
-  avb_cmd.AddParameter("--image");
-  avb_cmd.AddParameter(tmp_vendor_boot_image_path);
-  avb_cmd.AddParameter("--partition_size");
-  avb_cmd.AddParameter(FileSize(vendor_boot_image_path));
-  avb_cmd.AddParameter("--partition_name");
-  avb_cmd.AddParameter("vendor_boot");
-  success = avb_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run avbtool. Exited with status " << success;
+  auto footer = Avb::Unsigned().AddHashFooter(
+      tmp_vendor_boot_image_path, "vendor_boot",
+      FileSize(vendor_boot_image_path));
+  if (!footer.ok()) {
+    LOG(ERROR) << "Unable to append hash footer: " << footer.error();
     return false;
   }
 
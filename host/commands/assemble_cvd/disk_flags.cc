@@ -23,6 +23,8 @@
 #include <sys/statvfs.h>
 
 #include <fstream>
+#include <memory>
+#include <vector>
 
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/utils/environment.h"
@@ -33,6 +35,7 @@
 #include "host/commands/assemble_cvd/boot_image_utils.h"
 #include "host/commands/assemble_cvd/disk_builder.h"
 #include "host/commands/assemble_cvd/super_image_mixer.h"
+#include "host/libs/avb/avb.h"
 #include "host/libs/config/bootconfig_args.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/data_image.h"
@@ -552,24 +555,17 @@ class GeneratePersistentBootconfig : public SetupFeature {
       const off_t bootconfig_size_bytes = AlignToPowerOf2(
           MAX_AVB_METADATA_SIZE + bytesWritten, PARTITION_SIZE_SHIFT);
 
-      auto avbtool_path = HostBinaryPath("avbtool");
-      Command bootconfig_hash_footer_cmd(avbtool_path);
-      bootconfig_hash_footer_cmd.AddParameter("add_hash_footer");
-      bootconfig_hash_footer_cmd.AddParameter("--image");
-      bootconfig_hash_footer_cmd.AddParameter(bootconfig_path);
-      bootconfig_hash_footer_cmd.AddParameter("--partition_size");
-      bootconfig_hash_footer_cmd.AddParameter(bootconfig_size_bytes);
-      bootconfig_hash_footer_cmd.AddParameter("--partition_name");
-      bootconfig_hash_footer_cmd.AddParameter("bootconfig");
-      bootconfig_hash_footer_cmd.AddParameter("--key");
-      bootconfig_hash_footer_cmd.AddParameter(
+      auto avb = Avb::Create(
+          "SHA256_RSA4096",
           DefaultHostArtifactsPath("etc/cvd_avb_testkey.pem"));
-      bootconfig_hash_footer_cmd.AddParameter("--algorithm");
-      bootconfig_hash_footer_cmd.AddParameter("SHA256_RSA4096");
-      int success = bootconfig_hash_footer_cmd.Start().Wait();
-      if (success != 0) {
-        LOG(ERROR) << "Unable to run append hash footer. Exited with status "
-                   << success;
+      if (!avb.ok()) {
+        LOG(ERROR) << avb.error();
+        return false;
+      }
+      auto footer = avb->AddHashFooter(bootconfig_path, "bootconfig",
+                                       bootconfig_size_bytes);
+      if (!footer.ok()) {
+        LOG(ERROR) << "Unable to append hash footer: " << footer.error();
         return false;
       }
     } else {
@@ -614,31 +610,23 @@ class GeneratePersistentVbmeta : public SetupFeature {
   }
 
   bool Setup() override {
-    auto avbtool_path = HostBinaryPath("avbtool");
-    Command vbmeta_cmd(avbtool_path);
-    vbmeta_cmd.AddParameter("make_vbmeta_image");
-    vbmeta_cmd.AddParameter("--output");
-    vbmeta_cmd.AddParameter(instance_.vbmeta_path());
-    vbmeta_cmd.AddParameter("--algorithm");
-    vbmeta_cmd.AddParameter("SHA256_RSA4096");
-    vbmeta_cmd.AddParameter("--key");
-    vbmeta_cmd.AddParameter(
-        DefaultHostArtifactsPath("etc/cvd_avb_testkey.pem"));
-
-    vbmeta_cmd.AddParameter("--chain_partition");
-    vbmeta_cmd.AddParameter("uboot_env:1:" +
-                            DefaultHostArtifactsPath("etc/cvd.avbpubkey"));
-
+    auto avb = Avb::Create(
+        "SHA256_RSA4096", DefaultHostArtifactsPath("etc/cvd_avb_testkey.pem"));
+    if (!avb.ok()) {
+      LOG(ERROR) << avb.error();
+      return false;
+    }
+    auto public_key = DefaultHostArtifactsPath("etc/cvd.avbpubkey");
+    std::vector<AvbChainPartition> chained_partitions = {
+        {"uboot_env", 1, public_key},
+    };
     if (config_.bootconfig_supported()) {
-        vbmeta_cmd.AddParameter("--chain_partition");
-        vbmeta_cmd.AddParameter("bootconfig:2:" +
-                                DefaultHostArtifactsPath("etc/cvd.avbpubkey"));
+      chained_partitions.push_back({"bootconfig", 2, public_key});
     }
-
-    bool success = vbmeta_cmd.Start().Wait();
-    if (success != 0) {
-      LOG(ERROR) << "Unable to create persistent vbmeta. Exited with status "
-                 << success;
+    auto vbmeta =
+        avb->MakeVbmetaImage(instance_.vbmeta_path(), chained_partitions);
+    if (!vbmeta.ok()) {
+      LOG(ERROR) << "Unable to create persistent vbmeta: " << vbmeta.error();
       return false;
     }
 
@@ -962,16 +950,20 @@ Result<void> CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
   fruit::Injector<> injector(DiskChangesComponent, &fetcher_config, &config);
 
   const auto& features = injector.getMultibindings<SetupFeature>();
-  CF_EXPECT(SetupFeature::RunSetup(features));
-
-  for (const auto& instance : config.Instances()) {
-    fruit::Injector<> instance_injector(DiskChangesPerInstanceComponent,
-                                        &fetcher_config, &config, &instance);
-    const auto& instance_features =
-        instance_injector.getMultibindings<SetupFeature>();
-    CF_EXPECT(SetupFeature::RunSetup(instance_features),
-              "instance = \"" << instance.instance_name() << "\"");
+  CF_EXPECT(SetupFeature::RunSetupParallel({{"", features}}));
+
+  // Instances don't share any disk files, so all of them are set up at once.
+  auto instances = config.Instances();
+  std::vector<std::unique_ptr<fruit::Injector<>>> instance_injectors;
+  std::vector<SetupFeatureGroup> instance_groups;
+  for (const auto& instance : instances) {
+    instance_injectors.emplace_back(std::make_unique<fruit::Injector<>>(
+        DiskChangesPerInstanceComponent, &fetcher_config, &config, &instance));
+    instance_groups.push_back(SetupFeatureGroup{
+        "instance = \"" + instance.instance_name() + "\"",
+        instance_injectors.back()->getMultibindings<SetupFeature>()});
   }
+  CF_EXPECT(SetupFeature::RunSetupParallel(instance_groups));
 
   // Check if filling in the sparse image would run out of disk space.
   auto existing_sizes = SparseFileSizes(FLAGS_data_image);
@@ -1020,7 +1012,7 @@ Result<void> CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
     for (auto instance : config.Instances()) {
       os_disk_builder.OverlayPath(instance.PerInstancePath("overlay.img"));
       CF_EXPECT(os_disk_builder.BuildOverlayIfNecessary());
-      if (instance.start_ap()) {
+      if (instance.start_ap() && config.ap_backend() == "openwrt") {
         os_disk_builder.OverlayPath(instance.PerInstancePath("ap_overlay.img"));
         CF_EXPECT(os_disk_builder.BuildOverlayIfNecessary());
       }
@@ -29,8 +29,10 @@
 #include "host/commands/assemble_cvd/disk_flags.h"
 #include "host/libs/config/config_flag.h"
 #include "host/libs/config/host_tools_version.h"
+#include "host/libs/config/qos.h"
 #include "host/libs/graphics_detector/graphics_detector.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
+#include "host/libs/vm_manager/fake_guest_manager.h"
 #include "host/libs/vm_manager/gem5_manager.h"
 #include "host/libs/vm_manager/qemu_manager.h"
 #include "host/libs/vm_manager/vm_manager.h"
@@ -89,12 +91,27 @@ DEFINE_string(extra_bootconfig_args, "",
 DEFINE_bool(guest_enforce_security, true,
             "Whether to run in enforcing mode (non permissive).");
 DEFINE_int32(memory_mb, 0, "Total amount of memory available for guest, MB.");
+DEFINE_string(qos_tier, "",
+              "QoS tier of the host processes of each instance, one of "
+              "interactive, ci or background, or a comma separated list with "
+              "one tier per instance. Empty to leave them out of cgroups.");
+DEFINE_string(qos_cgroup_root, "",
+              "cgroup v2 directory under which the cgroups of instances with "
+              "a QoS tier are created. It has to be in a subtree delegated to "
+              "this user that launch_cvd also runs in. Empty for a "
+              "\"cuttlefish\" cgroup at the top of the subtree delegated to "
+              "this user, e.g. by `systemd-run --user --scope`, which is "
+              "/sys/fs/cgroup/cuttlefish for root.");
 DEFINE_string(serial_number, cuttlefish::ForCurrentInstance("CUTTLEFISHCVD"),
               "Serial number to use for the device");
 DEFINE_bool(use_random_serial, false,
             "Whether to use random serial for the device.");
 DEFINE_string(vm_manager, "",
-              "What virtual machine manager to use, one of {qemu_cli, crosvm}");
+              "What virtual machine manager to use, one of {qemu_cli, crosvm, "
+              "fake_guest}");
+DEFINE_string(fake_guest_profile, "",
+              "JSON file describing the load --vm_manager=fake_guest puts on "
+              "the host daemons. See host/commands/fake_guest/load_profile.h.");
 DEFINE_string(gpu_mode, cuttlefish::kGpuModeAuto,
               "What gpu configuration to use, one of {auto, drm_virgl, "
               "gfxstream, guest_swiftshader}");
@@ -278,7 +295,22 @@ DEFINE_int32(modem_simulator_sim_type, 1,
 
 DEFINE_bool(console, false, "Enable the serial console");
 
+DEFINE_bool(consolidate_host_daemons, false,
+            "Run kernel_log_monitor, logcat_receiver, tombstone_receiver, "
+            "config_server and console_forwarder as services of a single "
+            "host_daemons process per instance.");
+
 DEFINE_bool(vhost_net, false, "Enable vhost acceleration of networking");
+DEFINE_int32(net_queues, 1,
+             "Queue pairs of every network device, 0 for one per virtual CPU. "
+             "More than one needs tap interfaces created as multi_queue.");
+DEFINE_bool(tap_offloads, true,
+            "Let the guest hand checksums and segmentation of its network "
+            "traffic over to the host.");
+DEFINE_int32(tap_sndbuf, 0,
+             "Bytes of guest traffic a network queue may have queued on the "
+             "host, 0 for no limit. Lower values trade throughput for "
+             "latency.");
 
 DEFINE_string(
     vhost_user_mac80211_hwsim, "",
@@ -294,6 +326,15 @@ DEFINE_string(ap_rootfs_image,
 DEFINE_string(ap_kernel_image,
               DefaultHostArtifactsPath("etc/openwrt/images/kernel_for_openwrt"),
               "kernel image for AP instance");
+DEFINE_string(ap_backend, "openwrt",
+              "What runs the Wi-Fi access point: openwrt for the OpenWrt VM, "
+              "booted from --ap_rootfs_image and --ap_kernel_image, or host "
+              "for the much lighter wifi_ap host process.");
+
+DEFINE_bool(shared_secure_env, false,
+            "Have the secure_env of the first instance serve every instance, "
+            "instead of one secure_env per instance. The other instances "
+            "depend on the first one running.");
 
 DEFINE_bool(record_screen, false, "Enable screen recording. "
                                   "Requires --start_webrtc");
@@ -324,6 +365,14 @@ DEFINE_bool(use_sdcard, true, "Create blank SD-Card image and expose to guest");
 
 DEFINE_bool(protected_vm, false, "Boot in Protected VM mode");
 
+DEFINE_bool(share_super_image, false,
+            "[Experimental] Also expose the super image as a read-only pmem "
+            "device, backed by the host page cache instead of guest memory. "
+            "No guest built from this tree mounts its logical partitions "
+            "from that device yet, so they keep reading super from the "
+            "composite disk and this saves no memory without a guest fstab "
+            "that uses the device.");
+
 DEFINE_bool(enable_audio, cuttlefish::HostArch() != cuttlefish::Arch::Arm64,
             "Whether to play or capture audio");
 
@@ -333,10 +382,12 @@ DEFINE_string(userdata_format, "f2fs", "The userdata filesystem format");
 
 DECLARE_string(assembly_dir);
 DECLARE_string(boot_image);
+DECLARE_string(super_image);
 DECLARE_string(system_image_dir);
 
 namespace cuttlefish {
 using vm_manager::QemuManager;
+using vm_manager::FakeGuestManager;
 using vm_manager::Gem5Manager;
 using vm_manager::GetVmManager;
 
@@ -424,14 +475,10 @@ Result<KernelConfig> ReadKernelConfig() {
   return ret;
 }
 #else
-Result<KernelConfig> ReadKernelConfig() {
-  // extract-ikconfig can be called directly on the boot image since it looks
-  // for the ikconfig header in the image before extracting the config list.
-  // This code is liable to break if the boot image ever includes the
-  // ikconfig header outside the kernel.
-  const std::string kernel_image_path =
-      FLAGS_kernel_path.size() ? FLAGS_kernel_path : FLAGS_boot_image;
-
+// Fallback for kernels compressed with formats the native extraction does not
+// decode.
+Result<KernelConfig> ReadKernelConfigWithScript(
+    const std::string& kernel_image_path) {
   Command ikconfig_cmd(HostBinaryPath("extract-ikconfig"));
   ikconfig_cmd.AddParameter(kernel_image_path);
 
@@ -451,24 +498,24 @@ Result<KernelConfig> ReadKernelConfig() {
             "Failed to extract ikconfig from " << kernel_image_path);
 
   std::string config = ReadFile(ikconfig_path);
+  unlink(ikconfig_path.c_str());
+  return CF_EXPECT(ParseKernelConfig(config));
+}
 
-  KernelConfig kernel_config;
-  if (config.find("\nCONFIG_ARM=y") != std::string::npos) {
-    kernel_config.target_arch = Arch::Arm;
-  } else if (config.find("\nCONFIG_ARM64=y") != std::string::npos) {
-    kernel_config.target_arch = Arch::Arm64;
-  } else if (config.find("\nCONFIG_X86_64=y") != std::string::npos) {
-    kernel_config.target_arch = Arch::X86_64;
-  } else if (config.find("\nCONFIG_X86=y") != std::string::npos) {
-    kernel_config.target_arch = Arch::X86;
-  } else {
-    return CF_ERR("Unknown target architecture");
-  }
-  kernel_config.bootconfig_supported =
-      config.find("\nCONFIG_BOOT_CONFIG=y") != std::string::npos;
+Result<KernelConfig> ReadKernelConfig() {
+  // The ikconfig can be extracted directly from the boot image since the
+  // search looks for the ikconfig header before extracting the config list.
+  // This code is liable to break if the boot image ever includes the
+  // ikconfig header outside the kernel.
+  const std::string kernel_image_path =
+      FLAGS_kernel_path.size() ? FLAGS_kernel_path : FLAGS_boot_image;
 
-  unlink(ikconfig_path.c_str());
-  return kernel_config;
+  auto kernel_config = ReadKernelConfigFromImage(kernel_image_path);
+  if (kernel_config.ok()) {
+    return *kernel_config;
+  }
+  LOG(DEBUG) << "Falling back to extract-ikconfig: " << kernel_config.error();
+  return CF_EXPECT(ReadKernelConfigWithScript(kernel_image_path));
 }
 #endif  // #ifdef __ANDROID__
 
@@ -493,6 +540,8 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
     LOG(FATAL) << "Invalid vm_manager: " << FLAGS_vm_manager;
   }
   tmp_config_obj.set_vm_manager(FLAGS_vm_manager);
+  tmp_config_obj.set_fake_guest_profile(
+      AbsolutePath(FLAGS_fake_guest_profile));
 
   std::vector<CuttlefishConfig::DisplayConfig> display_configs;
 
@@ -636,6 +685,7 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   }
 
   tmp_config_obj.set_console(FLAGS_console);
+  tmp_config_obj.set_consolidate_host_daemons(FLAGS_consolidate_host_daemons);
   tmp_config_obj.set_kgdb(FLAGS_console && FLAGS_kgdb);
 
   tmp_config_obj.set_host_tools_version(HostToolsCrc());
@@ -697,6 +747,15 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   tmp_config_obj.set_enable_minimal_mode(FLAGS_enable_minimal_mode);
 
   tmp_config_obj.set_vhost_net(FLAGS_vhost_net);
+  CHECK(FLAGS_net_queues >= 0) << "--net_queues must not be negative";
+  // Queues beyond one per vCPU have no vCPU to process them.
+  if (FLAGS_net_queues == 0 || FLAGS_net_queues > FLAGS_cpus) {
+    tmp_config_obj.set_net_queues(FLAGS_cpus);
+  } else {
+    tmp_config_obj.set_net_queues(FLAGS_net_queues);
+  }
+  tmp_config_obj.set_tap_offloads(FLAGS_tap_offloads);
+  tmp_config_obj.set_tap_sndbuf(FLAGS_tap_sndbuf);
 
   tmp_config_obj.set_vhost_user_mac80211_hwsim(FLAGS_vhost_user_mac80211_hwsim);
 
@@ -708,8 +767,14 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   tmp_config_obj.set_ap_rootfs_image(FLAGS_ap_rootfs_image);
   tmp_config_obj.set_ap_kernel_image(FLAGS_ap_kernel_image);
 
+  CHECK(FLAGS_ap_backend == "openwrt" || FLAGS_ap_backend == "host")
+      << "Unknown --ap_backend=" << FLAGS_ap_backend;
+  tmp_config_obj.set_ap_backend(FLAGS_ap_backend);
+
   tmp_config_obj.set_wmediumd_config(FLAGS_wmediumd_config);
 
+  tmp_config_obj.set_shared_secure_env(FLAGS_shared_secure_env);
+
   tmp_config_obj.set_rootcanal_hci_port(7300);
   tmp_config_obj.set_rootcanal_link_port(7400);
   tmp_config_obj.set_rootcanal_test_port(7500);
@@ -724,6 +789,21 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
 
   tmp_config_obj.set_protected_vm(FLAGS_protected_vm);
 
+  if (FLAGS_share_super_image) {
+    // Protected guests cannot map host memory they do not own.
+    CHECK(!FLAGS_protected_vm)
+        << "--share_super_image is not supported with --protected_vm";
+    // The arm QEMU machine has no pmem device.
+    CHECK(FLAGS_vm_manager != QemuManager::name() ||
+          (kernel_config.target_arch != Arch::Arm &&
+           kernel_config.target_arch != Arch::Arm64))
+        << "--share_super_image is not supported with QEMU on arm";
+    LOG(WARNING) << "--share_super_image is experimental, guests only use "
+                 << "the pmem device if their fstab mounts the logical "
+                 << "partitions from it";
+    tmp_config_obj.set_super_pmem_image(AbsolutePath(FLAGS_super_image));
+  }
+
   tmp_config_obj.set_userdata_format(FLAGS_userdata_format);
 
   std::vector<int> num_instances;
@@ -731,6 +811,24 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
     num_instances.push_back(GetInstance() + i);
   }
   std::vector<std::string> gnss_file_paths = android::base::Split(FLAGS_gnss_file_path, ",");
+  std::vector<std::string> qos_tiers = android::base::Split(FLAGS_qos_tier, ",");
+  CHECK(qos_tiers.size() == 1 ||
+        qos_tiers.size() == static_cast<std::size_t>(FLAGS_num_instances))
+      << "Expected one QoS tier, or one per instance, got " << FLAGS_qos_tier;
+  std::string qos_cgroup_root = FLAGS_qos_cgroup_root;
+  if (!FLAGS_qos_tier.empty()) {
+    // run_cvd moves itself from this cgroup into the instance's, which fails
+    // with EACCES unless the user may move processes between them.
+    auto current_cgroup = CurrentCgroup();
+    CHECK(current_cgroup.ok()) << current_cgroup.error();
+    if (qos_cgroup_root.empty()) {
+      auto delegated = DelegatedCgroup(*current_cgroup);
+      CHECK(delegated.ok()) << delegated.error();
+      qos_cgroup_root = *delegated + "/cuttlefish";
+    }
+    auto movable = CheckCgroupMove(*current_cgroup, qos_cgroup_root);
+    CHECK(movable.ok()) << movable.error();
+  }
 
   bool is_first_instance = true;
   for (const auto& num : num_instances) {
@@ -796,6 +894,17 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
       instance.set_gnss_file_path(gnss_file_paths[num-1]);
     }
 
+    // A single tier applies to every instance.
+    const auto& qos_tier =
+        qos_tiers.size() == 1 ? qos_tiers[0] : qos_tiers[num - GetInstance()];
+    if (!qos_tier.empty()) {
+      auto parsed_tier = ParseQosTier(qos_tier);
+      CHECK(parsed_tier.ok()) << parsed_tier.error();
+      instance.set_qos_tier(qos_tier);
+      instance.set_qos_cgroup_path(qos_cgroup_root + "/" +
+                                   const_instance.instance_name());
+    }
+
     instance.set_camera_server_port(FLAGS_camera_server_port);
 
     if (FLAGS_protected_vm) {
@@ -873,8 +982,13 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
 
     instance.set_start_rootcanal(is_first_instance);
 
-    instance.set_start_ap(!FLAGS_ap_rootfs_image.empty() &&
-                          !FLAGS_ap_kernel_image.empty() && is_first_instance);
+    instance.set_start_secure_env(!FLAGS_shared_secure_env ||
+                                  is_first_instance);
+
+    bool has_ap_images =
+        !FLAGS_ap_rootfs_image.empty() && !FLAGS_ap_kernel_image.empty();
+    instance.set_start_ap((FLAGS_ap_backend == "host" || has_ap_images) &&
+                          is_first_instance);
 
     is_first_instance = false;
 
@@ -966,6 +1080,16 @@ void SetDefaultFlagsForGem5() {
   SetCommandLineOptionWithMode("cpus", "1", SET_FLAGS_DEFAULT);
 }
 
+void SetDefaultFlagsForFakeGuest() {
+  // There is no guest to boot, only the host daemons are exercised.
+  if (!FLAGS_start_webrtc) {
+    SetCommandLineOptionWithMode("start_webrtc", "true", SET_FLAGS_DEFAULT);
+  }
+  SetCommandLineOptionWithMode("gpu_mode", kGpuModeGuestSwiftshader,
+                               SET_FLAGS_DEFAULT);
+  SetCommandLineOptionWithMode("enable_sandbox", "false", SET_FLAGS_DEFAULT);
+}
+
 Result<KernelConfig> GetKernelConfigAndSetDefaults() {
   CF_EXPECT(ResolveInstanceFiles(), "Failed to resolve instance files");
 
@@ -989,6 +1113,8 @@ Result<KernelConfig> GetKernelConfigAndSetDefaults() {
       return CF_ERR("Gem5 only supports ARM64");
     }
     SetDefaultFlagsForGem5();
+  } else if (FLAGS_vm_manager == FakeGuestManager::name()) {
+    SetDefaultFlagsForFakeGuest();
   } else {
     return CF_ERR("Unknown Virtual Machine Manager: " << FLAGS_vm_manager);
   }
@@ -10,14 +10,10 @@
 #include "common/libs/utils/result.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/fetcher_config.h"
+#include "host/libs/config/kernel_config.h"
 
 namespace cuttlefish {
 
-struct KernelConfig {
-  Arch target_arch;
-  bool bootconfig_supported;
-};
-
 Result<KernelConfig> GetKernelConfigAndSetDefaults();
 // Must be called after ParseCommandLineFlags.
 CuttlefishConfig InitializeCuttlefishConfiguration(const std::string& root_dir,
@@ -13,9 +13,12 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include "host/commands/cvd/server.h"
+#include "host/commands/cvd/acloud_command.h"
 
+#include <algorithm>
+#include <functional>
 #include <optional>
+#include <sstream>
 #include <vector>
 
 #include <android-base/strings.h>
@@ -24,22 +27,20 @@
 
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
 #include "common/libs/utils/flag_parser.h"
 #include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
 #include "host/commands/cvd/command_sequence.h"
 #include "host/commands/cvd/instance_lock.h"
+#include "host/commands/cvd/server.h"
 #include "host/commands/cvd/server_client.h"
+#include "host/commands/cvd/warm_pool.h"
 
 namespace cuttlefish {
 
 namespace {
 
-struct ConvertedAcloudCreateCommand {
-  InstanceLockFile lock;
-  std::vector<RequestWithStdio> requests;
-};
-
 /**
  * Split a string into arguments based on shell tokenization rules.
  *
@@ -59,204 +60,266 @@ Result<std::vector<std::string>> BashTokenize(const std::string& str) {
   return android::base::Split(stdout, "\n");
 }
 
-class ConvertAcloudCreateCommand {
- public:
-  INJECT(ConvertAcloudCreateCommand(InstanceLockFileManager& lock_file_manager))
-      : lock_file_manager_(lock_file_manager) {}
+constexpr char kAndroidHostOut[] = "ANDROID_HOST_OUT";
+constexpr char kAndroidProductOut[] = "ANDROID_PRODUCT_OUT";
 
-  Result<ConvertedAcloudCreateCommand> Convert(
-      const RequestWithStdio& request) {
-    auto arguments = ParseInvocation(request.Message()).arguments;
-    CF_EXPECT(arguments.size() > 0);
-    CF_EXPECT(arguments[0] == "create");
-    arguments.erase(arguments.begin());
+}  // namespace
 
-    const auto& request_command = request.Message().command_request();
-
-    std::vector<Flag> flags;
-    bool local_instance_set;
-    std::optional<int> local_instance;
-    auto local_instance_flag = Flag();
-    local_instance_flag.Alias(
-        {FlagAliasMode::kFlagConsumesArbitrary, "--local-instance"});
-    local_instance_flag.Setter([&local_instance_set,
-                                &local_instance](const FlagMatch& m) {
-      local_instance_set = true;
-      if (m.value != "" && local_instance) {
-        LOG(ERROR) << "Instance number already set, was \"" << *local_instance
-                   << "\", now set to \"" << m.value << "\"";
-        return false;
-      } else if (m.value != "" && !local_instance) {
-        local_instance = std::stoi(m.value);
-      }
-      return true;
-    });
-    flags.emplace_back(local_instance_flag);
-
-    bool verbose = false;
-    flags.emplace_back(Flag()
-                           .Alias({FlagAliasMode::kFlagExact, "-v"})
-                           .Alias({FlagAliasMode::kFlagExact, "-vv"})
-                           .Alias({FlagAliasMode::kFlagExact, "--verbose"})
-                           .Setter([&verbose](const FlagMatch&) {
-                             verbose = true;
-                             return true;
-                           }));
-
-    std::optional<std::string> branch;
-    flags.emplace_back(
-        Flag()
-            .Alias({FlagAliasMode::kFlagConsumesFollowing, "--branch"})
-            .Setter([&branch](const FlagMatch& m) {
-              branch = m.value;
-              return true;
-            }));
-
-    bool local_image;
-    flags.emplace_back(
-        Flag()
-            .Alias({FlagAliasMode::kFlagConsumesArbitrary, "--local-image"})
-            .Setter([&local_image](const FlagMatch& m) {
-              local_image = true;
-              return m.value == "";
-            }));
-
-    std::optional<std::string> build_id;
-    flags.emplace_back(
-        Flag()
-            .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build-id"})
-            .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build_id"})
-            .Setter([&build_id](const FlagMatch& m) {
-              build_id = m.value;
-              return true;
-            }));
-
-    std::optional<std::string> build_target;
-    flags.emplace_back(
-        Flag()
-            .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build-target"})
-            .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build_target"})
-            .Setter([&build_target](const FlagMatch& m) {
-              build_target = m.value;
-              return true;
-            }));
-
-    std::optional<std::string> launch_args;
-    flags.emplace_back(
-        Flag()
-            .Alias({FlagAliasMode::kFlagConsumesFollowing, "--launch-args"})
-            .Setter([&launch_args](const FlagMatch& m) {
-              launch_args = m.value;
-              return true;
-            }));
-
-    CF_EXPECT(ParseFlags(flags, arguments));
-    CF_EXPECT(arguments.size() == 0,
-              "Unrecognized arguments:'"
-                  << android::base::Join(arguments, "', '") << "'");
-
-    CF_EXPECT(local_instance_set == true,
-              "Only '--local-instance' is supported");
-    std::optional<InstanceLockFile> lock;
-    if (local_instance.has_value()) {
-      // TODO(schuffelen): Block here if it can be interruptible
-      lock = CF_EXPECT(lock_file_manager_.TryAcquireLock(*local_instance));
-    } else {
-      lock = CF_EXPECT(lock_file_manager_.TryAcquireUnusedLock());
+std::string AcloudCreateFlags::Configuration() const {
+  std::stringstream configuration;
+  configuration << "host_out=" << host_artifacts_path;
+  if (local_image) {
+    configuration << " local_image=" << product_out;
+  }
+  if (branch) {
+    configuration << " branch=" << *branch;
+  }
+  if (build_id) {
+    configuration << " build_id=" << *build_id;
+  }
+  if (build_target) {
+    configuration << " build_target=" << *build_target;
+  }
+  if (launch_args) {
+    configuration << " launch_args=" << *launch_args;
+  }
+  return configuration.str();
+}
+
+bool AcloudCreateFlags::PinnedBuild() const {
+  return local_image || build_id.has_value();
+}
+
+std::string AcloudCreateFlags::ArtifactsFingerprint() const {
+  std::vector<std::string> directories = {host_artifacts_path + "/bin"};
+  if (local_image) {
+    directories.push_back(product_out);
+  }
+  // Only the files directly in the directories, a rebuild replaces those.
+  std::stringstream files;
+  for (const auto& directory : directories) {
+    if (!DirectoryExists(directory)) {
+      continue;
     }
-    CF_EXPECT(lock.has_value(), "Could not acquire instance lock");
-    CF_EXPECT(CF_EXPECT(lock->Status()) == InUseState::kNotInUse);
-
-    auto dir = TempDir() + "/acloud_cvd_temp/local-instance-" +
-               std::to_string(lock->Instance());
-
-    static constexpr char kAndroidHostOut[] = "ANDROID_HOST_OUT";
-
-    auto host_artifacts_path = request_command.env().find(kAndroidHostOut);
-    CF_EXPECT(host_artifacts_path != request_command.env().end(),
-              "Missing " << kAndroidHostOut);
-
-    std::vector<cvd::Request> request_protos;
-    if (local_image) {
-      cvd::Request& mkdir_request = request_protos.emplace_back();
-      auto& mkdir_command = *mkdir_request.mutable_command_request();
-      mkdir_command.add_args("cvd");
-      mkdir_command.add_args("mkdir");
-      mkdir_command.add_args("-p");
-      mkdir_command.add_args(dir);
-      auto& mkdir_env = *mkdir_command.mutable_env();
-      mkdir_env[kAndroidHostOut] = host_artifacts_path->second;
-      *mkdir_command.mutable_working_directory() = dir;
-    } else {
-      cvd::Request& fetch_request = request_protos.emplace_back();
-      auto& fetch_command = *fetch_request.mutable_command_request();
-      fetch_command.add_args("cvd");
-      fetch_command.add_args("fetch");
-      fetch_command.add_args("--directory");
-      fetch_command.add_args(dir);
-      if (branch || build_id || build_target) {
-        fetch_command.add_args("--default_build");
-        auto target = build_target ? "/" + *build_target : "";
-        auto build = build_id.value_or(branch.value_or("aosp-master"));
-        fetch_command.add_args(build + target);
+    auto names = DirectoryContents(directory);
+    std::sort(names.begin(), names.end());
+    for (const auto& name : names) {
+      auto fingerprint = GetFileFingerprint(directory + "/" + name);
+      if (fingerprint) {
+        files << directory << "/" << name << " " << fingerprint->inode << " "
+              << fingerprint->size << " " << fingerprint->mtime_ns << "\n";
       }
-      *fetch_command.mutable_working_directory() = dir;
-      auto& fetch_env = *fetch_command.mutable_env();
-      fetch_env[kAndroidHostOut] = host_artifacts_path->second;
     }
+  }
+  std::stringstream hash;
+  hash << std::hex << std::hash<std::string>()(files.str());
+  return hash.str();
+}
 
-    cvd::Request& start_request = request_protos.emplace_back();
-    auto& start_command = *start_request.mutable_command_request();
-    start_command.add_args("cvd");
-    start_command.add_args("start");
-    start_command.add_args("--daemon");
-    start_command.add_args("--undefok");
-    start_command.add_args("report_anonymous_usage_stats");
-    start_command.add_args("--report_anonymous_usage_stats");
-    start_command.add_args("y");
-    if (launch_args) {
-      for (const auto& arg : CF_EXPECT(BashTokenize(*launch_args))) {
-        start_command.add_args(arg);
-      }
-    }
-    static constexpr char kAndroidProductOut[] = "ANDROID_PRODUCT_OUT";
-    auto& start_env = *start_command.mutable_env();
-    if (local_image) {
-      start_env[kAndroidHostOut] = host_artifacts_path->second;
-
-      auto product_out = request_command.env().find(kAndroidProductOut);
-      CF_EXPECT(product_out != request_command.env().end(),
-                "Missing " << kAndroidProductOut);
-      start_env[kAndroidProductOut] = product_out->second;
-    } else {
-      start_env[kAndroidHostOut] = dir;
-      start_env[kAndroidProductOut] = dir;
+std::string AcloudInstanceDirectory(int instance) {
+  return TempDir() + "/acloud_cvd_temp/local-instance-" +
+         std::to_string(instance);
+}
+
+Result<AcloudCreateFlags> ConvertAcloudCreateCommand::Parse(
+    const cvd::CommandRequest& request_command,
+    std::vector<std::string> arguments) {
+  AcloudCreateFlags parsed;
+  std::vector<Flag> flags;
+  auto local_instance_flag = Flag();
+  local_instance_flag.Alias(
+      {FlagAliasMode::kFlagConsumesArbitrary, "--local-instance"});
+  local_instance_flag.Setter([&parsed](const FlagMatch& m) {
+    parsed.local_instance_set = true;
+    if (m.value != "" && parsed.local_instance) {
+      LOG(ERROR) << "Instance number already set, was \""
+                 << *parsed.local_instance << "\", now set to \"" << m.value
+                 << "\"";
+      return false;
+    } else if (m.value != "" && !parsed.local_instance) {
+      parsed.local_instance = std::stoi(m.value);
     }
-    start_env["CUTTLEFISH_INSTANCE"] = std::to_string(lock->Instance());
-    start_env["HOME"] = dir;
-    *start_command.mutable_working_directory() = dir;
-
-    std::vector<SharedFD> fds;
-    if (verbose) {
-      fds = request.FileDescriptors();
-    } else {
-      auto dev_null = SharedFD::Open("/dev/null", O_RDWR);
-      CF_EXPECT(dev_null->IsOpen(), dev_null->StrError());
-      fds = {dev_null, dev_null, dev_null};
+    return true;
+  });
+  flags.emplace_back(local_instance_flag);
+
+  flags.emplace_back(Flag()
+                         .Alias({FlagAliasMode::kFlagExact, "-v"})
+                         .Alias({FlagAliasMode::kFlagExact, "-vv"})
+                         .Alias({FlagAliasMode::kFlagExact, "--verbose"})
+                         .Setter([&parsed](const FlagMatch&) {
+                           parsed.verbose = true;
+                           return true;
+                         }));
+
+  flags.emplace_back(
+      Flag()
+          .Alias({FlagAliasMode::kFlagConsumesFollowing, "--branch"})
+          .Setter([&parsed](const FlagMatch& m) {
+            parsed.branch = m.value;
+            return true;
+          }));
+
+  flags.emplace_back(
+      Flag()
+          .Alias({FlagAliasMode::kFlagConsumesArbitrary, "--local-image"})
+          .Setter([&parsed](const FlagMatch& m) {
+            parsed.local_image = true;
+            return m.value == "";
+          }));
+
+  flags.emplace_back(
+      Flag()
+          .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build-id"})
+          .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build_id"})
+          .Setter([&parsed](const FlagMatch& m) {
+            parsed.build_id = m.value;
+            return true;
+          }));
+
+  flags.emplace_back(
+      Flag()
+          .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build-target"})
+          .Alias({FlagAliasMode::kFlagConsumesFollowing, "--build_target"})
+          .Setter([&parsed](const FlagMatch& m) {
+            parsed.build_target = m.value;
+            return true;
+          }));
+
+  flags.emplace_back(
+      Flag()
+          .Alias({FlagAliasMode::kFlagConsumesFollowing, "--launch-args"})
+          .Setter([&parsed](const FlagMatch& m) {
+            parsed.launch_args = m.value;
+            return true;
+          }));
+
+  CF_EXPECT(ParseFlags(flags, arguments));
+  CF_EXPECT(arguments.size() == 0,
+            "Unrecognized arguments:'"
+                << android::base::Join(arguments, "', '") << "'");
+
+  auto host_artifacts_path = request_command.env().find(kAndroidHostOut);
+  CF_EXPECT(host_artifacts_path != request_command.env().end(),
+            "Missing " << kAndroidHostOut);
+  parsed.host_artifacts_path = host_artifacts_path->second;
+  if (parsed.local_image) {
+    auto product_out = request_command.env().find(kAndroidProductOut);
+    CF_EXPECT(product_out != request_command.env().end(),
+              "Missing " << kAndroidProductOut);
+    parsed.product_out = product_out->second;
+  }
+  return parsed;
+}
+
+Result<std::vector<RequestWithStdio>> ConvertAcloudCreateCommand::Requests(
+    const AcloudCreateFlags& flags, const InstanceLockFile& lock,
+    const std::vector<SharedFD>& fds, std::optional<ucred> credentials) {
+  auto dir = AcloudInstanceDirectory(lock.Instance());
+
+  std::vector<cvd::Request> request_protos;
+  if (flags.local_image) {
+    cvd::Request& mkdir_request = request_protos.emplace_back();
+    auto& mkdir_command = *mkdir_request.mutable_command_request();
+    mkdir_command.add_args("cvd");
+    mkdir_command.add_args("mkdir");
+    mkdir_command.add_args("-p");
+    mkdir_command.add_args(dir);
+    auto& mkdir_env = *mkdir_command.mutable_env();
+    mkdir_env[kAndroidHostOut] = flags.host_artifacts_path;
+    *mkdir_command.mutable_working_directory() = dir;
+  } else {
+    cvd::Request& fetch_request = request_protos.emplace_back();
+    auto& fetch_command = *fetch_request.mutable_command_request();
+    fetch_command.add_args("cvd");
+    fetch_command.add_args("fetch");
+    fetch_command.add_args("--directory");
+    fetch_command.add_args(dir);
+    if (flags.branch || flags.build_id || flags.build_target) {
+      fetch_command.add_args("--default_build");
+      auto target = flags.build_target ? "/" + *flags.build_target : "";
+      auto build =
+          flags.build_id.value_or(flags.branch.value_or("aosp-master"));
+      fetch_command.add_args(build + target);
     }
+    *fetch_command.mutable_working_directory() = dir;
+    auto& fetch_env = *fetch_command.mutable_env();
+    fetch_env[kAndroidHostOut] = flags.host_artifacts_path;
+  }
 
-    ConvertedAcloudCreateCommand ret = {
-        .lock = {std::move(*lock)},
-    };
-    for (auto& request_proto : request_protos) {
-      ret.requests.emplace_back(request_proto, fds, request.Credentials());
+  cvd::Request& start_request = request_protos.emplace_back();
+  auto& start_command = *start_request.mutable_command_request();
+  start_command.add_args("cvd");
+  start_command.add_args("start");
+  start_command.add_args("--daemon");
+  start_command.add_args("--undefok");
+  start_command.add_args("report_anonymous_usage_stats");
+  start_command.add_args("--report_anonymous_usage_stats");
+  start_command.add_args("y");
+  if (flags.launch_args) {
+    for (const auto& arg : CF_EXPECT(BashTokenize(*flags.launch_args))) {
+      start_command.add_args(arg);
     }
-    return ret;
   }
+  auto& start_env = *start_command.mutable_env();
+  if (flags.local_image) {
+    start_env[kAndroidHostOut] = flags.host_artifacts_path;
+    start_env[kAndroidProductOut] = flags.product_out;
+  } else {
+    start_env[kAndroidHostOut] = dir;
+    start_env[kAndroidProductOut] = dir;
+  }
+  start_env["CUTTLEFISH_INSTANCE"] = std::to_string(lock.Instance());
+  start_env["HOME"] = dir;
+  *start_command.mutable_working_directory() = dir;
 
- private:
-  InstanceLockFileManager& lock_file_manager_;
-};
+  std::vector<RequestWithStdio> requests;
+  for (auto& request_proto : request_protos) {
+    requests.emplace_back(request_proto, fds, credentials);
+  }
+  return requests;
+}
+
+Result<ConvertedAcloudCreateCommand> ConvertAcloudCreateCommand::Convert(
+    const RequestWithStdio& request) {
+  auto arguments = ParseInvocation(request.Message()).arguments;
+  CF_EXPECT(arguments.size() > 0);
+  CF_EXPECT(arguments[0] == "create");
+  arguments.erase(arguments.begin());
+
+  auto flags =
+      CF_EXPECT(Parse(request.Message().command_request(), arguments));
+
+  CF_EXPECT(flags.local_instance_set == true,
+            "Only '--local-instance' is supported");
+  std::optional<InstanceLockFile> lock;
+  if (flags.local_instance.has_value()) {
+    // TODO(schuffelen): Block here if it can be interruptible
+    lock = CF_EXPECT(lock_file_manager_.TryAcquireLock(*flags.local_instance));
+  } else {
+    lock = CF_EXPECT(lock_file_manager_.TryAcquireUnusedLock());
+  }
+  CF_EXPECT(lock.has_value(), "Could not acquire instance lock");
+  CF_EXPECT(CF_EXPECT(lock->Status()) == InUseState::kNotInUse);
+
+  std::vector<SharedFD> fds;
+  if (flags.verbose) {
+    fds = request.FileDescriptors();
+  } else {
+    auto dev_null = SharedFD::Open("/dev/null", O_RDWR);
+    CF_EXPECT(dev_null->IsOpen(), dev_null->StrError());
+    fds = {dev_null, dev_null, dev_null};
+  }
+
+  ConvertedAcloudCreateCommand ret = {
+      .lock = {std::move(*lock)},
+  };
+  ret.requests =
+      CF_EXPECT(Requests(flags, ret.lock, fds, request.Credentials()));
+  return ret;
+}
+
+namespace {
 
 class TryAcloudCreateCommand : public CvdServerHandler {
  public:
@@ -283,8 +346,9 @@ class TryAcloudCreateCommand : public CvdServerHandler {
 class AcloudCreateCommand : public CvdServerHandler {
  public:
   INJECT(AcloudCreateCommand(CommandSequenceExecutor& executor,
-                             ConvertAcloudCreateCommand& converter))
-      : executor_(executor), converter_(converter) {}
+                             ConvertAcloudCreateCommand& converter,
+                             WarmPool& warm_pool))
+      : executor_(executor), converter_(converter), warm_pool_(warm_pool) {}
   ~AcloudCreateCommand() = default;
 
   Result<bool> CanHandle(const RequestWithStdio& request) const override {
@@ -299,14 +363,28 @@ class AcloudCreateCommand : public CvdServerHandler {
     }
     CF_EXPECT(CanHandle(request));
 
+    cvd::Response response;
+    response.mutable_command_response();
+
+    auto arguments = ParseInvocation(request.Message()).arguments;
+    arguments.erase(arguments.begin());
+    auto flags = CF_EXPECT(ConvertAcloudCreateCommand::Parse(
+        request.Message().command_request(), arguments));
+    if (flags.local_instance_set && !flags.local_instance) {
+      if (auto instance = warm_pool_.Take(flags)) {
+        auto message = "Using warm instance " + std::to_string(*instance) +
+                       " from " + AcloudInstanceDirectory(*instance) + "\n";
+        WriteAll(request.Err(), message);
+        return response;
+      }
+    }
+
     auto converted = CF_EXPECT(converter_.Convert(request));
     interrupt_lock.unlock();
     CF_EXPECT(executor_.Execute(converted.requests, request.Err()));
 
     CF_EXPECT(converted.lock.Status(InUseState::kInUse));
 
-    cvd::Response response;
-    response.mutable_command_response();
     return response;
   }
   Result<void> Interrupt() override {
@@ -319,6 +397,7 @@ class AcloudCreateCommand : public CvdServerHandler {
  private:
   CommandSequenceExecutor& executor_;
   ConvertAcloudCreateCommand& converter_;
+  WarmPool& warm_pool_;
 
   std::mutex interrupt_mutex_;
   bool interrupted_ = false;
@@ -326,7 +405,8 @@ class AcloudCreateCommand : public CvdServerHandler {
 
 }  // namespace
 
-fruit::Component<fruit::Required<CvdCommandHandler>> AcloudCommandComponent() {
+fruit::Component<fruit::Required<CvdCommandHandler, WarmPool>>
+AcloudCommandComponent() {
   return fruit::createComponent()
       .addMultibinding<CvdServerHandler, AcloudCreateCommand>()
       .addMultibinding<CvdServerHandler, TryAcloudCreateCommand>();
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fruit/fruit.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/instance_lock.h"
+#include "host/commands/cvd/server_client.h"
+
+namespace cuttlefish {
+
+// The arguments of an `acloud create` request.
+struct AcloudCreateFlags {
+  bool local_instance_set = false;
+  std::optional<int> local_instance;
+  bool verbose = false;
+  std::optional<std::string> branch;
+  bool local_image = false;
+  std::optional<std::string> build_id;
+  std::optional<std::string> build_target;
+  std::optional<std::string> launch_args;
+  std::string host_artifacts_path;
+  // Only used with local_image.
+  std::string product_out;
+
+  // Identifies the device the request asks for, regardless of which instance
+  // it runs as.
+  std::string Configuration() const;
+  // Whether every request of the configuration gets the same build. The
+  // latest build of a branch changes over time.
+  bool PinnedBuild() const;
+  // Changes whenever the host tools, or the local images, are rebuilt.
+  std::string ArtifactsFingerprint() const;
+};
+
+struct ConvertedAcloudCreateCommand {
+  InstanceLockFile lock;
+  std::vector<RequestWithStdio> requests;
+};
+
+class ConvertAcloudCreateCommand {
+ public:
+  INJECT(ConvertAcloudCreateCommand(InstanceLockFileManager& lock_file_manager))
+      : lock_file_manager_(lock_file_manager) {}
+
+  // Parses the arguments following `acloud create`.
+  static Result<AcloudCreateFlags> Parse(const cvd::CommandRequest& request,
+                                         std::vector<std::string> arguments);
+
+  // Returns the cvd requests starting the device as the locked instance.
+  static Result<std::vector<RequestWithStdio>> Requests(
+      const AcloudCreateFlags& flags, const InstanceLockFile& lock,
+      const std::vector<SharedFD>& fds, std::optional<ucred> credentials);
+
+  Result<ConvertedAcloudCreateCommand> Convert(const RequestWithStdio& request);
+
+ private:
+  InstanceLockFileManager& lock_file_manager_;
+};
+
+// The directory acloud runs a local instance from.
+std::string AcloudInstanceDirectory(int instance);
+
+}  // namespace cuttlefish
@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/fetch_coordinator.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <set>
+#include <thread>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "host/commands/cvd/instance_lock.h"
+
+namespace cuttlefish {
+namespace {
+
+// How often waiters check whether their request was interrupted.
+constexpr auto kInterruptPollPeriod = std::chrono::milliseconds(500);
+
+// fetch_cvd flags holding paths, which it resolves against its working
+// directory.
+const std::set<std::string> kPathFlags = {
+    "credential_source",
+    "flagfile",
+    "image_cache_dir",
+    "lazy_image_profile",
+};
+
+// fetch_cvd's boolean flags, which never take the next argument as their
+// value.
+const std::set<std::string> kBoolFlags = {
+    "download_img_zip",
+    "download_target_files_zip",
+    "lazy_images",
+};
+
+// Environment variables that change what fetch_cvd downloads or which
+// credentials it downloads with.
+const std::vector<std::string> kKeyEnvironment = {
+    "HOME",           "http_proxy",    "https_proxy",  "HTTPS_PROXY",
+    "no_proxy",       "NO_PROXY",      "all_proxy",    "ALL_PROXY",
+    "CURL_CA_BUNDLE", "SSL_CERT_FILE", "SSL_CERT_DIR",
+};
+
+// Returns the flag name of a "--name" or "--name=value" argument.
+std::string FlagName(const std::string& arg) {
+  auto name = arg.substr(0, arg.find('='));
+  return name.substr(name.find_first_not_of('-'));
+}
+
+// Makes a path relative to the request's working directory absolute. Returns
+// nothing when that isn't possible.
+std::optional<std::string> ResolvePath(const std::string& path,
+                                       const std::string& working_dir) {
+  if (path.empty() || path[0] == '/') {
+    return path;
+  }
+  if (working_dir.empty()) {
+    return {};
+  }
+  return working_dir + "/" + path;
+}
+
+// Returns the value of a path flag as it goes into the key, or nothing when it
+// can't be resolved.
+std::optional<std::string> PathFlagKey(const std::string& name,
+                                       const std::string& value,
+                                       const std::string& working_dir) {
+  auto resolved = ResolvePath(value, working_dir);
+  if (name == "credential_source") {
+    // Names a service account file when there is one at that path, or
+    // otherwise holds "gce" or a literal token.
+    if (resolved && FileExists(*resolved)) {
+      return *resolved;
+    }
+    return value;
+  }
+  if (!resolved) {
+    return {};
+  }
+  return *resolved;
+}
+
+Result<void> CopyFileContents(int source, int destination) {
+  char buffer[1 << 16];
+  for (;;) {
+    auto read = TEMP_FAILURE_RETRY(::read(source, buffer, sizeof(buffer)));
+    if (read < 0) {
+      return CF_ERRNO("Failed to read staged file");
+    } else if (read == 0) {
+      return {};
+    }
+    CF_EXPECT(android::base::WriteFully(destination, buffer, read),
+              "Failed to write fetched file: " << strerror(errno));
+  }
+}
+
+// Makes destination a read only view of source without copying data where
+// the filesystem allows it.
+Result<void> LinkFile(const std::string& source, const std::string& destination,
+                      mode_t mode) {
+  if (unlink(destination.c_str()) != 0 && errno != ENOENT) {
+    return CF_ERRNO("Failed to replace \"" << destination << "\"");
+  }
+  android::base::unique_fd source_fd(
+      TEMP_FAILURE_RETRY(open(source.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (source_fd.get() < 0) {
+    return CF_ERRNO("Failed to open \"" << source << "\"");
+  }
+  android::base::unique_fd destination_fd(TEMP_FAILURE_RETRY(
+      open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+           mode & 07777)));
+  if (destination_fd.get() < 0) {
+    return CF_ERRNO("Failed to create \"" << destination << "\"");
+  }
+  if (ioctl(destination_fd.get(), FICLONE, source_fd.get()) == 0) {
+    return {};
+  }
+  // No reflink support, e.g. ext4 or a different filesystem. Fall back to a
+  // hard link and only copy if that isn't possible either.
+  destination_fd.reset();
+  unlink(destination.c_str());
+  if (link(source.c_str(), destination.c_str()) == 0) {
+    return {};
+  }
+  destination_fd.reset(TEMP_FAILURE_RETRY(
+      open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+           mode & 07777)));
+  if (destination_fd.get() < 0) {
+    return CF_ERRNO("Failed to create \"" << destination << "\"");
+  }
+  CF_EXPECT(CopyFileContents(source_fd.get(), destination_fd.get()),
+            "Failed to copy \"" << source << "\" to \"" << destination
+                                << "\"");
+  return {};
+}
+
+Result<void> LinkTree(const std::string& source,
+                      const std::string& destination) {
+  CF_EXPECT(EnsureDirectoryExists(destination));
+  for (const auto& name : DirectoryContents(source)) {
+    if (name == "." || name == "..") {
+      continue;
+    }
+    auto source_path = source + "/" + name;
+    auto destination_path = destination + "/" + name;
+    struct stat st;
+    if (lstat(source_path.c_str(), &st) != 0) {
+      return CF_ERRNO("Failed to stat \"" << source_path << "\"");
+    }
+    if (S_ISDIR(st.st_mode)) {
+      CF_EXPECT(LinkTree(source_path, destination_path));
+    } else if (S_ISLNK(st.st_mode)) {
+      std::string target;
+      CF_EXPECT(android::base::Readlink(source_path, &target),
+                "Failed to read link \"" << source_path << "\"");
+      unlink(destination_path.c_str());
+      if (symlink(target.c_str(), destination_path.c_str()) != 0) {
+        return CF_ERRNO("Failed to create link \"" << destination_path
+                                                    << "\"");
+      }
+    } else if (S_ISREG(st.st_mode)) {
+      CF_EXPECT(LinkFile(source_path, destination_path, st.st_mode));
+    }
+  }
+  return {};
+}
+
+}  // namespace
+
+struct FetchCoordinator::Flight {
+  std::string staging_directory;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::optional<Subprocess> subprocess;
+  // Combined stdout and stderr of fetch_cvd so far.
+  std::string output;
+  bool done = false;
+  bool success = false;
+  std::string error;
+  // Number of requests still interested in the result. The last one out
+  // deletes the staging directory.
+  std::size_t waiters = 0;
+};
+
+FetchCoordinator::FetchCoordinator() = default;
+
+std::optional<std::string> FetchCoordinator::FlightKey(
+    const std::vector<std::string>& args,
+    const std::map<std::string, std::string>& env,
+    const std::string& working_dir) {
+  // Flags in the order gflags applies them, the last value of each wins. Flags
+  // and values are kept together so that swapping values between flags
+  // changes the key.
+  std::map<std::string, std::string> flags;
+  for (std::size_t i = 0; i < args.size(); i++) {
+    if (args[i].find("run_next_stage") != std::string::npos ||
+        args[i] == "--help" || args[i] == "-help") {
+      // Executes something after fetching, can't be shared.
+      return {};
+    }
+    if (args[i].size() < 2 || args[i][0] != '-' || args[i] == "--") {
+      // fetch_cvd takes no positional arguments.
+      return {};
+    }
+    auto name = FlagName(args[i]);
+    std::string value;
+    auto equals = args[i].find('=');
+    if (equals != std::string::npos) {
+      value = args[i].substr(equals + 1);
+    } else if (kBoolFlags.count(name)) {
+      value = "true";
+    } else if (android::base::StartsWith(name, "no") &&
+               kBoolFlags.count(name.substr(2))) {
+      name = name.substr(2);
+      value = "false";
+    } else if (i + 1 < args.size()) {
+      value = args[++i];
+    }
+    if (name == "directory") {
+      continue;
+    }
+    if (kPathFlags.count(name)) {
+      auto key_value = PathFlagKey(name, value, working_dir);
+      if (!key_value) {
+        return {};
+      }
+      value = *key_value;
+    }
+    flags[name] = value;
+  }
+  std::vector<std::string> key_args;
+  for (const auto& [name, value] : flags) {
+    key_args.push_back("--" + name + "=" + value);
+  }
+  // fetch_cvd runs with the server's environment overridden by the request's.
+  for (const auto& name : kKeyEnvironment) {
+    auto it = env.find(name);
+    std::string value =
+        it != env.end() ? it->second : StringFromEnv(name, "");
+    if (name == "HOME") {
+      // Locates the default acloud credentials, "." when unset.
+      auto home = ResolvePath(value.empty() ? "." : value, working_dir);
+      if (!home) {
+        return {};
+      }
+      value = *home;
+    }
+    key_args.push_back(name + "=" + value);
+  }
+  return android::base::Join(key_args, '\n');
+}
+
+Result<void> FetchCoordinator::StartFlight(
+    const std::string& key, const std::shared_ptr<Flight>& flight,
+    const std::string& target_directory, FetchStarter start) {
+  // Staged next to the target so that the files can be linked instead of
+  // copied, the temporary directory is often on another filesystem.
+  auto staging_parent = cpp_dirname(target_directory);
+  CF_EXPECT(EnsureDirectoryExists(staging_parent));
+  std::string staging_template = staging_parent + "/.cvd_fetch." +
+                                 cpp_basename(target_directory) + ".XXXXXX";
+  if (mkdtemp(staging_template.data()) == nullptr) {
+    return CF_ERRNO("Failed to create fetch staging directory");
+  }
+  SharedFD output_read, output_write;
+  CF_EXPECT(SharedFD::Pipe(&output_read, &output_write),
+            "Failed to create pipe: " << output_read->StrError());
+  {
+    std::lock_guard lock(flight->mutex);
+    flight->staging_directory = staging_template;
+    flight->subprocess = CF_EXPECT(start(staging_template, output_write));
+  }
+  output_write->Close();
+
+  std::thread([this, key, flight, output_read]() {
+    char buffer[4096];
+    for (;;) {
+      auto read = output_read->Read(buffer, sizeof(buffer));
+      if (read <= 0) {
+        break;
+      }
+      std::lock_guard lock(flight->mutex);
+      flight->output.append(buffer, read);
+      flight->cv.notify_all();
+    }
+    siginfo_t infop{};
+    // Same double wait as CvdCommandHandler, the pid can't be reused while a
+    // waiter may still try to stop the process.
+    auto result = flight->subprocess->Wait(&infop, WEXITED | WNOWAIT);
+    std::unique_lock lock(flight->mutex);
+    if (result != -1) {
+      result = flight->subprocess->Wait(&infop, WEXITED);
+    }
+    flight->subprocess.reset();
+    lock.unlock();
+    if (result == -1) {
+      FinishFlight(key, flight, false, "Lost track of fetch_cvd pid");
+    } else if (infop.si_code != CLD_EXITED) {
+      FinishFlight(key, flight, false,
+                   "fetch_cvd quit with signal " +
+                       std::to_string(infop.si_status));
+    } else if (infop.si_status != 0) {
+      FinishFlight(key, flight, false,
+                   "fetch_cvd exited with code " +
+                       std::to_string(infop.si_status));
+    } else {
+      FinishFlight(key, flight, true, "");
+    }
+  }).detach();
+  return {};
+}
+
+void FetchCoordinator::FinishFlight(const std::string& key,
+                                    const std::shared_ptr<Flight>& flight,
+                                    bool success, const std::string& error) {
+  {
+    // Requests arriving from now on start a new download.
+    std::lock_guard lock(flights_mutex_);
+    auto it = flights_.find(key);
+    if (it != flights_.end() && it->second == flight) {
+      flights_.erase(it);
+    }
+  }
+  std::unique_lock lock(flight->mutex);
+  flight->done = true;
+  flight->success = success;
+  flight->error = error;
+  flight->cv.notify_all();
+  if (flight->waiters == 0 && !flight->staging_directory.empty()) {
+    // Every waiter was interrupted.
+    auto staging_directory = flight->staging_directory;
+    lock.unlock();
+    RecursivelyRemoveDirectory(staging_directory);
+  }
+}
+
+void FetchCoordinator::ReleaseFlight(const std::shared_ptr<Flight>& flight) {
+  std::unique_lock lock(flight->mutex);
+  CHECK(flight->waiters > 0);
+  if (--flight->waiters > 0) {
+    return;
+  }
+  if (!flight->done) {
+    if (flight->subprocess) {
+      LOG(INFO) << "No requests left waiting for the fetch, stopping it";
+      flight->subprocess->Stop();
+    }
+    // The flight cleans up after itself once the process exits.
+    return;
+  }
+  auto staging_directory = flight->staging_directory;
+  lock.unlock();
+  if (!staging_directory.empty()) {
+    RecursivelyRemoveDirectory(staging_directory);
+  }
+}
+
+Result<void> FetchCoordinator::Fetch(const std::string& key,
+                                     const std::string& target_directory,
+                                     FetchStarter start, SharedFD progress,
+                                     std::function<bool()> interrupted) {
+  std::shared_ptr<Flight> flight;
+  bool leader = false;
+  {
+    std::lock_guard lock(flights_mutex_);
+    auto it = flights_.find(key);
+    if (it == flights_.end()) {
+      flight = std::make_shared<Flight>();
+      flights_[key] = flight;
+      leader = true;
+    } else {
+      flight = it->second;
+      LOG(INFO) << "Joining in-progress fetch for \"" << target_directory
+                << "\"";
+    }
+    std::lock_guard flight_lock(flight->mutex);
+    flight->waiters++;
+  }
+  if (leader) {
+    auto start_result =
+        StartFlight(key, flight, target_directory, std::move(start));
+    if (!start_result.ok()) {
+      FinishFlight(key, flight, false, start_result.error().message());
+    }
+  }
+
+  std::size_t forwarded = 0;
+  std::unique_lock lock(flight->mutex);
+  for (;;) {
+    if (flight->output.size() > forwarded) {
+      auto chunk = flight->output.substr(forwarded);
+      forwarded = flight->output.size();
+      lock.unlock();
+      WriteAll(progress, chunk);
+      lock.lock();
+      continue;
+    }
+    if (flight->done) {
+      break;
+    }
+    if (interrupted()) {
+      lock.unlock();
+      ReleaseFlight(flight);
+      return CF_ERR("Interrupted");
+    }
+    flight->cv.wait_for(lock, kInterruptPollPeriod);
+  }
+  bool success = flight->success;
+  auto error = flight->error;
+  auto staging_directory = flight->staging_directory;
+  lock.unlock();
+
+  Result<void> result;
+  if (success) {
+    result = LinkTree(staging_directory, target_directory);
+  } else {
+    result = CF_ERR("Fetch failed: " << error);
+  }
+  ReleaseFlight(flight);
+  return result;
+}
+
+}  // namespace cuttlefish
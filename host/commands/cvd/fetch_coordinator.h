@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fruit/fruit.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/subprocess.h"
+
+namespace cuttlefish {
+
+// Deduplicates concurrent `cvd fetch` requests for the same artifacts.
+//
+// The first request for a set of fetch arguments starts fetch_cvd into a
+// private staging directory next to its target directory, later identical
+// requests attach to that download instead of starting their own. Every
+// request receives the fetch output as it's produced and, once the download
+// succeeds, gets the staged files linked into its own target directory.
+// Fetched artifacts are treated as read only, files are reflinked where the
+// filesystem supports it and hard linked otherwise.
+class FetchCoordinator {
+ public:
+  // Starts fetch_cvd downloading into the given directory, with stdout and
+  // stderr redirected to output.
+  using FetchStarter = std::function<Result<Subprocess>(
+      const std::string& directory, SharedFD output)>;
+
+  INJECT(FetchCoordinator());
+
+  // Returns a key identifying the artifacts the fetch_cvd arguments refer to,
+  // independent of the target directory. Relative paths in the arguments are
+  // resolved against working_dir, and the environment variables fetch_cvd
+  // reads credentials and proxies from are part of the key. Returns nothing
+  // when the invocation can't be shared with other requests.
+  static std::optional<std::string> FlightKey(
+      const std::vector<std::string>& args,
+      const std::map<std::string, std::string>& env,
+      const std::string& working_dir);
+
+  // Fetches the artifacts identified by key into target_directory, starting a
+  // new download or joining one already in progress. Progress output is
+  // copied to progress. Returns early with an error if interrupted starts
+  // returning true, the download is stopped once no request is waiting for
+  // it anymore.
+  Result<void> Fetch(const std::string& key,
+                     const std::string& target_directory, FetchStarter start,
+                     SharedFD progress, std::function<bool()> interrupted);
+
+ private:
+  struct Flight;
+
+  Result<void> StartFlight(const std::string& key,
+                           const std::shared_ptr<Flight>& flight,
+                           const std::string& target_directory,
+                           FetchStarter start);
+  void FinishFlight(const std::string& key,
+                    const std::shared_ptr<Flight>& flight, bool success,
+                    const std::string& error);
+  void ReleaseFlight(const std::shared_ptr<Flight>& flight);
+
+  std::mutex flights_mutex_;
+  std::map<std::string, std::shared_ptr<Flight>> flights_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/fetch_coordinator.h"
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+std::optional<std::string> Key(const std::vector<std::string>& args,
+                               const std::string& working_dir = "/work") {
+  return FetchCoordinator::FlightKey(args, {}, working_dir);
+}
+
+TEST(FetchCoordinatorTest, SwappedValuesChangeKey) {
+  auto first = Key({"--default_build", "A", "--system_build", "B"});
+  auto second = Key({"--default_build", "B", "--system_build", "A"});
+  ASSERT_TRUE(first && second);
+  EXPECT_NE(*first, *second);
+}
+
+TEST(FetchCoordinatorTest, FlagOrderAndSyntaxDontChangeKey) {
+  auto key = Key({"--default_build", "A", "--system_build=B"});
+  ASSERT_TRUE(key);
+  EXPECT_EQ(Key({"--system_build", "B", "-default_build=A"}), key);
+}
+
+TEST(FetchCoordinatorTest, LastValueWins) {
+  auto key = Key({"--default_build=A", "--default_build=B"});
+  ASSERT_TRUE(key);
+  EXPECT_EQ(Key({"--default_build=B"}), key);
+  EXPECT_NE(Key({"--default_build=A"}), key);
+  EXPECT_NE(Key({"--default_build=B", "--default_build=A"}), key);
+}
+
+TEST(FetchCoordinatorTest, BoolFlagsDontTakeNextArgument) {
+  auto key = Key({"--lazy_images", "--default_build", "A"});
+  ASSERT_TRUE(key);
+  EXPECT_EQ(Key({"--default_build=A", "--lazy_images=true"}), key);
+  EXPECT_EQ(Key({"--default_build=A", "--nolazy_images"}),
+            Key({"--default_build=A", "--lazy_images=false"}));
+  EXPECT_NE(Key({"--default_build=A", "--nolazy_images"}), key);
+}
+
+TEST(FetchCoordinatorTest, TargetDirectoryDoesntChangeKey) {
+  auto key = Key({"--default_build=A", "--directory", "/a"});
+  ASSERT_TRUE(key);
+  EXPECT_EQ(Key({"--directory=/b", "--default_build=A"}), key);
+}
+
+TEST(FetchCoordinatorTest, ResolvesPathFlags) {
+  auto key = Key({"--image_cache_dir=cache"}, "/work");
+  ASSERT_TRUE(key);
+  EXPECT_EQ(Key({"--image_cache_dir", "/work/cache"}, "/other"), key);
+  EXPECT_FALSE(Key({"--image_cache_dir=cache"}, ""));
+}
+
+TEST(FetchCoordinatorTest, UnshareableInvocations) {
+  EXPECT_FALSE(Key({"--run_next_stage"}));
+  EXPECT_FALSE(Key({"--help"}));
+  EXPECT_FALSE(Key({"--default_build=A", "stray"}));
+}
+
+TEST(FetchCoordinatorTest, EnvironmentChangesKey) {
+  std::vector<std::string> args = {"--default_build=A"};
+  auto key = FetchCoordinator::FlightKey(args, {{"HOME", "/home/a"}}, "/work");
+  ASSERT_TRUE(key);
+  EXPECT_NE(FetchCoordinator::FlightKey(args, {{"HOME", "/home/b"}}, "/work"),
+            key);
+}
+
+}  // namespace
+}  // namespace cuttlefish
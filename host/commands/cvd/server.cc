@@ -47,22 +47,29 @@
 
 namespace cuttlefish {
 
-static fruit::Component<> RequestComponent(CvdServer* server,
-                                           InstanceManager* instance_manager) {
+static fruit::Component<> RequestComponent(
+    CvdServer* server, InstanceManager* instance_manager,
+    FetchCoordinator* fetch_coordinator, WarmPool* warm_pool) {
   return fruit::createComponent()
       .bindInstance(*server)
       .bindInstance(*instance_manager)
+      .bindInstance(*fetch_coordinator)
+      .bindInstance(*warm_pool)
       .install(AcloudCommandComponent)
       .install(cvdCommandComponent)
+      .install(cvdPoolComponent)
       .install(cvdShutdownComponent)
       .install(cvdVersionComponent);
 }
 
 static constexpr int kNumThreads = 10;
 
-CvdServer::CvdServer(EpollPool& epoll_pool, InstanceManager& instance_manager)
+CvdServer::CvdServer(EpollPool& epoll_pool, InstanceManager& instance_manager,
+                     FetchCoordinator& fetch_coordinator, WarmPool& warm_pool)
     : epoll_pool_(epoll_pool),
       instance_manager_(instance_manager),
+      fetch_coordinator_(fetch_coordinator),
+      warm_pool_(warm_pool),
       running_(true) {
   std::scoped_lock lock(threads_mutex_);
   for (auto i = 0; i < kNumThreads; i++) {
@@ -225,7 +232,8 @@ Result<void> CvdServer::HandleMessage(EpollEvent event) {
 
 Result<cvd::Response> CvdServer::HandleRequest(RequestWithStdio request,
                                                SharedFD client) {
-  fruit::Injector<> injector(RequestComponent, this, &instance_manager_);
+  fruit::Injector<> injector(RequestComponent, this, &instance_manager_,
+                             &fetch_coordinator_, &warm_pool_);
   auto possible_handlers = injector.getMultibindings<CvdServerHandler>();
 
   // Even if the interrupt callback outlives the request handler, it'll only
@@ -33,8 +33,10 @@
 #include "common/libs/utils/subprocess.h"
 #include "common/libs/utils/unix_sockets.h"
 #include "host/commands/cvd/epoll_loop.h"
+#include "host/commands/cvd/fetch_coordinator.h"
 #include "host/commands/cvd/instance_manager.h"
 #include "host/commands/cvd/server_client.h"
+#include "host/commands/cvd/warm_pool.h"
 
 namespace cuttlefish {
 
@@ -49,7 +51,8 @@ class CvdServerHandler {
 
 class CvdServer {
  public:
-  INJECT(CvdServer(EpollPool&, InstanceManager&));
+  INJECT(CvdServer(EpollPool&, InstanceManager&, FetchCoordinator&,
+                   WarmPool&));
   ~CvdServer();
 
   Result<void> StartServer(SharedFD server);
@@ -70,6 +73,8 @@ class CvdServer {
 
   EpollPool& epoll_pool_;
   InstanceManager& instance_manager_;
+  FetchCoordinator& fetch_coordinator_;
+  WarmPool& warm_pool_;
   std::atomic_bool running_ = true;
 
   std::mutex ongoing_requests_mutex_;
@@ -81,7 +86,9 @@ class CvdServer {
 
 class CvdCommandHandler : public CvdServerHandler {
  public:
-  INJECT(CvdCommandHandler(InstanceManager& instance_manager));
+  INJECT(CvdCommandHandler(InstanceManager& instance_manager,
+                           FetchCoordinator& fetch_coordinator,
+                           WarmPool& warm_pool));
 
   Result<bool> CanHandle(const RequestWithStdio&) const override;
   Result<cvd::Response> Handle(const RequestWithStdio&) override;
@@ -89,16 +96,21 @@ class CvdCommandHandler : public CvdServerHandler {
 
  private:
   InstanceManager& instance_manager_;
+  FetchCoordinator& fetch_coordinator_;
+  WarmPool& warm_pool_;
   std::optional<Subprocess> subprocess_;
   std::mutex interruptible_;
   bool interrupted_ = false;
 };
 
-fruit::Component<fruit::Required<InstanceManager>> cvdCommandComponent();
-fruit::Component<fruit::Required<CvdServer, InstanceManager>>
+fruit::Component<fruit::Required<InstanceManager, FetchCoordinator, WarmPool>>
+cvdCommandComponent();
+fruit::Component<fruit::Required<CvdServer, InstanceManager, WarmPool>>
 cvdShutdownComponent();
 fruit::Component<> cvdVersionComponent();
-fruit::Component<fruit::Required<CvdCommandHandler>> AcloudCommandComponent();
+fruit::Component<fruit::Required<WarmPool>> cvdPoolComponent();
+fruit::Component<fruit::Required<CvdCommandHandler, WarmPool>>
+AcloudCommandComponent();
 
 struct CommandInvocation {
   std::string command;
@@ -16,6 +16,7 @@
 
 #include "host/commands/cvd/server.h"
 
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -33,7 +34,9 @@
 #include "common/libs/utils/flag_parser.h"
 #include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/cvd/fetch_coordinator.h"
 #include "host/commands/cvd/instance_manager.h"
+#include "host/commands/cvd/warm_pool.h"
 #include "host/libs/config/cuttlefish_config.h"
 
 namespace cuttlefish {
@@ -59,6 +62,7 @@ Commands:
   clear               Stop all running devices and delete all instance and assembly directories.
   fleet               View the current fleet status.
   kill-server         Kill the cvd_server background process.
+  pool                Keep devices booted for `acloud create` requests.
   status              Check and print the state of a running instance.
   host_bugreport      Capture a host bugreport, including configs, logs, and tombstones.
 
@@ -83,10 +87,36 @@ const std::map<std::string, std::string> CommandToBinaryMap = {
     {"mkdir", kMkdirBin},
     {"fleet", kFleetBin}};
 
+// Returns the absolute directory fetch_cvd would download into, if it can be
+// determined without running it.
+std::optional<std::string> FetchTargetDirectory(
+    std::vector<std::string> args, const std::string& working_dir) {
+  std::string directory;
+  if (!ParseFlags({GflagsCompatFlag("directory", directory)}, args)) {
+    return {};
+  }
+  if (directory.empty()) {
+    directory = working_dir;
+  } else if (directory[0] != '/') {
+    if (working_dir.empty()) {
+      return {};
+    }
+    directory = working_dir + "/" + directory;
+  }
+  if (directory.empty()) {
+    return {};
+  }
+  return directory;
+}
+
 }  // namespace
 
-CvdCommandHandler::CvdCommandHandler(InstanceManager& instance_manager)
-    : instance_manager_(instance_manager) {}
+CvdCommandHandler::CvdCommandHandler(InstanceManager& instance_manager,
+                                     FetchCoordinator& fetch_coordinator,
+                                     WarmPool& warm_pool)
+    : instance_manager_(instance_manager),
+      fetch_coordinator_(fetch_coordinator),
+      warm_pool_(warm_pool) {}
 
 Result<bool> CvdCommandHandler::CanHandle(
     const RequestWithStdio& request) const {
@@ -154,6 +184,7 @@ Result<cvd::Response> CvdCommandHandler::Handle(
     bin = it->second;
     args_copy.push_back("--help");
   } else if (bin == kClearBin) {
+    warm_pool_.Clear();
     *response.mutable_status() =
         instance_manager_.CvdClear(request.Out(), request.Err());
     return response;
@@ -235,6 +266,42 @@ Result<cvd::Response> CvdCommandHandler::Handle(
     command.SetWorkingDirectory(fd);
   }
 
+  if (bin == kFetchBin && request.Message().command_request().wait_behavior() !=
+                              cvd::WAIT_BEHAVIOR_START) {
+    const auto& request_env = request.Message().command_request().env();
+    std::map<std::string, std::string> env(request_env.begin(),
+                                           request_env.end());
+    auto flight_key = FetchCoordinator::FlightKey(args_copy, env, working_dir);
+    auto target_dir = FetchTargetDirectory(args_copy, working_dir);
+    if (flight_key && target_dir) {
+      interrupt_lock.unlock();
+      auto start = [&command, options](
+                       const std::string& directory,
+                       SharedFD output) -> Result<Subprocess> {
+        command.AddParameter("--directory=", directory);
+        command.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, output);
+        command.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, output);
+        auto subprocess = command.Start(options);
+        CF_EXPECT(subprocess.Started(), "Failed to start fetch_cvd");
+        return subprocess;
+      };
+      auto interrupted = [this]() {
+        std::scoped_lock lock(interruptible_);
+        return interrupted_;
+      };
+      auto fetched =
+          fetch_coordinator_.Fetch(*flight_key, *target_dir, std::move(start),
+                                   request.Err(), std::move(interrupted));
+      if (!fetched.ok()) {
+        response.mutable_status()->set_code(cvd::Status::INTERNAL);
+        response.mutable_status()->set_message(fetched.error().message());
+        return response;
+      }
+      response.mutable_status()->set_code(cvd::Status::OK);
+      return response;
+    }
+  }
+
   subprocess_ = command.Start(options);
 
   if (request.Message().command_request().wait_behavior() ==
@@ -285,6 +352,7 @@ Result<cvd::Response> CvdCommandHandler::Handle(
 
 Result<void> CvdCommandHandler::Interrupt() {
   std::scoped_lock interrupt_lock(interruptible_);
+  interrupted_ = true;
   if (subprocess_) {
     auto stop_result = subprocess_->Stop();
     switch (stop_result) {
@@ -330,7 +398,8 @@ CommandInvocation ParseInvocation(const cvd::Request& request) {
   return invocation;
 }
 
-fruit::Component<fruit::Required<InstanceManager>> cvdCommandComponent() {
+fruit::Component<fruit::Required<InstanceManager, FetchCoordinator, WarmPool>>
+cvdCommandComponent() {
   return fruit::createComponent()
       .addMultibinding<CvdServerHandler, CvdCommandHandler>();
 }
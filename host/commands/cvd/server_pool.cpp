@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/server.h"
+
+#include <string>
+#include <vector>
+
+#include <android-base/parseint.h>
+#include <fruit/fruit.h>
+#include <json/json.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/flag_parser.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/acloud_command.h"
+#include "host/commands/cvd/warm_pool.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kPoolHelpMessage[] =
+    R"(Keeps devices booted for `acloud create` requests.
+
+usage: cvd pool <command> <args>
+
+Commands:
+  set --size=<n> <acloud create args>
+                      Keep n devices of the configuration booted. An
+                      `acloud create --local-instance` request for the same
+                      configuration gets one of them right away. A size of 0
+                      stops the devices kept. Only local images or a
+                      --build-id can be pooled, devices of rebuilt images
+                      are replaced.
+  recycle <instance>  Powerwash a device handed out and keep it booted for
+                      the next request.
+  status              Print the pools with their hits, misses and how long
+                      booting their devices took.
+)";
+
+class CvdPoolHandler : public CvdServerHandler {
+ public:
+  INJECT(CvdPoolHandler(WarmPool& warm_pool)) : warm_pool_(warm_pool) {}
+
+  Result<bool> CanHandle(const RequestWithStdio& request) const override {
+    return ParseInvocation(request.Message()).command == "pool";
+  }
+
+  Result<cvd::Response> Handle(const RequestWithStdio& request) override {
+    CF_EXPECT(CanHandle(request));
+    cvd::Response response;
+    response.mutable_command_response();
+    response.mutable_status()->set_code(cvd::Status::OK);
+
+    auto arguments = ParseInvocation(request.Message()).arguments;
+    if (arguments.empty()) {
+      WriteAll(request.Out(), kPoolHelpMessage);
+      return response;
+    }
+    auto subcommand = arguments[0];
+    arguments.erase(arguments.begin());
+
+    if (subcommand == "set") {
+      int size = -1;
+      CF_EXPECT(ParseFlags({GflagsCompatFlag("size", size)}, arguments));
+      CF_EXPECT(size >= 0, "Expected --size=<n>");
+      auto flags = CF_EXPECT(ConvertAcloudCreateCommand::Parse(
+          request.Message().command_request(), arguments));
+      CF_EXPECT(!flags.local_instance,
+                "The pool chooses the instances of its devices");
+      CF_EXPECT(warm_pool_.Resize(flags, size));
+    } else if (subcommand == "recycle") {
+      int instance = 0;
+      CF_EXPECT(arguments.size() == 1 &&
+                    android::base::ParseInt(arguments[0], &instance),
+                "Expected an instance number");
+      CF_EXPECT(warm_pool_.Recycle(instance));
+    } else if (subcommand == "status") {
+      Json::StreamWriterBuilder builder;
+      WriteAll(request.Out(),
+               Json::writeString(builder, warm_pool_.Stats()) + "\n");
+    } else {
+      WriteAll(request.Out(), kPoolHelpMessage);
+    }
+    return response;
+  }
+
+  Result<void> Interrupt() override { return CF_ERR("Can't interrupt"); }
+
+ private:
+  WarmPool& warm_pool_;
+};
+
+}  // namespace
+
+fruit::Component<fruit::Required<WarmPool>> cvdPoolComponent() {
+  return fruit::createComponent()
+      .addMultibinding<CvdServerHandler, CvdPoolHandler>();
+}
+
+}  // namespace cuttlefish
@@ -24,6 +24,7 @@
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/result.h"
 #include "host/commands/cvd/instance_manager.h"
+#include "host/commands/cvd/warm_pool.h"
 
 namespace cuttlefish {
 namespace {
@@ -31,8 +32,11 @@ namespace {
 class CvdShutdownHandler : public CvdServerHandler {
  public:
   INJECT(CvdShutdownHandler(CvdServer& server,
-                            InstanceManager& instance_manager))
-      : server_(server), instance_manager_(instance_manager) {}
+                            InstanceManager& instance_manager,
+                            WarmPool& warm_pool))
+      : server_(server),
+        instance_manager_(instance_manager),
+        warm_pool_(warm_pool) {}
 
   Result<bool> CanHandle(const RequestWithStdio& request) const override {
     return request.Message().contents_case() ==
@@ -52,6 +56,7 @@ class CvdShutdownHandler : public CvdServerHandler {
     }
 
     if (request.Message().shutdown_request().clear()) {
+      warm_pool_.Clear();
       *response.mutable_status() =
           instance_manager_.CvdClear(request.Out(), request.Err());
       if (response.status().code() != cvd::Status::OK) {
@@ -83,11 +88,12 @@ class CvdShutdownHandler : public CvdServerHandler {
  private:
   CvdServer& server_;
   InstanceManager& instance_manager_;
+  WarmPool& warm_pool_;
 };
 
 }  // namespace
 
-fruit::Component<fruit::Required<CvdServer, InstanceManager>>
+fruit::Component<fruit::Required<CvdServer, InstanceManager, WarmPool>>
 cvdShutdownComponent() {
   return fruit::createComponent()
       .addMultibinding<CvdServerHandler, CvdShutdownHandler>();
@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/warm_pool.h"
+
+#include <fcntl.h>
+
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/commands/cvd/command_sequence.h"
+#include "host/commands/cvd/server.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kPowerwashBin[] = "powerwash_cvd";
+
+// How long a pool waits after failing to boot a device before trying again.
+constexpr auto kRefillRetryDelay = std::chrono::minutes(1);
+
+double Seconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+Result<SharedFD> DevNull() {
+  auto dev_null = SharedFD::Open("/dev/null", O_RDWR);
+  CF_EXPECT(dev_null->IsOpen(), dev_null->StrError());
+  return dev_null;
+}
+
+}  // namespace
+
+struct WarmPool::Pool {
+  AcloudCreateFlags flags;
+  std::size_t size = 0;
+  // Booted devices waiting to be handed out.
+  std::deque<Device> ready;
+  // Devices given back, waiting to be powerwashed.
+  std::deque<Device> returned;
+  // Devices booted from artifacts rebuilt since, waiting to be stopped.
+  std::deque<InstanceLockFile> outdated;
+  // The handler booting a device, to interrupt it when the pool goes away.
+  CvdCommandHandler* booting = nullptr;
+  bool stopping = false;
+  std::thread worker;
+
+  std::uint64_t hits = 0;
+  std::uint64_t misses = 0;
+  std::uint64_t refills = 0;
+  std::uint64_t failed_refills = 0;
+  std::uint64_t recycles = 0;
+  std::uint64_t failed_recycles = 0;
+  std::chrono::steady_clock::duration last_refill{};
+  std::chrono::steady_clock::duration total_refill{};
+};
+
+WarmPool::WarmPool(InstanceManager& instance_manager,
+                   FetchCoordinator& fetch_coordinator)
+    : instance_manager_(instance_manager),
+      fetch_coordinator_(fetch_coordinator) {}
+
+WarmPool::~WarmPool() { Clear(); }
+
+Result<void> WarmPool::Resize(const AcloudCreateFlags& flags,
+                              std::size_t size) {
+  auto configuration = flags.Configuration();
+  CF_EXPECT(size == 0 || flags.PinnedBuild(),
+            "Only local images or a --build-id can be pooled, the latest "
+            "build of a branch changes");
+  std::unique_ptr<Pool> removed;
+  std::vector<InstanceLockFile> surplus;
+  {
+    std::lock_guard lock(mutex_);
+    auto it = pools_.find(configuration);
+    if (size == 0) {
+      CF_EXPECT(it != pools_.end(), "No pool for \"" << configuration << "\"");
+      removed = std::move(it->second);
+      pools_.erase(it);
+      for (auto handed_out = handed_out_.begin();
+           handed_out != handed_out_.end();) {
+        if (handed_out->second.configuration == configuration) {
+          handed_out = handed_out_.erase(handed_out);
+        } else {
+          handed_out++;
+        }
+      }
+    } else if (it == pools_.end()) {
+      auto pool = std::make_unique<Pool>();
+      pool->flags = flags;
+      pool->size = size;
+      auto& pool_ref = *pool;
+      pools_[configuration] = std::move(pool);
+      pool_ref.worker = std::thread([this, &pool_ref]() { Work(pool_ref); });
+    } else {
+      auto& pool = *it->second;
+      pool.size = size;
+      while (pool.ready.size() > size) {
+        surplus.emplace_back(std::move(pool.ready.back().instance));
+        pool.ready.pop_back();
+      }
+      cv_.notify_all();
+    }
+  }
+  if (removed) {
+    Shutdown(*removed);
+  }
+  for (auto& instance : surplus) {
+    Stop(instance);
+  }
+  return {};
+}
+
+std::optional<int> WarmPool::Take(const AcloudCreateFlags& flags) {
+  auto configuration = flags.Configuration();
+  std::lock_guard lock(mutex_);
+  auto it = pools_.find(configuration);
+  if (it == pools_.end()) {
+    return {};
+  }
+  auto& pool = *it->second;
+  auto artifacts = flags.ArtifactsFingerprint();
+  // Devices are booted in order, any outdated ones come first.
+  while (!pool.ready.empty() && pool.ready.front().artifacts != artifacts) {
+    pool.outdated.emplace_back(std::move(pool.ready.front().instance));
+    pool.ready.pop_front();
+  }
+  cv_.notify_all();
+  if (pool.ready.empty()) {
+    pool.misses++;
+    return {};
+  }
+  pool.hits++;
+  // The device stays marked in use, only its lock is let go of.
+  int instance = pool.ready.front().instance.Instance();
+  handed_out_[instance] =
+      HandedOut{configuration, std::move(pool.ready.front().artifacts)};
+  pool.ready.pop_front();
+  return instance;
+}
+
+Result<void> WarmPool::Recycle(int instance) {
+  auto instance_lock = CF_EXPECT(lock_file_manager_.TryAcquireLock(instance));
+  CF_EXPECT(instance_lock.has_value(), "Instance " << instance << " is busy");
+  std::lock_guard lock(mutex_);
+  auto handed_out = handed_out_.find(instance);
+  CF_EXPECT(handed_out != handed_out_.end(),
+            "Instance " << instance << " didn't come from a warm pool");
+  auto pool = pools_.find(handed_out->second.configuration);
+  CF_EXPECT(pool != pools_.end(),
+            "The warm pool of instance " << instance << " is gone");
+  pool->second->returned.emplace_back(
+      Device{std::move(*instance_lock), handed_out->second.artifacts});
+  handed_out_.erase(handed_out);
+  cv_.notify_all();
+  return {};
+}
+
+void WarmPool::Clear() {
+  std::map<std::string, std::unique_ptr<Pool>> pools;
+  {
+    std::lock_guard lock(mutex_);
+    pools = std::move(pools_);
+    pools_.clear();
+    handed_out_.clear();
+  }
+  for (auto& [configuration, pool] : pools) {
+    Shutdown(*pool);
+  }
+}
+
+Json::Value WarmPool::Stats() const {
+  std::lock_guard lock(mutex_);
+  Json::Value stats(Json::objectValue);
+  for (const auto& [configuration, pool] : pools_) {
+    Json::Value& pool_stats = stats[configuration];
+    pool_stats["size"] = static_cast<Json::UInt64>(pool->size);
+    pool_stats["ready"] = static_cast<Json::UInt64>(pool->ready.size());
+    pool_stats["outdated"] = static_cast<Json::UInt64>(pool->outdated.size());
+    pool_stats["booting"] = pool->booting != nullptr;
+    pool_stats["hits"] = static_cast<Json::UInt64>(pool->hits);
+    pool_stats["misses"] = static_cast<Json::UInt64>(pool->misses);
+    pool_stats["refills"] = static_cast<Json::UInt64>(pool->refills);
+    pool_stats["failed_refills"] =
+        static_cast<Json::UInt64>(pool->failed_refills);
+    pool_stats["recycles"] = static_cast<Json::UInt64>(pool->recycles);
+    pool_stats["failed_recycles"] =
+        static_cast<Json::UInt64>(pool->failed_recycles);
+    pool_stats["last_refill_seconds"] = Seconds(pool->last_refill);
+    pool_stats["mean_refill_seconds"] =
+        pool->refills == 0 ? 0.0 : Seconds(pool->total_refill) / pool->refills;
+  }
+  return stats;
+}
+
+void WarmPool::Work(Pool& pool) {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [&pool]() {
+      return pool.stopping || !pool.outdated.empty() ||
+             !pool.returned.empty() || pool.ready.size() < pool.size;
+    });
+    if (pool.stopping) {
+      return;
+    }
+    if (!pool.outdated.empty()) {
+      auto instance = std::move(pool.outdated.front());
+      pool.outdated.pop_front();
+      lock.unlock();
+      Stop(instance);
+      lock.lock();
+      continue;
+    }
+    // A powerwash is much faster than booting another device.
+    if (!pool.returned.empty()) {
+      auto device = std::move(pool.returned.front());
+      pool.returned.pop_front();
+      lock.unlock();
+      auto powerwashed = Powerwash(device.instance);
+      lock.lock();
+      if (!powerwashed.ok()) {
+        LOG(ERROR) << "Failed to recycle instance "
+                   << device.instance.Instance() << ": "
+                   << powerwashed.error();
+        pool.failed_recycles++;
+      } else if (pool.ready.size() < pool.size) {
+        pool.recycles++;
+        pool.ready.emplace_back(std::move(device));
+        continue;
+      }
+      lock.unlock();
+      Stop(device.instance);
+      lock.lock();
+      continue;
+    }
+    auto start = std::chrono::steady_clock::now();
+    lock.unlock();
+    // Taken first, so that a rebuild during the boot outdates the device.
+    auto artifacts = pool.flags.ArtifactsFingerprint();
+    auto booted = Boot(pool);
+    lock.lock();
+    if (!booted.ok()) {
+      if (pool.stopping) {
+        return;
+      }
+      LOG(ERROR) << "Failed to boot a warm device for \""
+                 << pool.flags.Configuration() << "\": " << booted.error();
+      pool.failed_refills++;
+      // Devices given back or outdated don't wait for the retry.
+      cv_.wait_for(lock, kRefillRetryDelay, [&pool]() {
+        return pool.stopping || !pool.returned.empty() ||
+               !pool.outdated.empty();
+      });
+      continue;
+    }
+    auto latency = std::chrono::steady_clock::now() - start;
+    pool.refills++;
+    pool.last_refill = latency;
+    pool.total_refill += latency;
+    pool.ready.emplace_back(Device{std::move(*booted), std::move(artifacts)});
+  }
+}
+
+Result<InstanceLockFile> WarmPool::Boot(Pool& pool) {
+  auto instance = CF_EXPECT(lock_file_manager_.TryAcquireUnusedLock());
+  CF_EXPECT(instance.has_value(), "Could not acquire instance lock");
+  CF_EXPECT(CF_EXPECT(instance->Status()) == InUseState::kNotInUse);
+  CF_EXPECT(instance->Status(InUseState::kInUse));
+
+  auto dev_null = CF_EXPECT(DevNull());
+  auto requests = ConvertAcloudCreateCommand::Requests(
+      pool.flags, *instance, {dev_null, dev_null, dev_null}, {});
+  if (!requests.ok()) {
+    instance->Status(InUseState::kNotInUse);
+    CF_EXPECT(std::move(requests));
+  }
+
+  CvdCommandHandler handler(instance_manager_, fetch_coordinator_, *this);
+  CommandSequenceExecutor executor(handler);
+  {
+    std::lock_guard lock(mutex_);
+    if (pool.stopping) {
+      instance->Status(InUseState::kNotInUse);
+      return CF_ERR("Interrupted");
+    }
+    pool.booting = &handler;
+  }
+  auto executed = executor.Execute(*requests, dev_null);
+  {
+    std::lock_guard lock(mutex_);
+    pool.booting = nullptr;
+  }
+  if (!executed.ok()) {
+    // The device may have started before failing.
+    Stop(*instance);
+    CF_EXPECT(std::move(executed));
+  }
+  return std::move(*instance);
+}
+
+Result<void> WarmPool::Powerwash(const InstanceLockFile& instance) {
+  auto home = AcloudInstanceDirectory(instance.Instance());
+  auto group = CF_EXPECT(instance_manager_.GetInstanceGroup(home));
+  auto config_path = GetCuttlefishConfigPath(home);
+  CF_EXPECT(config_path.has_value(), "No device config in \"" << home << "\"");
+
+  Command command(group.host_binaries_dir + kPowerwashBin);
+  command.AddParameter("--instance_num=", instance.Instance());
+  command.AddEnvironmentVariable(kCuttlefishConfigEnvVarName, *config_path);
+  command.AddEnvironmentVariable("HOME", home);
+  auto dev_null = CF_EXPECT(DevNull());
+  command.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, dev_null);
+  command.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, dev_null);
+  auto exit_code = command.Start().Wait();
+  CF_EXPECT(exit_code == 0, kPowerwashBin << " exited with " << exit_code);
+  return {};
+}
+
+void WarmPool::Stop(InstanceLockFile& instance) {
+  auto home = AcloudInstanceDirectory(instance.Instance());
+  auto group = instance_manager_.GetInstanceGroup(home);
+  auto config_path = GetCuttlefishConfigPath(home);
+  if (group.ok() && config_path) {
+    Command command(group->host_binaries_dir + kStopBin);
+    command.AddParameter("--clear_instance_dirs");
+    command.AddEnvironmentVariable(kCuttlefishConfigEnvVarName, *config_path);
+    if (int exit_code = command.Start().Wait(); exit_code != 0) {
+      LOG(ERROR) << "Failed to stop warm instance " << instance.Instance()
+                 << ", " << kStopBin << " exited with " << exit_code;
+    }
+  }
+  instance_manager_.RemoveInstanceGroup(home);
+  auto released = instance.Status(InUseState::kNotInUse);
+  if (!released.ok()) {
+    LOG(ERROR) << "Failed to release instance " << instance.Instance() << ": "
+               << released.error();
+  }
+}
+
+void WarmPool::Shutdown(Pool& pool) {
+  {
+    std::lock_guard lock(mutex_);
+    pool.stopping = true;
+    if (pool.booting) {
+      auto interrupted = pool.booting->Interrupt();
+      if (!interrupted.ok()) {
+        LOG(ERROR) << "Failed to interrupt a warm device boot: "
+                   << interrupted.error();
+      }
+    }
+    cv_.notify_all();
+  }
+  if (pool.worker.joinable()) {
+    pool.worker.join();
+  }
+  for (auto& device : pool.ready) {
+    Stop(device.instance);
+  }
+  for (auto& device : pool.returned) {
+    Stop(device.instance);
+  }
+  for (auto& instance : pool.outdated) {
+    Stop(instance);
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include <fruit/fruit.h>
+#include <json/json.h>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/acloud_command.h"
+#include "host/commands/cvd/fetch_coordinator.h"
+#include "host/commands/cvd/instance_lock.h"
+#include "host/commands/cvd/instance_manager.h"
+
+namespace cuttlefish {
+
+// Keeps booted devices of frequently requested `acloud create`
+// configurations, so requests for them don't wait for a boot.
+//
+// Every configuration given a pool has a worker booting devices until the
+// pool is full. `acloud create` requests for the configuration take a device
+// from the pool when one is ready, which the worker then replaces. Devices
+// handed out can be given back to be powerwashed and handed out again.
+// Pooled devices are marked in use, and are stopped with the pool.
+//
+// Only pinned builds are pooled. Devices booted before their host tools or
+// local images were rebuilt are never handed out, but stopped and replaced.
+class WarmPool {
+ public:
+  INJECT(WarmPool(InstanceManager& instance_manager,
+                  FetchCoordinator& fetch_coordinator));
+  virtual ~WarmPool();
+
+  // Keeps size devices of the configuration booted, or none with a size of 0.
+  Result<void> Resize(const AcloudCreateFlags& flags, std::size_t size);
+
+  // Hands out a booted device of the request's configuration, if its pool
+  // has one built from the current artifacts. Counts as a hit or a miss of
+  // the pool.
+  std::optional<int> Take(const AcloudCreateFlags& flags);
+
+  // Returns an instance handed out by Take to its pool.
+  Result<void> Recycle(int instance);
+
+  // Stops every pooled device and forgets every pool.
+  void Clear();
+
+  // Sizes and counters of every pool, by configuration.
+  Json::Value Stats() const;
+
+ protected:
+  struct Pool;
+
+  // Overridden by tests, which have to Clear before they are destroyed.
+  virtual Result<InstanceLockFile> Boot(Pool& pool);
+  virtual Result<void> Powerwash(const InstanceLockFile& instance);
+  virtual void Stop(InstanceLockFile& instance);
+
+ private:
+  // A booted device, with the fingerprint of the artifacts it was booted from.
+  struct Device {
+    InstanceLockFile instance;
+    std::string artifacts;
+  };
+  struct HandedOut {
+    std::string configuration;
+    std::string artifacts;
+  };
+
+  void Work(Pool& pool);
+  void Shutdown(Pool& pool);
+
+  InstanceManager& instance_manager_;
+  FetchCoordinator& fetch_coordinator_;
+  InstanceLockFileManager lock_file_manager_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<std::string, std::unique_ptr<Pool>> pools_;
+  std::map<int, HandedOut> handed_out_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/warm_pool.h"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/acloud_command.h"
+#include "host/commands/cvd/fetch_coordinator.h"
+#include "host/commands/cvd/instance_lock.h"
+#include "host/commands/cvd/instance_manager.h"
+
+namespace cuttlefish {
+namespace {
+
+// Hands out lock files of made up instances instead of booting devices.
+class FakeWarmPool : public WarmPool {
+ public:
+  FakeWarmPool(InstanceManager& instance_manager,
+               FetchCoordinator& fetch_coordinator)
+      : WarmPool(instance_manager, fetch_coordinator) {}
+  ~FakeWarmPool() override { Clear(); }
+
+  void FailBoots(bool fail) {
+    std::lock_guard lock(mutex_);
+    fail_boots_ = fail;
+  }
+  std::vector<int> Powerwashed() {
+    std::lock_guard lock(mutex_);
+    return powerwashed_;
+  }
+  std::vector<int> Stopped() {
+    std::lock_guard lock(mutex_);
+    return stopped_;
+  }
+
+ protected:
+  Result<InstanceLockFile> Boot(Pool&) override {
+    std::lock_guard lock(mutex_);
+    CF_EXPECT(!fail_boots_, "Failed to boot on purpose");
+    auto instance =
+        CF_EXPECT(lock_file_manager_.TryAcquireLock(next_instance_++));
+    CF_EXPECT(instance.has_value());
+    CF_EXPECT(instance->Status(InUseState::kInUse));
+    return std::move(*instance);
+  }
+
+  Result<void> Powerwash(const InstanceLockFile& instance) override {
+    std::lock_guard lock(mutex_);
+    powerwashed_.push_back(instance.Instance());
+    return {};
+  }
+
+  void Stop(InstanceLockFile& instance) override {
+    std::lock_guard lock(mutex_);
+    stopped_.push_back(instance.Instance());
+    instance.Status(InUseState::kNotInUse);
+  }
+
+ private:
+  InstanceLockFileManager lock_file_manager_;
+  std::mutex mutex_;
+  bool fail_boots_ = false;
+  int next_instance_ = 1;
+  std::vector<int> powerwashed_;
+  std::vector<int> stopped_;
+};
+
+class WarmPoolTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // Keeps the instance lock files away from those of real devices.
+    setenv("TMPDIR", temp_dir_.path, 1);
+    host_out_ = std::string(temp_dir_.path) + "/host";
+    product_out_ = std::string(temp_dir_.path) + "/product";
+    ASSERT_TRUE(EnsureDirectoryExists(host_out_).ok());
+    ASSERT_TRUE(EnsureDirectoryExists(host_out_ + "/bin").ok());
+    ASSERT_TRUE(EnsureDirectoryExists(product_out_).ok());
+    WriteFile(host_out_ + "/bin/launch_cvd", "launch_cvd");
+    WriteFile(product_out_ + "/super.img", "super");
+  }
+
+  void TearDown() override { unsetenv("TMPDIR"); }
+
+  void WriteFile(const std::string& path, const std::string& contents) {
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, path));
+  }
+
+  AcloudCreateFlags BuildFlags(const std::string& build_id) {
+    AcloudCreateFlags flags;
+    flags.local_instance_set = true;
+    flags.build_id = build_id;
+    flags.host_artifacts_path = host_out_;
+    return flags;
+  }
+
+  AcloudCreateFlags LocalImageFlags() {
+    AcloudCreateFlags flags;
+    flags.local_instance_set = true;
+    flags.local_image = true;
+    flags.host_artifacts_path = host_out_;
+    flags.product_out = product_out_;
+    return flags;
+  }
+
+  Json::Value Stats(const AcloudCreateFlags& flags) {
+    return pool_.Stats()[flags.Configuration()];
+  }
+
+  // Waits for the pool workers to get there, failing after a while instead of
+  // hanging.
+  bool WaitFor(const std::function<bool()>& condition) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!condition()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+  }
+
+  bool WaitForReady(const AcloudCreateFlags& flags, unsigned int ready) {
+    return WaitFor([&]() { return Stats(flags)["ready"].asUInt() == ready; });
+  }
+
+  TemporaryDir temp_dir_;
+  std::string host_out_;
+  std::string product_out_;
+  InstanceLockFileManager lock_file_manager_;
+  InstanceManager instance_manager_{lock_file_manager_};
+  FetchCoordinator fetch_coordinator_;
+  FakeWarmPool pool_{instance_manager_, fetch_coordinator_};
+};
+
+TEST_F(WarmPoolTest, FillsPool) {
+  auto flags = BuildFlags("1234");
+  ASSERT_TRUE(pool_.Resize(flags, 2).ok());
+  ASSERT_TRUE(WaitForReady(flags, 2));
+  EXPECT_EQ(Stats(flags)["size"].asUInt(), 2u);
+  EXPECT_EQ(Stats(flags)["refills"].asUInt(), 2u);
+  EXPECT_EQ(Stats(flags)["failed_refills"].asUInt(), 0u);
+}
+
+TEST_F(WarmPoolTest, RejectsUnpinnedBuilds) {
+  AcloudCreateFlags flags;
+  flags.branch = "aosp-master";
+  flags.host_artifacts_path = host_out_;
+  EXPECT_FALSE(pool_.Resize(flags, 1).ok());
+  EXPECT_TRUE(pool_.Stats().empty());
+}
+
+TEST_F(WarmPoolTest, ResizeToZeroStopsDevices) {
+  auto flags = BuildFlags("1234");
+  EXPECT_FALSE(pool_.Resize(flags, 0).ok());
+  ASSERT_TRUE(pool_.Resize(flags, 2).ok());
+  ASSERT_TRUE(WaitForReady(flags, 2));
+  ASSERT_TRUE(pool_.Resize(flags, 0).ok());
+  EXPECT_EQ(pool_.Stopped().size(), 2u);
+  EXPECT_TRUE(pool_.Stats().empty());
+}
+
+TEST_F(WarmPoolTest, TakeHitsAndRefills) {
+  auto flags = BuildFlags("1234");
+  ASSERT_TRUE(pool_.Resize(flags, 1).ok());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+
+  auto instance = pool_.Take(flags);
+  ASSERT_TRUE(instance.has_value());
+  EXPECT_EQ(Stats(flags)["hits"].asUInt(), 1u);
+  ASSERT_TRUE(WaitFor([&]() { return Stats(flags)["refills"].asUInt() == 2; }));
+  ASSERT_TRUE(WaitForReady(flags, 1));
+
+  auto second = pool_.Take(flags);
+  ASSERT_TRUE(second.has_value());
+  EXPECT_NE(*second, *instance);
+  // Handed out devices aren't the pool's to stop anymore.
+  EXPECT_TRUE(pool_.Stopped().empty());
+}
+
+TEST_F(WarmPoolTest, TakeOtherConfigurationMisses) {
+  auto flags = BuildFlags("1234");
+  ASSERT_TRUE(pool_.Resize(flags, 1).ok());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+  EXPECT_FALSE(pool_.Take(BuildFlags("5678")).has_value());
+  EXPECT_EQ(Stats(flags)["hits"].asUInt(), 0u);
+  EXPECT_EQ(Stats(flags)["ready"].asUInt(), 1u);
+}
+
+TEST_F(WarmPoolTest, TakeFromEmptyPoolMisses) {
+  pool_.FailBoots(true);
+  auto flags = BuildFlags("1234");
+  ASSERT_TRUE(pool_.Resize(flags, 1).ok());
+  ASSERT_TRUE(WaitFor(
+      [&]() { return Stats(flags)["failed_refills"].asUInt() == 1; }));
+  EXPECT_FALSE(pool_.Take(flags).has_value());
+  EXPECT_EQ(Stats(flags)["misses"].asUInt(), 1u);
+}
+
+TEST_F(WarmPoolTest, RecyclePowerwashesDevice) {
+  auto flags = BuildFlags("1234");
+  ASSERT_TRUE(pool_.Resize(flags, 1).ok());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+  // Leaves room in the pool for the recycled device.
+  pool_.FailBoots(true);
+  auto instance = pool_.Take(flags);
+  ASSERT_TRUE(instance.has_value());
+
+  ASSERT_TRUE(pool_.Recycle(*instance).ok());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+  EXPECT_EQ(Stats(flags)["recycles"].asUInt(), 1u);
+  EXPECT_EQ(pool_.Powerwashed(), std::vector<int>{*instance});
+  EXPECT_EQ(pool_.Take(flags), instance);
+}
+
+TEST_F(WarmPoolTest, RecycleRejectsOtherInstances) {
+  EXPECT_FALSE(pool_.Recycle(1).ok());
+
+  auto flags = BuildFlags("1234");
+  ASSERT_TRUE(pool_.Resize(flags, 1).ok());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+  // Still in the pool, its lock is held.
+  EXPECT_FALSE(pool_.Recycle(1).ok());
+}
+
+TEST_F(WarmPoolTest, ReplacesDevicesOfRebuiltImages) {
+  auto flags = LocalImageFlags();
+  ASSERT_TRUE(pool_.Resize(flags, 1).ok());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+
+  WriteFile(product_out_ + "/super.img", "rebuilt super");
+  EXPECT_FALSE(pool_.Take(flags).has_value());
+  EXPECT_EQ(Stats(flags)["misses"].asUInt(), 1u);
+  ASSERT_TRUE(WaitFor([&]() { return pool_.Stopped().size() == 1; }));
+  EXPECT_EQ(pool_.Stopped()[0], 1);
+
+  ASSERT_TRUE(WaitForReady(flags, 1));
+  auto instance = pool_.Take(flags);
+  ASSERT_TRUE(instance.has_value());
+  EXPECT_NE(*instance, 1);
+}
+
+TEST_F(WarmPoolTest, ReplacesDevicesOfRebuiltHostTools) {
+  auto flags = BuildFlags("1234");
+  ASSERT_TRUE(pool_.Resize(flags, 1).ok());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+
+  WriteFile(host_out_ + "/bin/assemble_cvd", "assemble_cvd");
+  EXPECT_FALSE(pool_.Take(flags).has_value());
+  ASSERT_TRUE(WaitForReady(flags, 1));
+  EXPECT_TRUE(pool_.Take(flags).has_value());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -31,14 +31,24 @@ bool SmsSender::Send(const std::string& content,
   if (pdu_format_str.empty()) {
     return false;
   }
+  if (modem_id_ && *modem_id_ != modem_id) {
+    LOG(ERROR) << "Connection already used for modem " << *modem_id_
+               << ", can't send to modem " << modem_id;
+    return false;
+  }
+  std::string at_command = "AT+REMOTESMS=" + pdu_format_str + "\r";
+  // The modem simulator hands the connection over to the modem named by the
+  // first message, which then reads the following commands directly.
   // https://cs.android.com/android/platform/superproject/+/master:device/google/cuttlefish/host/commands/modem_simulator/main.cpp;l=151;drc=cbfe7dba44bfea95049152b828c1a5d35c9e0522
-  std::string at_command = "REM" + std::to_string(modem_id) +
-                           "AT+REMOTESMS=" + pdu_format_str + "\r";
+  if (!modem_id_) {
+    at_command = "REM" + std::to_string(modem_id) + at_command;
+  }
   if (WriteAll(modem_simulator_client_fd_, at_command) != at_command.size()) {
     LOG(ERROR) << "Error writing to socket: "
                << modem_simulator_client_fd_->StrError();
     return false;
   }
+  modem_id_ = modem_id;
   return true;
 }
 }  // namespace cuttlefish
@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include <optional>
 #include <string>
 
 #include "common/libs/fs/shared_fd.h"
@@ -25,11 +26,14 @@ class SmsSender {
  public:
   SmsSender(SharedFD modem_simulator_client_fd);
 
-  // Returns true if SMS was successfully sent, returns false otherwise.
+  // Returns true if SMS was successfully sent, returns false otherwise. The
+  // connection is bound to the modem of the first message, later messages
+  // reuse it and must target the same modem.
   bool Send(const std::string& sms_body, const std::string& sender_number,
             uint32_t modem_id = 0);
 
  private:
   SharedFD modem_simulator_client_fd_;
+  std::optional<uint32_t> modem_id_;
 };
 }  // namespace cuttlefish
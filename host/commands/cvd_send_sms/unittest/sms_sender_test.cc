@@ -80,5 +80,18 @@ TEST_F(SmsSenderTest, NonDefaultModemIdValueSucceeds) {
       "REM1AT+REMOTESMS=0001000b916105214365f700000ae8329bfd4697d9ec37\r");
 }
 
+TEST_F(SmsSenderTest, ReusedConnectionSkipsModemPrefix) {
+  SmsSender sender(client_fd_);
+
+  EXPECT_TRUE(sender.Send("hellohello", "+16501234567", 1));
+  AssertCommandIsSent(
+      "REM1AT+REMOTESMS=0001000b916105214365f700000ae8329bfd4697d9ec37\r");
+  EXPECT_TRUE(sender.Send("hellohello", "+16501234567", 1));
+  AssertCommandIsSent(
+      "AT+REMOTESMS=0001000b916105214365f700000ae8329bfd4697d9ec37\r");
+
+  EXPECT_FALSE(sender.Send("hellohello", "+16501234567", 0));
+}
+
 }  // namespace
 }  // namespace cuttlefish
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/device_control/device_update.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance to update");
+
+// Usage examples:
+//   * cvd_device_control < battery_drain.jsonl
+//   * echo '{"type": "battery", "key": "aconline", "value": "0"}' |
+//         cvd_device_control --instance_num=2
+//
+// Reads one update per line of the standard input, see device_update.h for
+// the format, and streams them to the device control service of the
+// instance. Prints the updates that failed and exits with an error if any
+// did.
+
+namespace cuttlefish {
+namespace {
+
+Result<void> DeviceControlClientMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get(), "Failed to obtain config");
+  auto client = CF_EXPECT(
+      DeviceControlClient::Connect(config->ForInstance(FLAGS_instance_num)));
+
+  std::uint64_t sent = 0;
+  Result<void> sending = {};
+  std::thread sender([&client, &sent, &sending]() {
+    sending = [&client, &sent]() -> Result<void> {
+      std::string line;
+      while (std::getline(std::cin, line)) {
+        if (line.empty()) {
+          continue;
+        }
+        auto update = CF_EXPECT(ParseDeviceUpdate(line),
+                                "Invalid update on line " << sent + 1);
+        CF_EXPECT(client.Send(update));
+        sent++;
+      }
+      return {};
+    }();
+    // Also on errors, so that the results of the updates sent are received.
+    auto finished = client.FinishSending();
+    if (!finished.ok()) {
+      LOG(ERROR) << finished.error();
+    }
+  });
+
+  std::uint64_t failed = 0;
+  std::uint64_t received = 0;
+  Result<void> receiving = {};
+  while (true) {
+    auto result = client.ReadResult();
+    if (!result.ok()) {
+      receiving = CF_ERR(result.error().message());
+      break;
+    }
+    if (!*result) {
+      break;
+    }
+    received++;
+    if (!(*result)->error.empty()) {
+      failed++;
+      std::cerr << "Update " << (*result)->index << " failed: "
+                << (*result)->error << std::endl;
+    }
+  }
+  sender.join();
+  CF_EXPECT(std::move(sending));
+  CF_EXPECT(std::move(receiving));
+  CF_EXPECT(received == sent,
+            "Only " << received << " of " << sent << " updates were applied");
+  CF_EXPECT(failed == 0, failed << " of " << sent << " updates failed");
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::DeviceControlClientMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/device_control/crosvm_battery.h"
+
+#include <sys/socket.h>
+
+#include <map>
+#include <utility>
+
+#include <android-base/logging.h>
+
+#include "common/libs/utils/subprocess.h"
+
+namespace cuttlefish {
+namespace {
+
+// Names of the serde serialized BatStatus and BatHealth variants, see
+// crosvm's vm_control/src/lib.rs.
+const std::map<std::string, std::string> kStatuses = {
+    {"unknown", "Unknown"},         {"charging", "Charging"},
+    {"discharging", "DisCharging"}, {"notcharging", "NotCharging"},
+    {"full", "Full"},
+};
+const std::map<std::string, std::string> kHealths = {
+    {"unknown", "Unknown"},
+    {"good", "Good"},
+    {"overheat", "Overheat"},
+    {"dead", "Dead"},
+    {"overvoltage", "OverVoltage"},
+    {"unexpectedfailure", "UnexpectedFailure"},
+    {"cold", "Cold"},
+    {"watchdogtimerexpire", "WatchdogTimerExpire"},
+    {"safetytimerexpire", "SafetyTimerExpire"},
+    {"overcurrent", "OverCurrent"},
+};
+const std::map<std::string, std::string> kNumericCommands = {
+    {"present", "SetPresent"},
+    {"capacity", "SetCapacity"},
+    {"aconline", "SetACOnline"},
+};
+
+constexpr char kOkResponse[] = "{\"BatResponse\":\"Ok\"}";
+
+}  // namespace
+
+Result<std::string> CrosvmBatteryRequest(const std::string& key,
+                                         const std::string& value) {
+  std::string command;
+  if (key == "status") {
+    auto it = kStatuses.find(value);
+    CF_EXPECT(it != kStatuses.end(), "Unknown battery status " << value);
+    command = "{\"SetStatus\":\"" + it->second + "\"}";
+  } else if (key == "health") {
+    auto it = kHealths.find(value);
+    CF_EXPECT(it != kHealths.end(), "Unknown battery health " << value);
+    command = "{\"SetHealth\":\"" + it->second + "\"}";
+  } else {
+    auto it = kNumericCommands.find(key);
+    CF_EXPECT(it != kNumericCommands.end(), "Unknown battery property " << key);
+    CF_EXPECT(!value.empty() &&
+                  value.find_first_not_of("0123456789") == std::string::npos,
+              "Expected a number for " << key << ", got " << value);
+    command = "{\"" + it->second + "\":" + value + "}";
+  }
+  return "{\"BatCommand\":[\"Goldfish\"," + command + "]}";
+}
+
+CrosvmBattery::CrosvmBattery(std::string crosvm_binary,
+                             std::string control_socket)
+    : crosvm_binary_(std::move(crosvm_binary)),
+      control_socket_(std::move(control_socket)) {}
+
+Result<void> CrosvmBattery::Set(const std::string& key,
+                                const std::string& value) {
+  if (use_client_) {
+    CF_EXPECT(RunClient(key, value));
+    return {};
+  }
+  auto request = CF_EXPECT(CrosvmBatteryRequest(key, value));
+  auto response = SendRequest(request);
+  if (!response.ok()) {
+    LOG(WARNING) << "Control socket request failed, running the crosvm client "
+                 << "for battery updates from now on: " << response.error();
+    connection_->Close();
+    use_client_ = true;
+    CF_EXPECT(RunClient(key, value));
+    return {};
+  }
+  // A valid answer, the connection stays usable.
+  CF_EXPECT(*response == kOkResponse,
+            "crosvm refused " << request << ": " << *response);
+  return {};
+}
+
+Result<std::string> CrosvmBattery::SendRequest(const std::string& request) {
+  if (!connection_->IsOpen()) {
+    // crosvm serves every control connection until the client hangs up.
+    connection_ = SharedFD::SocketLocalClient(control_socket_, false,
+                                              SOCK_SEQPACKET);
+    CF_EXPECT(connection_->IsOpen(), "Could not connect to \""
+                                         << control_socket_
+                                         << "\": " << connection_->StrError());
+  }
+  // One message per request and per response on the seqpacket socket.
+  CF_EXPECT(connection_->Send(request.data(), request.size(), MSG_NOSIGNAL) ==
+                static_cast<ssize_t>(request.size()),
+            "Failed to send the request: " << connection_->StrError());
+  std::string response(4096, '\0');
+  auto received = connection_->Recv(response.data(), response.size(), 0);
+  CF_EXPECT(received > 0, "No response from crosvm: "
+                              << (received == 0 ? "connection closed"
+                                                : connection_->StrError()));
+  response.resize(received);
+  return response;
+}
+
+Result<void> CrosvmBattery::RunClient(const std::string& key,
+                                      const std::string& value) {
+  Command command(crosvm_binary_);
+  command.AddParameter("battery");
+  command.AddParameter("goldfish");
+  command.AddParameter(key);
+  command.AddParameter(value);
+  command.AddParameter(control_socket_);
+
+  std::string output, error;
+  auto ret = RunWithManagedStdio(std::move(command), nullptr, &output, &error);
+  CF_EXPECT(ret == 0, "goldfish battery returned: " << ret << "\n"
+                                                    << output << "\n"
+                                                    << error);
+  return {};
+}
+
+}  // namespace cuttlefish
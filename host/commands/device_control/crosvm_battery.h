@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <string>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Request crosvm accepts on its control socket to set a goldfish battery
+// property, as sent by `crosvm battery goldfish <key> <value>`.
+Result<std::string> CrosvmBatteryRequest(const std::string& key,
+                                         const std::string& value);
+
+/**
+ * Sets goldfish battery properties through a connection to the crosvm control
+ * socket that is kept open across updates, rather than running a crosvm
+ * client process per update.
+ *
+ * Falls back to running the crosvm client if crosvm drops the connection
+ * without answering, which is what it does with requests it can't decode.
+ */
+class CrosvmBattery {
+ public:
+  CrosvmBattery(std::string crosvm_binary, std::string control_socket);
+
+  Result<void> Set(const std::string& key, const std::string& value);
+
+ private:
+  // Fails only if the connection is unusable.
+  Result<std::string> SendRequest(const std::string& request);
+  Result<void> RunClient(const std::string& key, const std::string& value);
+
+  std::string crosvm_binary_;
+  std::string control_socket_;
+  SharedFD connection_;
+  bool use_client_ = false;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/device_control/device_update.h"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <android-base/parseint.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kTimeMs[] = "time_ms";
+constexpr char kType[] = "type";
+constexpr char kKey[] = "key";
+constexpr char kValue[] = "value";
+constexpr char kSender[] = "sender";
+constexpr char kBody[] = "body";
+constexpr char kModemId[] = "modem_id";
+constexpr char kIndex[] = "index";
+constexpr char kAppliedMs[] = "applied_ms";
+constexpr char kError[] = "error";
+
+constexpr char kBattery[] = "battery";
+constexpr char kSms[] = "sms";
+
+const std::vector<std::string> kBatteryStatuses = {
+    "unknown", "charging", "discharging", "notcharging", "full",
+};
+const std::vector<std::string> kBatteryHealths = {
+    "unknown",           "good",        "overheat",
+    "dead",              "overvoltage", "unexpectedfailure",
+    "cold",              "watchdogtimerexpire",
+    "safetytimerexpire", "overcurrent",
+};
+
+bool Contains(const std::vector<std::string>& values, const std::string& v) {
+  return std::find(values.begin(), values.end(), v) != values.end();
+}
+
+Result<Json::Value> ParseJsonLine(const std::string& line) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value json;
+  std::string errors;
+  CF_EXPECT(reader->parse(line.data(), line.data() + line.size(), &json,
+                          &errors),
+            "Invalid JSON \"" << line << "\": " << errors);
+  CF_EXPECT(json.isObject(), "Expected a JSON object, got \"" << line << "\"");
+  return json;
+}
+
+std::string WriteJsonLine(const Json::Value& json) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, json);
+}
+
+Result<std::string> GetString(const Json::Value& json, const char* key) {
+  CF_EXPECT(json.isMember(key) && json[key].isString(),
+            "Missing string \"" << key << "\"");
+  return json[key].asString();
+}
+
+}  // namespace
+
+Result<void> ValidateBatteryProperty(const std::string& key,
+                                     const std::string& value) {
+  if (key == "status") {
+    CF_EXPECT(Contains(kBatteryStatuses, value),
+              "Unknown battery status \"" << value << "\"");
+  } else if (key == "health") {
+    CF_EXPECT(Contains(kBatteryHealths, value),
+              "Unknown battery health \"" << value << "\"");
+  } else if (key == "present" || key == "aconline") {
+    CF_EXPECT(value == "0" || value == "1",
+              "Expected 0 or 1 for " << key << ", got \"" << value << "\"");
+  } else if (key == "capacity") {
+    int capacity = 0;
+    CF_EXPECT(android::base::ParseInt(value, &capacity, 0, 100),
+              "Expected a capacity from 0 to 100, got \"" << value << "\"");
+  } else {
+    return CF_ERR("Unknown battery property \"" << key << "\"");
+  }
+  return {};
+}
+
+Result<DeviceUpdate> ParseDeviceUpdate(const std::string& line) {
+  auto json = CF_EXPECT(ParseJsonLine(line));
+  DeviceUpdate update;
+  if (json.isMember(kTimeMs)) {
+    CF_EXPECT(json[kTimeMs].isIntegral() && json[kTimeMs].asInt64() >= 0,
+              "\"" << kTimeMs << "\" must be a non-negative integer");
+    update.time_ms = json[kTimeMs].asInt64();
+  }
+  auto type = CF_EXPECT(GetString(json, kType));
+  if (type == kBattery) {
+    update.type = DeviceUpdate::Type::kBattery;
+    update.key = CF_EXPECT(GetString(json, kKey));
+    update.value = CF_EXPECT(GetString(json, kValue));
+    CF_EXPECT(ValidateBatteryProperty(update.key, update.value));
+  } else if (type == kSms) {
+    update.type = DeviceUpdate::Type::kSms;
+    update.sender = CF_EXPECT(GetString(json, kSender));
+    update.body = CF_EXPECT(GetString(json, kBody));
+    if (json.isMember(kModemId)) {
+      CF_EXPECT(json[kModemId].isUInt(),
+                "\"" << kModemId << "\" must be a non-negative integer");
+      update.modem_id = json[kModemId].asUInt();
+    }
+  } else {
+    return CF_ERR("Unknown update type \"" << type << "\"");
+  }
+  return update;
+}
+
+std::string SerializeDeviceUpdate(const DeviceUpdate& update) {
+  Json::Value json(Json::objectValue);
+  if (update.time_ms) {
+    json[kTimeMs] = static_cast<Json::Int64>(*update.time_ms);
+  }
+  switch (update.type) {
+    case DeviceUpdate::Type::kBattery:
+      json[kType] = kBattery;
+      json[kKey] = update.key;
+      json[kValue] = update.value;
+      break;
+    case DeviceUpdate::Type::kSms:
+      json[kType] = kSms;
+      json[kSender] = update.sender;
+      json[kBody] = update.body;
+      json[kModemId] = update.modem_id;
+      break;
+  }
+  return WriteJsonLine(json);
+}
+
+Result<DeviceUpdateResult> ParseDeviceUpdateResult(const std::string& line) {
+  auto json = CF_EXPECT(ParseJsonLine(line));
+  CF_EXPECT(json[kIndex].isUInt64(), "Missing \"" << kIndex << "\"");
+  DeviceUpdateResult result;
+  result.index = json[kIndex].asUInt64();
+  if (json.isMember(kError)) {
+    result.error = CF_EXPECT(GetString(json, kError));
+  } else {
+    CF_EXPECT(json[kAppliedMs].isInt64(), "Missing \"" << kAppliedMs << "\"");
+    result.applied_ms = json[kAppliedMs].asInt64();
+  }
+  return result;
+}
+
+std::string SerializeDeviceUpdateResult(const DeviceUpdateResult& result) {
+  Json::Value json(Json::objectValue);
+  json[kIndex] = static_cast<Json::UInt64>(result.index);
+  if (result.error.empty()) {
+    json[kAppliedMs] = static_cast<Json::Int64>(result.applied_ms);
+  } else {
+    json[kError] = result.error;
+  }
+  return WriteJsonLine(json);
+}
+
+LineReader::LineReader(SharedFD fd) : fd_(std::move(fd)) {}
+
+Result<std::optional<std::string>> LineReader::ReadLine() {
+  while (true) {
+    auto newline = buffer_.find('\n');
+    if (newline != std::string::npos) {
+      auto line = buffer_.substr(0, newline);
+      buffer_.erase(0, newline + 1);
+      return line;
+    }
+    char chunk[4096];
+    auto bytes_read = fd_->Read(chunk, sizeof(chunk));
+    CF_EXPECT(bytes_read >= 0, "Read failed: " << fd_->StrError());
+    if (bytes_read == 0) {
+      CF_EXPECT(buffer_.empty(), "Connection closed in the middle of a line");
+      return std::nullopt;
+    }
+    buffer_.append(chunk, bytes_read);
+  }
+}
+
+DeviceControlClient::DeviceControlClient(SharedFD fd)
+    : fd_(fd), reader_(fd) {}
+
+Result<DeviceControlClient> DeviceControlClient::Connect(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto path = instance.device_control_socket_path();
+  auto fd = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+  CF_EXPECT(fd->IsOpen(), "Could not connect to the device control service at "
+                              << path << ": " << fd->StrError());
+  return DeviceControlClient(fd);
+}
+
+Result<void> DeviceControlClient::Send(const DeviceUpdate& update) {
+  auto line = SerializeDeviceUpdate(update) + "\n";
+  CF_EXPECT(WriteAll(fd_, line) == static_cast<ssize_t>(line.size()),
+            "Failed to send the update: " << fd_->StrError());
+  return {};
+}
+
+Result<void> DeviceControlClient::FinishSending() {
+  CF_EXPECT(fd_->Shutdown(SHUT_WR) == 0,
+            "Failed to close the connection: " << fd_->StrError());
+  return {};
+}
+
+Result<std::optional<DeviceUpdateResult>> DeviceControlClient::ReadResult() {
+  auto line = CF_EXPECT(reader_.ReadLine());
+  if (!line) {
+    return std::nullopt;
+  }
+  return CF_EXPECT(ParseDeviceUpdateResult(*line));
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+
+/**
+ * One change of the emulated device state, sent to the device control
+ * service as a line of JSON, for example
+ *
+ *   {"time_ms": 1000, "type": "battery", "key": "capacity", "value": "42"}
+ *   {"type": "sms", "sender": "+16501234567", "body": "hello", "modem_id": 0}
+ *
+ * The service applies the updates of a connection in order, each one no
+ * earlier than `time_ms` after the first update of the connection was
+ * received. Updates without a time are applied as soon as the previous ones
+ * are. For every update the service answers with a line holding its index in
+ * the stream and either the time it was applied or an error:
+ *
+ *   {"index": 0, "applied_ms": 1000}
+ *   {"index": 1, "error": "..."}
+ */
+struct DeviceUpdate {
+  enum class Type {
+    // Goldfish battery and AC power supply properties, as with `health`.
+    kBattery,
+    kSms,
+  };
+
+  Type type = Type::kBattery;
+  std::optional<std::int64_t> time_ms;
+
+  // kBattery: status, health, present, capacity or aconline.
+  std::string key;
+  std::string value;
+
+  // kSms
+  std::string sender;
+  std::string body;
+  std::uint32_t modem_id = 0;
+};
+
+Result<DeviceUpdate> ParseDeviceUpdate(const std::string& line);
+// Single line of JSON, without the trailing newline.
+std::string SerializeDeviceUpdate(const DeviceUpdate& update);
+
+struct DeviceUpdateResult {
+  std::uint64_t index = 0;
+  std::int64_t applied_ms = 0;
+  // Empty if the update was applied.
+  std::string error;
+};
+
+Result<DeviceUpdateResult> ParseDeviceUpdateResult(const std::string& line);
+std::string SerializeDeviceUpdateResult(const DeviceUpdateResult& result);
+
+// Checks the key and value of a battery update.
+Result<void> ValidateBatteryProperty(const std::string& key,
+                                     const std::string& value);
+
+// Splits a stream into lines, for reading either side of the protocol.
+class LineReader {
+ public:
+  LineReader(SharedFD fd);
+
+  // Returns an empty optional once the other side closed the connection.
+  Result<std::optional<std::string>> ReadLine();
+
+ private:
+  SharedFD fd_;
+  std::string buffer_;
+};
+
+// Client side of a device control service connection.
+class DeviceControlClient {
+ public:
+  static Result<DeviceControlClient> Connect(
+      const CuttlefishConfig::InstanceSpecific& instance);
+
+  // Queues an update, results are read separately. Clients sending many
+  // updates read the results from another thread, as the service stops
+  // reading updates while its results are not read.
+  Result<void> Send(const DeviceUpdate& update);
+  // Lets the service know no more updates are coming.
+  Result<void> FinishSending();
+  // Returns an empty optional once all results were read.
+  Result<std::optional<DeviceUpdateResult>> ReadResult();
+
+ private:
+  DeviceControlClient(SharedFD fd);
+
+  SharedFD fd_;
+  LineReader reader_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/device_control/crosvm_battery.h"
+#include "host/commands/device_control/device_update.h"
+
+namespace cuttlefish {
+namespace {
+
+TEST(DeviceUpdateTest, BatteryRoundTrip) {
+  auto update = ParseDeviceUpdate(
+      R"({"time_ms": 1500, "type": "battery", "key": "capacity", "value": "42"})");
+  ASSERT_TRUE(update.ok()) << update.error();
+  ASSERT_EQ(update->type, DeviceUpdate::Type::kBattery);
+  ASSERT_EQ(update->time_ms, 1500);
+  ASSERT_EQ(update->key, "capacity");
+  ASSERT_EQ(update->value, "42");
+
+  auto parsed = ParseDeviceUpdate(SerializeDeviceUpdate(*update));
+  ASSERT_TRUE(parsed.ok()) << parsed.error();
+  ASSERT_EQ(parsed->time_ms, 1500);
+  ASSERT_EQ(parsed->value, "42");
+}
+
+TEST(DeviceUpdateTest, Sms) {
+  auto update = ParseDeviceUpdate(
+      R"({"type": "sms", "sender": "+16501234567", "body": "hello"})");
+  ASSERT_TRUE(update.ok()) << update.error();
+  ASSERT_EQ(update->type, DeviceUpdate::Type::kSms);
+  ASSERT_FALSE(update->time_ms.has_value());
+  ASSERT_EQ(update->body, "hello");
+  ASSERT_EQ(update->modem_id, 0);
+}
+
+TEST(DeviceUpdateTest, Invalid) {
+  ASSERT_FALSE(ParseDeviceUpdate("not json").ok());
+  ASSERT_FALSE(ParseDeviceUpdate(R"({"type": "gps"})").ok());
+  ASSERT_FALSE(ParseDeviceUpdate(
+                   R"({"type": "battery", "key": "capacity", "value": "101"})")
+                   .ok());
+  ASSERT_FALSE(ParseDeviceUpdate(
+                   R"({"type": "battery", "key": "status", "value": "empty"})")
+                   .ok());
+  ASSERT_FALSE(ParseDeviceUpdate(R"({"time_ms": -1, "type": "battery", )"
+                                 R"("key": "present", "value": "1"})")
+                   .ok());
+}
+
+TEST(DeviceUpdateTest, Results) {
+  DeviceUpdateResult applied;
+  applied.index = 3;
+  applied.applied_ms = 250;
+  auto parsed = ParseDeviceUpdateResult(SerializeDeviceUpdateResult(applied));
+  ASSERT_TRUE(parsed.ok()) << parsed.error();
+  ASSERT_EQ(parsed->index, 3);
+  ASSERT_EQ(parsed->applied_ms, 250);
+  ASSERT_TRUE(parsed->error.empty());
+
+  DeviceUpdateResult failed;
+  failed.index = 4;
+  failed.error = "no battery";
+  parsed = ParseDeviceUpdateResult(SerializeDeviceUpdateResult(failed));
+  ASSERT_TRUE(parsed.ok()) << parsed.error();
+  ASSERT_EQ(parsed->error, "no battery");
+}
+
+TEST(DeviceUpdateTest, LineReader) {
+  SharedFD reader_fd, writer_fd;
+  ASSERT_TRUE(
+      SharedFD::SocketPair(AF_LOCAL, SOCK_STREAM, 0, &reader_fd, &writer_fd));
+  std::string data = "first\nsec";
+  ASSERT_EQ(WriteAll(writer_fd, data), data.size());
+  data = "ond\n\nthird";
+  ASSERT_EQ(WriteAll(writer_fd, data), data.size());
+  writer_fd->Close();
+
+  LineReader reader(reader_fd);
+  for (const auto& expected : {"first", "second", ""}) {
+    auto line = reader.ReadLine();
+    ASSERT_TRUE(line.ok()) << line.error();
+    ASSERT_EQ(*line, expected);
+  }
+  // The last line is missing its newline.
+  ASSERT_FALSE(reader.ReadLine().ok());
+}
+
+TEST(CrosvmBatteryTest, Requests) {
+  auto request = CrosvmBatteryRequest("status", "discharging");
+  ASSERT_TRUE(request.ok()) << request.error();
+  ASSERT_EQ(*request,
+            R"({"BatCommand":["Goldfish",{"SetStatus":"DisCharging"}]})");
+
+  request = CrosvmBatteryRequest("aconline", "1");
+  ASSERT_TRUE(request.ok()) << request.error();
+  ASSERT_EQ(*request, R"({"BatCommand":["Goldfish",{"SetACOnline":1}]})");
+
+  ASSERT_FALSE(CrosvmBatteryRequest("capacity", "1,2").ok());
+  ASSERT_FALSE(CrosvmBatteryRequest("voltage", "1").ok());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd_send_sms/sms_sender.h"
+#include "host/commands/device_control/crosvm_battery.h"
+#include "host/commands/device_control/device_update.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/logging.h"
+#include "host/libs/vm_manager/crosvm_manager.h"
+
+DEFINE_int32(server_fd, -1,
+             "File descriptor to an already created unix socket server. Must "
+             "be specified.");
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The state shared by all client connections: one connection to crosvm and
+// one per modem, created on first use and kept for the life of the device.
+class DeviceControl {
+ public:
+  DeviceControl(const CuttlefishConfig& config,
+                const CuttlefishConfig::InstanceSpecific& instance)
+      : config_(config), instance_(instance) {}
+
+  Result<void> Apply(const DeviceUpdate& update) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    switch (update.type) {
+      case DeviceUpdate::Type::kBattery:
+        CF_EXPECT(ApplyBattery(update));
+        break;
+      case DeviceUpdate::Type::kSms:
+        CF_EXPECT(ApplySms(update));
+        break;
+    }
+    return {};
+  }
+
+ private:
+  Result<void> ApplyBattery(const DeviceUpdate& update) {
+    CF_EXPECT(config_.vm_manager() == vm_manager::CrosvmManager::name(),
+              "Battery updates are only supported with crosvm");
+    if (!battery_) {
+      battery_ = std::make_unique<CrosvmBattery>(
+          config_.crosvm_binary(),
+          instance_.PerInstanceInternalPath("crosvm_control.sock"));
+    }
+    CF_EXPECT(battery_->Set(update.key, update.value));
+    return {};
+  }
+
+  Result<void> ApplySms(const DeviceUpdate& update) {
+    CF_EXPECT(config_.enable_modem_simulator(),
+              "The device was launched without the modem simulator");
+    auto it = sms_senders_.find(update.modem_id);
+    if (it == sms_senders_.end()) {
+      // See host/commands/modem_simulator/main.cpp for the monitor socket.
+      auto socket_name = "modem_simulator" +
+                         std::to_string(instance_.modem_simulator_host_id());
+      auto fd = SharedFD::SocketLocalClient(socket_name, true, SOCK_STREAM);
+      CF_EXPECT(fd->IsOpen(), "Could not connect to the modem simulator: "
+                                  << fd->StrError());
+      it = sms_senders_.emplace(update.modem_id, SmsSender(fd)).first;
+    }
+    if (!it->second.Send(update.body, update.sender, update.modem_id)) {
+      // Reconnect for the next message, the modem simulator may have been
+      // restarted.
+      sms_senders_.erase(it);
+      return CF_ERR("Failed to send the SMS");
+    }
+    return {};
+  }
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  std::mutex mutex_;
+  std::unique_ptr<CrosvmBattery> battery_;
+  std::map<std::uint32_t, SmsSender> sms_senders_;
+};
+
+Result<void> WriteResult(SharedFD client, const DeviceUpdateResult& result) {
+  auto line = SerializeDeviceUpdateResult(result) + "\n";
+  CF_EXPECT(WriteAll(client, line) == static_cast<ssize_t>(line.size()),
+            "Failed to answer the client: " << client->StrError());
+  return {};
+}
+
+Result<void> ApplyLine(DeviceControl& device_control, const std::string& line,
+                       Clock::time_point start) {
+  auto update = CF_EXPECT(ParseDeviceUpdate(line));
+  if (update.time_ms) {
+    std::this_thread::sleep_until(start +
+                                  std::chrono::milliseconds(*update.time_ms));
+  }
+  CF_EXPECT(device_control.Apply(update));
+  return {};
+}
+
+// Applies the updates of one client in order. Updates the client queued
+// faster than they are due wait in the socket buffer.
+Result<void> ServeClient(DeviceControl& device_control, SharedFD client) {
+  LineReader reader(client);
+  std::optional<Clock::time_point> start;
+  for (std::uint64_t index = 0;; index++) {
+    auto line = CF_EXPECT(reader.ReadLine());
+    if (!line) {
+      return {};
+    }
+    if (!start) {
+      start = Clock::now();
+    }
+    DeviceUpdateResult result;
+    result.index = index;
+    auto applied = ApplyLine(device_control, *line, *start);
+    if (applied.ok()) {
+      result.applied_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              Clock::now() - *start)
+                              .count();
+    } else {
+      result.error = applied.error().message();
+    }
+    CF_EXPECT(WriteResult(client, result));
+  }
+}
+
+Result<void> DeviceControlMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  // Clients going away before reading their results must not end the service.
+  signal(SIGPIPE, SIG_IGN);
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get(), "Failed to obtain config");
+  auto instance = config->ForDefaultInstance();
+
+  auto server = SharedFD::Dup(FLAGS_server_fd);
+  CF_EXPECT(server->IsOpen(),
+            "Inheriting device control server: " << server->StrError());
+
+  DeviceControl device_control(*config, instance);
+  while (true) {
+    auto client = SharedFD::Accept(*server);
+    if (!client->IsOpen()) {
+      LOG(ERROR) << "Failed to accept a client: " << client->StrError();
+      continue;
+    }
+    std::thread([&device_control, client]() {
+      auto served = ServeClient(device_control, client);
+      if (!served.ok()) {
+        LOG(ERROR) << "Device control client failed: " << served.error();
+      }
+    }).detach();
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::DeviceControlMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
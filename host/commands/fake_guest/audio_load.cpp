@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/unix_sockets.h"
+#include "host/commands/fake_guest/load_generator.h"
+#include "host/libs/audio_connector/shm_layout.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kChannels = 2;
+constexpr std::uint32_t kSampleRate = 48000;
+constexpr std::uint32_t kBytesPerSample = 2;
+// Periods the stream's buffer holds, and so periods in flight at most.
+constexpr std::uint32_t kPeriodsPerBuffer = 4;
+
+/**
+ * Plays a tone to the streamer's audio server the way crosvm's virtio-snd
+ * device forwards the guest's playback: the samples are written to the shared
+ * memory the server handed out and announced on the tx socket. The latency of
+ * a period is the time until the server reports it consumed.
+ */
+class Audio : public LoadGenerator {
+ public:
+  Audio(const CuttlefishConfig::InstanceSpecific& instance,
+        const LoadProfile::Audio& settings)
+      : instance_(instance), settings_(settings) {}
+
+  std::string Name() const override { return "audio"; }
+  std::string Daemon() const override { return "webRTC"; }
+
+  Result<void> Run(LoadClock::time_point deadline, LoadStats& stats) override {
+    CF_EXPECT(Connect());
+    auto stream_id = CF_EXPECT(FindPlaybackStream());
+    period_bytes_ = kSampleRate * settings_.period.count() / 1000 * kChannels *
+                    kBytesPerSample;
+    CF_EXPECT(period_bytes_ * kPeriodsPerBuffer < tx_shm_.len(),
+              "Periods of " << period_bytes_ << " bytes don't fit in "
+                            << tx_shm_.len() << " bytes of shared memory");
+
+    virtio_snd_pcm_set_params params = {};
+    params.hdr.hdr.code = Le32(static_cast<std::uint32_t>(
+        AudioCommandType::VIRTIO_SND_R_PCM_SET_PARAMS));
+    params.hdr.stream_id = Le32(stream_id);
+    params.buffer_bytes = Le32(period_bytes_ * kPeriodsPerBuffer);
+    params.period_bytes = Le32(period_bytes_);
+    params.channels = kChannels;
+    params.format =
+        static_cast<std::uint8_t>(AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16);
+    params.rate = AudioStreamRate::VIRTIO_SND_PCM_RATE_48000;
+    CF_EXPECT(Command(&params, sizeof(params)));
+    CF_EXPECT(StreamCommand(AudioCommandType::VIRTIO_SND_R_PCM_PREPARE,
+                            stream_id));
+    CF_EXPECT(StreamCommand(AudioCommandType::VIRTIO_SND_R_PCM_START,
+                            stream_id));
+
+    std::thread statuses([this, &stats]() { ReadStatuses(stats); });
+    auto result = Play(stream_id, deadline);
+    // The server answers buffers sent to a stopped stream right away, so this
+    // returns once the last periods are accounted for.
+    auto stopped =
+        StreamCommand(AudioCommandType::VIRTIO_SND_R_PCM_STOP, stream_id);
+    tx_->Shutdown(SHUT_RDWR);
+    statuses.join();
+    CF_EXPECT(std::move(result));
+    CF_EXPECT(std::move(stopped));
+    CF_EXPECT(StreamCommand(AudioCommandType::VIRTIO_SND_R_PCM_RELEASE,
+                            stream_id));
+    return {};
+  }
+
+ private:
+  Result<void> Connect() {
+    control_ = SharedFD::SocketLocalClient(instance_.audio_server_path(), false,
+                                           SOCK_SEQPACKET);
+    CF_EXPECT(control_->IsOpen(),
+              "Could not connect to the audio server at "
+                  << instance_.audio_server_path() << ": "
+                  << control_->StrError());
+    // The server greets with its configuration and the event, tx and rx
+    // sockets and shared memory, in that order.
+    auto welcome = CF_EXPECT(UnixMessageSocket(control_).ReadMessage());
+    CF_EXPECT(welcome.data.size() >= sizeof(VioSConfig),
+              "Short welcome message from the audio server");
+    std::memcpy(&config_, welcome.data.data(), sizeof(config_));
+    CF_EXPECT(config_.version == VIOS_VERSION,
+              "Unsupported audio server version " << config_.version);
+    auto fds = CF_EXPECT(welcome.FileDescriptors());
+    CF_EXPECT(fds.size() == 5, "Expected 5 file descriptors from the audio "
+                               "server, got " << fds.size());
+    tx_ = fds[1];
+    auto tx_shm_size = fds[3]->LSeek(0, SEEK_END);
+    CF_EXPECT(tx_shm_size > 0, "Empty tx shared memory");
+    tx_shm_ = fds[3]->MMap(nullptr, tx_shm_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, 0);
+    CF_EXPECT(static_cast<bool>(tx_shm_),
+              "Could not map the tx shared memory: " << fds[3]->StrError());
+    return {};
+  }
+
+  // Sends a control message, returns the payload after the status.
+  Result<std::string> Command(const void* message, std::size_t size,
+                              std::size_t reply_size = 0) {
+    CF_EXPECT(control_->Send(message, size, 0) == static_cast<ssize_t>(size),
+              "Failed to send to the audio server: " << control_->StrError());
+    std::string reply(sizeof(virtio_snd_hdr) + reply_size, '\0');
+    auto received = control_->Recv(reply.data(), reply.size(), 0);
+    CF_EXPECT(received >= static_cast<ssize_t>(sizeof(virtio_snd_hdr)),
+              "No answer from the audio server: " << control_->StrError());
+    virtio_snd_hdr status;
+    std::memcpy(&status, reply.data(), sizeof(status));
+    CF_EXPECT(status.code.as_uint32_t() ==
+                  static_cast<std::uint32_t>(AudioStatus::VIRTIO_SND_S_OK),
+              "Audio server error " << status.code.as_uint32_t());
+    return reply.substr(sizeof(virtio_snd_hdr), received - sizeof(status));
+  }
+
+  Result<void> StreamCommand(AudioCommandType type, std::uint32_t stream_id) {
+    virtio_snd_pcm_hdr message;
+    message.hdr.code = Le32(static_cast<std::uint32_t>(type));
+    message.stream_id = Le32(stream_id);
+    CF_EXPECT(Command(&message, sizeof(message)));
+    return {};
+  }
+
+  Result<std::uint32_t> FindPlaybackStream() {
+    virtio_snd_query_info query;
+    query.hdr.code = Le32(
+        static_cast<std::uint32_t>(AudioCommandType::VIRTIO_SND_R_PCM_INFO));
+    query.start_id = Le32(0);
+    query.count = Le32(config_.streams);
+    query.size = Le32(sizeof(virtio_snd_pcm_info));
+    auto reply = CF_EXPECT(Command(
+        &query, sizeof(query), config_.streams * sizeof(virtio_snd_pcm_info)));
+    for (std::uint32_t i = 0;
+         (i + 1) * sizeof(virtio_snd_pcm_info) <= reply.size(); i++) {
+      virtio_snd_pcm_info info;
+      std::memcpy(&info, reply.data() + i * sizeof(info), sizeof(info));
+      if (info.direction == static_cast<std::uint8_t>(
+                                AudioStreamDirection::VIRTIO_SND_D_OUTPUT)) {
+        return i;
+      }
+    }
+    return CF_ERR("The audio server has no playback stream");
+  }
+
+  Result<void> Play(std::uint32_t stream_id, LoadClock::time_point deadline) {
+    Pacer pacer(1000.0 / settings_.period.count());
+    auto samples = reinterpret_cast<std::int16_t*>(tx_shm_.get());
+    std::uint64_t frame = 0;
+    for (std::uint64_t period = 0; pacer.Wait(deadline); period++) {
+      std::uint32_t offset = (period % kPeriodsPerBuffer) * period_bytes_;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // A slow server holds back the stream, as it would the guest's.
+        period_done_.wait(lock, [this, offset]() {
+          return done_ || sent_.count(offset) == 0;
+        });
+        CF_EXPECT(!done_, "The audio server stopped answering");
+      }
+      // A 440Hz tone.
+      auto period_samples = samples + offset / kBytesPerSample;
+      auto frames = period_bytes_ / (kChannels * kBytesPerSample);
+      for (std::uint32_t i = 0; i < frames; i++, frame++) {
+        auto value = static_cast<std::int16_t>(
+            8000 * std::sin(2 * M_PI * 440 * frame / kSampleRate));
+        for (std::uint32_t channel = 0; channel < kChannels; channel++) {
+          period_samples[i * kChannels + channel] = value;
+        }
+      }
+      IoTransferMsg message;
+      message.io_xfer.stream_id = Le32(stream_id);
+      message.buffer_offset = offset;
+      message.buffer_len = period_bytes_;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sent_[offset] = LoadClock::now();
+      }
+      CF_EXPECT(tx_->Send(&message, sizeof(message), 0) ==
+                    static_cast<ssize_t>(sizeof(message)),
+                "Failed to send a period: " << tx_->StrError());
+    }
+    return {};
+  }
+
+  void ReadStatuses(LoadStats& stats) {
+    while (true) {
+      IoStatusMsg status;
+      if (tx_->Recv(&status, sizeof(status), 0) !=
+          static_cast<ssize_t>(sizeof(status))) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        period_done_.notify_all();
+        return;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = sent_.find(status.buffer_offset);
+      if (it == sent_.end()) {
+        continue;
+      }
+      if (status.status.status.as_uint32_t() ==
+          static_cast<std::uint32_t>(AudioStatus::VIRTIO_SND_S_OK)) {
+        stats.Record(status.consumed_length, LoadClock::now() - it->second);
+      } else {
+        stats.RecordError();
+      }
+      sent_.erase(it);
+      period_done_.notify_all();
+    }
+  }
+
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  LoadProfile::Audio settings_;
+  SharedFD control_;
+  SharedFD tx_;
+  ScopedMMap tx_shm_;
+  VioSConfig config_ = {};
+  std::uint32_t period_bytes_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable period_done_;
+  // Periods sent and not yet consumed, by their offset in the shared memory.
+  std::map<std::uint32_t, LoadClock::time_point> sent_;
+  bool done_ = false;
+};
+
+}  // namespace
+
+std::unique_ptr<LoadGenerator> AudioLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Audio& settings) {
+  return std::make_unique<Audio>(instance, settings);
+}
+
+}  // namespace cuttlefish
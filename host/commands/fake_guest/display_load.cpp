@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/fake_guest/load_generator.h"
+
+namespace cuttlefish {
+namespace {
+
+/*
+ * The guest side of the streamer's wayland server, speaking the wire protocol
+ * directly as only a handful of requests are needed: a shared memory pool with
+ * two buffers, and a surface assigned to a display through the virtio-gpu
+ * metadata extension, the way crosvm presents the guest's scanouts.
+ */
+
+// Object ids, chosen by the client.
+constexpr std::uint32_t kDisplayId = 1;
+constexpr std::uint32_t kRegistryId = 2;
+constexpr std::uint32_t kSyncId = 3;
+constexpr std::uint32_t kCompositorId = 4;
+constexpr std::uint32_t kShmId = 5;
+constexpr std::uint32_t kMetadataId = 6;
+constexpr std::uint32_t kPoolId = 7;
+constexpr std::uint32_t kSurfaceId = 8;
+constexpr std::uint32_t kRegionId = 9;
+constexpr std::uint32_t kSurfaceMetadataId = 10;
+constexpr std::uint32_t kFirstBufferId = 11;
+constexpr std::size_t kNumBuffers = 2;
+
+// Request and event opcodes, in the order of the protocol descriptions.
+constexpr std::uint16_t kDisplaySync = 0;
+constexpr std::uint16_t kDisplayGetRegistry = 1;
+constexpr std::uint16_t kDisplayErrorEvent = 0;
+constexpr std::uint16_t kRegistryBind = 0;
+constexpr std::uint16_t kRegistryGlobalEvent = 0;
+constexpr std::uint16_t kCallbackDoneEvent = 0;
+constexpr std::uint16_t kCompositorCreateSurface = 0;
+constexpr std::uint16_t kCompositorCreateRegion = 1;
+constexpr std::uint16_t kShmCreatePool = 0;
+constexpr std::uint16_t kShmPoolCreateBuffer = 0;
+constexpr std::uint16_t kBufferReleaseEvent = 0;
+constexpr std::uint16_t kRegionAdd = 1;
+constexpr std::uint16_t kSurfaceAttach = 1;
+constexpr std::uint16_t kSurfaceDamage = 2;
+constexpr std::uint16_t kSurfaceSetOpaqueRegion = 4;
+constexpr std::uint16_t kSurfaceCommit = 6;
+constexpr std::uint16_t kMetadataGetSurfaceMetadata = 0;
+constexpr std::uint16_t kSurfaceMetadataSetScanoutId = 0;
+
+constexpr std::uint32_t kShmFormatArgb8888 = 0;
+
+class WaylandMessage {
+ public:
+  WaylandMessage(std::uint32_t object, std::uint16_t opcode)
+      : words_{object, opcode} {}
+
+  WaylandMessage& Uint(std::uint32_t value) {
+    words_.push_back(value);
+    return *this;
+  }
+  WaylandMessage& Int(std::int32_t value) {
+    return Uint(static_cast<std::uint32_t>(value));
+  }
+  // Length including the terminator, then the padded contents.
+  WaylandMessage& String(const std::string& value) {
+    Uint(value.size() + 1);
+    std::vector<std::uint32_t> padded((value.size() + 4) / 4, 0);
+    std::memcpy(padded.data(), value.data(), value.size());
+    words_.insert(words_.end(), padded.begin(), padded.end());
+    return *this;
+  }
+
+  std::string Serialize() const {
+    auto words = words_;
+    words[1] |= (words.size() * 4) << 16;
+    return std::string(reinterpret_cast<const char*>(words.data()),
+                       words.size() * 4);
+  }
+
+ private:
+  std::vector<std::uint32_t> words_;
+};
+
+struct WaylandEvent {
+  std::uint32_t object = 0;
+  std::uint16_t opcode = 0;
+  std::string arguments;
+
+  std::uint32_t Uint(std::size_t word) const {
+    std::uint32_t value = 0;
+    if ((word + 1) * 4 <= arguments.size()) {
+      std::memcpy(&value, arguments.data() + word * 4, 4);
+    }
+    return value;
+  }
+  std::string String(std::size_t word) const {
+    auto size = Uint(word);
+    if (size == 0 || (word + 1) * 4 + size > arguments.size()) {
+      return "";
+    }
+    return arguments.substr((word + 1) * 4, size - 1);
+  }
+};
+
+class DisplayClient {
+ public:
+  DisplayClient(SharedFD connection) : connection_(connection) {}
+
+  Result<void> Send(const WaylandMessage& message) {
+    auto data = message.Serialize();
+    CF_EXPECT(WriteAll(connection_, data) == static_cast<ssize_t>(data.size()),
+              "Failed to send to the wayland server: "
+                  << connection_->StrError());
+    return {};
+  }
+
+  Result<WaylandEvent> ReadEvent() {
+    std::uint32_t header[2];
+    CF_EXPECT(ReadExactBinary(connection_, &header) == sizeof(header),
+              "Failed to read from the wayland server: "
+                  << connection_->StrError());
+    WaylandEvent event;
+    event.object = header[0];
+    event.opcode = header[1] & 0xffff;
+    std::size_t size = header[1] >> 16;
+    CF_EXPECT(size >= sizeof(header), "Malformed wayland event");
+    event.arguments.resize(size - sizeof(header));
+    CF_EXPECT(ReadExact(connection_, &event.arguments) ==
+                  static_cast<ssize_t>(event.arguments.size()),
+              "Failed to read from the wayland server: "
+                  << connection_->StrError());
+    if (event.object == kDisplayId && event.opcode == kDisplayErrorEvent) {
+      return CF_ERR("Wayland protocol error " << event.Uint(1) << " on object "
+                                              << event.Uint(0) << ": "
+                                              << event.String(2));
+    }
+    return event;
+  }
+
+  SharedFD& connection() { return connection_; }
+
+ private:
+  SharedFD connection_;
+};
+
+class Display : public LoadGenerator {
+ public:
+  Display(const CuttlefishConfig& config,
+          const CuttlefishConfig::InstanceSpecific& instance,
+          const LoadProfile::Display& settings)
+      : config_(config), instance_(instance), settings_(settings) {}
+
+  std::string Name() const override { return "display"; }
+  std::string Daemon() const override { return "webRTC"; }
+
+  Result<void> Run(LoadClock::time_point deadline, LoadStats& stats) override {
+    auto displays = config_.display_configs();
+    CF_EXPECT(settings_.display < displays.size(),
+              "No display " << settings_.display);
+    width_ = displays[settings_.display].width;
+    height_ = displays[settings_.display].height;
+
+    auto connection = SharedFD::SocketLocalClient(instance_.frames_socket_path(),
+                                                  false, SOCK_STREAM);
+    CF_EXPECT(connection->IsOpen(),
+              "Could not connect to the wayland server at "
+                  << instance_.frames_socket_path() << ": "
+                  << connection->StrError());
+    DisplayClient client(connection);
+    CF_EXPECT(SetUp(client));
+
+    std::thread releases([this, &client, &stats]() {
+      auto result = ReadReleases(client, stats);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!result.ok() && !done_) {
+        error_ = result.error().message();
+      }
+      done_ = true;
+      buffer_released_.notify_all();
+    });
+
+    auto result = SendFrames(client, deadline);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    client.connection()->Shutdown(SHUT_RDWR);
+    releases.join();
+    CF_EXPECT(std::move(result));
+    CF_EXPECT(error_.empty(), error_);
+    return {};
+  }
+
+ private:
+  Result<void> SetUp(DisplayClient& client) {
+    CF_EXPECT(client.Send(
+        WaylandMessage(kDisplayId, kDisplayGetRegistry).Uint(kRegistryId)));
+    CF_EXPECT(client.Send(WaylandMessage(kDisplayId, kDisplaySync).Uint(kSyncId)));
+    // Interface name to the global name and version.
+    std::map<std::string, std::pair<std::uint32_t, std::uint32_t>> globals;
+    while (true) {
+      auto event = CF_EXPECT(client.ReadEvent());
+      if (event.object == kRegistryId && event.opcode == kRegistryGlobalEvent) {
+        globals[event.String(1)] = {event.Uint(0),
+                                    event.Uint(2 + (event.Uint(1) + 3) / 4)};
+      } else if (event.object == kSyncId &&
+                 event.opcode == kCallbackDoneEvent) {
+        break;
+      }
+    }
+    auto bind = [&client, &globals](const std::string& interface,
+                                    std::uint32_t max_version,
+                                    std::uint32_t id) -> Result<void> {
+      auto it = globals.find(interface);
+      CF_EXPECT(it != globals.end(),
+                "The wayland server has no " << interface);
+      CF_EXPECT(client.Send(WaylandMessage(kRegistryId, kRegistryBind)
+                                .Uint(it->second.first)
+                                .String(interface)
+                                .Uint(std::min(it->second.second, max_version))
+                                .Uint(id)));
+      return {};
+    };
+    CF_EXPECT(bind("wl_compositor", 3, kCompositorId));
+    CF_EXPECT(bind("wl_shm", 1, kShmId));
+    CF_EXPECT(bind("wp_virtio_gpu_metadata_v1", 1, kMetadataId));
+
+    auto stride = width_ * 4;
+    frame_bytes_ = stride * height_;
+    auto pool_fd = SharedFD::MemfdCreate("fake_guest_frames");
+    CF_EXPECT(pool_fd->IsOpen(), pool_fd->StrError());
+    CF_EXPECT(pool_fd->Truncate(frame_bytes_ * kNumBuffers) == 0,
+              pool_fd->StrError());
+    pool_ = pool_fd->MMap(nullptr, frame_bytes_ * kNumBuffers,
+                          PROT_READ | PROT_WRITE, MAP_SHARED, 0);
+    CF_EXPECT(static_cast<bool>(pool_),
+              "Could not map the frame buffers: " << pool_fd->StrError());
+    // The pool's file descriptor goes along with the request creating it.
+    auto create_pool = WaylandMessage(kShmId, kShmCreatePool)
+                           .Uint(kPoolId)
+                           .Int(frame_bytes_ * kNumBuffers)
+                           .Serialize();
+    CF_EXPECT(client.connection()->SendFileDescriptors(
+                  create_pool.data(), create_pool.size(), pool_fd) ==
+                  static_cast<ssize_t>(create_pool.size()),
+              "Failed to send the frame buffers: "
+                  << client.connection()->StrError());
+    for (std::uint32_t i = 0; i < kNumBuffers; i++) {
+      CF_EXPECT(client.Send(WaylandMessage(kPoolId, kShmPoolCreateBuffer)
+                                .Uint(kFirstBufferId + i)
+                                .Int(i * frame_bytes_)
+                                .Int(width_)
+                                .Int(height_)
+                                .Int(stride)
+                                .Uint(kShmFormatArgb8888)));
+    }
+
+    CF_EXPECT(client.Send(WaylandMessage(kCompositorId, kCompositorCreateSurface)
+                              .Uint(kSurfaceId)));
+    CF_EXPECT(client.Send(WaylandMessage(kCompositorId, kCompositorCreateRegion)
+                              .Uint(kRegionId)));
+    CF_EXPECT(client.Send(WaylandMessage(kRegionId, kRegionAdd)
+                              .Int(0)
+                              .Int(0)
+                              .Int(width_)
+                              .Int(height_)));
+    CF_EXPECT(client.Send(WaylandMessage(kSurfaceId, kSurfaceSetOpaqueRegion)
+                              .Uint(kRegionId)));
+    CF_EXPECT(
+        client.Send(WaylandMessage(kMetadataId, kMetadataGetSurfaceMetadata)
+                        .Uint(kSurfaceMetadataId)
+                        .Uint(kSurfaceId)));
+    CF_EXPECT(client.Send(
+        WaylandMessage(kSurfaceMetadataId, kSurfaceMetadataSetScanoutId)
+            .Uint(settings_.display)));
+    return {};
+  }
+
+  Result<void> SendFrames(DisplayClient& client,
+                          LoadClock::time_point deadline) {
+    Pacer pacer(settings_.rate);
+    for (std::uint64_t frame = 0; pacer.Wait(deadline); frame++) {
+      std::size_t buffer = 0;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto free_buffer = [this]() {
+          return std::find(committed_.begin(), committed_.end(),
+                           std::nullopt) -
+                 committed_.begin();
+        };
+        buffer_released_.wait(lock, [this, &free_buffer]() {
+          return done_ || free_buffer() < kNumBuffers;
+        });
+        if (done_) {
+          return {};
+        }
+        buffer = free_buffer();
+      }
+      Draw(buffer, frame);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        committed_[buffer] = LoadClock::now();
+      }
+      CF_EXPECT(client.Send(WaylandMessage(kSurfaceId, kSurfaceAttach)
+                                .Uint(kFirstBufferId + buffer)
+                                .Int(0)
+                                .Int(0)));
+      CF_EXPECT(client.Send(WaylandMessage(kSurfaceId, kSurfaceDamage)
+                                .Int(0)
+                                .Int(0)
+                                .Int(width_)
+                                .Int(height_)));
+      CF_EXPECT(client.Send(WaylandMessage(kSurfaceId, kSurfaceCommit)));
+    }
+    return {};
+  }
+
+  // A frame is done once the server releases its buffer, after copying it out.
+  Result<void> ReadReleases(DisplayClient& client, LoadStats& stats) {
+    while (true) {
+      auto event = CF_EXPECT(client.ReadEvent());
+      if (event.opcode != kBufferReleaseEvent ||
+          event.object < kFirstBufferId ||
+          event.object >= kFirstBufferId + kNumBuffers) {
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& committed = committed_[event.object - kFirstBufferId];
+      if (committed) {
+        stats.Record(frame_bytes_, LoadClock::now() - *committed);
+        committed.reset();
+      }
+      buffer_released_.notify_all();
+    }
+  }
+
+  // Horizontal bands scrolling down, so that every frame differs from the
+  // previous one everywhere.
+  void Draw(std::size_t buffer, std::uint64_t frame) {
+    auto pixels = reinterpret_cast<std::uint32_t*>(
+        reinterpret_cast<char*>(pool_.get()) + buffer * frame_bytes_);
+    for (std::uint32_t y = 0; y < height_; y++) {
+      std::uint32_t shade = (y + frame * 4) & 0xff;
+      std::fill_n(pixels + y * width_, width_,
+                  0xff000000 | (shade << 16) | ((255 - shade) << 8) | shade);
+    }
+  }
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  LoadProfile::Display settings_;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  std::size_t frame_bytes_ = 0;
+  ScopedMMap pool_;
+
+  std::mutex mutex_;
+  std::condition_variable buffer_released_;
+  std::array<std::optional<LoadClock::time_point>, kNumBuffers> committed_;
+  bool done_ = false;
+  std::string error_;
+};
+
+}  // namespace
+
+std::unique_ptr<LoadGenerator> DisplayLoad(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Display& settings) {
+  return std::make_unique<Display>(config, instance, settings);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <time.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <keymaster/android_keymaster_messages.h>
+#include <keymaster/authorization_set.h>
+
+#include "common/libs/security/keymaster_channel.h"
+#include "host/commands/fake_guest/load_generator.h"
+
+namespace cuttlefish {
+namespace {
+
+using keymaster::AuthorizationSetBuilder;
+using keymaster::kDefaultMessageVersion;
+
+/**
+ * Sends keymaster requests to secure_env over the fifos crosvm otherwise
+ * connects to the guest's keymaster HAL, picking each request at random from
+ * the profile's mix. The latency of a request is the time until its response.
+ */
+class Keymaster : public LoadGenerator {
+ public:
+  Keymaster(const CuttlefishConfig::InstanceSpecific& instance,
+            const LoadProfile::Keymaster& settings)
+      : instance_(instance), settings_(settings) {}
+
+  std::string Name() const override { return "keymaster"; }
+  std::string Daemon() const override { return "secure_env"; }
+
+  Result<void> Run(LoadClock::time_point deadline, LoadStats& stats) override {
+    // secure_env reads the guest's requests from the .out fifo.
+    auto requests_path =
+        instance_.PerInstanceInternalPath("keymaster_fifo_vm.out");
+    auto responses_path =
+        instance_.PerInstanceInternalPath("keymaster_fifo_vm.in");
+    auto requests = SharedFD::Open(requests_path, O_RDWR);
+    CF_EXPECT(requests->IsOpen(),
+              "Could not open " << requests_path << ": "
+                                << requests->StrError());
+    auto responses = SharedFD::Open(responses_path, O_RDWR);
+    CF_EXPECT(responses->IsOpen(),
+              "Could not open " << responses_path << ": "
+                                << responses->StrError());
+    KeymasterChannel channel(responses, requests);
+
+    // As the HAL does before anything else.
+    keymaster::ConfigureRequest configure(kDefaultMessageVersion);
+    configure.os_version = 0;
+    configure.os_patchlevel = 0;
+    keymaster::ConfigureResponse configured(kDefaultMessageVersion);
+    CF_EXPECT(Call(channel, keymaster::CONFIGURE, configure, configured));
+
+    std::vector<std::string> names;
+    std::vector<double> weights;
+    for (const auto& [name, weight] : settings_.mix) {
+      names.push_back(name);
+      weights.push_back(weight);
+    }
+    std::discrete_distribution<std::size_t> pick(weights.begin(),
+                                                 weights.end());
+
+    Pacer pacer(settings_.rate);
+    while (pacer.Wait(deadline)) {
+      auto start = LoadClock::now();
+      auto bytes = Request(channel, names[pick(random_)]);
+      if (bytes.ok()) {
+        stats.Record(*bytes, LoadClock::now() - start);
+      } else {
+        LOG(ERROR) << bytes.error().message();
+        stats.RecordError();
+      }
+    }
+    return {};
+  }
+
+ private:
+  // Returns the size of the request and its response.
+  Result<std::size_t> Request(KeymasterChannel& channel,
+                              const std::string& name) {
+    if (name == "get_version") {
+      keymaster::GetVersionRequest request(kDefaultMessageVersion);
+      keymaster::GetVersionResponse response(kDefaultMessageVersion);
+      return CF_EXPECT(Call(channel, keymaster::GET_VERSION, request, response));
+    } else if (name == "add_rng_entropy") {
+      std::uint8_t data[32];
+      for (auto& byte : data) {
+        byte = random_();
+      }
+      keymaster::AddEntropyRequest request(kDefaultMessageVersion);
+      request.random_data.Reinitialize(data, sizeof(data));
+      keymaster::AddEntropyResponse response(kDefaultMessageVersion);
+      return CF_EXPECT(
+          Call(channel, keymaster::ADD_RNG_ENTROPY, request, response));
+    } else if (name == "generate_key") {
+      keymaster::GenerateKeyRequest request(kDefaultMessageVersion);
+      request.key_description.Reinitialize(
+          AuthorizationSetBuilder()
+              .AesEncryptionKey(128)
+              .EcbMode()
+              .Padding(KM_PAD_NONE)
+              .Authorization(keymaster::TAG_NO_AUTH_REQUIRED)
+              .Authorization(keymaster::TAG_CREATION_DATETIME,
+                             time(nullptr) * 1000ull));
+      keymaster::GenerateKeyResponse response(kDefaultMessageVersion);
+      return CF_EXPECT(
+          Call(channel, keymaster::GENERATE_KEY, request, response));
+    }
+    return CF_ERR("Unknown keymaster request \"" << name << "\"");
+  }
+
+  template <typename Response>
+  Result<std::size_t> Call(KeymasterChannel& channel,
+                           AndroidKeymasterCommand command,
+                           const keymaster::Serializable& request,
+                           Response& response) {
+    CF_EXPECT(channel.SendRequest(command, request),
+              "Failed to send keymaster command " << command);
+    auto message = channel.ReceiveMessage();
+    CF_EXPECT(message != nullptr,
+              "No response to keymaster command " << command);
+    CF_EXPECT(message->cmd == command && message->is_response,
+              "Unexpected keymaster message " << message->cmd);
+    const std::uint8_t* buffer = message->payload;
+    CF_EXPECT(response.Deserialize(&buffer, buffer + message->payload_size),
+              "Failed to parse the response to keymaster command "
+                  << command);
+    CF_EXPECT(response.error == KM_ERROR_OK,
+              "Keymaster command " << command << " failed with "
+                                   << response.error);
+    return request.SerializedSize() + message->payload_size;
+  }
+
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  LoadProfile::Keymaster settings_;
+  std::mt19937 random_{std::random_device()()};
+};
+
+}  // namespace
+
+std::unique_ptr<LoadGenerator> KeymasterLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Keymaster& settings) {
+  return std::make_unique<Keymaster>(instance, settings);
+}
+
+}  // namespace cuttlefish
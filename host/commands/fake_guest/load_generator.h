@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/fake_guest/load_profile.h"
+#include "host/commands/fake_guest/load_stats.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+
+// VMADDR_CID_LOCAL: the vsock services the daemons offer the guest are reached
+// from the host through the vsock_loopback module.
+constexpr unsigned int kVsockLocalCid = 1;
+
+// Plays the guest side of one host daemon's connection.
+class LoadGenerator {
+ public:
+  virtual ~LoadGenerator() = default;
+
+  // Name of the load in the report.
+  virtual std::string Name() const = 0;
+  // Name of the binary of the daemon receiving the load.
+  virtual std::string Daemon() const = 0;
+  // Sends load until `deadline`, counting it in `stats`.
+  virtual Result<void> Run(LoadClock::time_point deadline,
+                           LoadStats& stats) = 0;
+};
+
+// Sends the boot events run_cvd waits for, whether or not the kernel log
+// flood is enabled.
+std::unique_ptr<LoadGenerator> KernelLogLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::KernelLog& settings);
+std::unique_ptr<LoadGenerator> LogcatLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Logcat& settings);
+std::unique_ptr<LoadGenerator> DisplayLoad(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Display& settings);
+std::unique_ptr<LoadGenerator> AudioLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Audio& settings);
+std::unique_ptr<LoadGenerator> ModemLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Modem& settings);
+std::unique_ptr<LoadGenerator> KeymasterLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Keymaster& settings);
+std::unique_ptr<LoadGenerator> TombstoneLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Tombstone& settings);
+
+}  // namespace cuttlefish
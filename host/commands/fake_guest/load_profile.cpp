@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/fake_guest/load_profile.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <android-base/file.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kEnabled[] = "enabled";
+constexpr char kRate[] = "rate";
+
+Result<void> CheckKeys(const Json::Value& json, const std::string& section,
+                       const std::vector<std::string>& known) {
+  CF_EXPECT(json.isObject(), "\"" << section << "\" must be an object");
+  for (const auto& key : json.getMemberNames()) {
+    CF_EXPECT(std::find(known.begin(), known.end(), key) != known.end(),
+              "Unknown field \"" << key << "\" in \"" << section << "\"");
+  }
+  return {};
+}
+
+Result<double> GetNonNegative(const Json::Value& json, const char* key) {
+  CF_EXPECT(json[key].isNumeric() && json[key].asDouble() >= 0,
+            "\"" << key << "\" must be a non-negative number");
+  return json[key].asDouble();
+}
+
+Result<std::uint64_t> GetUInt(const Json::Value& json, const char* key) {
+  CF_EXPECT(json[key].isUInt64(),
+            "\"" << key << "\" must be a non-negative integer");
+  return json[key].asUInt64();
+}
+
+// Reads the common fields and checks no field is misspelt.
+Result<void> ParseSettings(const Json::Value& json, const std::string& section,
+                           std::vector<std::string> known,
+                           LoadSettings& settings) {
+  known.push_back(kEnabled);
+  known.push_back(kRate);
+  CF_EXPECT(CheckKeys(json, section, known));
+  if (json.isMember(kEnabled)) {
+    CF_EXPECT(json[kEnabled].isBool(),
+              "\"" << kEnabled << "\" must be a boolean in \"" << section
+                   << "\"");
+    settings.enabled = json[kEnabled].asBool();
+  }
+  if (json.isMember(kRate)) {
+    settings.rate = CF_EXPECT(GetNonNegative(json, kRate), "In " << section);
+  }
+  return {};
+}
+
+}  // namespace
+
+std::vector<std::string> KeymasterRequestNames() {
+  return {"get_version", "add_rng_entropy", "generate_key"};
+}
+
+Result<LoadProfile> ParseLoadProfile(const std::string& json_text) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value json;
+  std::string errors;
+  CF_EXPECT(reader->parse(json_text.data(), json_text.data() + json_text.size(),
+                          &json, &errors),
+            "Invalid JSON: " << errors);
+  CF_EXPECT(CheckKeys(json, "profile",
+                      {"duration_s", "kernel_log", "logcat", "display",
+                       "audio", "modem", "keymaster", "tombstone"}));
+
+  LoadProfile profile;
+  if (json.isMember("duration_s")) {
+    auto duration = CF_EXPECT(GetUInt(json, "duration_s"));
+    CF_EXPECT(duration > 0, "\"duration_s\" must be positive");
+    profile.duration = std::chrono::seconds(duration);
+  }
+  if (json.isMember("kernel_log")) {
+    const auto& section = json["kernel_log"];
+    CF_EXPECT(ParseSettings(section, "kernel_log", {"boot_delay_ms"},
+                            profile.kernel_log));
+    if (section.isMember("boot_delay_ms")) {
+      profile.kernel_log.boot_delay = std::chrono::milliseconds(
+          CF_EXPECT(GetUInt(section, "boot_delay_ms")));
+    }
+  }
+  if (json.isMember("logcat")) {
+    const auto& section = json["logcat"];
+    CF_EXPECT(
+        ParseSettings(section, "logcat", {"line_bytes"}, profile.logcat));
+    if (section.isMember("line_bytes")) {
+      profile.logcat.line_bytes = CF_EXPECT(GetUInt(section, "line_bytes"));
+    }
+  }
+  if (json.isMember("display")) {
+    const auto& section = json["display"];
+    CF_EXPECT(
+        ParseSettings(section, "display", {"display"}, profile.display));
+    if (section.isMember("display")) {
+      profile.display.display = CF_EXPECT(GetUInt(section, "display"));
+    }
+  }
+  if (json.isMember("audio")) {
+    const auto& section = json["audio"];
+    CF_EXPECT(ParseSettings(section, "audio", {"period_ms"}, profile.audio));
+    if (section.isMember("period_ms")) {
+      auto period = CF_EXPECT(GetUInt(section, "period_ms"));
+      CF_EXPECT(period > 0, "\"period_ms\" must be positive");
+      profile.audio.period = std::chrono::milliseconds(period);
+    }
+  }
+  if (json.isMember("modem")) {
+    const auto& section = json["modem"];
+    CF_EXPECT(ParseSettings(section, "modem", {"commands"}, profile.modem));
+    if (section.isMember("commands")) {
+      CF_EXPECT(section["commands"].isArray() && !section["commands"].empty(),
+                "\"commands\" must be a non-empty array");
+      profile.modem.commands.clear();
+      for (const auto& command : section["commands"]) {
+        CF_EXPECT(command.isString(), "AT commands must be strings");
+        profile.modem.commands.push_back(command.asString());
+      }
+    }
+  }
+  if (json.isMember("keymaster")) {
+    const auto& section = json["keymaster"];
+    CF_EXPECT(
+        ParseSettings(section, "keymaster", {"mix"}, profile.keymaster));
+    if (section.isMember("mix")) {
+      const auto& mix = section["mix"];
+      CF_EXPECT(CheckKeys(mix, "mix", KeymasterRequestNames()));
+      profile.keymaster.mix.clear();
+      double total = 0;
+      for (const auto& name : mix.getMemberNames()) {
+        profile.keymaster.mix[name] = CF_EXPECT(GetNonNegative(mix, name.c_str()));
+        total += profile.keymaster.mix[name];
+      }
+      CF_EXPECT(total > 0, "The keymaster mix must have a positive weight");
+    }
+  }
+  if (json.isMember("tombstone")) {
+    const auto& section = json["tombstone"];
+    CF_EXPECT(
+        ParseSettings(section, "tombstone", {"bytes"}, profile.tombstone));
+    if (section.isMember("bytes")) {
+      profile.tombstone.bytes = CF_EXPECT(GetUInt(section, "bytes"));
+    }
+  }
+  return profile;
+}
+
+Result<LoadProfile> LoadProfileFromFile(const std::string& path) {
+  std::string contents;
+  CF_EXPECT(android::base::ReadFileToString(path, &contents),
+            "Could not read the load profile " << path);
+  return CF_EXPECT(ParseLoadProfile(contents), "In " << path);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Settings shared by every kind of load. A rate of 0 sends as fast as the
+// receiving daemon accepts.
+struct LoadSettings {
+  bool enabled = true;
+  double rate = 0;
+};
+
+/**
+ * What the fake guest sends to the host daemons and for how long. Read from a
+ * JSON file where every section is optional and every field defaults to the
+ * values below, for example
+ *
+ *   {
+ *     "duration_s": 120,
+ *     "kernel_log": {"boot_delay_ms": 5000},
+ *     "logcat": {"rate": 20000, "line_bytes": 200},
+ *     "display": {"rate": 60},
+ *     "audio": {"enabled": false},
+ *     "modem": {"rate": 50, "commands": ["AT+CSQ", "AT+COPS?"]},
+ *     "keymaster": {"mix": {"generate_key": 1}},
+ *     "tombstone": {"rate": 1, "bytes": 1048576}
+ *   }
+ *
+ * Rates are in lines, frames, commands, requests or tombstones per second.
+ */
+struct LoadProfile {
+  std::chrono::seconds duration{60};
+
+  // A flood of kernel messages to kernel_log_monitor. The boot events are
+  // sent even if this is disabled.
+  struct KernelLog : LoadSettings {
+    KernelLog() { rate = 10; }
+    // Time between the boot started and the boot completed events.
+    std::chrono::milliseconds boot_delay{0};
+  } kernel_log;
+
+  // Logcat lines to logcat_receiver.
+  struct Logcat : LoadSettings {
+    Logcat() { rate = 1000; }
+    std::size_t line_bytes = 120;
+  } logcat;
+
+  // Frames to the streamer's wayland server.
+  struct Display : LoadSettings {
+    Display() { rate = 30; }
+    std::uint32_t display = 0;
+  } display;
+
+  // A virtio-snd playback stream to the streamer's audio server, sent in
+  // real time. The rate is not used.
+  struct Audio : LoadSettings {
+    std::chrono::milliseconds period{10};
+  } audio;
+
+  // AT commands to the first modem of modem_simulator.
+  struct Modem : LoadSettings {
+    Modem() { rate = 10; }
+    std::vector<std::string> commands = {"AT+CSQ", "AT+CREG?", "AT+COPS?",
+                                         "AT+CGREG?"};
+  } modem;
+
+  // Keymaster requests to secure_env, picked at random with the given
+  // relative weights. See KeymasterRequestNames() for the known requests.
+  struct Keymaster : LoadSettings {
+    Keymaster() { rate = 20; }
+    std::map<std::string, double> mix = {
+        {"get_version", 1}, {"add_rng_entropy", 1}, {"generate_key", 1}};
+  } keymaster;
+
+  // Tombstones of the given size to tombstone_receiver.
+  struct Tombstone : LoadSettings {
+    Tombstone() { rate = 0.2; }
+    std::size_t bytes = 64 * 1024;
+  } tombstone;
+};
+
+std::vector<std::string> KeymasterRequestNames();
+
+Result<LoadProfile> ParseLoadProfile(const std::string& json);
+Result<LoadProfile> LoadProfileFromFile(const std::string& path);
+
+}  // namespace cuttlefish
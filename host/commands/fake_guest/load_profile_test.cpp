@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "host/commands/fake_guest/load_profile.h"
+#include "host/commands/fake_guest/load_stats.h"
+
+namespace cuttlefish {
+namespace {
+
+TEST(LoadProfileTest, Defaults) {
+  auto profile = ParseLoadProfile("{}");
+  ASSERT_TRUE(profile.ok()) << profile.error();
+  ASSERT_EQ(profile->duration, std::chrono::seconds(60));
+  ASSERT_TRUE(profile->logcat.enabled);
+  ASSERT_EQ(profile->logcat.rate, 1000);
+  ASSERT_EQ(profile->display.rate, 30);
+  ASSERT_EQ(profile->keymaster.mix.size(), KeymasterRequestNames().size());
+}
+
+TEST(LoadProfileTest, Overrides) {
+  auto profile = ParseLoadProfile(R"({
+    "duration_s": 5,
+    "kernel_log": {"boot_delay_ms": 200},
+    "logcat": {"rate": 0, "line_bytes": 16},
+    "audio": {"enabled": false},
+    "modem": {"commands": ["AT+CSQ"]},
+    "keymaster": {"mix": {"generate_key": 2}}
+  })");
+  ASSERT_TRUE(profile.ok()) << profile.error();
+  ASSERT_EQ(profile->duration, std::chrono::seconds(5));
+  ASSERT_EQ(profile->kernel_log.boot_delay, std::chrono::milliseconds(200));
+  ASSERT_EQ(profile->logcat.rate, 0);
+  ASSERT_EQ(profile->logcat.line_bytes, 16);
+  ASSERT_FALSE(profile->audio.enabled);
+  ASSERT_EQ(profile->modem.commands, std::vector<std::string>{"AT+CSQ"});
+  ASSERT_EQ(profile->keymaster.mix.size(), 1);
+  ASSERT_EQ(profile->keymaster.mix["generate_key"], 2);
+  // Untouched sections keep their defaults.
+  ASSERT_EQ(profile->tombstone.bytes, 64 * 1024);
+}
+
+TEST(LoadProfileTest, Invalid) {
+  ASSERT_FALSE(ParseLoadProfile("not json").ok());
+  ASSERT_FALSE(ParseLoadProfile(R"({"gps": {}})").ok());
+  ASSERT_FALSE(ParseLoadProfile(R"({"logcat": {"rate": -1}})").ok());
+  ASSERT_FALSE(ParseLoadProfile(R"({"logcat": {"lines": 1}})").ok());
+  ASSERT_FALSE(ParseLoadProfile(R"({"keymaster": {"mix": {"sign": 1}}})").ok());
+  ASSERT_FALSE(ParseLoadProfile(R"({"modem": {"commands": []}})").ok());
+}
+
+TEST(LoadStatsTest, LatencyPercentile) {
+  std::vector<std::int64_t> latencies = {50, 10, 40, 30, 20,
+                                         60, 70, 80, 100, 90};
+  ASSERT_EQ(LatencyPercentile(latencies, 50), 50);
+  ASSERT_EQ(LatencyPercentile(latencies, 90), 90);
+  ASSERT_EQ(LatencyPercentile(latencies, 99), 100);
+  ASSERT_EQ(LatencyPercentile(latencies, 100), 100);
+  std::vector<std::int64_t> none;
+  ASSERT_EQ(LatencyPercentile(none, 50), 0);
+}
+
+TEST(LoadStatsTest, ParseProcessStat) {
+  auto process = ParseProcessStat(
+      "1234 (a (b) c) S 1000 1234 1234 0 -1 4194560 100 0 0 0 25 17 0 0 20 0 "
+      "1 0 5000 1000000 200 18446744073709551615");
+  ASSERT_TRUE(process.ok()) << process.error();
+  ASSERT_EQ(process->pid, 1234);
+  ASSERT_EQ(process->name, "a (b) c");
+  ASSERT_EQ(process->parent, 1000);
+  ASSERT_EQ(process->ticks, 42);
+
+  ASSERT_FALSE(ParseProcessStat("1234 kernel_log S 1000").ok());
+  ASSERT_FALSE(ParseProcessStat("1234 (kernel_log) S 1000").ok());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/fake_guest/load_stats.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+namespace {
+
+double Seconds(LoadClock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+}  // namespace
+
+void LoadStats::Record(std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  operations_++;
+  bytes_ += bytes;
+}
+
+void LoadStats::Record(std::size_t bytes, LoadClock::duration latency) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  operations_++;
+  bytes_ += bytes;
+  latencies_us_.push_back(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+}
+
+void LoadStats::RecordLatency(LoadClock::duration latency) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  latencies_us_.push_back(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+}
+
+void LoadStats::RecordError() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  errors_++;
+}
+
+Json::Value LoadStats::ToJson(LoadClock::duration elapsed) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Json::Value json(Json::objectValue);
+  json["operations"] = static_cast<Json::UInt64>(operations_);
+  json["bytes"] = static_cast<Json::UInt64>(bytes_);
+  json["errors"] = static_cast<Json::UInt64>(errors_);
+  auto seconds = Seconds(elapsed);
+  if (seconds > 0) {
+    json["operations_per_second"] = operations_ / seconds;
+    json["bytes_per_second"] = bytes_ / seconds;
+  }
+  if (!latencies_us_.empty()) {
+    auto latencies = latencies_us_;
+    Json::Value latency(Json::objectValue);
+    latency["samples"] = static_cast<Json::UInt64>(latencies.size());
+    latency["p50"] = static_cast<Json::Int64>(LatencyPercentile(latencies, 50));
+    latency["p90"] = static_cast<Json::Int64>(LatencyPercentile(latencies, 90));
+    latency["p99"] = static_cast<Json::Int64>(LatencyPercentile(latencies, 99));
+    latency["max"] = static_cast<Json::Int64>(latencies.back());
+    json["latency_us"] = latency;
+  }
+  return json;
+}
+
+std::int64_t LatencyPercentile(std::vector<std::int64_t>& latencies_us,
+                               double percentile) {
+  if (latencies_us.empty()) {
+    return 0;
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+  auto rank = static_cast<std::size_t>(
+      std::ceil(percentile / 100 * latencies_us.size()));
+  return latencies_us[std::clamp<std::size_t>(rank, 1, latencies_us.size()) -
+                      1];
+}
+
+Pacer::Pacer(double rate)
+    : interval_(rate > 0 ? std::chrono::duration_cast<LoadClock::duration>(
+                               std::chrono::duration<double>(1 / rate))
+                         : LoadClock::duration::zero()),
+      next_(LoadClock::now()) {}
+
+bool Pacer::Wait(LoadClock::time_point deadline) {
+  if (next_ >= deadline) {
+    return false;
+  }
+  std::this_thread::sleep_until(next_);
+  // Operations that fell behind are sent right away, but the schedule is not
+  // moved, so the average rate holds.
+  next_ += interval_;
+  return true;
+}
+
+Result<ProcessCpu> ParseProcessStat(const std::string& stat) {
+  // The name is in parentheses and may contain spaces and parentheses itself.
+  auto open = stat.find('(');
+  auto close = stat.rfind(')');
+  CF_EXPECT(open != std::string::npos && close != std::string::npos &&
+                open < close,
+            "Malformed process stat \"" << stat << "\"");
+  ProcessCpu process;
+  CF_EXPECT(android::base::ParseInt(stat.substr(0, open - 1), &process.pid),
+            "Malformed pid in \"" << stat << "\"");
+  process.name = stat.substr(open + 1, close - open - 1);
+  // Fields after the name, starting with the state. See proc(5).
+  auto fields =
+      android::base::Split(android::base::Trim(stat.substr(close + 1)), " ");
+  CF_EXPECT(fields.size() > 12, "Too few fields in \"" << stat << "\"");
+  CF_EXPECT(android::base::ParseInt(fields[1], &process.parent),
+            "Malformed parent pid in \"" << stat << "\"");
+  std::uint64_t utime = 0;
+  std::uint64_t stime = 0;
+  CF_EXPECT(android::base::ParseUint(fields[11], &utime) &&
+                android::base::ParseUint(fields[12], &stime),
+            "Malformed cpu times in \"" << stat << "\"");
+  process.ticks = utime + stime;
+  return process;
+}
+
+std::map<pid_t, ProcessCpu> SiblingProcesses() {
+  std::map<pid_t, ProcessCpu> siblings;
+  std::unique_ptr<DIR, int (*)(DIR*)> proc(opendir("/proc"), closedir);
+  if (!proc) {
+    return siblings;
+  }
+  auto parent = getppid();
+  auto self = getpid();
+  while (auto entry = readdir(proc.get())) {
+    pid_t pid = 0;
+    if (!android::base::ParseInt(entry->d_name, &pid) || pid == self) {
+      continue;
+    }
+    std::string stat;
+    // Processes may exit while being listed.
+    if (!android::base::ReadFileToString(
+            "/proc/" + std::string(entry->d_name) + "/stat", &stat)) {
+      continue;
+    }
+    auto process = ParseProcessStat(stat);
+    if (process.ok() && process->parent == parent) {
+      siblings[pid] = *process;
+    }
+  }
+  return siblings;
+}
+
+Json::Value CpuUsageToJson(const std::map<pid_t, ProcessCpu>& before,
+                           const std::map<pid_t, ProcessCpu>& after,
+                           LoadClock::duration elapsed) {
+  static const double kTicksPerSecond = sysconf(_SC_CLK_TCK);
+  Json::Value json(Json::arrayValue);
+  for (const auto& [pid, process] : after) {
+    // Processes restarted during the run only count since they started.
+    auto it = before.find(pid);
+    auto ticks = process.ticks;
+    if (it != before.end() && it->second.name == process.name) {
+      ticks -= it->second.ticks;
+    }
+    Json::Value usage(Json::objectValue);
+    usage["name"] = process.name;
+    usage["pid"] = pid;
+    usage["cpu_seconds"] = ticks / kTicksPerSecond;
+    if (Seconds(elapsed) > 0) {
+      usage["cpu_percent"] = 100 * ticks / kTicksPerSecond / Seconds(elapsed);
+    }
+    json.append(usage);
+  }
+  return json;
+}
+
+}  // namespace cuttlefish
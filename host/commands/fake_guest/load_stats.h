@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+using LoadClock = std::chrono::steady_clock;
+
+// Counts what one load generator sent, updated from any of its threads.
+class LoadStats {
+ public:
+  // An operation with no known completion time, like a line written to a pipe.
+  void Record(std::size_t bytes);
+  void Record(std::size_t bytes, LoadClock::duration latency);
+  // Latency of something sent earlier and already counted.
+  void RecordLatency(LoadClock::duration latency);
+  void RecordError();
+
+  Json::Value ToJson(LoadClock::duration elapsed) const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::uint64_t operations_ = 0;
+  std::uint64_t bytes_ = 0;
+  std::uint64_t errors_ = 0;
+  std::vector<std::int64_t> latencies_us_;
+};
+
+// The latency below which `percentile` percent of the samples are, with the
+// nearest rank method. Sorts the samples.
+std::int64_t LatencyPercentile(std::vector<std::int64_t>& latencies_us,
+                               double percentile);
+
+// Spaces out operations to keep to a rate, without drifting when an operation
+// takes longer than its slot.
+class Pacer {
+ public:
+  // A rate of 0 does not wait at all.
+  Pacer(double rate);
+
+  // Waits for the next slot, returns false if it would be past `deadline`.
+  bool Wait(LoadClock::time_point deadline);
+
+ private:
+  LoadClock::duration interval_;
+  LoadClock::time_point next_;
+};
+
+// CPU time used by a process so far, from /proc/<pid>/stat.
+struct ProcessCpu {
+  pid_t pid = 0;
+  pid_t parent = 0;
+  std::string name;
+  std::uint64_t ticks = 0;
+};
+
+Result<ProcessCpu> ParseProcessStat(const std::string& stat);
+
+// The processes started by the same parent as this one, that is the host
+// daemons process_monitor runs for the device.
+std::map<pid_t, ProcessCpu> SiblingProcesses();
+
+// CPU use of every sibling between the two snapshots.
+Json::Value CpuUsageToJson(const std::map<pid_t, ProcessCpu>& before,
+                           const std::map<pid_t, ProcessCpu>& after,
+                           LoadClock::duration elapsed);
+
+}  // namespace cuttlefish
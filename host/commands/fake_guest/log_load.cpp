@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <android-base/parseint.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/fake_guest/load_generator.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kProbe[] = "fake_guest_probe=";
+// Probes sent per second at most, so that following the log file stays cheap
+// next to the load.
+constexpr double kProbesPerSecond = 100;
+
+/**
+ * Writes lines to a pipe a daemon copies to a log file, the way the guest
+ * writes to its virtio consoles. The latency of a line is the time it takes
+ * to show up in the log file, measured on lines tagged with a probe number.
+ */
+class LogFlood {
+ public:
+  using LineMaker = std::function<std::string(std::uint64_t)>;
+
+  LogFlood(std::string pipe_path, std::string log_path)
+      : pipe_path_(std::move(pipe_path)), log_path_(std::move(log_path)) {}
+
+  ~LogFlood() {
+    stop_ = true;
+    if (follower_.joinable()) {
+      follower_.join();
+    }
+  }
+
+  Result<void> Open(LoadStats& stats) {
+    // Read-write, so that opening doesn't wait for the daemon to open its end.
+    pipe_ = SharedFD::Open(pipe_path_, O_RDWR);
+    CF_EXPECT(pipe_->IsOpen(),
+              "Could not open " << pipe_path_ << ": " << pipe_->StrError());
+    // The daemon may not have created the log file yet.
+    log_ = SharedFD::Open(log_path_, O_RDONLY | O_CREAT, 0666);
+    CF_EXPECT(log_->IsOpen(),
+              "Could not open " << log_path_ << ": " << log_->StrError());
+    log_->LSeek(0, SEEK_END);
+    follower_ = std::thread([this, &stats]() { Follow(stats); });
+    return {};
+  }
+
+  Result<void> WriteLine(const std::string& line, bool probe,
+                         LoadStats& stats) {
+    auto text = line;
+    if (probe) {
+      std::lock_guard<std::mutex> lock(probes_mutex_);
+      text += " " + std::string(kProbe) + std::to_string(next_probe_);
+      probes_[next_probe_++] = LoadClock::now();
+    }
+    text += "\n";
+    CF_EXPECT(WriteAll(pipe_, text) == static_cast<ssize_t>(text.size()),
+              "Failed to write to " << pipe_path_ << ": " << pipe_->StrError());
+    stats.Record(text.size());
+    return {};
+  }
+
+  Result<void> Flood(const LoadSettings& settings, const LineMaker& make_line,
+                     LoadClock::time_point deadline, LoadStats& stats) {
+    std::uint64_t probe_every = 1;
+    if (settings.rate == 0 || settings.rate > kProbesPerSecond) {
+      // Unpaced floods are probed as if they were sent at 100k lines/s.
+      auto rate = settings.rate == 0 ? 100000 : settings.rate;
+      probe_every = static_cast<std::uint64_t>(rate / kProbesPerSecond);
+    }
+    Pacer pacer(settings.rate);
+    for (std::uint64_t line = 0; pacer.Wait(deadline); line++) {
+      CF_EXPECT(WriteLine(make_line(line), line % probe_every == 0, stats));
+    }
+    return {};
+  }
+
+ private:
+  void Follow(LoadStats& stats) {
+    std::string pending;
+    char buffer[64 * 1024];
+    while (!stop_) {
+      auto bytes_read = log_->Read(buffer, sizeof(buffer));
+      if (bytes_read <= 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        continue;
+      }
+      auto now = LoadClock::now();
+      pending.append(buffer, bytes_read);
+      std::size_t line_start = 0;
+      for (auto newline = pending.find('\n'); newline != std::string::npos;
+           newline = pending.find('\n', line_start)) {
+        auto probe = pending.find(kProbe, line_start);
+        if (probe != std::string::npos && probe < newline) {
+          auto number_start = probe + sizeof(kProbe) - 1;
+          std::uint64_t number = 0;
+          if (android::base::ParseUint(
+                  pending.substr(number_start, newline - number_start),
+                  &number)) {
+            RecordProbe(number, now, stats);
+          }
+        }
+        line_start = newline + 1;
+      }
+      pending.erase(0, line_start);
+    }
+  }
+
+  void RecordProbe(std::uint64_t number, LoadClock::time_point seen,
+                   LoadStats& stats) {
+    std::lock_guard<std::mutex> lock(probes_mutex_);
+    auto it = probes_.find(number);
+    if (it != probes_.end()) {
+      stats.RecordLatency(seen - it->second);
+      probes_.erase(it);
+    }
+  }
+
+  std::string pipe_path_;
+  std::string log_path_;
+  SharedFD pipe_;
+  SharedFD log_;
+  std::thread follower_;
+  std::atomic<bool> stop_ = false;
+  std::mutex probes_mutex_;
+  std::map<std::uint64_t, LoadClock::time_point> probes_;
+  std::uint64_t next_probe_ = 0;
+};
+
+std::string Padding(std::size_t size, std::uint64_t line) {
+  std::string padding(size, ' ');
+  for (std::size_t i = 0; i < size; i++) {
+    padding[i] = 'a' + (line + i) % 26;
+  }
+  return padding;
+}
+
+class KernelLog : public LoadGenerator {
+ public:
+  KernelLog(const CuttlefishConfig::InstanceSpecific& instance,
+            const LoadProfile::KernelLog& settings)
+      : flood_(instance.kernel_log_pipe_name(),
+               instance.PerInstanceLogPath("kernel.log")),
+        settings_(settings) {}
+
+  std::string Name() const override { return "kernel_log"; }
+  std::string Daemon() const override { return "kernel_log_monitor"; }
+
+  Result<void> Run(LoadClock::time_point deadline, LoadStats& stats) override {
+    start_ = LoadClock::now();
+    CF_EXPECT(flood_.Open(stats));
+    CF_EXPECT(flood_.WriteLine(KernelLine("Linux version fake_guest"), false,
+                               stats));
+    CF_EXPECT(flood_.WriteLine(KernelLine(kBootStartedMessage), true, stats));
+    std::this_thread::sleep_for(settings_.boot_delay);
+    CF_EXPECT(flood_.WriteLine(KernelLine("init: starting service 'adbd'..."),
+                               false, stats));
+    CF_EXPECT(flood_.WriteLine(KernelLine(kBootCompletedMessage), true, stats));
+    if (!settings_.enabled) {
+      return {};
+    }
+    auto make_line = [this](std::uint64_t line) {
+      return KernelLine("fake_guest: line " + std::to_string(line) + " " +
+                        Padding(64, line));
+    };
+    CF_EXPECT(flood_.Flood(settings_, make_line, deadline, stats));
+    return {};
+  }
+
+ private:
+  // With a timestamp, as printk adds.
+  std::string KernelLine(const std::string& message) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       LoadClock::now() - start_)
+                       .count();
+    char timestamp[32];
+    snprintf(timestamp, sizeof(timestamp), "[%5lld.%06lld] ",
+             static_cast<long long>(elapsed / 1000000),
+             static_cast<long long>(elapsed % 1000000));
+    return timestamp + message;
+  }
+
+  LogFlood flood_;
+  LoadProfile::KernelLog settings_;
+  LoadClock::time_point start_;
+};
+
+class Logcat : public LoadGenerator {
+ public:
+  Logcat(const CuttlefishConfig::InstanceSpecific& instance,
+         const LoadProfile::Logcat& settings)
+      : flood_(instance.logcat_pipe_name(), instance.logcat_path()),
+        settings_(settings) {}
+
+  std::string Name() const override { return "logcat"; }
+  std::string Daemon() const override { return "logcat_receiver"; }
+
+  Result<void> Run(LoadClock::time_point deadline, LoadStats& stats) override {
+    CF_EXPECT(flood_.Open(stats));
+    // In the threadtime format the guest uses.
+    const std::string prefix = "01-01 00:00:00.000  1000  1000 I fake_guest: ";
+    auto make_line = [this, &prefix](std::uint64_t line) {
+      auto text = prefix + std::to_string(line) + " ";
+      if (text.size() < settings_.line_bytes) {
+        text += Padding(settings_.line_bytes - text.size(), line);
+      }
+      return text;
+    };
+    CF_EXPECT(flood_.Flood(settings_, make_line, deadline, stats));
+    return {};
+  }
+
+ private:
+  LogFlood flood_;
+  LoadProfile::Logcat settings_;
+};
+
+}  // namespace
+
+std::unique_ptr<LoadGenerator> KernelLogLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::KernelLog& settings) {
+  return std::make_unique<KernelLog>(instance, settings);
+}
+
+std::unique_ptr<LoadGenerator> LogcatLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Logcat& settings) {
+  return std::make_unique<Logcat>(instance, settings);
+}
+
+}  // namespace cuttlefish
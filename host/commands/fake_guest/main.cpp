@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/fake_guest/load_generator.h"
+#include "host/commands/fake_guest/load_profile.h"
+#include "host/commands/fake_guest/load_stats.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/logging.h"
+
+DEFINE_string(profile, "",
+              "JSON file with the load to generate, empty for the defaults.");
+
+namespace cuttlefish {
+namespace {
+
+// Time given to the daemons to catch up with the last of the load before the
+// CPU use is measured.
+constexpr auto kDrainTime = std::chrono::seconds(1);
+
+struct RunningLoad {
+  std::unique_ptr<LoadGenerator> generator;
+  LoadStats stats;
+  std::optional<std::string> error;
+  std::thread thread;
+};
+
+std::vector<std::unique_ptr<LoadGenerator>> EnabledLoads(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile& profile) {
+  std::vector<std::unique_ptr<LoadGenerator>> loads;
+  // Always runs, run_cvd waits for the boot events it sends.
+  loads.emplace_back(KernelLogLoad(instance, profile.kernel_log));
+  if (profile.logcat.enabled) {
+    loads.emplace_back(LogcatLoad(instance, profile.logcat));
+  }
+  if (profile.display.enabled && config.enable_webrtc()) {
+    loads.emplace_back(DisplayLoad(config, instance, profile.display));
+  }
+  if (profile.audio.enabled && config.enable_webrtc() &&
+      config.enable_audio()) {
+    loads.emplace_back(AudioLoad(instance, profile.audio));
+  }
+  if (profile.modem.enabled && config.enable_modem_simulator()) {
+    loads.emplace_back(ModemLoad(instance, profile.modem));
+  }
+  if (profile.keymaster.enabled) {
+    loads.emplace_back(KeymasterLoad(instance, profile.keymaster));
+  }
+  if (profile.tombstone.enabled) {
+    loads.emplace_back(TombstoneLoad(instance, profile.tombstone));
+  }
+  return loads;
+}
+
+Json::Value DaemonCpu(const Json::Value& cpu, const std::string& daemon) {
+  // Process names are cut to 15 characters.
+  auto name = daemon.substr(0, 15);
+  for (const auto& usage : cpu) {
+    if (usage["name"].asString() == name) {
+      return usage;
+    }
+  }
+  return Json::Value();
+}
+
+Result<void> FakeGuestMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  // Daemons going away must fail their load, not end the device.
+  signal(SIGPIPE, SIG_IGN);
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get(), "Failed to obtain config");
+  auto instance = config->ForDefaultInstance();
+  LoadProfile profile;
+  if (!FLAGS_profile.empty()) {
+    profile = CF_EXPECT(LoadProfileFromFile(FLAGS_profile));
+  }
+
+  std::vector<std::unique_ptr<RunningLoad>> loads;
+  for (auto& generator : EnabledLoads(*config, instance, profile)) {
+    loads.emplace_back(new RunningLoad());
+    loads.back()->generator = std::move(generator);
+  }
+
+  auto cpu_before = SiblingProcesses();
+  auto start = LoadClock::now();
+  auto deadline = start + profile.duration;
+  for (auto& load : loads) {
+    load->thread = std::thread([&load, deadline]() {
+      auto result = load->generator->Run(deadline, load->stats);
+      if (!result.ok()) {
+        LOG(ERROR) << load->generator->Name()
+                   << " load failed: " << result.error().message();
+        load->error = result.error().message();
+      }
+    });
+  }
+  for (auto& load : loads) {
+    load->thread.join();
+  }
+  std::this_thread::sleep_for(kDrainTime);
+  auto elapsed = LoadClock::now() - start;
+  auto cpu = CpuUsageToJson(cpu_before, SiblingProcesses(), elapsed);
+
+  Json::Value report(Json::objectValue);
+  report["duration_s"] =
+      std::chrono::duration<double>(profile.duration).count();
+  report["loads"] = Json::Value(Json::arrayValue);
+  for (const auto& load : loads) {
+    Json::Value entry(Json::objectValue);
+    entry["name"] = load->generator->Name();
+    entry["daemon"] = load->generator->Daemon();
+    entry["stats"] = load->stats.ToJson(profile.duration);
+    if (load->error) {
+      entry["error"] = *load->error;
+    }
+    entry["daemon_cpu"] = DaemonCpu(cpu, load->generator->Daemon());
+    report["loads"].append(entry);
+    LOG(INFO) << entry["name"].asString() << ": "
+              << entry["stats"]["operations"].asUInt64() << " operations, "
+              << entry["stats"]["errors"].asUInt64() << " errors";
+  }
+  report["daemons"] = cpu;
+
+  auto report_path = instance.PerInstancePath("fake_guest_report.json");
+  auto report_fd = SharedFD::Creat(report_path, 0644);
+  CF_EXPECT(report_fd->IsOpen(), "Could not create " << report_path << ": "
+                                                     << report_fd->StrError());
+  auto report_text = report.toStyledString();
+  CF_EXPECT(WriteAll(report_fd, report_text) ==
+                static_cast<ssize_t>(report_text.size()),
+            "Failed to write " << report_path << ": "
+                               << report_fd->StrError());
+  LOG(INFO) << "Wrote the load report to " << report_path;
+
+  // Exiting would look like the VMM crashing to run_cvd.
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::hours(1));
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::FakeGuestMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
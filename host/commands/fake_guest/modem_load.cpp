@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <string>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/fake_guest/load_generator.h"
+
+namespace cuttlefish {
+namespace {
+
+// Commands left unanswered this long count as errors.
+constexpr struct timeval kAnswerTimeout = {.tv_sec = 5, .tv_usec = 0};
+
+bool IsFinalResult(const std::string& line) {
+  return line == "OK" || line == "ERROR" || line == "NO CARRIER" ||
+         android::base::StartsWith(line, "+CME ERROR") ||
+         android::base::StartsWith(line, "+CMS ERROR");
+}
+
+/**
+ * Sends AT commands to the first modem the way the guest's RIL does, over the
+ * vsock port modem_simulator listens on, one at a time. The latency of a
+ * command is the time until its final result code.
+ */
+class Modem : public LoadGenerator {
+ public:
+  Modem(const CuttlefishConfig::InstanceSpecific& instance,
+        const LoadProfile::Modem& settings)
+      : instance_(instance), settings_(settings) {}
+
+  std::string Name() const override { return "modem"; }
+  std::string Daemon() const override { return "modem_simulator"; }
+
+  Result<void> Run(LoadClock::time_point deadline, LoadStats& stats) override {
+    auto ports = android::base::Split(instance_.modem_simulator_ports(), ",");
+    unsigned int port = 0;
+    CF_EXPECT(!ports.empty() && android::base::ParseUint(ports[0], &port),
+              "No modem simulator port in \""
+                  << instance_.modem_simulator_ports() << "\"");
+    connection_ = SharedFD::VsockClient(kVsockLocalCid, port, SOCK_STREAM);
+    CF_EXPECT(connection_->IsOpen(), "Could not connect to the modem simulator "
+                                     "on vsock port "
+                                         << port << ": "
+                                         << connection_->StrError());
+    CF_EXPECT(connection_->SetSockOpt(SOL_SOCKET, SO_RCVTIMEO, &kAnswerTimeout,
+                                      sizeof(kAnswerTimeout)) == 0,
+              connection_->StrError());
+
+    Pacer pacer(settings_.rate);
+    for (std::size_t i = 0; pacer.Wait(deadline); i++) {
+      const auto& command = settings_.commands[i % settings_.commands.size()];
+      auto start = LoadClock::now();
+      auto answer = Send(command);
+      if (answer.ok()) {
+        stats.Record(command.size() + 1 + *answer, LoadClock::now() - start);
+      } else {
+        // Unanswered commands leave the connection out of step.
+        LOG(ERROR) << answer.error().message();
+        stats.RecordError();
+        return CF_ERR("Lost the modem simulator connection");
+      }
+    }
+    return {};
+  }
+
+ private:
+  // Returns the size of the answer.
+  Result<std::size_t> Send(const std::string& command) {
+    auto line = command + "\r";
+    CF_EXPECT(WriteAll(connection_, line) == static_cast<ssize_t>(line.size()),
+              "Failed to send \"" << command
+                                  << "\": " << connection_->StrError());
+    std::size_t answer_size = 0;
+    while (true) {
+      auto end = pending_.find_first_of("\r\n");
+      if (end == std::string::npos) {
+        char buffer[4096];
+        auto bytes_read = connection_->Read(buffer, sizeof(buffer));
+        CF_EXPECT(bytes_read > 0, "No answer to \"" << command << "\": "
+                                                    << connection_->StrError());
+        pending_.append(buffer, bytes_read);
+        answer_size += bytes_read;
+        continue;
+      }
+      auto answer_line = pending_.substr(0, end);
+      pending_.erase(0, end + 1);
+      // Unsolicited results and intermediate lines are skipped.
+      if (IsFinalResult(answer_line)) {
+        return answer_size;
+      }
+    }
+  }
+
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  LoadProfile::Modem settings_;
+  SharedFD connection_;
+  std::string pending_;
+};
+
+}  // namespace
+
+std::unique_ptr<LoadGenerator> ModemLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Modem& settings) {
+  return std::make_unique<Modem>(instance, settings);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+
+#include <string>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/fake_guest/load_generator.h"
+
+namespace cuttlefish {
+namespace {
+
+/**
+ * Sends tombstones to tombstone_receiver the way the guest's tombstone
+ * transmit service does: one vsock connection per tombstone, closed once it
+ * is written. The latency of a tombstone is the time it takes to send.
+ */
+class Tombstone : public LoadGenerator {
+ public:
+  Tombstone(const CuttlefishConfig::InstanceSpecific& instance,
+            const LoadProfile::Tombstone& settings)
+      : instance_(instance), settings_(settings) {}
+
+  std::string Name() const override { return "tombstone"; }
+  std::string Daemon() const override { return "tombstone_receiver"; }
+
+  Result<void> Run(LoadClock::time_point deadline, LoadStats& stats) override {
+    Pacer pacer(settings_.rate);
+    for (std::uint64_t i = 0; pacer.Wait(deadline); i++) {
+      auto start = LoadClock::now();
+      auto sent = Send(Contents(i));
+      if (sent.ok()) {
+        stats.Record(settings_.bytes, LoadClock::now() - start);
+      } else {
+        LOG(ERROR) << sent.error().message();
+        stats.RecordError();
+      }
+    }
+    return {};
+  }
+
+ private:
+  std::string Contents(std::uint64_t number) {
+    std::string contents =
+        "*** *** *** *** *** *** *** *** *** *** *** *** *** *** *** ***\n"
+        "Build fingerprint: 'fake_guest'\npid: " +
+        std::to_string(number) + ", tid: " + std::to_string(number) +
+        ", name: fake_guest  >>> fake_guest <<<\n";
+    while (contents.size() < settings_.bytes) {
+      contents += "    #" + std::to_string(contents.size()) +
+                  " pc 0000000000000000  /system/bin/fake_guest\n";
+    }
+    contents.resize(settings_.bytes);
+    return contents;
+  }
+
+  Result<void> Send(const std::string& contents) {
+    auto port = instance_.tombstone_receiver_port();
+    auto connection = SharedFD::VsockClient(kVsockLocalCid, port, SOCK_STREAM);
+    CF_EXPECT(connection->IsOpen(),
+              "Could not connect to the tombstone receiver on vsock port "
+                  << port << ": " << connection->StrError());
+    CF_EXPECT(WriteAll(connection, contents) ==
+                  static_cast<ssize_t>(contents.size()),
+              "Failed to send a tombstone: " << connection->StrError());
+    return {};
+  }
+
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  LoadProfile::Tombstone settings_;
+};
+
+}  // namespace
+
+std::unique_ptr<LoadGenerator> TombstoneLoad(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    const LoadProfile::Tombstone& settings) {
+  return std::make_unique<Tombstone>(instance, settings);
+}
+
+}  // namespace cuttlefish
@@ -13,15 +13,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <set>
 #include <string>
+#include <thread>
 
 #include <curl/curl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "android-base/file.h"
 #include "android-base/logging.h"
 #include "android-base/strings.h"
 #include "gflags/gflags.h"
@@ -32,6 +36,10 @@
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/subprocess.h"
 
+#include "host/commands/fetcher/image_cache.h"
+#include "host/commands/fetcher/lazy_image.h"
+#include "host/commands/fetcher/lazy_image_fs.h"
+#include "host/commands/fetcher/zip_delta.h"
 #include "host/libs/config/fetcher_config.h"
 
 #include "host/libs/web/build_api.h"
@@ -64,6 +72,22 @@ DEFINE_string(directory, CurrentDirectory(), "Target directory to fetch "
 DEFINE_bool(run_next_stage, false, "Continue running the device through the next stage.");
 DEFINE_string(wait_retry_period, "20", "Retry period for pending builds given "
                                        "in seconds. Set to 0 to not wait.");
+DEFINE_string(image_cache_dir, "",
+              "Directory to keep the img and target files zips of fetched "
+              "builds in. Later builds of the same target download only the "
+              "images that changed since the most recent one cached. Empty to "
+              "always download whole zips.");
+DEFINE_int32(image_cache_builds, 2,
+             "How many builds of each target to keep in --image_cache_dir.");
+DEFINE_bool(lazy_images, false,
+            "Serve the large images of the default build from a FUSE mount "
+            "while they download, so the device can start before they are "
+            "complete. What the device reads is downloaded first. Needs "
+            "fusermount3, and falls back to downloading the img zip whole.");
+DEFINE_string(lazy_image_profile, "",
+              "File with the order a boot reads the lazy images in. The "
+              "images are prefetched in that order, and the reads of this "
+              "fetch's boot are saved to it once they are complete.");
 
 namespace cuttlefish {
 namespace {
@@ -72,6 +96,17 @@ const std::string HOST_TOOLS = "cvd-host_package.tar.gz";
 const std::string OTA_TOOLS = "otatools.zip";
 const std::string OTA_TOOLS_DIR = "/otatools/";
 
+const std::string LAZY_IMAGES_DIR = "lazy_images";
+// Smaller images are downloaded whole before the device starts.
+constexpr uint64_t kMinLazyImageSize = 64 << 20;
+// Written to before the device starts, which the read only mount can't serve.
+const std::set<std::string> kWritableImages = {
+    // Resized by assemble_cvd.
+    "userdata.img",
+};
+constexpr int kLazyImageServerThreads = 4;
+constexpr int kLazyImagePrefetchAttempts = 5;
+
 /** Returns the name of one of the artifact target zip files.
  *
  * For example, for a target "aosp_cf_x86_phone-userdebug" at a build "5824130",
@@ -91,7 +126,48 @@ std::string TargetBuildZipFromArtifacts(
   return "";
 }
 
+/** Downloads one of the artifact target zip files.
+ *
+ * With an image cache, the zip is downloaded as a delta from the cached zip of
+ * the same kind of a nearby build, falling back to downloading it whole.
+ */
+bool DownloadTargetBuildZip(BuildApi* build_api, ImageCache* image_cache,
+                            const Build& build, const std::string& kind,
+                            const std::vector<Artifact>& artifacts,
+                            const std::string& zip_name,
+                            const std::string& local_path) {
+  auto device_build = std::get_if<DeviceBuild>(&build);
+  if (image_cache == nullptr || device_build == nullptr) {
+    return build_api->ArtifactToFile(build, zip_name, local_path);
+  }
+  auto artifact = std::find_if(
+      artifacts.begin(), artifacts.end(),
+      [&zip_name](const Artifact& a) { return a.Name() == zip_name; });
+  bool downloaded = false;
+  if (artifact != artifacts.end() &&
+      !image_cache->FindBase(*device_build, kind).empty()) {
+    auto delta = image_cache->FetchDelta(*build_api, *device_build, *artifact,
+                                         kind, local_path);
+    if (delta.ok()) {
+      downloaded = true;
+    } else {
+      LOG(INFO) << "Could not download " << zip_name << " as a delta, "
+                << "downloading it whole: " << delta.error();
+    }
+  }
+  if (!downloaded &&
+      !build_api->ArtifactToFile(build, zip_name, local_path)) {
+    return false;
+  }
+  auto added = image_cache->Add(*device_build, zip_name, local_path);
+  if (!added.ok()) {
+    LOG(WARNING) << "Could not cache " << local_path << ": " << added.error();
+  }
+  return true;
+}
+
 std::vector<std::string> download_images(BuildApi* build_api,
+                                         ImageCache* image_cache,
                                          const Build& build,
                                          const std::string& target_directory,
                                          const std::vector<std::string>& images) {
@@ -102,7 +178,8 @@ std::vector<std::string> download_images(BuildApi* build_api,
     return {};
   }
   std::string local_path = target_directory + "/" + img_zip_name;
-  if (!build_api->ArtifactToFile(build, img_zip_name, local_path)) {
+  if (!DownloadTargetBuildZip(build_api, image_cache, build, "img", artifacts,
+                              img_zip_name, local_path)) {
     LOG(ERROR) << "Unable to download " << build << ":" << img_zip_name << " to "
                << local_path;
     return {};
@@ -120,12 +197,227 @@ std::vector<std::string> download_images(BuildApi* build_api,
   return files;
 }
 std::vector<std::string> download_images(BuildApi* build_api,
+                                         ImageCache* image_cache,
                                          const Build& build,
                                          const std::string& target_directory) {
-  return download_images(build_api, build, target_directory, {});
+  return download_images(build_api, image_cache, build, target_directory, {});
+}
+
+/** The images of the default build served while they download.
+ *
+ * Each image is backed by <target>/lazy_images/<image> and served at
+ * <target>/lazy_images/mount/<image>, which <target>/<image> links to until
+ * the download completes and the backing file is renamed over the link.
+ */
+struct LazyImageServer {
+  std::string dir;
+  std::string mountpoint;
+  android::base::unique_fd fuse;
+  // Separate connections, so reads never queue behind a prefetch.
+  std::unique_ptr<CurlWrapper> demand_curl;
+  std::unique_ptr<CurlWrapper> prefetch_curl;
+  std::unique_ptr<CurlWrapper> retrying_demand_curl;
+  std::unique_ptr<CurlWrapper> retrying_prefetch_curl;
+  // The signed URL of the img zip expires long before a device stops using
+  // the images, so it is resolved again through the build API as needed.
+  std::shared_ptr<RefreshableUrl> url;
+  LazyImageSet images;
+};
+
+std::string LazyImageLinkTarget(const std::string& image) {
+  return LAZY_IMAGES_DIR + "/mount/" + image;
+}
+
+/** Downloads the small images of the default build's img zip and sets up the
+ * large ones, the members stored uncompressed, to download lazily.
+ *
+ * Nothing is left behind on failure, so the img zip can be downloaded whole
+ * instead.
+ */
+Result<std::vector<std::string>> DownloadImagesLazily(
+    BuildApi* build_api, const Build& build,
+    const std::string& target_directory, LazyImageServer* server) {
+  auto device_build = std::get_if<DeviceBuild>(&build);
+  CF_EXPECT(device_build != nullptr,
+            "Only builds from the build API download lazily");
+  auto artifacts = build_api->Artifacts(build);
+  auto img_zip_name = TargetBuildZipFromArtifacts(build, "img", artifacts);
+  CF_EXPECT(!img_zip_name.empty(), "Target " << build << " had no img zip");
+  auto artifact = std::find_if(
+      artifacts.begin(), artifacts.end(),
+      [&img_zip_name](const Artifact& a) { return a.Name() == img_zip_name; });
+  auto resolve_url = [build_api, device_build = *device_build,
+                      img_zip_name]() -> Result<std::string> {
+    auto url = build_api->ArtifactUrl(device_build, img_zip_name);
+    CF_EXPECT(!url.empty(), "Could not get the URL of " << img_zip_name);
+    return url;
+  };
+  server->url = std::make_shared<RefreshableUrl>(CF_EXPECT(resolve_url()),
+                                                 resolve_url);
+
+  server->demand_curl = CurlWrapper::Create();
+  server->prefetch_curl = CurlWrapper::Create();
+  server->retrying_demand_curl = CurlWrapper::WithServerErrorRetry(
+      *server->demand_curl, 10, std::chrono::milliseconds(5000));
+  server->retrying_prefetch_curl = CurlWrapper::WithServerErrorRetry(
+      *server->prefetch_curl, 10, std::chrono::milliseconds(5000));
+  auto reader = HttpRangeReader(*server->retrying_demand_curl, server->url);
+  auto directory = CF_EXPECT(ReadZipDirectory(reader, artifact->Size()));
+
+  server->dir = target_directory + "/" + LAZY_IMAGES_DIR;
+  server->mountpoint = server->dir + "/mount";
+  CF_EXPECT(EnsureDirectoryExists(server->dir));
+  CF_EXPECT(EnsureDirectoryExists(server->mountpoint));
+  server->fuse = CF_EXPECT(MountFuse(server->mountpoint, "fetch_cvd"));
+
+  std::vector<std::string> files;
+  auto download = [&]() -> Result<void> {
+    for (const auto& entry : directory.entries) {
+      CF_EXPECT(entry.name.find('/') == std::string::npos,
+                "Unexpected directory in " << img_zip_name);
+      auto path = target_directory + "/" + entry.name;
+      unlink(path.c_str());
+      files.push_back(path);
+      if (entry.method != 0 || entry.uncompressed_size < kMinLazyImageSize ||
+          kWritableImages.count(entry.name) > 0) {
+        CF_EXPECT(ExtractZipMember(reader, entry, path));
+        continue;
+      }
+      auto offset = CF_EXPECT(ZipMemberDataOffset(reader, entry));
+      server->images.Add(CF_EXPECT(LazyImage::Create(
+          entry.name, offset, entry.uncompressed_size, entry.crc32,
+          HttpRangeReader(*server->retrying_demand_curl, server->url),
+          HttpRangeReader(*server->retrying_prefetch_curl, server->url),
+          server->dir + "/" + entry.name)));
+      auto link_target = LazyImageLinkTarget(entry.name);
+      CF_EXPECT(symlink(link_target.c_str(), path.c_str()) == 0,
+                "Could not link " << path << ": " << strerror(errno));
+    }
+    return {};
+  };
+  auto result = download();
+  if (!result.ok()) {
+    for (const auto& file : files) {
+      unlink(file.c_str());
+    }
+    server->fuse.reset();
+    UnmountFuseLazily(server->mountpoint);
+    RecursivelyRemoveDirectory(server->dir);
+  }
+  CF_EXPECT(std::move(result));
+  LOG(INFO) << "Downloading " << server->images.Images().size()
+            << " images of " << img_zip_name << " lazily";
+  return files;
+}
+
+/** Serves the lazy images until they are complete and no longer open.
+ *
+ * Once every image is downloaded and matches its checksum, its backing file
+ * replaces the link to the mount. The reads seen so far are saved as the boot
+ * profile and the mount is detached, to go away when the VMM closes the
+ * images.
+ */
+Result<void> ServeLazyImages(LazyImageServer& server,
+                             const std::string& target_directory,
+                             const std::string& profile_path) {
+  BootProfile profile;
+  if (!profile_path.empty() && FileExists(profile_path)) {
+    auto loaded = LoadBootProfile(profile_path);
+    if (loaded.ok()) {
+      profile = std::move(*loaded);
+    } else {
+      LOG(WARNING) << "Ignoring the boot profile: " << loaded.error();
+    }
+  }
+  std::thread prefetch([&server, &target_directory, &profile_path, profile]() {
+    for (int attempt = 1; !server.images.Complete(); attempt++) {
+      auto prefetched = server.images.Prefetch(profile);
+      if (prefetched.ok()) {
+        break;
+      }
+      LOG(ERROR) << "Prefetch failed: " << prefetched.error();
+      if (attempt == kLazyImagePrefetchAttempts) {
+        // Reads still download what they need.
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::seconds(10));
+    }
+    for (const auto& image : server.images.Images()) {
+      auto path = target_directory + "/" + image->Name();
+      // Whatever replaced the link since, e.g. a later fetch_cvd into the
+      // same directory, is left alone.
+      std::string link;
+      if (!android::base::Readlink(path, &link) ||
+          link != LazyImageLinkTarget(image->Name())) {
+        LOG(WARNING) << path << " no longer links to the lazy image, keeping "
+                     << image->BackingPath();
+        continue;
+      }
+      auto verified = server.images.VerifyOrDownloadAgain(*image);
+      if (!verified.ok()) {
+        // Still served, but the device gets what was downloaded.
+        LOG(ERROR) << "Not moving " << image->BackingPath() << " to " << path
+                   << ": " << verified.error();
+        continue;
+      }
+      if (rename(image->BackingPath().c_str(), path.c_str()) != 0) {
+        LOG(ERROR) << "Could not move " << image->BackingPath() << " to "
+                   << path << ": " << strerror(errno);
+      }
+    }
+    LOG(INFO) << "Lazy images complete";
+    if (!profile_path.empty()) {
+      auto saved = SaveBootProfile(server.images.RecordedProfile(),
+                                   profile_path);
+      if (!saved.ok()) {
+        LOG(ERROR) << "Could not save the boot profile: " << saved.error();
+      }
+    }
+    auto unmounted = UnmountFuseLazily(server.mountpoint);
+    if (!unmounted.ok()) {
+      LOG(ERROR) << unmounted.error();
+    }
+  });
+  // Ends with the process if the mount goes away first.
+  prefetch.detach();
+
+  LazyImageFs fs(server.images);
+  CF_EXPECT(fs.Serve(server.fuse.get(), kLazyImageServerThreads));
+  return {};
+}
+
+/** Forks the process serving the lazy images, which outlives fetch_cvd and
+ * logs to <target>/lazy_images/server.log.
+ */
+Result<void> StartLazyImageServer(LazyImageServer& server,
+                                  const std::string& target_directory,
+                                  const std::string& profile_path) {
+  auto log_path = server.dir + "/server.log";
+  auto pid = fork();
+  CF_EXPECT(pid >= 0, "Could not fork: " << strerror(errno));
+  if (pid > 0) {
+    server.fuse.reset();
+    return {};
+  }
+  // Holding on to the caller's terminal or pipes would keep whoever reads
+  // fetch_cvd's output waiting for the images.
+  setsid();
+  int null_fd = open("/dev/null", O_RDONLY);
+  int log_fd = open(log_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (null_fd >= 0 && log_fd >= 0) {
+    dup2(null_fd, 0);
+    dup2(log_fd, 1);
+    dup2(log_fd, 2);
+  }
+  auto result = ServeLazyImages(server, target_directory, profile_path);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+  }
+  _exit(result.ok() ? 0 : 1);
 }
 
 std::vector<std::string> download_target_files(BuildApi* build_api,
+                                               ImageCache* image_cache,
                                                const Build& build,
                                                const std::string& target_directory) {
   auto artifacts = build_api->Artifacts(build);
@@ -135,7 +427,8 @@ std::vector<std::string> download_target_files(BuildApi* build_api,
     return {};
   }
   std::string local_path = target_directory + "/" + target_zip;
-  if (!build_api->ArtifactToFile(build, target_zip, local_path)) {
+  if (!DownloadTargetBuildZip(build_api, image_cache, build, "target_files",
+                              artifacts, target_zip, local_path)) {
     LOG(ERROR) << "Unable to download " << build << ":" << target_zip << " to "
                << local_path;
     return {};
@@ -326,6 +619,12 @@ int FetchCvdMain(int argc, char** argv) {
       credential_source = FixedCredentialSource::make(FLAGS_credential_source);
     }
     BuildApi build_api(*retrying_curl, credential_source.get(), FLAGS_api_key);
+    std::unique_ptr<ImageCache> image_cache;
+    if (!FLAGS_image_cache_dir.empty()) {
+      image_cache.reset(new ImageCache(AbsolutePath(FLAGS_image_cache_dir),
+                                       FLAGS_image_cache_builds,
+                                       *retrying_curl));
+    }
 
     auto default_build = ArgumentToBuild(&build_api, FLAGS_default_build,
                                          DEFAULT_BUILD_TARGET,
@@ -356,9 +655,24 @@ int FetchCvdMain(int argc, char** argv) {
       AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
                        ota_tools_files, &config, target_dir);
     }
+    LazyImageServer lazy_image_server;
     if (FLAGS_download_img_zip) {
-      std::vector<std::string> image_files =
-          download_images(&build_api, default_build, target_dir);
+      std::vector<std::string> image_files;
+      // Images of a --system_build are extracted over the default build's.
+      if (FLAGS_lazy_images && FLAGS_system_build.empty()) {
+        auto lazy_files = DownloadImagesLazily(&build_api, default_build,
+                                               target_dir, &lazy_image_server);
+        if (lazy_files.ok()) {
+          image_files = std::move(*lazy_files);
+        } else {
+          LOG(INFO) << "Could not download images lazily, downloading the "
+                    << "img zip whole: " << lazy_files.error();
+        }
+      }
+      if (image_files.empty()) {
+        image_files = download_images(&build_api, image_cache.get(),
+                                      default_build, target_dir);
+      }
       if (image_files.empty()) {
         LOG(FATAL) << "Could not download images for " << default_build;
       }
@@ -375,7 +689,8 @@ int FetchCvdMain(int argc, char** argv) {
         LOG(FATAL) << "Could not create " << default_target_dir;
       }
       std::vector<std::string> target_files =
-          download_target_files(&build_api, default_build, default_target_dir);
+          download_target_files(&build_api, image_cache.get(), default_build,
+                                default_target_dir);
       if (target_files.empty()) {
         LOG(FATAL) << "Could not download target files for " << default_build;
       }
@@ -391,8 +706,8 @@ int FetchCvdMain(int argc, char** argv) {
       bool system_in_img_zip = true;
       if (FLAGS_download_img_zip) {
         std::vector<std::string> image_files =
-            download_images(&build_api, system_build, target_dir,
-                            {"system.img", "product.img"});
+            download_images(&build_api, image_cache.get(), system_build,
+                            target_dir, {"system.img", "product.img"});
         if (image_files.empty()) {
           LOG(INFO) << "Could not find system image for " << system_build
                     << "in the img zip. Assuming a super image build, which will "
@@ -409,7 +724,8 @@ int FetchCvdMain(int argc, char** argv) {
         LOG(FATAL) << "Could not create " << system_target_dir;
       }
       std::vector<std::string> target_files =
-          download_target_files(&build_api, system_build, system_target_dir);
+          download_target_files(&build_api, image_cache.get(), system_build,
+                                system_target_dir);
       if (target_files.empty()) {
         LOG(FATAL) << "Could not download target files for " << system_build;
         return -1;
@@ -526,6 +842,13 @@ int FetchCvdMain(int argc, char** argv) {
             << local_path;
       }
     }
+    if (!lazy_image_server.images.Images().empty()) {
+      auto started = StartLazyImageServer(lazy_image_server, target_dir,
+                                          FLAGS_lazy_image_profile);
+      if (!started.ok()) {
+        LOG(FATAL) << "Could not serve the lazy images: " << started.error();
+      }
+    }
   }
   curl_global_cleanup();
 
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <openssl/md5.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Archives and an HTTP server to test downloading them with.
+
+namespace cuttlefish {
+
+struct TestMember {
+  std::string name;
+  std::string data;
+  uint16_t time = 0;
+  bool deflate = false;
+};
+
+template <typename T>
+inline void Append(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline uint32_t Crc32(const std::string& data) {
+  uint32_t crc = 0xffffffff;
+  for (unsigned char c : data) {
+    crc ^= c;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+inline std::string RawDeflate(const std::string& data) {
+  z_stream stream = {};
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(out.data());
+  stream.avail_out = out.size();
+  deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return out;
+}
+
+// An archive of stored members, like the ones zipalign leaves images in,
+// unless told to deflate them.
+inline std::string MakeZip(const std::vector<TestMember>& members) {
+  std::string zip, directory;
+  for (const auto& member : members) {
+    uint32_t offset = zip.size();
+    uint32_t crc = Crc32(member.data);
+    uint16_t method = member.deflate ? 8 : 0;
+    auto data = member.deflate ? RawDeflate(member.data) : member.data;
+    uint32_t compressed_size = data.size();
+    uint32_t size = member.data.size();
+    Append<uint32_t>(zip, 0x04034b50);
+    Append<uint16_t>(zip, 10);
+    Append<uint16_t>(zip, 0);
+    Append(zip, method);
+    Append<uint16_t>(zip, member.time);
+    Append<uint16_t>(zip, 0);
+    Append(zip, crc);
+    Append(zip, compressed_size);
+    Append(zip, size);
+    Append<uint16_t>(zip, member.name.size());
+    Append<uint16_t>(zip, 0);
+    zip += member.name + data;
+
+    Append<uint32_t>(directory, 0x02014b50);
+    Append<uint16_t>(directory, 10);
+    Append<uint16_t>(directory, 10);
+    Append<uint16_t>(directory, 0);
+    Append(directory, method);
+    Append<uint16_t>(directory, member.time);
+    Append<uint16_t>(directory, 0);
+    Append(directory, crc);
+    Append(directory, compressed_size);
+    Append(directory, size);
+    Append<uint16_t>(directory, member.name.size());
+    Append<uint16_t>(directory, 0);
+    Append<uint16_t>(directory, 0);
+    Append<uint16_t>(directory, 0);
+    Append<uint16_t>(directory, 0);
+    Append<uint32_t>(directory, 0);
+    Append(directory, offset);
+    directory += member.name;
+  }
+  uint32_t directory_offset = zip.size();
+  zip += directory;
+  Append<uint32_t>(zip, 0x06054b50);
+  Append<uint16_t>(zip, 0);
+  Append<uint16_t>(zip, 0);
+  Append<uint16_t>(zip, members.size());
+  Append<uint16_t>(zip, members.size());
+  Append<uint32_t>(zip, directory.size());
+  Append(zip, directory_offset);
+  Append<uint16_t>(zip, 0);
+  return zip;
+}
+
+inline std::string RandomData(size_t size, int seed) {
+  std::mt19937 random(seed);
+  std::string data(size, '\0');
+  for (auto& c : data) {
+    c = random();
+  }
+  return data;
+}
+
+inline std::string Md5(const std::string& data) {
+  uint8_t digest[MD5_DIGEST_LENGTH];
+  MD5(reinterpret_cast<const uint8_t*>(data.data()), data.size(), digest);
+  std::stringstream hex;
+  hex << std::hex;
+  for (auto byte : digest) {
+    hex << (byte >> 4) << (byte & 0xf);
+  }
+  return hex.str();
+}
+
+inline void WriteFile(const std::string& path, const std::string& data) {
+  std::ofstream(path, std::ios::binary) << data;
+}
+
+inline std::string ReadWholeFile(const std::string& path) {
+  std::stringstream data;
+  data << std::ifstream(path, std::ios::binary).rdbuf();
+  return data.str();
+}
+
+// Stands in for the artifact storage the build API signs URLs to: serves one
+// file over HTTP/1.1, honouring single range requests unless told not to.
+class HttpStandIn {
+ public:
+  HttpStandIn(std::string content, bool ranges = true)
+      : content_(std::move(content)), ranges_(ranges) {
+    server_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(server_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(server_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    listen(server_, 8);
+    thread_ = std::thread([this]() { Serve(); });
+  }
+
+  ~HttpStandIn() {
+    shutdown(server_, SHUT_RDWR);
+    thread_.join();
+    close(server_);
+  }
+
+  std::string Url(const std::string& file = "artifact.zip") const {
+    return "http://127.0.0.1:" + std::to_string(port_) + "/" + file;
+  }
+
+  // Answers requests for any other file with 403, like an expired signed URL.
+  void OnlyServe(const std::string& file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    only_file_ = file;
+  }
+
+  uint64_t BytesServed() const { return bytes_served_; }
+  uint64_t Requests() const { return requests_; }
+
+ private:
+  void Serve() {
+    while (true) {
+      int client = accept(server_, nullptr, nullptr);
+      if (client < 0) {
+        return;
+      }
+      std::string request;
+      char buffer[4096];
+      while (request.find("\r\n\r\n") == std::string::npos) {
+        auto bytes = read(client, buffer, sizeof(buffer));
+        if (bytes <= 0) {
+          break;
+        }
+        request.append(buffer, bytes);
+      }
+      std::smatch range;
+      std::stringstream response;
+      std::string body = content_;
+      if (!Serves(request)) {
+        body.clear();
+        response << "HTTP/1.1 403 Forbidden\r\n";
+      } else if (ranges_ && std::regex_search(request, range,
+                                       std::regex("Range: bytes=(\\d+)-(\\d+)",
+                                                  std::regex::icase))) {
+        uint64_t first = std::stoull(range[1]);
+        uint64_t last = std::stoull(range[2]);
+        body = content_.substr(first, last - first + 1);
+        response << "HTTP/1.1 206 Partial Content\r\n"
+                 << "Content-Range: bytes " << first << "-" << last << "/"
+                 << content_.size() << "\r\n";
+      } else {
+        response << "HTTP/1.1 200 OK\r\n";
+      }
+      response << "Content-Length: " << body.size() << "\r\n"
+               << "Connection: close\r\n\r\n"
+               << body;
+      // Counted before answering, for the client to see it once it has the
+      // data.
+      bytes_served_ += body.size();
+      requests_++;
+      auto data = response.str();
+      for (size_t written = 0; written < data.size();) {
+        auto bytes = write(client, data.data() + written,
+                           data.size() - written);
+        if (bytes <= 0) {
+          break;
+        }
+        written += bytes;
+      }
+      close(client);
+    }
+  }
+
+  bool Serves(const std::string& request) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return only_file_.empty() ||
+           request.rfind("GET /" + only_file_ + " ", 0) == 0;
+  }
+
+  std::string content_;
+  bool ranges_;
+  std::mutex mutex_;
+  std::string only_file_;
+  int server_;
+  int port_;
+  std::thread thread_;
+  std::atomic<uint64_t> bytes_served_ = 0;
+  std::atomic<uint64_t> requests_ = 0;
+};
+
+}  // namespace cuttlefish
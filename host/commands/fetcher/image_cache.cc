@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/fetcher/image_cache.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+// The cached builds of a target, most recently cached first.
+std::vector<std::string> BuildDirs(const std::string& target_dir) {
+  std::vector<std::pair<std::chrono::system_clock::time_point, std::string>>
+      builds;
+  if (!DirectoryExists(target_dir)) {
+    return {};
+  }
+  for (const auto& id : DirectoryContents(target_dir)) {
+    auto build_dir = target_dir + "/" + id;
+    if (id == "." || id == ".." || !DirectoryExists(build_dir)) {
+      continue;
+    }
+    builds.emplace_back(FileModificationTime(build_dir), build_dir);
+  }
+  std::sort(builds.rbegin(), builds.rend());
+  std::vector<std::string> dirs;
+  for (auto& [time, dir] : builds) {
+    dirs.emplace_back(std::move(dir));
+  }
+  return dirs;
+}
+
+Result<void> LinkOrCopy(const std::string& from, const std::string& to) {
+  unlink(to.c_str());
+  if (link(from.c_str(), to.c_str()) == 0) {
+    return {};
+  }
+  // Across file systems
+  std::ifstream in(from, std::ios::binary);
+  std::ofstream out(to, std::ios::binary | std::ios::trunc);
+  out << in.rdbuf();
+  CF_EXPECT(in.good() && out.good(), "Could not copy " << from << " to " << to);
+  return {};
+}
+
+}  // namespace
+
+ImageCache::ImageCache(std::string dir, size_t max_builds, CurlWrapper& curl)
+    : dir_(std::move(dir)), max_builds_(max_builds), curl_(curl) {}
+
+std::string ImageCache::TargetDir(const DeviceBuild& build) const {
+  return dir_ + "/" + build.target;
+}
+
+std::string ImageCache::FindBase(const DeviceBuild& build,
+                                 const std::string& kind) const {
+  for (const auto& build_dir : BuildDirs(TargetDir(build))) {
+    auto id = cpp_basename(build_dir);
+    for (const auto& file : DirectoryContents(build_dir)) {
+      if (android::base::EndsWith(file, "-" + kind + "-" + id + ".zip")) {
+        return build_dir + "/" + file;
+      }
+    }
+  }
+  return "";
+}
+
+Result<ZipDeltaStats> ImageCache::FetchDelta(BuildApi& build_api,
+                                             const DeviceBuild& build,
+                                             const Artifact& artifact,
+                                             const std::string& kind,
+                                             const std::string& path) {
+  auto base = FindBase(build, kind);
+  CF_EXPECT(!base.empty(), "No cached " << kind << " archive of "
+                                        << build.target);
+  auto url = build_api.ArtifactUrl(build, artifact.Name());
+  CF_EXPECT(!url.empty(), "Could not get the URL of " << artifact.Name());
+  LOG(INFO) << "Downloading " << artifact.Name() << " as a delta from "
+            << base;
+  auto stats = CF_EXPECT(RebuildZipFromBase(base, HttpRangeReader(curl_, url),
+                                            artifact.Size(), artifact.Md5(),
+                                            path));
+  LOG(INFO) << "Reused " << stats.reused_entries << " members ("
+            << stats.reused_bytes << " bytes) of " << base
+            << ", downloaded " << stats.downloaded_entries << " ("
+            << stats.downloaded_bytes << " bytes)";
+  return stats;
+}
+
+Result<void> ImageCache::Add(const DeviceBuild& build,
+                             const std::string& artifact,
+                             const std::string& path) {
+  auto target_dir = TargetDir(build);
+  auto build_dir = target_dir + "/" + build.id;
+  CF_EXPECT(EnsureDirectoryExists(dir_));
+  CF_EXPECT(EnsureDirectoryExists(target_dir));
+  CF_EXPECT(EnsureDirectoryExists(build_dir));
+  CF_EXPECT(LinkOrCopy(path, build_dir + "/" + artifact));
+
+  auto build_dirs = BuildDirs(target_dir);
+  for (size_t i = max_builds_; i < build_dirs.size(); i++) {
+    // The build just added is the most recent, so it is never dropped.
+    if (build_dirs[i] == build_dir) {
+      continue;
+    }
+    LOG(DEBUG) << "Dropping " << build_dirs[i] << " from the image cache";
+    if (!RecursivelyRemoveDirectory(build_dirs[i])) {
+      LOG(WARNING) << "Could not remove " << build_dirs[i];
+    }
+  }
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/fetcher/zip_delta.h"
+#include "host/libs/web/build_api.h"
+
+namespace cuttlefish {
+
+/**
+ * Keeps the image and target files archives of previous fetches, so later
+ * builds of the same target are downloaded as deltas from them. Archives are
+ * stored as <dir>/<target>/<build id>/<artifact>, hard linked to the fetched
+ * files where possible, and only the |max_builds| most recent builds of each
+ * target are kept.
+ */
+class ImageCache {
+ public:
+  ImageCache(std::string dir, size_t max_builds, CurlWrapper& curl);
+
+  // The most recently cached |kind| archive ("img" or "target_files") of a
+  // build of |build|'s target, empty if there is none.
+  std::string FindBase(const DeviceBuild& build, const std::string& kind) const;
+
+  // Downloads |artifact| of |build| to |path| as a delta from the cached
+  // archive FindBase() returns.
+  Result<ZipDeltaStats> FetchDelta(BuildApi& build_api,
+                                   const DeviceBuild& build,
+                                   const Artifact& artifact,
+                                   const std::string& kind,
+                                   const std::string& path);
+
+  // Caches |path|, the |artifact| of |build|, dropping the least recently
+  // cached builds of the target past the limit.
+  Result<void> Add(const DeviceBuild& build, const std::string& artifact,
+                   const std::string& path);
+
+ private:
+  std::string TargetDir(const DeviceBuild& build) const;
+
+  std::string dir_;
+  size_t max_builds_;
+  CurlWrapper& curl_;
+};
+
+}  // namespace cuttlefish
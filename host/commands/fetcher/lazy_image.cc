@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/fetcher/lazy_image.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <utility>
+
+#include <android-base/logging.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace {
+
+// Prefetches download this many blocks per request, large enough for the
+// request overhead not to matter and small enough for the reads sharing the
+// server not to wait long behind them.
+constexpr uint64_t kPrefetchBlocks = 8;
+
+}  // namespace
+
+Result<std::unique_ptr<LazyImage>> LazyImage::Create(
+    std::string name, uint64_t offset, uint64_t size, uint32_t crc32,
+    RangeReader demand, RangeReader prefetch, std::string backing_path) {
+  android::base::unique_fd backing(
+      open(backing_path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644));
+  CF_EXPECT(backing.get() >= 0,
+            "Could not open " << backing_path << ": " << strerror(errno));
+  // Sparse until downloaded
+  CF_EXPECT(ftruncate(backing.get(), size) == 0,
+            "Could not resize " << backing_path << ": " << strerror(errno));
+  return std::unique_ptr<LazyImage>(
+      new LazyImage(std::move(name), offset, size, crc32, std::move(demand),
+                    std::move(prefetch), std::move(backing_path),
+                    std::move(backing)));
+}
+
+LazyImage::LazyImage(std::string name, uint64_t offset, uint64_t size,
+                     uint32_t crc32, RangeReader demand, RangeReader prefetch,
+                     std::string backing_path,
+                     android::base::unique_fd backing)
+    : name_(std::move(name)),
+      offset_(offset),
+      size_(size),
+      crc32_(crc32),
+      demand_(std::move(demand)),
+      prefetch_(std::move(prefetch)),
+      backing_path_(std::move(backing_path)),
+      backing_(std::move(backing)),
+      blocks_((size + kBlockSize - 1) / kBlockSize, BlockState::kMissing),
+      read_(blocks_.size(), false) {}
+
+void LazyImage::OnFirstRead(std::function<void(uint64_t block)> callback) {
+  on_first_read_ = std::move(callback);
+}
+
+Result<size_t> LazyImage::Read(uint64_t offset, char* data, size_t length) {
+  if (offset >= size_) {
+    return 0;
+  }
+  length = std::min<uint64_t>(length, size_ - offset);
+  if (length == 0) {
+    return 0;
+  }
+  uint64_t first = offset / kBlockSize;
+  uint64_t end = (offset + length + kBlockSize - 1) / kBlockSize;
+  if (on_first_read_) {
+    std::vector<uint64_t> first_reads;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (uint64_t block = first; block < end; block++) {
+        if (!read_[block]) {
+          read_[block] = true;
+          first_reads.push_back(block);
+        }
+      }
+    }
+    for (auto block : first_reads) {
+      on_first_read_(block);
+    }
+  }
+  CF_EXPECT(Ensure(first, end, demand_));
+
+  for (size_t done = 0; done < length;) {
+    auto bytes = pread(backing_.get(), data + done, length - done,
+                       offset + done);
+    CF_EXPECT(bytes > 0,
+              "Could not read " << backing_path_ << ": " << strerror(errno));
+    done += bytes;
+  }
+  return length;
+}
+
+Result<void> LazyImage::Prefetch(uint64_t first, uint64_t count) {
+  uint64_t end = std::min<uint64_t>(first + count, blocks_.size());
+  if (first < end) {
+    CF_EXPECT(Ensure(first, end, prefetch_));
+  }
+  return {};
+}
+
+bool LazyImage::Complete() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return downloaded_blocks_ == blocks_.size();
+}
+
+uint64_t LazyImage::DownloadedBlocks() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return downloaded_blocks_;
+}
+
+Result<void> LazyImage::Verify() const {
+  CF_EXPECT(Complete(), name_ << " is not complete");
+  std::vector<char> buffer(kBlockSize);
+  uLong crc = crc32(0, nullptr, 0);
+  for (uint64_t offset = 0; offset < size_;) {
+    auto bytes = pread(backing_.get(), buffer.data(),
+                       std::min<uint64_t>(buffer.size(), size_ - offset),
+                       offset);
+    CF_EXPECT(bytes > 0,
+              "Could not read " << backing_path_ << ": " << strerror(errno));
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(buffer.data()), bytes);
+    offset += bytes;
+  }
+  CF_EXPECT(crc == crc32_, "Bad checksum for " << name_);
+  return {};
+}
+
+void LazyImage::Discard() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Blocks being downloaded are left to finish, they have the new data.
+  for (auto& block : blocks_) {
+    if (block == BlockState::kPresent) {
+      block = BlockState::kMissing;
+      downloaded_blocks_--;
+    }
+  }
+}
+
+Result<void> LazyImage::Ensure(uint64_t first, uint64_t end,
+                               const RangeReader& reader) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // Claims the missing blocks, leaving the ones downloading to whoever
+    // started them.
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+    bool waiting = false;
+    for (uint64_t block = first; block < end; block++) {
+      if (blocks_[block] == BlockState::kDownloading) {
+        waiting = true;
+      }
+      if (blocks_[block] != BlockState::kMissing) {
+        continue;
+      }
+      blocks_[block] = BlockState::kDownloading;
+      if (!runs.empty() && runs.back().second == block) {
+        runs.back().second++;
+      } else {
+        runs.emplace_back(block, block + 1);
+      }
+    }
+    if (runs.empty() && !waiting) {
+      return {};
+    }
+
+    Result<void> result = {};
+    for (const auto& [run_first, run_end] : runs) {
+      if (result.ok()) {
+        lock.unlock();
+        result = Download(run_first, run_end, reader);
+        lock.lock();
+      }
+      auto state = result.ok() ? BlockState::kPresent : BlockState::kMissing;
+      std::fill(blocks_.begin() + run_first, blocks_.begin() + run_end, state);
+      if (result.ok()) {
+        downloaded_blocks_ += run_end - run_first;
+      }
+    }
+    downloaded_.notify_all();
+    CF_EXPECT(std::move(result));
+
+    downloaded_.wait(lock, [this, first, end]() {
+      return std::none_of(
+          blocks_.begin() + first, blocks_.begin() + end,
+          [](BlockState state) { return state == BlockState::kDownloading; });
+    });
+    // Blocks someone else failed to download are missing again, and tried
+    // once more by this caller.
+  }
+}
+
+Result<void> LazyImage::Download(uint64_t first, uint64_t end,
+                                 const RangeReader& reader) {
+  uint64_t offset = first * kBlockSize;
+  uint64_t length = std::min(end * kBlockSize, size_) - offset;
+  auto data = CF_EXPECT(reader(offset_ + offset, length),
+                        "Could not download " << name_ << " at " << offset);
+  CF_EXPECT(data.size() == length, "Short download of " << name_);
+  for (size_t done = 0; done < data.size();) {
+    auto bytes = pwrite(backing_.get(), data.data() + done, data.size() - done,
+                        offset + done);
+    CF_EXPECT(bytes > 0,
+              "Could not write " << backing_path_ << ": " << strerror(errno));
+    done += bytes;
+  }
+  return {};
+}
+
+Result<BootProfile> LoadBootProfile(const std::string& path) {
+  std::ifstream ifs(path);
+  CF_EXPECT(ifs.good(), "Could not open " << path);
+  Json::CharReaderBuilder builder;
+  Json::Value json;
+  std::string error;
+  CF_EXPECT(Json::parseFromStream(builder, ifs, &json, &error),
+            "Could not parse " << path << ": " << error);
+  CF_EXPECT(json["ranges"].isArray(), "No ranges in " << path);
+  BootProfile profile;
+  for (const auto& range : json["ranges"]) {
+    CF_EXPECT(range["image"].isString() && range["offset"].isUInt64() &&
+                  range["length"].isUInt64(),
+              "Bad range in " << path);
+    profile.push_back({range["image"].asString(), range["offset"].asUInt64(),
+                       range["length"].asUInt64()});
+  }
+  return profile;
+}
+
+Result<void> SaveBootProfile(const BootProfile& profile,
+                             const std::string& path) {
+  Json::Value ranges(Json::arrayValue);
+  for (const auto& range : profile) {
+    Json::Value json;
+    json["image"] = range.image;
+    json["offset"] = Json::UInt64(range.offset);
+    json["length"] = Json::UInt64(range.length);
+    ranges.append(json);
+  }
+  Json::Value json;
+  json["ranges"] = ranges;
+  // Written aside and renamed, so a concurrent fetch never reads half of it.
+  auto temp_path = path + ".tmp";
+  {
+    std::ofstream ofs(temp_path);
+    ofs << json;
+    CF_EXPECT(!ofs.fail(), "Could not write " << temp_path);
+  }
+  CF_EXPECT(rename(temp_path.c_str(), path.c_str()) == 0,
+            "Could not rename " << temp_path << " to " << path << ": "
+                                << strerror(errno));
+  return {};
+}
+
+void LazyImageSet::Add(std::unique_ptr<LazyImage> image) {
+  const LazyImage* image_ptr = image.get();
+  image->OnFirstRead([this, image_ptr](uint64_t block) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    first_reads_.emplace_back(image_ptr, block);
+  });
+  images_.emplace_back(std::move(image));
+}
+
+LazyImage* LazyImageSet::Find(const std::string& name) const {
+  for (const auto& image : images_) {
+    if (image->Name() == name) {
+      return image.get();
+    }
+  }
+  return nullptr;
+}
+
+Result<void> LazyImageSet::Prefetch(const BootProfile& profile) {
+  for (const auto& range : profile) {
+    auto image = Find(range.image);
+    if (image == nullptr || range.length == 0) {
+      // Profiled on a build with other images
+      continue;
+    }
+    uint64_t first = range.offset / LazyImage::kBlockSize;
+    uint64_t end = (range.offset + range.length + LazyImage::kBlockSize - 1) /
+                   LazyImage::kBlockSize;
+    for (uint64_t block = first; block < end; block += kPrefetchBlocks) {
+      CF_EXPECT(image->Prefetch(block, std::min(kPrefetchBlocks, end - block)));
+    }
+  }
+  for (const auto& image : images_) {
+    for (uint64_t block = 0; block < image->Blocks();
+         block += kPrefetchBlocks) {
+      CF_EXPECT(image->Prefetch(block, kPrefetchBlocks));
+    }
+  }
+  return {};
+}
+
+Result<void> LazyImageSet::VerifyOrDownloadAgain(LazyImage& image) {
+  auto verified = image.Verify();
+  if (verified.ok()) {
+    return {};
+  }
+  LOG(WARNING) << verified.error().message() << ", downloading it again";
+  image.Discard();
+  for (uint64_t block = 0; block < image.Blocks(); block += kPrefetchBlocks) {
+    CF_EXPECT(image.Prefetch(block, kPrefetchBlocks));
+  }
+  CF_EXPECT(image.Verify());
+  return {};
+}
+
+bool LazyImageSet::Complete() const {
+  return std::all_of(images_.begin(), images_.end(),
+                     [](const auto& image) { return image->Complete(); });
+}
+
+BootProfile LazyImageSet::RecordedProfile() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  BootProfile profile;
+  for (const auto& [image, block] : first_reads_) {
+    uint64_t offset = block * LazyImage::kBlockSize;
+    uint64_t length = std::min(LazyImage::kBlockSize, image->Size() - offset);
+    if (!profile.empty() && profile.back().image == image->Name() &&
+        profile.back().offset + profile.back().length == offset) {
+      profile.back().length += length;
+    } else {
+      profile.push_back({image->Name(), offset, length});
+    }
+  }
+  return profile;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/fetcher/zip_delta.h"
+
+namespace cuttlefish {
+
+/**
+ * An image stored uncompressed in a remote archive, downloaded block by block
+ * into a sparse backing file. Blocks are downloaded when first read, or ahead
+ * of time by Prefetch(), so the image can be used long before it is complete.
+ */
+class LazyImage {
+ public:
+  static constexpr uint64_t kBlockSize = 1 << 20;
+
+  // The image is the |size| bytes at |offset| of the archive, with the
+  // |crc32| of its member. Reads download with |demand| and prefetches with
+  // |prefetch|, so a read never waits for the connection a prefetch is using.
+  static Result<std::unique_ptr<LazyImage>> Create(
+      std::string name, uint64_t offset, uint64_t size, uint32_t crc32,
+      RangeReader demand, RangeReader prefetch, std::string backing_path);
+
+  const std::string& Name() const { return name_; }
+  uint64_t Size() const { return size_; }
+  uint64_t Blocks() const { return blocks_.size(); }
+  const std::string& BackingPath() const { return backing_path_; }
+
+  // Called with every block the first time it is read.
+  void OnFirstRead(std::function<void(uint64_t block)> callback);
+
+  // Reads up to |length| bytes at |offset|, downloading the blocks they are
+  // in first. Reads are only short at the end of the image.
+  Result<size_t> Read(uint64_t offset, char* data, size_t length);
+
+  // Downloads the missing blocks of [first, first + count).
+  Result<void> Prefetch(uint64_t first, uint64_t count);
+
+  bool Complete() const;
+  uint64_t DownloadedBlocks() const;
+
+  // Checks the complete image against the CRC32 of its member.
+  Result<void> Verify() const;
+  // Forgets the downloaded blocks, for them to be downloaded again.
+  void Discard();
+
+ private:
+  enum class BlockState : uint8_t { kMissing, kDownloading, kPresent };
+
+  LazyImage(std::string name, uint64_t offset, uint64_t size, uint32_t crc32,
+            RangeReader demand, RangeReader prefetch,
+            std::string backing_path, android::base::unique_fd backing);
+
+  Result<void> Ensure(uint64_t first, uint64_t end, const RangeReader& reader);
+  Result<void> Download(uint64_t first, uint64_t end,
+                        const RangeReader& reader);
+
+  std::string name_;
+  uint64_t offset_;
+  uint64_t size_;
+  uint32_t crc32_;
+  RangeReader demand_;
+  RangeReader prefetch_;
+  std::string backing_path_;
+  android::base::unique_fd backing_;
+  std::function<void(uint64_t)> on_first_read_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable downloaded_;
+  std::vector<BlockState> blocks_;
+  std::vector<bool> read_;
+  uint64_t downloaded_blocks_ = 0;
+};
+
+// A range of an image a boot read, in the order the boot first read them.
+struct BootProfileRange {
+  std::string image;
+  uint64_t offset;
+  uint64_t length;
+};
+
+using BootProfile = std::vector<BootProfileRange>;
+
+Result<BootProfile> LoadBootProfile(const std::string& path);
+Result<void> SaveBootProfile(const BootProfile& profile,
+                             const std::string& path);
+
+// The images served together, recording the order they are read in.
+class LazyImageSet {
+ public:
+  void Add(std::unique_ptr<LazyImage> image);
+
+  const std::vector<std::unique_ptr<LazyImage>>& Images() const {
+    return images_;
+  }
+  LazyImage* Find(const std::string& name) const;
+
+  // Downloads every missing block, the ranges of |profile| first and then
+  // the rest of each image in order.
+  Result<void> Prefetch(const BootProfile& profile);
+
+  bool Complete() const;
+
+  // Verifies a complete image, downloading it once more if it doesn't match.
+  Result<void> VerifyOrDownloadAgain(LazyImage& image);
+
+  // What was read so far, as a profile for later prefetches.
+  BootProfile RecordedProfile() const;
+
+ private:
+  std::vector<std::unique_ptr<LazyImage>> images_;
+  mutable std::mutex mutex_;
+  std::vector<std::pair<const LazyImage*, uint64_t>> first_reads_;
+};
+
+}  // namespace cuttlefish
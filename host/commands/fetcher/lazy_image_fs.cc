@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/fetcher/lazy_image_fs.h"
+
+#include <fcntl.h>
+#include <linux/fuse.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/subprocess.h"
+
+namespace cuttlefish {
+namespace {
+
+// Images never change, so the kernel may cache everything about them.
+constexpr uint64_t kValidSeconds = 24 * 60 * 60;
+// Large enough for every request the file system accepts; writes, the only
+// large ones, are refused.
+constexpr size_t kRequestBufferSize = 64 << 10;
+constexpr uint32_t kMaxWrite = 4096;
+// Lets the kernel read up to 1MiB, a block, per request.
+constexpr uint16_t kMaxPages = 256;
+
+constexpr uint64_t kFirstImageNode = FUSE_ROOT_ID + 1;
+
+template <typename T>
+std::string Reply(uint64_t unique, const T& payload) {
+  fuse_out_header header = {};
+  header.len = sizeof(header) + sizeof(payload);
+  header.unique = unique;
+  std::string reply(reinterpret_cast<const char*>(&header), sizeof(header));
+  reply.append(reinterpret_cast<const char*>(&payload), sizeof(payload));
+  return reply;
+}
+
+std::string ErrorReply(uint64_t unique, int error) {
+  fuse_out_header header = {};
+  header.len = sizeof(header);
+  header.error = -error;
+  header.unique = unique;
+  return std::string(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+template <typename T>
+bool ReadArg(const std::string& request, T* arg) {
+  if (request.size() < sizeof(fuse_in_header) + sizeof(T)) {
+    return false;
+  }
+  memcpy(arg, request.data() + sizeof(fuse_in_header), sizeof(T));
+  return true;
+}
+
+fuse_attr Attr(uint64_t node, uint64_t size, uint32_t mode, uint32_t links) {
+  static const time_t mount_time = time(nullptr);
+  fuse_attr attr = {};
+  attr.ino = node;
+  attr.size = size;
+  attr.blocks = (size + 511) / 512;
+  attr.atime = attr.mtime = attr.ctime = mount_time;
+  attr.mode = mode;
+  attr.nlink = links;
+  attr.uid = getuid();
+  attr.gid = getgid();
+  attr.blksize = 4096;
+  return attr;
+}
+
+}  // namespace
+
+LazyImageFs::LazyImageFs(LazyImageSet& images) : images_(images) {}
+
+LazyImage* LazyImageFs::Image(uint64_t node) const {
+  if (node < kFirstImageNode ||
+      node - kFirstImageNode >= images_.Images().size()) {
+    return nullptr;
+  }
+  return images_.Images()[node - kFirstImageNode].get();
+}
+
+std::string LazyImageFs::Handle(const std::string& request) {
+  fuse_in_header header;
+  if (request.size() < sizeof(header)) {
+    LOG(ERROR) << "Truncated FUSE request";
+    return "";
+  }
+  memcpy(&header, request.data(), sizeof(header));
+  auto unique = header.unique;
+  switch (header.opcode) {
+    case FUSE_INIT:
+      return Init(unique, request);
+    case FUSE_DESTROY:
+      destroyed_ = true;
+      return ErrorReply(unique, 0);
+    case FUSE_FORGET:
+    case FUSE_BATCH_FORGET:
+    case FUSE_INTERRUPT:
+      // Node ids live as long as the mount, and reads can't be cancelled.
+      return "";
+    case FUSE_LOOKUP: {
+      // The name is NUL terminated.
+      auto name = request.substr(sizeof(header));
+      return Lookup(unique, header.nodeid, name.substr(0, name.find('\0')));
+    }
+    case FUSE_GETATTR:
+      return GetAttr(unique, header.nodeid);
+    case FUSE_OPEN: {
+      fuse_open_in open_in;
+      if (!ReadArg(request, &open_in)) {
+        return ErrorReply(unique, EINVAL);
+      }
+      return Open(unique, header.nodeid, open_in.flags);
+    }
+    case FUSE_OPENDIR:
+      return OpenDir(unique, header.nodeid);
+    case FUSE_READ:
+    case FUSE_READDIR: {
+      fuse_read_in read_in;
+      if (!ReadArg(request, &read_in)) {
+        return ErrorReply(unique, EINVAL);
+      }
+      if (header.opcode == FUSE_READ) {
+        return Read(unique, header.nodeid, read_in.offset, read_in.size);
+      }
+      return ReadDir(unique, header.nodeid, read_in.offset, read_in.size);
+    }
+    case FUSE_STATFS:
+      return StatFs(unique);
+    case FUSE_RELEASE:
+    case FUSE_RELEASEDIR:
+    case FUSE_FLUSH:
+    case FUSE_ACCESS:
+      return ErrorReply(unique, 0);
+    default:
+      return ErrorReply(unique, ENOSYS);
+  }
+}
+
+std::string LazyImageFs::Init(uint64_t unique, const std::string& request) {
+  // Only the fields every version of the protocol has.
+  struct {
+    uint32_t major;
+    uint32_t minor;
+    uint32_t max_readahead;
+    uint32_t flags;
+  } init_in;
+  if (!ReadArg(request, &init_in)) {
+    return ErrorReply(unique, EINVAL);
+  }
+  if (init_in.major != FUSE_KERNEL_VERSION) {
+    LOG(ERROR) << "Unsupported FUSE protocol " << init_in.major << "."
+               << init_in.minor;
+    return ErrorReply(unique, EPROTO);
+  }
+  minor_version_ = std::min<uint32_t>(init_in.minor,
+                                      FUSE_KERNEL_MINOR_VERSION);
+  fuse_init_out init_out = {};
+  init_out.major = FUSE_KERNEL_VERSION;
+  init_out.minor = FUSE_KERNEL_MINOR_VERSION;
+  init_out.max_readahead = init_in.max_readahead;
+  init_out.flags = init_in.flags & FUSE_ASYNC_READ;
+#ifdef FUSE_MAX_PAGES
+  if (init_in.flags & FUSE_MAX_PAGES) {
+    init_out.flags |= FUSE_MAX_PAGES;
+    init_out.max_pages = kMaxPages;
+  }
+#endif
+  init_out.max_background = 16;
+  init_out.congestion_threshold = 12;
+  init_out.max_write = kMaxWrite;
+  init_out.time_gran = 1;
+  auto reply = Reply(unique, init_out);
+  if (minor_version_ < 23) {
+    // Older kernels take a shorter reply.
+    reply.resize(sizeof(fuse_out_header) + FUSE_COMPAT_22_INIT_OUT_SIZE);
+    fuse_out_header out_header;
+    memcpy(&out_header, reply.data(), sizeof(out_header));
+    out_header.len = reply.size();
+    memcpy(reply.data(), &out_header, sizeof(out_header));
+  }
+  return reply;
+}
+
+std::string LazyImageFs::Lookup(uint64_t unique, uint64_t node,
+                                const std::string& name) {
+  if (node != FUSE_ROOT_ID) {
+    return ErrorReply(unique, ENOTDIR);
+  }
+  const auto& images = images_.Images();
+  for (size_t i = 0; i < images.size(); i++) {
+    if (images[i]->Name() != name) {
+      continue;
+    }
+    fuse_entry_out entry = {};
+    entry.nodeid = kFirstImageNode + i;
+    entry.entry_valid = kValidSeconds;
+    entry.attr_valid = kValidSeconds;
+    entry.attr =
+        Attr(entry.nodeid, images[i]->Size(), S_IFREG | 0444, 1);
+    return Reply(unique, entry);
+  }
+  return ErrorReply(unique, ENOENT);
+}
+
+std::string LazyImageFs::GetAttr(uint64_t unique, uint64_t node) {
+  fuse_attr_out attr_out = {};
+  attr_out.attr_valid = kValidSeconds;
+  if (node == FUSE_ROOT_ID) {
+    attr_out.attr = Attr(node, 0, S_IFDIR | 0555, 2);
+  } else if (auto image = Image(node)) {
+    attr_out.attr = Attr(node, image->Size(), S_IFREG | 0444, 1);
+  } else {
+    return ErrorReply(unique, ENOENT);
+  }
+  return Reply(unique, attr_out);
+}
+
+std::string LazyImageFs::Open(uint64_t unique, uint64_t node,
+                              uint32_t flags) {
+  if (Image(node) == nullptr) {
+    return ErrorReply(unique, node == FUSE_ROOT_ID ? EISDIR : ENOENT);
+  }
+  if ((flags & O_ACCMODE) != O_RDONLY) {
+    return ErrorReply(unique, EROFS);
+  }
+  fuse_open_out open_out = {};
+  // Keeps what was read cached across opens.
+  open_out.open_flags = FOPEN_KEEP_CACHE;
+  return Reply(unique, open_out);
+}
+
+std::string LazyImageFs::OpenDir(uint64_t unique, uint64_t node) {
+  if (node != FUSE_ROOT_ID) {
+    return ErrorReply(unique, ENOTDIR);
+  }
+  return Reply(unique, fuse_open_out{});
+}
+
+std::string LazyImageFs::Read(uint64_t unique, uint64_t node, uint64_t offset,
+                              uint32_t size) {
+  auto image = Image(node);
+  if (image == nullptr) {
+    return ErrorReply(unique, ENOENT);
+  }
+  std::string reply(sizeof(fuse_out_header) + size, '\0');
+  auto bytes = image->Read(offset, reply.data() + sizeof(fuse_out_header),
+                           size);
+  if (!bytes.ok()) {
+    LOG(ERROR) << "Failed to read " << image->Name() << ": " << bytes.error();
+    return ErrorReply(unique, EIO);
+  }
+  reply.resize(sizeof(fuse_out_header) + *bytes);
+  fuse_out_header header = {};
+  header.len = reply.size();
+  header.unique = unique;
+  memcpy(reply.data(), &header, sizeof(header));
+  return reply;
+}
+
+std::string LazyImageFs::ReadDir(uint64_t unique, uint64_t node,
+                                 uint64_t offset, uint32_t size) {
+  if (node != FUSE_ROOT_ID) {
+    return ErrorReply(unique, ENOTDIR);
+  }
+  std::vector<std::pair<std::string, uint64_t>> entries = {
+      {".", FUSE_ROOT_ID}, {"..", FUSE_ROOT_ID}};
+  const auto& images = images_.Images();
+  for (size_t i = 0; i < images.size(); i++) {
+    entries.emplace_back(images[i]->Name(), kFirstImageNode + i);
+  }
+  std::string data;
+  for (uint64_t i = offset; i < entries.size(); i++) {
+    const auto& [name, entry_node] = entries[i];
+    std::string dirent(FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + name.size()), '\0');
+    if (data.size() + dirent.size() > size) {
+      break;
+    }
+    fuse_dirent header = {};
+    header.ino = entry_node;
+    header.off = i + 1;
+    header.namelen = name.size();
+    header.type = (entry_node == FUSE_ROOT_ID ? S_IFDIR : S_IFREG) >> 12;
+    memcpy(dirent.data(), &header, FUSE_NAME_OFFSET);
+    memcpy(dirent.data() + FUSE_NAME_OFFSET, name.data(), name.size());
+    data += dirent;
+  }
+  fuse_out_header header = {};
+  header.len = sizeof(header) + data.size();
+  header.unique = unique;
+  return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) +
+         data;
+}
+
+std::string LazyImageFs::StatFs(uint64_t unique) {
+  fuse_statfs_out statfs_out = {};
+  statfs_out.st.bsize = 4096;
+  statfs_out.st.frsize = 4096;
+  statfs_out.st.namelen = 255;
+  return Reply(unique, statfs_out);
+}
+
+Result<void> LazyImageFs::Serve(int fuse, int threads) {
+  std::mutex error_mutex;
+  Result<void> error = {};
+  auto serve = [this, fuse, &error_mutex, &error]() {
+    std::vector<char> buffer(kRequestBufferSize);
+    while (!destroyed_) {
+      auto bytes = read(fuse, buffer.data(), buffer.size());
+      if (bytes < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == ENOENT) {
+          // ENOENT is a request interrupted before it was read.
+          continue;
+        }
+        if (errno != ENODEV) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          error = CF_ERR("Could not read from /dev/fuse: " << strerror(errno));
+        }
+        // ENODEV once unmounted
+        return;
+      }
+      auto reply = Handle(std::string(buffer.data(), bytes));
+      // ENOENT is a request interrupted while it was handled.
+      if (!reply.empty() && write(fuse, reply.data(), reply.size()) < 0 &&
+          errno != ENOENT) {
+        LOG(ERROR) << "Could not reply to FUSE: " << strerror(errno);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; i++) {
+    workers.emplace_back(serve);
+  }
+  serve();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  CF_EXPECT(std::move(error));
+  return {};
+}
+
+Result<android::base::unique_fd> MountFuse(const std::string& mountpoint,
+                                           const std::string& name) {
+  SharedFD ours, theirs;
+  CF_EXPECT(SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &ours, &theirs),
+            "Could not create a socket pair: " << ours->StrError());
+  Subprocess fusermount = [&]() {
+    // fusermount3 sends /dev/fuse over the socket its environment names.
+    Command command("env");
+    command.AddParameter("_FUSE_COMMFD=", theirs);
+    command.AddParameter("fusermount3");
+    command.AddParameter("-o");
+    command.AddParameter("ro,nosuid,nodev,default_permissions,fsname=", name,
+                         ",subtype=", name);
+    command.AddParameter("--");
+    command.AddParameter(mountpoint);
+    return command.Start();
+  }();
+  theirs->Close();
+
+  char byte;
+  iovec iov = {&byte, sizeof(byte)};
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  // Returns 0 when fusermount3 fails, or isn't installed, and exits.
+  auto bytes = ours->RecvMsg(&msg, MSG_CMSG_CLOEXEC);
+  auto exit_code = fusermount.Wait();
+  CF_EXPECT(bytes > 0, "Could not mount " << mountpoint << " with fusermount3");
+  CF_EXPECT(exit_code == 0, "fusermount3 exited with " << exit_code);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  CF_EXPECT(cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_RIGHTS,
+            "fusermount3 did not send /dev/fuse");
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+  return android::base::unique_fd(fd);
+}
+
+Result<void> UnmountFuseLazily(const std::string& mountpoint) {
+  auto exit_code = execute({"fusermount3", "-u", "-z", mountpoint});
+  CF_EXPECT(exit_code == 0, "Could not unmount " << mountpoint);
+  return {};
+}
+
+}  // namespace cuttlefish
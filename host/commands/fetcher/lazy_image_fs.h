@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include <android-base/unique_fd.h>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/fetcher/lazy_image.h"
+
+namespace cuttlefish {
+
+/**
+ * Serves a LazyImageSet as a flat, read only FUSE file system, speaking the
+ * kernel protocol over /dev/fuse directly. Reads of the files download what
+ * they need first, so the VMM can use images still being downloaded.
+ */
+class LazyImageFs {
+ public:
+  explicit LazyImageFs(LazyImageSet& images);
+
+  // Handles a request read from /dev/fuse, returning the reply to write back,
+  // empty for the requests that take none.
+  std::string Handle(const std::string& request);
+
+  // Serves |fuse| on |threads| threads, so a read waiting on its download
+  // doesn't hold up the others, until the file system is unmounted.
+  Result<void> Serve(int fuse, int threads);
+
+ private:
+  std::string Init(uint64_t unique, const std::string& request);
+  std::string Lookup(uint64_t unique, uint64_t node, const std::string& name);
+  std::string GetAttr(uint64_t unique, uint64_t node);
+  std::string Open(uint64_t unique, uint64_t node, uint32_t flags);
+  std::string OpenDir(uint64_t unique, uint64_t node);
+  std::string Read(uint64_t unique, uint64_t node, uint64_t offset,
+                   uint32_t size);
+  std::string ReadDir(uint64_t unique, uint64_t node, uint64_t offset,
+                      uint32_t size);
+  std::string StatFs(uint64_t unique);
+
+  LazyImage* Image(uint64_t node) const;
+
+  LazyImageSet& images_;
+  uint32_t minor_version_ = 0;
+  std::atomic<bool> destroyed_ = false;
+};
+
+// Mounts a FUSE file system at |mountpoint| without privileges, through the
+// setuid fusermount3 helper, returning the /dev/fuse file descriptor to serve.
+Result<android::base::unique_fd> MountFuse(const std::string& mountpoint,
+                                           const std::string& name);
+
+// Detaches the file system at |mountpoint|. It goes away, ending Serve(),
+// once the files open in it are closed.
+Result<void> UnmountFuseLazily(const std::string& mountpoint);
+
+}  // namespace cuttlefish
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <linux/fuse.h>
+
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "host/commands/fetcher/fetcher_test_utils.h"
+#include "host/commands/fetcher/lazy_image.h"
+#include "host/commands/fetcher/lazy_image_fs.h"
+#include "host/commands/fetcher/zip_delta.h"
+#include "host/libs/web/curl_wrapper.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr uint64_t kBlock = LazyImage::kBlockSize;
+
+class LazyImageTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = temp_dir_.path;
+    demand_curl_ = CurlWrapper::Create();
+    prefetch_curl_ = CurlWrapper::Create();
+
+    system_ = RandomData(8 * kBlock + 4096, 1);
+    vendor_ = RandomData(4 * kBlock, 2);
+    zip_ = MakeZip({{"android-info.txt", "board=cutf", 0, true},
+                    {"system.img", system_},
+                    {"vendor.img", vendor_}});
+    server_ = std::make_unique<HttpStandIn>(zip_);
+  }
+
+  // Reads the directory locally, so the server only sees image downloads.
+  std::unique_ptr<LazyImage> Open(const std::string& name,
+                                  RangeReader prefetch = nullptr,
+                                  std::optional<uint32_t> crc32 = {}) {
+    auto local = [this](uint64_t offset, uint64_t length) -> Result<std::string> {
+      return zip_.substr(offset, length);
+    };
+    auto directory = ReadZipDirectory(local, zip_.size());
+    EXPECT_TRUE(directory.ok()) << directory.error();
+    for (const auto& entry : directory->entries) {
+      if (entry.name != name) {
+        continue;
+      }
+      auto offset = ZipMemberDataOffset(local, entry);
+      EXPECT_TRUE(offset.ok()) << offset.error();
+      if (!prefetch) {
+        prefetch = HttpRangeReader(*prefetch_curl_, server_->Url());
+      }
+      auto image = LazyImage::Create(
+          name, *offset, entry.uncompressed_size,
+          crc32.value_or(entry.crc32), HttpRangeReader(*demand_curl_, server_->Url()), prefetch,
+          dir_ + "/" + name);
+      EXPECT_TRUE(image.ok()) << image.error();
+      return std::move(*image);
+    }
+    ADD_FAILURE() << "No " << name;
+    return nullptr;
+  }
+
+  TemporaryDir temp_dir_;
+  std::string dir_;
+  std::unique_ptr<CurlWrapper> demand_curl_;
+  std::unique_ptr<CurlWrapper> prefetch_curl_;
+  std::string system_;
+  std::string vendor_;
+  std::string zip_;
+  std::unique_ptr<HttpStandIn> server_;
+};
+
+TEST_F(LazyImageTest, DownloadsOnlyWhatIsRead) {
+  auto image = Open("system.img");
+  ASSERT_NE(image, nullptr);
+  ASSERT_EQ(image->Blocks(), 9);
+
+  std::string data(100, '\0');
+  auto bytes = image->Read(3 * kBlock + kBlock / 2, data.data(), data.size());
+  ASSERT_TRUE(bytes.ok()) << bytes.error();
+  ASSERT_EQ(*bytes, data.size());
+  ASSERT_EQ(data, system_.substr(3 * kBlock + kBlock / 2, 100));
+  ASSERT_EQ(image->DownloadedBlocks(), 1);
+  ASSERT_EQ(server_->BytesServed(), kBlock);
+
+  // Across a block boundary, the block already downloaded isn't again.
+  data.resize(kBlock);
+  bytes = image->Read(3 * kBlock + kBlock / 2, data.data(), data.size());
+  ASSERT_TRUE(bytes.ok()) << bytes.error();
+  ASSERT_EQ(data, system_.substr(3 * kBlock + kBlock / 2, kBlock));
+  ASSERT_EQ(image->DownloadedBlocks(), 2);
+  ASSERT_EQ(server_->BytesServed(), 2 * kBlock);
+
+  // Short at the end
+  bytes = image->Read(system_.size() - 10, data.data(), data.size());
+  ASSERT_TRUE(bytes.ok()) << bytes.error();
+  ASSERT_EQ(*bytes, 10);
+  ASSERT_EQ(data.substr(0, 10), system_.substr(system_.size() - 10));
+  ASSERT_FALSE(image->Complete());
+}
+
+TEST_F(LazyImageTest, ConcurrentReadsDownloadOnce) {
+  auto image = Open("system.img");
+  ASSERT_NE(image, nullptr);
+  std::vector<std::thread> readers;
+  std::vector<std::string> results(4, std::string(4096, '\0'));
+  for (size_t i = 0; i < results.size(); i++) {
+    readers.emplace_back([&image, &results, i]() {
+      auto bytes = image->Read(kBlock + i * 4096, results[i].data(), 4096);
+      EXPECT_TRUE(bytes.ok()) << bytes.error();
+    });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  for (size_t i = 0; i < results.size(); i++) {
+    ASSERT_EQ(results[i], system_.substr(kBlock + i * 4096, 4096));
+  }
+  ASSERT_EQ(server_->Requests(), 1);
+}
+
+TEST_F(LazyImageTest, PrefetchesTheProfileFirst) {
+  std::vector<std::pair<uint64_t, uint64_t>> requests;
+  auto http = HttpRangeReader(*prefetch_curl_, server_->Url());
+  auto recording = [&requests, http](uint64_t offset,
+                                     uint64_t length) -> Result<std::string> {
+    requests.emplace_back(offset, length);
+    return http(offset, length);
+  };
+  LazyImageSet images;
+  images.Add(Open("system.img", recording));
+  images.Add(Open("vendor.img", recording));
+
+  BootProfile profile = {{"vendor.img", 2 * kBlock, kBlock},
+                         {"system.img", 0, 2 * kBlock},
+                         {"odm.img", 0, kBlock}};
+  auto prefetched = images.Prefetch(profile);
+  ASSERT_TRUE(prefetched.ok()) << prefetched.error();
+  ASSERT_TRUE(images.Complete());
+  ASSERT_EQ(ReadWholeFile(dir_ + "/system.img"), system_);
+  ASSERT_EQ(ReadWholeFile(dir_ + "/vendor.img"), vendor_);
+
+  auto system_start = zip_.find(system_.substr(0, 64));
+  auto vendor_start = zip_.find(vendor_.substr(0, 64));
+  ASSERT_GE(requests.size(), 2);
+  ASSERT_EQ(requests[0], std::make_pair(vendor_start + 2 * kBlock, kBlock));
+  ASSERT_EQ(requests[1], std::make_pair(system_start, 2 * kBlock));
+  // Nothing is downloaded twice.
+  ASSERT_EQ(server_->BytesServed(), system_.size() + vendor_.size());
+}
+
+TEST_F(LazyImageTest, RecordsTheBootProfile) {
+  LazyImageSet images;
+  images.Add(Open("system.img"));
+  images.Add(Open("vendor.img"));
+  auto system = images.Find("system.img");
+  auto vendor = images.Find("vendor.img");
+  ASSERT_NE(system, nullptr);
+  ASSERT_NE(vendor, nullptr);
+
+  std::string data(6 * kBlock, '\0');
+  ASSERT_TRUE(system->Read(2 * kBlock, data.data(), 10).ok());
+  ASSERT_TRUE(vendor->Read(0, data.data(), 10).ok());
+  ASSERT_TRUE(system->Read(3 * kBlock, data.data(), 2 * kBlock).ok());
+  ASSERT_TRUE(system->Read(2 * kBlock, data.data(), 10).ok());
+  ASSERT_TRUE(system->Read(5 * kBlock, data.data(), 4 * kBlock + 4096).ok());
+
+  auto profile = images.RecordedProfile();
+  ASSERT_EQ(profile.size(), 3);
+  ASSERT_EQ(profile[0].image, "system.img");
+  ASSERT_EQ(profile[0].offset, 2 * kBlock);
+  ASSERT_EQ(profile[0].length, kBlock);
+  ASSERT_EQ(profile[1].image, "vendor.img");
+  ASSERT_EQ(profile[2].image, "system.img");
+  ASSERT_EQ(profile[2].offset, 3 * kBlock);
+  // Through the short last block
+  ASSERT_EQ(profile[2].length, system_.size() - 3 * kBlock);
+
+  auto path = dir_ + "/profile.json";
+  ASSERT_TRUE(SaveBootProfile(profile, path).ok());
+  auto loaded = LoadBootProfile(path);
+  ASSERT_TRUE(loaded.ok()) << loaded.error();
+  ASSERT_EQ(loaded->size(), 3);
+  ASSERT_EQ((*loaded)[2].length, profile[2].length);
+  ASSERT_EQ((*loaded)[1].image, "vendor.img");
+}
+
+TEST_F(LazyImageTest, DownloadsAgainOnBadChecksum) {
+  // The first download of the image comes back corrupted.
+  auto http = HttpRangeReader(*prefetch_curl_, server_->Url());
+  bool corrupted = false;
+  auto corrupting = [&corrupted, http](uint64_t offset,
+                                       uint64_t length) -> Result<std::string> {
+    auto data = CF_EXPECT(http(offset, length));
+    if (!corrupted) {
+      data[0] ^= 1;
+      corrupted = true;
+    }
+    return data;
+  };
+  LazyImageSet images;
+  images.Add(Open("vendor.img", corrupting));
+  auto vendor = images.Find("vendor.img");
+  ASSERT_TRUE(images.Prefetch({}).ok());
+  ASSERT_TRUE(images.Complete());
+  ASSERT_FALSE(vendor->Verify().ok());
+
+  auto verified = images.VerifyOrDownloadAgain(*vendor);
+  ASSERT_TRUE(verified.ok()) << verified.error();
+  ASSERT_EQ(ReadWholeFile(dir_ + "/vendor.img"), vendor_);
+  ASSERT_EQ(server_->BytesServed(), 2 * vendor_.size());
+}
+
+TEST_F(LazyImageTest, FailsOnPersistentBadChecksum) {
+  LazyImageSet images;
+  images.Add(Open("vendor.img", nullptr, Crc32(vendor_) ^ 1));
+  auto vendor = images.Find("vendor.img");
+  ASSERT_TRUE(images.Prefetch({}).ok());
+  ASSERT_FALSE(images.VerifyOrDownloadAgain(*vendor).ok());
+}
+
+template <typename T>
+std::string Request(uint32_t opcode, uint64_t node, const T& arg,
+                    const std::string& extra = "") {
+  fuse_in_header header = {};
+  header.len = sizeof(header) + sizeof(arg) + extra.size();
+  header.opcode = opcode;
+  header.unique = 7;
+  header.nodeid = node;
+  std::string request(reinterpret_cast<const char*>(&header), sizeof(header));
+  request.append(reinterpret_cast<const char*>(&arg), sizeof(arg));
+  return request + extra;
+}
+
+template <typename T>
+T Payload(const std::string& reply) {
+  fuse_out_header header;
+  memcpy(&header, reply.data(), sizeof(header));
+  EXPECT_EQ(header.len, reply.size());
+  EXPECT_EQ(header.unique, 7);
+  EXPECT_EQ(header.error, 0);
+  T payload;
+  memcpy(&payload, reply.data() + sizeof(header), sizeof(payload));
+  return payload;
+}
+
+int Error(const std::string& reply) {
+  fuse_out_header header;
+  memcpy(&header, reply.data(), sizeof(header));
+  return -header.error;
+}
+
+TEST_F(LazyImageTest, ServesTheImagesOverFuse) {
+  LazyImageSet images;
+  images.Add(Open("system.img"));
+  images.Add(Open("vendor.img"));
+  LazyImageFs fs(images);
+
+  fuse_init_in init_in = {};
+  init_in.major = FUSE_KERNEL_VERSION;
+  init_in.minor = FUSE_KERNEL_MINOR_VERSION;
+  init_in.max_readahead = 128 << 10;
+  auto init_out =
+      Payload<fuse_init_out>(fs.Handle(Request(FUSE_INIT, 0, init_in)));
+  ASSERT_EQ(init_out.major, FUSE_KERNEL_VERSION);
+
+  char name[] = "vendor.img";
+  auto entry = Payload<fuse_entry_out>(
+      fs.Handle(Request(FUSE_LOOKUP, FUSE_ROOT_ID, name)));
+  ASSERT_EQ(entry.attr.size, vendor_.size());
+  char missing[] = "odm.img";
+  ASSERT_EQ(Error(fs.Handle(Request(FUSE_LOOKUP, FUSE_ROOT_ID, missing))),
+            ENOENT);
+
+  fuse_getattr_in getattr_in = {};
+  auto attr = Payload<fuse_attr_out>(
+      fs.Handle(Request(FUSE_GETATTR, entry.nodeid, getattr_in)));
+  ASSERT_EQ(attr.attr.size, vendor_.size());
+
+  fuse_open_in open_in = {};
+  open_in.flags = O_RDWR;
+  ASSERT_EQ(Error(fs.Handle(Request(FUSE_OPEN, entry.nodeid, open_in))),
+            EROFS);
+  open_in.flags = O_RDONLY;
+  Payload<fuse_open_out>(fs.Handle(Request(FUSE_OPEN, entry.nodeid, open_in)));
+
+  fuse_read_in read_in = {};
+  read_in.offset = kBlock - 100;
+  read_in.size = 4096;
+  auto reply = fs.Handle(Request(FUSE_READ, entry.nodeid, read_in));
+  ASSERT_EQ(reply.size(), sizeof(fuse_out_header) + 4096);
+  ASSERT_EQ(reply.substr(sizeof(fuse_out_header)),
+            vendor_.substr(kBlock - 100, 4096));
+  ASSERT_EQ(server_->BytesServed(), 2 * kBlock);
+
+  read_in.offset = 0;
+  read_in.size = 4096;
+  reply = fs.Handle(Request(FUSE_READDIR, FUSE_ROOT_ID, read_in));
+  std::vector<std::string> names;
+  for (size_t pos = sizeof(fuse_out_header); pos < reply.size();) {
+    fuse_dirent dirent;
+    memcpy(&dirent, reply.data() + pos, FUSE_NAME_OFFSET);
+    names.push_back(reply.substr(pos + FUSE_NAME_OFFSET, dirent.namelen));
+    pos += FUSE_DIRENT_SIZE(&dirent);
+  }
+  ASSERT_EQ(names, (std::vector<std::string>{".", "..", "system.img",
+                                             "vendor.img"}));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,507 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/fetcher/zip_delta.h"
+
+#include <fcntl.h>
+#include <openssl/md5.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+constexpr uint32_t kZip64EndOfCentralDirectorySignature = 0x06064b50;
+constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr uint32_t kCentralDirectorySignature = 0x02014b50;
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint16_t kZip64ExtraId = 0x0001;
+
+constexpr size_t kEndOfCentralDirectoryLen = 22;
+constexpr size_t kZip64LocatorLen = 20;
+constexpr size_t kZip64EndOfCentralDirectoryLen = 56;
+constexpr size_t kCentralDirectoryHeaderLen = 46;
+constexpr size_t kLocalHeaderLen = 30;
+constexpr size_t kMaxCommentLen = 0xffff;
+
+constexpr uint16_t kStored = 0;
+constexpr uint16_t kDeflated = 8;
+
+// Downloads are split into requests of at most this size, which is also what
+// is held in memory at a time.
+constexpr uint64_t kMaxRequestLen = 32 << 20;
+// Members shorter than this between two downloaded ranges are downloaded
+// along with them rather than costing two more requests.
+constexpr uint64_t kMinReusedLen = 256 << 10;
+constexpr uint64_t kCopyChunkLen = 4 << 20;
+
+template <typename T>
+T Read(const std::string& data, size_t offset) {
+  T value;
+  memcpy(&value, data.data() + offset, sizeof(T));
+  return value;
+}
+
+Result<ZipEntry> ParseCentralDirectoryHeader(const std::string& data,
+                                             size_t* pos) {
+  CF_EXPECT(*pos + kCentralDirectoryHeaderLen <= data.size(),
+            "Truncated central directory");
+  CF_EXPECT(Read<uint32_t>(data, *pos) == kCentralDirectorySignature,
+            "Bad central directory header signature");
+  ZipEntry entry;
+  entry.version_needed = Read<uint16_t>(data, *pos + 6);
+  entry.flags = Read<uint16_t>(data, *pos + 8);
+  entry.method = Read<uint16_t>(data, *pos + 10);
+  entry.time = Read<uint16_t>(data, *pos + 12);
+  entry.date = Read<uint16_t>(data, *pos + 14);
+  entry.crc32 = Read<uint32_t>(data, *pos + 16);
+  entry.compressed_size = Read<uint32_t>(data, *pos + 20);
+  entry.uncompressed_size = Read<uint32_t>(data, *pos + 24);
+  auto name_len = Read<uint16_t>(data, *pos + 28);
+  auto extra_len = Read<uint16_t>(data, *pos + 30);
+  auto comment_len = Read<uint16_t>(data, *pos + 32);
+  entry.local_header_offset = Read<uint32_t>(data, *pos + 42);
+  size_t name_pos = *pos + kCentralDirectoryHeaderLen;
+  size_t end = name_pos + name_len + extra_len + comment_len;
+  CF_EXPECT(end <= data.size(), "Truncated central directory");
+  entry.name = data.substr(name_pos, name_len);
+
+  // The 64 bit values follow in this order, present only when their 32 bit
+  // field is saturated.
+  size_t extra_pos = name_pos + name_len;
+  size_t extra_end = extra_pos + extra_len;
+  while (extra_pos + 4 <= extra_end) {
+    auto id = Read<uint16_t>(data, extra_pos);
+    auto len = Read<uint16_t>(data, extra_pos + 2);
+    size_t field = extra_pos + 4;
+    CF_EXPECT(field + len <= extra_end, "Bad extra field in " << entry.name);
+    if (id == kZip64ExtraId) {
+      for (auto* value : {&entry.uncompressed_size, &entry.compressed_size,
+                          &entry.local_header_offset}) {
+        if (*value != 0xffffffff) {
+          continue;
+        }
+        CF_EXPECT(field + 8 <= extra_pos + 4 + len,
+                  "Truncated ZIP64 field in " << entry.name);
+        *value = Read<uint64_t>(data, field);
+        field += 8;
+      }
+    }
+    extra_pos += 4 + len;
+  }
+  *pos = end;
+  return entry;
+}
+
+std::string Md5Hex(const uint8_t digest[MD5_DIGEST_LENGTH]) {
+  std::stringstream hex;
+  hex << std::hex;
+  for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+    hex << (digest[i] >> 4) << (digest[i] & 0xf);
+  }
+  return hex.str();
+}
+
+// A range of the rebuilt archive, copied from the base archive or downloaded.
+struct Segment {
+  uint64_t offset;
+  uint64_t length;
+  bool reused;
+  uint64_t base_offset;
+  const ZipEntry* entry;
+};
+
+// The members of the archive, by local header offset, with the length of
+// their records: local header, data and data descriptor.
+std::map<uint64_t, std::pair<const ZipEntry*, uint64_t>> Records(
+    const ZipDirectory& directory) {
+  std::map<uint64_t, std::pair<const ZipEntry*, uint64_t>> records;
+  for (const auto& entry : directory.entries) {
+    records[entry.local_header_offset] = {&entry, 0};
+  }
+  for (auto it = records.begin(); it != records.end(); it++) {
+    auto next = std::next(it);
+    auto end = next == records.end() ? directory.central_directory_offset
+                                     : next->first;
+    it->second.second = end - it->first;
+  }
+  return records;
+}
+
+bool SameContent(const ZipEntry& a, const ZipEntry& b) {
+  return a.crc32 == b.crc32 && a.compressed_size == b.compressed_size &&
+         a.uncompressed_size == b.uncompressed_size && a.method == b.method;
+}
+
+std::vector<Segment> PlanRebuild(const ZipDirectory& remote,
+                                 uint64_t remote_size,
+                                 const ZipDirectory& base) {
+  std::map<std::string, std::pair<const ZipEntry*, uint64_t>> base_records;
+  for (const auto& [offset, record] : Records(base)) {
+    base_records[record.first->name] = record;
+  }
+
+  std::vector<Segment> segments;
+  auto add_downloaded = [&segments](uint64_t offset, uint64_t length) {
+    if (length == 0) {
+      return;
+    }
+    if (!segments.empty() && !segments.back().reused) {
+      segments.back().length += length;
+    } else {
+      segments.push_back({offset, length, false, 0, nullptr});
+    }
+  };
+
+  uint64_t pos = 0;
+  for (const auto& [offset, record] : Records(remote)) {
+    add_downloaded(pos, offset - pos);
+    const auto& [entry, length] = record;
+    auto base_record = base_records.find(entry->name);
+    // Records of the same length with the same content only differ in the
+    // local header fields that are copied from the central directory.
+    if (base_record != base_records.end() &&
+        SameContent(*entry, *base_record->second.first) &&
+        base_record->second.second == length) {
+      segments.push_back({offset, length, true,
+                          base_record->second.first->local_header_offset,
+                          entry});
+    } else {
+      add_downloaded(offset, length);
+    }
+    pos = offset + length;
+  }
+  add_downloaded(pos, remote_size - pos);
+
+  // Downloads the small reused segments that split downloaded ones.
+  std::vector<Segment> merged;
+  for (size_t i = 0; i < segments.size(); i++) {
+    const auto& segment = segments[i];
+    bool between_downloads = i > 0 && i + 1 < segments.size() &&
+                             !segments[i - 1].reused &&
+                             !segments[i + 1].reused;
+    if (segment.reused &&
+        !(between_downloads && segment.length < kMinReusedLen)) {
+      merged.push_back(segment);
+      continue;
+    }
+    if (!merged.empty() && !merged.back().reused) {
+      merged.back().length += segment.length;
+    } else {
+      merged.push_back({segment.offset, segment.length, false, 0, nullptr});
+    }
+  }
+  return merged;
+}
+
+CurlResponse<std::string> RequestRange(CurlWrapper& curl,
+                                       const std::string& url,
+                                       uint64_t offset, uint64_t length) {
+  std::stringstream range;
+  range << "Range: bytes=" << offset << "-" << (offset + length - 1);
+  return curl.DownloadToString(url, {range.str()});
+}
+
+Result<std::string> RangeData(const std::string& url, uint64_t length,
+                              CurlResponse<std::string> response) {
+  // 200 means the server ignored the range and sent everything.
+  CF_EXPECT(response.http_code == 206,
+            "Range request for " << url << " answered with "
+                                 << response.http_code);
+  CF_EXPECT(response.data.size() == length,
+            "Range request for " << url << " returned "
+                                 << response.data.size() << " bytes, not "
+                                 << length);
+  return std::move(response.data);
+}
+
+}  // namespace
+
+Result<ZipDirectory> ReadZipDirectory(const RangeReader& reader,
+                                      uint64_t size) {
+  CF_EXPECT(size >= kEndOfCentralDirectoryLen, "Too short for a zip archive");
+  uint64_t tail_len = std::min<uint64_t>(
+      size, kEndOfCentralDirectoryLen + kZip64LocatorLen + kMaxCommentLen);
+  auto tail = CF_EXPECT(reader(size - tail_len, tail_len));
+  CF_EXPECT(tail.size() == tail_len, "Short read of the archive's tail");
+
+  // The comment may contain the signature too, so search from the end.
+  size_t eocd = tail_len - kEndOfCentralDirectoryLen;
+  while (Read<uint32_t>(tail, eocd) != kEndOfCentralDirectorySignature ||
+         eocd + kEndOfCentralDirectoryLen + Read<uint16_t>(tail, eocd + 20) !=
+             tail_len) {
+    CF_EXPECT(eocd > 0, "No end of central directory record");
+    eocd--;
+  }
+  uint64_t entries = Read<uint16_t>(tail, eocd + 10);
+  uint64_t directory_len = Read<uint32_t>(tail, eocd + 12);
+  uint64_t directory_offset = Read<uint32_t>(tail, eocd + 16);
+
+  if (eocd >= kZip64LocatorLen &&
+      Read<uint32_t>(tail, eocd - kZip64LocatorLen) ==
+          kZip64LocatorSignature) {
+    auto record_offset = Read<uint64_t>(tail, eocd - kZip64LocatorLen + 8);
+    auto record =
+        CF_EXPECT(reader(record_offset, kZip64EndOfCentralDirectoryLen));
+    CF_EXPECT(record.size() == kZip64EndOfCentralDirectoryLen &&
+                  Read<uint32_t>(record, 0) ==
+                      kZip64EndOfCentralDirectorySignature,
+              "Bad ZIP64 end of central directory record");
+    entries = Read<uint64_t>(record, 32);
+    directory_len = Read<uint64_t>(record, 40);
+    directory_offset = Read<uint64_t>(record, 48);
+  }
+  CF_EXPECT(directory_offset + directory_len <= size,
+            "Central directory past the end of the archive");
+
+  auto data = CF_EXPECT(reader(directory_offset, directory_len));
+  CF_EXPECT(data.size() == directory_len, "Short read of central directory");
+  ZipDirectory directory;
+  directory.central_directory_offset = directory_offset;
+  size_t pos = 0;
+  for (uint64_t i = 0; i < entries; i++) {
+    auto entry = CF_EXPECT(ParseCentralDirectoryHeader(data, &pos));
+    CF_EXPECT(entry.local_header_offset < directory_offset,
+              "Member " << entry.name << " past the central directory");
+    directory.entries.emplace_back(std::move(entry));
+  }
+  return directory;
+}
+
+RangeReader HttpRangeReader(CurlWrapper& curl, const std::string& url) {
+  return [&curl, url](uint64_t offset, uint64_t length) -> Result<std::string> {
+    if (length == 0) {
+      return std::string();
+    }
+    return CF_EXPECT(
+        RangeData(url, length, RequestRange(curl, url, offset, length)));
+  };
+}
+
+RefreshableUrl::RefreshableUrl(std::string url, Resolver resolve)
+    : url_(std::move(url)), resolve_(std::move(resolve)) {}
+
+std::string RefreshableUrl::Get() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return url_;
+}
+
+Result<std::string> RefreshableUrl::Refresh(const std::string& stale) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (url_ == stale) {
+    url_ = CF_EXPECT(resolve_(), "Could not resolve the URL again");
+  }
+  return url_;
+}
+
+RangeReader HttpRangeReader(CurlWrapper& curl,
+                            std::shared_ptr<RefreshableUrl> url) {
+  return [&curl, url](uint64_t offset, uint64_t length) -> Result<std::string> {
+    if (length == 0) {
+      return std::string();
+    }
+    auto current = url->Get();
+    auto response = RequestRange(curl, current, offset, length);
+    if (response.http_code == 401 || response.http_code == 403 ||
+        response.http_code == 404) {
+      LOG(INFO) << "Range request answered with " << response.http_code
+                << ", resolving the URL again";
+      current = CF_EXPECT(url->Refresh(current));
+      response = RequestRange(curl, current, offset, length);
+    }
+    return CF_EXPECT(RangeData(current, length, std::move(response)));
+  };
+}
+
+RangeReader FileRangeReader(const std::string& path) {
+  return [path](uint64_t offset, uint64_t length) -> Result<std::string> {
+    auto fd = SharedFD::Open(path, O_RDONLY);
+    CF_EXPECT(fd->IsOpen(), "Could not open " << path << ": " << fd->StrError());
+    CF_EXPECT(fd->LSeek(offset, SEEK_SET) == static_cast<off_t>(offset),
+              "Could not seek in " << path << ": " << fd->StrError());
+    std::string data(length, '\0');
+    CF_EXPECT(ReadExact(fd, &data) == static_cast<ssize_t>(length),
+              "Could not read " << path << ": " << fd->StrError());
+    return data;
+  };
+}
+
+Result<uint64_t> ZipMemberDataOffset(const RangeReader& reader,
+                                     const ZipEntry& entry) {
+  auto header = CF_EXPECT(reader(entry.local_header_offset, kLocalHeaderLen));
+  CF_EXPECT(header.size() == kLocalHeaderLen &&
+                Read<uint32_t>(header, 0) == kLocalHeaderSignature,
+            "Bad local header for " << entry.name);
+  // The local extra field may differ in length from the central one.
+  return entry.local_header_offset + kLocalHeaderLen +
+         Read<uint16_t>(header, 26) + Read<uint16_t>(header, 28);
+}
+
+Result<void> ExtractZipMember(const RangeReader& reader, const ZipEntry& entry,
+                              const std::string& path) {
+  CF_EXPECT(entry.method == kStored || entry.method == kDeflated,
+            "Unsupported compression method " << entry.method << " for "
+                                              << entry.name);
+  auto data_offset = CF_EXPECT(ZipMemberDataOffset(reader, entry));
+  auto out = SharedFD::Open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  CF_EXPECT(out->IsOpen(), "Could not open " << path << ": "
+                                             << out->StrError());
+  z_stream stream = {};
+  if (entry.method == kDeflated) {
+    CF_EXPECT(inflateInit2(&stream, -MAX_WBITS) == Z_OK,
+              "Could not initialize zlib");
+  }
+  auto extract = [&]() -> Result<void> {
+    uLong crc = crc32(0, nullptr, 0);
+    uint64_t written = 0;
+    auto write = [&](const char* data, size_t len) -> Result<void> {
+      CF_EXPECT(WriteAll(out, data, len) == static_cast<ssize_t>(len),
+                "Could not write " << path << ": " << out->StrError());
+      crc = crc32(crc, reinterpret_cast<const Bytef*>(data), len);
+      written += len;
+      return {};
+    };
+    std::vector<char> inflated(kCopyChunkLen);
+    for (uint64_t done = 0; done < entry.compressed_size;) {
+      uint64_t len = std::min(kMaxRequestLen, entry.compressed_size - done);
+      auto chunk = CF_EXPECT(reader(data_offset + done, len));
+      done += len;
+      if (entry.method == kStored) {
+        CF_EXPECT(write(chunk.data(), chunk.size()));
+        continue;
+      }
+      stream.next_in = reinterpret_cast<Bytef*>(chunk.data());
+      stream.avail_in = chunk.size();
+      while (stream.avail_in > 0) {
+        stream.next_out = reinterpret_cast<Bytef*>(inflated.data());
+        stream.avail_out = inflated.size();
+        auto ret = inflate(&stream, Z_NO_FLUSH);
+        CF_EXPECT(ret == Z_OK || ret == Z_STREAM_END,
+                  "Could not inflate " << entry.name << ": " << ret);
+        CF_EXPECT(write(inflated.data(), inflated.size() - stream.avail_out));
+        if (ret == Z_STREAM_END) {
+          break;
+        }
+      }
+    }
+    CF_EXPECT(written == entry.uncompressed_size,
+              "Extracted " << written << " bytes of " << entry.name
+                           << " instead of " << entry.uncompressed_size);
+    CF_EXPECT(crc == entry.crc32, "Bad checksum for " << entry.name);
+    return {};
+  };
+  auto result = extract();
+  if (entry.method == kDeflated) {
+    inflateEnd(&stream);
+  }
+  if (!result.ok()) {
+    out->Close();
+    unlink(path.c_str());
+  }
+  CF_EXPECT(std::move(result));
+  return {};
+}
+
+Result<ZipDeltaStats> RebuildZipFromBase(const std::string& base,
+                                         const RangeReader& remote,
+                                         uint64_t remote_size,
+                                         const std::string& expected_md5,
+                                         const std::string& path) {
+  CF_EXPECT(!expected_md5.empty(), "No hash to verify the archive against");
+  auto base_reader = FileRangeReader(base);
+  auto base_size = FileSize(base);
+  auto base_directory = CF_EXPECT(ReadZipDirectory(base_reader, base_size),
+                                  "Could not read " << base);
+  auto remote_directory = CF_EXPECT(ReadZipDirectory(remote, remote_size));
+  auto segments = PlanRebuild(remote_directory, remote_size, base_directory);
+
+  auto out = SharedFD::Open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  CF_EXPECT(out->IsOpen(), "Could not open " << path << ": "
+                                             << out->StrError());
+  MD5_CTX md5;
+  MD5_Init(&md5);
+  ZipDeltaStats stats;
+  auto write = [&out, &md5, &path](const std::string& data) -> Result<void> {
+    CF_EXPECT(WriteAll(out, data) == static_cast<ssize_t>(data.size()),
+              "Could not write " << path << ": " << out->StrError());
+    MD5_Update(&md5, data.data(), data.size());
+    return {};
+  };
+  auto rebuild = [&]() -> Result<void> {
+    for (const auto& segment : segments) {
+      uint64_t chunk_len = segment.reused ? kCopyChunkLen : kMaxRequestLen;
+      for (uint64_t done = 0; done < segment.length; done += chunk_len) {
+        uint64_t len = std::min(chunk_len, segment.length - done);
+        if (!segment.reused) {
+          CF_EXPECT(write(CF_EXPECT(remote(segment.offset + done, len))));
+          continue;
+        }
+        auto data = CF_EXPECT(base_reader(segment.base_offset + done, len));
+        if (done == 0) {
+          CF_EXPECT(data.size() >= kLocalHeaderLen &&
+                        Read<uint32_t>(data, 0) == kLocalHeaderSignature,
+                    "Bad local header for " << segment.entry->name << " in "
+                                            << base);
+          // Version needed, flags, method, time and date
+          const auto& entry = *segment.entry;
+          memcpy(&data[4], &entry.version_needed, 2);
+          memcpy(&data[6], &entry.flags, 2);
+          memcpy(&data[8], &entry.method, 2);
+          memcpy(&data[10], &entry.time, 2);
+          memcpy(&data[12], &entry.date, 2);
+        }
+        CF_EXPECT(write(data));
+      }
+      if (segment.reused) {
+        stats.reused_bytes += segment.length;
+        stats.reused_entries++;
+      } else {
+        stats.downloaded_bytes += segment.length;
+      }
+    }
+    uint8_t digest[MD5_DIGEST_LENGTH];
+    MD5_Final(digest, &md5);
+    auto md5_hex = Md5Hex(digest);
+    CF_EXPECT(android::base::EqualsIgnoreCase(md5_hex, expected_md5),
+              "Rebuilt archive hashes to " << md5_hex << " instead of "
+                                           << expected_md5);
+    return {};
+  };
+  auto result = rebuild();
+  if (!result.ok()) {
+    out->Close();
+    unlink(path.c_str());
+  }
+  CF_EXPECT(std::move(result));
+  stats.downloaded_entries =
+      remote_directory.entries.size() - stats.reused_entries;
+  return stats;
+}
+
+}  // namespace cuttlefish
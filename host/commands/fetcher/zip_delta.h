@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+#include "host/libs/web/curl_wrapper.h"
+
+namespace cuttlefish {
+
+// A member of a zip archive, as recorded in its central directory.
+struct ZipEntry {
+  std::string name;
+  uint16_t version_needed = 0;
+  uint16_t flags = 0;
+  uint16_t method = 0;
+  uint16_t time = 0;
+  uint16_t date = 0;
+  uint32_t crc32 = 0;
+  uint64_t compressed_size = 0;
+  uint64_t uncompressed_size = 0;
+  uint64_t local_header_offset = 0;
+};
+
+struct ZipDirectory {
+  std::vector<ZipEntry> entries;
+  // Where the central directory starts, which is where the members end.
+  uint64_t central_directory_offset = 0;
+};
+
+// Reads |length| bytes at |offset| of an archive.
+using RangeReader =
+    std::function<Result<std::string>(uint64_t offset, uint64_t length)>;
+
+// Reads the central directory of the |size| bytes long archive, ZIP64
+// included, without reading any of its members.
+Result<ZipDirectory> ReadZipDirectory(const RangeReader& reader,
+                                      uint64_t size);
+
+// Reads ranges of |url| with HTTP range requests. Fails on servers that
+// answer with the whole file instead.
+RangeReader HttpRangeReader(CurlWrapper& curl, const std::string& url);
+
+/**
+ * A URL that stops working after a while, like the signed URLs the build API
+ * hands out for artifacts, and is resolved again when a server rejects it.
+ * Shared by the readers of one archive, so it is resolved once for all.
+ */
+class RefreshableUrl {
+ public:
+  using Resolver = std::function<Result<std::string>()>;
+
+  RefreshableUrl(std::string url, Resolver resolve);
+
+  std::string Get() const;
+  // Replaces |stale| with a newly resolved URL, unless another reader already
+  // did, and returns the current one.
+  Result<std::string> Refresh(const std::string& stale);
+
+ private:
+  mutable std::mutex mutex_;
+  std::string url_;
+  Resolver resolve_;
+};
+
+// Like the above, resolving |url| again and retrying once when the server
+// answers 401, 403 or 404.
+RangeReader HttpRangeReader(CurlWrapper& curl,
+                            std::shared_ptr<RefreshableUrl> url);
+
+RangeReader FileRangeReader(const std::string& path);
+
+// Where the data of |entry| starts, past its local header.
+Result<uint64_t> ZipMemberDataOffset(const RangeReader& reader,
+                                     const ZipEntry& entry);
+
+// Extracts |entry|, stored or deflated, to |path| reading only its record.
+Result<void> ExtractZipMember(const RangeReader& reader, const ZipEntry& entry,
+                              const std::string& path);
+
+struct ZipDeltaStats {
+  uint64_t reused_bytes = 0;
+  uint64_t downloaded_bytes = 0;
+  size_t reused_entries = 0;
+  size_t downloaded_entries = 0;
+};
+
+/**
+ * Rebuilds the |remote_size| bytes long archive |remote| at |path| from
+ * |base|, a local archive of a nearby build. Members |base| has the same
+ * content of are copied from it and only the rest is downloaded, so images
+ * unchanged between the builds cost no transfer.
+ *
+ * The archive is rebuilt byte for byte and fails verification, leaving
+ * nothing at |path|, unless it hashes to |expected_md5|.
+ */
+Result<ZipDeltaStats> RebuildZipFromBase(const std::string& base,
+                                         const RangeReader& remote,
+                                         uint64_t remote_size,
+                                         const std::string& expected_md5,
+                                         const std::string& path);
+
+}  // namespace cuttlefish
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+#include "host/commands/fetcher/fetcher_test_utils.h"
+#include "host/commands/fetcher/image_cache.h"
+#include "host/commands/fetcher/zip_delta.h"
+#include "host/libs/web/curl_wrapper.h"
+
+namespace cuttlefish {
+namespace {
+
+class ZipDeltaTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    char dir[] = "/tmp/zip_delta_test_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    dir_ = dir;
+    curl_ = CurlWrapper::Create();
+
+    // Two unchanged images, one with a new timestamp, a changed one and a
+    // new one.
+    auto system = RandomData(1 << 20, 1);
+    auto vendor = RandomData(1 << 20, 2);
+    auto product = RandomData(512 << 10, 3);
+    base_ = MakeZip({{"system.img", system},
+                     {"vendor.img", vendor},
+                     {"product.img", product},
+                     {"android-info.txt", "board=cutf"}});
+    target_ = MakeZip({{"system.img", system},
+                       {"vendor.img", RandomData(1 << 20, 4)},
+                       {"product.img", product, 42},
+                       {"android-info.txt", "board=cutf"},
+                       {"odm.img", RandomData(64 << 10, 5)}});
+    WriteFile(dir_ + "/base.zip", base_);
+  }
+
+  void TearDown() override { RecursivelyRemoveDirectory(dir_); }
+
+  std::string dir_;
+  std::unique_ptr<CurlWrapper> curl_;
+  std::string base_;
+  std::string target_;
+};
+
+TEST_F(ZipDeltaTest, ReadsTheCentralDirectory) {
+  auto directory =
+      ReadZipDirectory(FileRangeReader(dir_ + "/base.zip"), base_.size());
+  ASSERT_TRUE(directory.ok()) << directory.error();
+  ASSERT_EQ(directory->entries.size(), 4);
+  ASSERT_EQ(directory->entries[1].name, "vendor.img");
+  ASSERT_EQ(directory->entries[1].uncompressed_size, 1 << 20);
+  ASSERT_EQ(directory->entries[3].crc32, Crc32("board=cutf"));
+}
+
+TEST_F(ZipDeltaTest, DownloadsOnlyChangedMembers) {
+  HttpStandIn server(target_);
+  auto path = dir_ + "/target.zip";
+  auto stats =
+      RebuildZipFromBase(dir_ + "/base.zip", HttpRangeReader(*curl_, server.Url()),
+                         target_.size(), Md5(target_), path);
+  ASSERT_TRUE(stats.ok()) << stats.error();
+  ASSERT_EQ(ReadWholeFile(path), target_);
+  // system.img, product.img and android-info.txt
+  ASSERT_EQ(stats->reused_entries, 3);
+  // Reading the central directory takes up to 64KiB more.
+  ASSERT_GE(stats->reused_bytes, 3 << 19);
+  ASSERT_LT(server.BytesServed(), target_.size() - (1 << 20));
+  ASSERT_EQ(stats->reused_bytes + stats->downloaded_bytes, target_.size());
+}
+
+TEST_F(ZipDeltaTest, FailsVerification) {
+  HttpStandIn server(target_);
+  auto path = dir_ + "/target.zip";
+  auto stats =
+      RebuildZipFromBase(dir_ + "/base.zip", HttpRangeReader(*curl_, server.Url()),
+                         target_.size(), Md5(base_), path);
+  ASSERT_FALSE(stats.ok());
+  ASSERT_FALSE(FileExists(path));
+}
+
+TEST_F(ZipDeltaTest, FailsWithoutRangeRequests) {
+  HttpStandIn server(target_, /* ranges */ false);
+  auto stats = RebuildZipFromBase(
+      dir_ + "/base.zip", HttpRangeReader(*curl_, server.Url()),
+      target_.size(), Md5(target_), dir_ + "/target.zip");
+  ASSERT_FALSE(stats.ok());
+}
+
+TEST_F(ZipDeltaTest, ResolvesExpiredUrlsAgain) {
+  HttpStandIn server(target_);
+  server.OnlyServe("fresh.zip");
+  int resolved = 0;
+  auto url = std::make_shared<RefreshableUrl>(
+      server.Url("expired.zip"), [&server, &resolved]() -> Result<std::string> {
+        resolved++;
+        return server.Url("fresh.zip");
+      });
+  auto reader = HttpRangeReader(*curl_, url);
+  auto data = reader(10, 100);
+  ASSERT_TRUE(data.ok()) << data.error();
+  ASSERT_EQ(*data, target_.substr(10, 100));
+  data = reader(200, 100);
+  ASSERT_TRUE(data.ok()) << data.error();
+  ASSERT_EQ(resolved, 1);
+  ASSERT_EQ(url->Get(), server.Url("fresh.zip"));
+
+  // A URL that is rejected again fails the read.
+  server.OnlyServe("fresher.zip");
+  ASSERT_FALSE(reader(10, 100).ok());
+  ASSERT_EQ(resolved, 2);
+}
+
+TEST_F(ZipDeltaTest, CachesRecentBuilds) {
+  ImageCache cache(dir_ + "/cache", 2, *curl_);
+  DeviceBuild build("100", "aosp_cf_x86_64_phone-userdebug");
+  ASSERT_EQ(cache.FindBase(build, "img"), "");
+
+  auto zip = dir_ + "/base.zip";
+  for (auto id : {"100", "101", "102"}) {
+    DeviceBuild cached(id, build.target);
+    auto added =
+        cache.Add(cached, std::string("aosp_cf_x86_64_phone-img-") + id + ".zip",
+                  zip);
+    ASSERT_TRUE(added.ok()) << added.error();
+    // Modification times only have a second of resolution.
+    sleep(1);
+  }
+  auto target_dir = dir_ + "/cache/" + build.target;
+  ASSERT_FALSE(DirectoryExists(target_dir + "/100"));
+  ASSERT_EQ(cache.FindBase(build, "img"),
+            target_dir + "/102/aosp_cf_x86_64_phone-img-102.zip");
+  ASSERT_EQ(cache.FindBase(build, "target_files"), "");
+}
+
+TEST(ZipMemberTest, ExtractsStoredAndDeflatedMembers) {
+  TemporaryDir dir;
+  auto text = std::string(100000, 'a') + "board=cutf";
+  auto random = RandomData(300000, 3);
+  auto zip = MakeZip({{"text", text, 0, true}, {"random", random}});
+  auto reader = [&zip](uint64_t offset, uint64_t length) -> Result<std::string> {
+    return zip.substr(offset, length);
+  };
+  auto directory = ReadZipDirectory(reader, zip.size());
+  ASSERT_TRUE(directory.ok()) << directory.error();
+  ASSERT_LT(directory->entries[0].compressed_size, text.size());
+  for (const auto& entry : directory->entries) {
+    auto path = std::string(dir.path) + "/" + entry.name;
+    auto extracted = ExtractZipMember(reader, entry, path);
+    ASSERT_TRUE(extracted.ok()) << extracted.error();
+  }
+  ASSERT_EQ(ReadWholeFile(std::string(dir.path) + "/text"), text);
+  ASSERT_EQ(ReadWholeFile(std::string(dir.path) + "/random"), random);
+}
+
+}  // namespace
+}  // namespace cuttlefish
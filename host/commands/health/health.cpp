@@ -20,6 +20,8 @@
 #include <android-base/logging.h>
 #include <gflags/gflags.h>
 //
+#include "common/libs/utils/result.h"
+#include "host/commands/device_control/device_update.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/vm_manager/vm_manager.h"
 
@@ -78,6 +80,29 @@ int usage() {
   return 1;
 }
 
+namespace cuttlefish {
+namespace {
+
+// Goes through the device control service of run_cvd, which keeps a
+// connection to crosvm, instead of starting a crosvm client.
+Result<void> SetThroughDeviceControl(DeviceControlClient& client,
+                                     const std::string& key,
+                                     const std::string& value) {
+  DeviceUpdate update;
+  update.type = DeviceUpdate::Type::kBattery;
+  update.key = key;
+  update.value = value;
+  CF_EXPECT(client.Send(update));
+  CF_EXPECT(client.FinishSending());
+  auto result = CF_EXPECT(client.ReadResult());
+  CF_EXPECT(result.has_value(), "No answer from the device control service");
+  CF_EXPECT(result->error.empty(), result->error);
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
 int main(int argc, char** argv) {
   ::android::base::InitLogging(argv, android::base::StderrLogger);
   gflags::SetUsageMessage(USAGE_MESSAGE);
@@ -114,6 +139,20 @@ int main(int argc, char** argv) {
     }
   }
 
+  // The socket file outlives a run_cvd that didn't exit cleanly, or may
+  // belong to one without the service, so only a connection tells.
+  auto client =
+      cuttlefish::DeviceControlClient::Connect(config->ForDefaultInstance());
+  if (client.ok()) {
+    auto result = cuttlefish::SetThroughDeviceControl(*client, key, value);
+    if (!result.ok()) {
+      LOG(ERROR) << "goldfish battery update failed: " << result.error();
+      return 1;
+    }
+    return 0;
+  }
+  LOG(DEBUG) << "Falling back to the crosvm client: " << client.error();
+
   cuttlefish::Command command(config->crosvm_binary());
   command.AddParameter("battery");
   command.AddParameter("goldfish");
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include "host/commands/host_daemons/services.h"
+
+namespace cuttlefish {
+namespace {
+
+/**
+ * Forwards the serial console to a pseudo-terminal, like console_forwarder.
+ * The console's output is read as soon as it is available so the VMM never
+ * blocks on it, and every write happens on the shared thread pool: the kernel
+ * log pipe in particular is drained by another service of the same loop.
+ */
+class Console : public HostService {
+ public:
+  Console(std::string console_path, SharedFD console_in, SharedFD console_out,
+          std::string console_log_path, std::string kernel_log_pipe_path,
+          ThreadPool& pool)
+      : console_path_(std::move(console_path)),
+        console_in_(console_in),
+        console_out_(console_out),
+        console_log_path_(std::move(console_log_path)),
+        kernel_log_pipe_path_(std::move(kernel_log_pipe_path)),
+        writes_(pool) {}
+
+  ~Console() { writes_.Drain(); }
+
+  std::string Name() const override { return "console_forwarder"; }
+
+  Result<void> Start() override {
+    // Writes still queued hold on to the file descriptors being replaced.
+    console_log_ =
+        SharedFD::Open(console_log_path_, O_CREAT | O_APPEND | O_WRONLY, 0666);
+    CF_EXPECT(console_log_->IsOpen(),
+              "Could not open " << console_log_path_ << ": "
+                                << console_log_->StrError());
+    kernel_log_ = SharedFD::Open(kernel_log_pipe_path_, O_APPEND | O_WRONLY);
+    CF_EXPECT(kernel_log_->IsOpen(), "Could not open "
+                                         << kernel_log_pipe_path_ << ": "
+                                         << kernel_log_->StrError());
+    client_ = CF_EXPECT(OpenPty());
+    return {};
+  }
+
+  void BeforeSelect(SharedFDSet* read_set) const override {
+    read_set->Set(console_out_);
+    read_set->Set(client_);
+  }
+
+  Result<void> AfterSelect(const SharedFDSet& read_set) override {
+    if (read_set.IsSet(console_out_)) {
+      auto buffer = std::make_shared<std::vector<char>>(4096);
+      auto bytes_read = console_out_->Read(buffer->data(), buffer->size());
+      CF_EXPECT(bytes_read > 0, "Error reading from console output: "
+                                    << console_out_->StrError());
+      buffer->resize(bytes_read);
+      Write(buffer, console_log_);
+      Write(buffer, client_);
+      Write(buffer, kernel_log_);
+    }
+    if (read_set.IsSet(client_)) {
+      auto buffer = std::make_shared<std::vector<char>>(4096);
+      auto bytes_read = client_->Read(buffer->data(), buffer->size());
+      if (bytes_read <= 0) {
+        // Usually the PTY controller went away, e.g. screen was closed. It
+        // gets a new PTY. The old one is closed once no queued write uses it.
+        LOG(DEBUG) << "Error reading from client fd: " << client_->StrError();
+        client_ = CF_EXPECT(OpenPty());
+      } else {
+        buffer->resize(bytes_read);
+        Write(buffer, console_in_);
+      }
+    }
+    return {};
+  }
+
+ private:
+  void Write(std::shared_ptr<std::vector<char>> buffer, SharedFD fd) {
+    writes_.Post([buffer, fd]() {
+      std::size_t written = 0;
+      while (written < buffer->size()) {
+        auto bytes = fd->Write(buffer->data() + written,
+                               buffer->size() - written);
+        if (bytes < 0) {
+          // Writes to the PTY fail while nothing is connected to it.
+          if (fd->GetErrno() != EAGAIN) {
+            LOG(ERROR) << "Error writing to fd: " << fd->StrError();
+          }
+          return;
+        }
+        written += bytes;
+      }
+    });
+  }
+
+  Result<SharedFD> OpenPty() {
+    // Remove any stale symlink to a pts device
+    auto ret = unlink(console_path_.c_str());
+    CF_EXPECT(!(ret < 0 && errno != ENOENT),
+              "Failed to unlink " << console_path_ << ": " << strerror(errno));
+
+    android::base::unique_fd pty(
+        posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK));
+    CF_EXPECT(pty.get() >= 0, "Failed to open a PTY: " << strerror(errno));
+    grantpt(pty.get());
+    unlockpt(pty.get());
+
+    // Disable all echo modes on the PTY
+    struct termios termios;
+    CF_EXPECT(tcgetattr(pty.get(), &termios) >= 0,
+              "Failed to get terminal control: " << strerror(errno));
+    termios.c_lflag &= ~(ECHO | ECHOE | ECHOK | ECHONL);
+    termios.c_oflag &= ~(ONLCR);
+    CF_EXPECT(tcsetattr(pty.get(), TCSANOW, &termios) >= 0,
+              "Failed to set terminal control: " << strerror(errno));
+
+    auto pty_dev_name = ptsname(pty.get());
+    CF_EXPECT(pty_dev_name != nullptr,
+              "Failed to obtain PTY device name: " << strerror(errno));
+    CF_EXPECT(symlink(pty_dev_name, console_path_.c_str()) >= 0,
+              "Failed to create symlink to " << pty_dev_name << " at "
+                                             << console_path_ << ": "
+                                             << strerror(errno));
+
+    auto pty_shared_fd = SharedFD::Dup(pty.get());
+    CF_EXPECT(pty_shared_fd->IsOpen(),
+              "Error dupping the PTY: " << pty_shared_fd->StrError());
+    return pty_shared_fd;
+  }
+
+  std::string console_path_;
+  SharedFD console_in_;
+  SharedFD console_out_;
+  std::string console_log_path_;
+  std::string kernel_log_pipe_path_;
+  SharedFD console_log_;
+  SharedFD kernel_log_;
+  SharedFD client_;
+  // Ordered like the single writer thread of console_forwarder.
+  Strand writes_;
+};
+
+}  // namespace
+
+std::unique_ptr<HostService> ConsoleService(std::string console_path,
+                                            SharedFD console_in,
+                                            SharedFD console_out,
+                                            std::string console_log_path,
+                                            std::string kernel_log_pipe_path,
+                                            ThreadPool& pool) {
+  return std::make_unique<Console>(
+      std::move(console_path), console_in, console_out,
+      std::move(console_log_path), std::move(kernel_log_pipe_path), pool);
+}
+
+}  // namespace cuttlefish
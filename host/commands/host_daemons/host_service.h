@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include "common/libs/fs/shared_select.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+/**
+ * A host daemon run as a component of host_daemons. All services share one
+ * select loop, so they must not block in AfterSelect: slow work, like writes
+ * that depend on another service making progress, goes to the shared thread
+ * pool instead.
+ */
+class HostService {
+ public:
+  virtual ~HostService() = default;
+
+  virtual std::string Name() const = 0;
+
+  // Called before the service is first polled, and again before it is polled
+  // after a restart.
+  virtual Result<void> Start() = 0;
+
+  // Adds the file descriptors the service waits on.
+  virtual void BeforeSelect(SharedFDSet* read_set) const = 0;
+
+  // Handles the ready file descriptors. An error stops the service, which is
+  // then restarted or not according to its RestartPolicy.
+  virtual Result<void> AfterSelect(const SharedFDSet& read_set) = 0;
+};
+
+// What to do when a service fails. Restarts back off exponentially, so that
+// a service failing right away doesn't take the loop from the others.
+struct RestartPolicy {
+  bool restart = true;
+  std::chrono::milliseconds initial_backoff{100};
+  std::chrono::milliseconds max_backoff{10000};
+};
+
+}  // namespace cuttlefish
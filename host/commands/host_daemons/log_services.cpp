@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "host/commands/host_daemons/services.h"
+#include "host/commands/kernel_log_monitor/kernel_log_server.h"
+#include "host/commands/kernel_log_monitor/utils.h"
+
+namespace cuttlefish {
+namespace {
+
+class KernelLog : public HostService {
+ public:
+  KernelLog(SharedFD pipe, std::string log_path, bool deprecated_boot_completed,
+            std::vector<SharedFD> subscribers)
+      : pipe_(pipe),
+        log_path_(std::move(log_path)),
+        deprecated_boot_completed_(deprecated_boot_completed),
+        subscribers_(std::move(subscribers)) {}
+
+  std::string Name() const override { return "kernel_log_monitor"; }
+
+  Result<void> Start() override {
+    server_.emplace(pipe_, log_path_, deprecated_boot_completed_);
+    for (auto subscriber : subscribers_) {
+      if (!subscriber->IsOpen()) {
+        // Gone before a restart.
+        continue;
+      }
+      server_->SubscribeToEvents([subscriber](Json::Value message) {
+        if (!monitor::WriteEvent(subscriber, message)) {
+          if (subscriber->GetErrno() != EPIPE) {
+            LOG(ERROR) << "Error while writing to pipe: "
+                       << subscriber->StrError();
+          }
+          subscriber->Close();
+          return monitor::SubscriptionAction::CancelSubscription;
+        }
+        return monitor::SubscriptionAction::ContinueSubscription;
+      });
+    }
+    return {};
+  }
+
+  void BeforeSelect(SharedFDSet* read_set) const override {
+    server_->BeforeSelect(read_set);
+  }
+
+  Result<void> AfterSelect(const SharedFDSet& read_set) override {
+    server_->AfterSelect(read_set);
+    return {};
+  }
+
+ private:
+  SharedFD pipe_;
+  std::string log_path_;
+  bool deprecated_boot_completed_;
+  std::vector<SharedFD> subscribers_;
+  std::optional<monitor::KernelLogServer> server_;
+};
+
+class Logcat : public HostService {
+ public:
+  Logcat(SharedFD pipe, std::string log_path)
+      : pipe_(pipe), log_path_(std::move(log_path)) {}
+
+  std::string Name() const override { return "logcat_receiver"; }
+
+  Result<void> Start() override {
+    log_ = SharedFD::Open(log_path_, O_CREAT | O_APPEND | O_WRONLY, 0666);
+    CF_EXPECT(log_->IsOpen(),
+              "Could not open " << log_path_ << ": " << log_->StrError());
+    return {};
+  }
+
+  void BeforeSelect(SharedFDSet* read_set) const override {
+    read_set->Set(pipe_);
+  }
+
+  Result<void> AfterSelect(const SharedFDSet& read_set) override {
+    if (!read_set.IsSet(pipe_)) {
+      return {};
+    }
+    char buffer[4096];
+    auto bytes_read = pipe_->Read(buffer, sizeof(buffer));
+    CF_EXPECT(bytes_read >= 0, "Could not read logcat: " << pipe_->StrError());
+    CF_EXPECT(WriteAll(log_, buffer, bytes_read) == bytes_read,
+              "Error writing to log file: " << log_->StrError());
+    return {};
+  }
+
+ private:
+  SharedFD pipe_;
+  std::string log_path_;
+  SharedFD log_;
+};
+
+}  // namespace
+
+std::unique_ptr<HostService> KernelLogService(
+    SharedFD pipe, std::string log_path, bool deprecated_boot_completed,
+    std::vector<SharedFD> subscribers) {
+  return std::make_unique<KernelLog>(pipe, std::move(log_path),
+                                     deprecated_boot_completed,
+                                     std::move(subscribers));
+}
+
+std::unique_ptr<HostService> LogcatService(SharedFD pipe,
+                                           std::string log_path) {
+  return std::make_unique<Logcat>(pipe, std::move(log_path));
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/host_daemons/service_host.h"
+#include "host/commands/host_daemons/services.h"
+#include "host/commands/host_daemons/thread_pool.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/logging.h"
+
+DEFINE_int32(kernel_log_pipe_fd, -1,
+             "Pipe with the guest's kernel log. Runs the kernel_log_monitor "
+             "service if given.");
+DEFINE_string(kernel_log_subscriber_fds, "",
+              "A comma separated list of file descriptors to send kernel log "
+              "events to.");
+DEFINE_int32(logcat_pipe_fd, -1,
+             "Pipe with the guest's logcat. Runs the logcat_receiver service "
+             "if given.");
+DEFINE_int32(tombstone_server_fd, -1,
+             "Vsock server for tombstones. Runs the tombstone_receiver service "
+             "if given.");
+DEFINE_string(tombstone_dir, "", "Directory to write tombstones in.");
+DEFINE_int32(config_server_fd, -1,
+             "Vsock server for the device configuration. Runs the "
+             "config_server service if given.");
+DEFINE_int32(console_in_fd, -1,
+             "The console's input channel. Runs the console_forwarder service "
+             "together with --console_out_fd.");
+DEFINE_int32(console_out_fd, -1, "The console's output channel.");
+DEFINE_int32(worker_threads, 2,
+             "Threads of the pool the services hand blocking writes to.");
+
+namespace cuttlefish {
+namespace {
+
+Result<SharedFD> InheritFd(int fd, const std::string& flag) {
+  auto shared_fd = SharedFD::Dup(fd);
+  CF_EXPECT(shared_fd->IsOpen(),
+            "Error dupping --" << flag << "=" << fd << ": "
+                               << shared_fd->StrError());
+  close(fd);
+  return shared_fd;
+}
+
+Result<std::vector<SharedFD>> InheritFds(const std::string& fd_list,
+                                         const std::string& flag) {
+  std::vector<SharedFD> fds;
+  if (fd_list.empty()) {
+    return fds;
+  }
+  for (const auto& fd_str : android::base::Split(fd_list, ",")) {
+    int fd = -1;
+    CF_EXPECT(android::base::ParseInt(fd_str, &fd, 0),
+              "Invalid file descriptor list --" << flag << "=" << fd_list);
+    fds.emplace_back(CF_EXPECT(InheritFd(fd, flag)));
+  }
+  return fds;
+}
+
+Result<void> HostDaemonsMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  // Clients going away must not take every service down with them.
+  signal(SIGPIPE, SIG_IGN);
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get(), "Failed to obtain config");
+  auto instance = config->ForDefaultInstance();
+
+  // Destroyed after the services, which may have writes queued on it.
+  ThreadPool pool(FLAGS_worker_threads);
+  ServiceHost host;
+  // Restarting reopens the logs and servers from the same file descriptors,
+  // which run_cvd keeps open, so every service can start over.
+  RestartPolicy policy;
+
+  if (FLAGS_kernel_log_pipe_fd >= 0) {
+    auto pipe =
+        CF_EXPECT(InheritFd(FLAGS_kernel_log_pipe_fd, "kernel_log_pipe_fd"));
+    auto subscribers = CF_EXPECT(InheritFds(FLAGS_kernel_log_subscriber_fds,
+                                            "kernel_log_subscriber_fds"));
+    host.AddService(
+        KernelLogService(pipe, instance.PerInstanceLogPath("kernel.log"),
+                         config->deprecated_boot_completed(), subscribers),
+        policy);
+  }
+  if (FLAGS_logcat_pipe_fd >= 0) {
+    auto pipe = CF_EXPECT(InheritFd(FLAGS_logcat_pipe_fd, "logcat_pipe_fd"));
+    host.AddService(LogcatService(pipe, instance.logcat_path()), policy);
+  }
+  if (FLAGS_tombstone_server_fd >= 0) {
+    CF_EXPECT(!FLAGS_tombstone_dir.empty(), "--tombstone_dir is required");
+    auto server =
+        CF_EXPECT(InheritFd(FLAGS_tombstone_server_fd, "tombstone_server_fd"));
+    host.AddService(TombstoneService(server, FLAGS_tombstone_dir), policy);
+  }
+  if (FLAGS_config_server_fd >= 0) {
+    auto server =
+        CF_EXPECT(InheritFd(FLAGS_config_server_fd, "config_server_fd"));
+    host.AddService(ConfigService(server), policy);
+  }
+  if (FLAGS_console_in_fd >= 0 || FLAGS_console_out_fd >= 0) {
+    auto console_in =
+        CF_EXPECT(InheritFd(FLAGS_console_in_fd, "console_in_fd"));
+    auto console_out =
+        CF_EXPECT(InheritFd(FLAGS_console_out_fd, "console_out_fd"));
+    // Console failures, like running out of PTYs, tend to last, so it retries
+    // less often than the others.
+    RestartPolicy console_policy;
+    console_policy.max_backoff = std::chrono::minutes(1);
+    host.AddService(
+        ConsoleService(instance.console_path(), console_in, console_out,
+                       instance.PerInstancePath("console_log"),
+                       instance.kernel_log_pipe_name(), pool),
+        console_policy);
+  }
+
+  CF_EXPECT(host.Run());
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::HostDaemonsMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
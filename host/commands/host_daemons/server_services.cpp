@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <android-base/logging.h>
+
+#include "common/libs/device_config/device_config.h"
+#include "common/libs/fs/shared_buf.h"
+#include "host/commands/host_daemons/services.h"
+
+namespace cuttlefish {
+namespace {
+
+// Receives a tombstone per connection, until the guest closes it.
+class Tombstone : public HostService {
+ public:
+  Tombstone(SharedFD server, std::string tombstone_dir)
+      : server_(server), tombstone_dir_(std::move(tombstone_dir)) {}
+
+  std::string Name() const override { return "tombstone_receiver"; }
+
+  Result<void> Start() override {
+    // Tombstones cut short by the restart are kept as received so far.
+    connections_.clear();
+    return {};
+  }
+
+  void BeforeSelect(SharedFDSet* read_set) const override {
+    read_set->Set(server_);
+    for (const auto& [connection, file] : connections_) {
+      read_set->Set(connection);
+    }
+  }
+
+  Result<void> AfterSelect(const SharedFDSet& read_set) override {
+    for (auto it = connections_.begin(); it != connections_.end();) {
+      auto& [connection, file] = *it;
+      if (!read_set.IsSet(connection)) {
+        it++;
+        continue;
+      }
+      char buffer[4096];
+      auto bytes_read = connection->Read(buffer, sizeof(buffer));
+      if (bytes_read <= 0) {
+        it = connections_.erase(it);
+        continue;
+      }
+      if (WriteAll(file, buffer, bytes_read) != bytes_read) {
+        LOG(ERROR) << "Failed to write a tombstone: " << file->StrError();
+        it = connections_.erase(it);
+        continue;
+      }
+      it++;
+    }
+    if (read_set.IsSet(server_)) {
+      auto connection = SharedFD::Accept(*server_);
+      CF_EXPECT(connection->IsOpen(),
+                "Failed to accept a tombstone: " << connection->StrError());
+      auto path = NextTombstonePath();
+      auto file = SharedFD::Open(path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+      if (file->IsOpen()) {
+        connections_[connection] = file;
+      } else {
+        LOG(ERROR) << "Could not create " << path << ": " << file->StrError();
+      }
+    }
+    return {};
+  }
+
+ private:
+  std::string NextTombstonePath() {
+    auto now = std::chrono::system_clock::to_time_t(
+        std::chrono::system_clock::now());
+    std::stringstream path;
+    path << tombstone_dir_ << "/tombstone_"
+         << std::put_time(std::gmtime(&now), "%Y-%m-%d-%H%M%S");
+    // Gives tombstones of the same second unique names.
+    if (path.str() == last_path_) {
+      return path.str() + "_" + std::to_string(++same_second_);
+    }
+    last_path_ = path.str();
+    same_second_ = 0;
+    return last_path_;
+  }
+
+  SharedFD server_;
+  std::string tombstone_dir_;
+  // Tombstones being received, by connection.
+  std::map<SharedFD, SharedFD> connections_;
+  std::string last_path_;
+  int same_second_ = 0;
+};
+
+// Sends the device configuration to every connection.
+class Config : public HostService {
+ public:
+  Config(SharedFD server) : server_(server) {}
+
+  std::string Name() const override { return "config_server"; }
+
+  Result<void> Start() override {
+    helper_ = DeviceConfigHelper::Get();
+    CF_EXPECT(helper_ != nullptr, "Could not open device config");
+    return {};
+  }
+
+  void BeforeSelect(SharedFDSet* read_set) const override {
+    read_set->Set(server_);
+  }
+
+  Result<void> AfterSelect(const SharedFDSet& read_set) override {
+    if (!read_set.IsSet(server_)) {
+      return {};
+    }
+    auto connection = SharedFD::Accept(*server_);
+    CF_EXPECT(connection->IsOpen(), "Failed to accept a configuration request: "
+                                        << connection->StrError());
+    // The configuration is small enough to fit in the socket's buffer.
+    if (!helper_->SendDeviceConfig(connection)) {
+      LOG(ERROR) << "Failed to send the device configuration: "
+                 << connection->StrError();
+    }
+    return {};
+  }
+
+ private:
+  SharedFD server_;
+  std::unique_ptr<DeviceConfigHelper> helper_;
+};
+
+}  // namespace
+
+std::unique_ptr<HostService> TombstoneService(SharedFD server,
+                                              std::string tombstone_dir) {
+  return std::make_unique<Tombstone>(server, std::move(tombstone_dir));
+}
+
+std::unique_ptr<HostService> ConfigService(SharedFD server) {
+  return std::make_unique<Config>(server);
+}
+
+}  // namespace cuttlefish
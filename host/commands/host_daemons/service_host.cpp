@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/host_daemons/service_host.h"
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+
+// A service that runs this long without failing starts over from the initial
+// backoff the next time it fails.
+constexpr auto kStableRunTime = std::chrono::seconds(60);
+
+void ServiceHost::AddService(std::unique_ptr<HostService> service,
+                             RestartPolicy policy) {
+  Entry entry;
+  entry.service = std::move(service);
+  entry.policy = policy;
+  entry.restart_at = Clock::now();
+  entries_.emplace_back(std::move(entry));
+}
+
+void ServiceHost::Start(Entry& entry) {
+  entry.restart_at.reset();
+  auto started = entry.service->Start();
+  if (!started.ok()) {
+    Fail(entry, started.error().message());
+    return;
+  }
+  entry.running = true;
+  entry.started_at = Clock::now();
+  LOG(DEBUG) << "Started " << entry.service->Name();
+}
+
+void ServiceHost::Fail(Entry& entry, const std::string& message) {
+  if (!entry.policy.restart) {
+    entry.running = false;
+    LOG(ERROR) << entry.service->Name() << " failed: " << message;
+    return;
+  }
+  if (entry.running && Clock::now() - entry.started_at >= kStableRunTime) {
+    entry.backoff = std::chrono::milliseconds(0);
+  }
+  entry.running = false;
+  if (entry.backoff.count() == 0) {
+    entry.backoff = entry.policy.initial_backoff;
+  } else {
+    entry.backoff = std::min(entry.backoff * 2, entry.policy.max_backoff);
+  }
+  LOG(ERROR) << entry.service->Name() << " failed, restarting in "
+             << entry.backoff.count() << "ms: " << message;
+  entry.restart_at = Clock::now() + entry.backoff;
+}
+
+Result<void> ServiceHost::RunOnce(std::chrono::milliseconds timeout) {
+  auto now = Clock::now();
+  std::optional<Clock::time_point> next_restart;
+  for (auto& entry : entries_) {
+    if (entry.restart_at && *entry.restart_at <= now) {
+      Start(entry);
+    }
+    if (entry.restart_at) {
+      next_restart = std::min(next_restart.value_or(*entry.restart_at),
+                              *entry.restart_at);
+    }
+  }
+
+  SharedFDSet read_set;
+  bool any_running = false;
+  for (const auto& entry : entries_) {
+    if (entry.running) {
+      entry.service->BeforeSelect(&read_set);
+      any_running = true;
+    }
+  }
+  CF_EXPECT(any_running || next_restart.has_value(),
+            "No service left to run");
+
+  auto wait = timeout;
+  if (next_restart) {
+    // Rounded up, waking up early would only loop around to wait again.
+    auto until_restart = std::chrono::ceil<std::chrono::milliseconds>(
+        *next_restart - Clock::now());
+    wait = std::max(std::chrono::milliseconds(0),
+                    std::min(wait, until_restart));
+  }
+  struct timeval select_timeout = {
+      .tv_sec = static_cast<time_t>(wait.count() / 1000),
+      .tv_usec = static_cast<suseconds_t>((wait.count() % 1000) * 1000),
+  };
+  auto ready = Select(&read_set, nullptr, nullptr, &select_timeout);
+  if (ready < 0) {
+    // Interrupted, or a service handed out a closed file descriptor. Either
+    // way the next iteration starts over.
+    return {};
+  }
+
+  for (auto& entry : entries_) {
+    if (!entry.running) {
+      continue;
+    }
+    auto result = entry.service->AfterSelect(read_set);
+    if (!result.ok()) {
+      Fail(entry, result.error().message());
+    }
+  }
+  return {};
+}
+
+Result<void> ServiceHost::Run() {
+  while (true) {
+    CF_EXPECT(RunOnce(std::chrono::milliseconds(60000)));
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/host_daemons/host_service.h"
+
+namespace cuttlefish {
+
+// Runs services in a shared select loop, restarting them when they fail.
+class ServiceHost {
+ public:
+  void AddService(std::unique_ptr<HostService> service, RestartPolicy policy);
+
+  // Runs one iteration of the loop, waiting at most `timeout` for a file
+  // descriptor to be ready. Fails once no service is left to run.
+  Result<void> RunOnce(std::chrono::milliseconds timeout);
+
+  // Runs until no service is left to run.
+  Result<void> Run();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::unique_ptr<HostService> service;
+    RestartPolicy policy;
+    bool running = false;
+    Clock::time_point started_at;
+    // Set while a failed service waits to be restarted.
+    std::optional<Clock::time_point> restart_at;
+    std::chrono::milliseconds backoff{0};
+  };
+
+  void Start(Entry& entry);
+  void Fail(Entry& entry, const std::string& message);
+
+  std::vector<Entry> entries_;
+};
+
+}  // namespace cuttlefish
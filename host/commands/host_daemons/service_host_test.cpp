@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/host_daemons/service_host.h"
+#include "host/commands/host_daemons/thread_pool.h"
+
+namespace cuttlefish {
+namespace {
+
+using std::chrono::milliseconds;
+
+// Reads bytes from a pipe, failing on every 'x'.
+class FakeService : public HostService {
+ public:
+  FakeService(SharedFD pipe, std::string* received, int* starts)
+      : pipe_(pipe), received_(received), starts_(starts) {}
+
+  std::string Name() const override { return "fake"; }
+
+  Result<void> Start() override {
+    (*starts_)++;
+    return {};
+  }
+
+  void BeforeSelect(SharedFDSet* read_set) const override {
+    read_set->Set(pipe_);
+  }
+
+  Result<void> AfterSelect(const SharedFDSet& read_set) override {
+    if (!read_set.IsSet(pipe_)) {
+      return {};
+    }
+    char byte;
+    CF_EXPECT(pipe_->Read(&byte, 1) == 1, "Read failed");
+    CF_EXPECT(byte != 'x', "Failing on request");
+    *received_ += byte;
+    return {};
+  }
+
+ private:
+  SharedFD pipe_;
+  std::string* received_;
+  int* starts_;
+};
+
+TEST(ServiceHostTest, RestartsFailedServices) {
+  SharedFD read_end, write_end;
+  ASSERT_TRUE(SharedFD::Pipe(&read_end, &write_end));
+  std::string received;
+  int starts = 0;
+  ServiceHost host;
+  RestartPolicy policy;
+  policy.initial_backoff = milliseconds(10);
+  host.AddService(std::make_unique<FakeService>(read_end, &received, &starts),
+                  policy);
+
+  ASSERT_EQ(WriteAll(write_end, std::string("abxc")), 4);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(host.RunOnce(milliseconds(100)).ok());
+  }
+  ASSERT_EQ(received, "ab");
+  ASSERT_EQ(starts, 1);
+  // Failed on 'x', 'c' waits for the restart.
+  ASSERT_TRUE(host.RunOnce(milliseconds(100)).ok());
+  ASSERT_TRUE(host.RunOnce(milliseconds(100)).ok());
+  ASSERT_EQ(starts, 2);
+  ASSERT_EQ(received, "abc");
+}
+
+TEST(ServiceHostTest, DropsServicesNotRestarted) {
+  SharedFD read_end, write_end;
+  ASSERT_TRUE(SharedFD::Pipe(&read_end, &write_end));
+  std::string received;
+  int starts = 0;
+  ServiceHost host;
+  RestartPolicy policy;
+  policy.restart = false;
+  host.AddService(std::make_unique<FakeService>(read_end, &received, &starts),
+                  policy);
+
+  ASSERT_EQ(WriteAll(write_end, std::string("x")), 1);
+  ASSERT_TRUE(host.RunOnce(milliseconds(100)).ok());
+  ASSERT_FALSE(host.RunOnce(milliseconds(100)).ok());
+  ASSERT_EQ(starts, 1);
+}
+
+TEST(StrandTest, RunsJobsInOrder) {
+  ThreadPool pool(4);
+  std::vector<int> first, second;
+  Strand first_strand(pool), second_strand(pool);
+  for (int i = 0; i < 1000; i++) {
+    first_strand.Post([&first, i]() { first.push_back(i); });
+    second_strand.Post([&second, i]() { second.push_back(i); });
+  }
+  first_strand.Drain();
+  second_strand.Drain();
+  ASSERT_EQ(first.size(), 1000);
+  ASSERT_EQ(second.size(), 1000);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(first[i], i);
+    ASSERT_EQ(second[i], i);
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "host/commands/host_daemons/host_service.h"
+#include "host/commands/host_daemons/thread_pool.h"
+
+namespace cuttlefish {
+
+// The services of the host daemons of the same names, taking the same file
+// descriptors and writing the same files.
+
+// kernel_log_monitor
+std::unique_ptr<HostService> KernelLogService(
+    SharedFD pipe, std::string log_path, bool deprecated_boot_completed,
+    std::vector<SharedFD> subscribers);
+// logcat_receiver
+std::unique_ptr<HostService> LogcatService(SharedFD pipe,
+                                           std::string log_path);
+// tombstone_receiver
+std::unique_ptr<HostService> TombstoneService(SharedFD server,
+                                              std::string tombstone_dir);
+// config_server
+std::unique_ptr<HostService> ConfigService(SharedFD server);
+// console_forwarder
+std::unique_ptr<HostService> ConsoleService(std::string console_path,
+                                            SharedFD console_in,
+                                            SharedFD console_out,
+                                            std::string console_log_path,
+                                            std::string kernel_log_pipe_path,
+                                            ThreadPool& pool);
+
+}  // namespace cuttlefish
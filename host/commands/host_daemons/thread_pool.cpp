@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/host_daemons/thread_pool.h"
+
+#include <utility>
+
+namespace cuttlefish {
+
+ThreadPool::ThreadPool(std::size_t num_threads) {
+  for (std::size_t i = 0; i < num_threads; i++) {
+    threads_.emplace_back([this]() { Work(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  job_posted_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Post(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.emplace_back(std::move(job));
+  }
+  job_posted_.notify_one();
+}
+
+void ThreadPool::Work() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_posted_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
+
+Strand::Strand(ThreadPool& pool) : pool_(pool) {}
+
+void Strand::Post(std::function<void()> job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  jobs_.emplace_back(std::move(job));
+  if (!running_) {
+    running_ = true;
+    pool_.Post([this]() { RunJobs(); });
+  }
+}
+
+void Strand::Drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return !running_; });
+}
+
+void Strand::RunJobs() {
+  // Keeps the pool thread until the queue is empty, rather than posting a pool
+  // job per strand job, so the strand's jobs stay in order.
+  while (true) {
+    std::function<void()> job;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (jobs_.empty()) {
+        running_ = false;
+        idle_.notify_all();
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
+
+}  // namespace cuttlefish
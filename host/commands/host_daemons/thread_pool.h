@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cuttlefish {
+
+// A fixed number of threads running jobs in the order they are posted.
+class ThreadPool {
+ public:
+  explicit ThreadPool(std::size_t num_threads);
+  // Runs the jobs already posted, then joins the threads.
+  ~ThreadPool();
+
+  void Post(std::function<void()> job);
+
+ private:
+  void Work();
+
+  std::mutex mutex_;
+  std::condition_variable job_posted_;
+  std::deque<std::function<void()>> jobs_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+/**
+ * Runs jobs on a ThreadPool one at a time, in the order they are posted, so
+ * that writes to the same file descriptor don't interleave. Jobs posted to
+ * different strands run in parallel. The strand must outlive its jobs.
+ */
+class Strand {
+ public:
+  explicit Strand(ThreadPool& pool);
+
+  void Post(std::function<void()> job);
+
+  // Waits for the jobs posted so far to finish.
+  void Drain();
+
+ private:
+  void RunJobs();
+
+  ThreadPool& pool_;
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  std::deque<std::function<void()>> jobs_;
+  bool running_ = false;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+DEFINE_bool(csv, false,
+            "Print one comma separated line per instance instead of a table, "
+            "for collecting the results of several runs.");
+
+namespace cuttlefish {
+namespace {
+
+// Values from /proc/<pid>/smaps_rollup, in kB.
+struct MemoryUsage {
+  std::uint64_t rss = 0;
+  std::uint64_t pss = 0;
+  std::uint64_t pss_file = 0;
+  std::uint64_t shared = 0;
+  std::uint64_t private_ = 0;
+
+  MemoryUsage& operator+=(const MemoryUsage& other) {
+    rss += other.rss;
+    pss += other.pss;
+    pss_file += other.pss_file;
+    shared += other.shared;
+    private_ += other.private_;
+    return *this;
+  }
+};
+
+Result<MemoryUsage> ReadMemoryUsage(pid_t pid) {
+  auto path = "/proc/" + std::to_string(pid) + "/smaps_rollup";
+  std::string contents;
+  CF_EXPECT(android::base::ReadFileToString(path, &contents),
+            "Could not read \"" << path << "\": " << strerror(errno));
+  MemoryUsage usage;
+  for (const auto& line : android::base::Split(contents, "\n")) {
+    // "Pss:                 561 kB"
+    std::vector<std::string> fields;
+    for (const auto& field : android::base::Split(line, " ")) {
+      if (!field.empty()) {
+        fields.push_back(field);
+      }
+    }
+    if (fields.size() != 3 || fields[2] != "kB") {
+      continue;
+    }
+    std::uint64_t value = 0;
+    CF_EXPECT(android::base::ParseUint(fields[1], &value),
+              "Malformed line in \"" << path << "\": " << line);
+    const auto& key = fields[0];
+    if (key == "Rss:") {
+      usage.rss = value;
+    } else if (key == "Pss:") {
+      usage.pss = value;
+    } else if (key == "Pss_File:") {
+      usage.pss_file = value;
+    } else if (key == "Shared_Clean:" || key == "Shared_Dirty:") {
+      usage.shared += value;
+    } else if (key == "Private_Clean:" || key == "Private_Dirty:") {
+      usage.private_ += value;
+    }
+  }
+  return usage;
+}
+
+bool IsVmm(const std::vector<std::string>& args) {
+  if (args.empty()) {
+    return false;
+  }
+  auto name = android::base::Basename(args[0]);
+  return name == "crosvm" || android::base::StartsWith(name, "qemu-system");
+}
+
+// The VMM processes running the instance, recognized by their arguments
+// referring to the instance directory. Sandboxed crosvm forks one process per
+// device, all of them are included.
+std::vector<pid_t> VmmProcesses(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto instance_dir = instance.instance_dir() + "/";
+  std::vector<pid_t> pids;
+  std::unique_ptr<DIR, int (*)(DIR*)> proc(opendir("/proc"), closedir);
+  if (!proc) {
+    return pids;
+  }
+  while (auto entry = readdir(proc.get())) {
+    int pid = 0;
+    if (!android::base::ParseInt(entry->d_name, &pid)) {
+      continue;
+    }
+    std::string cmdline;
+    if (!android::base::ReadFileToString("/proc/" + std::to_string(pid) +
+                                             "/cmdline",
+                                         &cmdline)) {
+      continue;
+    }
+    auto args = android::base::Split(cmdline, std::string(1, '\0'));
+    if (!IsVmm(args)) {
+      continue;
+    }
+    for (const auto& arg : args) {
+      if (arg.find(instance_dir) != std::string::npos) {
+        pids.push_back(pid);
+        break;
+      }
+    }
+  }
+  return pids;
+}
+
+// How much of the file is in the host page cache, in kB. Mapping the file
+// does not fault any page in.
+Result<std::uint64_t> ResidentFileKb(const std::string& path) {
+  auto size = FileSize(path);
+  CF_EXPECT(size > 0, "\"" << path << "\" is empty or missing");
+  auto fd = SharedFD::Open(path, O_RDONLY | O_CLOEXEC);
+  CF_EXPECT(fd->IsOpen(), "Could not open \"" << path << "\": "
+                                              << fd->StrError());
+  auto mapping = fd->MMap(nullptr, size, PROT_READ, MAP_SHARED, 0);
+  CF_EXPECT(static_cast<bool>(mapping),
+            "Could not map \"" << path << "\": " << fd->StrError());
+  const std::size_t page_size = sysconf(_SC_PAGESIZE);
+  std::vector<unsigned char> resident((size + page_size - 1) / page_size);
+  CF_EXPECT(mincore(mapping.get(), size, resident.data()) == 0,
+            "mincore failed: " << strerror(errno));
+
+  std::uint64_t pages = 0;
+  for (auto page : resident) {
+    pages += page & 1;
+  }
+  return pages * page_size / 1024;
+}
+
+void PrintRow(const std::string& name, std::size_t processes,
+              const MemoryUsage& usage) {
+  if (FLAGS_csv) {
+    std::cout << name << "," << processes << "," << usage.rss << ","
+              << usage.pss << "," << usage.pss_file << "," << usage.shared
+              << "," << usage.private_ << std::endl;
+    return;
+  }
+  auto mb = [](std::uint64_t kb) { return std::to_string(kb / 1024) + " MB"; };
+  std::cout << std::left << std::setw(12) << name << std::right
+            << std::setw(6) << processes << std::setw(12) << mb(usage.rss)
+            << std::setw(12) << mb(usage.pss) << std::setw(12)
+            << mb(usage.pss_file) << std::setw(12) << mb(usage.shared)
+            << std::setw(12) << mb(usage.private_) << std::endl;
+}
+
+Result<void> MemoryUsageMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get(), "Failed to obtain config");
+
+  if (FLAGS_csv) {
+    std::cout << "instance,processes,rss_kb,pss_kb,pss_file_kb,shared_kb,"
+              << "private_kb" << std::endl;
+  } else {
+    std::cout << std::left << std::setw(12) << "instance" << std::right
+              << std::setw(6) << "procs" << std::setw(12) << "rss"
+              << std::setw(12) << "pss" << std::setw(12) << "pss_file"
+              << std::setw(12) << "shared" << std::setw(12) << "private"
+              << std::endl;
+  }
+
+  // The sum of the proportional set sizes is what the instances cost the
+  // host, resident set sizes count shared pages once per instance.
+  MemoryUsage total;
+  std::size_t total_processes = 0;
+  for (const auto& instance : config->Instances()) {
+    auto pids = VmmProcesses(instance);
+    if (pids.empty()) {
+      LOG(WARNING) << "No VMM running for " << instance.instance_name();
+      continue;
+    }
+    MemoryUsage usage;
+    for (auto pid : pids) {
+      auto process_usage = ReadMemoryUsage(pid);
+      if (!process_usage.ok()) {
+        // The process may have exited since listing it.
+        LOG(WARNING) << process_usage.error();
+        continue;
+      }
+      usage += *process_usage;
+    }
+    PrintRow(instance.instance_name(), pids.size(), usage);
+    total += usage;
+    total_processes += pids.size();
+  }
+  PrintRow("total", total_processes, total);
+
+  if (!config->super_pmem_image().empty() && !FLAGS_csv) {
+    auto resident = CF_EXPECT(ResidentFileKb(config->super_pmem_image()));
+    std::cout << "Shared super image: " << resident / 1024 << " MB of "
+              << FileSize(config->super_pmem_image()) / 1024 / 1024
+              << " MB in the host page cache" << std::endl;
+  }
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::MemoryUsageMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/qos.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance to inspect or adjust");
+DEFINE_string(tier, "",
+              "Moves the instance to this QoS tier: interactive, ci or "
+              "background. Only reports the current tier and pressure when "
+              "empty.");
+
+namespace cuttlefish {
+namespace {
+
+void PrintPressure(const std::string& resource,
+                   const ResourcePressure& pressure) {
+  auto print_stats = [](const std::string& kind, const PressureStats& stats) {
+    std::cout << "  " << kind << " avg10=" << stats.avg10
+              << " avg60=" << stats.avg60 << " avg300=" << stats.avg300
+              << " total=" << stats.total_us << "us";
+  };
+  std::cout << std::left << std::setw(7) << resource;
+  print_stats("some", pressure.some);
+  print_stats("full", pressure.full);
+  std::cout << std::endl;
+}
+
+Result<void> QosMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get(), "Failed to obtain config");
+  auto instance = config->ForInstance(FLAGS_instance_num);
+  CF_EXPECT(!instance.qos_cgroup_path().empty(),
+            instance.instance_name() << " was launched without a QoS tier");
+  auto cgroup = CF_EXPECT(InstanceCgroup::Open(instance.qos_cgroup_path()));
+
+  if (!FLAGS_tier.empty()) {
+    auto tier = CF_EXPECT(ParseQosTier(FLAGS_tier));
+    CF_EXPECT(cgroup.Apply(
+        QosLimitsForTier(tier, config->cpus(), config->memory_mb())));
+  }
+
+  auto tier = CF_EXPECT(cgroup.Tier());
+  std::cout << instance.instance_name() << ": "
+            << (tier ? QosTierName(*tier) : "custom") << " QoS tier ("
+            << cgroup.path() << ")" << std::endl;
+
+  auto pressure = CF_EXPECT(cgroup.Pressure());
+  std::cout << std::fixed << std::setprecision(2);
+  PrintPressure("cpu", pressure.cpu);
+  PrintPressure("memory", pressure.memory);
+  PrintPressure("io", pressure.io);
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::QosMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
@@ -15,8 +15,13 @@
 
 #include "host/commands/run_cvd/launch.h"
 
+#include <poll.h>
+
 #include <android-base/logging.h>
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -29,6 +34,7 @@
 #include "host/commands/run_cvd/process_monitor.h"
 #include "host/commands/run_cvd/reporting.h"
 #include "host/commands/run_cvd/runner_defs.h"
+#include "host/commands/secure_env/tenant_channels.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/inject.h"
 #include "host/libs/config/known_paths.h"
@@ -49,14 +55,62 @@ std::vector<T> single_element_emplace(T&& element) {
   return vec;
 }
 
+void ReleaseWifiDhcpLeases(SharedFD wifi_tap) {
+  // Only run the leases workaround if we are not using the new network
+  // bridge architecture - in that case, we have a wider DHCP address
+  // space and stale leases should be much less of an issue
+  if (FileExists("/var/run/cuttlefish-dnsmasq-cvd-wbr.leases") ||
+      !wifi_tap->IsOpen()) {
+    return;
+  }
+  // TODO(schuffelen): QEMU also needs this and this is not the best place
+  // for this code. Find a better place to put it.
+  auto lease_file =
+      ForCurrentInstance("/var/run/cuttlefish-dnsmasq-cvd-wbr-") + ".leases";
+  std::uint8_t dhcp_server_ip[] = {
+      192, 168, 96, (std::uint8_t)(ForCurrentInstance(1) * 4 - 3)};
+  if (!ReleaseDhcpLeases(lease_file, wifi_tap, dhcp_server_ip)) {
+    LOG(ERROR) << "Failed to release wifi DHCP leases. Connecting to the wifi "
+               << "network may not work.";
+  }
+}
+
 }  // namespace
 
+// Runs the services of the small per-instance daemons in a single process
+// when the config asks for it. The sources of those daemons hand their file
+// descriptors over to it during setup instead of starting their binaries.
+class HostDaemons : public CommandSource {
+ public:
+  INJECT(HostDaemons(const CuttlefishConfig& config))
+      : config_(config), command_(HostDaemonsBinary()) {}
+
+  Command& Cmd() { return command_; }
+
+  // CommandSource
+  std::vector<Command> Commands() override {
+    return single_element_emplace(std::move(command_));
+  }
+
+  // SetupFeature
+  std::string Name() const override { return "HostDaemons"; }
+  bool Enabled() const override { return config_.consolidate_host_daemons(); }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
+  bool Setup() override { return true; }
+
+  const CuttlefishConfig& config_;
+  Command command_;
+};
+
 class KernelLogMonitor : public CommandSource,
                          public KernelLogPipeProvider,
                          public DiagnosticInformation {
  public:
-  INJECT(KernelLogMonitor(const CuttlefishConfig::InstanceSpecific& instance))
-      : instance_(instance) {}
+  INJECT(KernelLogMonitor(const CuttlefishConfig::InstanceSpecific& instance,
+                          HostDaemons& host_daemons))
+      : instance_(instance), host_daemons_(host_daemons) {}
 
   // DiagnosticInformation
   std::vector<std::string> Diagnostics() const override {
@@ -65,19 +119,11 @@ class KernelLogMonitor : public CommandSource,
 
   // CommandSource
   std::vector<Command> Commands() override {
-    Command command(KernelLogMonitorBinary());
-    command.AddParameter("-log_pipe_fd=", fifo_);
-
-    if (!event_pipe_write_ends_.empty()) {
-      command.AddParameter("-subscriber_fds=");
-      for (size_t i = 0; i < event_pipe_write_ends_.size(); i++) {
-        if (i > 0) {
-          command.AppendToLastParameter(",");
-        }
-        command.AppendToLastParameter(event_pipe_write_ends_[i]);
-      }
+    if (host_daemons_.Enabled()) {
+      return {};
     }
-
+    Command command(KernelLogMonitorBinary());
+    AddParameters(command, "-log_pipe_fd=", "-subscriber_fds=");
     return single_element_emplace(std::move(command));
   }
 
@@ -95,6 +141,20 @@ class KernelLogMonitor : public CommandSource,
   std::string Name() const override { return "KernelLogMonitor"; }
 
  private:
+  void AddParameters(Command& command, const std::string& pipe_flag,
+                     const std::string& subscribers_flag) {
+    command.AddParameter(pipe_flag, fifo_);
+    if (!event_pipe_write_ends_.empty()) {
+      command.AddParameter(subscribers_flag);
+      for (size_t i = 0; i < event_pipe_write_ends_.size(); i++) {
+        if (i > 0) {
+          command.AppendToLastParameter(",");
+        }
+        command.AppendToLastParameter(event_pipe_write_ends_[i]);
+      }
+    }
+  }
+
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
   Result<void> ResultSetup() override {
     auto log_name = instance_.kernel_log_pipe_name();
@@ -121,10 +181,15 @@ class KernelLogMonitor : public CommandSource,
         event_pipe_read_ends_.push_back(event_pipe_read_end);
       }
     }
+    if (host_daemons_.Enabled()) {
+      AddParameters(host_daemons_.Cmd(), "--kernel_log_pipe_fd=",
+                    "--kernel_log_subscriber_fds=");
+    }
     return {};
   }
 
   const CuttlefishConfig::InstanceSpecific& instance_;
+  HostDaemons& host_daemons_;
   SharedFD fifo_;
   std::vector<SharedFD> event_pipe_write_ends_;
   std::vector<SharedFD> event_pipe_read_ends_;
@@ -206,8 +271,9 @@ class RootCanal : public CommandSource {
 
 class LogcatReceiver : public CommandSource, public DiagnosticInformation {
  public:
-  INJECT(LogcatReceiver(const CuttlefishConfig::InstanceSpecific& instance))
-      : instance_(instance) {}
+  INJECT(LogcatReceiver(const CuttlefishConfig::InstanceSpecific& instance,
+                        HostDaemons& host_daemons))
+      : instance_(instance), host_daemons_(host_daemons) {}
   // DiagnosticInformation
   std::vector<std::string> Diagnostics() const override {
     return {"Logcat output: " + instance_.logcat_path()};
@@ -215,6 +281,9 @@ class LogcatReceiver : public CommandSource, public DiagnosticInformation {
 
   // CommandSource
   std::vector<Command> Commands() override {
+    if (host_daemons_.Enabled()) {
+      return {};
+    }
     return single_element_emplace(
         Command(LogcatReceiverBinary()).AddParameter("-log_pipe_fd=", pipe_));
   }
@@ -237,20 +306,28 @@ class LogcatReceiver : public CommandSource, public DiagnosticInformation {
     pipe_ = SharedFD::Open(log_name.c_str(), O_RDWR);
     CF_EXPECT(pipe_->IsOpen(),
               "Can't open \"" << log_name << "\": " << pipe_->StrError());
+    if (host_daemons_.Enabled()) {
+      host_daemons_.Cmd().AddParameter("--logcat_pipe_fd=", pipe_);
+    }
     return {};
   }
 
   const CuttlefishConfig::InstanceSpecific& instance_;
+  HostDaemons& host_daemons_;
   SharedFD pipe_;
 };
 
 class ConfigServer : public CommandSource {
  public:
-  INJECT(ConfigServer(const CuttlefishConfig::InstanceSpecific& instance))
-      : instance_(instance) {}
+  INJECT(ConfigServer(const CuttlefishConfig::InstanceSpecific& instance,
+                      HostDaemons& host_daemons))
+      : instance_(instance), host_daemons_(host_daemons) {}
 
   // CommandSource
   std::vector<Command> Commands() override {
+    if (host_daemons_.Enabled()) {
+      return {};
+    }
     return single_element_emplace(
         Command(ConfigServerBinary()).AddParameter("-server_fd=", socket_));
   }
@@ -267,21 +344,58 @@ class ConfigServer : public CommandSource {
     CF_EXPECT(socket_->IsOpen(),
               "Unable to create configuration server socket: "
                   << socket_->StrError());
+    if (host_daemons_.Enabled()) {
+      host_daemons_.Cmd().AddParameter("--config_server_fd=", socket_);
+    }
     return {};
   }
 
  private:
   const CuttlefishConfig::InstanceSpecific& instance_;
+  HostDaemons& host_daemons_;
   SharedFD socket_;
 };
 
-class TombstoneReceiver : public CommandSource {
+class DeviceControl : public CommandSource {
  public:
-  INJECT(TombstoneReceiver(const CuttlefishConfig::InstanceSpecific& instance))
+  INJECT(DeviceControl(const CuttlefishConfig::InstanceSpecific& instance))
       : instance_(instance) {}
 
   // CommandSource
   std::vector<Command> Commands() override {
+    return single_element_emplace(
+        Command(DeviceControlBinary()).AddParameter("-server_fd=", socket_));
+  }
+
+  // SetupFeature
+  std::string Name() const override { return "DeviceControl"; }
+  bool Enabled() const override { return true; }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
+  Result<void> ResultSetup() override {
+    auto path = instance_.device_control_socket_path();
+    socket_ = SharedFD::SocketLocalServer(path, false, SOCK_STREAM, 0666);
+    CF_EXPECT(socket_->IsOpen(), "Unable to create device control socket \""
+                                     << path << "\": " << socket_->StrError());
+    return {};
+  }
+
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  SharedFD socket_;
+};
+
+class TombstoneReceiver : public CommandSource {
+ public:
+  INJECT(TombstoneReceiver(const CuttlefishConfig::InstanceSpecific& instance,
+                           HostDaemons& host_daemons))
+      : instance_(instance), host_daemons_(host_daemons) {}
+
+  // CommandSource
+  std::vector<Command> Commands() override {
+    if (host_daemons_.Enabled()) {
+      return {};
+    }
     return single_element_emplace(
         Command(TombstoneReceiverBinary())
             .AddParameter("-server_fd=", socket_)
@@ -308,10 +422,16 @@ class TombstoneReceiver : public CommandSource {
     socket_ = SharedFD::VsockServer(port, SOCK_STREAM);
     CF_EXPECT(socket_->IsOpen(), "Unable to create tombstone server socket: "
                                      << socket_->StrError());
+    if (host_daemons_.Enabled()) {
+      host_daemons_.Cmd()
+          .AddParameter("--tombstone_server_fd=", socket_)
+          .AddParameter("--tombstone_dir=", tombstone_dir_);
+    }
     return {};
   }
 
   const CuttlefishConfig::InstanceSpecific& instance_;
+  HostDaemons& host_daemons_;
   SharedFD socket_;
   std::string tombstone_dir_;
 };
@@ -455,8 +575,21 @@ class SecureEnvironment : public CommandSource {
         instance_(instance),
         kernel_log_pipe_provider_(kernel_log_pipe_provider) {}
 
+  ~SecureEnvironment() {
+    if (interrupt_fd_->IsOpen()) {
+      CHECK(interrupt_fd_->EventfdWrite(1) >= 0);
+    }
+    if (registration_thread_.joinable()) {
+      registration_thread_.join();
+    }
+  }
+
   // CommandSource
   std::vector<Command> Commands() override {
+    if (!instance_.start_secure_env()) {
+      // Served by the secure_env of the first instance.
+      return {};
+    }
     Command command(HostBinaryPath("secure_env"));
     command.AddParameter("-confui_server_fd=", confui_server_fd_);
     command.AddParameter("-keymaster_fd_out=", fifos_[0]);
@@ -472,6 +605,9 @@ class SecureEnvironment : public CommandSource {
     command.AddParameter("-gatekeeper_impl=", gatekeeper_impl);
 
     command.AddParameter("-kernel_events_fd=", kernel_log_pipe_);
+    if (tenant_server_->IsOpen()) {
+      command.AddParameter("-tenant_server_fd=", tenant_server_);
+    }
 
     return single_element_emplace(std::move(command));
   }
@@ -510,15 +646,118 @@ class SecureEnvironment : public CommandSource {
                                 << confui_server_fd_->StrError());
     kernel_log_pipe_ = kernel_log_pipe_provider_.KernelLogPipe();
 
+    if (config_.shared_secure_env()) {
+      auto tenant_socket_path = config_.AssemblyPath("secure_env_tenants.sock");
+      if (instance_.start_secure_env()) {
+        tenant_server_ = SharedFD::SocketLocalServer(tenant_socket_path, false,
+                                                     SOCK_SEQPACKET, 0600);
+        CF_EXPECT(tenant_server_->IsOpen(),
+                  "Could not open " << tenant_socket_path << ": "
+                                    << tenant_server_->StrError());
+      } else {
+        // The first instance may still be starting.
+        auto registered = RegisterTenant(tenant_socket_path);
+        for (int attempt = 1; !registered.ok() && attempt < kRegisterAttempts;
+             attempt++) {
+          sleep(1);
+          registered = RegisterTenant(tenant_socket_path);
+        }
+        CF_EXPECT(std::move(registered));
+        interrupt_fd_ = SharedFD::Event();
+        CF_EXPECT(interrupt_fd_->IsOpen(),
+                  "Failed to open eventfd: " << interrupt_fd_->StrError());
+        registration_thread_ = std::thread(
+            [this, tenant_socket_path]() { KeepRegistered(tenant_socket_path); });
+      }
+    }
+
     return {};
   }
 
+  // Hands the guest's channels to the secure_env of the first instance, which
+  // serves the guest for as long as the registration stays open.
+  Result<void> RegisterTenant(const std::string& tenant_socket_path) {
+    auto registration = SharedFD::SocketLocalClient(tenant_socket_path, false,
+                                                    SOCK_SEQPACKET);
+    CF_EXPECT(registration->IsOpen(),
+              "Could not connect to the shared secure_env at "
+                  << tenant_socket_path << ": " << registration->StrError());
+    Tenant tenant;
+    tenant.instance_id = instance_.id();
+    tenant.channels.keymaster_in = fifos_[1];
+    tenant.channels.keymaster_out = fifos_[0];
+    tenant.channels.gatekeeper_in = fifos_[3];
+    tenant.channels.gatekeeper_out = fifos_[2];
+    tenant.channels.confui_server = confui_server_fd_;
+    tenant.channels.kernel_events = kernel_log_pipe_;
+    CF_EXPECT(SendTenant(registration, tenant));
+    registration_ = registration;
+    return {};
+  }
+
+  // The shared secure_env forgets its tenants when it restarts, closing their
+  // registrations, so the guest is registered again whenever that happens.
+  // The tenant server socket belongs to the first instance's run_cvd and
+  // outlives secure_env, so a restarted one accepts the new registration.
+  void KeepRegistered(const std::string& tenant_socket_path) {
+    while (true) {
+      std::vector<PollSharedFd> poll_shared_fd = {
+          {
+              .fd = registration_,
+              .events = POLLIN | POLLHUP,
+          },
+          {
+              .fd = interrupt_fd_,
+              .events = POLLIN | POLLHUP,
+          }};
+      if (SharedFD::Poll(poll_shared_fd, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        LOG(ERROR) << "Failed to poll the secure_env registration: "
+                   << strerror(errno);
+        return;
+      }
+      if (poll_shared_fd[1].revents & POLLIN) {
+        return;
+      }
+      // Nothing is ever sent back, the shared secure_env went away.
+      LOG(INFO) << "Shared secure_env stopped serving instance "
+                << instance_.id() << ", registering again";
+      registration_->Close();
+      auto backoff = kRegisterBackoffMin;
+      while (true) {
+        auto registered = RegisterTenant(tenant_socket_path);
+        if (registered.ok()) {
+          break;
+        }
+        LOG(DEBUG) << registered.error().message();
+        std::vector<PollSharedFd> interrupt = {{
+            .fd = interrupt_fd_,
+            .events = POLLIN | POLLHUP,
+        }};
+        if (SharedFD::Poll(interrupt, backoff.count()) > 0) {
+          return;
+        }
+        backoff = std::min(backoff * 2, kRegisterBackoffMax);
+      }
+    }
+  }
+
+  static constexpr int kRegisterAttempts = 60;
+  static constexpr std::chrono::milliseconds kRegisterBackoffMin{100};
+  static constexpr std::chrono::milliseconds kRegisterBackoffMax{10000};
+
   const CuttlefishConfig& config_;
   const CuttlefishConfig::InstanceSpecific& instance_;
   SharedFD confui_server_fd_;
   std::vector<SharedFD> fifos_;
   KernelLogPipeProvider& kernel_log_pipe_provider_;
   SharedFD kernel_log_pipe_;
+  SharedFD tenant_server_;
+  SharedFD registration_;
+  SharedFD interrupt_fd_;
+  std::thread registration_thread_;
 };
 
 class VehicleHalServer : public CommandSource {
@@ -566,8 +805,9 @@ class VehicleHalServer : public CommandSource {
 class ConsoleForwarder : public CommandSource, public DiagnosticInformation {
  public:
   INJECT(ConsoleForwarder(const CuttlefishConfig& config,
-                          const CuttlefishConfig::InstanceSpecific& instance))
-      : config_(config), instance_(instance) {}
+                          const CuttlefishConfig::InstanceSpecific& instance,
+                          HostDaemons& host_daemons))
+      : config_(config), instance_(instance), host_daemons_(host_daemons) {}
   // DiagnosticInformation
   std::vector<std::string> Diagnostics() const override {
     if (Enabled()) {
@@ -579,6 +819,9 @@ class ConsoleForwarder : public CommandSource, public DiagnosticInformation {
 
   // CommandSource
   std::vector<Command> Commands() override {
+    if (host_daemons_.Enabled()) {
+      return {};
+    }
     Command console_forwarder_cmd(ConsoleForwarderBinary());
 
     console_forwarder_cmd.AddParameter("--console_in_fd=",
@@ -618,11 +861,17 @@ class ConsoleForwarder : public CommandSource, public DiagnosticInformation {
     CF_EXPECT(console_forwarder_out_rd_->IsOpen(),
               "Failed to open console_forwarder output fifo for reads: "
                   << console_forwarder_out_rd_->StrError());
+    if (host_daemons_.Enabled()) {
+      host_daemons_.Cmd()
+          .AddParameter("--console_in_fd=", console_forwarder_in_wr_)
+          .AddParameter("--console_out_fd=", console_forwarder_out_rd_);
+    }
     return {};
   }
 
   const CuttlefishConfig& config_;
   const CuttlefishConfig::InstanceSpecific& instance_;
+  HostDaemons& host_daemons_;
   SharedFD console_forwarder_in_wr_;
   SharedFD console_forwarder_out_rd_;
 };
@@ -728,24 +977,7 @@ class OpenWrt : public CommandSource {
                                 config_.vhost_user_mac80211_hwsim());
     }
     SharedFD wifi_tap = ap_cmd.AddTap(instance_.wifi_tap_name());
-    // Only run the leases workaround if we are not using the new network
-    // bridge architecture - in that case, we have a wider DHCP address
-    // space and stale leases should be much less of an issue
-    if (!FileExists("/var/run/cuttlefish-dnsmasq-cvd-wbr.leases") &&
-        wifi_tap->IsOpen()) {
-      // TODO(schuffelen): QEMU also needs this and this is not the best place
-      // for this code. Find a better place to put it.
-      auto lease_file =
-          ForCurrentInstance("/var/run/cuttlefish-dnsmasq-cvd-wbr-") +
-          ".leases";
-      std::uint8_t dhcp_server_ip[] = {
-          192, 168, 96, (std::uint8_t)(ForCurrentInstance(1) * 4 - 3)};
-      if (!ReleaseDhcpLeases(lease_file, wifi_tap, dhcp_server_ip)) {
-        LOG(ERROR)
-            << "Failed to release wifi DHCP leases. Connecting to the wifi "
-            << "network may not work.";
-      }
-    }
+    ReleaseWifiDhcpLeases(wifi_tap);
     if (config_.enable_sandbox()) {
       ap_cmd.Cmd().AddParameter("--seccomp-policy-dir=",
                                 config_.seccomp_policy_dir());
@@ -776,7 +1008,7 @@ class OpenWrt : public CommandSource {
 #ifndef ENFORCE_MAC80211_HWSIM
     return false;
 #else
-    return instance_.start_ap() &&
+    return instance_.start_ap() && config_.ap_backend() == "openwrt" &&
            config_.vm_manager() == vm_manager::CrosvmManager::name();
 #endif
   }
@@ -790,6 +1022,51 @@ class OpenWrt : public CommandSource {
   LogTeeCreator& log_tee_;
 };
 
+// The access point as a host process attached to wmediumd, bridging its
+// stations to the Wi-Fi tap like the OpenWrt VM does.
+class HostAccessPoint : public CommandSource {
+ public:
+  INJECT(HostAccessPoint(const CuttlefishConfig& config,
+                         const CuttlefishConfig::InstanceSpecific& instance))
+      : config_(config), instance_(instance) {}
+
+  // CommandSource
+  std::vector<Command> Commands() override {
+    Command ap_cmd(WifiApBinary());
+    ap_cmd.AddParameter("--wmediumd_api_server=",
+                        config_.wmediumd_api_server_socket());
+    ap_cmd.AddParameter("--tap_fd=", wifi_tap_);
+    return single_element_emplace(std::move(ap_cmd));
+  }
+
+  // SetupFeature
+  std::string Name() const override { return "HostAccessPoint"; }
+  bool Enabled() const override {
+#ifndef ENFORCE_MAC80211_HWSIM
+    return false;
+#else
+    return instance_.start_ap() && config_.ap_backend() == "host";
+#endif
+  }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
+  Result<void> ResultSetup() override {
+    CF_EXPECT(instance_.start_wmediumd(),
+              "The host access point needs the instance's wmediumd");
+    wifi_tap_ = OpenTapInterface(instance_.wifi_tap_name());
+    CF_EXPECT(wifi_tap_->IsOpen(), "Could not open "
+                                       << instance_.wifi_tap_name() << ": "
+                                       << wifi_tap_->StrError());
+    ReleaseWifiDhcpLeases(wifi_tap_);
+    return {};
+  }
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  SharedFD wifi_tap_;
+};
+
 using PublicDeps = fruit::Required<const CuttlefishConfig, VmManager,
                                    const CuttlefishConfig::InstanceSpecific>;
 fruit::Component<PublicDeps, KernelLogPipeProvider> launchComponent() {
@@ -804,7 +1081,10 @@ fruit::Component<PublicDeps, KernelLogPipeProvider> launchComponent() {
       .install(Bases::Impls<BluetoothConnector>)
       .install(Bases::Impls<ConfigServer>)
       .install(Bases::Impls<ConsoleForwarder>)
+      .install(Bases::Impls<DeviceControl>)
       .install(Bases::Impls<GnssGrpcProxyServer>)
+      .install(Bases::Impls<HostAccessPoint>)
+      .install(Bases::Impls<HostDaemons>)
       .install(Bases::Impls<KernelLogMonitor>)
       .install(Bases::Impls<LogcatReceiver>)
       .install(Bases::Impls<MetricsService>)
@@ -237,6 +237,9 @@ class WebRtcServer : public virtual CommandSource,
     // webrtc process when connecting to the websocket, so it shouldn't be an
     // issue most of the time.
     webrtc.AddParameter("--command_fd=", client_socket_);
+    webrtc.AddParameter("-frame_capture_fd=", frame_capture_server_);
+    webrtc.AddParameter("-screen_stability_fd=", screen_stability_server_);
+    webrtc.AddParameter("-input_control_fd=", input_control_server_);
     webrtc.AddParameter("-kernel_log_events_fd=", kernel_log_events_pipe_);
     webrtc.AddParameter("-client_dir=",
                         DefaultHostArtifactsPath("usr/share/webrtc/assets"));
@@ -272,6 +275,18 @@ class WebRtcServer : public virtual CommandSource,
           CreateUnixInputServer(instance_.switches_socket_path());
       CF_EXPECT(switches_server_->IsOpen(), switches_server_->StrError());
     }
+    frame_capture_server_ =
+        CreateUnixInputServer(instance_.frame_capture_socket_path());
+    CF_EXPECT(frame_capture_server_->IsOpen(),
+              frame_capture_server_->StrError());
+    screen_stability_server_ =
+        CreateUnixInputServer(instance_.screen_stability_socket_path());
+    CF_EXPECT(screen_stability_server_->IsOpen(),
+              screen_stability_server_->StrError());
+    input_control_server_ =
+        CreateUnixInputServer(instance_.input_control_socket_path());
+    CF_EXPECT(input_control_server_->IsOpen(),
+              input_control_server_->StrError());
     kernel_log_events_pipe_ = log_pipe_provider_.KernelLogPipe();
     CF_EXPECT(kernel_log_events_pipe_->IsOpen(),
               kernel_log_events_pipe_->StrError());
@@ -287,6 +302,9 @@ class WebRtcServer : public virtual CommandSource,
   SharedFD client_socket_;
   SharedFD host_socket_;
   SharedFD switches_server_;
+  SharedFD frame_capture_server_;
+  SharedFD screen_stability_server_;
+  SharedFD input_control_server_;
 };
 
 }  // namespace
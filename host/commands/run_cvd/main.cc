@@ -45,6 +45,7 @@
 #include "host/libs/config/config_fragment.h"
 #include "host/libs/config/custom_actions.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/qos.h"
 #include "host/libs/vm_manager/vm_manager.h"
 
 namespace cuttlefish {
@@ -180,6 +181,23 @@ Result<void> ChdirIntoRuntimeDir(
   return {};
 }
 
+Result<void> PlaceInQosCgroup(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance,
+    ProcessMonitor::Properties& process_monitor_properties) {
+  if (instance.qos_tier().empty()) {
+    return {};
+  }
+  auto tier = CF_EXPECT(ParseQosTier(instance.qos_tier()));
+  auto cgroup = CF_EXPECT(InstanceCgroup::Create(instance.qos_cgroup_path()));
+  CF_EXPECT(cgroup.Apply(
+      QosLimitsForTier(tier, config.cpus(), config.memory_mb())));
+  LOG(INFO) << "Host processes run in " << cgroup.path() << " with the "
+            << QosTierName(tier) << " QoS tier";
+  process_monitor_properties.JoinCgroup(cgroup.path());
+  return {};
+}
+
 }  // namespace
 
 Result<void> RunCvdMain(int argc, char** argv) {
@@ -218,6 +236,8 @@ Result<void> RunCvdMain(int argc, char** argv) {
     }
   }
 
+  CF_EXPECT(PlaceInQosCgroup(*config, instance, process_monitor_properties));
+
   ProcessMonitor process_monitor(std::move(process_monitor_properties));
 
   CF_EXPECT(process_monitor.StartAndMonitorProcesses());
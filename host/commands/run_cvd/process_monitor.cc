@@ -33,6 +33,7 @@
 
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_select.h"
+#include "host/libs/config/qos.h"
 
 namespace cuttlefish {
 
@@ -66,6 +67,18 @@ ProcessMonitor::Properties ProcessMonitor::Properties::AddCommand(
   return std::move(*this);
 }
 
+ProcessMonitor::Properties& ProcessMonitor::Properties::JoinCgroup(
+    std::string path) & {
+  cgroup_path_ = std::move(path);
+  return *this;
+}
+
+ProcessMonitor::Properties ProcessMonitor::Properties::JoinCgroup(
+    std::string path) && {
+  cgroup_path_ = std::move(path);
+  return std::move(*this);
+}
+
 ProcessMonitor::ProcessMonitor(ProcessMonitor::Properties&& properties)
     : properties_(std::move(properties)), monitor_(-1) {}
 
@@ -88,6 +101,13 @@ Result<void> ProcessMonitor::StopMonitoredProcesses() {
   CF_EXPECT(WIFEXITED(wstatus), "Monitor process exited for unknown reasons");
   CF_EXPECT(WEXITSTATUS(wstatus) == 0,
             "Monitor process exited with code " << WEXITSTATUS(wstatus));
+  if (!properties_.cgroup_path_.empty()) {
+    auto removed = RemoveCgroup(properties_.cgroup_path_);
+    if (!removed.ok()) {
+      // Processes which escaped the monitor may still be running.
+      LOG(WARNING) << removed.error();
+    }
+  }
   return {};
 }
 
@@ -149,6 +169,11 @@ Result<void> ProcessMonitor::MonitorRoutine() {
   prctl(PR_SET_CHILD_SUBREAPER, 1);
   prctl(PR_SET_PDEATHSIG, SIGHUP); // Die when parent dies
 
+  if (!properties_.cgroup_path_.empty()) {
+    auto cgroup = CF_EXPECT(InstanceCgroup::Open(properties_.cgroup_path_));
+    CF_EXPECT(cgroup.AddCurrentProcess());
+  }
+
   LOG(DEBUG) << "Starting monitoring subprocesses";
   for (auto& monitored : properties_.entries_) {
     LOG(INFO) << monitored.cmd->GetShortName();
@@ -17,6 +17,7 @@
 
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -41,6 +42,12 @@ class ProcessMonitor {
     Properties& AddCommand(Command) &;
     Properties AddCommand(Command) &&;
 
+    // The monitor moves itself into the cgroup before starting the
+    // subprocesses, so they all start in it. The cgroup is removed once they
+    // are stopped.
+    Properties& JoinCgroup(std::string) &;
+    Properties JoinCgroup(std::string) &&;
+
     template <typename T>
     Properties& AddCommands(T commands) & {
       for (auto& command : commands) {
@@ -60,6 +67,7 @@ class ProcessMonitor {
    private:
     bool restart_subprocesses_;
     std::vector<MonitorEntry> entries_;
+    std::string cgroup_path_;
 
     friend class ProcessMonitor;
   };
@@ -19,17 +19,14 @@
 
 #include "host/commands/secure_env/primary_key_builder.h"
 #include "host/commands/secure_env/tpm_hmac.h"
-#include "host/libs/config/cuttlefish_config.h"
 
 namespace cuttlefish {
 ConfUiSignServer::ConfUiSignServer(TpmResourceManager& tpm_resource_manager,
-                                   SharedFD server_fd)
-    : tpm_resource_manager_(tpm_resource_manager), server_fd_(server_fd) {
-  auto config = cuttlefish::CuttlefishConfig::Get();
-  CHECK(config) << "Config must not be null";
-  auto instance = config->ForDefaultInstance();
-  server_socket_path_ = instance.PerInstanceInternalPath("confui_sign.sock");
-}
+                                   SharedFD server_fd,
+                                   std::string server_socket_path)
+    : tpm_resource_manager_(tpm_resource_manager),
+      server_socket_path_(std::move(server_socket_path)),
+      server_fd_(server_fd) {}
 
 [[noreturn]] void ConfUiSignServer::MainLoop() {
   while (true) {
@@ -42,49 +39,53 @@ ConfUiSignServer::ConfUiSignServer(TpmResourceManager& tpm_resource_manager,
       LOG(ERROR) << "Confirmation UI host signing client socket is broken.";
       continue;
     }
-    ConfUiSignSender sign_sender(accepted_socket_fd);
+    HandleConnection(accepted_socket_fd);
+  }
+}
 
-    // receive request
-    auto request_opt = sign_sender.Receive();
-    if (!request_opt) {
-      std::string error_category = (sign_sender.IsIoError() ? "IO" : "Logic");
-      LOG(ERROR) << "ReceiveRequest failed with " << error_category << " error";
-      continue;
-    }
-    auto request = request_opt.value();
+void ConfUiSignServer::HandleConnection(SharedFD client) {
+  ConfUiSignSender sign_sender(client);
 
-    // get signing key
-    auto signing_key_builder = PrimaryKeyBuilder();
-    signing_key_builder.SigningKey();
-    signing_key_builder.UniqueData("confirmation_token");
-    auto signing_key = signing_key_builder.CreateKey(tpm_resource_manager_);
-    if (!signing_key) {
-      LOG(ERROR) << "Could not generate signing key";
-      sign_sender.Send(confui::SignMessageError::kUnknownError, {});
-      continue;
-    }
+  // receive request
+  auto request_opt = sign_sender.Receive();
+  if (!request_opt) {
+    std::string error_category = (sign_sender.IsIoError() ? "IO" : "Logic");
+    LOG(ERROR) << "ReceiveRequest failed with " << error_category << " error";
+    return;
+  }
+  auto request = request_opt.value();
 
-    // hmac
-    auto hmac = TpmHmac(tpm_resource_manager_, signing_key->get(),
-                        TpmAuth(ESYS_TR_PASSWORD), request.payload_.data(),
-                        request.payload_.size());
-    if (!hmac) {
-      LOG(ERROR) << "Could not calculate confirmation token hmac";
-      sign_sender.Send(confui::SignMessageError::kUnknownError, {});
-      continue;
-    }
-    if (hmac->size == 0) {
-      LOG(ERROR) << "hmac was too short";
-      sign_sender.Send(confui::SignMessageError::kUnknownError, {});
-      continue;
-    }
+  // get signing key
+  auto signing_key_builder = PrimaryKeyBuilder();
+  signing_key_builder.SigningKey();
+  signing_key_builder.UniqueData("confirmation_token");
+  auto signing_key = signing_key_builder.CreateKey(tpm_resource_manager_);
+  if (!signing_key) {
+    LOG(ERROR) << "Could not generate signing key";
+    sign_sender.Send(confui::SignMessageError::kUnknownError, {});
+    return;
+  }
 
-    // send hmac
-    std::vector<std::uint8_t> hmac_buffer(hmac->buffer,
-                                          hmac->buffer + hmac->size);
-    if (!sign_sender.Send(confui::SignMessageError::kOk, hmac_buffer)) {
-      LOG(ERROR) << "Sending signature failed likely due to I/O error";
-    }
+  // hmac
+  auto hmac = TpmHmac(tpm_resource_manager_, signing_key->get(),
+                      TpmAuth(ESYS_TR_PASSWORD), request.payload_.data(),
+                      request.payload_.size());
+  if (!hmac) {
+    LOG(ERROR) << "Could not calculate confirmation token hmac";
+    sign_sender.Send(confui::SignMessageError::kUnknownError, {});
+    return;
+  }
+  if (hmac->size == 0) {
+    LOG(ERROR) << "hmac was too short";
+    sign_sender.Send(confui::SignMessageError::kUnknownError, {});
+    return;
+  }
+
+  // send hmac
+  std::vector<std::uint8_t> hmac_buffer(hmac->buffer,
+                                        hmac->buffer + hmac->size);
+  if (!sign_sender.Send(confui::SignMessageError::kOk, hmac_buffer)) {
+    LOG(ERROR) << "Sending signature failed likely due to I/O error";
   }
 }
 }  // namespace cuttlefish
@@ -24,9 +24,13 @@
 namespace cuttlefish {
 class ConfUiSignServer {
  public:
+  // server_socket_path is where server_fd is listening, to start over if it
+  // breaks.
   ConfUiSignServer(TpmResourceManager& tpm_resource_manager,
-                   SharedFD server_fd);
+                   SharedFD server_fd, std::string server_socket_path);
   [[noreturn]] void MainLoop();
+  // Signs the request of one client accepted on server_fd.
+  void HandleConnection(SharedFD client);
 
  private:
   TpmResourceManager& tpm_resource_manager_;
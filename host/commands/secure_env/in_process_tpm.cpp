@@ -16,7 +16,12 @@
 #include "in_process_tpm.h"
 
 #include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
 #include <stddef.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <tss2/tss2_esys.h>
 #include <tss2/tss2_rc.h>
@@ -37,7 +42,9 @@ typedef int SOCKET;
 
 #include <android-base/logging.h>
 
+#include <algorithm>
 #include <mutex>
+#include <optional>
 
 namespace cuttlefish {
 
@@ -47,6 +54,102 @@ struct __attribute__((__packed__)) tpm_message_header {
   uint32_t ordinal;
 };
 
+namespace {
+
+struct Segment {
+  char* start;
+  size_t size;
+};
+
+struct SegmentSearch {
+  uintptr_t symbol;
+  bool found;
+  bool main_program;
+  std::vector<Segment> writable;
+};
+
+int FindSimulatorSegments(struct dl_phdr_info* info, size_t, void* data) {
+  auto search = reinterpret_cast<SegmentSearch*>(data);
+  bool contains_symbol = false;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const auto& header = info->dlpi_phdr[i];
+    uintptr_t start = info->dlpi_addr + header.p_vaddr;
+    if (header.p_type == PT_LOAD && search->symbol >= start &&
+        search->symbol < start + header.p_memsz) {
+      contains_symbol = true;
+    }
+  }
+  if (!contains_symbol) {
+    return 0;
+  }
+  search->found = true;
+  // The main program is reported first, with an empty name.
+  search->main_program = info->dlpi_name == nullptr || !*info->dlpi_name;
+  uintptr_t relro_start = 0;
+  uintptr_t relro_end = 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const auto& header = info->dlpi_phdr[i];
+    if (header.p_type == PT_GNU_RELRO) {
+      relro_start = info->dlpi_addr + header.p_vaddr;
+      relro_end = relro_start + header.p_memsz;
+    }
+  }
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const auto& header = info->dlpi_phdr[i];
+    if (header.p_type != PT_LOAD || !(header.p_flags & PF_W)) {
+      continue;
+    }
+    uintptr_t start = info->dlpi_addr + header.p_vaddr;
+    uintptr_t end = start + header.p_memsz;
+    // The read-only after relocation part is mapped read-only by now.
+    if (relro_start <= start && start < relro_end) {
+      start = std::min(relro_end, end);
+    }
+    if (start < end) {
+      search->writable.push_back(
+          Segment{reinterpret_cast<char*>(start), end - start});
+    }
+  }
+  return 1;
+}
+
+/*
+ * Returns the writable data of the library holding the simulator, or nothing
+ * if the simulator is linked into the main program and its globals can't be
+ * told apart from everything else.
+ */
+std::optional<std::vector<Segment>> SimulatorSegments() {
+  SegmentSearch search = {
+      .symbol = reinterpret_cast<uintptr_t>(&_plat__NVEnable),
+      .found = false,
+      .main_program = false,
+      .writable = {},
+  };
+  dl_iterate_phdr(FindSimulatorSegments, &search);
+  if (!search.found || search.main_program) {
+    return {};
+  }
+  return search.writable;
+}
+
+using SimulatorState = std::vector<std::vector<char>>;
+
+void SaveState(const std::vector<Segment>& segments, SimulatorState& state) {
+  state.resize(segments.size());
+  for (size_t i = 0; i < segments.size(); i++) {
+    state[i].assign(segments[i].start, segments[i].start + segments[i].size);
+  }
+}
+
+void RestoreState(const std::vector<Segment>& segments,
+                  const SimulatorState& state) {
+  for (size_t i = 0; i < segments.size(); i++) {
+    memcpy(segments[i].start, state[i].data(), segments[i].size);
+  }
+}
+
+}  // namespace
+
 class InProcessTpm::Impl {
  public:
   static Impl* FromContext(TSS2_TCTI_CONTEXT* context) {
@@ -82,6 +185,8 @@ class InProcessTpm::Impl {
     auto header = reinterpret_cast<tpm_message_header*>(request.data());
     LOG(VERBOSE) << "Sending TPM command "
                 << TpmCommandName(be32toh(header->ordinal));
+    std::lock_guard simulator_lock(simulator_mutex);
+    impl->Activate();
     _IN_BUFFER input = {
         .BufferSize = request.size(),
         .Buffer = request.data(),
@@ -99,30 +204,50 @@ class InProcessTpm::Impl {
     return TSS2_RC_SUCCESS;
   }
 
-  Impl() {
-    {
-      std::lock_guard<std::mutex> lock(global_mutex);
-      // This is a limitation of ms-tpm-20-ref
-      CHECK(!global_instance) << "InProcessTpm internally uses global data, so "
-                              << "only one can exist.";
-      global_instance = this;
-    }
-
+  Impl(const std::string& nv_directory) {
     tcti_context_.v1.magic = 0xFAD;
     tcti_context_.v1.version = 1;
     tcti_context_.v1.transmit = Impl::Transmit;
     tcti_context_.v1.receive = Impl::Receive;
-    _plat__NVEnable(NULL);
-    if (_plat__NVNeedsManufacture()) {
-      // Can't use android logging here due to a macro conflict with TPM
-      // internals
-      LOG(DEBUG) << "Manufacturing TPM state";
-      if (TPM_Manufacture(1)) {
-        LOG(FATAL) << "Failed to manufacture TPM state";
+    {
+      std::lock_guard lock(simulator_mutex);
+      if (!segments) {
+        segments = SimulatorSegments();
+        if (segments) {
+          SaveState(*segments, pristine_state);
+        }
+      }
+      // Without the library data the state can't be swapped, which is a
+      // limitation of ms-tpm-20-ref keeping everything in globals.
+      CHECK(segments || !active) << "InProcessTpm internally uses global data, "
+                                 << "so only one can exist.";
+      if (active) {
+        SaveState(*segments, active->state_);
+      }
+      if (segments) {
+        RestoreState(*segments, pristine_state);
+      }
+      active = this;
+
+      // The simulator opens its NVChip file in the working directory.
+      int old_directory = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      CHECK(old_directory >= 0) << "open(\".\") failed: " << strerror(errno);
+      CHECK(chdir(nv_directory.c_str()) == 0)
+          << "chdir(\"" << nv_directory << "\") failed: " << strerror(errno);
+      _plat__NVEnable(NULL);
+      CHECK(fchdir(old_directory) == 0) << "fchdir failed: " << strerror(errno);
+      close(old_directory);
+      if (_plat__NVNeedsManufacture()) {
+        // Can't use android logging here due to a macro conflict with TPM
+        // internals
+        LOG(DEBUG) << "Manufacturing TPM state";
+        if (TPM_Manufacture(1)) {
+          LOG(FATAL) << "Failed to manufacture TPM state";
+        }
       }
+      _rpc__Signal_PowerOn(false);
+      _rpc__Signal_NvOn();
     }
-    _rpc__Signal_PowerOn(false);
-    _rpc__Signal_NvOn();
 
     ESYS_CONTEXT* esys = nullptr;
     auto rc = Esys_Initialize(&esys, TctiContext(), nullptr);
@@ -156,10 +281,12 @@ class InProcessTpm::Impl {
   }
 
   ~Impl() {
+    std::lock_guard lock(simulator_mutex);
+    Activate();
     _rpc__Signal_NvOff();
     _rpc__Signal_PowerOff();
-    std::lock_guard<std::mutex> lock(global_mutex);
-    global_instance = nullptr;
+    _plat__NVDisable(0);
+    active = nullptr;
   }
 
   TSS2_TCTI_CONTEXT* TctiContext() {
@@ -167,17 +294,35 @@ class InProcessTpm::Impl {
   }
 
  private:
-  static std::mutex global_mutex;
-  static Impl* global_instance;
+  // Swaps this instance's simulator state in. Needs simulator_mutex.
+  void Activate() {
+    if (active == this) {
+      return;
+    }
+    if (active) {
+      SaveState(*segments, active->state_);
+    }
+    RestoreState(*segments, state_);
+    active = this;
+  }
+
+  static std::mutex simulator_mutex;
+  static std::optional<std::vector<Segment>> segments;
+  static SimulatorState pristine_state;
+  static Impl* active;
   TSS2_TCTI_CONTEXT_COMMON_CURRENT tcti_context_;
+  SimulatorState state_;
   std::list<std::vector<uint8_t>> command_queue_;
   std::mutex queue_mutex_;
 };
 
-std::mutex InProcessTpm::Impl::global_mutex;
-InProcessTpm::Impl* InProcessTpm::Impl::global_instance;
+std::mutex InProcessTpm::Impl::simulator_mutex;
+std::optional<std::vector<Segment>> InProcessTpm::Impl::segments;
+SimulatorState InProcessTpm::Impl::pristine_state;
+InProcessTpm::Impl* InProcessTpm::Impl::active;
 
-InProcessTpm::InProcessTpm() : impl_(new Impl()) {}
+InProcessTpm::InProcessTpm(const std::string& nv_directory)
+    : impl_(new Impl(nv_directory)) {}
 
 InProcessTpm::~InProcessTpm() = default;
 
@@ -16,7 +16,9 @@
 #pragma once
 
 #include <list>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include <tss2/tss2_tcti.h>
@@ -29,16 +31,15 @@ namespace cuttlefish {
  * Exposes a TSS2_TCTI_CONTEXT for interacting with an in-process TPM simulator.
  *
  * TSS2_TCTI_CONTEXT is the abstraction for "communication channel to a TPM".
- * It is not safe to create more than one of these per process or per working
- * directory, as the TPM simulator implementation relies heavily on global
- * variables and files saved in the working directory.
- *
- * TODO(schuffelen): Consider moving this to a separate process with its own
- * working directory.
+ * The TPM simulator implementation keeps its state in global variables, all
+ * in the writable data of its shared library. Every instance keeps a copy of
+ * that data and swaps it in before running a command, so instances are
+ * separate TPMs taking turns on the simulator. Each keeps its NV memory in
+ * the NVChip file of its own directory.
  */
 class InProcessTpm : public Tpm {
 public:
-  InProcessTpm();
+  explicit InProcessTpm(const std::string& nv_directory = ".");
   ~InProcessTpm();
 
   TSS2_TCTI_CONTEXT* TctiContext() override;
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/secure_env/in_process_tpm.h"
+
+#include <string.h>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <keymaster/serializable.h>
+
+#include "common/libs/utils/files.h"
+#include "host/commands/secure_env/encrypted_serializable.h"
+#include "host/commands/secure_env/primary_key_builder.h"
+#include "host/commands/secure_env/test_tpm.h"
+#include "host/commands/secure_env/tpm_resource_manager.h"
+
+namespace cuttlefish {
+
+namespace {
+
+std::vector<uint8_t> Encrypt(TpmResourceManager& resource_manager,
+                             keymaster::Buffer& input) {
+  EncryptedSerializable encrypted(resource_manager, ParentKeyCreator("test"),
+                                  input);
+  std::vector<uint8_t> data(encrypted.SerializedSize());
+  encrypted.Serialize(data.data(), data.data() + data.size());
+  return data;
+}
+
+bool Decrypt(TpmResourceManager& resource_manager,
+             const std::vector<uint8_t>& data, keymaster::Buffer& output) {
+  EncryptedSerializable decrypted(resource_manager, ParentKeyCreator("test"),
+                                  output);
+  const uint8_t* data_ptr = data.data();
+  return decrypted.Deserialize(&data_ptr, data_ptr + data.size());
+}
+
+}  // namespace
+
+TEST(InProcessTpm, InstancesKeepSeparateState) {
+  TemporaryDir first_dir;
+  TemporaryDir second_dir;
+  TestTpm first_tpm(first_dir.path);
+  TestTpm second_tpm(second_dir.path);
+  TpmResourceManager first(first_tpm.Esys());
+  TpmResourceManager second(second_tpm.Esys());
+
+  uint8_t input_data[] = {1, 2, 3, 4, 5};
+  keymaster::Buffer input(input_data, sizeof(input_data));
+  auto encrypted = Encrypt(first, input);
+
+  // Each TPM is manufactured with its own seeds, so the other one derives a
+  // different parent key.
+  keymaster::Buffer second_output(sizeof(input_data));
+  ASSERT_FALSE(Decrypt(second, encrypted, second_output));
+
+  keymaster::Buffer first_output(sizeof(input_data));
+  ASSERT_TRUE(Decrypt(first, encrypted, first_output));
+  ASSERT_EQ(0, memcmp(input_data, first_output.begin(), sizeof(input_data)));
+
+  ASSERT_TRUE(FileExists(std::string(first_dir.path) + "/NVChip"));
+  ASSERT_TRUE(FileExists(std::string(second_dir.path) + "/NVChip"));
+}
+
+}  // namespace cuttlefish
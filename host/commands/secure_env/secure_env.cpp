@@ -13,7 +13,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <fruit/fruit.h>
@@ -25,9 +35,11 @@
 #include <tss2/tss2_rc.h>
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_select.h"
 #include "common/libs/security/confui_sign.h"
 #include "common/libs/security/gatekeeper_channel.h"
 #include "common/libs/security/keymaster_channel.h"
+#include "common/libs/utils/tee_logging.h"
 #include "host/commands/kernel_log_monitor/kernel_log_server.h"
 #include "host/commands/kernel_log_monitor/utils.h"
 #include "host/commands/secure_env/confui_sign_server.h"
@@ -39,10 +51,12 @@
 #include "host/commands/secure_env/keymaster_responder.h"
 #include "host/commands/secure_env/proxy_keymaster_context.h"
 #include "host/commands/secure_env/soft_gatekeeper.h"
+#include "host/commands/secure_env/tenant_channels.h"
 #include "host/commands/secure_env/tpm_gatekeeper.h"
 #include "host/commands/secure_env/tpm_keymaster_context.h"
 #include "host/commands/secure_env/tpm_keymaster_enforcement.h"
 #include "host/commands/secure_env/tpm_resource_manager.h"
+#include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/logging.h"
 
 DEFINE_int32(confui_server_fd, -1, "A named socket to serve confirmation UI");
@@ -55,6 +69,9 @@ DEFINE_int32(kernel_events_fd, -1,
              "messages written to the kernel log. This "
              "is used by secure_env to monitor for "
              "device reboots.");
+DEFINE_int32(tenant_server_fd, -1,
+             "A socket the other instances register their guests with, to "
+             "be served by this secure_env too.");
 
 DEFINE_string(tpm_impl,
               "in_memory",
@@ -98,21 +115,6 @@ SharedFD DupFdFlag(gflags::int32 fd) {
   abort();  // LOG(FATAL) isn't marked as noreturn
 }
 
-// Spin up a thread that monitors for a kernel loaded event, then re-execs
-// this process. This way, secure_env's boot tracking matches up with the guest.
-std::thread StartKernelEventMonitor(SharedFD kernel_events_fd) {
-  return std::thread([kernel_events_fd]() {
-    while (kernel_events_fd->IsOpen()) {
-      auto read_result = monitor::ReadEvent(kernel_events_fd);
-      CHECK(read_result.has_value()) << kernel_events_fd->StrError();
-      if (read_result->event == monitor::Event::BootloaderLoaded) {
-        LOG(DEBUG) << "secure_env detected guest reboot, restarting.";
-        ReExecSelf();
-      }
-    }
-  });
-}
-
 fruit::Component<fruit::Required<gatekeeper::SoftGateKeeper, TpmGatekeeper,
                                  TpmResourceManager>,
                  gatekeeper::GateKeeper, keymaster::KeymasterEnforcement>
@@ -140,11 +142,13 @@ ChooseGatekeeperComponent() {
 
 fruit::Component<TpmResourceManager, gatekeeper::GateKeeper,
                  keymaster::KeymasterEnforcement>
-SecureEnvComponent() {
+SecureEnvComponent(const CuttlefishConfig::InstanceSpecific* instance) {
   return fruit::createComponent()
-      .registerProvider([]() -> Tpm* {  // fruit will take ownership
+      .bindInstance(*instance)
+      .registerProvider([](const CuttlefishConfig::InstanceSpecific& instance)
+                            -> Tpm* {  // fruit will take ownership
         if (FLAGS_tpm_impl == "in_memory") {
-          return new InProcessTpm();
+          return new InProcessTpm(instance.instance_dir());
         } else if (FLAGS_tpm_impl == "host_device") {
           return new DeviceTpm("/dev/tpm0");
         } else {
@@ -172,12 +176,15 @@ SecureEnvComponent() {
             return new TpmResourceManager(
                 esys.get());  // fruit will take ownership
           })
-      .registerProvider([](TpmResourceManager& resource_manager) {
-        return new FragileTpmStorage(resource_manager, "gatekeeper_secure");
+      .registerProvider([](const CuttlefishConfig::InstanceSpecific& instance,
+                           TpmResourceManager& resource_manager) {
+        return new FragileTpmStorage(
+            resource_manager, instance.PerInstancePath("gatekeeper_secure"));
       })
-      .registerProvider([](TpmResourceManager& resource_manager) {
-        return new InsecureFallbackStorage(resource_manager,
-                                           "gatekeeper_insecure");
+      .registerProvider([](const CuttlefishConfig::InstanceSpecific& instance,
+                           TpmResourceManager& resource_manager) {
+        return new InsecureFallbackStorage(
+            resource_manager, instance.PerInstancePath("gatekeeper_insecure"));
       })
       .registerProvider([](TpmResourceManager& resource_manager,
                            FragileTpmStorage& secure_storage,
@@ -189,83 +196,279 @@ SecureEnvComponent() {
       .install(ChooseGatekeeperComponent);
 }
 
-}  // namespace
+// What a guest is served with from one boot to the next.
+class TenantBoot {
+ public:
+  TenantBoot(const CuttlefishConfig::InstanceSpecific& instance)
+      : injector_(SecureEnvComponent, &instance) {
+    auto resource_manager = injector_.get<TpmResourceManager*>();
+    auto keymaster_enforcement =
+        injector_.get<keymaster::KeymasterEnforcement*>();
+    if (FLAGS_keymint_impl == "software") {
+      // TODO: See if this is the right KM version.
+      keymaster_context_.reset(new keymaster::PureSoftKeymasterContext(
+          keymaster::KmVersion::KEYMINT_2, KM_SECURITY_LEVEL_SOFTWARE));
+    } else if (FLAGS_keymint_impl == "tpm") {
+      keymaster_context_.reset(
+          new TpmKeymasterContext(*resource_manager, *keymaster_enforcement));
+    } else {
+      LOG(FATAL) << "Unknown keymaster implementation " << FLAGS_keymint_impl;
+    }
+    // keymaster::AndroidKeymaster puts the context pointer into a UniquePtr,
+    // taking ownership.
+    keymaster_.reset(new keymaster::AndroidKeymaster(
+        new ProxyKeymasterContext(*keymaster_context_), kOperationTableSize,
+        keymaster::MessageVersion(keymaster::KmVersion::KEYMINT_2,
+                                  0 /* km_date */)));
+  }
 
-int SecureEnvMain(int argc, char** argv) {
-  DefaultSubprocessLogging(argv);
-  gflags::ParseCommandLineFlags(&argc, &argv, true);
-  keymaster::SoftKeymasterLogger km_logger;
+  TpmResourceManager& ResourceManager() {
+    return *injector_.get<TpmResourceManager*>();
+  }
+  gatekeeper::GateKeeper& Gatekeeper() {
+    return *injector_.get<gatekeeper::GateKeeper*>();
+  }
+  keymaster::AndroidKeymaster& Keymaster() { return *keymaster_; }
 
+ private:
   fruit::Injector<TpmResourceManager, gatekeeper::GateKeeper,
                   keymaster::KeymasterEnforcement>
-      injector(SecureEnvComponent);
-  TpmResourceManager* resource_manager = injector.get<TpmResourceManager*>();
-  gatekeeper::GateKeeper* gatekeeper = injector.get<gatekeeper::GateKeeper*>();
-  keymaster::KeymasterEnforcement* keymaster_enforcement =
-      injector.get<keymaster::KeymasterEnforcement*>();
-
-  std::unique_ptr<keymaster::KeymasterContext> keymaster_context;
-  if (FLAGS_keymint_impl == "software") {
-    // TODO: See if this is the right KM version.
-    keymaster_context.reset(new keymaster::PureSoftKeymasterContext(
-        keymaster::KmVersion::KEYMINT_2, KM_SECURITY_LEVEL_SOFTWARE));
-  } else if (FLAGS_keymint_impl == "tpm") {
-    keymaster_context.reset(
-        new TpmKeymasterContext(*resource_manager, *keymaster_enforcement));
-  } else {
-    LOG(FATAL) << "Unknown keymaster implementation " << FLAGS_keymint_impl;
-    return -1;
-  }
-  // keymaster::AndroidKeymaster puts the context pointer into a UniquePtr,
-  // taking ownership.
-  keymaster::AndroidKeymaster keymaster{
-      new ProxyKeymasterContext(*keymaster_context), kOperationTableSize,
-      keymaster::MessageVersion(keymaster::KmVersion::KEYMINT_2,
-                                0 /* km_date */)};
-
-  auto confui_server_fd = DupFdFlag(FLAGS_confui_server_fd);
-  auto keymaster_in = DupFdFlag(FLAGS_keymaster_fd_in);
-  auto keymaster_out = DupFdFlag(FLAGS_keymaster_fd_out);
-  auto gatekeeper_in = DupFdFlag(FLAGS_gatekeeper_fd_in);
-  auto gatekeeper_out = DupFdFlag(FLAGS_gatekeeper_fd_out);
-  auto kernel_events_fd = DupFdFlag(FLAGS_kernel_events_fd);
-
-  std::vector<std::thread> threads;
-
-  threads.emplace_back([keymaster_in, keymaster_out, &keymaster]() {
-    while (true) {
+      injector_;
+  std::unique_ptr<keymaster::KeymasterContext> keymaster_context_;
+  std::unique_ptr<keymaster::AndroidKeymaster> keymaster_;
+};
+
+// Serves one guest from threads of this process. When the guest reboots,
+// restart is called if set, otherwise the guest's services start over, the
+// way a restarted secure_env would.
+class TenantServer {
+ public:
+  TenantServer(const CuttlefishConfig::InstanceSpecific& instance,
+               const TenantChannels& channels, std::function<void()> restart)
+      : instance_(instance),
+        restart_(std::move(restart)),
+        stop_(SharedFD::Event()),
+        boot_(new TenantBoot(instance_)) {
+    CHECK(stop_->IsOpen()) << "Could not create an eventfd: "
+                           << stop_->StrError();
+    auto keymaster_in = channels.keymaster_in;
+    auto keymaster_out = channels.keymaster_out;
+    Serve(keymaster_in, [keymaster_in, keymaster_out](TenantBoot& boot) {
       KeymasterChannel keymaster_channel(keymaster_in, keymaster_out);
+      KeymasterResponder keymaster_responder(keymaster_channel,
+                                             boot.Keymaster());
+      keymaster_responder.ProcessMessage();
+    });
+    auto gatekeeper_in = channels.gatekeeper_in;
+    auto gatekeeper_out = channels.gatekeeper_out;
+    Serve(gatekeeper_in, [gatekeeper_in, gatekeeper_out](TenantBoot& boot) {
+      GatekeeperChannel gatekeeper_channel(gatekeeper_in, gatekeeper_out);
+      GatekeeperResponder gatekeeper_responder(gatekeeper_channel,
+                                               boot.Gatekeeper());
+      gatekeeper_responder.ProcessMessage();
+    });
+    auto confui_server = channels.confui_server;
+    auto confui_socket_path =
+        instance_.PerInstanceInternalPath("confui_sign.sock");
+    Serve(confui_server, [confui_server, confui_socket_path](TenantBoot& boot) {
+      auto client = SharedFD::Accept(*confui_server);
+      if (!client->IsOpen()) {
+        LOG(ERROR) << "Confirmation UI host signing client socket is broken.";
+        return;
+      }
+      ConfUiSignServer(boot.ResourceManager(), confui_server,
+                       confui_socket_path)
+          .HandleConnection(client);
+    });
+    auto kernel_events = channels.kernel_events;
+    Serve(kernel_events, [this, kernel_events](TenantBoot&) {
+      auto read_result = monitor::ReadEvent(kernel_events);
+      CHECK(read_result.has_value()) << kernel_events->StrError();
+      if (read_result->event == monitor::Event::BootloaderLoaded) {
+        LOG(DEBUG) << "secure_env detected reboot of instance "
+                   << instance_.id() << ", restarting.";
+        restart_pending_ = true;
+      }
+    });
+  }
 
-      KeymasterResponder keymaster_responder(keymaster_channel, keymaster);
+  ~TenantServer() {
+    CHECK(stop_->EventfdWrite(1) == 0) << stop_->StrError();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
 
-      while (keymaster_responder.ProcessMessage()) {
+ private:
+  // Handles messages on channel with the current boot's services until the
+  // server is destroyed.
+  void Serve(SharedFD channel, std::function<void(TenantBoot&)> handle) {
+    threads_.emplace_back([this, channel, handle]() {
+      while (true) {
+        std::vector<PollSharedFd> fds = {
+            {.fd = channel, .events = POLLIN},
+            {.fd = stop_, .events = POLLIN},
+        };
+        if (SharedFD::Poll(fds, -1) < 0) {
+          CHECK(errno == EINTR) << "poll failed: " << strerror(errno);
+          continue;
+        }
+        if (fds[1].revents) {
+          return;
+        }
+        {
+          std::shared_lock lock(boot_mutex_);
+          handle(*boot_);
+        }
+        if (restart_pending_.exchange(false)) {
+          Restart();
+        }
       }
+    });
+  }
+
+  void Restart() {
+    if (restart_) {
+      restart_();
+      return;
     }
-  });
+    std::unique_lock lock(boot_mutex_);
+    // The old TPM lets go of its NV memory before the new one opens it.
+    boot_.reset();
+    boot_.reset(new TenantBoot(instance_));
+  }
 
-  threads.emplace_back([gatekeeper_in, gatekeeper_out, &gatekeeper]() {
-    while (true) {
-      GatekeeperChannel gatekeeper_channel(gatekeeper_in, gatekeeper_out);
+  CuttlefishConfig::InstanceSpecific instance_;
+  std::function<void()> restart_;
+  SharedFD stop_;
+  std::atomic<bool> restart_pending_{false};
+  std::shared_mutex boot_mutex_;
+  std::unique_ptr<TenantBoot> boot_;
+  std::vector<std::thread> threads_;
+};
+
+bool IsConfiguredInstance(const CuttlefishConfig& config,
+                          const std::string& id) {
+  for (const auto& instance : config.Instances()) {
+    if (instance.id() == id) {
+      return true;
+    }
+  }
+  return false;
+}
 
-      GatekeeperResponder gatekeeper_responder(gatekeeper_channel, *gatekeeper);
+// Serves the guest of the instance that started secure_env together with
+// those of the instances registering with tenant_server, each in threads of
+// this process. A registration connection is only read once it has data, so
+// an instance that connects and stalls can't hold up the others.
+int ServeTenants(const CuttlefishConfig& config,
+                 const CuttlefishConfig::InstanceSpecific& instance,
+                 const TenantChannels& channels, SharedFD tenant_server) {
+  struct Registered {
+    std::string instance_id;
+    // Closed by the instance to stop serving its guest.
+    SharedFD registration;
+    std::unique_ptr<TenantServer> server;
+  };
+  TenantServer own(instance, channels, {});
+  std::vector<SharedFD> pending;
+  std::vector<Registered> registered;
 
-      while (gatekeeper_responder.ProcessMessage()) {
+  while (true) {
+    SharedFDSet read_set;
+    read_set.Set(tenant_server);
+    for (const auto& connection : pending) {
+      read_set.Set(connection);
+    }
+    for (const auto& tenant : registered) {
+      read_set.Set(tenant.registration);
+    }
+    if (Select(&read_set, nullptr, nullptr, nullptr) < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      LOG(ERROR) << "select failed: " << strerror(errno);
+      return 1;
     }
-  });
 
-  threads.emplace_back([confui_server_fd, resource_manager]() {
-    ConfUiSignServer confui_sign_server(*resource_manager, confui_server_fd);
-    // no return, infinite loop
-    confui_sign_server.MainLoop();
-  });
-  threads.emplace_back(StartKernelEventMonitor(kernel_events_fd));
-
-  for (auto& t : threads) {
-    t.join();
+    for (auto it = registered.begin(); it != registered.end();) {
+      if (read_set.IsSet(it->registration)) {
+        // Nothing else is sent on it, the instance went away.
+        LOG(DEBUG) << "No longer serving instance " << it->instance_id;
+        it = registered.erase(it);
+      } else {
+        it++;
+      }
+    }
+    for (auto it = pending.begin(); it != pending.end();) {
+      if (!read_set.IsSet(*it)) {
+        it++;
+        continue;
+      }
+      auto registration = *it;
+      it = pending.erase(it);
+      auto tenant = ReceiveTenant(registration);
+      if (!tenant.ok()) {
+        LOG(ERROR) << "Failed to register a tenant: " << tenant.error();
+        continue;
+      }
+      if (!IsConfiguredInstance(config, tenant->instance_id)) {
+        LOG(ERROR) << "Unknown tenant instance \"" << tenant->instance_id
+                   << "\"";
+        continue;
+      }
+      // An instance registering again replaces what it registered before.
+      for (auto old = registered.begin(); old != registered.end(); old++) {
+        if (old->instance_id == tenant->instance_id) {
+          registered.erase(old);
+          break;
+        }
+      }
+      LOG(DEBUG) << "Serving instance " << tenant->instance_id;
+      auto server = std::make_unique<TenantServer>(
+          config.ForInstance(std::stoi(tenant->instance_id)),
+          tenant->channels, std::function<void()>());
+      registered.push_back(Registered{tenant->instance_id, registration,
+                                      std::move(server)});
+    }
+    if (read_set.IsSet(tenant_server)) {
+      auto connection = SharedFD::Accept(*tenant_server);
+      if (connection->IsOpen()) {
+        pending.push_back(connection);
+      } else {
+        LOG(ERROR) << "Failed to accept a tenant: " << connection->StrError();
+      }
+    }
   }
+}
 
-  return 0;
+}  // namespace
+
+int SecureEnvMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CuttlefishConfig::Get();
+  CHECK(config) << "Could not open cuttlefish config";
+  auto instance = config->ForDefaultInstance();
+
+  TenantChannels channels;
+  channels.confui_server = DupFdFlag(FLAGS_confui_server_fd);
+  channels.keymaster_in = DupFdFlag(FLAGS_keymaster_fd_in);
+  channels.keymaster_out = DupFdFlag(FLAGS_keymaster_fd_out);
+  channels.gatekeeper_in = DupFdFlag(FLAGS_gatekeeper_fd_in);
+  channels.gatekeeper_out = DupFdFlag(FLAGS_gatekeeper_fd_out);
+  channels.kernel_events = DupFdFlag(FLAGS_kernel_events_fd);
+
+  if (FLAGS_tenant_server_fd < 0) {
+    TenantServer server(instance, channels, ReExecSelf);
+    // The server's threads run until the process is replaced or killed.
+    while (true) {
+      pause();
+    }
+  }
+  return ServeTenants(*config, instance, channels,
+                      DupFdFlag(FLAGS_tenant_server_fd));
 }
 
 }  // namespace cuttlefish
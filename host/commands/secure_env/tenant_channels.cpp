@@ -0,0 +1,59 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/secure_env/tenant_channels.h"
+
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/unix_sockets.h"
+
+namespace cuttlefish {
+
+Result<void> SendTenant(SharedFD connection, const Tenant& tenant) {
+  CF_EXPECT(connection->IsOpen(), connection->StrError());
+  const auto& channels = tenant.channels;
+  std::vector<SharedFD> fds = {
+      channels.keymaster_in,  channels.keymaster_out,
+      channels.gatekeeper_in, channels.gatekeeper_out,
+      channels.confui_server, channels.kernel_events,
+  };
+  UnixSocketMessage message;
+  message.data.assign(tenant.instance_id.begin(), tenant.instance_id.end());
+  message.control.emplace_back(
+      CF_EXPECT(ControlMessage::FromFileDescriptors(fds)));
+  CF_EXPECT(UnixMessageSocket(connection).WriteMessage(message));
+  return {};
+}
+
+Result<Tenant> ReceiveTenant(SharedFD connection) {
+  CF_EXPECT(connection->IsOpen(), connection->StrError());
+  auto message = CF_EXPECT(UnixMessageSocket(connection).ReadMessage());
+  CF_EXPECT(!message.data.empty(), "Tenant registration without an instance");
+  auto fds = CF_EXPECT(message.FileDescriptors());
+  CF_EXPECT(fds.size() == 6,
+            "Expected 6 tenant file descriptors, got " << fds.size());
+  Tenant tenant;
+  tenant.instance_id = std::string(message.data.begin(), message.data.end());
+  tenant.channels.keymaster_in = fds[0];
+  tenant.channels.keymaster_out = fds[1];
+  tenant.channels.gatekeeper_in = fds[2];
+  tenant.channels.gatekeeper_out = fds[3];
+  tenant.channels.confui_server = fds[4];
+  tenant.channels.kernel_events = fds[5];
+  return tenant;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,46 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <string>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// The file descriptors secure_env serves one guest over.
+struct TenantChannels {
+  SharedFD keymaster_in;
+  SharedFD keymaster_out;
+  SharedFD gatekeeper_in;
+  SharedFD gatekeeper_out;
+  SharedFD confui_server;
+  SharedFD kernel_events;
+};
+
+// A guest served by a secure_env started for another instance.
+struct Tenant {
+  std::string instance_id;
+  TenantChannels channels;
+};
+
+// Registers a guest with a shared secure_env over a connection to its tenant
+// server. The guest is served until the connection is closed.
+Result<void> SendTenant(SharedFD connection, const Tenant& tenant);
+Result<Tenant> ReceiveTenant(SharedFD connection);
+
+}  // namespace cuttlefish
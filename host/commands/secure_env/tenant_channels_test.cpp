@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/secure_env/tenant_channels.h"
+
+#include <sys/socket.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+
+TEST(TenantChannels, RegistrationRoundTrip) {
+  SharedFD registration, tenant_server;
+  ASSERT_TRUE(SharedFD::SocketPair(AF_UNIX, SOCK_SEQPACKET, 0, &registration,
+                                   &tenant_server));
+
+  // Every channel is a pipe, to tell them apart by what goes through them.
+  std::vector<SharedFD> read_ends(6), write_ends(6);
+  for (int i = 0; i < 6; i++) {
+    ASSERT_TRUE(SharedFD::Pipe(&read_ends[i], &write_ends[i]));
+  }
+  Tenant sent;
+  sent.instance_id = "2";
+  sent.channels.keymaster_in = write_ends[0];
+  sent.channels.keymaster_out = write_ends[1];
+  sent.channels.gatekeeper_in = write_ends[2];
+  sent.channels.gatekeeper_out = write_ends[3];
+  sent.channels.confui_server = write_ends[4];
+  sent.channels.kernel_events = write_ends[5];
+  ASSERT_TRUE(SendTenant(registration, sent).ok());
+
+  auto received = ReceiveTenant(tenant_server);
+  ASSERT_TRUE(received.ok()) << received.error();
+  ASSERT_EQ(received->instance_id, "2");
+  std::vector<SharedFD> channels = {
+      received->channels.keymaster_in,  received->channels.keymaster_out,
+      received->channels.gatekeeper_in, received->channels.gatekeeper_out,
+      received->channels.confui_server, received->channels.kernel_events,
+  };
+  for (int i = 0; i < 6; i++) {
+    char byte = 'a' + i;
+    ASSERT_EQ(channels[i]->Write(&byte, 1), 1);
+    char read_byte = 0;
+    ASSERT_EQ(read_ends[i]->Read(&read_byte, 1), 1);
+    ASSERT_EQ(read_byte, byte);
+  }
+}
+
+TEST(TenantChannels, ClosedRegistration) {
+  SharedFD registration, tenant_server;
+  ASSERT_TRUE(SharedFD::SocketPair(AF_UNIX, SOCK_SEQPACKET, 0, &registration,
+                                   &tenant_server));
+  registration->Close();
+  ASSERT_FALSE(ReceiveTenant(tenant_server).ok());
+}
+
+}  // namespace cuttlefish
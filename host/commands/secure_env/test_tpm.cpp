@@ -21,7 +21,7 @@
 
 namespace cuttlefish {
 
-TestTpm::TestTpm() {
+TestTpm::TestTpm(const std::string& nv_directory) : tpm_(nv_directory) {
   auto rc = Esys_Initialize(&esys_, tpm_.TctiContext(), nullptr);
   if (rc != TPM2_RC_SUCCESS) {
     LOG(FATAL) << "Could not initialize esys: " << Tss2_RC_Decode(rc) << " ("
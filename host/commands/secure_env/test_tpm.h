@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <string>
+
 #include <tss2/tss2_esys.h>
 
 #include "host/commands/secure_env/in_process_tpm.h"
@@ -22,7 +24,7 @@ namespace cuttlefish {
 
 class TestTpm {
  public:
-  TestTpm();
+  explicit TestTpm(const std::string& nv_directory = ".");
   ~TestTpm();
 
   ESYS_CONTEXT* Esys();
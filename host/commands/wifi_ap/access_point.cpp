@@ -0,0 +1,509 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/wifi_ap/access_point.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cuttlefish {
+namespace {
+
+// IEEE 802.11-2016 9.2.4.1, frame control
+constexpr uint8_t kTypeManagement = 0;
+constexpr uint8_t kTypeControl = 1;
+constexpr uint8_t kTypeData = 2;
+
+constexpr uint8_t kSubtypeAssocRequest = 0;
+constexpr uint8_t kSubtypeAssocResponse = 1;
+constexpr uint8_t kSubtypeReassocRequest = 2;
+constexpr uint8_t kSubtypeReassocResponse = 3;
+constexpr uint8_t kSubtypeProbeRequest = 4;
+constexpr uint8_t kSubtypeProbeResponse = 5;
+constexpr uint8_t kSubtypeBeacon = 8;
+constexpr uint8_t kSubtypeDisassoc = 10;
+constexpr uint8_t kSubtypeAuth = 11;
+constexpr uint8_t kSubtypeDeauth = 12;
+constexpr uint8_t kSubtypePsPoll = 10;
+
+constexpr uint8_t kFlagToDs = 0x01;
+constexpr uint8_t kFlagFromDs = 0x02;
+constexpr uint8_t kFlagPowerManagement = 0x10;
+constexpr uint8_t kFlagMoreData = 0x20;
+constexpr uint8_t kFlagProtected = 0x40;
+constexpr uint8_t kFlagOrder = 0x80;
+
+constexpr uint8_t kElementSsid = 0;
+constexpr uint8_t kElementRates = 1;
+constexpr uint8_t kElementDsParams = 3;
+constexpr uint8_t kElementTim = 5;
+constexpr uint8_t kElementErp = 42;
+constexpr uint8_t kElementExtendedRates = 50;
+
+constexpr uint16_t kStatusSuccess = 0;
+constexpr uint16_t kStatusFailure = 1;
+constexpr uint16_t kStatusUnsupportedAuthAlgorithm = 13;
+constexpr uint16_t kStatusApFull = 17;
+
+constexpr uint16_t kReasonClass2FromUnauthenticated = 6;
+constexpr uint16_t kReasonClass3FromUnassociated = 7;
+
+// ESS, short slot time
+constexpr uint16_t kCapabilities = 0x0401;
+constexpr uint16_t kBeaconIntervalTu = 100;
+
+// 1, 2, 5.5 and 11 Mbps basic rates, then the 802.11g ones
+const std::vector<uint8_t> kRates = {0x82, 0x84, 0x8b, 0x96,
+                                     0x0c, 0x12, 0x18, 0x24};
+const std::vector<uint8_t> kExtendedRates = {0x30, 0x48, 0x60, 0x6c};
+
+const MacAddress kBroadcast = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+// RFC 1042 and 802.1H (bridge tunnel) SNAP headers
+const uint8_t kRfc1042[] = {0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00};
+const uint8_t kBridgeTunnel[] = {0xaa, 0xaa, 0x03, 0x00, 0x00, 0xf8};
+
+constexpr size_t kHeaderLen = 24;
+constexpr size_t kMaxBuffered = 64;
+
+bool IsGroup(const MacAddress& address) { return address[0] & 1; }
+
+MacAddress AddressAt(const std::vector<uint8_t>& frame, size_t offset) {
+  MacAddress address;
+  std::copy_n(frame.begin() + offset, address.size(), address.begin());
+  return address;
+}
+
+void Append16(std::vector<uint8_t>& frame, uint16_t value) {
+  frame.push_back(value & 0xff);
+  frame.push_back(value >> 8);
+}
+
+uint16_t Read16(const uint8_t* data) { return data[0] | (data[1] << 8); }
+
+void AppendAddress(std::vector<uint8_t>& frame, const MacAddress& address) {
+  frame.insert(frame.end(), address.begin(), address.end());
+}
+
+void AppendElement(std::vector<uint8_t>& frame, uint8_t id,
+                   const std::vector<uint8_t>& data) {
+  frame.push_back(id);
+  frame.push_back(data.size());
+  frame.insert(frame.end(), data.begin(), data.end());
+}
+
+void Enqueue(std::deque<std::vector<uint8_t>>& queue,
+             std::vector<uint8_t> frame) {
+  if (queue.size() == kMaxBuffered) {
+    queue.pop_front();
+  }
+  queue.emplace_back(std::move(frame));
+}
+
+}  // namespace
+
+AccessPoint::AccessPoint(AccessPointConfig config)
+    : config_(std::move(config)) {}
+
+uint32_t AccessPoint::Frequency() const {
+  return config_.channel == 14 ? 2484 : 2407 + 5 * config_.channel;
+}
+
+size_t AccessPoint::AssociatedStations() const {
+  return std::count_if(stations_.begin(), stations_.end(),
+                       [](const auto& entry) { return entry.second.associated; });
+}
+
+void AccessPoint::Beacon(uint64_t timestamp_us, Output* out) {
+  auto beacon = ManagementHeader(kSubtypeBeacon, kBroadcast);
+  for (int i = 0; i < 8; i++) {
+    beacon.push_back((timestamp_us >> (8 * i)) & 0xff);
+  }
+  Append16(beacon, kBeaconIntervalTu);
+  Append16(beacon, kCapabilities);
+  AppendElements(beacon, true);
+  out->wireless.emplace_back(std::move(beacon));
+
+  // Every beacon is a DTIM, so the group frames follow it.
+  while (!group_buffered_.empty()) {
+    auto frame = std::move(group_buffered_.front());
+    group_buffered_.pop_front();
+    if (!group_buffered_.empty()) {
+      frame[1] |= kFlagMoreData;
+    }
+    out->wireless.emplace_back(std::move(frame));
+  }
+}
+
+void AccessPoint::OnWirelessFrame(const std::vector<uint8_t>& frame,
+                                  Output* out) {
+  if (frame.size() < 16) {
+    return;
+  }
+  uint8_t type = (frame[0] >> 2) & 3;
+  uint8_t subtype = frame[0] >> 4;
+  uint8_t flags = frame[1];
+  auto receiver = AddressAt(frame, 4);
+  auto sender = AddressAt(frame, 10);
+  if (sender == config_.bssid) {
+    return;
+  }
+
+  if (type == kTypeControl) {
+    if (subtype == kSubtypePsPoll && receiver == config_.bssid) {
+      OnPsPoll(sender, out);
+    }
+    return;
+  }
+  if (frame.size() < kHeaderLen) {
+    return;
+  }
+  bool to_us = receiver == config_.bssid;
+  if (to_us && (type == kTypeData || type == kTypeManagement)) {
+    SetPowerSave(sender, flags & kFlagPowerManagement, out);
+  }
+
+  const uint8_t* body = frame.data() + kHeaderLen;
+  size_t body_len = frame.size() - kHeaderLen;
+  if (type == kTypeManagement) {
+    if (subtype == kSubtypeProbeRequest && (to_us || IsGroup(receiver))) {
+      OnProbeRequest(sender, body, body_len, out);
+      return;
+    }
+    if (!to_us || AddressAt(frame, 16) != config_.bssid) {
+      return;
+    }
+    switch (subtype) {
+      case kSubtypeAuth:
+        OnAuthentication(sender, body, body_len, out);
+        break;
+      case kSubtypeAssocRequest:
+        OnAssociation(sender, false, body, body_len, out);
+        break;
+      case kSubtypeReassocRequest:
+        OnAssociation(sender, true, body, body_len, out);
+        break;
+      case kSubtypeDisassoc:
+        if (stations_.count(sender)) {
+          stations_[sender] = Station{};
+        }
+        break;
+      case kSubtypeDeauth:
+        stations_.erase(sender);
+        break;
+      default:
+        break;
+    }
+  } else if (type == kTypeData && to_us) {
+    OnData(sender, frame, out);
+  }
+}
+
+void AccessPoint::OnEthernetFrame(const std::vector<uint8_t>& frame,
+                                  Output* out) {
+  if (frame.size() < 14) {
+    return;
+  }
+  auto dest = AddressAt(frame, 0);
+  auto source = AddressAt(frame, 6);
+  // 802.3 length fields instead of EtherTypes aren't bridged.
+  if (((frame[12] << 8) | frame[13]) < 0x0600) {
+    return;
+  }
+  if (!IsGroup(dest)) {
+    auto it = stations_.find(dest);
+    if (it == stations_.end() || !it->second.associated) {
+      return;
+    }
+  }
+  SendData(dest, source, frame.data() + 12, frame.size() - 12, out);
+}
+
+void AccessPoint::OnProbeRequest(const MacAddress& sender, const uint8_t* body,
+                                 size_t len, Output* out) {
+  if (!SsidMatches(body, len, true)) {
+    return;
+  }
+  auto response = ManagementHeader(kSubtypeProbeResponse, sender);
+  response.insert(response.end(), 8, 0);  // timestamp
+  Append16(response, kBeaconIntervalTu);
+  Append16(response, kCapabilities);
+  AppendElements(response, false);
+  out->wireless.emplace_back(std::move(response));
+}
+
+void AccessPoint::OnAuthentication(const MacAddress& sender,
+                                   const uint8_t* body, size_t len,
+                                   Output* out) {
+  if (len < 6) {
+    return;
+  }
+  uint16_t algorithm = Read16(body);
+  uint16_t sequence = Read16(body + 2);
+  if (sequence != 1) {
+    return;
+  }
+  uint16_t status = kStatusSuccess;
+  if (algorithm != 0) {
+    // Only open system authentication
+    status = kStatusUnsupportedAuthAlgorithm;
+  } else if (!stations_.count(sender) && stations_.size() >= kMaxStations) {
+    status = kStatusApFull;
+  } else {
+    // Authenticating again ends any association.
+    stations_[sender] = Station{};
+  }
+  auto response = ManagementHeader(kSubtypeAuth, sender);
+  Append16(response, algorithm);
+  Append16(response, 2);
+  Append16(response, status);
+  out->wireless.emplace_back(std::move(response));
+}
+
+void AccessPoint::OnAssociation(const MacAddress& sender, bool reassociation,
+                                const uint8_t* body, size_t len, Output* out) {
+  auto it = stations_.find(sender);
+  if (it == stations_.end()) {
+    Deauthenticate(sender, kReasonClass2FromUnauthenticated, out);
+    return;
+  }
+  // Capabilities, listen interval and, on reassociation, the current AP
+  size_t fixed_len = reassociation ? 10 : 4;
+  if (len < fixed_len) {
+    return;
+  }
+  auto& station = it->second;
+  uint16_t status = kStatusSuccess;
+  if (!SsidMatches(body + fixed_len, len - fixed_len, false)) {
+    status = kStatusFailure;
+  } else if (!station.associated) {
+    station.aid = FreeAid();
+    station.associated = true;
+  }
+  auto response = ManagementHeader(
+      reassociation ? kSubtypeReassocResponse : kSubtypeAssocResponse, sender);
+  Append16(response, kCapabilities);
+  Append16(response, status);
+  Append16(response, status == kStatusSuccess ? (station.aid | 0xc000) : 0);
+  AppendElement(response, kElementRates, kRates);
+  AppendElement(response, kElementExtendedRates, kExtendedRates);
+  out->wireless.emplace_back(std::move(response));
+}
+
+void AccessPoint::OnData(const MacAddress& sender,
+                         const std::vector<uint8_t>& frame, Output* out) {
+  uint8_t subtype = frame[0] >> 4;
+  uint8_t flags = frame[1];
+  auto it = stations_.find(sender);
+  if (it == stations_.end() || !it->second.associated) {
+    Deauthenticate(sender, kReasonClass3FromUnassociated, out);
+    return;
+  }
+  // Only frames to the distribution system, unencrypted as the network is
+  // open. Null function frames carry nothing but the power management bit.
+  if ((flags & (kFlagToDs | kFlagFromDs)) != kFlagToDs ||
+      (flags & kFlagProtected) || (subtype & 0x4)) {
+    return;
+  }
+  size_t header_len = kHeaderLen;
+  if (subtype & 0x8) {
+    // QoS control, and the HT control that the order bit adds to it
+    header_len += 2 + ((flags & kFlagOrder) ? 4 : 0);
+  }
+  if (frame.size() < header_len + sizeof(kRfc1042) + 2) {
+    return;
+  }
+  const uint8_t* llc = frame.data() + header_len;
+  if (memcmp(llc, kRfc1042, sizeof(kRfc1042)) != 0 &&
+      memcmp(llc, kBridgeTunnel, sizeof(kBridgeTunnel)) != 0) {
+    return;
+  }
+  const uint8_t* payload = llc + sizeof(kRfc1042);
+  size_t payload_len = frame.data() + frame.size() - payload;
+  auto dest = AddressAt(frame, 16);
+
+  auto dest_station = stations_.find(dest);
+  bool to_station =
+      dest_station != stations_.end() && dest_station->second.associated;
+  if (IsGroup(dest) || to_station) {
+    // Stations talking to each other never leave the wireless side.
+    SendData(dest, sender, payload, payload_len, out);
+  }
+  if (IsGroup(dest) || !to_station) {
+    std::vector<uint8_t> ethernet;
+    AppendAddress(ethernet, dest);
+    AppendAddress(ethernet, sender);
+    ethernet.insert(ethernet.end(), payload, payload + payload_len);
+    out->ethernet.emplace_back(std::move(ethernet));
+  }
+}
+
+void AccessPoint::OnPsPoll(const MacAddress& sender, Output* out) {
+  auto it = stations_.find(sender);
+  if (it == stations_.end() || !it->second.associated) {
+    return;
+  }
+  auto& buffered = it->second.buffered;
+  if (buffered.empty()) {
+    return;
+  }
+  auto frame = std::move(buffered.front());
+  buffered.pop_front();
+  if (!buffered.empty()) {
+    frame[1] |= kFlagMoreData;
+  }
+  out->wireless.emplace_back(std::move(frame));
+}
+
+void AccessPoint::SetPowerSave(const MacAddress& sender, bool power_save,
+                               Output* out) {
+  auto it = stations_.find(sender);
+  if (it == stations_.end() || !it->second.associated) {
+    return;
+  }
+  auto& station = it->second;
+  station.power_save = power_save;
+  if (!power_save) {
+    while (!station.buffered.empty()) {
+      out->wireless.emplace_back(std::move(station.buffered.front()));
+      station.buffered.pop_front();
+    }
+  }
+}
+
+void AccessPoint::SendData(const MacAddress& dest, const MacAddress& source,
+                           const uint8_t* payload, size_t len, Output* out) {
+  std::vector<uint8_t> frame;
+  frame.push_back(kTypeData << 2);
+  frame.push_back(kFlagFromDs);
+  Append16(frame, 0);  // duration
+  AppendAddress(frame, dest);
+  AppendAddress(frame, config_.bssid);
+  AppendAddress(frame, source);
+  Append16(frame, (sequence_++ & 0xfff) << 4);
+  frame.insert(frame.end(), std::begin(kRfc1042), std::end(kRfc1042));
+  frame.insert(frame.end(), payload, payload + len);
+  Deliver(std::move(frame), dest, out);
+}
+
+void AccessPoint::Deliver(std::vector<uint8_t> frame, const MacAddress& dest,
+                          Output* out) {
+  if (IsGroup(dest)) {
+    if (AnyInPowerSave()) {
+      Enqueue(group_buffered_, std::move(frame));
+    } else {
+      out->wireless.emplace_back(std::move(frame));
+    }
+    return;
+  }
+  auto& station = stations_[dest];
+  if (station.power_save) {
+    Enqueue(station.buffered, std::move(frame));
+  } else {
+    out->wireless.emplace_back(std::move(frame));
+  }
+}
+
+void AccessPoint::Deauthenticate(const MacAddress& dest, uint16_t reason,
+                                 Output* out) {
+  auto frame = ManagementHeader(kSubtypeDeauth, dest);
+  Append16(frame, reason);
+  out->wireless.emplace_back(std::move(frame));
+}
+
+std::vector<uint8_t> AccessPoint::ManagementHeader(uint8_t subtype,
+                                                   const MacAddress& dest) {
+  std::vector<uint8_t> frame;
+  frame.push_back((subtype << 4) | (kTypeManagement << 2));
+  frame.push_back(0);
+  Append16(frame, 0);  // duration
+  AppendAddress(frame, dest);
+  AppendAddress(frame, config_.bssid);
+  AppendAddress(frame, config_.bssid);
+  Append16(frame, (sequence_++ & 0xfff) << 4);
+  return frame;
+}
+
+void AccessPoint::AppendElements(std::vector<uint8_t>& frame, bool tim) {
+  AppendElement(frame, kElementSsid,
+                std::vector<uint8_t>(config_.ssid.begin(), config_.ssid.end()));
+  AppendElement(frame, kElementRates, kRates);
+  AppendElement(frame, kElementDsParams,
+                {static_cast<uint8_t>(config_.channel)});
+  if (tim) {
+    // DTIM count and period, then the bitmap control, whose first bit tells
+    // group frames follow, and the partial virtual bitmap from AID 0.
+    std::vector<uint8_t> element = {0, 1, 0};
+    if (!group_buffered_.empty()) {
+      element[2] |= 1;
+    }
+    std::vector<uint8_t> bitmap(kMaxStations / 8 + 1, 0);
+    for (const auto& [address, station] : stations_) {
+      if (station.associated && !station.buffered.empty()) {
+        bitmap[station.aid / 8] |= 1 << (station.aid % 8);
+      }
+    }
+    // Trailing zeros are left out, though one octet is always present.
+    while (bitmap.size() > 1 && bitmap.back() == 0) {
+      bitmap.pop_back();
+    }
+    element.insert(element.end(), bitmap.begin(), bitmap.end());
+    AppendElement(frame, kElementTim, element);
+  }
+  AppendElement(frame, kElementErp, {0});
+  AppendElement(frame, kElementExtendedRates, kExtendedRates);
+}
+
+bool AccessPoint::SsidMatches(const uint8_t* elements, size_t len,
+                              bool allow_wildcard) {
+  size_t pos = 0;
+  while (pos + 2 <= len) {
+    uint8_t id = elements[pos];
+    uint8_t element_len = elements[pos + 1];
+    if (pos + 2 + element_len > len) {
+      return false;
+    }
+    if (id == kElementSsid) {
+      if (element_len == 0) {
+        return allow_wildcard;
+      }
+      return std::string(elements + pos + 2,
+                         elements + pos + 2 + element_len) == config_.ssid;
+    }
+    pos += 2 + element_len;
+  }
+  return false;
+}
+
+uint16_t AccessPoint::FreeAid() const {
+  for (uint16_t aid = 1; aid <= kMaxStations; aid++) {
+    bool used = std::any_of(
+        stations_.begin(), stations_.end(), [aid](const auto& entry) {
+          return entry.second.associated && entry.second.aid == aid;
+        });
+    if (!used) {
+      return aid;
+    }
+  }
+  // Authentication turns stations away before they get here.
+  return kMaxStations;
+}
+
+bool AccessPoint::AnyInPowerSave() const {
+  return std::any_of(stations_.begin(), stations_.end(),
+                     [](const auto& entry) { return entry.second.power_save; });
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "host/commands/wifi_ap/hwsim_netlink.h"
+
+namespace cuttlefish {
+
+struct AccessPointConfig {
+  std::string ssid;
+  int channel = 6;
+  MacAddress bssid = {};
+};
+
+/**
+ * An open 802.11g access point that bridges its stations to an Ethernet link,
+ * in place of the OpenWrt AP. It only deals in frames: the caller moves them
+ * between the wireless medium and the link, and calls Beacon() every
+ * kBeaconInterval.
+ *
+ * Stations in power save mode get their frames buffered, announced in the
+ * beacons' TIM and delivered on PS-Poll or when they wake up. Group frames are
+ * buffered while any station is in power save and sent after each beacon, as
+ * every beacon is a DTIM.
+ */
+class AccessPoint {
+ public:
+  static constexpr std::chrono::microseconds kBeaconInterval{102400};
+  static constexpr uint16_t kMaxStations = 32;
+
+  struct Output {
+    std::vector<std::vector<uint8_t>> wireless;
+    std::vector<std::vector<uint8_t>> ethernet;
+  };
+
+  AccessPoint(AccessPointConfig config);
+
+  uint32_t Frequency() const;
+  size_t AssociatedStations() const;
+
+  void Beacon(uint64_t timestamp_us, Output* out);
+  void OnWirelessFrame(const std::vector<uint8_t>& frame, Output* out);
+  void OnEthernetFrame(const std::vector<uint8_t>& frame, Output* out);
+
+ private:
+  struct Station {
+    bool associated = false;
+    uint16_t aid = 0;
+    bool power_save = false;
+    std::deque<std::vector<uint8_t>> buffered;
+  };
+
+  void OnProbeRequest(const MacAddress& sender, const uint8_t* body,
+                      size_t len, Output* out);
+  void OnAuthentication(const MacAddress& sender, const uint8_t* body,
+                        size_t len, Output* out);
+  void OnAssociation(const MacAddress& sender, bool reassociation,
+                     const uint8_t* body, size_t len, Output* out);
+  void OnData(const MacAddress& sender, const std::vector<uint8_t>& frame,
+              Output* out);
+  void OnPsPoll(const MacAddress& sender, Output* out);
+  void SetPowerSave(const MacAddress& sender, bool power_save, Output* out);
+
+  // Sends an Ethernet payload (EtherType included) from |source| to |dest|.
+  void SendData(const MacAddress& dest, const MacAddress& source,
+                const uint8_t* payload, size_t len, Output* out);
+  void Deliver(std::vector<uint8_t> frame, const MacAddress& dest,
+               Output* out);
+  void Deauthenticate(const MacAddress& dest, uint16_t reason, Output* out);
+
+  std::vector<uint8_t> ManagementHeader(uint8_t subtype,
+                                        const MacAddress& dest);
+  void AppendElements(std::vector<uint8_t>& frame, bool tim);
+  bool SsidMatches(const uint8_t* elements, size_t len, bool allow_wildcard);
+  uint16_t FreeAid() const;
+  bool AnyInPowerSave() const;
+
+  AccessPointConfig config_;
+  uint16_t sequence_ = 0;
+  std::map<MacAddress, Station> stations_;
+  std::deque<std::vector<uint8_t>> group_buffered_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "host/commands/wifi_ap/access_point.h"
+#include "host/commands/wifi_ap/hwsim_netlink.h"
+
+namespace cuttlefish {
+namespace {
+
+const MacAddress kBssid = {0x02, 0, 0, 0, 0, 0};
+const MacAddress kStation = {0x02, 0x15, 0xb2, 0, 0, 0};
+const MacAddress kOtherStation = {0x02, 0x15, 0xb2, 0, 0, 1};
+const MacAddress kHost = {0x52, 0x54, 0, 0x12, 0x34, 0x56};
+const MacAddress kBroadcast = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+const std::string kSsid = "VirtWifi";
+
+std::vector<uint8_t> Header(uint8_t fc0, uint8_t fc1, const MacAddress& a1,
+                            const MacAddress& a2, const MacAddress& a3) {
+  std::vector<uint8_t> frame = {fc0, fc1, 0, 0};
+  frame.insert(frame.end(), a1.begin(), a1.end());
+  frame.insert(frame.end(), a2.begin(), a2.end());
+  frame.insert(frame.end(), a3.begin(), a3.end());
+  frame.insert(frame.end(), {0, 0});
+  return frame;
+}
+
+std::vector<uint8_t> SsidElement(const std::string& ssid) {
+  std::vector<uint8_t> element = {0, static_cast<uint8_t>(ssid.size())};
+  element.insert(element.end(), ssid.begin(), ssid.end());
+  return element;
+}
+
+MacAddress Address(const std::vector<uint8_t>& frame, size_t offset) {
+  MacAddress address;
+  std::copy_n(frame.begin() + offset, 6, address.begin());
+  return address;
+}
+
+std::vector<uint8_t> DataFrame(const MacAddress& sender, const MacAddress& dest,
+                               uint8_t fc1 = 0x01) {
+  auto frame = Header(0x08, fc1, kBssid, sender, dest);
+  frame.insert(frame.end(), {0xaa, 0xaa, 0x03, 0, 0, 0, 0x08, 0x00, 'h', 'i'});
+  return frame;
+}
+
+class AccessPointTest : public testing::Test {
+ protected:
+  AccessPointTest() : ap_(AccessPointConfig{kSsid, 6, kBssid}) {}
+
+  void Associate(const MacAddress& station) {
+    AccessPoint::Output out;
+    auto auth = Header(0xb0, 0, kBssid, station, kBssid);
+    auth.insert(auth.end(), {0, 0, 1, 0, 0, 0});
+    ap_.OnWirelessFrame(auth, &out);
+    auto assoc = Header(0x00, 0, kBssid, station, kBssid);
+    assoc.insert(assoc.end(), {0x01, 0x04, 0x0a, 0x00});
+    auto ssid = SsidElement(kSsid);
+    assoc.insert(assoc.end(), ssid.begin(), ssid.end());
+    ap_.OnWirelessFrame(assoc, &out);
+  }
+
+  AccessPoint ap_;
+};
+
+TEST_F(AccessPointTest, Beacons) {
+  AccessPoint::Output out;
+  ap_.Beacon(0, &out);
+  ASSERT_EQ(out.wireless.size(), 1);
+  auto& beacon = out.wireless[0];
+  ASSERT_EQ(beacon[0], 0x80);
+  ASSERT_EQ(Address(beacon, 4), kBroadcast);
+  ASSERT_EQ(Address(beacon, 10), kBssid);
+  auto ssid = SsidElement(kSsid);
+  ASSERT_TRUE(std::equal(ssid.begin(), ssid.end(), beacon.begin() + 36));
+  ASSERT_EQ(ap_.Frequency(), 2437);
+}
+
+TEST_F(AccessPointTest, AnswersProbes) {
+  AccessPoint::Output out;
+  auto probe = Header(0x40, 0, kBroadcast, kStation, kBroadcast);
+  probe.insert(probe.end(), {0, 0});
+  ap_.OnWirelessFrame(probe, &out);
+  ASSERT_EQ(out.wireless.size(), 1);
+  ASSERT_EQ(out.wireless[0][0], 0x50);
+  ASSERT_EQ(Address(out.wireless[0], 4), kStation);
+
+  out = {};
+  probe = Header(0x40, 0, kBroadcast, kStation, kBroadcast);
+  auto ssid = SsidElement("OtherWifi");
+  probe.insert(probe.end(), ssid.begin(), ssid.end());
+  ap_.OnWirelessFrame(probe, &out);
+  ASSERT_TRUE(out.wireless.empty());
+}
+
+TEST_F(AccessPointTest, Associates) {
+  AccessPoint::Output out;
+  auto auth = Header(0xb0, 0, kBssid, kStation, kBssid);
+  auth.insert(auth.end(), {0, 0, 1, 0, 0, 0});
+  ap_.OnWirelessFrame(auth, &out);
+  ASSERT_EQ(out.wireless.size(), 1);
+  ASSERT_EQ(out.wireless[0][0], 0xb0);
+  // Sequence 2, success
+  ASSERT_EQ(out.wireless[0][26], 2);
+  ASSERT_EQ(out.wireless[0][28], 0);
+
+  out = {};
+  auto assoc = Header(0x00, 0, kBssid, kStation, kBssid);
+  assoc.insert(assoc.end(), {0x01, 0x04, 0x0a, 0x00});
+  auto ssid = SsidElement(kSsid);
+  assoc.insert(assoc.end(), ssid.begin(), ssid.end());
+  ap_.OnWirelessFrame(assoc, &out);
+  ASSERT_EQ(out.wireless.size(), 1);
+  ASSERT_EQ(out.wireless[0][0], 0x10);
+  ASSERT_EQ(out.wireless[0][26], 0);
+  ASSERT_EQ(out.wireless[0][28], 1);
+  ASSERT_EQ(out.wireless[0][29], 0xc0);
+  ASSERT_EQ(ap_.AssociatedStations(), 1);
+
+  out = {};
+  auto deauth = Header(0xc0, 0, kBssid, kStation, kBssid);
+  deauth.insert(deauth.end(), {3, 0});
+  ap_.OnWirelessFrame(deauth, &out);
+  ASSERT_EQ(ap_.AssociatedStations(), 0);
+}
+
+TEST_F(AccessPointTest, DeauthenticatesUnassociatedSenders) {
+  AccessPoint::Output out;
+  ap_.OnWirelessFrame(DataFrame(kStation, kHost), &out);
+  ASSERT_TRUE(out.ethernet.empty());
+  ASSERT_EQ(out.wireless.size(), 1);
+  ASSERT_EQ(out.wireless[0][0], 0xc0);
+  ASSERT_EQ(out.wireless[0][24], 7);
+}
+
+TEST_F(AccessPointTest, BridgesData) {
+  Associate(kStation);
+  AccessPoint::Output out;
+  ap_.OnWirelessFrame(DataFrame(kStation, kHost), &out);
+  ASSERT_TRUE(out.wireless.empty());
+  ASSERT_EQ(out.ethernet.size(), 1);
+  std::vector<uint8_t> expected(kHost.begin(), kHost.end());
+  expected.insert(expected.end(), kStation.begin(), kStation.end());
+  expected.insert(expected.end(), {0x08, 0x00, 'h', 'i'});
+  ASSERT_EQ(out.ethernet[0], expected);
+
+  out = {};
+  std::vector<uint8_t> reply(kStation.begin(), kStation.end());
+  reply.insert(reply.end(), kHost.begin(), kHost.end());
+  reply.insert(reply.end(), {0x08, 0x00, 'h', 'o'});
+  ap_.OnEthernetFrame(reply, &out);
+  ASSERT_EQ(out.wireless.size(), 1);
+  auto& frame = out.wireless[0];
+  ASSERT_EQ(frame[0], 0x08);
+  ASSERT_EQ(frame[1], 0x02);
+  ASSERT_EQ(Address(frame, 4), kStation);
+  ASSERT_EQ(Address(frame, 10), kBssid);
+  ASSERT_EQ(Address(frame, 16), kHost);
+  ASSERT_EQ(std::vector<uint8_t>(frame.begin() + 24, frame.end()),
+            std::vector<uint8_t>({0xaa, 0xaa, 0x03, 0, 0, 0, 0x08, 0x00, 'h',
+                                  'o'}));
+
+  // Unknown destinations stay off the air.
+  out = {};
+  std::copy(kOtherStation.begin(), kOtherStation.end(), reply.begin());
+  ap_.OnEthernetFrame(reply, &out);
+  ASSERT_TRUE(out.wireless.empty());
+}
+
+TEST_F(AccessPointTest, RelaysBetweenStations) {
+  Associate(kStation);
+  Associate(kOtherStation);
+  AccessPoint::Output out;
+  ap_.OnWirelessFrame(DataFrame(kStation, kOtherStation), &out);
+  ASSERT_TRUE(out.ethernet.empty());
+  ASSERT_EQ(out.wireless.size(), 1);
+  ASSERT_EQ(Address(out.wireless[0], 4), kOtherStation);
+  ASSERT_EQ(Address(out.wireless[0], 16), kStation);
+
+  out = {};
+  ap_.OnWirelessFrame(DataFrame(kStation, kBroadcast), &out);
+  ASSERT_EQ(out.ethernet.size(), 1);
+  ASSERT_EQ(out.wireless.size(), 1);
+}
+
+TEST_F(AccessPointTest, BuffersForStationsInPowerSave) {
+  Associate(kStation);
+  AccessPoint::Output out;
+  // A null function frame with the power management bit set
+  ap_.OnWirelessFrame(Header(0x48, 0x11, kBssid, kStation, kBssid), &out);
+  ASSERT_TRUE(out.wireless.empty());
+
+  std::vector<uint8_t> packet(kStation.begin(), kStation.end());
+  packet.insert(packet.end(), kHost.begin(), kHost.end());
+  packet.insert(packet.end(), {0x08, 0x00, 'h', 'o'});
+  ap_.OnEthernetFrame(packet, &out);
+  ap_.OnEthernetFrame(packet, &out);
+  std::vector<uint8_t> broadcast(kBroadcast.begin(), kBroadcast.end());
+  broadcast.insert(broadcast.end(), kHost.begin(), kHost.end());
+  broadcast.insert(broadcast.end(), {0x08, 0x06, 'h', 'o'});
+  ap_.OnEthernetFrame(broadcast, &out);
+  ASSERT_TRUE(out.wireless.empty());
+
+  // The TIM announces the group frames and AID 1's.
+  ap_.Beacon(0, &out);
+  ASSERT_EQ(out.wireless.size(), 2);
+  auto& beacon = out.wireless[0];
+  std::vector<uint8_t> tim = {5, 4, 0, 1, 1, 0x02};
+  ASSERT_NE(std::search(beacon.begin(), beacon.end(), tim.begin(), tim.end()),
+            beacon.end());
+  ASSERT_EQ(Address(out.wireless[1], 4), kBroadcast);
+
+  out = {};
+  std::vector<uint8_t> ps_poll = {0xa4, 0x10, 0x01, 0xc0};
+  ps_poll.insert(ps_poll.end(), kBssid.begin(), kBssid.end());
+  ps_poll.insert(ps_poll.end(), kStation.begin(), kStation.end());
+  ap_.OnWirelessFrame(ps_poll, &out);
+  ASSERT_EQ(out.wireless.size(), 1);
+  ASSERT_EQ(out.wireless[0][1], 0x22);
+
+  // Waking up flushes the rest.
+  out = {};
+  ap_.OnWirelessFrame(Header(0x48, 0x01, kBssid, kStation, kBssid), &out);
+  ASSERT_EQ(out.wireless.size(), 1);
+  ASSERT_EQ(out.wireless[0][1], 0x02);
+}
+
+TEST(HwsimNetlinkTest, RoundTrips) {
+  std::vector<uint8_t> frame = {0x80, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                0xff, 2,  0, 0, 0, 0,    0};
+  auto netlink = HwsimTxFrame(0x1d, kBssid, frame, 2437, 7);
+  auto message = ParseHwsimMessage(netlink);
+  ASSERT_TRUE(message.ok()) << message.error();
+  ASSERT_EQ(message->family, 0x1d);
+  ASSERT_EQ(message->command, HwsimCommand::kFrame);
+  ASSERT_EQ(message->transmitter, kBssid);
+  ASSERT_EQ(message->frame, frame);
+  ASSERT_EQ(message->frequency, 2437);
+}
+
+TEST(HwsimNetlinkTest, ParsesMacAddresses) {
+  auto address = ParseMacAddress("02:15:b2:00:00:01");
+  ASSERT_TRUE(address.ok());
+  ASSERT_EQ(*address, kOtherStation);
+  ASSERT_EQ(MacAddressToString(*address), "02:15:b2:00:00:01");
+  ASSERT_FALSE(ParseMacAddress("02:15:b2:00:00").ok());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/wifi_ap/hwsim_netlink.h"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+namespace {
+
+// Attributes of include/uapi/linux/mac80211_hwsim.h
+constexpr uint16_t kAttrAddrReceiver = 1;
+constexpr uint16_t kAttrAddrTransmitter = 2;
+constexpr uint16_t kAttrFrame = 3;
+constexpr uint16_t kAttrFlags = 4;
+constexpr uint16_t kAttrSignal = 6;
+constexpr uint16_t kAttrTxInfo = 7;
+constexpr uint16_t kAttrCookie = 8;
+constexpr uint16_t kAttrFreq = 19;
+
+constexpr uint32_t kTxCtlReqTxStatus = 1 << 0;
+constexpr uint32_t kTxCtlNoAck = 1 << 1;
+
+constexpr size_t kNlMsgHdrLen = 16;
+constexpr size_t kGenlMsgHdrLen = 4;
+constexpr size_t kNlAttrHdrLen = 4;
+
+size_t Align4(size_t len) { return (len + 3) & ~size_t(3); }
+
+template <typename T>
+void Append(std::string& buf, const T& value) {
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendAttr(std::string& buf, uint16_t type, const void* data,
+                size_t len) {
+  Append(buf, static_cast<uint16_t>(kNlAttrHdrLen + len));
+  Append(buf, type);
+  buf.append(reinterpret_cast<const char*>(data), len);
+  buf.append(Align4(len) - len, '\0');
+}
+
+template <typename T>
+void AppendAttr(std::string& buf, uint16_t type, const T& value) {
+  AppendAttr(buf, type, &value, sizeof(value));
+}
+
+template <typename T>
+Result<T> AttrValue(const char* data, size_t len) {
+  CF_EXPECT(len >= sizeof(T), "Attribute too short");
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+}  // namespace
+
+Result<MacAddress> ParseMacAddress(const std::string& str) {
+  auto bytes = android::base::Split(str, ":");
+  CF_EXPECT(bytes.size() == 6, "Invalid MAC address \"" << str << "\"");
+  MacAddress address;
+  for (size_t i = 0; i < address.size(); i++) {
+    CF_EXPECT(android::base::ParseUint("0x" + bytes[i], &address[i]),
+              "Invalid MAC address \"" << str << "\"");
+  }
+  return address;
+}
+
+std::string MacAddressToString(const MacAddress& address) {
+  std::stringstream str;
+  str << std::hex << std::setfill('0');
+  for (size_t i = 0; i < address.size(); i++) {
+    str << (i ? ":" : "") << std::setw(2) << static_cast<int>(address[i]);
+  }
+  return str.str();
+}
+
+Result<HwsimMessage> ParseHwsimMessage(const std::string& netlink) {
+  CF_EXPECT(netlink.size() >= kNlMsgHdrLen + kGenlMsgHdrLen,
+            "Netlink message too short: " << netlink.size());
+  auto len = CF_EXPECT(AttrValue<uint32_t>(netlink.data(), 4));
+  CF_EXPECT(len >= kNlMsgHdrLen + kGenlMsgHdrLen && len <= netlink.size(),
+            "Invalid netlink message length " << len);
+
+  HwsimMessage message;
+  message.family = CF_EXPECT(AttrValue<uint16_t>(netlink.data() + 4, 2));
+  message.command = static_cast<HwsimCommand>(netlink[kNlMsgHdrLen]);
+
+  size_t pos = kNlMsgHdrLen + kGenlMsgHdrLen;
+  while (pos + kNlAttrHdrLen <= len) {
+    auto attr_len = CF_EXPECT(AttrValue<uint16_t>(netlink.data() + pos, 2));
+    auto attr_type =
+        CF_EXPECT(AttrValue<uint16_t>(netlink.data() + pos + 2, 2));
+    CF_EXPECT(attr_len >= kNlAttrHdrLen && pos + attr_len <= len,
+              "Invalid netlink attribute length " << attr_len);
+    const char* data = netlink.data() + pos + kNlAttrHdrLen;
+    size_t data_len = attr_len - kNlAttrHdrLen;
+    switch (attr_type) {
+      case kAttrAddrReceiver:
+        message.receiver = CF_EXPECT(AttrValue<MacAddress>(data, data_len));
+        break;
+      case kAttrAddrTransmitter:
+        message.transmitter = CF_EXPECT(AttrValue<MacAddress>(data, data_len));
+        break;
+      case kAttrFrame:
+        message.frame.assign(data, data + data_len);
+        break;
+      case kAttrFreq:
+        message.frequency = CF_EXPECT(AttrValue<uint32_t>(data, data_len));
+        break;
+      case kAttrSignal:
+        message.signal = CF_EXPECT(AttrValue<int32_t>(data, data_len));
+        break;
+      default:
+        break;
+    }
+    pos += Align4(attr_len);
+  }
+  return message;
+}
+
+std::string HwsimTxFrame(uint16_t family, const MacAddress& transmitter,
+                         const std::vector<uint8_t>& frame, uint32_t frequency,
+                         uint64_t cookie) {
+  // The first byte of the receiver address, after frame control and duration
+  bool group = frame.size() >= 10 && (frame[4] & 1);
+
+  std::string attrs;
+  AppendAttr(attrs, kAttrAddrTransmitter, transmitter);
+  AppendAttr(attrs, kAttrFrame, frame.data(), frame.size());
+  AppendAttr(attrs, kAttrFlags, group ? kTxCtlNoAck : kTxCtlReqTxStatus);
+  // Single attempt at the lowest rate, the rest of the table unused
+  struct {
+    int8_t idx;
+    uint8_t count;
+  } tx_info[4] = {{0, 1}, {-1, 0}, {-1, 0}, {-1, 0}};
+  AppendAttr(attrs, kAttrTxInfo, tx_info);
+  AppendAttr(attrs, kAttrCookie, cookie);
+  AppendAttr(attrs, kAttrFreq, frequency);
+
+  std::string netlink;
+  Append(netlink, static_cast<uint32_t>(kNlMsgHdrLen + kGenlMsgHdrLen +
+                                        attrs.size()));
+  Append(netlink, family);
+  Append(netlink, static_cast<uint16_t>(0));  // flags
+  Append(netlink, static_cast<uint32_t>(0));  // seq
+  Append(netlink, static_cast<uint32_t>(0));  // pid
+  Append(netlink, static_cast<uint8_t>(HwsimCommand::kFrame));
+  Append(netlink, static_cast<uint8_t>(1));   // version
+  Append(netlink, static_cast<uint16_t>(0));  // reserved
+  netlink += attrs;
+  return netlink;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+using MacAddress = std::array<uint8_t, 6>;
+
+Result<MacAddress> ParseMacAddress(const std::string& str);
+std::string MacAddressToString(const MacAddress& address);
+
+// The mac80211_hwsim generic netlink messages wmediumd exchanges with the
+// radios on the medium, see include/uapi/linux/mac80211_hwsim.h.
+enum class HwsimCommand : uint8_t {
+  kFrame = 2,
+  kTxInfoFrame = 3,
+};
+
+struct HwsimMessage {
+  // The generic netlink family, echoed in the messages sent back
+  uint16_t family = 0;
+  HwsimCommand command = HwsimCommand::kFrame;
+  // Radio the frame is delivered to, set on received frames
+  MacAddress receiver = {};
+  // Radio that sent the frame, set on transmission status reports
+  MacAddress transmitter = {};
+  std::vector<uint8_t> frame;
+  uint32_t frequency = 0;
+  int32_t signal = 0;
+};
+
+Result<HwsimMessage> ParseHwsimMessage(const std::string& netlink);
+
+// Builds the message transmitting |frame| from the radio |transmitter|.
+// Broadcast frames are sent without waiting for an acknowledgement.
+std::string HwsimTxFrame(uint16_t family, const MacAddress& transmitter,
+                         const std::vector<uint8_t>& frame, uint32_t frequency,
+                         uint64_t cookie);
+
+}  // namespace cuttlefish
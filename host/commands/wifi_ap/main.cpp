@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/if_tun.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_select.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/wifi_ap/access_point.h"
+#include "host/commands/wifi_ap/hwsim_netlink.h"
+#include "host/libs/config/logging.h"
+#include "host/libs/wmediumd_controller/wmediumd_api_protocol.h"
+
+DEFINE_string(wmediumd_api_server, "",
+              "The wmediumd API socket the access point's radio attaches to.");
+DEFINE_int32(tap_fd, -1, "The tap interface the stations are bridged to.");
+DEFINE_string(ssid, "VirtWifi", "The network name.");
+DEFINE_int32(channel, 6, "The 2.4GHz channel the access point runs on.");
+DEFINE_string(bssid, "02:00:00:00:00:00", "The access point's BSSID.");
+DEFINE_string(radio_mac, "",
+              "The address of the access point's radio on the medium. "
+              "Defaults to the BSSID with the locally administered bit 6 set, "
+              "as mac80211_hwsim derives it.");
+
+namespace cuttlefish {
+namespace {
+
+// The virtio_net_hdr the tap interfaces are opened with, see
+// common/libs/utils/network.cpp. The access point neither sends nor accepts
+// offloaded packets, so it is all zeros.
+constexpr size_t kVnetHeaderLen = 12;
+constexpr size_t kMaxFrameLen = 65536;
+// The first dynamically allocated generic netlink family
+constexpr uint16_t kGenlMinId = 0x10;
+// wmediumd is started alongside the access point, so its API socket may not
+// exist yet.
+constexpr auto kConnectTimeout = std::chrono::seconds(30);
+constexpr auto kMaxConnectBackoff = std::chrono::seconds(2);
+
+using Clock = std::chrono::steady_clock;
+
+class WifiAp {
+ public:
+  WifiAp(AccessPointConfig config, MacAddress radio, SharedFD wmediumd,
+         SharedFD tap)
+      : ap_(std::move(config)),
+        radio_(radio),
+        wmediumd_(wmediumd),
+        tap_(tap),
+        start_(Clock::now()),
+        next_beacon_(start_) {}
+
+  Result<void> Run() {
+    CF_EXPECT(SendAll(wmediumd_, WmediumdMessageRegister().Serialize()),
+              "Failed to register with wmediumd: " << wmediumd_->StrError());
+    while (true) {
+      auto now = Clock::now();
+      if (now >= next_beacon_) {
+        AccessPoint::Output out;
+        ap_.Beacon(Microseconds(now), &out);
+        CF_EXPECT(Send(out));
+        next_beacon_ += AccessPoint::kBeaconInterval;
+        if (next_beacon_ <= now) {
+          // Fell behind, e.g. the host was suspended.
+          next_beacon_ = now + AccessPoint::kBeaconInterval;
+        }
+        continue;
+      }
+      auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+          next_beacon_ - now);
+      struct timeval timeout = {
+          .tv_sec = static_cast<time_t>(wait.count() / 1000000),
+          .tv_usec = static_cast<suseconds_t>(wait.count() % 1000000),
+      };
+      SharedFDSet read_set;
+      read_set.Set(wmediumd_);
+      read_set.Set(tap_);
+      auto ready = Select(&read_set, nullptr, nullptr, &timeout);
+      CF_EXPECT(ready >= 0 || errno == EINTR,
+                "select() failed: " << strerror(errno));
+      if (ready <= 0) {
+        continue;
+      }
+      if (read_set.IsSet(wmediumd_)) {
+        CF_EXPECT(OnWmediumdMessage());
+      }
+      if (read_set.IsSet(tap_)) {
+        CF_EXPECT(OnTapFrame());
+      }
+    }
+  }
+
+ private:
+  uint64_t Microseconds(Clock::time_point time) const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - start_)
+        .count();
+  }
+
+  Result<void> OnWmediumdMessage() {
+    auto header = RecvAll(wmediumd_, sizeof(uint32_t) * 2);
+    CF_EXPECT(header.size() == sizeof(uint32_t) * 2,
+              "Lost the connection to wmediumd");
+    uint32_t type, len;
+    memcpy(&type, header.data(), sizeof(type));
+    memcpy(&len, header.data() + sizeof(type), sizeof(len));
+    auto body = RecvAll(wmediumd_, len);
+    CF_EXPECT(body.size() == len, "Lost the connection to wmediumd");
+
+    // The acknowledgements of the messages sent to wmediumd arrive here too.
+    // They are not waited for: wmediumd itself blocks on the acknowledgement of
+    // every frame it delivers, so doing so could deadlock.
+    if (static_cast<WmediumdMessageType>(type) != WmediumdMessageType::kNetlink) {
+      return {};
+    }
+    CF_EXPECT(SendAll(wmediumd_, WmediumdMessageAck().Serialize()),
+              "Failed to acknowledge a frame: " << wmediumd_->StrError());
+
+    auto message = ParseHwsimMessage(body);
+    if (!message.ok()) {
+      LOG(DEBUG) << "Dropping a malformed netlink message: "
+                 << message.error();
+      return {};
+    }
+    // Transmission status reports aren't retried on, so they are of no use.
+    if (message->command != HwsimCommand::kFrame ||
+        message->receiver != radio_) {
+      return {};
+    }
+    family_ = message->family;
+    AccessPoint::Output out;
+    ap_.OnWirelessFrame(message->frame, &out);
+    CF_EXPECT(Send(out));
+    return {};
+  }
+
+  Result<void> OnTapFrame() {
+    std::vector<uint8_t> buffer(kMaxFrameLen);
+    auto bytes_read = tap_->Read(buffer.data(), buffer.size());
+    if (bytes_read < 0 && tap_->GetErrno() == EAGAIN) {
+      return {};
+    }
+    CF_EXPECT(bytes_read >= 0,
+              "Failed to read from the tap: " << tap_->StrError());
+    if (bytes_read < static_cast<ssize_t>(kVnetHeaderLen)) {
+      return {};
+    }
+    std::vector<uint8_t> frame(buffer.begin() + kVnetHeaderLen,
+                               buffer.begin() + bytes_read);
+    AccessPoint::Output out;
+    ap_.OnEthernetFrame(frame, &out);
+    CF_EXPECT(Send(out));
+    return {};
+  }
+
+  Result<void> Send(const AccessPoint::Output& out) {
+    for (const auto& frame : out.wireless) {
+      auto netlink =
+          HwsimTxFrame(family_, radio_, frame, ap_.Frequency(), ++cookie_);
+      CF_EXPECT(SendAll(wmediumd_, WmediumdMessageNetlink(netlink).Serialize()),
+                "Failed to send a frame: " << wmediumd_->StrError());
+    }
+    for (const auto& frame : out.ethernet) {
+      std::vector<uint8_t> packet(kVnetHeaderLen, 0);
+      packet.insert(packet.end(), frame.begin(), frame.end());
+      if (tap_->Write(packet.data(), packet.size()) < 0) {
+        // The bridge is best effort, like the wireless medium.
+        LOG(DEBUG) << "Failed to write to the tap: " << tap_->StrError();
+      }
+    }
+    return {};
+  }
+
+  AccessPoint ap_;
+  MacAddress radio_;
+  SharedFD wmediumd_;
+  SharedFD tap_;
+  Clock::time_point start_;
+  Clock::time_point next_beacon_;
+  // wmediumd goes by the command rather than the family, which is echoed from
+  // the frames received once there are any.
+  uint16_t family_ = kGenlMinId;
+  uint64_t cookie_ = 0;
+};
+
+Result<SharedFD> ConnectToWmediumd(const std::string& path) {
+  auto deadline = Clock::now() + kConnectTimeout;
+  std::chrono::milliseconds backoff(100);
+  while (true) {
+    auto wmediumd = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+    if (wmediumd->IsOpen()) {
+      return wmediumd;
+    }
+    CF_EXPECT(Clock::now() + backoff < deadline,
+              "Cannot connect to wmediumd at " << path << ": "
+                                               << wmediumd->StrError());
+    LOG(DEBUG) << "wmediumd is not up yet: " << wmediumd->StrError();
+    std::this_thread::sleep_for(backoff);
+    backoff = std::min<std::chrono::milliseconds>(2 * backoff,
+                                                  kMaxConnectBackoff);
+  }
+}
+
+Result<void> WifiApMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  CF_EXPECT(!FLAGS_wmediumd_api_server.empty(),
+            "--wmediumd_api_server is required");
+  CF_EXPECT(FLAGS_channel >= 1 && FLAGS_channel <= 14,
+            "Invalid --channel=" << FLAGS_channel);
+  CF_EXPECT(FLAGS_ssid.size() <= 32, "--ssid is longer than 32 bytes");
+
+  AccessPointConfig config;
+  config.ssid = FLAGS_ssid;
+  config.channel = FLAGS_channel;
+  config.bssid = CF_EXPECT(ParseMacAddress(FLAGS_bssid));
+  MacAddress radio = config.bssid;
+  if (FLAGS_radio_mac.empty()) {
+    radio[0] |= 0x40;
+  } else {
+    radio = CF_EXPECT(ParseMacAddress(FLAGS_radio_mac));
+  }
+
+  auto tap = SharedFD::Dup(FLAGS_tap_fd);
+  CF_EXPECT(tap->IsOpen(), "Error dupping --tap_fd=" << FLAGS_tap_fd << ": "
+                                                     << tap->StrError());
+  close(FLAGS_tap_fd);
+  // Offloaded packets would need segmenting before going on the air.
+  CF_EXPECT(tap->Ioctl(TUNSETOFFLOAD, nullptr) >= 0,
+            "Failed to disable the tap's offloads: " << tap->StrError());
+
+  auto wmediumd = CF_EXPECT(ConnectToWmediumd(FLAGS_wmediumd_api_server));
+
+  LOG(INFO) << "Serving \"" << config.ssid << "\" on channel "
+            << config.channel << " from " << MacAddressToString(radio);
+  WifiAp ap(std::move(config), radio, wmediumd, tap);
+  CF_EXPECT(ap.Run());
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  signal(SIGPIPE, SIG_IGN);
+  auto result = cuttlefish::WifiApMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
@@ -33,8 +33,24 @@ async function ConnectDevice(deviceId, serverConnector) {
     }
   }, intervalMs);
 
+  // The video quality can be picked with the video_content and video_profile
+  // URL parameters, e.g. ?video_content=text&video_profile=constrained
+  let params = new URLSearchParams(location.search);
+  let videoQuality = {};
+  if (params.has('video_content')) {
+    videoQuality.content = params.get('video_content');
+  }
+  if (params.has('video_profile')) {
+    videoQuality.profile = params.get('video_profile');
+  }
+  let options = {};
+  if (Object.keys(videoQuality).length > 0) {
+    options.videoQuality = videoQuality;
+  }
+
   let module = await import('./cf_webrtc.js');
-  let deviceConnection = await module.Connect(deviceId, serverConnector);
+  let deviceConnection =
+      await module.Connect(deviceId, serverConnector, options);
   console.info('Connected to ' + deviceId);
   clearInterval(connectionInterval);
   return deviceConnection;
@@ -348,11 +348,30 @@ class DeviceConnection {
     this.#pc.addEventListener(
         'connectionstatechange', evt => cb(this.#pc.connectionState));
   }
+
+  // Changes how the displays are encoded for this client, e.g.
+  // {content: 'text', profile: 'constrained', max_bitrate_kbps: 600}. Content
+  // is one of 'auto', 'text', 'detail' or 'motion', profile one of 'default',
+  // 'lan' or 'constrained'.
+  setVideoQuality(videoQuality) {
+    this.#control.setVideoQuality(videoQuality);
+  }
+
+  // The callback receives a message per display, with its label, the video
+  // quality in use and the display's outbound RTP stats.
+  onVideoStats(cb) {
+    this.#control.onVideoStats(cb);
+  }
+
+  requestVideoStats() {
+    this.#control.requestVideoStats();
+  }
 }
 
 class Controller {
   #pc;
   #serverConnector;
+  #onVideoStats;
 
   constructor(serverConnector) {
     this.#serverConnector = serverConnector;
@@ -375,6 +394,11 @@ class Controller {
             candidate: message.candidate
           }));
         break;
+      case 'video-stats':
+        if (this.#onVideoStats) {
+          this.#onVideoStats(message);
+        }
+        break;
       case 'error':
         console.error('Device responded with error message: ', message.error);
         break;
@@ -422,7 +446,7 @@ class Controller {
     this.#pc.addIceCandidate(iceCandidate);
   }
 
-  ConnectDevice(pc) {
+  ConnectDevice(pc, videoQuality) {
     this.#pc = pc;
     console.debug('ConnectDevice');
     // ICE candidates will be generated when we add the offer. Adding it here
@@ -432,7 +456,23 @@ class Controller {
     this.#pc.addEventListener('icecandidate', evt => {
       if (evt.candidate) this.#sendIceCandidate(evt.candidate);
     });
-    this.#serverConnector.sendToDevice({type: 'request-offer'});
+    let request = {type: 'request-offer'};
+    if (videoQuality) {
+      request.video_quality = videoQuality;
+    }
+    this.#serverConnector.sendToDevice(request);
+  }
+
+  setVideoQuality(videoQuality) {
+    this.#serverConnector.sendToDevice({...videoQuality, type: 'video-quality'});
+  }
+
+  onVideoStats(cb) {
+    this.#onVideoStats = cb;
+  }
+
+  requestVideoStats() {
+    this.#serverConnector.sendToDevice({type: 'get-video-stats'});
   }
 
   async renegotiateConnection() {
@@ -464,7 +504,9 @@ function createPeerConnection(infra_config) {
   return pc;
 }
 
-export async function Connect(deviceId, serverConnector) {
+// Options may hold the initial videoQuality, see
+// DeviceConnection.setVideoQuality.
+export async function Connect(deviceId, serverConnector, options = {}) {
   let requestRet = await serverConnector.requestDevice(deviceId);
   let deviceInfo = requestRet.deviceInfo;
   let infraConfig = requestRet.infraConfig;
@@ -491,6 +533,6 @@ export async function Connect(deviceId, serverConnector) {
         reject(evt);
       }
     });
-    control.ConnectDevice(pc);
+    control.ConnectDevice(pc, options.videoQuality);
   });
 }
@@ -29,7 +29,6 @@
 #include <json/json.h>
 
 #include <android-base/logging.h>
-#include <gflags/gflags.h>
 
 #include "common/libs/confui/confui.h"
 #include "common/libs/fs/shared_buf.h"
@@ -39,17 +38,8 @@
 #include "host/frontend/webrtc/lib/utils.h"
 #include "host/libs/config/cuttlefish_config.h"
 
-DECLARE_bool(write_virtio_input);
-
 namespace cuttlefish {
 
-// TODO (b/147511234): de-dup this from vnc server and here
-struct virtio_input_event {
-  uint16_t type;
-  uint16_t code;
-  int32_t value;
-};
-
 struct multitouch_slot {
   int32_t id;
   int32_t slot;
@@ -57,40 +47,6 @@ struct multitouch_slot {
   int32_t y;
 };
 
-struct InputEventBuffer {
-  virtual ~InputEventBuffer() = default;
-  virtual void AddEvent(uint16_t type, uint16_t code, int32_t value) = 0;
-  virtual size_t size() const = 0;
-  virtual const void *data() const = 0;
-};
-
-template <typename T>
-struct InputEventBufferImpl : public InputEventBuffer {
-  InputEventBufferImpl() {
-    buffer_.reserve(6);  // 6 is usually enough
-  }
-  void AddEvent(uint16_t type, uint16_t code, int32_t value) override {
-    buffer_.push_back({.type = type, .code = code, .value = value});
-  }
-  T *data() { return buffer_.data(); }
-  const void *data() const override { return buffer_.data(); }
-  std::size_t size() const override { return buffer_.size() * sizeof(T); }
-
- private:
-  std::vector<T> buffer_;
-};
-
-// TODO: we could add an arg here to specify whether we want the multitouch buffer?
-std::unique_ptr<InputEventBuffer> GetEventBuffer() {
-  if (FLAGS_write_virtio_input) {
-    return std::unique_ptr<InputEventBuffer>(
-        new InputEventBufferImpl<virtio_input_event>());
-  } else {
-    return std::unique_ptr<InputEventBuffer>(
-        new InputEventBufferImpl<input_event>());
-  }
-}
-
 /**
  * connection observer implementation for regular android mode.
  * i.e. when it is not in the confirmation UI mode (or TEE),
@@ -100,14 +56,14 @@ class ConnectionObserverImpl
     : public cuttlefish::webrtc_streaming::ConnectionObserver {
  public:
   ConnectionObserverImpl(
-      cuttlefish::InputSockets &input_sockets,
+      cuttlefish::InputEngine &input_engine,
       cuttlefish::KernelLogEventsHandler *kernel_log_events_handler,
       std::map<std::string, cuttlefish::SharedFD>
           commands_to_custom_action_servers,
       std::weak_ptr<DisplayHandler> display_handler,
       CameraController *camera_controller,
       cuttlefish::confui::HostVirtualInput &confui_input)
-      : input_sockets_(input_sockets),
+      : input_engine_(input_engine),
         kernel_log_events_handler_(kernel_log_events_handler),
         commands_to_custom_action_servers_(commands_to_custom_action_servers),
         weak_display_handler_(display_handler),
@@ -158,9 +114,7 @@ class ConnectionObserverImpl
     buffer->AddEvent(EV_ABS, ABS_Y, y);
     buffer->AddEvent(EV_KEY, BTN_TOUCH, down);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.GetTouchClientByLabel(display_label),
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    input_engine_.Send(display_label, *buffer);
   }
 
   void OnMultiTouchEvent(const std::string &display_label, Json::Value id,
@@ -212,9 +166,7 @@ class ConnectionObserverImpl
     }
 
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.GetTouchClientByLabel(display_label),
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    input_engine_.Send(display_label, *buffer);
   }
 
   void OnKeyboardEvent(uint16_t code, bool down) override {
@@ -230,9 +182,7 @@ class ConnectionObserverImpl
     }
     buffer->AddEvent(EV_KEY, code, down);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.keyboard_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    input_engine_.Send("keyboard", *buffer);
   }
 
   void OnSwitchEvent(uint16_t code, bool state) override {
@@ -243,9 +193,7 @@ class ConnectionObserverImpl
     }
     buffer->AddEvent(EV_SW, code, state);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.switches_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    input_engine_.Send("switches", *buffer);
   }
 
   void OnAdbChannelOpen(std::function<bool(const uint8_t *, size_t)>
@@ -360,7 +308,7 @@ class ConnectionObserverImpl
   }
 
  private:
-  cuttlefish::InputSockets& input_sockets_;
+  cuttlefish::InputEngine& input_engine_;
   cuttlefish::KernelLogEventsHandler* kernel_log_events_handler_;
   int kernel_log_subscription_id_ = -1;
   std::shared_ptr<cuttlefish::webrtc_streaming::AdbHandler> adb_handler_;
@@ -374,17 +322,17 @@ class ConnectionObserverImpl
 };
 
 CfConnectionObserverFactory::CfConnectionObserverFactory(
-    cuttlefish::InputSockets &input_sockets,
+    cuttlefish::InputEngine &input_engine,
     cuttlefish::KernelLogEventsHandler* kernel_log_events_handler,
     cuttlefish::confui::HostVirtualInput &confui_input)
-    : input_sockets_(input_sockets),
+    : input_engine_(input_engine),
       kernel_log_events_handler_(kernel_log_events_handler),
       confui_input_{confui_input} {}
 
 std::shared_ptr<cuttlefish::webrtc_streaming::ConnectionObserver>
 CfConnectionObserverFactory::CreateObserver() {
   return std::shared_ptr<cuttlefish::webrtc_streaming::ConnectionObserver>(
-      new ConnectionObserverImpl(input_sockets_, kernel_log_events_handler_,
+      new ConnectionObserverImpl(input_engine_, kernel_log_events_handler_,
                                  commands_to_custom_action_servers_,
                                  weak_display_handler_, camera_controller_,
                                  confui_input_));
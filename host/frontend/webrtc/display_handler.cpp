@@ -33,10 +33,17 @@ DisplayHandler::DisplayHandler(
 DisplayHandler::GenerateProcessedFrameCallback DisplayHandler::GetScreenConnectorCallback() {
     // only to tell the producer how to create a ProcessedFrame to cache into the queue
     DisplayHandler::GenerateProcessedFrameCallback callback =
-        [](std::uint32_t display_number, std::uint32_t frame_width,
-           std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
-           std::uint8_t* frame_pixels,
-           WebRtcScProcessedFrame& processed_frame) {
+        [this](std::uint32_t display_number, std::uint32_t frame_width,
+               std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
+               std::uint8_t* frame_pixels,
+               WebRtcScProcessedFrame& processed_frame) {
+          {
+            std::lock_guard<std::mutex> lock(raw_frame_observers_mutex_);
+            for (const auto& observer : raw_frame_observers_) {
+              observer(display_number, frame_width, frame_height,
+                       frame_stride_bytes, frame_pixels);
+            }
+          }
           processed_frame.display_number_ = display_number;
           processed_frame.buf_ =
               std::make_unique<CvdVideoFrameBuffer>(frame_width, frame_height);
@@ -67,6 +74,11 @@ DisplayHandler::GenerateProcessedFrameCallback DisplayHandler::GetScreenConnecto
   }
 }
 
+void DisplayHandler::AddRawFrameObserver(RawFrameObserver observer) {
+  std::lock_guard<std::mutex> lock(raw_frame_observers_mutex_);
+  raw_frame_observers_.emplace_back(std::move(observer));
+}
+
 void DisplayHandler::SendLastFrame() {
   std::shared_ptr<webrtc_streaming::VideoFrameBuffer> buffer;
   std::uint32_t buffer_display;
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -51,6 +52,12 @@ class DisplayHandler {
  public:
   using ScreenConnector = cuttlefish::ScreenConnector<WebRtcScProcessedFrame>;
   using GenerateProcessedFrameCallback = ScreenConnector::GenerateProcessedFrameCallback;
+  // Receives the unprocessed RGBA guest frames before they are converted for
+  // streaming. Called from the screen connector's thread.
+  using RawFrameObserver = std::function<void(
+      std::uint32_t /*display_number*/, std::uint32_t /*frame_width*/,
+      std::uint32_t /*frame_height*/, std::uint32_t /*frame_stride_bytes*/,
+      const std::uint8_t* /*frame_bytes*/)>;
 
   DisplayHandler(
       std::vector<std::shared_ptr<webrtc_streaming::VideoSink>> display_sinks,
@@ -59,6 +66,7 @@ class DisplayHandler {
 
   [[noreturn]] void Loop();
   void SendLastFrame();
+  void AddRawFrameObserver(RawFrameObserver observer);
 
  private:
   GenerateProcessedFrameCallback GetScreenConnectorCallback();
@@ -68,5 +76,7 @@ class DisplayHandler {
   std::uint32_t last_buffer_display_ = 0;
   std::mutex last_buffer_mutex_;
   std::mutex next_frame_mutex_;
+  std::vector<RawFrameObserver> raw_frame_observers_;
+  std::mutex raw_frame_observers_mutex_;
 };
 }  // namespace cuttlefish
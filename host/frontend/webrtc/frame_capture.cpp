@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/frame_capture.h"
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <android-base/logging.h>
+#include <jpeglib.h>
+#include <png.h>
+
+#include "host/frontend/webrtc/json_line_socket.h"
+#include "host/frontend/webrtc/lib/utils.h"
+
+namespace cuttlefish {
+namespace {
+
+// Screenshots are usually taken in a tight loop by tests, favor encoding speed
+// over output size.
+constexpr int kPngCompressionLevel = 1;
+
+std::int64_t MonotonicTimeUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+const char* CaptureFormatName(CaptureFormat format) {
+  switch (format) {
+    case CaptureFormat::kRgba:
+      return "rgba";
+    case CaptureFormat::kPng:
+      return "png";
+    case CaptureFormat::kJpeg:
+      return "jpeg";
+  }
+  return "unknown";
+}
+
+void PngWriteToVector(png_structp png, png_bytep data, png_size_t length) {
+  auto out = static_cast<std::vector<std::uint8_t>*>(png_get_io_ptr(png));
+  out->insert(out->end(), data, data + length);
+}
+
+Result<std::vector<std::uint8_t>> EncodePng(const CapturedFrame& frame) {
+  png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                            nullptr, nullptr);
+  CF_EXPECT(png != nullptr, "Failed to create png write struct");
+  png_infop info = png_create_info_struct(png);
+  if (info == nullptr) {
+    png_destroy_write_struct(&png, nullptr);
+    return CF_ERR("Failed to create png info struct");
+  }
+
+  std::vector<std::uint8_t> out;
+  std::vector<png_bytep> rows(frame.height);
+  auto pixels = const_cast<std::uint8_t*>(frame.pixels->data());
+  for (std::uint32_t y = 0; y < frame.height; y++) {
+    rows[y] = pixels + y * frame.width * 4;
+  }
+
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    return CF_ERR("libpng failed to encode the frame");
+  }
+  png_set_write_fn(png, &out, PngWriteToVector, nullptr);
+  png_set_IHDR(png, info, frame.width, frame.height, 8, PNG_COLOR_TYPE_RGBA,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_set_compression_level(png, kPngCompressionLevel);
+  png_write_info(png, info);
+  png_write_image(png, rows.data());
+  png_write_end(png, nullptr);
+  png_destroy_write_struct(&png, &info);
+  return out;
+}
+
+struct JpegErrorManager {
+  jpeg_error_mgr base;
+  std::jmp_buf jump_buffer;
+};
+
+void JpegErrorExit(j_common_ptr cinfo) {
+  // The default handler calls exit(), return control to the encoder instead.
+  auto manager = reinterpret_cast<JpegErrorManager*>(cinfo->err);
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  LOG(ERROR) << "libjpeg error: " << message;
+  std::longjmp(manager->jump_buffer, 1);
+}
+
+Result<std::vector<std::uint8_t>> EncodeJpeg(const CapturedFrame& frame,
+                                             int quality) {
+  jpeg_compress_struct cinfo;
+  JpegErrorManager error_manager;
+  cinfo.err = jpeg_std_error(&error_manager.base);
+  error_manager.base.error_exit = JpegErrorExit;
+
+  unsigned char* buffer = nullptr;
+  unsigned long buffer_size = 0;
+  auto pixels = const_cast<std::uint8_t*>(frame.pixels->data());
+
+  if (setjmp(error_manager.jump_buffer)) {
+    jpeg_destroy_compress(&cinfo);
+    free(buffer);
+    return CF_ERR("libjpeg failed to encode the frame");
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &buffer, &buffer_size);
+  cinfo.image_width = frame.width;
+  cinfo.image_height = frame.height;
+  cinfo.input_components = 4;
+  cinfo.in_color_space = JCS_EXT_RGBA;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = pixels + cinfo.next_scanline * frame.width * 4;
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  std::vector<std::uint8_t> out(buffer, buffer + buffer_size);
+  free(buffer);
+  return out;
+}
+
+Result<std::vector<std::uint8_t>> EncodeFrame(const CapturedFrame& frame,
+                                              CaptureFormat format,
+                                              int quality) {
+  switch (format) {
+    case CaptureFormat::kRgba:
+      return *frame.pixels;
+    case CaptureFormat::kPng:
+      return CF_EXPECT(EncodePng(frame));
+    case CaptureFormat::kJpeg:
+      return CF_EXPECT(EncodeJpeg(frame, quality));
+  }
+  return CF_ERR("Unknown capture format");
+}
+
+}  // namespace
+
+std::optional<CaptureFormat> CaptureFormatFromString(const std::string& name) {
+  if (name == "rgba") {
+    return CaptureFormat::kRgba;
+  } else if (name == "png") {
+    return CaptureFormat::kPng;
+  } else if (name == "jpeg" || name == "jpg") {
+    return CaptureFormat::kJpeg;
+  }
+  return {};
+}
+
+Result<CaptureRequest> ParseCaptureRequest(const Json::Value& request) {
+  auto validation = webrtc_streaming::ValidationResult::ValidateJsonObject(
+      request, "capture", {},
+      {
+          {"display", Json::ValueType::uintValue},
+          {"format", Json::ValueType::stringValue},
+          {"quality", Json::ValueType::intValue},
+          {"timeout_ms", Json::ValueType::uintValue},
+      });
+  CF_EXPECT(validation.ok(), validation.error());
+  // Both are routinely past the 32 bit range ValidateJsonObject checks.
+  CF_EXPECT(request.get("after_sequence", 0).isUInt64(),
+            "Expected an unsigned 64 bit integer 'after_sequence'");
+  CF_EXPECT(request.get("after_timestamp_us", 0).isInt64(),
+            "Expected a 64 bit integer 'after_timestamp_us'");
+
+  CaptureRequest parsed;
+  auto format_name = request.get("format", "png").asString();
+  auto format = CaptureFormatFromString(format_name);
+  CF_EXPECT(format.has_value(), "Unknown format \"" << format_name << "\"");
+  parsed.format = *format;
+  parsed.display = request.get("display", 0).asUInt();
+  parsed.quality = request.get("quality", parsed.quality).asInt();
+  CF_EXPECT(parsed.quality >= 1 && parsed.quality <= 100,
+            "'quality' must be between 1 and 100");
+  parsed.after_sequence = request.get("after_sequence", 0).asUInt64();
+  parsed.after_timestamp_us = request.get("after_timestamp_us", 0).asInt64();
+  parsed.timeout = std::chrono::milliseconds(
+      request.get("timeout_ms", Json::UInt(parsed.timeout.count())).asUInt());
+  return parsed;
+}
+
+FrameCapture::FrameCapture(std::size_t num_displays,
+                           std::size_t num_encoder_threads)
+    : displays_(num_displays) {
+  // Encode() would wait forever for a result.
+  CHECK(num_encoder_threads > 0) << "Frame capture needs an encoder thread";
+  for (std::size_t i = 0; i < num_encoder_threads; i++) {
+    encoders_.emplace_back([this]() { EncoderLoop(); });
+  }
+}
+
+FrameCapture::~FrameCapture() {
+  // An empty job tells an encoder thread to exit.
+  for (std::size_t i = 0; i < encoders_.size(); i++) {
+    encode_jobs_.Push(std::function<void()>());
+  }
+  for (auto& encoder : encoders_) {
+    encoder.join();
+  }
+}
+
+void FrameCapture::OnFrame(std::uint32_t display_number, std::uint32_t width,
+                           std::uint32_t height, std::uint32_t stride_bytes,
+                           const std::uint8_t* pixels) {
+  if (display_number >= displays_.size()) {
+    LOG(ERROR) << "Ignoring frame for unknown display " << display_number;
+    return;
+  }
+  std::shared_ptr<std::vector<std::uint8_t>> buffer;
+  {
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    buffer = std::move(displays_[display_number].spare);
+  }
+  // Only reuse the spare buffer if no client is still reading from it.
+  if (!buffer || buffer.use_count() > 1) {
+    buffer = std::make_shared<std::vector<std::uint8_t>>();
+  }
+  const std::size_t row_size = width * 4;
+  buffer->resize(row_size * height);
+  for (std::uint32_t y = 0; y < height; y++) {
+    std::memcpy(buffer->data() + y * row_size, pixels + y * stride_bytes,
+                row_size);
+  }
+
+  std::lock_guard<std::mutex> lock(frames_mutex_);
+  auto& display = displays_[display_number];
+  display.spare = std::const_pointer_cast<std::vector<std::uint8_t>>(
+      std::move(display.latest.pixels));
+  display.latest.display_number = display_number;
+  display.latest.sequence++;
+  display.latest.timestamp_us = MonotonicTimeUs();
+  display.latest.width = width;
+  display.latest.height = height;
+  display.latest.pixels = std::move(buffer);
+  new_frame_cv_.notify_all();
+}
+
+std::optional<CapturedFrame> FrameCapture::WaitForFrame(
+    std::uint32_t display_number, std::uint64_t after_sequence,
+    std::int64_t after_timestamp_us, std::chrono::milliseconds timeout) {
+  if (display_number >= displays_.size()) {
+    return {};
+  }
+  std::unique_lock<std::mutex> lock(frames_mutex_);
+  const auto& latest = displays_[display_number].latest;
+  bool available = new_frame_cv_.wait_for(lock, timeout, [&]() {
+    return latest.pixels && latest.sequence > after_sequence &&
+           latest.timestamp_us > after_timestamp_us;
+  });
+  if (!available) {
+    return {};
+  }
+  return latest;
+}
+
+std::future<Result<std::vector<std::uint8_t>>> FrameCapture::Encode(
+    CapturedFrame frame, CaptureFormat format, int quality) {
+  auto task = std::make_shared<
+      std::packaged_task<Result<std::vector<std::uint8_t>>()>>(
+      [frame = std::move(frame), format, quality]() {
+        return EncodeFrame(frame, format, quality);
+      });
+  auto result = task->get_future();
+  encode_jobs_.Push(std::function<void()>([task]() { (*task)(); }));
+  return result;
+}
+
+void FrameCapture::EncoderLoop() {
+  for (;;) {
+    auto job = encode_jobs_.Pop();
+    if (!job) {
+      return;
+    }
+    job();
+  }
+}
+
+void FrameCapture::Serve(SharedFD server) {
+  AcceptJsonLineClients(server,
+                        [this](JsonLineSocket& client) { HandleClient(client); });
+}
+
+void FrameCapture::HandleClient(JsonLineSocket& client) {
+  while (auto json_request = client.ReadRequest()) {
+    auto request = ParseCaptureRequest(*json_request);
+    if (!request.ok()) {
+      if (!client.WriteError(request.error().message())) {
+        return;
+      }
+      continue;
+    }
+    auto frame = WaitForFrame(request->display, request->after_sequence,
+                              request->after_timestamp_us, request->timeout);
+    if (!frame) {
+      if (!client.WriteError("No matching frame available")) {
+        return;
+      }
+      continue;
+    }
+    auto encoded = Encode(*frame, request->format, request->quality).get();
+    if (!encoded.ok()) {
+      LOG(ERROR) << encoded.error();
+      if (!client.WriteError("Failed to encode frame")) {
+        return;
+      }
+      continue;
+    }
+
+    Json::Value header;
+    header["status"] = "ok";
+    header["display"] = frame->display_number;
+    header["sequence"] = Json::UInt64(frame->sequence);
+    header["timestamp_us"] = Json::Int64(frame->timestamp_us);
+    header["width"] = frame->width;
+    header["height"] = frame->height;
+    header["format"] = CaptureFormatName(request->format);
+    header["size"] = Json::UInt64(encoded->size());
+    if (!client.Write(header) ||
+        !client.WriteData(encoded->data(), encoded->size())) {
+      return;
+    }
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json/json.h>
+
+#include "common/libs/concurrency/thread_safe_queue.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/frontend/webrtc/json_line_socket.h"
+
+namespace cuttlefish {
+
+enum class CaptureFormat {
+  kRgba,
+  kPng,
+  kJpeg,
+};
+
+std::optional<CaptureFormat> CaptureFormatFromString(const std::string& name);
+
+// A client request, see FrameCapture for the fields.
+struct CaptureRequest {
+  std::uint32_t display = 0;
+  CaptureFormat format = CaptureFormat::kPng;
+  // Only used for jpeg, between 1 and 100.
+  int quality = 90;
+  std::uint64_t after_sequence = 0;
+  std::int64_t after_timestamp_us = 0;
+  std::chrono::milliseconds timeout{1000};
+};
+
+// Fails on unknown formats and on fields of the wrong type or out of range.
+Result<CaptureRequest> ParseCaptureRequest(const Json::Value& request);
+
+// A copy of a composed guest frame as received from the screen connector.
+struct CapturedFrame {
+  std::uint32_t display_number = 0;
+  // Increases by one with every frame received for the display.
+  std::uint64_t sequence = 0;
+  // CLOCK_MONOTONIC time at which the host received the frame.
+  std::int64_t timestamp_us = 0;
+  std::uint32_t width = 0;
+  std::uint32_t height = 0;
+  // Tightly packed RGBA8888 rows, the stride is always width * 4.
+  std::shared_ptr<const std::vector<std::uint8_t>> pixels;
+};
+
+// Keeps the most recent frame of every display and serves screenshots to
+// local clients without going through the guest.
+//
+// Clients connect to the capture socket and send one JSON object per line:
+//
+//   {"display": 0, "format": "png", "quality": 90,
+//    "after_sequence": 12, "after_timestamp_us": 3456, "timeout_ms": 1000}
+//
+// Every field is optional. The reply is a single line JSON header followed by
+// "size" bytes of encoded image data:
+//
+//   {"status": "ok", "display": 0, "sequence": 13, "timestamp_us": 3500,
+//    "width": 720, "height": 1280, "format": "png", "size": 12345}
+//
+// On failure the header has "status": "error" and a "message", and no data
+// follows.
+class FrameCapture {
+ public:
+  // num_encoder_threads must be at least 1.
+  FrameCapture(std::size_t num_displays, std::size_t num_encoder_threads);
+  ~FrameCapture();
+
+  // Called from the screen connector thread for every guest frame.
+  void OnFrame(std::uint32_t display_number, std::uint32_t width,
+               std::uint32_t height, std::uint32_t stride_bytes,
+               const std::uint8_t* pixels);
+
+  // Returns the most recent frame of the display that has a sequence number
+  // greater than after_sequence and a timestamp greater than
+  // after_timestamp_us, waiting up to timeout for it to arrive.
+  std::optional<CapturedFrame> WaitForFrame(std::uint32_t display_number,
+                                            std::uint64_t after_sequence,
+                                            std::int64_t after_timestamp_us,
+                                            std::chrono::milliseconds timeout);
+
+  // Encodes the frame on the encoder thread pool.
+  std::future<Result<std::vector<std::uint8_t>>> Encode(CapturedFrame frame,
+                                                        CaptureFormat format,
+                                                        int quality);
+
+  // Accepts capture clients on the given listening socket in the background.
+  void Serve(SharedFD server);
+
+ private:
+  struct DisplayFrames {
+    CapturedFrame latest;
+    // The previous frame's buffer, reused when no client holds on to it.
+    std::shared_ptr<std::vector<std::uint8_t>> spare;
+  };
+
+  void HandleClient(JsonLineSocket& client);
+  void EncoderLoop();
+
+  std::mutex frames_mutex_;
+  std::condition_variable new_frame_cv_;
+  std::vector<DisplayFrames> displays_;
+
+  ThreadSafeQueue<std::function<void()>> encode_jobs_;
+  std::vector<std::thread> encoders_;
+};
+
+}  // namespace cuttlefish
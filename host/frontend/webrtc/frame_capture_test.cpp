@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/frame_capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace {
+
+using std::chrono::milliseconds;
+
+Json::Value Parse(const std::string& text) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value value;
+  std::string errors;
+  EXPECT_TRUE(
+      reader->parse(text.data(), text.data() + text.size(), &value, &errors))
+      << errors;
+  return value;
+}
+
+TEST(FrameCaptureRequestTest, Defaults) {
+  auto request = ParseCaptureRequest(Parse("{}"));
+  ASSERT_TRUE(request.ok()) << request.error().message();
+  EXPECT_EQ(request->display, 0);
+  EXPECT_EQ(request->format, CaptureFormat::kPng);
+  EXPECT_EQ(request->quality, 90);
+  EXPECT_EQ(request->after_sequence, 0);
+  EXPECT_EQ(request->after_timestamp_us, 0);
+  EXPECT_EQ(request->timeout, milliseconds(1000));
+}
+
+TEST(FrameCaptureRequestTest, AllFields) {
+  auto request = ParseCaptureRequest(
+      Parse(R"({"display": 1, "format": "jpg", "quality": 50,
+                "after_sequence": 12, "after_timestamp_us": 5000000000,
+                "timeout_ms": 20})"));
+  ASSERT_TRUE(request.ok()) << request.error().message();
+  EXPECT_EQ(request->display, 1);
+  EXPECT_EQ(request->format, CaptureFormat::kJpeg);
+  EXPECT_EQ(request->quality, 50);
+  EXPECT_EQ(request->after_sequence, 12);
+  EXPECT_EQ(request->after_timestamp_us, 5000000000);
+  EXPECT_EQ(request->timeout, milliseconds(20));
+}
+
+TEST(FrameCaptureRequestTest, RejectsMalformedFields) {
+  EXPECT_FALSE(ParseCaptureRequest(Parse("[]")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse("5")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"display": -1})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"display": "one"})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"display": {}})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"format": "bmp"})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"format": []})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"quality": 0})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"quality": 101})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"timeout_ms": -5})")).ok());
+  EXPECT_FALSE(ParseCaptureRequest(Parse(R"({"after_sequence": -1})")).ok());
+  EXPECT_FALSE(
+      ParseCaptureRequest(Parse(R"({"after_timestamp_us": "now"})")).ok());
+}
+
+// 2x2 pixels with 4 bytes of padding after every row.
+const std::vector<std::uint8_t> kPaddedFrame = {
+    1, 2,  3,  4,  5,  6,  7,  8,  0, 0, 0, 0,
+    9, 10, 11, 12, 13, 14, 15, 16, 0, 0, 0, 0,
+};
+constexpr std::uint32_t kPaddedStride = 12;
+
+TEST(FrameCaptureTest, CopiesLatestFrameWithoutPadding) {
+  FrameCapture capture(1, 1);
+  capture.OnFrame(0, 2, 2, kPaddedStride, kPaddedFrame.data());
+
+  auto frame = capture.WaitForFrame(0, 0, 0, milliseconds(0));
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->sequence, 1);
+  EXPECT_EQ(frame->width, 2);
+  EXPECT_EQ(frame->height, 2);
+  std::vector<std::uint8_t> expected = {1, 2,  3,  4,  5,  6,  7,  8,
+                                        9, 10, 11, 12, 13, 14, 15, 16};
+  EXPECT_EQ(*frame->pixels, expected);
+
+  auto rgba = capture.Encode(*frame, CaptureFormat::kRgba, 90).get();
+  ASSERT_TRUE(rgba.ok()) << rgba.error().message();
+  EXPECT_EQ(*rgba, expected);
+}
+
+TEST(FrameCaptureTest, WaitsForNewerFrames) {
+  FrameCapture capture(1, 1);
+  EXPECT_FALSE(capture.WaitForFrame(0, 0, 0, milliseconds(0)));
+  capture.OnFrame(0, 2, 2, kPaddedStride, kPaddedFrame.data());
+  auto first = capture.WaitForFrame(0, 0, 0, milliseconds(0));
+  ASSERT_TRUE(first);
+  EXPECT_FALSE(capture.WaitForFrame(0, first->sequence, 0, milliseconds(10)));
+  EXPECT_FALSE(
+      capture.WaitForFrame(0, 0, first->timestamp_us, milliseconds(10)));
+  EXPECT_FALSE(capture.WaitForFrame(1, 0, 0, milliseconds(0)));
+
+  capture.OnFrame(0, 2, 2, kPaddedStride, kPaddedFrame.data());
+  auto second = capture.WaitForFrame(0, first->sequence, 0, milliseconds(0));
+  ASSERT_TRUE(second);
+  EXPECT_EQ(second->sequence, first->sequence + 1);
+}
+
+TEST(FrameCaptureTest, EncodesImages) {
+  FrameCapture capture(1, 2);
+  capture.OnFrame(0, 2, 2, kPaddedStride, kPaddedFrame.data());
+  auto frame = capture.WaitForFrame(0, 0, 0, milliseconds(0));
+  ASSERT_TRUE(frame);
+
+  auto png = capture.Encode(*frame, CaptureFormat::kPng, 90).get();
+  ASSERT_TRUE(png.ok()) << png.error().message();
+  const std::vector<std::uint8_t> png_signature = {0x89, 'P', 'N', 'G'};
+  ASSERT_GE(png->size(), png_signature.size());
+  EXPECT_TRUE(std::equal(png_signature.begin(), png_signature.end(),
+                         png->begin()));
+
+  auto jpeg = capture.Encode(*frame, CaptureFormat::kJpeg, 50).get();
+  ASSERT_TRUE(jpeg.ok()) << jpeg.error().message();
+  ASSERT_GE(jpeg->size(), 2);
+  EXPECT_EQ((*jpeg)[0], 0xFF);
+  EXPECT_EQ((*jpeg)[1], 0xD8);
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/input_engine.h"
+
+#include <fcntl.h>
+#include <linux/input.h>
+
+#include <thread>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+
+DECLARE_bool(write_virtio_input);
+
+namespace cuttlefish {
+namespace {
+
+// sleep_until() routinely overshoots by tens of microseconds, so the last
+// stretch before an event is spent spinning instead.
+constexpr auto kSpinThreshold = std::chrono::microseconds(200);
+
+// TODO (b/147511234): de-dup this from vnc server and here
+struct virtio_input_event {
+  uint16_t type;
+  uint16_t code;
+  int32_t value;
+};
+
+template <typename T>
+struct InputEventBufferImpl : public InputEventBuffer {
+  InputEventBufferImpl() {
+    buffer_.reserve(6);  // 6 is usually enough
+  }
+  void AddEvent(uint16_t type, uint16_t code, int32_t value) override {
+    buffer_.push_back({.type = type, .code = code, .value = value});
+  }
+  T *data() { return buffer_.data(); }
+  const void *data() const override { return buffer_.data(); }
+  std::size_t size() const override { return buffer_.size() * sizeof(T); }
+  std::vector<InputEvent> Events() const override {
+    std::vector<InputEvent> events;
+    events.reserve(buffer_.size());
+    for (const auto& event : buffer_) {
+      events.push_back({event.type, event.code, event.value});
+    }
+    return events;
+  }
+
+ private:
+  std::vector<T> buffer_;
+};
+
+void SleepUntil(std::chrono::steady_clock::time_point deadline) {
+  auto now = std::chrono::steady_clock::now();
+  if (deadline - now > kSpinThreshold) {
+    std::this_thread::sleep_until(deadline - kSpinThreshold);
+  }
+  while (std::chrono::steady_clock::now() < deadline) {
+  }
+}
+
+Result<Json::Value> ReadJsonFile(const std::string& path) {
+  CF_EXPECT(FileExists(path), "No such file: " << path);
+  auto contents = ReadFile(path);
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value json;
+  std::string error_message;
+  CF_EXPECT(reader->parse(contents.data(), contents.data() + contents.size(),
+                          &json, &error_message),
+            "Invalid JSON in " << path << ": " << error_message);
+  return json;
+}
+
+Result<void> WriteJsonFile(const std::string& path, const Json::Value& json) {
+  auto file = SharedFD::Open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  CF_EXPECT(file->IsOpen(),
+            "Could not open " << path << ": " << file->StrError());
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  auto serialized = Json::writeString(builder, json) + "\n";
+  auto written = WriteAll(file, serialized);
+  CF_EXPECT(written == static_cast<ssize_t>(serialized.size()),
+            "Could not write " << path << ": " << file->StrError());
+  return {};
+}
+
+}  // namespace
+
+Result<SharedFD> InputSockets::GetTouchClientByLabel(const std::string& label) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  auto it = touch_clients_.find(label);
+  CF_EXPECT(it != touch_clients_.end(), "Unknown input device: " << label);
+  return it->second;
+}
+
+SharedFD InputSockets::GetKeyboardClient() {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  return keyboard_client_;
+}
+
+SharedFD InputSockets::GetSwitchesClient() {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  return switches_client_;
+}
+
+void InputSockets::SetTouchClient(const std::string& label, SharedFD client) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  touch_clients_[label] = client;
+}
+
+void InputSockets::SetKeyboardClient(SharedFD client) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  keyboard_client_ = client;
+}
+
+void InputSockets::SetSwitchesClient(SharedFD client) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  switches_client_ = client;
+}
+
+// TODO: we could add an arg here to specify whether we want the multitouch buffer?
+std::unique_ptr<InputEventBuffer> GetEventBuffer() {
+  if (FLAGS_write_virtio_input) {
+    return std::unique_ptr<InputEventBuffer>(
+        new InputEventBufferImpl<virtio_input_event>());
+  } else {
+    return std::unique_ptr<InputEventBuffer>(
+        new InputEventBufferImpl<input_event>());
+  }
+}
+
+Json::Value RecordingToJson(const std::vector<TimedInputEvents>& recording) {
+  Json::Value json;
+  Json::Value& events = json["events"];
+  events = Json::Value(Json::arrayValue);
+  for (const auto& batch : recording) {
+    Json::Value batch_json;
+    batch_json["offset_us"] = Json::Int64(batch.offset.count());
+    batch_json["device"] = batch.device;
+    Json::Value& input = batch_json["input"];
+    input = Json::Value(Json::arrayValue);
+    for (const auto& event : batch.events) {
+      Json::Value event_json(Json::arrayValue);
+      event_json.append(event.type);
+      event_json.append(event.code);
+      event_json.append(event.value);
+      input.append(event_json);
+    }
+    events.append(batch_json);
+  }
+  return json;
+}
+
+Result<std::vector<TimedInputEvents>> RecordingFromJson(
+    const Json::Value& json) {
+  CF_EXPECT(json.isObject() && json["events"].isArray(),
+            "Recording must have an \"events\" array");
+  std::vector<TimedInputEvents> recording;
+  for (const auto& batch_json : json["events"]) {
+    CF_EXPECT(batch_json.isObject(), "Batches must be objects");
+    CF_EXPECT(batch_json["device"].isString(), "Batch is missing a device");
+    CF_EXPECT(batch_json["input"].isArray(), "Batch is missing its input");
+    const auto& offset_json = batch_json["offset_us"];
+    CF_EXPECT(offset_json.isNull() ||
+                  (offset_json.isInt64() && offset_json.asInt64() >= 0),
+              "Batch offsets must be non negative integers");
+    TimedInputEvents batch;
+    batch.offset = std::chrono::microseconds(
+        offset_json.isNull() ? 0 : offset_json.asInt64());
+    batch.device = batch_json["device"].asString();
+    for (const auto& event_json : batch_json["input"]) {
+      CF_EXPECT(event_json.isArray() && event_json.size() == 3,
+                "Events must be [type, code, value] triples");
+      for (int i = 0; i < 2; i++) {
+        CF_EXPECT(event_json[i].isUInt() &&
+                      event_json[i].asUInt() <= UINT16_MAX,
+                  "Event types and codes must fit in 16 unsigned bits");
+      }
+      CF_EXPECT(event_json[2].isInt(), "Event values must be 32 bit integers");
+      batch.events.push_back({
+          static_cast<std::uint16_t>(event_json[0].asUInt()),
+          static_cast<std::uint16_t>(event_json[1].asUInt()),
+          event_json[2].asInt(),
+      });
+    }
+    CF_EXPECT(recording.empty() || recording.back().offset <= batch.offset,
+              "Batches must be sorted by offset");
+    recording.emplace_back(std::move(batch));
+  }
+  return recording;
+}
+
+InputEngine::InputEngine(InputSockets& input_sockets)
+    : input_sockets_(input_sockets) {}
+
+Result<SharedFD> InputEngine::DeviceSocket(const std::string& device) {
+  if (device == "keyboard") {
+    return input_sockets_.GetKeyboardClient();
+  } else if (device == "switches") {
+    return input_sockets_.GetSwitchesClient();
+  }
+  return CF_EXPECT(input_sockets_.GetTouchClientByLabel(device));
+}
+
+Result<void> InputEngine::Write(const std::string& device,
+                                const InputEventBuffer& buffer) {
+  auto socket = CF_EXPECT(DeviceSocket(device));
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  auto written = WriteAll(socket, reinterpret_cast<const char*>(buffer.data()),
+                          buffer.size());
+  CF_EXPECT(written == static_cast<ssize_t>(buffer.size()),
+            "Failed to write events to " << device << ": "
+                                         << socket->StrError());
+  return {};
+}
+
+void InputEngine::Send(const std::string& device,
+                       const InputEventBuffer& buffer) {
+  {
+    std::lock_guard<std::mutex> lock(recording_mutex_);
+    if (recording_start_) {
+      auto offset = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - *recording_start_);
+      recording_.push_back({offset, device, buffer.Events()});
+    }
+  }
+  auto result = Write(device, buffer);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error().message();
+  }
+}
+
+void InputEngine::StartRecording() {
+  std::lock_guard<std::mutex> lock(recording_mutex_);
+  recording_.clear();
+  recording_start_ = std::chrono::steady_clock::now();
+}
+
+std::vector<TimedInputEvents> InputEngine::StopRecording() {
+  std::lock_guard<std::mutex> lock(recording_mutex_);
+  recording_start_.reset();
+  return std::move(recording_);
+}
+
+Result<ReplayStats> InputEngine::Replay(
+    const std::vector<TimedInputEvents>& recording, double speed) {
+  CF_EXPECT(speed > 0, "Replay speed must be positive");
+  // Serialize everything up front so the timed loop only writes.
+  std::vector<std::unique_ptr<InputEventBuffer>> buffers;
+  for (const auto& batch : recording) {
+    auto buffer = GetEventBuffer();
+    for (const auto& event : batch.events) {
+      buffer->AddEvent(event.type, event.code, event.value);
+    }
+    buffers.emplace_back(std::move(buffer));
+  }
+
+  std::lock_guard<std::mutex> lock(replay_mutex_);
+  ReplayStats stats;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < recording.size(); i++) {
+    auto scaled_offset = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        recording[i].offset / speed);
+    auto deadline = start + scaled_offset;
+    SleepUntil(deadline);
+    auto lateness = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - deadline);
+    CF_EXPECT(Write(recording[i].device, *buffers[i]));
+    stats.batches++;
+    stats.max_lateness = std::max(stats.max_lateness, lateness);
+    stats.total_lateness += lateness;
+  }
+  return stats;
+}
+
+void InputEngine::Serve(SharedFD server) {
+  AcceptJsonLineClients(server,
+                        [this](JsonLineSocket& client) { HandleClient(client); });
+}
+
+Result<std::vector<TimedInputEvents>> InputEngine::ReadRecording(
+    const Json::Value& request) {
+  auto path = request.get("path", "").asString();
+  if (path.empty()) {
+    return CF_EXPECT(RecordingFromJson(request["recording"]));
+  }
+  auto json = CF_EXPECT(ReadJsonFile(path));
+  return CF_EXPECT(RecordingFromJson(json));
+}
+
+void InputEngine::HandleClient(JsonLineSocket& client) {
+  while (auto request = client.ReadRequest()) {
+    auto command = request->get("command", "").asString();
+    Json::Value reply;
+    reply["status"] = "ok";
+    if (command == "start_recording") {
+      StartRecording();
+    } else if (command == "stop_recording") {
+      auto recording = StopRecording();
+      auto path = request->get("path", "").asString();
+      if (path.empty()) {
+        reply["recording"] = RecordingToJson(recording);
+      } else {
+        auto written = WriteJsonFile(path, RecordingToJson(recording));
+        if (!written.ok()) {
+          if (!client.WriteError(written.error().message())) {
+            return;
+          }
+          continue;
+        }
+        reply["batches"] = Json::UInt64(recording.size());
+      }
+    } else if (command == "replay") {
+      auto recording = ReadRecording(*request);
+      if (!recording.ok()) {
+        if (!client.WriteError(recording.error().message())) {
+          return;
+        }
+        continue;
+      }
+      auto stats = Replay(*recording, request->get("speed", 1.0).asDouble());
+      if (!stats.ok()) {
+        if (!client.WriteError(stats.error().message())) {
+          return;
+        }
+        continue;
+      }
+      reply["batches"] = Json::UInt64(stats->batches);
+      reply["max_lateness_us"] = Json::Int64(stats->max_lateness.count());
+      reply["mean_lateness_us"] = Json::Int64(
+          stats->batches ? stats->total_lateness.count() / stats->batches : 0);
+    } else {
+      if (!client.WriteError("Unknown command: " + command)) {
+        return;
+      }
+      continue;
+    }
+    if (!client.Write(reply)) {
+      return;
+    }
+  }
+}
+
+}  // namespace cuttlefish
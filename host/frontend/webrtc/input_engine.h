@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/frontend/webrtc/json_line_socket.h"
+
+namespace cuttlefish {
+
+// The servers are set up before any thread starts, the clients are replaced
+// by the accepting threads whenever the VMM reconnects.
+struct InputSockets {
+  // Returns the client of the touch device with the given label, failing for
+  // unknown labels.
+  Result<SharedFD> GetTouchClientByLabel(const std::string& label);
+  SharedFD GetKeyboardClient();
+  SharedFD GetSwitchesClient();
+
+  void SetTouchClient(const std::string& label, SharedFD client);
+  void SetKeyboardClient(SharedFD client);
+  void SetSwitchesClient(SharedFD client);
+
+  std::map<std::string, SharedFD> touch_servers;
+  SharedFD keyboard_server;
+  SharedFD switches_server;
+
+ private:
+  std::mutex clients_mutex_;
+  // TODO (b/186773052): Finding strings in a map for every input event may
+  // introduce unwanted latency.
+  std::map<std::string, SharedFD> touch_clients_;
+  SharedFD keyboard_client_;
+  SharedFD switches_client_;
+};
+
+struct InputEvent {
+  std::uint16_t type;
+  std::uint16_t code;
+  std::int32_t value;
+};
+
+struct InputEventBuffer {
+  virtual ~InputEventBuffer() = default;
+  virtual void AddEvent(uint16_t type, uint16_t code, int32_t value) = 0;
+  virtual size_t size() const = 0;
+  virtual const void *data() const = 0;
+  virtual std::vector<InputEvent> Events() const = 0;
+};
+
+// Returns a buffer that serializes events in the format expected by the VMM's
+// input devices.
+std::unique_ptr<InputEventBuffer> GetEventBuffer();
+
+// A batch of input events delivered to one device at once, usually ending with
+// a SYN_REPORT.
+struct TimedInputEvents {
+  // Time since the start of the recording.
+  std::chrono::microseconds offset;
+  // "display_<n>" for touch screens, "keyboard" or "switches".
+  std::string device;
+  std::vector<InputEvent> events;
+};
+
+struct ReplayStats {
+  std::size_t batches = 0;
+  std::chrono::microseconds max_lateness{0};
+  std::chrono::microseconds total_lateness{0};
+};
+
+Json::Value RecordingToJson(const std::vector<TimedInputEvents>& recording);
+Result<std::vector<TimedInputEvents>> RecordingFromJson(
+    const Json::Value& json);
+
+// Single path through which input reaches the guest. Records the events sent
+// by streaming clients and replays recordings with their original timing,
+// optionally scaled, directly into the virtio-input sockets.
+//
+// The engine is scriptable through a local socket speaking newline delimited
+// JSON. Recordings are usually too large for a request line, so they are
+// exchanged through files:
+//
+//   {"command": "start_recording"}
+//   {"command": "stop_recording", "path": "/tmp/recording.json"}
+//     -> {"status": "ok", "batches": 120}
+//   {"command": "replay", "speed": 2.0, "path": "/tmp/recording.json"}
+//     -> {"status": "ok", "batches": 120, "max_lateness_us": 35,
+//         "mean_lateness_us": 4}
+//
+// The recording files hold
+//   {"events": [{"offset_us": 0, "device": "display_0",
+//                "input": [[3, 53, 100], [3, 54, 200], [0, 0, 0]]}, ...]}
+// Without a path, stop_recording returns the recording inline as
+// "recording" and replay takes it the same way, as long as it fits the
+// request line.
+class InputEngine {
+ public:
+  explicit InputEngine(InputSockets& input_sockets);
+
+  // Sends the events to the guest device, recording them if a recording is in
+  // progress.
+  void Send(const std::string& device, const InputEventBuffer& buffer);
+
+  void StartRecording();
+  std::vector<TimedInputEvents> StopRecording();
+
+  // Blocks until every batch has been delivered. Only one replay runs at a
+  // time, concurrent calls wait for their turn.
+  Result<ReplayStats> Replay(const std::vector<TimedInputEvents>& recording,
+                             double speed);
+
+  // Accepts control clients on the listening socket in the background.
+  void Serve(SharedFD server);
+
+ private:
+  Result<SharedFD> DeviceSocket(const std::string& device);
+  Result<void> Write(const std::string& device, const InputEventBuffer& buffer);
+  // From the file at "path", or inline from "recording".
+  Result<std::vector<TimedInputEvents>> ReadRecording(
+      const Json::Value& request);
+  void HandleClient(JsonLineSocket& client);
+
+  InputSockets& input_sockets_;
+  std::mutex recording_mutex_;
+  std::optional<std::chrono::steady_clock::time_point> recording_start_;
+  std::vector<TimedInputEvents> recording_;
+  std::mutex replay_mutex_;
+  // Keeps the batches of replays and streaming clients from interleaving.
+  std::mutex write_mutex_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/input_engine.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+// Normally defined by the webRTC binary's main.cpp.
+DEFINE_bool(write_virtio_input, true, "");
+
+namespace cuttlefish {
+namespace {
+
+using std::chrono::microseconds;
+
+Json::Value Parse(const std::string& text) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value value;
+  std::string errors;
+  EXPECT_TRUE(
+      reader->parse(text.data(), text.data() + text.size(), &value, &errors))
+      << errors;
+  return value;
+}
+
+bool Parses(const std::string& text) {
+  return RecordingFromJson(Parse(text)).ok();
+}
+
+TEST(InputRecordingTest, RoundTrip) {
+  std::vector<TimedInputEvents> recording = {
+      {microseconds(0), "display_0", {{3, 53, 100}, {3, 54, 200}, {0, 0, 0}}},
+      {microseconds(1500), "keyboard", {{1, 30, 1}, {0, 0, 0}}},
+      {microseconds(1500), "switches", {{5, 0, -1}}},
+      {microseconds(4000000000), "display_1", {}},
+  };
+  auto parsed = RecordingFromJson(RecordingToJson(recording));
+  ASSERT_TRUE(parsed.ok()) << parsed.error().message();
+  ASSERT_EQ(parsed->size(), recording.size());
+  for (std::size_t i = 0; i < recording.size(); i++) {
+    EXPECT_EQ((*parsed)[i].offset, recording[i].offset);
+    EXPECT_EQ((*parsed)[i].device, recording[i].device);
+    ASSERT_EQ((*parsed)[i].events.size(), recording[i].events.size());
+    for (std::size_t j = 0; j < recording[i].events.size(); j++) {
+      EXPECT_EQ((*parsed)[i].events[j].type, recording[i].events[j].type);
+      EXPECT_EQ((*parsed)[i].events[j].code, recording[i].events[j].code);
+      EXPECT_EQ((*parsed)[i].events[j].value, recording[i].events[j].value);
+    }
+  }
+}
+
+TEST(InputRecordingTest, EmptyRecording) {
+  auto parsed = RecordingFromJson(RecordingToJson({}));
+  ASSERT_TRUE(parsed.ok()) << parsed.error().message();
+  EXPECT_TRUE(parsed->empty());
+}
+
+TEST(InputRecordingTest, MissingOffsetIsZero) {
+  auto parsed = RecordingFromJson(
+      Parse(R"({"events": [{"device": "keyboard", "input": [[1, 2, 3]]}]})"));
+  ASSERT_TRUE(parsed.ok()) << parsed.error().message();
+  ASSERT_EQ(parsed->size(), 1u);
+  EXPECT_EQ((*parsed)[0].offset, microseconds(0));
+}
+
+TEST(InputRecordingTest, RejectsMalformedRecordings) {
+  EXPECT_FALSE(Parses(R"([])"));
+  EXPECT_FALSE(Parses(R"({})"));
+  EXPECT_FALSE(Parses(R"({"events": {}})"));
+  EXPECT_FALSE(Parses(R"({"events": [1]})"));
+  EXPECT_FALSE(Parses(R"({"events": [{"input": []}]})"));
+  EXPECT_FALSE(Parses(R"({"events": [{"device": 1, "input": []}]})"));
+  EXPECT_FALSE(Parses(R"({"events": [{"device": "keyboard"}]})"));
+}
+
+TEST(InputRecordingTest, RejectsMalformedOffsets) {
+  auto with_offset = [](const std::string& offset) {
+    return Parses(R"({"events": [{"offset_us": )" + offset +
+                  R"(, "device": "keyboard", "input": []}]})");
+  };
+  EXPECT_TRUE(with_offset("0"));
+  EXPECT_FALSE(with_offset("-1"));
+  EXPECT_FALSE(with_offset(R"("1")"));
+  EXPECT_FALSE(with_offset("1.5"));
+}
+
+TEST(InputRecordingTest, RejectsUnsortedBatches) {
+  EXPECT_FALSE(Parses(R"({"events": [
+      {"offset_us": 10, "device": "keyboard", "input": []},
+      {"offset_us": 5, "device": "keyboard", "input": []}]})"));
+}
+
+TEST(InputRecordingTest, RejectsMalformedEvents) {
+  auto with_event = [](const std::string& event) {
+    return Parses(R"({"events": [{"device": "keyboard", "input": [)" + event +
+                  "]}]}");
+  };
+  EXPECT_TRUE(with_event("[65535, 65535, -2147483648]"));
+  EXPECT_FALSE(with_event("[1, 2]"));
+  EXPECT_FALSE(with_event("[1, 2, 3, 4]"));
+  EXPECT_FALSE(with_event("{}"));
+  EXPECT_FALSE(with_event(R"(["1", 2, 3])"));
+  EXPECT_FALSE(with_event("[1, null, 3]"));
+  EXPECT_FALSE(with_event("[1, 2, true]"));
+  EXPECT_FALSE(with_event("[-1, 2, 3]"));
+  EXPECT_FALSE(with_event("[65536, 2, 3]"));
+  EXPECT_FALSE(with_event("[1, 65536, 3]"));
+  EXPECT_FALSE(with_event("[1, 2, 2147483648]"));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/json_line_socket.h"
+
+#include <thread>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kMaxRequestLineSize = 4096;
+
+}  // namespace
+
+JsonLineSocket::JsonLineSocket(SharedFD fd) : fd_(fd) {
+  Json::CharReaderBuilder builder;
+  reader_.reset(builder.newCharReader());
+}
+
+bool JsonLineSocket::ReadLine(std::string* line) {
+  for (;;) {
+    auto newline = pending_.find('\n');
+    if (newline != std::string::npos) {
+      *line = pending_.substr(0, newline);
+      pending_.erase(0, newline + 1);
+      return true;
+    }
+    if (pending_.size() > kMaxRequestLineSize) {
+      LOG(ERROR) << "Local control request is too long";
+      return false;
+    }
+    char buffer[512];
+    auto read = fd_->Read(buffer, sizeof(buffer));
+    if (read <= 0) {
+      return false;
+    }
+    pending_.append(buffer, read);
+  }
+}
+
+std::optional<Json::Value> JsonLineSocket::ReadRequest() {
+  std::string line;
+  while (ReadLine(&line)) {
+    Json::Value request;
+    std::string error_message;
+    if (reader_->parse(line.data(), line.data() + line.size(), &request,
+                       &error_message)) {
+      return request;
+    }
+    if (!WriteError("Invalid JSON request: " + error_message)) {
+      break;
+    }
+  }
+  return {};
+}
+
+bool JsonLineSocket::Write(const Json::Value& message) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  auto serialized = Json::writeString(builder, message) + "\n";
+  return WriteAll(fd_, serialized) == static_cast<ssize_t>(serialized.size());
+}
+
+bool JsonLineSocket::WriteError(const std::string& message) {
+  Json::Value reply;
+  reply["status"] = "error";
+  reply["message"] = message;
+  return Write(reply);
+}
+
+bool JsonLineSocket::WriteData(const void* data, std::size_t size) {
+  auto written = WriteAll(fd_, static_cast<const char*>(data), size);
+  if (written != static_cast<ssize_t>(size)) {
+    LOG(ERROR) << "Failed to write to local control client: "
+               << fd_->StrError();
+    return false;
+  }
+  return true;
+}
+
+void AcceptJsonLineClients(SharedFD server,
+                           std::function<void(JsonLineSocket&)> handler) {
+  std::thread([server, handler = std::move(handler)]() {
+    for (;;) {
+      auto client = SharedFD::Accept(*server);
+      if (!client->IsOpen()) {
+        LOG(ERROR) << "Failed to accept local control client: "
+                   << client->StrError();
+        continue;
+      }
+      std::thread([client, handler]() {
+        JsonLineSocket socket(client);
+        handler(socket);
+      }).detach();
+    }
+  }).detach();
+}
+
+}  // namespace cuttlefish
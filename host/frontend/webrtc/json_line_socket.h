@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <json/json.h>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+// A connection speaking the newline delimited JSON protocol used by the
+// streamer's local control sockets. Every request and every reply header is a
+// single JSON object terminated by '\n'.
+class JsonLineSocket {
+ public:
+  explicit JsonLineSocket(SharedFD fd);
+
+  // Returns the next request, or std::nullopt once the peer has closed the
+  // connection or misbehaved. Requests that are not valid JSON are answered
+  // with an error and skipped.
+  std::optional<Json::Value> ReadRequest();
+
+  bool Write(const Json::Value& message);
+  bool WriteError(const std::string& message);
+  bool WriteData(const void* data, std::size_t size);
+
+  SharedFD fd() const { return fd_; }
+
+ private:
+  bool ReadLine(std::string* line);
+
+  SharedFD fd_;
+  std::string pending_;
+  std::unique_ptr<Json::CharReader> reader_;
+};
+
+// Accepts connections on the listening socket from a background thread and
+// runs the handler for each client on its own thread.
+void AcceptJsonLineClients(SharedFD server,
+                           std::function<void(JsonLineSocket&)> handler);
+
+}  // namespace cuttlefish
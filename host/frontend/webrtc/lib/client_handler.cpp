@@ -26,6 +26,8 @@
 #include <openssl/rand.h>
 
 #include <android-base/logging.h>
+#include <api/stats/rtc_stats_collector_callback.h>
+#include <api/stats/rtc_stats_report.h>
 
 #include "host/frontend/webrtc/lib/keyboard.h"
 #include "host/frontend/webrtc/lib/utils.h"
@@ -86,6 +88,25 @@ class CvdSetSessionDescriptionObserver
   std::weak_ptr<ClientHandler> client_handler_;
 };
 
+class CvdStatsCollectorCallback : public webrtc::RTCStatsCollectorCallback {
+ public:
+  CvdStatsCollectorCallback(
+      std::function<void(const rtc::scoped_refptr<const webrtc::RTCStatsReport>
+                             &report)>
+          on_stats)
+      : on_stats_(on_stats) {}
+
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport> &report) override {
+    on_stats_(report);
+  }
+
+ private:
+  std::function<void(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport> &report)>
+      on_stats_;
+};
+
 class CvdOnSetRemoteDescription
     : public webrtc::SetRemoteDescriptionObserverInterface {
  public:
@@ -486,12 +507,9 @@ bool ClientHandler::SetPeerConnection(
   peer_connection_ = peer_connection;
 
   // libwebrtc configures the video encoder with a start bitrate of just 300kbs
-  // which causes it to drop the first 4 frames it receives. Any value over 2Mbs
-  // will be capped at 2Mbs when passed to the encoder by the peer_connection
-  // object, so we pass the maximum possible value here.
-  webrtc::BitrateSettings bitrate_settings;
-  bitrate_settings.start_bitrate_bps = 2000000; // 2Mbs
-  peer_connection_->SetBitrate(bitrate_settings);
+  // which causes it to drop the first 4 frames it receives. The default video
+  // quality starts at the maximum possible value instead.
+  peer_connection_->SetBitrate(video_quality_.StartBitrateSettings());
   // At least one data channel needs to be created on the side that makes the
   // SDP offer (the device) for data channels to be enabled at all.
   // This channel is meant to carry control commands from the client.
@@ -517,6 +535,13 @@ bool ClientHandler::AddDisplay(
   }
   // TODO (b/154138394): use the returned sender (err_or_sender.value()) to
   // remove the display from the connection.
+  DisplaySender display{label, video_track, err_or_sender.value()};
+  auto error = video_quality_.ApplyTo(display.track.get(), display.sender.get());
+  if (!error.ok()) {
+    LOG(ERROR) << "Failed to set the video quality of display " << label
+               << ": " << error.message();
+  }
+  displays_.push_back(display);
   return true;
 }
 
@@ -545,6 +570,59 @@ void ClientHandler::LogAndReplyError(const std::string &error_msg) const {
   send_to_client_(reply);
 }
 
+void ClientHandler::SetVideoQuality(const VideoQuality &video_quality) {
+  video_quality_ = video_quality;
+  peer_connection_->SetBitrate(video_quality_.StartBitrateSettings());
+  for (auto &display : displays_) {
+    auto error =
+        video_quality_.ApplyTo(display.track.get(), display.sender.get());
+    if (!error.ok()) {
+      LogAndReplyError("Failed to set the video quality of display " +
+                       display.label + ": " + error.message());
+    }
+  }
+  LOG(INFO) << "Client " << client_id_ << " video quality: "
+            << video_quality_.ToJson().toStyledString();
+}
+
+void ClientHandler::SendVideoStats() {
+  // Reports the outbound RTP stats of each display separately, as they
+  // arrive. Among them are the target bitrate, the frame rate and size and
+  // what, if anything, limits the quality.
+  for (auto &display : displays_) {
+    std::weak_ptr<ClientHandler> weak_this = weak_from_this();
+    auto label = display.label;
+    auto callback = new rtc::RefCountedObject<CvdStatsCollectorCallback>(
+        [weak_this, label](
+            const rtc::scoped_refptr<const webrtc::RTCStatsReport> &report) {
+          auto client_handler = weak_this.lock();
+          if (!client_handler) {
+            return;
+          }
+          Json::Value reply;
+          reply["type"] = "video-stats";
+          reply["label"] = label;
+          reply["quality"] = client_handler->video_quality_.ToJson();
+          reply["stats"] = Json::Value(Json::arrayValue);
+          for (const auto &stats : *report) {
+            if (std::string(stats.type()) != "outbound-rtp") {
+              continue;
+            }
+            Json::Value stats_json;
+            for (const auto *member : stats.Members()) {
+              if (member->is_defined()) {
+                stats_json[member->name()] = member->ValueToString();
+              }
+            }
+            reply["stats"].append(stats_json);
+          }
+          client_handler->send_to_client_(reply);
+        });
+    // The callback is delivered on the signaling thread, like this call.
+    peer_connection_->GetStats(display.sender, callback);
+  }
+}
+
 void ClientHandler::AddPendingIceCandidates() {
   // Add any ice candidates that arrived before the remote description
   for (auto& candidate: pending_ice_candidates_) {
@@ -615,6 +693,18 @@ void ClientHandler::HandleMessage(const Json::Value &message) {
       return;
     }
     state_ = State::kCreatingOffer;
+    // Clients may pick their video quality as they connect, so the first
+    // frames already use it.
+    if (message.isMember("video_quality")) {
+      VideoQuality video_quality;
+      auto result =
+          VideoQuality::FromJson(message["video_quality"], &video_quality);
+      if (!result.ok()) {
+        LogAndReplyError(result.error());
+      } else {
+        SetVideoQuality(video_quality);
+      }
+    }
     peer_connection_->CreateOffer(
         // No memory leak here because this is a ref counted objects and the
         // peer connection immediately wraps it with a scoped_refptr
@@ -742,6 +832,16 @@ void ClientHandler::HandleMessage(const Json::Value &message) {
       // calls are asynchronous.
       pending_ice_candidates_.push_back(std::move(candidate));
     }
+  } else if (type == "video-quality") {
+    VideoQuality video_quality;
+    auto result = VideoQuality::FromJson(message, &video_quality);
+    if (!result.ok()) {
+      LogAndReplyError(result.error());
+      return;
+    }
+    SetVideoQuality(video_quality);
+  } else if (type == "get-video-stats") {
+    SendVideoStats();
   } else {
     LogAndReplyError("Unknown client message type: " + type);
     return;
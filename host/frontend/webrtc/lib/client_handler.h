@@ -30,6 +30,7 @@
 #include <pc/video_track_source.h>
 
 #include "host/frontend/webrtc/lib/connection_observer.h"
+#include "host/frontend/webrtc/lib/video_quality.h"
 
 namespace cuttlefish {
 namespace webrtc_streaming {
@@ -121,6 +122,14 @@ class ClientHandler : public webrtc::PeerConnectionObserver,
 
   void LogAndReplyError(const std::string& error_msg) const;
   void AddPendingIceCandidates();
+  void SetVideoQuality(const VideoQuality& video_quality);
+  void SendVideoStats();
+
+  struct DisplaySender {
+    std::string label;
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> track;
+    rtc::scoped_refptr<webrtc::RtpSenderInterface> sender;
+  };
 
   int client_id_;
   State state_ = State::kNew;
@@ -135,6 +144,8 @@ class ClientHandler : public webrtc::PeerConnectionObserver,
   std::unique_ptr<BluetoothChannelHandler> bluetooth_handler_;
   std::unique_ptr<CameraChannelHandler> camera_data_handler_;
   std::unique_ptr<ClientVideoTrackImpl> camera_track_;
+  std::vector<DisplaySender> displays_;
+  VideoQuality video_quality_;
   bool remote_description_added_ = false;
   std::vector<std::unique_ptr<webrtc::IceCandidateInterface>>
       pending_ice_candidates_;
@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/shared_video_encoder.h"
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <android-base/logging.h>
+#include <api/video/encoded_image.h>
+#include <modules/video_coding/include/video_codec_interface.h>
+#include <modules/video_coding/include/video_error_codes.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Quality layers are bitrate bands a factor of two wide, the lowest one
+// starting at 0 and ending at twice this rate.
+constexpr uint64_t kLayerBaseBps = 125000;
+// Viewers only move to another layer once their estimate is this far out of
+// the band of their current one, estimates hovering around a boundary would
+// otherwise keep costing keyframes.
+constexpr double kLayerHysteresis = 0.25;
+// Encoded frames kept for the viewers which haven't asked for them yet.
+constexpr std::size_t kRecentFrames = 16;
+
+int LayerOf(uint32_t bps) {
+  int layer = 0;
+  while (bps >= kLayerBaseBps << (layer + 1)) {
+    layer++;
+  }
+  return layer;
+}
+
+bool InLayer(uint32_t bps, int layer) {
+  double low =
+      layer == 0 ? 0 : (kLayerBaseBps << layer) * (1 - kLayerHysteresis);
+  double high = (kLayerBaseBps << (layer + 1)) * (1 + kLayerHysteresis);
+  return bps >= low && bps < high;
+}
+
+// Encoders of different connections can share their work when this matches.
+struct GroupKey {
+  std::string format;
+  // 0 for frames of unknown displays and for connections that stopped
+  // sharing, neither is shared.
+  uint16_t display = 0;
+  int width = 0;
+  int height = 0;
+  webrtc::VideoCodecMode mode = webrtc::VideoCodecMode::kRealtimeVideo;
+  unsigned int max_bitrate_kbps = 0;
+  unsigned int max_framerate = 0;
+  int simulcast_streams = 0;
+  int layer = 0;
+
+  auto Tie() const {
+    return std::tie(format, display, width, height, mode, max_bitrate_kbps,
+                    max_framerate, simulcast_streams, layer);
+  }
+  bool operator<(const GroupKey& other) const { return Tie() < other.Tie(); }
+  bool operator==(const GroupKey& other) const {
+    return Tie() == other.Tie();
+  }
+  bool operator!=(const GroupKey& other) const { return !(*this == other); }
+};
+
+struct EncodedOutput {
+  webrtc::EncodedImage image;
+  webrtc::CodecSpecificInfo info;
+};
+
+struct EncodedFrame {
+  int64_t timestamp_us;
+  // Position among the frames with output, each of which may reference the
+  // ones before it.
+  int64_t index;
+  bool keyframe;
+  std::vector<EncodedOutput> outputs;
+};
+
+}  // namespace
+
+class SharedVideoEncoder;
+
+// One encoder and the connections it encodes for. The connections' encoder
+// threads take turns with it: the first to ask for a frame encodes it, the
+// others find it among the recent frames.
+class EncoderGroup : public webrtc::EncodedImageCallback {
+ public:
+  EncoderGroup(std::unique_ptr<webrtc::VideoEncoder> encoder,
+               const SharedEncodingOptions& options, GroupKey key)
+      : key_(std::move(key)), encoder_(std::move(encoder)), options_(options) {}
+
+  ~EncoderGroup() override { encoder_->Release(); }
+
+  int32_t Init(const webrtc::VideoCodec& codec,
+               const webrtc::VideoEncoder::Settings& settings) {
+    simulcast_streams_ = std::max<int>(1, codec.numberOfSimulcastStreams);
+    encoder_->RegisterEncodeCompleteCallback(this);
+    return encoder_->InitEncode(&codec, settings);
+  }
+
+  void AddMember(SharedVideoEncoder* member,
+                 std::optional<webrtc::VideoEncoder::RateControlParameters>
+                     rates) {
+    std::lock_guard lock(mutex_);
+    members_[member].rates = std::move(rates);
+    UpdateRatesLocked();
+  }
+
+  void RemoveMember(SharedVideoEncoder* member) {
+    std::lock_guard lock(mutex_);
+    members_.erase(member);
+    UpdateRatesLocked();
+  }
+
+  std::size_t MemberCount() {
+    std::lock_guard lock(mutex_);
+    return members_.size();
+  }
+
+  void SetRates(SharedVideoEncoder* member,
+                const webrtc::VideoEncoder::RateControlParameters& rates) {
+    std::lock_guard lock(mutex_);
+    members_[member].rates = rates;
+    UpdateRatesLocked();
+  }
+
+  // Provides the member's output for the frame, if any: the frame is dropped
+  // for members that missed frames it may depend on until the next keyframe.
+  // Members missing frames the others got are told so through missed_frames
+  // instead of requesting a keyframe, unless they are alone in the group.
+  int32_t Encode(SharedVideoEncoder* member, const webrtc::VideoFrame& frame,
+                 bool keyframe_requested, std::vector<EncodedOutput>* outputs,
+                 bool* missed_frames) {
+    std::lock_guard lock(mutex_);
+    auto& state = members_[member];
+    auto encoded = std::find_if(
+        recent_.begin(), recent_.end(), [&frame](const EncodedFrame& encoded) {
+          return encoded.timestamp_us == frame.timestamp_us();
+        });
+    if (encoded == recent_.end() && !recent_.empty() &&
+        frame.timestamp_us() <= recent_.back().timestamp_us) {
+      // The others moved past this frame already, encoding it now would
+      // break their streams.
+      return MissedFramesLocked(state, missed_frames);
+    }
+    bool needs_keyframe = keyframe_requested || !state.synced;
+    if (encoded == recent_.end()) {
+      if (needs_keyframe) {
+        keyframe_requested_ = true;
+      }
+      auto rc = EncodeLocked(frame);
+      if (rc != WEBRTC_VIDEO_CODEC_OK) {
+        return rc;
+      }
+      encoded = std::prev(recent_.end());
+    }
+    if (!encoded->keyframe && needs_keyframe) {
+      // Already encoded, or dropped, without one.
+      keyframe_requested_ = true;
+    }
+    if (encoded->outputs.empty()) {
+      // Dropped by the encoder, nothing depends on it.
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    if (!encoded->keyframe && !state.synced) {
+      // Waits for the keyframe it requested.
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    if (!encoded->keyframe && encoded->index != state.last_index + 1) {
+      return MissedFramesLocked(state, missed_frames);
+    }
+    state.synced = true;
+    state.last_index = encoded->index;
+    *outputs = encoded->outputs;
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  // Called from within encoder_->Encode, libvpx encodes synchronously.
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override {
+    EncodedOutput output{encoded_image, codec_specific_info
+                                            ? *codec_specific_info
+                                            : webrtc::CodecSpecificInfo()};
+    // The encoder reuses its buffer for the next frame.
+    output.image.SetEncodedData(webrtc::EncodedImageBuffer::Create(
+        encoded_image.data(), encoded_image.size()));
+    pending_.push_back(std::move(output));
+    return Result(Result::OK);
+  }
+
+  // Only changed with the hub's lock held.
+  GroupKey key_;
+
+ private:
+  struct MemberState {
+    std::optional<webrtc::VideoEncoder::RateControlParameters> rates;
+    // Whether it got every frame since its last keyframe.
+    bool synced = false;
+    int64_t last_index = -1;
+  };
+
+  int32_t MissedFramesLocked(MemberState& state, bool* missed_frames) {
+    state.synced = false;
+    if (members_.size() > 1) {
+      *missed_frames = true;
+    } else {
+      keyframe_requested_ = true;
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t EncodeLocked(const webrtc::VideoFrame& frame) {
+    auto now = Clock::now();
+    auto since_keyframe = now - last_keyframe_;
+    bool keyframe =
+        (keyframe_requested_ &&
+         since_keyframe >= options_.min_keyframe_interval) ||
+        (options_.keyframe_interval.count() > 0 &&
+         since_keyframe >= options_.keyframe_interval);
+    auto type = keyframe ? webrtc::VideoFrameType::kVideoFrameKey
+                         : webrtc::VideoFrameType::kVideoFrameDelta;
+    std::vector<webrtc::VideoFrameType> types(simulcast_streams_, type);
+    pending_.clear();
+    auto rc = encoder_->Encode(frame, &types);
+    if (rc != WEBRTC_VIDEO_CODEC_OK) {
+      return rc;
+    }
+    EncodedFrame encoded{frame.timestamp_us(), next_index_, false,
+                         std::move(pending_)};
+    pending_.clear();
+    if (!encoded.outputs.empty()) {
+      next_index_++;
+      encoded.keyframe = std::all_of(
+          encoded.outputs.begin(), encoded.outputs.end(),
+          [](const EncodedOutput& output) {
+            return output.image._frameType ==
+                   webrtc::VideoFrameType::kVideoFrameKey;
+          });
+    }
+    if (encoded.keyframe) {
+      last_keyframe_ = now;
+      keyframe_requested_ = false;
+    }
+    recent_.push_back(std::move(encoded));
+    if (recent_.size() > kRecentFrames) {
+      recent_.pop_front();
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  // Encodes at the rate of the slowest member that isn't paused.
+  void UpdateRatesLocked() {
+    const webrtc::VideoEncoder::RateControlParameters* slowest = nullptr;
+    for (const auto& [member, state] : members_) {
+      if (!state.rates || state.rates->bitrate.get_sum_bps() == 0) {
+        continue;
+      }
+      if (!slowest || state.rates->bitrate.get_sum_bps() <
+                          slowest->bitrate.get_sum_bps()) {
+        slowest = &*state.rates;
+      }
+    }
+    if (slowest) {
+      encoder_->SetRates(*slowest);
+    }
+  }
+
+  std::mutex mutex_;
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  SharedEncodingOptions options_;
+  int simulcast_streams_ = 1;
+  std::map<SharedVideoEncoder*, MemberState> members_;
+  std::deque<EncodedFrame> recent_;
+  std::vector<EncodedOutput> pending_;
+  int64_t next_index_ = 0;
+  bool keyframe_requested_ = false;
+  Clock::time_point last_keyframe_;
+};
+
+class SharedEncoderHub {
+ public:
+  SharedEncoderHub(std::unique_ptr<webrtc::VideoEncoderFactory> inner,
+                   SharedEncodingOptions options)
+      : inner_(std::move(inner)), options_(options) {}
+
+  webrtc::VideoEncoderFactory& Inner() { return *inner_; }
+
+  std::shared_ptr<EncoderGroup> Join(
+      SharedVideoEncoder* member, const GroupKey& key,
+      const webrtc::SdpVideoFormat& format, const webrtc::VideoCodec& codec,
+      const webrtc::VideoEncoder::Settings& settings,
+      std::optional<webrtc::VideoEncoder::RateControlParameters> rates) {
+    std::lock_guard lock(mutex_);
+    auto it = groups_.find(key);
+    if (it != groups_.end()) {
+      it->second->AddMember(member, std::move(rates));
+      return it->second;
+    }
+    auto encoder = inner_->CreateVideoEncoder(format);
+    if (!encoder) {
+      LOG(ERROR) << "Failed to create a " << format.name << " encoder";
+      return nullptr;
+    }
+    auto group = std::make_shared<EncoderGroup>(std::move(encoder), options_,
+                                                key);
+    auto rc = group->Init(codec, settings);
+    if (rc != WEBRTC_VIDEO_CODEC_OK) {
+      LOG(ERROR) << "Failed to initialize the encoder: " << rc;
+      return nullptr;
+    }
+    group->AddMember(member, std::move(rates));
+    if (key.display != 0) {
+      groups_[key] = group;
+      LOG(VERBOSE) << "Encoding display " << key.display << " at "
+                   << key.width << "x" << key.height << " in layer "
+                   << key.layer << ", " << groups_.size() << " encoders";
+    }
+    return group;
+  }
+
+  void Leave(SharedVideoEncoder* member, std::shared_ptr<EncoderGroup> group) {
+    std::lock_guard lock(mutex_);
+    group->RemoveMember(member);
+    if (group->MemberCount() > 0) {
+      return;
+    }
+    auto it = groups_.find(group->key_);
+    if (it != groups_.end() && it->second == group) {
+      groups_.erase(it);
+    }
+  }
+
+  // Moves a group of a single member to a new key, so that it keeps encoding
+  // without a keyframe. Returns false if the member has to join another group
+  // instead.
+  bool Rekey(std::shared_ptr<EncoderGroup> group, const GroupKey& key) {
+    std::lock_guard lock(mutex_);
+    if (group->MemberCount() != 1 ||
+        (key.display != 0 && groups_.count(key))) {
+      return false;
+    }
+    auto it = groups_.find(group->key_);
+    if (it != groups_.end() && it->second == group) {
+      groups_.erase(it);
+    }
+    group->key_ = key;
+    if (key.display != 0) {
+      groups_[key] = group;
+    }
+    return true;
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> inner_;
+  SharedEncodingOptions options_;
+  std::mutex mutex_;
+  std::map<GroupKey, std::shared_ptr<EncoderGroup>> groups_;
+};
+
+// The encoder of one connection's video sender. libwebrtc calls it from the
+// sender's encoder thread only.
+class SharedVideoEncoder : public webrtc::VideoEncoder {
+ public:
+  SharedVideoEncoder(std::shared_ptr<SharedEncoderHub> hub,
+                     webrtc::SdpVideoFormat format, EncoderInfo info)
+      : hub_(std::move(hub)), format_(std::move(format)), info_(info) {}
+
+  ~SharedVideoEncoder() override { Release(); }
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const Settings& settings) override {
+    // The group is picked once frames tell which display this encodes.
+    LeaveGroup();
+    shared_ = true;
+    codec_ = *codec_settings;
+    settings_.emplace(settings);
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t Release() override {
+    LeaveGroup();
+    codec_.reset();
+    settings_.reset();
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    if (!callback_ || !codec_) {
+      return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    }
+    bool keyframe_requested =
+        frame_types &&
+        std::find(frame_types->begin(), frame_types->end(),
+                  webrtc::VideoFrameType::kVideoFrameKey) != frame_types->end();
+    std::vector<EncodedOutput> outputs;
+    bool missed_frames = false;
+    auto rc =
+        EncodeInGroup(frame, keyframe_requested, &outputs, &missed_frames);
+    if (rc == WEBRTC_VIDEO_CODEC_OK && missed_frames) {
+      // This connection skips frames the others take, it stops sharing until
+      // it's reinitialized rather than costing them a keyframe every time.
+      LOG(VERBOSE) << "Encoding display " << frame.id()
+                   << " for a connection missing frames on its own";
+      shared_ = false;
+      rc = EncodeInGroup(frame, keyframe_requested, &outputs, &missed_frames);
+    }
+    if (rc != WEBRTC_VIDEO_CODEC_OK) {
+      return rc;
+    }
+    for (auto& output : outputs) {
+      // The RTP timestamps come from this connection's clock.
+      output.image.SetTimestamp(frame.timestamp());
+      output.image.capture_time_ms_ = frame.render_time_ms();
+      callback_->OnEncodedImage(output.image, &output.info, nullptr);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  void SetRates(const RateControlParameters& parameters) override {
+    rates_ = parameters;
+    auto bps = parameters.bitrate.get_sum_bps();
+    if (bps > 0 && !InLayer(bps, layer_)) {
+      layer_ = LayerOf(bps);
+    }
+    if (group_) {
+      group_->SetRates(this, parameters);
+    }
+  }
+
+  EncoderInfo GetEncoderInfo() const override { return info_; }
+
+ private:
+  int32_t EncodeInGroup(const webrtc::VideoFrame& frame,
+                        bool keyframe_requested,
+                        std::vector<EncodedOutput>* outputs,
+                        bool* missed_frames) {
+    auto key = Key(frame.id());
+    if (group_ && group_key_ != key && !hub_->Rekey(group_, key)) {
+      LeaveGroup();
+    }
+    if (!group_) {
+      group_ = hub_->Join(this, key, format_, *codec_, *settings_, rates_);
+      if (!group_) {
+        return WEBRTC_VIDEO_CODEC_ERROR;
+      }
+    }
+    group_key_ = key;
+    return group_->Encode(this, frame, keyframe_requested, outputs,
+                          missed_frames);
+  }
+
+  GroupKey Key(uint16_t display) const {
+    GroupKey key;
+    key.format = format_.name;
+    key.display = shared_ ? display : 0;
+    key.width = codec_->width;
+    key.height = codec_->height;
+    key.mode = codec_->mode;
+    key.max_bitrate_kbps = codec_->maxBitrate;
+    key.max_framerate = codec_->maxFramerate;
+    key.simulcast_streams = codec_->numberOfSimulcastStreams;
+    key.layer = layer_;
+    return key;
+  }
+
+  void LeaveGroup() {
+    if (group_) {
+      hub_->Leave(this, group_);
+      group_.reset();
+    }
+  }
+
+  std::shared_ptr<SharedEncoderHub> hub_;
+  webrtc::SdpVideoFormat format_;
+  EncoderInfo info_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  std::optional<webrtc::VideoCodec> codec_;
+  std::optional<Settings> settings_;
+  std::optional<RateControlParameters> rates_;
+  int layer_ = 0;
+  // Cleared for connections that miss frames the others encode.
+  bool shared_ = true;
+  std::shared_ptr<EncoderGroup> group_;
+  GroupKey group_key_;
+};
+
+SharedVideoEncoderFactory::SharedVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> inner,
+    SharedEncodingOptions options)
+    : hub_(std::make_shared<SharedEncoderHub>(std::move(inner), options)) {}
+
+std::vector<webrtc::SdpVideoFormat>
+SharedVideoEncoderFactory::GetSupportedFormats() const {
+  return hub_->Inner().GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+SharedVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return hub_->Inner().QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+SharedVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  // Only asked for its capabilities, the encoding happens in a group's one.
+  auto prototype = hub_->Inner().CreateVideoEncoder(format);
+  if (!prototype) {
+    return nullptr;
+  }
+  auto info = prototype->GetEncoderInfo();
+  info.implementation_name = "Shared (" + info.implementation_name + ")";
+  return std::make_unique<SharedVideoEncoder>(hub_, format, info);
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <api/video_codecs/video_encoder.h>
+#include <api/video_codecs/video_encoder_factory.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+struct SharedEncodingOptions {
+  // Keyframes requested by viewers closer than this to the previous one wait
+  // for it to pass, so that viewers joining or losing packets together don't
+  // turn the stream into keyframes only.
+  std::chrono::milliseconds min_keyframe_interval{500};
+  // Keyframes sent without being requested, 0 to send them only on request.
+  std::chrono::milliseconds keyframe_interval{0};
+};
+
+class SharedEncoderHub;
+
+// Hands every peer connection an encoder that shares its work with the
+// encoders of the other connections streaming the same display: each frame is
+// encoded once per display and quality layer and the output sent to all of
+// them. Viewers land in the same layer when their senders configure the
+// encoder the same way and their bandwidth estimates are within a factor of
+// two of each other, the layer encodes at the rate of its slowest viewer.
+// Viewers whose connection skips frames the others encode, for instance
+// because its encoder thread is overloaded, get an encoder of their own instead
+// of having the whole layer send keyframes for them.
+// Frames are matched across connections by the display id their source sets
+// as the frame id, frames without one are encoded for their connection alone.
+class SharedVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  SharedVideoEncoderFactory(std::unique_ptr<webrtc::VideoEncoderFactory> inner,
+                            SharedEncodingOptions options);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::shared_ptr<SharedEncoderHub> hub_;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
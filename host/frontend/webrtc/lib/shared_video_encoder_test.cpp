@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/shared_video_encoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame.h>
+#include <gtest/gtest.h>
+#include <modules/video_coding/include/video_codec_interface.h>
+#include <modules/video_coding/include/video_error_codes.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+using webrtc::VideoFrameType;
+
+constexpr auto kKey = VideoFrameType::kVideoFrameKey;
+constexpr auto kDelta = VideoFrameType::kVideoFrameDelta;
+
+// The frames encoded by every inner encoder, in the order they were
+// initialized.
+using Encodes = std::vector<std::vector<VideoFrameType>>;
+
+// Encodes every frame into a single byte, of the type it was asked for.
+class FakeEncoder : public webrtc::VideoEncoder {
+ public:
+  explicit FakeEncoder(Encodes* encodes) : encodes_(encodes) {}
+
+  int32_t InitEncode(const webrtc::VideoCodec*, const Settings&) override {
+    index_ = encodes_->size();
+    encodes_->emplace_back();
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t Release() override { return WEBRTC_VIDEO_CODEC_OK; }
+
+  int32_t Encode(const webrtc::VideoFrame&,
+                 const std::vector<VideoFrameType>* frame_types) override {
+    auto type = frame_types && !frame_types->empty() ? frame_types->front()
+                                                     : kDelta;
+    (*encodes_)[index_].push_back(type);
+    uint8_t byte = 0;
+    webrtc::EncodedImage image;
+    image._frameType = type;
+    image.SetEncodedData(webrtc::EncodedImageBuffer::Create(&byte, 1));
+    webrtc::CodecSpecificInfo info;
+    callback_->OnEncodedImage(image, &info, nullptr);
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  void SetRates(const RateControlParameters&) override {}
+
+  EncoderInfo GetEncoderInfo() const override { return EncoderInfo(); }
+
+ private:
+  Encodes* encodes_;
+  std::size_t index_ = 0;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+};
+
+class FakeEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  explicit FakeEncoderFactory(Encodes* encodes) : encodes_(encodes) {}
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override {
+    return {webrtc::SdpVideoFormat("VP8")};
+  }
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat&) const override {
+    return CodecInfo();
+  }
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat&) override {
+    return std::make_unique<FakeEncoder>(encodes_);
+  }
+
+ private:
+  Encodes* encodes_;
+};
+
+// The encoder of one connection and the frames it sent.
+class Viewer : public webrtc::EncodedImageCallback {
+ public:
+  explicit Viewer(webrtc::VideoEncoderFactory& factory, int width = 720)
+      : encoder_(factory.CreateVideoEncoder(webrtc::SdpVideoFormat("VP8"))) {
+    encoder_->RegisterEncodeCompleteCallback(this);
+    Init(width);
+  }
+
+  void Init(int width) {
+    webrtc::VideoCodec codec;
+    codec.width = width;
+    codec.height = 1280;
+    codec.maxBitrate = 10000;
+    codec.maxFramerate = 60;
+    codec.numberOfSimulcastStreams = 1;
+    webrtc::VideoEncoder::Settings settings(
+        webrtc::VideoEncoder::Capabilities(false), 1, 1200);
+    ASSERT_EQ(encoder_->InitEncode(&codec, settings), WEBRTC_VIDEO_CODEC_OK);
+  }
+
+  void SetBitrate(uint32_t bps) {
+    webrtc::VideoBitrateAllocation allocation;
+    allocation.SetBitrate(0, 0, bps);
+    encoder_->SetRates(
+        webrtc::VideoEncoder::RateControlParameters(allocation, 30));
+  }
+
+  // Frames of the same display and index are the same frame.
+  void Encode(uint16_t display, int index, bool keyframe = false) {
+    auto frame = webrtc::VideoFrame::Builder()
+                     .set_video_frame_buffer(webrtc::I420Buffer::Create(2, 2))
+                     .set_timestamp_us(1000 + index * 16000)
+                     .set_timestamp_rtp(index * 1440)
+                     .set_id(display)
+                     .build();
+    std::vector<VideoFrameType> types = {keyframe ? kKey : kDelta};
+    ASSERT_EQ(encoder_->Encode(frame, &types), WEBRTC_VIDEO_CODEC_OK);
+  }
+
+  Result OnEncodedImage(const webrtc::EncodedImage& image,
+                        const webrtc::CodecSpecificInfo*,
+                        const webrtc::RTPFragmentationHeader*) override {
+    sent.push_back(image._frameType);
+    return Result(Result::OK);
+  }
+
+  std::vector<VideoFrameType> sent;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+};
+
+class SharedVideoEncoderTest : public testing::Test {
+ protected:
+  void CreateFactory(std::chrono::milliseconds min_keyframe_interval) {
+    SharedEncodingOptions options;
+    options.min_keyframe_interval = min_keyframe_interval;
+    factory_ = std::make_unique<SharedVideoEncoderFactory>(
+        std::make_unique<FakeEncoderFactory>(&encodes_), options);
+  }
+
+  void SetUp() override { CreateFactory(std::chrono::milliseconds(0)); }
+
+  Encodes encodes_;
+  std::unique_ptr<SharedVideoEncoderFactory> factory_;
+};
+
+TEST_F(SharedVideoEncoderTest, SharesEncoderOfDisplay) {
+  Viewer a(*factory_);
+  Viewer b(*factory_);
+  a.Encode(1, 1);
+  b.Encode(1, 1);
+  a.Encode(1, 2);
+  b.Encode(1, 2);
+  EXPECT_EQ(encodes_, Encodes({{kKey, kDelta}}));
+  EXPECT_EQ(a.sent, std::vector<VideoFrameType>({kKey, kDelta}));
+  EXPECT_EQ(b.sent, std::vector<VideoFrameType>({kKey, kDelta}));
+}
+
+TEST_F(SharedVideoEncoderTest, SeparatesDisplaysAndSettings) {
+  Viewer a(*factory_);
+  Viewer other_display(*factory_);
+  Viewer other_width(*factory_, 360);
+  a.Encode(1, 1);
+  other_display.Encode(2, 1);
+  other_width.Encode(1, 1);
+  EXPECT_EQ(encodes_.size(), 3u);
+}
+
+TEST_F(SharedVideoEncoderTest, NeverSharesFramesOfUnknownDisplays) {
+  Viewer a(*factory_);
+  Viewer b(*factory_);
+  a.Encode(0, 1);
+  b.Encode(0, 1);
+  EXPECT_EQ(encodes_.size(), 2u);
+}
+
+TEST_F(SharedVideoEncoderTest, SeparatesBitrateLayers) {
+  Viewer slow(*factory_);
+  Viewer fast(*factory_);
+  Viewer close_to_fast(*factory_);
+  slow.SetBitrate(200000);
+  fast.SetBitrate(2000000);
+  close_to_fast.SetBitrate(2100000);
+  slow.Encode(1, 1);
+  fast.Encode(1, 1);
+  close_to_fast.Encode(1, 1);
+  EXPECT_EQ(encodes_, Encodes({{kKey}, {kKey}}));
+}
+
+TEST_F(SharedVideoEncoderTest, ResyncsJoiningViewerWithKeyframe) {
+  Viewer a(*factory_);
+  a.Encode(1, 1);
+  a.Encode(1, 2);
+
+  Viewer b(*factory_);
+  a.Encode(1, 3);
+  b.Encode(1, 3);
+  a.Encode(1, 4);
+  b.Encode(1, 4);
+  a.Encode(1, 5);
+  b.Encode(1, 5);
+  // b waited for the keyframe it asked for.
+  EXPECT_EQ(encodes_, Encodes({{kKey, kDelta, kDelta, kKey, kDelta}}));
+  EXPECT_EQ(b.sent, std::vector<VideoFrameType>({kKey, kDelta}));
+}
+
+TEST_F(SharedVideoEncoderTest, CoalescesKeyframeRequests) {
+  CreateFactory(std::chrono::milliseconds(100));
+  Viewer a(*factory_);
+  Viewer b(*factory_);
+  a.Encode(1, 1);
+  b.Encode(1, 1);
+  // Both ask for a keyframe, too soon after the last one.
+  a.Encode(1, 2, true);
+  b.Encode(1, 2, true);
+  a.Encode(1, 3, true);
+  b.Encode(1, 3);
+  EXPECT_EQ(encodes_, Encodes({{kKey, kDelta, kDelta}}));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  a.Encode(1, 4);
+  b.Encode(1, 4);
+  a.Encode(1, 5);
+  b.Encode(1, 5);
+  EXPECT_EQ(encodes_, Encodes({{kKey, kDelta, kDelta, kKey, kDelta}}));
+  EXPECT_EQ(b.sent, std::vector<VideoFrameType>(
+                        {kKey, kDelta, kDelta, kKey, kDelta}));
+}
+
+TEST_F(SharedVideoEncoderTest, ViewerMissingFramesGetsOwnEncoder) {
+  Viewer a(*factory_);
+  Viewer b(*factory_);
+  a.Encode(1, 1);
+  b.Encode(1, 1);
+  // b's connection drops frame 2.
+  a.Encode(1, 2);
+  a.Encode(1, 3);
+  b.Encode(1, 3);
+  b.Encode(1, 4);
+  a.Encode(1, 4);
+
+  // Only b's new encoder sent a keyframe.
+  EXPECT_EQ(encodes_,
+            Encodes({{kKey, kDelta, kDelta, kDelta}, {kKey, kDelta}}));
+  EXPECT_EQ(a.sent,
+            std::vector<VideoFrameType>({kKey, kDelta, kDelta, kDelta}));
+  EXPECT_EQ(b.sent, std::vector<VideoFrameType>({kKey, kKey, kDelta}));
+
+  // New viewers still join a's encoder.
+  Viewer c(*factory_);
+  c.Encode(1, 5);
+  EXPECT_EQ(encodes_.size(), 2u);
+}
+
+TEST_F(SharedVideoEncoderTest, LaggingViewerGetsOwnEncoder) {
+  Viewer a(*factory_);
+  Viewer b(*factory_);
+  a.Encode(1, 1);
+  b.Encode(1, 1);
+  for (int i = 2; i < 40; i++) {
+    a.Encode(1, i);
+  }
+  // Long gone from the frames kept for the others.
+  b.Encode(1, 2);
+  EXPECT_EQ(encodes_.size(), 2u);
+  EXPECT_EQ(encodes_[0].front(), kKey);
+  EXPECT_EQ(std::count(encodes_[0].begin(), encodes_[0].end(), kKey), 1);
+  EXPECT_EQ(b.sent, std::vector<VideoFrameType>({kKey, kKey}));
+}
+
+TEST_F(SharedVideoEncoderTest, LoneViewerSkippingFramesKeepsEncoding) {
+  // Frames nobody asked for are never encoded, nothing misses them.
+  Viewer a(*factory_);
+  a.Encode(1, 1);
+  a.Encode(1, 3);
+  a.Encode(1, 4);
+  EXPECT_EQ(encodes_, Encodes({{kKey, kDelta, kDelta}}));
+  EXPECT_EQ(a.sent, std::vector<VideoFrameType>({kKey, kDelta, kDelta}));
+}
+
+TEST_F(SharedVideoEncoderTest, SharesAgainAfterReinit) {
+  Viewer a(*factory_);
+  Viewer b(*factory_);
+  a.Encode(1, 1);
+  b.Encode(1, 1);
+  a.Encode(1, 2);
+  a.Encode(1, 3);
+  b.Encode(1, 3);
+  ASSERT_EQ(encodes_.size(), 2u);
+
+  b.Init(720);
+  a.Encode(1, 4);
+  b.Encode(1, 4);
+  a.Encode(1, 5);
+  b.Encode(1, 5);
+  EXPECT_EQ(encodes_.size(), 2u);
+  EXPECT_EQ(encodes_[0].back(), kKey);
+  EXPECT_EQ(b.sent.back(), kKey);
+}
+
+}  // namespace
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
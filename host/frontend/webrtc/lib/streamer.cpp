@@ -205,13 +205,20 @@ std::unique_ptr<Streamer> Streamer::Create(
       rtc::scoped_refptr<CfAudioDeviceModule>(
           new rtc::RefCountedObject<CfAudioDeviceModule>()));
 
+  std::unique_ptr<webrtc::VideoEncoderFactory> video_encoder_factory =
+      std::make_unique<VP8OnlyEncoderFactory>(
+          webrtc::CreateBuiltinVideoEncoderFactory());
+  if (cfg.shared_encoding) {
+    video_encoder_factory = std::make_unique<SharedVideoEncoderFactory>(
+        std::move(video_encoder_factory), *cfg.shared_encoding);
+  }
+
   impl->peer_connection_factory_ = webrtc::CreatePeerConnectionFactory(
       impl->network_thread_.get(), impl->worker_thread_.get(),
       impl->signal_thread_.get(), impl->audio_device_module_->device_module(),
       webrtc::CreateBuiltinAudioEncoderFactory(),
       webrtc::CreateBuiltinAudioDecoderFactory(),
-      std::make_unique<VP8OnlyEncoderFactory>(
-          webrtc::CreateBuiltinVideoEncoderFactory()),
+      std::move(video_encoder_factory),
       webrtc::CreateBuiltinVideoDecoderFactory(), nullptr /* audio_mixer */,
       nullptr /* audio_processing */);
 
@@ -242,7 +249,8 @@ std::shared_ptr<VideoSink> Streamer::AddDisplay(const std::string& label,
           return nullptr;
         }
         rtc::scoped_refptr<VideoTrackSourceImpl> source(
-            new rtc::RefCountedObject<VideoTrackSourceImpl>(width, height));
+            new rtc::RefCountedObject<VideoTrackSourceImpl>(
+                width, height, impl_->displays_.size() + 1));
         impl_->displays_[label] = {width, height, dpi, touch_enabled, source};
         return std::shared_ptr<VideoSink>(
             new VideoTrackSourceImplSinkWrapper(source));
@@ -33,6 +33,7 @@
 #include "host/frontend/webrtc/lib/local_recorder.h"
 #include "host/frontend/webrtc/lib/video_sink.h"
 #include "host/frontend/webrtc/lib/server_connection.h"
+#include "host/frontend/webrtc/lib/shared_video_encoder.h"
 
 namespace cuttlefish {
 namespace webrtc_streaming {
@@ -49,6 +50,9 @@ struct StreamerConfig {
   // [0,0] means all ports
   std::pair<uint16_t, uint16_t> udp_port_range = {15550, 15558};
   std::pair<uint16_t, uint16_t> tcp_port_range = {15550, 15558};
+  // Encode each display once for all the clients watching it, instead of once
+  // per client.
+  std::optional<SharedEncodingOptions> shared_encoding;
 };
 
 class OperatorObserver {
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/video_quality.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+namespace {
+
+using ContentHint = webrtc::VideoTrackInterface::ContentHint;
+
+// libwebrtc starts at 300kbps and drops the first frames it receives at that
+// rate. Anything over 2Mbps is capped at 2Mbps by the peer connection.
+constexpr int kDefaultStartBitrateBps = 2000000;
+// Well over what a display stream needs, and low enough for the bitrates in
+// bps to fit an int.
+constexpr unsigned int kMaxBitrateKbps = 100000;
+
+bool ApplyContent(const std::string& content, VideoQuality* quality) {
+  if (content == "auto") {
+    quality->content_hint = ContentHint::kNone;
+    quality->degradation_preference = std::nullopt;
+  } else if (content == "text") {
+    // Keeps text readable, lowering the frame rate rather than the resolution.
+    quality->content_hint = ContentHint::kText;
+    quality->degradation_preference =
+        webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
+  } else if (content == "detail") {
+    quality->content_hint = ContentHint::kDetailed;
+    quality->degradation_preference =
+        webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
+  } else if (content == "motion") {
+    // Keeps animations and games smooth at the expense of sharpness.
+    quality->content_hint = ContentHint::kFluid;
+    quality->degradation_preference =
+        webrtc::DegradationPreference::MAINTAIN_FRAMERATE;
+  } else {
+    return false;
+  }
+  quality->content = content;
+  return true;
+}
+
+bool ApplyProfile(const std::string& profile, VideoQuality* quality) {
+  if (profile == "default") {
+    quality->start_bitrate_bps = std::nullopt;
+    quality->min_bitrate_bps = std::nullopt;
+    quality->max_bitrate_bps = std::nullopt;
+    quality->max_framerate = std::nullopt;
+  } else if (profile == "lan") {
+    // Lifts libwebrtc's resolution based cap for links that can take it.
+    quality->start_bitrate_bps = kDefaultStartBitrateBps;
+    quality->min_bitrate_bps = 1000000;
+    quality->max_bitrate_bps = 10000000;
+    quality->max_framerate = 60;
+  } else if (profile == "constrained") {
+    // For VPNs and other slow or lossy links: fewer, better frames.
+    quality->start_bitrate_bps = 500000;
+    quality->min_bitrate_bps = 100000;
+    quality->max_bitrate_bps = 1000000;
+    quality->max_framerate = 15;
+  } else {
+    return false;
+  }
+  quality->profile = profile;
+  return true;
+}
+
+}  // namespace
+
+ValidationResult VideoQuality::FromJson(const Json::Value& message,
+                                        VideoQuality* quality) {
+  auto result = ValidationResult::ValidateJsonObject(
+      message, "video-quality", {},
+      {
+          {"content", Json::ValueType::stringValue},
+          {"profile", Json::ValueType::stringValue},
+          {"min_bitrate_kbps", Json::ValueType::uintValue},
+          {"max_bitrate_kbps", Json::ValueType::uintValue},
+          {"max_framerate", Json::ValueType::realValue},
+      });
+  if (!result.ok()) {
+    return result;
+  }
+  VideoQuality parsed;
+  if (message.isMember("content") &&
+      !ApplyContent(message["content"].asString(), &parsed)) {
+    return {"Unknown video content mode: " + message["content"].asString()};
+  }
+  if (message.isMember("profile") &&
+      !ApplyProfile(message["profile"].asString(), &parsed)) {
+    return {"Unknown video quality profile: " + message["profile"].asString()};
+  }
+  for (const auto& [field, bitrate_bps] :
+       {std::make_pair("min_bitrate_kbps", &parsed.min_bitrate_bps),
+        std::make_pair("max_bitrate_kbps", &parsed.max_bitrate_bps)}) {
+    if (!message.isMember(field)) {
+      continue;
+    }
+    auto kbps = message[field].asUInt();
+    if (kbps > kMaxBitrateKbps) {
+      return {std::string(field) + " can't be greater than " +
+              std::to_string(kMaxBitrateKbps)};
+    }
+    *bitrate_bps = static_cast<int>(kbps) * 1000;
+  }
+  if (parsed.max_bitrate_bps && *parsed.max_bitrate_bps == 0) {
+    return {"max_bitrate_kbps must be positive"};
+  }
+  if (message.isMember("max_framerate")) {
+    parsed.max_framerate = message["max_framerate"].asDouble();
+    if (*parsed.max_framerate <= 0) {
+      return {"max_framerate must be positive"};
+    }
+  }
+  if (parsed.min_bitrate_bps && parsed.max_bitrate_bps &&
+      *parsed.min_bitrate_bps > *parsed.max_bitrate_bps) {
+    return {"min_bitrate_kbps can't be greater than max_bitrate_kbps"};
+  }
+  *quality = parsed;
+  return {};
+}
+
+Json::Value VideoQuality::ToJson() const {
+  Json::Value json;
+  json["content"] = content;
+  json["profile"] = profile;
+  if (min_bitrate_bps) {
+    json["min_bitrate_kbps"] = *min_bitrate_bps / 1000;
+  }
+  if (max_bitrate_bps) {
+    json["max_bitrate_kbps"] = *max_bitrate_bps / 1000;
+  }
+  if (max_framerate) {
+    json["max_framerate"] = *max_framerate;
+  }
+  return json;
+}
+
+webrtc::BitrateSettings VideoQuality::StartBitrateSettings() const {
+  webrtc::BitrateSettings settings;
+  settings.start_bitrate_bps =
+      start_bitrate_bps.value_or(kDefaultStartBitrateBps);
+  // The start bitrate has to be in range, or it's ignored.
+  if (min_bitrate_bps) {
+    settings.start_bitrate_bps =
+        std::max(*settings.start_bitrate_bps, *min_bitrate_bps);
+  }
+  if (max_bitrate_bps) {
+    settings.start_bitrate_bps =
+        std::min(*settings.start_bitrate_bps, *max_bitrate_bps);
+  }
+  return settings;
+}
+
+webrtc::RTCError VideoQuality::ApplyTo(
+    webrtc::VideoTrackInterface* track,
+    webrtc::RtpSenderInterface* sender) const {
+  track->set_content_hint(content_hint);
+
+  auto parameters = sender->GetParameters();
+  ApplyTo(&parameters);
+  return sender->SetParameters(parameters);
+}
+
+void VideoQuality::ApplyTo(webrtc::RtpParameters* parameters) const {
+  if (degradation_preference) {
+    parameters->degradation_preference = *degradation_preference;
+  } else {
+    parameters->degradation_preference =
+        webrtc::DegradationPreference::BALANCED;
+  }
+  for (auto& encoding : parameters->encodings) {
+    encoding.min_bitrate_bps = absl::nullopt;
+    if (min_bitrate_bps) {
+      encoding.min_bitrate_bps = *min_bitrate_bps;
+    }
+    encoding.max_bitrate_bps = absl::nullopt;
+    if (max_bitrate_bps) {
+      encoding.max_bitrate_bps = *max_bitrate_bps;
+    }
+    encoding.max_framerate = absl::nullopt;
+    if (max_framerate) {
+      encoding.max_framerate = *max_framerate;
+    }
+  }
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
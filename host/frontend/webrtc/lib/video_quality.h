@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include <json/json.h>
+
+#include <api/media_stream_interface.h>
+#include <api/rtp_parameters.h>
+#include <api/rtp_sender_interface.h>
+#include <api/transport/bitrate_settings.h>
+
+#include "host/frontend/webrtc/lib/utils.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// How a client wants the displays encoded for it. Clients pick a content mode
+// (what matters on screen: text, detail or motion) and a bandwidth profile
+// (the link they are on), each field of which they may override. Unset fields
+// leave libwebrtc's own choices in place.
+struct VideoQuality {
+  std::string content = "auto";
+  std::string profile = "default";
+  webrtc::VideoTrackInterface::ContentHint content_hint =
+      webrtc::VideoTrackInterface::ContentHint::kNone;
+  std::optional<webrtc::DegradationPreference> degradation_preference;
+  std::optional<int> start_bitrate_bps;
+  std::optional<int> min_bitrate_bps;
+  std::optional<int> max_bitrate_bps;
+  std::optional<double> max_framerate;
+
+  // Parses a message like
+  // {"content": "text", "profile": "constrained", "max_bitrate_kbps": 600}.
+  // Every field is optional, bitrates are at most 100Mbps.
+  static ValidationResult FromJson(const Json::Value& message,
+                                   VideoQuality* quality);
+
+  Json::Value ToJson() const;
+
+  // Connection wide settings, for the bandwidth estimation to start from.
+  webrtc::BitrateSettings StartBitrateSettings() const;
+
+  // Applies the per display settings to the track and sender streaming it.
+  webrtc::RTCError ApplyTo(webrtc::VideoTrackInterface* track,
+                           webrtc::RtpSenderInterface* sender) const;
+  // The part of the above that goes through the sender's parameters.
+  void ApplyTo(webrtc::RtpParameters* parameters) const;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
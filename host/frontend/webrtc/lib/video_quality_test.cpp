@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/video_quality.h"
+
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+using ContentHint = webrtc::VideoTrackInterface::ContentHint;
+
+Json::Value Parse(const std::string& text) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value value;
+  std::string errors;
+  EXPECT_TRUE(
+      reader->parse(text.data(), text.data() + text.size(), &value, &errors))
+      << errors;
+  return value;
+}
+
+TEST(VideoQualityTest, EmptyMessageKeepsDefaults) {
+  VideoQuality quality;
+  auto result =
+      VideoQuality::FromJson(Json::Value(Json::objectValue), &quality);
+  ASSERT_TRUE(result.ok()) << result.error();
+  EXPECT_EQ(quality.content, "auto");
+  EXPECT_EQ(quality.profile, "default");
+  EXPECT_EQ(quality.content_hint, ContentHint::kNone);
+  EXPECT_FALSE(quality.degradation_preference.has_value());
+  EXPECT_FALSE(quality.start_bitrate_bps.has_value());
+  EXPECT_FALSE(quality.min_bitrate_bps.has_value());
+  EXPECT_FALSE(quality.max_bitrate_bps.has_value());
+  EXPECT_FALSE(quality.max_framerate.has_value());
+}
+
+TEST(VideoQualityTest, ContentAndProfile) {
+  VideoQuality quality;
+  auto result = VideoQuality::FromJson(
+      Parse(R"({"content": "text", "profile": "constrained"})"), &quality);
+  ASSERT_TRUE(result.ok()) << result.error();
+  EXPECT_EQ(quality.content_hint, ContentHint::kText);
+  EXPECT_EQ(quality.degradation_preference,
+            webrtc::DegradationPreference::MAINTAIN_RESOLUTION);
+  EXPECT_EQ(quality.start_bitrate_bps, 500000);
+  EXPECT_EQ(quality.min_bitrate_bps, 100000);
+  EXPECT_EQ(quality.max_bitrate_bps, 1000000);
+  EXPECT_EQ(quality.max_framerate, 15);
+
+  auto json = quality.ToJson();
+  EXPECT_EQ(json["content"].asString(), "text");
+  EXPECT_EQ(json["profile"].asString(), "constrained");
+  EXPECT_EQ(json["max_bitrate_kbps"].asInt(), 1000);
+}
+
+TEST(VideoQualityTest, FieldsOverrideProfile) {
+  VideoQuality quality;
+  auto result = VideoQuality::FromJson(
+      Parse(R"({"profile": "lan", "max_bitrate_kbps": 4000,
+                "max_framerate": 30})"),
+      &quality);
+  ASSERT_TRUE(result.ok()) << result.error();
+  EXPECT_EQ(quality.min_bitrate_bps, 1000000);
+  EXPECT_EQ(quality.max_bitrate_bps, 4000000);
+  EXPECT_EQ(quality.max_framerate, 30);
+}
+
+TEST(VideoQualityTest, RejectsInvalidMessages) {
+  for (const auto& text : {
+           R"({"content": "cinema"})",
+           R"({"profile": "satellite"})",
+           R"({"max_bitrate_kbps": -1})",
+           R"({"max_bitrate_kbps": 0})",
+           R"({"max_bitrate_kbps": "fast"})",
+           R"({"max_framerate": 0})",
+           R"({"min_bitrate_kbps": 2000, "max_bitrate_kbps": 1000})",
+       }) {
+    VideoQuality quality;
+    quality.content = "unchanged";
+    EXPECT_FALSE(VideoQuality::FromJson(Parse(text), &quality).ok()) << text;
+    EXPECT_EQ(quality.content, "unchanged") << text;
+  }
+}
+
+TEST(VideoQualityTest, RejectsBitratesOverflowingBps) {
+  // Valid unsigned ints, too large once converted to bps.
+  for (const auto& text : {
+           R"({"max_bitrate_kbps": 100001})",
+           R"({"min_bitrate_kbps": 3000000})",
+           R"({"max_bitrate_kbps": 4294967295})",
+       }) {
+    VideoQuality quality;
+    auto result = VideoQuality::FromJson(Parse(text), &quality);
+    ASSERT_FALSE(result.ok()) << text;
+    EXPECT_NE(result.error().find("can't be greater than"), std::string::npos)
+        << result.error();
+  }
+  VideoQuality quality;
+  auto result = VideoQuality::FromJson(
+      Parse(R"({"max_bitrate_kbps": 100000})"), &quality);
+  ASSERT_TRUE(result.ok()) << result.error();
+  EXPECT_EQ(quality.max_bitrate_bps, 100000000);
+}
+
+TEST(VideoQualityTest, StartBitrateDefault) {
+  VideoQuality quality;
+  EXPECT_EQ(quality.StartBitrateSettings().start_bitrate_bps, 2000000);
+}
+
+TEST(VideoQualityTest, StartBitrateWithinRange) {
+  VideoQuality quality;
+  quality.max_bitrate_bps = 1000000;
+  EXPECT_EQ(quality.StartBitrateSettings().start_bitrate_bps, 1000000);
+
+  quality.max_bitrate_bps = std::nullopt;
+  quality.min_bitrate_bps = 3000000;
+  EXPECT_EQ(quality.StartBitrateSettings().start_bitrate_bps, 3000000);
+
+  quality.min_bitrate_bps = 100000;
+  quality.start_bitrate_bps = 500000;
+  EXPECT_EQ(quality.StartBitrateSettings().start_bitrate_bps, 500000);
+}
+
+TEST(VideoQualityTest, ApplyToSetsEveryEncoding) {
+  VideoQuality quality;
+  ASSERT_TRUE(VideoQuality::FromJson(
+                  Parse(R"({"content": "motion", "profile": "lan"})"), &quality)
+                  .ok());
+  webrtc::RtpParameters parameters;
+  parameters.encodings.resize(2);
+  quality.ApplyTo(&parameters);
+  EXPECT_EQ(parameters.degradation_preference,
+            webrtc::DegradationPreference::MAINTAIN_FRAMERATE);
+  for (const auto& encoding : parameters.encodings) {
+    EXPECT_EQ(encoding.min_bitrate_bps, 1000000);
+    EXPECT_EQ(encoding.max_bitrate_bps, 10000000);
+    EXPECT_EQ(encoding.max_framerate, 60);
+  }
+}
+
+TEST(VideoQualityTest, ApplyToClearsPreviousSettings) {
+  webrtc::RtpParameters parameters;
+  parameters.degradation_preference =
+      webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
+  parameters.encodings.resize(1);
+  parameters.encodings[0].min_bitrate_bps = 1;
+  parameters.encodings[0].max_bitrate_bps = 2;
+  parameters.encodings[0].max_framerate = 3;
+
+  // Switching back to the defaults hands the choices back to libwebrtc.
+  VideoQuality().ApplyTo(&parameters);
+  EXPECT_EQ(parameters.degradation_preference,
+            webrtc::DegradationPreference::BALANCED);
+  EXPECT_FALSE(parameters.encodings[0].min_bitrate_bps.has_value());
+  EXPECT_FALSE(parameters.encodings[0].max_bitrate_bps.has_value());
+  EXPECT_FALSE(parameters.encodings[0].max_framerate.has_value());
+}
+
+}  // namespace
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -51,8 +51,12 @@ class VideoFrameWrapper : public webrtc::I420BufferInterface {
 
 }  // namespace
 
-VideoTrackSourceImpl::VideoTrackSourceImpl(int width, int height)
-    : webrtc::VideoTrackSource(false), width_(width), height_(height) {}
+VideoTrackSourceImpl::VideoTrackSourceImpl(int width, int height,
+                                           uint16_t frame_id)
+    : webrtc::VideoTrackSource(false),
+      width_(width),
+      height_(height),
+      frame_id_(frame_id) {}
 
 void VideoTrackSourceImpl::OnFrame(std::shared_ptr<VideoFrameBuffer> frame,
                                    int64_t timestamp_us) {
@@ -61,6 +65,7 @@ void VideoTrackSourceImpl::OnFrame(std::shared_ptr<VideoFrameBuffer> frame,
           .set_video_frame_buffer(
               new rtc::RefCountedObject<VideoFrameWrapper>(frame))
           .set_timestamp_us(timestamp_us)
+          .set_id(frame_id_)
           .build();
   broadcaster_.OnFrame(video_frame);
 }
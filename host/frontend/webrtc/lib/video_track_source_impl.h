@@ -26,7 +26,8 @@ namespace webrtc_streaming {
 
 class VideoTrackSourceImpl : public webrtc::VideoTrackSource {
  public:
-  VideoTrackSourceImpl(int width, int height);
+  // The frames carry the id so that encoders can tell the displays apart.
+  VideoTrackSourceImpl(int width, int height, uint16_t frame_id);
 
   void OnFrame(std::shared_ptr<VideoFrameBuffer> frame, int64_t timestamp_us);
 
@@ -48,6 +49,7 @@ class VideoTrackSourceImpl : public webrtc::VideoTrackSource {
  private:
   int width_;
   int height_;
+  uint16_t frame_id_;
   rtc::VideoBroadcaster broadcaster_;
 };
 
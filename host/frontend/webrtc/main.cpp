@@ -16,6 +16,7 @@
 
 #include <linux/input.h>
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <utility>
@@ -33,7 +34,10 @@
 #include "host/frontend/webrtc/client_server.h"
 #include "host/frontend/webrtc/connection_observer.h"
 #include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/frame_capture.h"
+#include "host/frontend/webrtc/input_engine.h"
 #include "host/frontend/webrtc/kernel_log_events_handler.h"
+#include "host/frontend/webrtc/screen_stability.h"
 #include "host/frontend/webrtc/lib/camera_controller.h"
 #include "host/frontend/webrtc/lib/local_recorder.h"
 #include "host/frontend/webrtc/lib/streamer.h"
@@ -61,16 +65,37 @@ DEFINE_bool(write_virtio_input, true,
 DEFINE_int32(audio_server_fd, -1, "An fd to listen on for audio frames");
 DEFINE_int32(camera_streamer_fd, -1, "An fd to send client camera frames");
 DEFINE_string(client_dir, "webrtc", "Location of the client files");
+DEFINE_int32(frame_capture_fd, -1,
+             "An fd to listen on for host side screenshot requests");
+DEFINE_uint32(frame_capture_encoder_threads, 2,
+              "Number of threads used to encode captured frames, at least 1");
+DEFINE_int32(input_control_fd, -1,
+             "An fd to listen on for input recording and replay commands");
+DEFINE_int32(screen_stability_fd, -1,
+             "An fd to listen on for screen stability queries");
+DEFINE_uint32(screen_stability_block_size, 16,
+              "Size in pixels of the square blocks compared between frames "
+              "to detect screen changes");
+DEFINE_bool(share_video_encoders, false,
+            "Encode each display once for all the clients watching it with "
+            "similar settings and bandwidth, instead of once per client.");
+DEFINE_uint32(shared_keyframe_interval_ms, 0,
+              "Milliseconds between keyframes sent to the clients sharing an "
+              "encoder without being requested, 0 to send them on request "
+              "only.");
 
 using cuttlefish::AudioHandler;
 using cuttlefish::CfConnectionObserverFactory;
 using cuttlefish::DisplayHandler;
+using cuttlefish::FrameCapture;
 using cuttlefish::KernelLogEventsHandler;
+using cuttlefish::ScreenStabilityDetector;
 using cuttlefish::webrtc_streaming::LocalRecorder;
 using cuttlefish::webrtc_streaming::Streamer;
 using cuttlefish::webrtc_streaming::StreamerConfig;
 using cuttlefish::webrtc_streaming::VideoSink;
 using cuttlefish::webrtc_streaming::ServerConfig;
+using cuttlefish::webrtc_streaming::SharedEncodingOptions;
 
 class CfOperatorObserver
     : public cuttlefish::webrtc_streaming::OperatorObserver {
@@ -165,37 +190,46 @@ int main(int argc, char** argv) {
   // devices there is no meaningful interaction the user can have with the
   // device.
   for (const auto& touch_entry : input_sockets.touch_servers) {
-    input_sockets.touch_clients[touch_entry.first] =
-        cuttlefish::SharedFD::Accept(*touch_entry.second);
+    input_sockets.SetTouchClient(
+        touch_entry.first, cuttlefish::SharedFD::Accept(*touch_entry.second));
   }
-  input_sockets.keyboard_client =
-      cuttlefish::SharedFD::Accept(*input_sockets.keyboard_server);
-  input_sockets.switches_client =
-      cuttlefish::SharedFD::Accept(*input_sockets.switches_server);
+  input_sockets.SetKeyboardClient(
+      cuttlefish::SharedFD::Accept(*input_sockets.keyboard_server));
+  input_sockets.SetSwitchesClient(
+      cuttlefish::SharedFD::Accept(*input_sockets.switches_server));
 
   std::vector<std::thread> touch_accepters;
   for (const auto& touch : input_sockets.touch_servers) {
     auto label = touch.first;
-    touch_accepters.emplace_back([label, &input_sockets]() {
+    auto server = touch.second;
+    touch_accepters.emplace_back([label, server, &input_sockets]() {
       for (;;) {
-        input_sockets.touch_clients[label] =
-            cuttlefish::SharedFD::Accept(*input_sockets.touch_servers[label]);
+        input_sockets.SetTouchClient(label,
+                                     cuttlefish::SharedFD::Accept(*server));
       }
     });
   }
   std::thread keyboard_accepter([&input_sockets]() {
     for (;;) {
-      input_sockets.keyboard_client =
-          cuttlefish::SharedFD::Accept(*input_sockets.keyboard_server);
+      input_sockets.SetKeyboardClient(
+          cuttlefish::SharedFD::Accept(*input_sockets.keyboard_server));
     }
   });
   std::thread switches_accepter([&input_sockets]() {
     for (;;) {
-      input_sockets.switches_client =
-          cuttlefish::SharedFD::Accept(*input_sockets.switches_server);
+      input_sockets.SetSwitchesClient(
+          cuttlefish::SharedFD::Accept(*input_sockets.switches_server));
     }
   });
 
+  cuttlefish::InputEngine input_engine(input_sockets);
+  if (FLAGS_input_control_fd >= 0) {
+    auto input_control_server =
+        cuttlefish::SharedFD::Dup(FLAGS_input_control_fd);
+    close(FLAGS_input_control_fd);
+    input_engine.Serve(input_control_server);
+  }
+
   auto kernel_log_events_client =
       cuttlefish::SharedFD::Dup(FLAGS_kernel_log_events_fd);
   close(FLAGS_kernel_log_events_fd);
@@ -234,6 +268,15 @@ int main(int argc, char** argv) {
         ServerConfig::Security::kInsecure;
   }
 
+  if (FLAGS_share_video_encoders) {
+    SharedEncodingOptions shared_encoding;
+    shared_encoding.keyframe_interval =
+        std::chrono::milliseconds(FLAGS_shared_keyframe_interval_ms);
+    streamer_config.shared_encoding = shared_encoding;
+  } else {
+    streamer_config.shared_encoding.reset();
+  }
+
   if (!cvd_config->sig_server_headers_path().empty()) {
     streamer_config.operator_server.http_headers =
         ParseHttpHeaders(cvd_config->sig_server_headers_path());
@@ -241,7 +284,7 @@ int main(int argc, char** argv) {
 
   KernelLogEventsHandler kernel_logs_event_handler(kernel_log_events_client);
   auto observer_factory = std::make_shared<CfConnectionObserverFactory>(
-      input_sockets, &kernel_logs_event_handler, host_confui_server);
+      input_engine, &kernel_logs_event_handler, host_confui_server);
 
   auto streamer = Streamer::Create(streamer_config, observer_factory);
   CHECK(streamer) << "Could not create streamer";
@@ -262,6 +305,46 @@ int main(int argc, char** argv) {
   auto display_handler =
       std::make_shared<DisplayHandler>(std::move(displays), screen_connector);
 
+  std::unique_ptr<FrameCapture> frame_capture;
+  if (FLAGS_frame_capture_fd >= 0) {
+    CHECK(FLAGS_frame_capture_encoder_threads >= 1)
+        << "--frame_capture_encoder_threads must be at least 1";
+    auto frame_capture_server =
+        cuttlefish::SharedFD::Dup(FLAGS_frame_capture_fd);
+    close(FLAGS_frame_capture_fd);
+    frame_capture = std::make_unique<FrameCapture>(
+        cvd_config->display_configs().size(),
+        FLAGS_frame_capture_encoder_threads);
+    display_handler->AddRawFrameObserver(
+        [capture = frame_capture.get()](
+            std::uint32_t display_number, std::uint32_t frame_width,
+            std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
+            const std::uint8_t* frame_bytes) {
+          capture->OnFrame(display_number, frame_width, frame_height,
+                           frame_stride_bytes, frame_bytes);
+        });
+    frame_capture->Serve(frame_capture_server);
+  }
+
+  std::unique_ptr<ScreenStabilityDetector> stability_detector;
+  if (FLAGS_screen_stability_fd >= 0) {
+    auto stability_server =
+        cuttlefish::SharedFD::Dup(FLAGS_screen_stability_fd);
+    close(FLAGS_screen_stability_fd);
+    stability_detector = std::make_unique<ScreenStabilityDetector>(
+        cvd_config->display_configs().size(),
+        FLAGS_screen_stability_block_size);
+    display_handler->AddRawFrameObserver(
+        [detector = stability_detector.get()](
+            std::uint32_t display_number, std::uint32_t frame_width,
+            std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
+            const std::uint8_t* frame_bytes) {
+          detector->OnFrame(display_number, frame_width, frame_height,
+                            frame_stride_bytes, frame_bytes);
+        });
+    stability_detector->Serve(stability_server);
+  }
+
   if (instance.camera_server_port()) {
     auto camera_controller = streamer->AddCamera(instance.camera_server_port(),
                                                  instance.vsock_guest_cid());
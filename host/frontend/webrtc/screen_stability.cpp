@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/screen_stability.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <android-base/logging.h>
+
+#include "host/frontend/webrtc/lib/utils.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+constexpr std::uint64_t kFnvPrime = 0x100000001b3ULL;
+
+std::int64_t MonotonicTimeUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::chrono::steady_clock::time_point FromMonotonicUs(std::int64_t time_us) {
+  return std::chrono::steady_clock::time_point(
+      std::chrono::microseconds(time_us));
+}
+
+// FNV-1a over 64 bit words, only used to detect changes so the weaker mixing
+// compared to the byte wise variant is fine.
+std::uint64_t HashBytes(std::uint64_t hash, const std::uint8_t* data,
+                        std::size_t size) {
+  std::size_t i = 0;
+  for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+    std::uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * kFnvPrime;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ data[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+bool Overlaps(const ScreenRegion& a, const ScreenRegion& b) {
+  return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height &&
+         b.y < a.y + a.height;
+}
+
+Result<ScreenRegion> ParseRegion(const Json::Value& value) {
+  auto validation = webrtc_streaming::ValidationResult::ValidateJsonObject(
+      value, "region",
+      {
+          {"width", Json::ValueType::uintValue},
+          {"height", Json::ValueType::uintValue},
+      },
+      {
+          {"x", Json::ValueType::uintValue},
+          {"y", Json::ValueType::uintValue},
+      });
+  CF_EXPECT(validation.ok(), validation.error());
+  ScreenRegion region;
+  region.x = value.get("x", 0).asUInt();
+  region.y = value.get("y", 0).asUInt();
+  region.width = value["width"].asUInt();
+  region.height = value["height"].asUInt();
+  CF_EXPECT(region.width > 0 && region.height > 0,
+            "Regions can't be empty");
+  // Overlaps() adds the sizes to the coordinates.
+  constexpr auto kMax = std::numeric_limits<std::uint32_t>::max();
+  CF_EXPECT(region.width <= kMax - region.x && region.height <= kMax - region.y,
+            "Region is out of range");
+  return region;
+}
+
+}  // namespace
+
+Result<StabilityCriteria> ParseStabilityCriteria(const Json::Value& request) {
+  auto validation = webrtc_streaming::ValidationResult::ValidateJsonObject(
+      request, "", {},
+      {
+          {"region", Json::ValueType::objectValue},
+          {"masks", Json::ValueType::arrayValue},
+          {"threshold", Json::ValueType::realValue},
+      });
+  CF_EXPECT(validation.ok(), validation.error());
+  StabilityCriteria criteria;
+  if (request.isMember("region")) {
+    criteria.region = CF_EXPECT(ParseRegion(request["region"]));
+  }
+  for (const auto& mask : request["masks"]) {
+    criteria.masks.emplace_back(CF_EXPECT(ParseRegion(mask)));
+  }
+  if (request.isMember("threshold")) {
+    criteria.threshold = request["threshold"].asDouble();
+    CF_EXPECT(criteria.threshold > 0 && criteria.threshold < 1,
+              "'threshold' must be between 0 and 1");
+  }
+  return criteria;
+}
+
+ScreenStabilityDetector::ScreenStabilityDetector(std::size_t num_displays,
+                                                 std::uint32_t block_size)
+    : block_size_(std::max<std::uint32_t>(block_size, 1)),
+      displays_(num_displays) {}
+
+void ScreenStabilityDetector::HashBlocks(std::uint32_t width,
+                                         std::uint32_t height,
+                                         std::uint32_t stride_bytes,
+                                         const std::uint8_t* pixels,
+                                         std::vector<std::uint64_t>* out) const {
+  const std::uint32_t blocks_x = (width + block_size_ - 1) / block_size_;
+  const std::uint32_t blocks_y = (height + block_size_ - 1) / block_size_;
+  out->assign(blocks_x * blocks_y, kFnvOffsetBasis);
+  for (std::uint32_t y = 0; y < height; y++) {
+    const std::uint8_t* row = pixels + y * stride_bytes;
+    std::uint64_t* row_hashes = out->data() + (y / block_size_) * blocks_x;
+    for (std::uint32_t bx = 0; bx < blocks_x; bx++) {
+      std::uint32_t x = bx * block_size_;
+      std::uint32_t block_width = std::min(block_size_, width - x);
+      row_hashes[bx] = HashBytes(row_hashes[bx], row + x * 4, block_width * 4);
+    }
+  }
+}
+
+void ScreenStabilityDetector::SelectBlocks(const DisplayState& display,
+                                           Watch* watch) {
+  ScreenRegion region = watch->criteria.region.value_or(
+      ScreenRegion{0, 0, display.width, display.height});
+  watch->blocks.clear();
+  for (std::uint32_t by = 0; by < display.blocks_y; by++) {
+    for (std::uint32_t bx = 0; bx < display.blocks_x; bx++) {
+      ScreenRegion block{bx * block_size_, by * block_size_, block_size_,
+                         block_size_};
+      if (!Overlaps(block, region)) {
+        continue;
+      }
+      // Blocks touching a mask are ignored entirely, their hash can't tell
+      // which part of the block changed.
+      bool masked = std::any_of(
+          watch->criteria.masks.begin(), watch->criteria.masks.end(),
+          [&block](const ScreenRegion& mask) { return Overlaps(block, mask); });
+      if (!masked) {
+        watch->blocks.push_back(by * display.blocks_x + bx);
+      }
+    }
+  }
+}
+
+void ScreenStabilityDetector::OnFrame(std::uint32_t display_number,
+                                      std::uint32_t width,
+                                      std::uint32_t height,
+                                      std::uint32_t stride_bytes,
+                                      const std::uint8_t* pixels) {
+  if (display_number >= displays_.size()) {
+    LOG(ERROR) << "Ignoring frame for unknown display " << display_number;
+    return;
+  }
+  auto& display = displays_[display_number];
+  // Hashing happens outside the lock, only this thread uses the scratch
+  // buffer.
+  HashBlocks(width, height, stride_bytes, pixels, &display.scratch_hashes);
+  auto now = MonotonicTimeUs();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (display.width != width || display.height != height) {
+    display.width = width;
+    display.height = height;
+    display.blocks_x = (width + block_size_ - 1) / block_size_;
+    display.blocks_y = (height + block_size_ - 1) / block_size_;
+    display.block_hashes.swap(display.scratch_hashes);
+    display.block_changed_us.assign(display.block_hashes.size(), now);
+    for (auto& watch : watches_) {
+      if (watch.display_number == display_number) {
+        SelectBlocks(display, &watch);
+        watch.last_change_us = now;
+        watch.changed = true;
+      }
+    }
+    changed_cv_.notify_all();
+    return;
+  }
+
+  std::vector<bool> block_changed(display.block_hashes.size(), false);
+  bool any_changed = false;
+  for (std::size_t i = 0; i < display.block_hashes.size(); i++) {
+    if (display.block_hashes[i] != display.scratch_hashes[i]) {
+      block_changed[i] = true;
+      display.block_changed_us[i] = now;
+      any_changed = true;
+    }
+  }
+  display.block_hashes.swap(display.scratch_hashes);
+  if (!any_changed) {
+    return;
+  }
+  bool notify = false;
+  for (auto& watch : watches_) {
+    if (watch.display_number != display_number) {
+      continue;
+    }
+    std::size_t changed_count =
+        std::count_if(watch.blocks.begin(), watch.blocks.end(),
+                      [&block_changed](std::uint32_t b) {
+                        return block_changed[b];
+                      });
+    if (changed_count > 0 &&
+        changed_count > watch.criteria.threshold * watch.blocks.size()) {
+      watch.last_change_us = now;
+      watch.changed = true;
+      notify = true;
+    }
+  }
+  if (notify) {
+    changed_cv_.notify_all();
+  }
+}
+
+std::list<ScreenStabilityDetector::Watch>::iterator
+ScreenStabilityDetector::AddWatch(std::uint32_t display_number,
+                                  const StabilityCriteria& criteria) {
+  const auto& display = displays_[display_number];
+  Watch watch;
+  watch.display_number = display_number;
+  watch.criteria = criteria;
+  SelectBlocks(display, &watch);
+  if (display.block_changed_us.empty()) {
+    // Nothing has been shown yet, the screen can't be considered stable
+    // before the first frame.
+    watch.last_change_us = MonotonicTimeUs();
+  }
+  for (auto block : watch.blocks) {
+    watch.last_change_us =
+        std::max(watch.last_change_us, display.block_changed_us[block]);
+  }
+  return watches_.insert(watches_.end(), std::move(watch));
+}
+
+Result<std::int64_t> ScreenStabilityDetector::WaitUntilStable(
+    std::uint32_t display_number, const StabilityCriteria& criteria,
+    std::chrono::milliseconds stable_for, std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CF_EXPECT(display_number < displays_.size(),
+            "Unknown display " << display_number);
+  auto watch = AddWatch(display_number, criteria);
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (;;) {
+    auto stable_at = FromMonotonicUs(watch->last_change_us) + stable_for;
+    auto now = std::chrono::steady_clock::now();
+    if (now >= stable_at) {
+      auto last_change_us = watch->last_change_us;
+      watches_.erase(watch);
+      return last_change_us;
+    }
+    if (now >= deadline) {
+      watches_.erase(watch);
+      return CF_ERR("Display " << display_number << " did not become stable");
+    }
+    changed_cv_.wait_until(lock, std::min(stable_at, deadline));
+  }
+}
+
+Result<std::int64_t> ScreenStabilityDetector::WaitUntilChanged(
+    std::uint32_t display_number, const StabilityCriteria& criteria,
+    std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CF_EXPECT(display_number < displays_.size(),
+            "Unknown display " << display_number);
+  auto watch = AddWatch(display_number, criteria);
+  bool changed = changed_cv_.wait_for(lock, timeout,
+                                      [&watch]() { return watch->changed; });
+  auto last_change_us = watch->last_change_us;
+  watches_.erase(watch);
+  if (!changed) {
+    return CF_ERR("Display " << display_number << " did not change");
+  }
+  return last_change_us;
+}
+
+void ScreenStabilityDetector::Serve(SharedFD server) {
+  AcceptJsonLineClients(server,
+                        [this](JsonLineSocket& client) { HandleClient(client); });
+}
+
+void ScreenStabilityDetector::HandleClient(JsonLineSocket& client) {
+  while (auto request = client.ReadRequest()) {
+    auto validation = webrtc_streaming::ValidationResult::ValidateJsonObject(
+        *request, "", {{"command", Json::ValueType::stringValue}},
+        {
+            {"display", Json::ValueType::uintValue},
+            {"stable_ms", Json::ValueType::uintValue},
+            {"timeout_ms", Json::ValueType::uintValue},
+        });
+    if (!validation.ok()) {
+      if (!client.WriteError(validation.error())) {
+        return;
+      }
+      continue;
+    }
+    auto command = (*request)["command"].asString();
+    auto display_number = request->get("display", 0).asUInt();
+    if (display_number >= displays_.size()) {
+      if (!client.WriteError("Unknown display")) {
+        return;
+      }
+      continue;
+    }
+    auto criteria = ParseStabilityCriteria(*request);
+    if (!criteria.ok()) {
+      if (!client.WriteError(criteria.error().message())) {
+        return;
+      }
+      continue;
+    }
+    std::chrono::milliseconds timeout(
+        request->get("timeout_ms", 10000).asUInt());
+
+    Result<std::int64_t> result;
+    if (command == "wait_stable") {
+      std::chrono::milliseconds stable_for(
+          request->get("stable_ms", 500).asUInt());
+      result = WaitUntilStable(display_number, *criteria, stable_for, timeout);
+    } else if (command == "wait_change") {
+      result = WaitUntilChanged(display_number, *criteria, timeout);
+    } else {
+      if (!client.WriteError("Unknown command: " + command)) {
+        return;
+      }
+      continue;
+    }
+
+    Json::Value reply;
+    reply["status"] = result.ok() ? "ok" : "timeout";
+    if (result.ok()) {
+      reply["last_change_us"] = Json::Int64(*result);
+    } else {
+      LOG(DEBUG) << result.error();
+    }
+    if (!client.Write(reply)) {
+      return;
+    }
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <json/json.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/frontend/webrtc/json_line_socket.h"
+
+namespace cuttlefish {
+
+// A rectangle in display pixels.
+struct ScreenRegion {
+  std::uint32_t x = 0;
+  std::uint32_t y = 0;
+  std::uint32_t width = 0;
+  std::uint32_t height = 0;
+};
+
+struct StabilityCriteria {
+  // Area to watch, the whole display if not set.
+  std::optional<ScreenRegion> region;
+  // Areas inside the region to ignore, e.g. a blinking cursor or a clock.
+  std::vector<ScreenRegion> masks;
+  // Fraction of the watched blocks that must differ from the previous frame
+  // for the frame to count as a change, any change counts if 0.
+  double threshold = 0;
+};
+
+// Reads the "region", "masks" and "threshold" fields of a request. Fails on
+// fields of the wrong type, empty rectangles and thresholds outside (0, 1).
+Result<StabilityCriteria> ParseStabilityCriteria(const Json::Value& request);
+
+// Tracks frame to frame changes of every display with per block hashes so
+// tests can wait for the screen to settle instead of sleeping.
+//
+// Clients connect to the stability socket and send one JSON object per line:
+//
+//   {"command": "wait_stable", "display": 0, "stable_ms": 500,
+//    "timeout_ms": 10000, "threshold": 0.01,
+//    "region": {"x": 0, "y": 0, "width": 720, "height": 1280},
+//    "masks": [{"x": 0, "y": 0, "width": 720, "height": 48}]}
+//
+// "wait_change" takes the same arguments except "stable_ms" and returns as
+// soon as the watched area changes. The reply is a single JSON line with
+// "status" set to "ok" or "timeout" and "last_change_us", the CLOCK_MONOTONIC
+// time of the most recent change seen in the watched area.
+class ScreenStabilityDetector {
+ public:
+  ScreenStabilityDetector(std::size_t num_displays, std::uint32_t block_size);
+
+  // Called from the screen connector thread for every guest frame.
+  void OnFrame(std::uint32_t display_number, std::uint32_t width,
+               std::uint32_t height, std::uint32_t stride_bytes,
+               const std::uint8_t* pixels);
+
+  // Returns the time of the last change once the watched area has not changed
+  // for stable_for, or an error if that doesn't happen within timeout.
+  Result<std::int64_t> WaitUntilStable(std::uint32_t display_number,
+                                       const StabilityCriteria& criteria,
+                                       std::chrono::milliseconds stable_for,
+                                       std::chrono::milliseconds timeout);
+
+  // Returns the time of the first change to the watched area after the call,
+  // or an error if there is none within timeout.
+  Result<std::int64_t> WaitUntilChanged(std::uint32_t display_number,
+                                        const StabilityCriteria& criteria,
+                                        std::chrono::milliseconds timeout);
+
+  // Accepts clients on the given listening socket in the background.
+  void Serve(SharedFD server);
+
+ private:
+  struct DisplayState {
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    std::uint32_t blocks_x = 0;
+    std::uint32_t blocks_y = 0;
+    std::vector<std::uint64_t> block_hashes;
+    std::vector<std::int64_t> block_changed_us;
+    // Only touched by the screen connector thread.
+    std::vector<std::uint64_t> scratch_hashes;
+  };
+  struct Watch {
+    std::uint32_t display_number;
+    StabilityCriteria criteria;
+    std::vector<std::uint32_t> blocks;
+    std::int64_t last_change_us = 0;
+    bool changed = false;
+  };
+
+  void HashBlocks(std::uint32_t width, std::uint32_t height,
+                  std::uint32_t stride_bytes, const std::uint8_t* pixels,
+                  std::vector<std::uint64_t>* out) const;
+  void SelectBlocks(const DisplayState& display, Watch* watch);
+  std::list<Watch>::iterator AddWatch(std::uint32_t display_number,
+                                      const StabilityCriteria& criteria);
+  void HandleClient(JsonLineSocket& client);
+
+  const std::uint32_t block_size_;
+  std::mutex mutex_;
+  std::condition_variable changed_cv_;
+  std::vector<DisplayState> displays_;
+  std::list<Watch> watches_;
+};
+
+}  // namespace cuttlefish
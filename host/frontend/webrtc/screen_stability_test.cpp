@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/screen_stability.h"
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace {
+
+using std::chrono::milliseconds;
+
+Json::Value Parse(const std::string& text) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value value;
+  std::string errors;
+  EXPECT_TRUE(
+      reader->parse(text.data(), text.data() + text.size(), &value, &errors))
+      << errors;
+  return value;
+}
+
+TEST(StabilityCriteriaTest, Defaults) {
+  auto criteria = ParseStabilityCriteria(Parse("{}"));
+  ASSERT_TRUE(criteria.ok()) << criteria.error().message();
+  EXPECT_FALSE(criteria->region);
+  EXPECT_TRUE(criteria->masks.empty());
+  EXPECT_EQ(criteria->threshold, 0);
+}
+
+TEST(StabilityCriteriaTest, AllFields) {
+  auto criteria = ParseStabilityCriteria(
+      Parse(R"({"region": {"x": 1, "y": 2, "width": 3, "height": 4},
+                "masks": [{"width": 5, "height": 6}],
+                "threshold": 0.25})"));
+  ASSERT_TRUE(criteria.ok()) << criteria.error().message();
+  ASSERT_TRUE(criteria->region);
+  EXPECT_EQ(criteria->region->x, 1);
+  EXPECT_EQ(criteria->region->y, 2);
+  EXPECT_EQ(criteria->region->width, 3);
+  EXPECT_EQ(criteria->region->height, 4);
+  ASSERT_EQ(criteria->masks.size(), 1);
+  EXPECT_EQ(criteria->masks[0].x, 0);
+  EXPECT_EQ(criteria->masks[0].width, 5);
+  EXPECT_EQ(criteria->threshold, 0.25);
+}
+
+TEST(StabilityCriteriaTest, RejectsMalformedFields) {
+  for (const auto& text : {
+           R"([])",
+           R"({"region": 5})",
+           R"({"region": {"width": -1, "height": 1}})",
+           R"({"region": {"width": "wide", "height": 1}})",
+           R"({"region": {"x": -1, "width": 1, "height": 1}})",
+           R"({"region": {"width": 0, "height": 1}})",
+           R"({"region": {"width": 1, "height": 0}})",
+           R"({"region": {"width": 1}})",
+           R"({"region": {"x": 4294967295, "width": 2, "height": 1}})",
+           R"({"masks": {}})",
+           R"({"masks": [{"width": 0, "height": 0}]})",
+           R"({"threshold": "high"})",
+           R"({"threshold": 0})",
+           R"({"threshold": 1})",
+           R"({"threshold": -0.5})",
+       }) {
+    EXPECT_FALSE(ParseStabilityCriteria(Parse(text)).ok()) << text;
+  }
+}
+
+constexpr std::uint32_t kSize = 4;
+constexpr std::uint32_t kBlockSize = 2;
+
+class ScreenStabilityTest : public testing::Test {
+ protected:
+  ScreenStabilityTest() : detector_(1, kBlockSize), pixels_(kSize * kSize * 4) {
+    SendFrame();
+  }
+
+  void SendFrame() {
+    detector_.OnFrame(0, kSize, kSize, kSize * 4, pixels_.data());
+  }
+
+  // Changes one pixel and sends the frame.
+  void ChangePixel(std::uint32_t x, std::uint32_t y) {
+    pixels_[(y * kSize + x) * 4]++;
+    SendFrame();
+  }
+
+  // Waits for a change to the watched area while changing the pixel.
+  Result<std::int64_t> ChangedBy(std::uint32_t x, std::uint32_t y,
+                                 const StabilityCriteria& criteria) {
+    auto changed = std::async(std::launch::async, [this, &criteria]() {
+      return detector_.WaitUntilChanged(0, criteria, milliseconds(200));
+    });
+    // Keep changing the pixel until the watch is certain to be registered.
+    while (changed.wait_for(milliseconds(5)) != std::future_status::ready) {
+      ChangePixel(x, y);
+    }
+    return changed.get();
+  }
+
+  ScreenStabilityDetector detector_;
+  std::vector<std::uint8_t> pixels_;
+};
+
+TEST_F(ScreenStabilityTest, ReportsChanges) {
+  EXPECT_TRUE(ChangedBy(3, 3, {}).ok());
+  EXPECT_FALSE(detector_.WaitUntilChanged(0, {}, milliseconds(10)).ok());
+}
+
+TEST_F(ScreenStabilityTest, UnknownDisplay) {
+  EXPECT_FALSE(detector_.WaitUntilChanged(1, {}, milliseconds(0)).ok());
+  EXPECT_FALSE(
+      detector_.WaitUntilStable(1, {}, milliseconds(0), milliseconds(0)).ok());
+}
+
+TEST_F(ScreenStabilityTest, IgnoresChangesOutsideRegion) {
+  StabilityCriteria criteria;
+  criteria.region = ScreenRegion{0, 0, kBlockSize, kBlockSize};
+  EXPECT_FALSE(ChangedBy(3, 3, criteria).ok());
+  EXPECT_TRUE(ChangedBy(1, 1, criteria).ok());
+}
+
+TEST_F(ScreenStabilityTest, IgnoresMaskedChanges) {
+  StabilityCriteria criteria;
+  criteria.masks.push_back(ScreenRegion{3, 3, 1, 1});
+  EXPECT_FALSE(ChangedBy(3, 3, criteria).ok());
+  EXPECT_TRUE(ChangedBy(0, 0, criteria).ok());
+}
+
+TEST_F(ScreenStabilityTest, IgnoresChangesBelowThreshold) {
+  StabilityCriteria criteria;
+  // One of the four blocks changing is not enough.
+  criteria.threshold = 0.5;
+  EXPECT_FALSE(ChangedBy(0, 0, criteria).ok());
+}
+
+TEST_F(ScreenStabilityTest, WaitsUntilStable) {
+  auto last_change = detector_.WaitUntilStable(0, {}, milliseconds(10),
+                                               milliseconds(1000));
+  EXPECT_TRUE(last_change.ok()) << last_change.error().message();
+}
+
+TEST_F(ScreenStabilityTest, ChangingScreenIsNotStable) {
+  auto stable = std::async(std::launch::async, [this]() {
+    return detector_.WaitUntilStable(0, {}, milliseconds(100),
+                                     milliseconds(200));
+  });
+  while (stable.wait_for(milliseconds(5)) != std::future_status::ready) {
+    ChangePixel(0, 0);
+  }
+  EXPECT_FALSE(stable.get().ok());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -36,7 +36,8 @@ int RunExternalCommand(const std::string& command) {
 
 bool AddTapIface(const std::string& name) {
   std::stringstream ss;
-  ss << "ip tuntap add dev " << name << " mode tap group cvdnetwork vnet_hdr";
+  ss << "ip tuntap add dev " << name << " mode tap group cvdnetwork vnet_hdr"
+     << " multi_queue";
   auto add_command = ss.str();
   LOG(INFO) << "Create tap interface: " << add_command;
   int status = RunExternalCommand(add_command);
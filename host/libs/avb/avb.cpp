@@ -0,0 +1,424 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/avb/avb.h"
+
+#include <fcntl.h>
+#include <string.h>
+
+#include <set>
+
+#include <android-base/file.h>
+#include <libavb/libavb.h>
+#include <openssl/bn.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+struct AvbAlgorithm {
+  const char* name;
+  AvbAlgorithmType type;
+  const EVP_MD* (*hash)();
+  std::size_t hash_bytes;
+  std::size_t signature_bytes;
+};
+
+namespace {
+
+// Values of avbtool.py, which are not in the libavb headers.
+constexpr std::uint64_t kMaxVbmetaSize = 64 * 1024;
+constexpr std::uint64_t kMaxFooterSize = 4096;
+constexpr std::uint64_t kBlockSize = 4096;
+constexpr char kHashAlgorithm[] = "sha256";
+constexpr std::uint32_t kSparseHeaderMagic = 0xed26ff3a;
+constexpr std::size_t kReadChunkSize = 1 << 20;
+
+const AvbAlgorithm kAlgorithms[] = {
+    {"NONE", AVB_ALGORITHM_TYPE_NONE, nullptr, 0, 0},
+    {"SHA256_RSA2048", AVB_ALGORITHM_TYPE_SHA256_RSA2048, EVP_sha256, 32, 256},
+    {"SHA256_RSA4096", AVB_ALGORITHM_TYPE_SHA256_RSA4096, EVP_sha256, 32, 512},
+    {"SHA256_RSA8192", AVB_ALGORITHM_TYPE_SHA256_RSA8192, EVP_sha256, 32,
+     1024},
+    {"SHA512_RSA2048", AVB_ALGORITHM_TYPE_SHA512_RSA2048, EVP_sha512, 64, 256},
+    {"SHA512_RSA4096", AVB_ALGORITHM_TYPE_SHA512_RSA4096, EVP_sha512, 64, 512},
+    {"SHA512_RSA8192", AVB_ALGORITHM_TYPE_SHA512_RSA8192, EVP_sha512, 64,
+     1024},
+};
+
+const AvbAlgorithm* FindAlgorithm(const std::string& name) {
+  for (const auto& algorithm : kAlgorithms) {
+    if (name == algorithm.name) {
+      return &algorithm;
+    }
+  }
+  return nullptr;
+}
+
+std::uint64_t RoundUp(std::uint64_t value, std::uint64_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+std::string Bytes(const void* data, std::size_t size) {
+  return std::string(static_cast<const char*>(data), size);
+}
+
+std::string Zeros(std::size_t size) { return std::string(size, '\0'); }
+
+Result<std::string> Digest(const EVP_MD* hash, const std::string& data) {
+  std::string digest(EVP_MD_size(hash), '\0');
+  unsigned int size = 0;
+  CF_EXPECT(EVP_Digest(data.data(), data.size(),
+                       reinterpret_cast<uint8_t*>(digest.data()), &size, hash,
+                       nullptr) == 1,
+            "Failed to hash vbmeta");
+  return digest;
+}
+
+// Digest of `salt` followed by the first `size` bytes of `fd`.
+Result<std::string> SaltedDigest(SharedFD fd, std::uint64_t size,
+                                 const std::string& salt) {
+  std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX*)> ctx(EVP_MD_CTX_new(),
+                                                          EVP_MD_CTX_free);
+  CF_EXPECT(ctx != nullptr);
+  const EVP_MD* hash = EVP_sha256();
+  CF_EXPECT(EVP_DigestInit_ex(ctx.get(), hash, nullptr) == 1);
+  CF_EXPECT(EVP_DigestUpdate(ctx.get(), salt.data(), salt.size()) == 1);
+  CF_EXPECT(fd->LSeek(0, SEEK_SET) == 0, fd->StrError());
+  std::vector<char> buffer(kReadChunkSize);
+  while (size > 0) {
+    auto chunk = std::min<std::uint64_t>(size, buffer.size());
+    CF_EXPECT(ReadExact(fd, buffer.data(), chunk) == chunk,
+              "Failed to read image: " << fd->StrError());
+    CF_EXPECT(EVP_DigestUpdate(ctx.get(), buffer.data(), chunk) == 1);
+    size -= chunk;
+  }
+  std::string digest(EVP_MD_size(hash), '\0');
+  CF_EXPECT(EVP_DigestFinal_ex(ctx.get(),
+                               reinterpret_cast<uint8_t*>(digest.data()),
+                               nullptr) == 1);
+  return digest;
+}
+
+// Big endian, left padded to `size` bytes.
+std::string EncodeBignum(const BIGNUM* value, std::size_t size) {
+  std::string encoded(size, '\0');
+  auto bytes = BN_num_bytes(value);
+  BN_bn2bin(value, reinterpret_cast<uint8_t*>(encoded.data()) + size - bytes);
+  return encoded;
+}
+
+// The AvbRSAPublicKeyHeader followed by the modulus and R^2 mod N, as
+// expected by libavb's Montgomery multiplication.
+Result<std::string> EncodePublicKey(EVP_PKEY* key) {
+  const RSA* rsa = EVP_PKEY_get0_RSA(key);
+  CF_EXPECT(rsa != nullptr, "Only RSA keys are supported");
+  const BIGNUM* n = RSA_get0_n(rsa);
+  std::uint32_t num_bits = RSA_bits(rsa);
+
+  auto modulus = EncodeBignum(n, num_bits / 8);
+  // Newton's iteration for the inverse of N modulo 2^32, which only depends
+  // on the low 32 bits. Each step doubles the number of correct bits.
+  auto low = reinterpret_cast<const uint8_t*>(modulus.data()) + modulus.size();
+  std::uint32_t n0 = (low[-4] << 24) | (low[-3] << 16) | (low[-2] << 8) |
+                     low[-1];
+  std::uint32_t inverse = n0;
+  for (int i = 0; i < 5; i++) {
+    inverse *= 2 - n0 * inverse;
+  }
+  std::uint32_t n0inv = 0 - inverse;
+
+  std::unique_ptr<BN_CTX, void (*)(BN_CTX*)> ctx(BN_CTX_new(), BN_CTX_free);
+  std::unique_ptr<BIGNUM, void (*)(BIGNUM*)> rr(BN_new(), BN_free);
+  CF_EXPECT(ctx && rr);
+  CF_EXPECT(BN_set_bit(rr.get(), 2 * num_bits) == 1);
+  CF_EXPECT(BN_mod(rr.get(), rr.get(), n, ctx.get()) == 1);
+
+  AvbRSAPublicKeyHeader header;
+  header.key_num_bits = avb_htobe32(num_bits);
+  header.n0inv = avb_htobe32(n0inv);
+  return Bytes(&header, sizeof(header)) + modulus +
+         EncodeBignum(rr.get(), num_bits / 8);
+}
+
+Result<std::string> Sign(EVP_PKEY* key, const EVP_MD* hash,
+                         const std::string& digest) {
+  std::unique_ptr<EVP_PKEY_CTX, void (*)(EVP_PKEY_CTX*)> ctx(
+      EVP_PKEY_CTX_new(key, nullptr), EVP_PKEY_CTX_free);
+  CF_EXPECT(ctx != nullptr);
+  CF_EXPECT(EVP_PKEY_sign_init(ctx.get()) == 1);
+  CF_EXPECT(EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_PKCS1_PADDING) == 1);
+  CF_EXPECT(EVP_PKEY_CTX_set_signature_md(ctx.get(), hash) == 1);
+  std::size_t size = 0;
+  auto data = reinterpret_cast<const uint8_t*>(digest.data());
+  CF_EXPECT(EVP_PKEY_sign(ctx.get(), nullptr, &size, data, digest.size()) == 1);
+  std::string signature(size, '\0');
+  CF_EXPECT(EVP_PKEY_sign(ctx.get(),
+                          reinterpret_cast<uint8_t*>(signature.data()), &size,
+                          data, digest.size()) == 1,
+            "Failed to sign vbmeta");
+  signature.resize(size);
+  return signature;
+}
+
+// Descriptors are padded to a multiple of 8 bytes.
+std::string PadDescriptor(std::string descriptor) {
+  return descriptor + Zeros(RoundUp(descriptor.size(), 8) - descriptor.size());
+}
+
+std::string HashDescriptor(const std::string& partition_name,
+                           std::uint64_t image_size, const std::string& salt,
+                           const std::string& digest) {
+  AvbHashDescriptor desc;
+  memset(&desc, 0, sizeof(desc));
+  auto size = sizeof(desc) + partition_name.size() + salt.size() +
+              digest.size() - sizeof(AvbDescriptor);
+  desc.parent_descriptor.tag = avb_htobe64(AVB_DESCRIPTOR_TAG_HASH);
+  desc.parent_descriptor.num_bytes_following = avb_htobe64(RoundUp(size, 8));
+  desc.image_size = avb_htobe64(image_size);
+  memcpy(desc.hash_algorithm, kHashAlgorithm, strlen(kHashAlgorithm));
+  desc.partition_name_len = avb_htobe32(partition_name.size());
+  desc.salt_len = avb_htobe32(salt.size());
+  desc.digest_len = avb_htobe32(digest.size());
+  return PadDescriptor(Bytes(&desc, sizeof(desc)) + partition_name + salt +
+                       digest);
+}
+
+std::string ChainPartitionDescriptor(const std::string& partition_name,
+                                     std::uint32_t rollback_index_location,
+                                     const std::string& public_key) {
+  AvbChainPartitionDescriptor desc;
+  memset(&desc, 0, sizeof(desc));
+  auto size = sizeof(desc) + partition_name.size() + public_key.size() -
+              sizeof(AvbDescriptor);
+  desc.parent_descriptor.tag = avb_htobe64(AVB_DESCRIPTOR_TAG_CHAIN_PARTITION);
+  desc.parent_descriptor.num_bytes_following = avb_htobe64(RoundUp(size, 8));
+  desc.rollback_index_location = avb_htobe32(rollback_index_location);
+  desc.partition_name_len = avb_htobe32(partition_name.size());
+  desc.public_key_len = avb_htobe32(public_key.size());
+  return PadDescriptor(Bytes(&desc, sizeof(desc)) + partition_name +
+                       public_key);
+}
+
+}  // namespace
+
+Avb::Avb(const AvbAlgorithm& algorithm, std::shared_ptr<EVP_PKEY> key)
+    : algorithm_(&algorithm), key_(std::move(key)) {}
+
+Result<Avb> Avb::Create(const std::string& algorithm_name,
+                        const std::string& key_path) {
+  auto algorithm = FindAlgorithm(algorithm_name);
+  CF_EXPECT(algorithm != nullptr,
+            "Unknown algorithm \"" << algorithm_name << "\"");
+  if (algorithm->type == AVB_ALGORITHM_TYPE_NONE) {
+    return Avb(*algorithm, nullptr);
+  }
+  std::string pem;
+  CF_EXPECT(android::base::ReadFileToString(key_path, &pem),
+            "Failed to read key \"" << key_path << "\"");
+  std::unique_ptr<BIO, int (*)(BIO*)> bio(
+      BIO_new_mem_buf(pem.data(), pem.size()), BIO_free);
+  CF_EXPECT(bio != nullptr);
+  std::shared_ptr<EVP_PKEY> key(
+      PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr),
+      EVP_PKEY_free);
+  CF_EXPECT(key != nullptr, "Failed to parse key \"" << key_path << "\"");
+  const RSA* rsa = EVP_PKEY_get0_RSA(key.get());
+  CF_EXPECT(rsa != nullptr, "\"" << key_path << "\" is not an RSA key");
+  CF_EXPECT(RSA_bits(rsa) == algorithm->signature_bytes * 8,
+            "Key is " << RSA_bits(rsa) << " bits, " << algorithm_name
+                      << " needs " << algorithm->signature_bytes * 8);
+  return Avb(*algorithm, std::move(key));
+}
+
+Avb Avb::Unsigned() { return Avb(*FindAlgorithm("NONE"), nullptr); }
+
+Result<std::string> Avb::VbmetaBlob(const std::string& descriptors) const {
+  std::string public_key;
+  if (key_) {
+    public_key = CF_EXPECT(EncodePublicKey(key_.get()));
+  }
+
+  // The descriptors come first in the auxiliary data block, followed by the
+  // public key. The authentication data block holds the hash followed by the
+  // signature.
+  AvbVBMetaImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, AVB_MAGIC, AVB_MAGIC_LEN);
+  header.required_libavb_version_major = avb_htobe32(AVB_VERSION_MAJOR);
+  header.required_libavb_version_minor = avb_htobe32(0);
+  auto auth_size =
+      RoundUp(algorithm_->hash_bytes + algorithm_->signature_bytes, 64);
+  auto aux_size = RoundUp(descriptors.size() + public_key.size(), 64);
+  header.authentication_data_block_size = avb_htobe64(auth_size);
+  header.auxiliary_data_block_size = avb_htobe64(aux_size);
+  header.algorithm_type = avb_htobe32(algorithm_->type);
+  header.hash_offset = avb_htobe64(0);
+  header.hash_size = avb_htobe64(algorithm_->hash_bytes);
+  header.signature_offset = avb_htobe64(algorithm_->hash_bytes);
+  header.signature_size = avb_htobe64(algorithm_->signature_bytes);
+  header.public_key_offset = avb_htobe64(descriptors.size());
+  header.public_key_size = avb_htobe64(public_key.size());
+  header.public_key_metadata_offset =
+      avb_htobe64(descriptors.size() + public_key.size());
+  header.public_key_metadata_size = avb_htobe64(0);
+  header.descriptors_offset = avb_htobe64(0);
+  header.descriptors_size = avb_htobe64(descriptors.size());
+  // avbtool leaves room for the terminating NUL.
+  std::string release = "avbtool " + std::to_string(AVB_VERSION_MAJOR) + "." +
+                        std::to_string(AVB_VERSION_MINOR) + "." +
+                        std::to_string(AVB_VERSION_SUB);
+  memcpy(header.release_string, release.data(),
+         std::min<std::size_t>(release.size(), AVB_RELEASE_STRING_SIZE - 1));
+
+  auto header_block = Bytes(&header, sizeof(header));
+  auto aux_block = descriptors + public_key;
+  aux_block += Zeros(aux_size - aux_block.size());
+
+  std::string auth_block;
+  if (key_) {
+    auto hash = algorithm_->hash();
+    auto signed_data = header_block + aux_block;
+    auto digest = CF_EXPECT(Digest(hash, signed_data));
+    auth_block = digest + CF_EXPECT(Sign(key_.get(), hash, digest));
+  }
+  auth_block += Zeros(auth_size - auth_block.size());
+
+  return header_block + auth_block + aux_block;
+}
+
+Result<void> Avb::AddHashFooter(const std::string& image_path,
+                                const std::string& partition_name,
+                                std::uint64_t partition_size,
+                                const std::string& salt) const {
+  CF_EXPECT(partition_size >= kMaxVbmetaSize + kMaxFooterSize,
+            "Partition size of " << partition_size << " is too small");
+  CF_EXPECT(partition_size % kBlockSize == 0,
+            "Partition size of " << partition_size
+                                 << " is not a multiple of " << kBlockSize);
+  auto max_image_size = partition_size - kMaxVbmetaSize - kMaxFooterSize;
+
+  auto fd = SharedFD::Open(image_path, O_RDWR);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << image_path << "\": " << fd->StrError());
+  auto image_size = fd->LSeek(0, SEEK_END);
+  CF_EXPECT(image_size >= 0, fd->StrError());
+
+  std::uint32_t sparse_magic = 0;
+  if (image_size >= static_cast<off_t>(sizeof(sparse_magic))) {
+    CF_EXPECT(fd->LSeek(0, SEEK_SET) == 0, fd->StrError());
+    CF_EXPECT(ReadExactBinary(fd, &sparse_magic) == sizeof(sparse_magic));
+  }
+  CF_EXPECT(sparse_magic != kSparseHeaderMagic,
+            "\"" << image_path << "\" is a sparse image, use avbtool");
+
+  // Replacing an existing footer starts again from the original image, which
+  // makes this idempotent (modulo salts).
+  std::uint64_t original_size = image_size;
+  if (image_size >= static_cast<off_t>(sizeof(AvbFooter))) {
+    AvbFooter footer;
+    CF_EXPECT(fd->LSeek(image_size - sizeof(footer), SEEK_SET) >= 0);
+    CF_EXPECT(ReadExactBinary(fd, &footer) == sizeof(footer),
+              "Failed to read \"" << image_path << "\": " << fd->StrError());
+    if (memcmp(footer.magic, AVB_FOOTER_MAGIC, AVB_FOOTER_MAGIC_LEN) == 0) {
+      original_size = avb_be64toh(footer.original_image_size);
+      CF_EXPECT(fd->Truncate(original_size) == 0, fd->StrError());
+    }
+  }
+
+  auto result = [&]() -> Result<void> {
+    CF_EXPECT(original_size <= max_image_size,
+              "Image size of " << original_size << " exceeds maximum image "
+                               << "size of " << max_image_size
+                               << " in order to fit in a partition size of "
+                               << partition_size);
+    std::string image_salt = salt;
+    if (image_salt.empty()) {
+      image_salt.resize(EVP_MD_size(EVP_sha256()));
+      CF_EXPECT(RAND_bytes(reinterpret_cast<uint8_t*>(image_salt.data()),
+                           image_salt.size()) == 1);
+    }
+    auto digest = CF_EXPECT(SaltedDigest(fd, original_size, image_salt));
+    auto vbmeta = CF_EXPECT(VbmetaBlob(
+        HashDescriptor(partition_name, original_size, image_salt, digest)));
+
+    // The vbmeta blob starts at the next block, the footer is at the end of
+    // the last block of the partition and zeros are in between.
+    auto vbmeta_offset = RoundUp(original_size, kBlockSize);
+    auto vbmeta_size = vbmeta.size();
+    vbmeta += Zeros(RoundUp(vbmeta_size, kBlockSize) - vbmeta_size);
+    CF_EXPECT(fd->Truncate(vbmeta_offset) == 0, fd->StrError());
+    CF_EXPECT(fd->LSeek(vbmeta_offset, SEEK_SET) == vbmeta_offset);
+    CF_EXPECT(WriteAll(fd, vbmeta) == vbmeta.size(),
+              "Failed to write vbmeta: " << fd->StrError());
+
+    AvbFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, AVB_FOOTER_MAGIC, AVB_FOOTER_MAGIC_LEN);
+    footer.version_major = avb_htobe32(AVB_FOOTER_VERSION_MAJOR);
+    footer.version_minor = avb_htobe32(AVB_FOOTER_VERSION_MINOR);
+    footer.original_image_size = avb_htobe64(original_size);
+    footer.vbmeta_offset = avb_htobe64(vbmeta_offset);
+    footer.vbmeta_size = avb_htobe64(vbmeta_size);
+    auto footer_block =
+        Zeros(kBlockSize - sizeof(footer)) + Bytes(&footer, sizeof(footer));
+    auto footer_offset = partition_size - kBlockSize;
+    CF_EXPECT(fd->Truncate(footer_offset) == 0, fd->StrError());
+    CF_EXPECT(fd->LSeek(footer_offset, SEEK_SET) == footer_offset);
+    CF_EXPECT(WriteAll(fd, footer_block) == footer_block.size(),
+              "Failed to write footer: " << fd->StrError());
+    return {};
+  }();
+  if (!result.ok()) {
+    fd->Truncate(original_size);
+  }
+  return result;
+}
+
+Result<void> Avb::MakeVbmetaImage(
+    const std::string& output_path,
+    const std::vector<AvbChainPartition>& chained_partitions) const {
+  std::string descriptors;
+  // Location 0 belongs to the vbmeta image itself.
+  std::set<std::uint32_t> used_locations = {0};
+  for (const auto& partition : chained_partitions) {
+    CF_EXPECT(partition.rollback_index_location >= 1,
+              "Rollback index location must be 1 or larger.");
+    CF_EXPECT(used_locations.insert(partition.rollback_index_location).second,
+              "Rollback Index Location " << partition.rollback_index_location
+                                         << " is already in use.");
+    std::string public_key;
+    CF_EXPECT(
+        android::base::ReadFileToString(partition.public_key_path, &public_key),
+        "Failed to read \"" << partition.public_key_path << "\"");
+    descriptors += ChainPartitionDescriptor(partition.partition_name,
+                                            partition.rollback_index_location,
+                                            public_key);
+  }
+  auto vbmeta = CF_EXPECT(VbmetaBlob(descriptors));
+
+  auto fd = SharedFD::Open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << output_path << "\": " << fd->StrError());
+  CF_EXPECT(WriteAll(fd, vbmeta) == vbmeta.size(),
+            "Failed to write \"" << output_path << "\": " << fd->StrError());
+  return {};
+}
+
+}  // namespace cuttlefish
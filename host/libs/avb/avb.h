@@ -0,0 +1,89 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+struct AvbAlgorithm;
+
+struct AvbChainPartition {
+  std::string partition_name;
+  std::uint32_t rollback_index_location;
+  // Public key in the avbtool format, e.g. the output of
+  // `avbtool extract_public_key`.
+  std::string public_key_path;
+};
+
+/**
+ * In-process implementation of the avbtool commands used to assemble a
+ * device, without starting a python interpreter for each of them.
+ *
+ * The output is byte for byte what avbtool produces for the same arguments,
+ * as long as the same salt is used: like avbtool, a random salt is chosen
+ * when none is given.
+ *
+ * Instances hold no mutable state and can be shared between threads.
+ */
+class Avb {
+ public:
+  /**
+   * `algorithm` is an avbtool algorithm name such as "SHA256_RSA4096", the
+   * private key is read from the PEM file at `key_path`. With "NONE" the
+   * metadata is not signed and `key_path` is ignored.
+   */
+  static Result<Avb> Create(const std::string& algorithm,
+                            const std::string& key_path);
+  // Equivalent to `avbtool add_hash_footer` without a key.
+  static Avb Unsigned();
+
+  /**
+   * Equivalent to `avbtool add_hash_footer --image image_path
+   * --partition_name partition_name --partition_size partition_size
+   * [--salt salt]`, with `salt` given in binary rather than hex. An existing
+   * footer is replaced.
+   */
+  Result<void> AddHashFooter(const std::string& image_path,
+                             const std::string& partition_name,
+                             std::uint64_t partition_size,
+                             const std::string& salt = "") const;
+
+  /**
+   * Equivalent to `avbtool make_vbmeta_image --output output_path
+   * [--chain_partition name:location:key]...`.
+   */
+  Result<void> MakeVbmetaImage(
+      const std::string& output_path,
+      const std::vector<AvbChainPartition>& chained_partitions) const;
+
+ private:
+  Avb(const AvbAlgorithm& algorithm, std::shared_ptr<EVP_PKEY> key);
+
+  Result<std::string> VbmetaBlob(const std::string& descriptors) const;
+
+  const AvbAlgorithm* algorithm_;
+  std::shared_ptr<EVP_PKEY> key_;
+};
+
+}  // namespace cuttlefish
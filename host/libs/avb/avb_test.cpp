@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <libavb/libavb.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/libs/avb/avb.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint64_t kPartitionSize = 1 << 20;
+const std::string kSalt(32, '\x5a');
+
+std::string Hex(const std::string& data) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  for (unsigned char c : data) {
+    hex += kDigits[c >> 4];
+    hex += kDigits[c & 0xf];
+  }
+  return hex;
+}
+
+std::string Contents(std::size_t size) {
+  std::string contents;
+  for (std::size_t i = 0; i < size; i++) {
+    contents += static_cast<char>(i * 31 + 7);
+  }
+  return contents;
+}
+
+class AvbTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // A small key keeps the test fast, the code paths are the same.
+    std::unique_ptr<EVP_PKEY_CTX, void (*)(EVP_PKEY_CTX*)> ctx(
+        EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr), EVP_PKEY_CTX_free);
+    ASSERT_TRUE(ctx);
+    ASSERT_EQ(EVP_PKEY_keygen_init(ctx.get()), 1);
+    ASSERT_EQ(EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), 2048), 1);
+    EVP_PKEY* pkey = nullptr;
+    ASSERT_EQ(EVP_PKEY_keygen(ctx.get(), &pkey), 1);
+    std::unique_ptr<EVP_PKEY, void (*)(EVP_PKEY*)> key(pkey, EVP_PKEY_free);
+
+    key_path_ = std::string(dir_.path) + "/key.pem";
+    std::unique_ptr<BIO, int (*)(BIO*)> bio(BIO_new(BIO_s_mem()), BIO_free);
+    ASSERT_EQ(PEM_write_bio_PrivateKey(bio.get(), key.get(), nullptr, nullptr,
+                                       0, nullptr, nullptr),
+              1);
+    std::string pem(BIO_pending(bio.get()), '\0');
+    ASSERT_EQ(BIO_read(bio.get(), pem.data(), pem.size()), pem.size());
+    ASSERT_TRUE(android::base::WriteStringToFile(pem, key_path_));
+  }
+
+  std::string Path(const std::string& name) {
+    return std::string(dir_.path) + "/" + name;
+  }
+
+  TemporaryDir dir_;
+  std::string key_path_;
+};
+
+TEST_F(AvbTest, HashFooterVerifiesWithLibavb) {
+  auto avb = Avb::Create("SHA256_RSA2048", key_path_);
+  ASSERT_TRUE(avb.ok()) << avb.error();
+  auto image = Path("image");
+  auto contents = Contents(5000);
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, image));
+
+  auto result = avb->AddHashFooter(image, "uboot_env", kPartitionSize, kSalt);
+  ASSERT_TRUE(result.ok()) << result.error();
+
+  std::string partition;
+  ASSERT_TRUE(android::base::ReadFileToString(image, &partition));
+  ASSERT_EQ(partition.size(), kPartitionSize);
+  ASSERT_EQ(partition.substr(0, contents.size()), contents);
+
+  AvbFooter footer;
+  ASSERT_TRUE(avb_footer_validate_and_byteswap(
+      reinterpret_cast<const AvbFooter*>(partition.data() + partition.size() -
+                                         sizeof(AvbFooter)),
+      &footer));
+  ASSERT_EQ(footer.original_image_size, contents.size());
+  ASSERT_EQ(footer.vbmeta_offset % 4096, 0);
+
+  auto vbmeta = reinterpret_cast<const uint8_t*>(partition.data()) +
+                footer.vbmeta_offset;
+  const uint8_t* public_key = nullptr;
+  std::size_t public_key_size = 0;
+  ASSERT_EQ(avb_vbmeta_image_verify(vbmeta, footer.vbmeta_size, &public_key,
+                                    &public_key_size),
+            AVB_VBMETA_VERIFY_RESULT_OK);
+
+  AvbVBMetaImageHeader header;
+  avb_vbmeta_image_header_to_host_byte_order(
+      reinterpret_cast<const AvbVBMetaImageHeader*>(vbmeta), &header);
+  auto descriptors = vbmeta + sizeof(AvbVBMetaImageHeader) +
+                     header.authentication_data_block_size +
+                     header.descriptors_offset;
+  AvbHashDescriptor descriptor;
+  ASSERT_TRUE(avb_hash_descriptor_validate_and_byteswap(
+      reinterpret_cast<const AvbHashDescriptor*>(descriptors), &descriptor));
+  ASSERT_EQ(descriptor.image_size, contents.size());
+  ASSERT_EQ(descriptor.salt_len, kSalt.size());
+}
+
+TEST_F(AvbTest, HashFooterIsIdempotent) {
+  auto avb = Avb::Unsigned();
+  auto image = Path("image");
+  auto contents = Contents(4096);
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, image));
+
+  ASSERT_TRUE(avb.AddHashFooter(image, "boot", kPartitionSize, kSalt).ok());
+  auto first = ReadFile(image);
+  ASSERT_TRUE(avb.AddHashFooter(image, "boot", kPartitionSize, kSalt).ok());
+  ASSERT_EQ(ReadFile(image), first);
+}
+
+TEST_F(AvbTest, HashFooterRejectsLargeImages) {
+  auto avb = Avb::Unsigned();
+  auto image = Path("image");
+  auto contents = Contents(kPartitionSize);
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, image));
+
+  ASSERT_FALSE(avb.AddHashFooter(image, "boot", kPartitionSize).ok());
+  ASSERT_EQ(ReadFile(image), contents);
+}
+
+TEST_F(AvbTest, ConcurrentHashFooters) {
+  auto avb = Avb::Create("SHA256_RSA2048", key_path_);
+  ASSERT_TRUE(avb.ok()) << avb.error();
+  std::vector<std::thread> threads;
+  std::vector<char> ok(8);
+  for (std::size_t i = 0; i < ok.size(); i++) {
+    auto image = Path("image" + std::to_string(i));
+    ASSERT_TRUE(android::base::WriteStringToFile(Contents(4096 * i), image));
+    threads.emplace_back([&avb, &ok, i, image]() {
+      ok[i] = avb->AddHashFooter(image, "uboot_env", kPartitionSize).ok();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (std::size_t i = 0; i < ok.size(); i++) {
+    ASSERT_TRUE(ok[i]) << "image " << i;
+  }
+}
+
+TEST_F(AvbTest, RepeatedRollbackIndexLocation) {
+  auto avb = Avb::Create("SHA256_RSA2048", key_path_);
+  ASSERT_TRUE(avb.ok()) << avb.error();
+  auto public_key = Path("key.avbpubkey");
+  ASSERT_TRUE(android::base::WriteStringToFile("key", public_key));
+  auto result = avb->MakeVbmetaImage(
+      Path("vbmeta.img"), {{"uboot_env", 1, public_key},
+                           {"bootconfig", 1, public_key}});
+  ASSERT_FALSE(result.ok());
+}
+
+class AvbtoolComparisonTest : public AvbTest {
+ protected:
+  void SetUp() override {
+    AvbTest::SetUp();
+    // Installed by data_bins, or found in the host output directory when
+    // running the test binary out of a build tree.
+    avbtool_ = android::base::GetExecutableDirectory() + "/avbtool";
+    if (!FileExists(avbtool_)) {
+      avbtool_ = HostBinaryPath("avbtool");
+    }
+    ASSERT_TRUE(FileExists(avbtool_)) << "avbtool is missing";
+  }
+
+  void RunAvbtool(const std::vector<std::string>& args) {
+    Command command(avbtool_);
+    for (const auto& arg : args) {
+      command.AddParameter(arg);
+    }
+    ASSERT_EQ(command.Start().Wait(), 0);
+  }
+
+  std::string avbtool_;
+};
+
+TEST_F(AvbtoolComparisonTest, HashFooter) {
+  for (const auto& [algorithm, size] :
+       std::vector<std::pair<std::string, std::size_t>>{
+           {"NONE", 0}, {"NONE", 4096}, {"SHA256_RSA2048", 1},
+           {"SHA256_RSA2048", 70000}}) {
+    auto contents = Contents(size);
+    auto expected = Path("expected");
+    auto actual = Path("actual");
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, expected));
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, actual));
+
+    std::vector<std::string> args = {
+        "add_hash_footer",  "--image", expected,
+        "--partition_size", std::to_string(kPartitionSize),
+        "--partition_name", "uboot_env",
+        "--salt",           Hex(kSalt),
+        "--algorithm",      algorithm,
+    };
+    if (algorithm != "NONE") {
+      args.insert(args.end(), {"--key", key_path_});
+    }
+    RunAvbtool(args);
+
+    auto avb = Avb::Create(algorithm, key_path_);
+    ASSERT_TRUE(avb.ok()) << avb.error();
+    auto result = avb->AddHashFooter(actual, "uboot_env", kPartitionSize, kSalt);
+    ASSERT_TRUE(result.ok()) << result.error();
+    ASSERT_TRUE(ReadFile(actual) == ReadFile(expected))
+        << algorithm << ", " << size << " bytes";
+  }
+}
+
+TEST_F(AvbtoolComparisonTest, VbmetaWithChainedPartitions) {
+  auto public_key = Path("key.avbpubkey");
+  RunAvbtool({"extract_public_key", "--key", key_path_, "--output",
+              public_key});
+  auto expected = Path("expected");
+  RunAvbtool({"make_vbmeta_image", "--output", expected, "--algorithm",
+              "SHA256_RSA2048", "--key", key_path_, "--chain_partition",
+              "uboot_env:1:" + public_key, "--chain_partition",
+              "bootconfig:2:" + public_key});
+
+  auto avb = Avb::Create("SHA256_RSA2048", key_path_);
+  ASSERT_TRUE(avb.ok()) << avb.error();
+  auto actual = Path("actual");
+  auto result = avb->MakeVbmetaImage(
+      actual,
+      {{"uboot_env", 1, public_key}, {"bootconfig", 2, public_key}});
+  ASSERT_TRUE(result.ok()) << result.error();
+  ASSERT_TRUE(ReadFile(actual) == ReadFile(expected));
+}
+
+}  // namespace
+}  // namespace cuttlefish
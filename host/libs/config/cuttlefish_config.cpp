@@ -518,6 +518,15 @@ std::string CuttlefishConfig::sig_server_headers_path() const {
   return (*dictionary_)[kSigServerHeadersPath].asString();
 }
 
+static constexpr char kConsolidateHostDaemons[] = "consolidate_host_daemons";
+bool CuttlefishConfig::consolidate_host_daemons() const {
+  return (*dictionary_)[kConsolidateHostDaemons].asBool();
+}
+void CuttlefishConfig::set_consolidate_host_daemons(
+    bool consolidate_host_daemons) {
+  (*dictionary_)[kConsolidateHostDaemons] = consolidate_host_daemons;
+}
+
 static constexpr char kRunModemSimulator[] = "enable_modem_simulator";
 bool CuttlefishConfig::enable_modem_simulator() const {
   return (*dictionary_)[kRunModemSimulator].asBool();
@@ -704,6 +713,30 @@ bool CuttlefishConfig::vhost_net() const {
   return (*dictionary_)[kVhostNet].asBool();
 }
 
+static constexpr char kNetQueues[] = "net_queues";
+void CuttlefishConfig::set_net_queues(int net_queues) {
+  (*dictionary_)[kNetQueues] = net_queues;
+}
+int CuttlefishConfig::net_queues() const {
+  return (*dictionary_)[kNetQueues].asInt();
+}
+
+static constexpr char kTapOffloads[] = "tap_offloads";
+void CuttlefishConfig::set_tap_offloads(bool tap_offloads) {
+  (*dictionary_)[kTapOffloads] = tap_offloads;
+}
+bool CuttlefishConfig::tap_offloads() const {
+  return (*dictionary_)[kTapOffloads].asBool();
+}
+
+static constexpr char kTapSndbuf[] = "tap_sndbuf";
+void CuttlefishConfig::set_tap_sndbuf(int tap_sndbuf) {
+  (*dictionary_)[kTapSndbuf] = tap_sndbuf;
+}
+int CuttlefishConfig::tap_sndbuf() const {
+  return (*dictionary_)[kTapSndbuf].asInt();
+}
+
 static constexpr char kVhostUserMac80211Hwsim[] = "vhost_user_mac80211_hwsim";
 void CuttlefishConfig::set_vhost_user_mac80211_hwsim(const std::string& path) {
   (*dictionary_)[kVhostUserMac80211Hwsim] = path;
@@ -736,6 +769,22 @@ void CuttlefishConfig::set_ap_kernel_image(const std::string& ap_kernel_image) {
   (*dictionary_)[kApKernelImage] = ap_kernel_image;
 }
 
+static constexpr char kApBackend[] = "ap_backend";
+std::string CuttlefishConfig::ap_backend() const {
+  return (*dictionary_)[kApBackend].asString();
+}
+void CuttlefishConfig::set_ap_backend(const std::string& ap_backend) {
+  (*dictionary_)[kApBackend] = ap_backend;
+}
+
+static constexpr char kSharedSecureEnv[] = "shared_secure_env";
+bool CuttlefishConfig::shared_secure_env() const {
+  return (*dictionary_)[kSharedSecureEnv].asBool();
+}
+void CuttlefishConfig::set_shared_secure_env(bool shared) {
+  (*dictionary_)[kSharedSecureEnv] = shared;
+}
+
 static constexpr char kWmediumdConfig[] = "wmediumd_config";
 void CuttlefishConfig::set_wmediumd_config(const std::string& config) {
   (*dictionary_)[kWmediumdConfig] = config;
@@ -821,6 +870,22 @@ bool CuttlefishConfig::protected_vm() const {
   return (*dictionary_)[kProtectedVm].asBool();
 }
 
+static constexpr char kSuperPmemImage[] = "super_pmem_image";
+void CuttlefishConfig::set_super_pmem_image(const std::string& path) {
+  (*dictionary_)[kSuperPmemImage] = path;
+}
+std::string CuttlefishConfig::super_pmem_image() const {
+  return (*dictionary_)[kSuperPmemImage].asString();
+}
+
+static constexpr char kFakeGuestProfile[] = "fake_guest_profile";
+void CuttlefishConfig::set_fake_guest_profile(const std::string& path) {
+  (*dictionary_)[kFakeGuestProfile] = path;
+}
+std::string CuttlefishConfig::fake_guest_profile() const {
+  return (*dictionary_)[kFakeGuestProfile].asString();
+}
+
 static constexpr char kTargetArch[] = "target_arch";
 void CuttlefishConfig::set_target_arch(Arch target_arch) {
   (*dictionary_)[kTargetArch] = static_cast<int>(target_arch);
@@ -281,6 +281,11 @@ class CuttlefishConfig {
   bool enable_minimal_mode() const;
   void set_enable_minimal_mode(bool enable_minimal_mode);
 
+  // Run the small per-instance host daemons as services of one host_daemons
+  // process rather than as separate processes.
+  void set_consolidate_host_daemons(bool consolidate_host_daemons);
+  bool consolidate_host_daemons() const;
+
   void set_enable_modem_simulator(bool enable_modem_simulator);
   bool enable_modem_simulator() const;
 
@@ -296,6 +301,16 @@ class CuttlefishConfig {
   void set_vhost_net(bool vhost_net);
   bool vhost_net() const;
 
+  // Queue pairs of every virtio-net device, each served by its own vCPU.
+  void set_net_queues(int net_queues);
+  int net_queues() const;
+
+  void set_tap_offloads(bool tap_offloads);
+  bool tap_offloads() const;
+
+  void set_tap_sndbuf(int tap_sndbuf);
+  int tap_sndbuf() const;
+
   void set_vhost_user_mac80211_hwsim(const std::string& path);
   std::string vhost_user_mac80211_hwsim() const;
 
@@ -308,9 +323,17 @@ class CuttlefishConfig {
   void set_ap_kernel_image(const std::string& path);
   std::string ap_kernel_image() const;
 
+  // "openwrt" for the OpenWrt VM, "host" for the wifi_ap host process.
+  void set_ap_backend(const std::string& backend);
+  std::string ap_backend() const;
+
   void set_wmediumd_config(const std::string& path);
   std::string wmediumd_config() const;
 
+  // Whether the secure_env of the first instance serves every instance.
+  void set_shared_secure_env(bool shared);
+  bool shared_secure_env() const;
+
   void set_rootcanal_hci_port(int rootcanal_hci_port);
   int rootcanal_hci_port() const;
 
@@ -339,6 +362,15 @@ class CuttlefishConfig {
   void set_protected_vm(bool protected_vm);
   bool protected_vm() const;
 
+  // The super image exposed to every instance as a read-only pmem device, so
+  // that the guests share the host page cache for it. Empty when disabled.
+  void set_super_pmem_image(const std::string& path);
+  std::string super_pmem_image() const;
+
+  // Load profile of the fake_guest vm manager, empty for its defaults.
+  void set_fake_guest_profile(const std::string& path);
+  std::string fake_guest_profile() const;
+
   void set_target_arch(Arch target_arch);
   Arch target_arch() const;
 
@@ -436,6 +468,9 @@ class CuttlefishConfig {
     std::string keyboard_socket_path() const;
     std::string switches_socket_path() const;
     std::string frames_socket_path() const;
+    std::string frame_capture_socket_path() const;
+    std::string screen_stability_socket_path() const;
+    std::string input_control_socket_path() const;
 
     int confui_host_vsock_port() const;
 
@@ -465,6 +500,9 @@ class CuttlefishConfig {
 
     std::string launcher_monitor_socket_path() const;
 
+    // Where run_cvd's device control service accepts state updates.
+    std::string device_control_socket_path() const;
+
     std::string sdcard_path() const;
 
     std::string persistent_composite_disk_path() const;
@@ -496,9 +534,18 @@ class CuttlefishConfig {
     // Whether this instance should start an ap instance
     bool start_ap() const;
 
+    // Whether this instance should start a secure_env instance
+    bool start_secure_env() const;
+
     // Wifi MAC address inside the guest
     int wifi_mac_prefix() const;
 
+    // QoS tier of the instance, empty when its host processes are not placed
+    // in a cgroup.
+    std::string qos_tier() const;
+    // The cgroup for the host processes of the instance.
+    std::string qos_cgroup_path() const;
+
     std::string factory_reset_protected_path() const;
 
     std::string persistent_bootconfig_path() const;
@@ -551,8 +598,11 @@ class CuttlefishConfig {
     void set_start_wmediumd(bool start);
     void set_start_rootcanal(bool start);
     void set_start_ap(bool start);
+    void set_start_secure_env(bool start);
     // Wifi MAC address inside the guest
     void set_wifi_mac_prefix(const int wifi_mac_prefix);
+    void set_qos_tier(const std::string& qos_tier);
+    void set_qos_cgroup_path(const std::string& qos_cgroup_path);
     // Gnss grpc proxy server port inside the host
     void set_gnss_grpc_proxy_server_port(int gnss_grpc_proxy_server_port);
     // Gnss grpc proxy local file path
@@ -157,6 +157,11 @@ std::string CuttlefishConfig::InstanceSpecific::launcher_monitor_socket_path()
   return AbsolutePath(PerInstancePath("launcher_monitor.sock"));
 }
 
+std::string CuttlefishConfig::InstanceSpecific::device_control_socket_path()
+    const {
+  return PerInstanceInternalPath("device_control.sock");
+}
+
 static constexpr char kModemSimulatorPorts[] = "modem_simulator_ports";
 std::string CuttlefishConfig::InstanceSpecific::modem_simulator_ports() const {
   return (*Dictionary())[kModemSimulatorPorts].asString();
@@ -425,6 +430,33 @@ bool CuttlefishConfig::InstanceSpecific::start_ap() const {
   return (*Dictionary())[kStartAp].asBool();
 }
 
+static constexpr char kStartSecureEnv[] = "start_secure_env";
+void CuttlefishConfig::MutableInstanceSpecific::set_start_secure_env(
+    bool start) {
+  (*Dictionary())[kStartSecureEnv] = start;
+}
+bool CuttlefishConfig::InstanceSpecific::start_secure_env() const {
+  return (*Dictionary())[kStartSecureEnv].asBool();
+}
+
+static constexpr char kQosTier[] = "qos_tier";
+void CuttlefishConfig::MutableInstanceSpecific::set_qos_tier(
+    const std::string& qos_tier) {
+  (*Dictionary())[kQosTier] = qos_tier;
+}
+std::string CuttlefishConfig::InstanceSpecific::qos_tier() const {
+  return (*Dictionary())[kQosTier].asString();
+}
+
+static constexpr char kQosCgroupPath[] = "qos_cgroup_path";
+void CuttlefishConfig::MutableInstanceSpecific::set_qos_cgroup_path(
+    const std::string& qos_cgroup_path) {
+  (*Dictionary())[kQosCgroupPath] = qos_cgroup_path;
+}
+std::string CuttlefishConfig::InstanceSpecific::qos_cgroup_path() const {
+  return (*Dictionary())[kQosCgroupPath].asString();
+}
+
 std::string CuttlefishConfig::InstanceSpecific::touch_socket_path(
     int screen_idx) const {
   return PerInstanceInternalPath(
@@ -443,6 +475,21 @@ std::string CuttlefishConfig::InstanceSpecific::frames_socket_path() const {
   return PerInstanceInternalPath("frames.sock");
 }
 
+std::string CuttlefishConfig::InstanceSpecific::frame_capture_socket_path()
+    const {
+  return PerInstanceInternalPath("frame_capture.sock");
+}
+
+std::string CuttlefishConfig::InstanceSpecific::screen_stability_socket_path()
+    const {
+  return PerInstanceInternalPath("screen_stability.sock");
+}
+
+std::string CuttlefishConfig::InstanceSpecific::input_control_socket_path()
+    const {
+  return PerInstanceInternalPath("input_control.sock");
+}
+
 static constexpr char kWifiMacPrefix[] = "wifi_mac_prefix";
 int CuttlefishConfig::InstanceSpecific::wifi_mac_prefix() const {
   return (*Dictionary())[kWifiMacPrefix].asInt();
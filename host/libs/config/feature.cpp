@@ -16,11 +16,45 @@
 
 #include "host/libs/config/feature.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "common/libs/utils/result.h"
 
 namespace cuttlefish {
+namespace {
+
+struct SetupNode {
+  SetupFeature* feature;
+  std::size_t group;
+  // Position in the topological order of the group, ready features run in
+  // this order so that runs and errors are reproducible.
+  std::size_t order;
+  std::size_t pending_dependencies = 0;
+  std::vector<SetupNode*> dependents;
+  bool ran = false;
+  Result<void> result;
+  std::chrono::steady_clock::duration duration{};
+};
+
+struct SetupNodeOrder {
+  bool operator()(const SetupNode* a, const SetupNode* b) const {
+    return std::tie(a->group, a->order) < std::tie(b->group, b->order);
+  }
+};
+
+std::string GroupPrefix(const SetupFeatureGroup& group) {
+  return group.label.empty() ? "" : "[" + group.label + "] ";
+}
+
+}  // namespace
 
 SetupFeature::~SetupFeature() {}
 
@@ -59,6 +93,134 @@ bool SetupFeature::Setup() {
   return {};
 }
 
+/* static */ Result<void> SetupFeature::RunSetupParallel(
+    const std::vector<SetupFeatureGroup>& groups,
+    std::size_t max_parallelism) {
+  std::vector<std::unique_ptr<SetupNode>> nodes;
+  for (std::size_t group = 0; group < groups.size(); group++) {
+    std::unordered_set<SetupFeature*> enabled;
+    for (const auto& feature : groups[group].features) {
+      CF_EXPECT(feature != nullptr, "Received null feature");
+      if (feature->Enabled()) {
+        enabled.insert(feature);
+      }
+    }
+    std::unordered_map<SetupFeature*, SetupNode*> group_nodes;
+    auto add_node = [&](SetupFeature* feature) -> bool {
+      auto node = std::make_unique<SetupNode>();
+      node->feature = feature;
+      node->group = group;
+      node->order = group_nodes.size();
+      group_nodes[feature] = node.get();
+      nodes.emplace_back(std::move(node));
+      return true;
+    };
+    CF_EXPECT(Feature<SetupFeature>::TopologicalVisit(enabled, add_node),
+              GroupPrefix(groups[group])
+                  << "Dependency issue detected, not performing any setup.");
+    for (auto& [feature, node] : group_nodes) {
+      for (const auto& dependency : DirectDependencies(feature)) {
+        node->pending_dependencies++;
+        group_nodes[dependency]->dependents.push_back(node);
+      }
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::set<SetupNode*, SetupNodeOrder> ready;
+  std::size_t running = 0;
+  bool failed = false;
+  for (auto& node : nodes) {
+    if (node->pending_dependencies == 0) {
+      ready.insert(node.get());
+    }
+  }
+
+  auto worker = [&]() {
+    std::unique_lock lock(mutex);
+    for (;;) {
+      cv.wait(lock, [&]() { return (!ready.empty() && !failed) || !running; });
+      if (failed || ready.empty()) {
+        // Nothing left to start and nothing running that could unblock more.
+        cv.notify_all();
+        return;
+      }
+      auto node = *ready.begin();
+      ready.erase(ready.begin());
+      running++;
+      lock.unlock();
+
+      LOG(DEBUG) << GroupPrefix(groups[node->group]) << "Running setup for "
+                 << node->feature->Name();
+      auto start = std::chrono::steady_clock::now();
+      auto result = node->feature->ResultSetup();
+      auto duration = std::chrono::steady_clock::now() - start;
+      LOG(DEBUG) << GroupPrefix(groups[node->group]) << node->feature->Name()
+                 << " took "
+                 << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        duration)
+                        .count()
+                 << " ms";
+
+      lock.lock();
+      running--;
+      node->ran = true;
+      node->duration = duration;
+      if (result.ok()) {
+        for (auto dependent : node->dependents) {
+          if (--dependent->pending_dependencies == 0) {
+            ready.insert(dependent);
+          }
+        }
+      } else {
+        failed = true;
+      }
+      node->result = std::move(result);
+      cv.notify_all();
+    }
+  };
+
+  if (max_parallelism == 0) {
+    // Most features wait on subprocesses or the disk, so use a few threads
+    // even on small machines.
+    max_parallelism = std::max(std::thread::hardware_concurrency(), 4u);
+  }
+  auto num_threads = std::min(max_parallelism, nodes.size());
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto wall_time = std::chrono::steady_clock::now() - start;
+
+  std::chrono::steady_clock::duration work_time{};
+  for (const auto& node : nodes) {
+    work_time += node->duration;
+  }
+  LOG(DEBUG) << "Setup of " << nodes.size() << " features on " << num_threads
+             << " threads took "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(wall_time)
+                    .count()
+             << " ms for "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(work_time)
+                    .count()
+             << " ms of work";
+
+  // `nodes` is already in group and topological order.
+  for (auto& node : nodes) {
+    if (node->ran && !node->result.ok()) {
+      CF_EXPECT(std::move(node->result),
+                GroupPrefix(groups[node->group])
+                    << "Setup failed for " << node->feature->Name());
+    }
+  }
+  return {};
+}
+
 Result<void> FlagFeature::ProcessFlags(
     const std::vector<FlagFeature*>& features,
     std::vector<std::string>& flags) {
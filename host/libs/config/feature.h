@@ -15,6 +15,7 @@
  */
 #pragma once
 
+#include <functional>
 #include <ostream>
 #include <string>
 #include <unordered_map>
@@ -38,15 +39,42 @@ class Feature {
       const std::unordered_set<Subclass*>& features,
       const std::function<bool(Subclass*)>& callback);
 
+ protected:
+  static std::unordered_set<Subclass*> DirectDependencies(
+      const Subclass* feature) {
+    return feature->Dependencies();
+  }
+
  private:
   virtual std::unordered_set<Subclass*> Dependencies() const = 0;
 };
 
+class SetupFeature;
+
+// Features set up together, e.g. the disk features of one instance.
+struct SetupFeatureGroup {
+  // Included in errors and timing output to tell the groups apart.
+  std::string label;
+  std::vector<SetupFeature*> features;
+};
+
 class SetupFeature : public virtual Feature<SetupFeature> {
  public:
   virtual ~SetupFeature();
 
   static Result<void> RunSetup(const std::vector<SetupFeature*>& features);
+  // Sets up every group, running any features whose dependencies are done
+  // concurrently on up to max_parallelism threads, or a default based on the
+  // number of cores if 0.
+  // Groups don't depend on each other and run concurrently as well. Once a
+  // feature fails no new features are started, and the error of the first
+  // failed feature in group and dependency order is returned.
+  //
+  // Only for features that tolerate running on a different thread alongside
+  // others, e.g. they don't fork the calling process.
+  static Result<void> RunSetupParallel(
+      const std::vector<SetupFeatureGroup>& groups,
+      std::size_t max_parallelism = 0);
 
   virtual bool Enabled() const = 0;
 
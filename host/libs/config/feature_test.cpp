@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/result.h"
+#include "host/libs/config/feature.h"
+
+namespace cuttlefish {
+namespace {
+
+// Records when features start and finish setting up, in a single sequence
+// shared by all features of a test.
+class SetupLog {
+ public:
+  std::size_t Record(const std::string& event) {
+    std::lock_guard lock(mutex_);
+    events_.push_back(event);
+    return events_.size() - 1;
+  }
+
+  std::vector<std::string> Events() {
+    std::lock_guard lock(mutex_);
+    return events_;
+  }
+
+  // Position of the event in the sequence, or -1 if it didn't happen.
+  int IndexOf(const std::string& event) {
+    std::lock_guard lock(mutex_);
+    for (std::size_t i = 0; i < events_.size(); i++) {
+      if (events_[i] == event) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::string> events_;
+};
+
+class FakeFeature : public SetupFeature {
+ public:
+  FakeFeature(SetupLog& log, std::string name) : log_(log), name_(name) {}
+
+  std::string Name() const override { return name_; }
+  bool Enabled() const override { return enabled_; }
+
+  FakeFeature& DependsOn(std::unordered_set<SetupFeature*> dependencies) {
+    dependencies_ = std::move(dependencies);
+    return *this;
+  }
+  FakeFeature& Disable() {
+    enabled_ = false;
+    return *this;
+  }
+  FakeFeature& Fail() {
+    fail_ = true;
+    return *this;
+  }
+  // Runs before the setup completes, from the setup thread.
+  FakeFeature& During(std::function<void()> during) {
+    during_ = std::move(during);
+    return *this;
+  }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override {
+    return dependencies_;
+  }
+
+  Result<void> ResultSetup() override {
+    log_.Record("start " + name_);
+    if (during_) {
+      during_();
+    }
+    log_.Record("end " + name_);
+    CF_EXPECT(!fail_, name_ << " failed on purpose");
+    return {};
+  }
+
+  SetupLog& log_;
+  std::string name_;
+  std::unordered_set<SetupFeature*> dependencies_;
+  bool enabled_ = true;
+  bool fail_ = false;
+  std::function<void()> during_;
+};
+
+// Blocks every caller until `count` of them are waiting, or until a timeout
+// so that a broken scheduler fails the test instead of hanging it.
+class Rendezvous {
+ public:
+  explicit Rendezvous(std::size_t count) : count_(count) {}
+
+  bool Arrive() {
+    std::unique_lock lock(mutex_);
+    arrived_++;
+    cv_.notify_all();
+    return cv_.wait_for(lock, std::chrono::seconds(10),
+                        [this]() { return arrived_ >= count_; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::size_t count_;
+  std::size_t arrived_ = 0;
+};
+
+TEST(RunSetupParallelTest, DependenciesFinishFirst) {
+  SetupLog log;
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  FakeFeature c(log, "c");
+  FakeFeature d(log, "d");
+  // Diamond: d needs b and c, which both need a.
+  b.DependsOn({&a});
+  c.DependsOn({&a});
+  d.DependsOn({&b, &c});
+
+  auto result = SetupFeature::RunSetupParallel({{"", {&d, &c, &b, &a}}}, 4);
+  ASSERT_TRUE(result.ok()) << result.error();
+
+  ASSERT_EQ(log.Events().size(), 8u);
+  EXPECT_LT(log.IndexOf("end a"), log.IndexOf("start b"));
+  EXPECT_LT(log.IndexOf("end a"), log.IndexOf("start c"));
+  EXPECT_LT(log.IndexOf("end b"), log.IndexOf("start d"));
+  EXPECT_LT(log.IndexOf("end c"), log.IndexOf("start d"));
+}
+
+TEST(RunSetupParallelTest, IndependentFeaturesRunConcurrently) {
+  SetupLog log;
+  Rendezvous rendezvous(3);
+  bool all_met = true;
+  std::mutex all_met_mutex;
+  auto meet = [&]() {
+    bool met = rendezvous.Arrive();
+    std::lock_guard lock(all_met_mutex);
+    all_met &= met;
+  };
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  FakeFeature c(log, "c");
+  a.During(meet);
+  b.During(meet);
+  c.During(meet);
+
+  // Groups don't wait on each other either.
+  auto result =
+      SetupFeature::RunSetupParallel({{"0", {&a, &b}}, {"1", {&c}}}, 3);
+  ASSERT_TRUE(result.ok()) << result.error();
+  EXPECT_TRUE(all_met);
+}
+
+TEST(RunSetupParallelTest, SkipsDisabledFeatures) {
+  SetupLog log;
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  b.Disable();
+
+  auto result = SetupFeature::RunSetupParallel({{"", {&a, &b}}}, 2);
+  ASSERT_TRUE(result.ok()) << result.error();
+  EXPECT_EQ(log.Events(), (std::vector<std::string>{"start a", "end a"}));
+}
+
+TEST(RunSetupParallelTest, FailureStopsDependents) {
+  SetupLog log;
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  FakeFeature c(log, "c");
+  a.Fail();
+  b.DependsOn({&a});
+  c.DependsOn({&b});
+
+  auto result = SetupFeature::RunSetupParallel({{"instance 1", {&a, &b, &c}}});
+  ASSERT_FALSE(result.ok());
+  auto message = result.error().message();
+  EXPECT_NE(message.find("a failed on purpose"), std::string::npos) << message;
+  EXPECT_NE(message.find("[instance 1] Setup failed for a"), std::string::npos)
+      << message;
+  EXPECT_EQ(log.IndexOf("start b"), -1);
+  EXPECT_EQ(log.IndexOf("start c"), -1);
+}
+
+TEST(RunSetupParallelTest, FailureStopsNewFeatures) {
+  SetupLog log;
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  a.Fail();
+
+  // One thread: a runs first by order, b must not start after it failed.
+  auto result = SetupFeature::RunSetupParallel({{"0", {&a}}, {"1", {&b}}}, 1);
+  ASSERT_FALSE(result.ok());
+  EXPECT_EQ(log.IndexOf("start b"), -1);
+}
+
+TEST(RunSetupParallelTest, ReportsFirstFailureInGroupOrder) {
+  SetupLog log;
+  Rendezvous rendezvous(2);
+  auto meet = [&rendezvous]() { rendezvous.Arrive(); };
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  a.Fail().During(meet);
+  b.Fail().During(meet);
+
+  // Both fail at the same time, the error of the earlier group wins
+  // regardless of which thread finishes first.
+  auto result = SetupFeature::RunSetupParallel({{"0", {&a}}, {"1", {&b}}}, 2);
+  ASSERT_FALSE(result.ok());
+  auto message = result.error().message();
+  EXPECT_NE(message.find("[0] Setup failed for a"), std::string::npos)
+      << message;
+  EXPECT_EQ(message.find("Setup failed for b"), std::string::npos) << message;
+}
+
+TEST(RunSetupParallelTest, DetectsCycles) {
+  SetupLog log;
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  FakeFeature c(log, "c");
+  a.DependsOn({&c});
+  b.DependsOn({&a});
+  c.DependsOn({&b});
+
+  auto result = SetupFeature::RunSetupParallel({{"", {&a, &b, &c}}});
+  ASSERT_FALSE(result.ok());
+  EXPECT_NE(result.error().message().find("Cycle detected"), std::string::npos)
+      << result.error().message();
+  EXPECT_TRUE(log.Events().empty());
+}
+
+TEST(RunSetupParallelTest, CycleInOneGroupStopsAllGroups) {
+  SetupLog log;
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  FakeFeature c(log, "c");
+  a.DependsOn({&b});
+  b.DependsOn({&a});
+
+  auto result = SetupFeature::RunSetupParallel({{"0", {&c}}, {"1", {&a, &b}}});
+  ASSERT_FALSE(result.ok());
+  EXPECT_TRUE(log.Events().empty());
+}
+
+TEST(RunSetupParallelTest, RejectsDisabledDependency) {
+  SetupLog log;
+  FakeFeature a(log, "a");
+  FakeFeature b(log, "b");
+  a.Disable();
+  b.DependsOn({&a});
+
+  auto result = SetupFeature::RunSetupParallel({{"", {&a, &b}}});
+  ASSERT_FALSE(result.ok());
+  EXPECT_TRUE(log.Events().empty());
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/config/fingerprint_cache.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include "common/libs/utils/environment.h"
+
+namespace cuttlefish {
+
+FingerprintCache::FingerprintCache(const std::string& name)
+    : path_(StringFromEnv("HOME", ".") + "/.cache/cuttlefish/" + name) {
+  std::string contents;
+  if (!android::base::ReadFileToString(path_, &contents)) {
+    return;
+  }
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value root;
+  std::string errors;
+  if (!reader->parse(contents.data(), contents.data() + contents.size(),
+                     &root, &errors) ||
+      !root.isObject()) {
+    LOG(DEBUG) << "Ignoring corrupt cache \"" << path_ << "\": " << errors;
+    return;
+  }
+  for (const auto& file : root.getMemberNames()) {
+    const auto& entry = root[file];
+    if (!entry.isObject() || !entry.isMember("value")) {
+      continue;
+    }
+    Entry cached;
+    cached.fingerprint.device = entry["device"].asUInt64();
+    cached.fingerprint.inode = entry["inode"].asUInt64();
+    cached.fingerprint.size = entry["size"].asInt64();
+    cached.fingerprint.mtime_ns = entry["mtime_ns"].asInt64();
+    cached.fingerprint.ctime_ns = entry["ctime_ns"].asInt64();
+    cached.value = entry["value"];
+    entries_[file] = std::move(cached);
+  }
+}
+
+std::optional<Json::Value> FingerprintCache::Lookup(
+    const std::string& file, const FileFingerprint& fingerprint) const {
+  auto it = entries_.find(file);
+  if (it == entries_.end() || !(it->second.fingerprint == fingerprint)) {
+    return {};
+  }
+  return it->second.value;
+}
+
+void FingerprintCache::Update(const std::string& file,
+                              const FileFingerprint& fingerprint,
+                              Json::Value value) {
+  entries_[file] = Entry{fingerprint, std::move(value)};
+  dirty_ = true;
+}
+
+void FingerprintCache::Save() {
+  if (!dirty_) {
+    return;
+  }
+  Json::Value root(Json::objectValue);
+  for (const auto& [file, cached] : entries_) {
+    // Files of finished launches are often deleted, keep only entries that
+    // can still match.
+    auto current = GetFileFingerprint(file);
+    if (!current || !(*current == cached.fingerprint)) {
+      continue;
+    }
+    Json::Value entry;
+    entry["device"] = Json::UInt64(cached.fingerprint.device);
+    entry["inode"] = Json::UInt64(cached.fingerprint.inode);
+    entry["size"] = Json::Int64(cached.fingerprint.size);
+    entry["mtime_ns"] = Json::Int64(cached.fingerprint.mtime_ns);
+    entry["ctime_ns"] = Json::Int64(cached.fingerprint.ctime_ns);
+    entry["value"] = cached.value;
+    root[file] = entry;
+  }
+  auto directory = cpp_dirname(path_);
+  if (!EnsureDirectoryExists(cpp_dirname(directory)).ok() ||
+      !EnsureDirectoryExists(directory).ok()) {
+    return;
+  }
+  // Written to a temporary file first so that concurrent launches never see a
+  // partial cache.
+  std::string temp_path = path_ + ".XXXXXX";
+  android::base::unique_fd fd(mkstemp(temp_path.data()));
+  if (fd.get() < 0) {
+    PLOG(DEBUG) << "Failed to store cache \"" << path_ << "\"";
+    return;
+  }
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  auto serialized = Json::writeString(builder, root);
+  if (!android::base::WriteStringToFd(serialized, fd.get()) ||
+      rename(temp_path.c_str(), path_.c_str()) != 0) {
+    PLOG(DEBUG) << "Failed to store cache \"" << path_ << "\"";
+    unlink(temp_path.c_str());
+    return;
+  }
+  dirty_ = false;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,60 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <map>
+#include <optional>
+#include <string>
+
+#include <json/json.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+
+/**
+ * Values computed from the contents of files, persisted across invocations
+ * in ~/.cache/cuttlefish/<name> and keyed on the path and fingerprint of the
+ * file they were computed from, so that unchanged files are never read again.
+ *
+ * The cache is advisory: failures to load or store it are logged and only
+ * cost recomputing the values. Concurrent writers replace the file
+ * atomically, the last one wins.
+ */
+class FingerprintCache {
+ public:
+  explicit FingerprintCache(const std::string& name);
+
+  std::optional<Json::Value> Lookup(const std::string& file,
+                                    const FileFingerprint& fingerprint) const;
+  void Update(const std::string& file, const FileFingerprint& fingerprint,
+              Json::Value value);
+  // Writes the cache back if it was updated. Entries of files that were
+  // deleted or changed since are dropped.
+  void Save();
+
+ private:
+  struct Entry {
+    FileFingerprint fingerprint;
+    Json::Value value;
+  };
+
+  std::string path_;
+  std::map<std::string, Entry> entries_;
+  bool dirty_ = false;
+};
+
+}  // namespace cuttlefish
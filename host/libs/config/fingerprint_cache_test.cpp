@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+#include "host/libs/config/fingerprint_cache.h"
+
+namespace cuttlefish {
+namespace {
+
+TEST(FingerprintCacheTest, PersistsValuesOfUnchangedFiles) {
+  TemporaryDir home;
+  setenv("HOME", home.path, 1);
+  std::string file = std::string(home.path) + "/file";
+  ASSERT_TRUE(android::base::WriteStringToFile("contents", file));
+  auto fingerprint = GetFileFingerprint(file);
+  ASSERT_TRUE(fingerprint.has_value());
+
+  {
+    FingerprintCache cache("test.json");
+    ASSERT_FALSE(cache.Lookup(file, *fingerprint).has_value());
+    cache.Update(file, *fingerprint, Json::Value(42));
+    cache.Save();
+  }
+  ASSERT_TRUE(
+      FileExists(std::string(home.path) + "/.cache/cuttlefish/test.json"));
+
+  FingerprintCache cache("test.json");
+  auto cached = cache.Lookup(file, *fingerprint);
+  ASSERT_TRUE(cached.has_value());
+  ASSERT_EQ(cached->asInt(), 42);
+  // Other caches are kept apart.
+  ASSERT_FALSE(FingerprintCache("other.json").Lookup(file, *fingerprint));
+}
+
+TEST(FingerprintCacheTest, IgnoresChangedAndDeletedFiles) {
+  TemporaryDir home;
+  setenv("HOME", home.path, 1);
+  std::string changed = std::string(home.path) + "/changed";
+  std::string deleted = std::string(home.path) + "/deleted";
+  ASSERT_TRUE(android::base::WriteStringToFile("old", changed));
+  ASSERT_TRUE(android::base::WriteStringToFile("old", deleted));
+  auto changed_fingerprint = GetFileFingerprint(changed);
+  auto deleted_fingerprint = GetFileFingerprint(deleted);
+  ASSERT_TRUE(changed_fingerprint && deleted_fingerprint);
+
+  FingerprintCache cache("test.json");
+  cache.Update(changed, *changed_fingerprint, Json::Value("old"));
+  cache.Update(deleted, *deleted_fingerprint, Json::Value("old"));
+  ASSERT_TRUE(android::base::WriteStringToFile("new contents", changed));
+  ASSERT_EQ(unlink(deleted.c_str()), 0);
+  cache.Save();
+
+  FingerprintCache reloaded("test.json");
+  ASSERT_FALSE(reloaded.Lookup(changed, *changed_fingerprint));
+  ASSERT_FALSE(reloaded.Lookup(deleted, *deleted_fingerprint));
+  auto new_fingerprint = GetFileFingerprint(changed);
+  ASSERT_TRUE(new_fingerprint.has_value());
+  ASSERT_FALSE(reloaded.Lookup(changed, *new_fingerprint));
+}
+
+TEST(FingerprintCacheTest, IgnoresCorruptCache) {
+  TemporaryDir home;
+  setenv("HOME", home.path, 1);
+  std::string directory = std::string(home.path) + "/.cache/cuttlefish";
+  ASSERT_TRUE(EnsureDirectoryExists(std::string(home.path) + "/.cache").ok());
+  ASSERT_TRUE(EnsureDirectoryExists(directory).ok());
+  ASSERT_TRUE(
+      android::base::WriteStringToFile("{not json", directory + "/test.json"));
+  std::string file = std::string(home.path) + "/file";
+  ASSERT_TRUE(android::base::WriteStringToFile("contents", file));
+  auto fingerprint = GetFileFingerprint(file);
+  ASSERT_TRUE(fingerprint.has_value());
+
+  FingerprintCache cache("test.json");
+  ASSERT_FALSE(cache.Lookup(file, *fingerprint));
+  cache.Update(file, *fingerprint, Json::Value(true));
+  cache.Save();
+  ASSERT_TRUE(FingerprintCache("test.json").Lookup(file, *fingerprint));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -15,66 +15,160 @@
 
 #include "host/libs/config/host_tools_version.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
-#include <fstream>
-#include <future>
+#include <atomic>
+#include <optional>
+#include <thread>
 #include <vector>
 
+#include <android-base/unique_fd.h>
+#include <json/json.h>
 #include <zlib.h>
 
 #include "common/libs/utils/files.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/fingerprint_cache.h"
 
 using std::uint32_t;
 
 namespace cuttlefish {
+namespace {
 
-uint32_t FileCrc(const std::string& path) {
-  uint32_t crc = crc32(0, (unsigned char*) path.c_str(), path.size());
-  std::ifstream file_stream(path, std::ifstream::binary);
-  std::vector<char> data(1024, 0);
-  while (file_stream) {
-    file_stream.read(data.data(), data.size());
-    crc = crc32(crc, (unsigned char*) data.data(), file_stream.gcount());
+// Upper bound on the number of files hashed at the same time, beyond this
+// the disk is the bottleneck.
+constexpr unsigned kMaxHashThreads = 8;
+// zlib takes the length as a uInt.
+constexpr std::size_t kCrcChunkSize = 1 << 30;
+constexpr std::size_t kReadBufferSize = 1 << 20;
+
+uint32_t CrcBuffer(uint32_t crc, const unsigned char* data, std::size_t size) {
+  while (size > 0) {
+    auto chunk = std::min(size, kCrcChunkSize);
+    crc = crc32(crc, data, chunk);
+    data += chunk;
+    size -= chunk;
   }
   return crc;
 }
 
-static std::map<std::string, uint32_t> DirectoryCrc(const std::string& path) {
-  auto full_path = DefaultHostArtifactsPath(path);
-  if (!DirectoryExists(full_path)) {
-    return {};
+uint32_t UncachedFileCrc(const std::string& path) {
+  uint32_t crc = crc32(0, (unsigned char*) path.c_str(), path.size());
+  android::base::unique_fd fd(
+      TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (fd.get() < 0) {
+    return crc;
+  }
+  struct stat st;
+  if (fstat(fd.get(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* data =
+        mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      crc = CrcBuffer(crc, static_cast<unsigned char*>(data), st.st_size);
+      munmap(data, st.st_size);
+      return crc;
+    }
   }
-  std::vector<std::string> files = DirectoryContents(full_path);
-  for (auto it = files.begin(); it != files.end();) {
-    if (*it == "." || *it == "..") {
-      it = files.erase(it);
+  // Not mappable (e.g. a pipe or a procfs file), stream it instead.
+  std::vector<unsigned char> buffer(kReadBufferSize);
+  for (;;) {
+    auto read =
+        TEMP_FAILURE_RETRY(::read(fd.get(), buffer.data(), buffer.size()));
+    if (read <= 0) {
+      break;
+    }
+    crc = crc32(crc, buffer.data(), read);
+  }
+  return crc;
+}
+
+// Returns the checksums of the given files, only reading the ones that
+// changed since they were last seen.
+std::vector<uint32_t> CachedFileCrcs(const std::vector<std::string>& files) {
+  FingerprintCache cache("host_tools_crc.json");
+  std::vector<uint32_t> crcs(files.size());
+  std::vector<std::optional<FileFingerprint>> fingerprints(files.size());
+  std::vector<std::size_t> stale;
+  for (std::size_t i = 0; i < files.size(); i++) {
+    fingerprints[i] = GetFileFingerprint(files[i]);
+    auto cached = fingerprints[i] ? cache.Lookup(files[i], *fingerprints[i])
+                                  : std::nullopt;
+    if (cached && cached->isUInt()) {
+      crcs[i] = cached->asUInt();
     } else {
-      it++;
+      stale.push_back(i);
     }
   }
-  std::vector<std::future<uint32_t>> calculations;
-  for (auto& file : files) {
-    file = path + "/" + file; // mutate in place in files vector
-    calculations.emplace_back(
-        std::async(FileCrc, DefaultHostArtifactsPath(file)));
+  if (stale.empty()) {
+    return crcs;
   }
-  std::map<std::string, uint32_t> crcs;
-  for (int i = 0; i < files.size(); i++) {
-    crcs[files[i]] = calculations[i].get();
+
+  std::atomic<std::size_t> next = 0;
+  auto worker = [&files, &crcs, &stale, &next]() {
+    for (auto i = next++; i < stale.size(); i = next++) {
+      crcs[stale[i]] = UncachedFileCrc(files[stale[i]]);
+    }
+  };
+  unsigned num_threads = std::clamp<unsigned>(
+      std::thread::hardware_concurrency(), 1, kMaxHashThreads);
+  num_threads = std::min<std::size_t>(num_threads, stale.size());
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
   }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (auto i : stale) {
+    if (fingerprints[i]) {
+      cache.Update(files[i], *fingerprints[i], Json::UInt(crcs[i]));
+    }
+  }
+  cache.Save();
   return crcs;
 }
 
+std::vector<std::string> DirectoryFiles(const std::string& path) {
+  auto full_path = DefaultHostArtifactsPath(path);
+  if (!DirectoryExists(full_path)) {
+    return {};
+  }
+  std::vector<std::string> files;
+  for (const auto& file : DirectoryContents(full_path)) {
+    if (file != "." && file != "..") {
+      files.push_back(path + "/" + file);
+    }
+  }
+  return files;
+}
+
+}  // namespace
+
+uint32_t FileCrc(const std::string& path) {
+  return CachedFileCrcs({path})[0];
+}
+
 std::map<std::string, uint32_t> HostToolsCrc() {
-  auto bin_future = std::async(DirectoryCrc, "bin");
-  auto lib_future = std::async(DirectoryCrc, "lib64");
-  std::map<std::string, uint32_t> all_crcs;
-  for (auto const& [file, crc] : bin_future.get()) {
-    all_crcs[file] = crc;
+  auto files = DirectoryFiles("bin");
+  auto lib_files = DirectoryFiles("lib64");
+  files.insert(files.end(), lib_files.begin(), lib_files.end());
+
+  std::vector<std::string> full_paths;
+  for (const auto& file : files) {
+    full_paths.push_back(DefaultHostArtifactsPath(file));
   }
-  for (auto const& [file, crc] : lib_future.get()) {
-    all_crcs[file] = crc;
+  auto crcs = CachedFileCrcs(full_paths);
+
+  std::map<std::string, uint32_t> all_crcs;
+  for (std::size_t i = 0; i < files.size(); i++) {
+    all_crcs[files[i]] = crcs[i];
   }
   return all_crcs;
 }
@@ -0,0 +1,338 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/config/kernel_config.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+#include <android-base/unique_fd.h>
+#include <json/json.h>
+#include <lz4.h>
+#include <zlib.h>
+
+#include "common/libs/utils/files.h"
+#include "host/libs/config/fingerprint_cache.h"
+
+namespace cuttlefish {
+namespace {
+
+// CONFIG_IKCONFIG stores the gzip compressed configuration between these
+// markers, see kernel/configs.c.
+constexpr std::string_view kIkconfigStart = "IKCFG_ST";
+constexpr std::string_view kGzipMagic("\x1f\x8b\x08", 3);
+// Format produced by `lz4 -l`, used for compressed kernels.
+constexpr std::string_view kLz4LegacyMagic("\x02\x21\x4c\x18", 4);
+constexpr std::size_t kLz4LegacyBlockSize = 8 << 20;
+// Bounds the memory used by a corrupt or hostile image.
+constexpr std::size_t kMaxKernelSize = 512 << 20;
+constexpr std::size_t kMaxConfigSize = 16 << 20;
+constexpr std::size_t kInflateChunkSize = 1 << 20;
+
+std::optional<std::size_t> Find(std::string_view haystack,
+                                std::string_view needle, std::size_t from) {
+  if (from >= haystack.size()) {
+    return {};
+  }
+  auto found = memmem(haystack.data() + from, haystack.size() - from,
+                      needle.data(), needle.size());
+  if (!found) {
+    return {};
+  }
+  return static_cast<const char*>(found) - haystack.data();
+}
+
+// Called as decompressed output is produced, returns true to stop early.
+using DecompressProgress = std::function<bool(const std::string& output)>;
+
+/**
+ * Inflates the gzip stream at the start of `data`, ignoring anything after
+ * the end of the stream. Returns whether the stream was complete and valid,
+ * `output` keeps what could be decoded either way.
+ */
+bool Gunzip(std::string_view data, std::size_t max_size, std::string& output,
+            const DecompressProgress& progress = nullptr) {
+  z_stream stream{};
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  int status = Z_OK;
+  while (status == Z_OK && output.size() < max_size) {
+    if (stream.avail_in == 0) {
+      if (data.empty()) {
+        break;
+      }
+      auto chunk = std::min<std::size_t>(data.size(), UINT_MAX);
+      stream.next_in =
+          reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+      stream.avail_in = chunk;
+      data.remove_prefix(chunk);
+    }
+    auto used = output.size();
+    output.resize(std::min(max_size, used + kInflateChunkSize));
+    stream.next_out = reinterpret_cast<Bytef*>(output.data() + used);
+    stream.avail_out = output.size() - used;
+    status = inflate(&stream, Z_NO_FLUSH);
+    output.resize(output.size() - stream.avail_out);
+    if (progress && progress(output)) {
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  return status == Z_STREAM_END;
+}
+
+std::uint32_t ReadLe32(std::string_view data) {
+  auto bytes = reinterpret_cast<const unsigned char*>(data.data());
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+         (static_cast<std::uint32_t>(bytes[3]) << 24);
+}
+
+// Decodes an lz4 legacy frame: the magic number followed by blocks of up to
+// 8MB, each prefixed with its compressed size.
+bool Lz4LegacyDecompress(std::string_view data, std::size_t max_size,
+                         std::string& output,
+                         const DecompressProgress& progress) {
+  const auto max_block = LZ4_compressBound(kLz4LegacyBlockSize);
+  const auto magic = ReadLe32(kLz4LegacyMagic);
+  data.remove_prefix(kLz4LegacyMagic.size());
+  while (data.size() >= 4) {
+    auto block_size = ReadLe32(data);
+    data.remove_prefix(4);
+    if (block_size == magic) {
+      // Concatenated frames.
+      continue;
+    }
+    if (block_size > data.size() ||
+        block_size > static_cast<std::uint32_t>(max_block) ||
+        output.size() + kLz4LegacyBlockSize > max_size) {
+      // Kernels append the uncompressed size after the last block.
+      break;
+    }
+    auto used = output.size();
+    output.resize(used + kLz4LegacyBlockSize);
+    int decoded = LZ4_decompress_safe(data.data(), output.data() + used,
+                                      block_size, kLz4LegacyBlockSize);
+    if (decoded < 0) {
+      output.resize(used);
+      return false;
+    }
+    output.resize(used + decoded);
+    data.remove_prefix(block_size);
+    if (progress && progress(output)) {
+      break;
+    }
+  }
+  return !output.empty();
+}
+
+// Looks for the configuration stored uncompressed in `image`.
+std::optional<std::string> FindIkconfig(std::string_view image) {
+  for (auto start = Find(image, kIkconfigStart, 0); start;
+       start = Find(image, kIkconfigStart, *start + 1)) {
+    auto payload = image.substr(*start + kIkconfigStart.size());
+    if (payload.substr(0, kGzipMagic.size()) != kGzipMagic) {
+      continue;
+    }
+    std::string config;
+    if (Gunzip(payload, kMaxConfigSize, config)) {
+      return config;
+    }
+  }
+  return {};
+}
+
+// Looks for the configuration inside compressed payloads of `image`, such as
+// the kernel in a bzImage or a compressed arm64 Image. Each payload is only
+// decompressed until the configuration shows up in it.
+std::optional<std::string> FindCompressedIkconfig(std::string_view image) {
+  using Decompressor = bool (*)(std::string_view, std::size_t, std::string&,
+                                const DecompressProgress&);
+  const std::pair<std::string_view, Decompressor> formats[] = {
+      {kGzipMagic, Gunzip},
+      {kLz4LegacyMagic, Lz4LegacyDecompress},
+  };
+  for (const auto& [magic, decompress] : formats) {
+    for (auto start = Find(image, magic, 0); start;
+         start = Find(image, magic, *start + 1)) {
+      std::optional<std::string> config;
+      // Output already searched for a configuration marker.
+      std::size_t searched = 0;
+      auto find_config = [&config, &searched](const std::string& kernel) {
+        // A configuration is only complete once its whole gzip stream was
+        // decompressed. The first marker that may still be waiting for more
+        // output is searched again after the next chunk.
+        std::optional<std::size_t> incomplete;
+        for (auto marker = Find(kernel, kIkconfigStart, searched); marker;
+             marker = Find(kernel, kIkconfigStart, *marker + 1)) {
+          auto payload = std::string_view(kernel).substr(
+              *marker + kIkconfigStart.size());
+          if (payload.substr(0, kGzipMagic.size()) != kGzipMagic) {
+            continue;
+          }
+          std::string candidate;
+          if (Gunzip(payload, kMaxConfigSize, candidate)) {
+            config = std::move(candidate);
+            return true;
+          }
+          if (!incomplete && payload.size() <= kMaxConfigSize) {
+            incomplete = marker;
+          }
+        }
+        if (incomplete) {
+          searched = *incomplete;
+        } else if (kernel.size() >= kIkconfigStart.size()) {
+          searched = kernel.size() - kIkconfigStart.size() + 1;
+        }
+        return false;
+      };
+      // A truncated or corrupt stream may still hold the configuration in
+      // the part that could be decoded.
+      std::string kernel;
+      decompress(image.substr(*start), kMaxKernelSize, kernel, find_config);
+      if (config || find_config(kernel)) {
+        return config;
+      }
+    }
+  }
+  return {};
+}
+
+std::string ArchName(Arch arch) {
+  switch (arch) {
+    case Arch::Arm:
+      return "arm";
+    case Arch::Arm64:
+      return "arm64";
+    case Arch::X86:
+      return "x86";
+    case Arch::X86_64:
+      return "x86_64";
+  }
+  return "";
+}
+
+std::optional<Arch> ArchFromName(const std::string& name) {
+  for (auto arch : {Arch::Arm, Arch::Arm64, Arch::X86, Arch::X86_64}) {
+    if (ArchName(arch) == name) {
+      return arch;
+    }
+  }
+  return {};
+}
+
+Json::Value KernelConfigToJson(const KernelConfig& config) {
+  Json::Value json;
+  json["target_arch"] = ArchName(config.target_arch);
+  json["bootconfig_supported"] = config.bootconfig_supported;
+  return json;
+}
+
+std::optional<KernelConfig> KernelConfigFromJson(const Json::Value& json) {
+  if (!json.isObject()) {
+    return {};
+  }
+  auto arch = ArchFromName(json["target_arch"].asString());
+  if (!arch) {
+    return {};
+  }
+  KernelConfig config;
+  config.target_arch = *arch;
+  config.bootconfig_supported = json["bootconfig_supported"].asBool();
+  return config;
+}
+
+}  // namespace
+
+Result<std::string> ExtractIkconfig(const char* image, std::size_t size) {
+  std::string_view image_view(image, size);
+  if (auto config = FindIkconfig(image_view); config) {
+    return *config;
+  }
+  if (auto config = FindCompressedIkconfig(image_view); config) {
+    return *config;
+  }
+  return CF_ERR("No embedded kernel configuration found");
+}
+
+Result<std::string> ExtractIkconfigFromFile(const std::string& image_path) {
+  android::base::unique_fd fd(
+      TEMP_FAILURE_RETRY(open(image_path.c_str(), O_RDONLY | O_CLOEXEC)));
+  CF_EXPECT(fd.get() >= 0,
+            "Failed to open \"" << image_path << "\": " << strerror(errno));
+  struct stat st;
+  CF_EXPECT(fstat(fd.get(), &st) == 0,
+            "Failed to stat \"" << image_path << "\": " << strerror(errno));
+  CF_EXPECT(S_ISREG(st.st_mode) && st.st_size > 0,
+            "\"" << image_path << "\" is not a kernel image");
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  CF_EXPECT(data != MAP_FAILED,
+            "Failed to map \"" << image_path << "\": " << strerror(errno));
+  auto config = ExtractIkconfig(static_cast<const char*>(data), st.st_size);
+  munmap(data, st.st_size);
+  return CF_EXPECT(std::move(config), "In \"" << image_path << "\"");
+}
+
+Result<KernelConfig> ParseKernelConfig(const std::string& config) {
+  // Options are matched at the start of a line so that comments such as
+  // "# CONFIG_ARM is not set" are skipped.
+  auto lines = "\n" + config;
+  auto has_option = [&lines](const std::string& option) {
+    return lines.find("\n" + option + "=y") != std::string::npos;
+  };
+  KernelConfig kernel_config;
+  if (has_option("CONFIG_ARM")) {
+    kernel_config.target_arch = Arch::Arm;
+  } else if (has_option("CONFIG_ARM64")) {
+    kernel_config.target_arch = Arch::Arm64;
+  } else if (has_option("CONFIG_X86_64")) {
+    kernel_config.target_arch = Arch::X86_64;
+  } else if (has_option("CONFIG_X86")) {
+    kernel_config.target_arch = Arch::X86;
+  } else {
+    return CF_ERR("Unknown target architecture");
+  }
+  kernel_config.bootconfig_supported = has_option("CONFIG_BOOT_CONFIG");
+  return kernel_config;
+}
+
+Result<KernelConfig> ReadKernelConfigFromImage(const std::string& image_path) {
+  auto image = AbsolutePath(image_path);
+  auto fingerprint = GetFileFingerprint(image);
+  CF_EXPECT(fingerprint.has_value(),
+            "Failed to stat \"" << image << "\": " << strerror(errno));
+  FingerprintCache cache("kernel_config.json");
+  if (auto cached = cache.Lookup(image, *fingerprint); cached) {
+    if (auto config = KernelConfigFromJson(*cached); config) {
+      return *config;
+    }
+  }
+  auto config = CF_EXPECT(ExtractIkconfigFromFile(image));
+  auto kernel_config = CF_EXPECT(ParseKernelConfig(config));
+  cache.Update(image, *fingerprint, KernelConfigToJson(kernel_config));
+  cache.Save();
+  return kernel_config;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,49 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+struct KernelConfig {
+  Arch target_arch;
+  bool bootconfig_supported;
+};
+
+/**
+ * Returns the kernel build configuration embedded with CONFIG_IKCONFIG in a
+ * kernel image, or in a boot image containing one. The configuration is found
+ * either directly in the image or in a gzip or lz4 compressed kernel payload.
+ */
+Result<std::string> ExtractIkconfig(const char* image, std::size_t size);
+Result<std::string> ExtractIkconfigFromFile(const std::string& image_path);
+
+Result<KernelConfig> ParseKernelConfig(const std::string& config);
+
+/**
+ * Extracts and parses the configuration of the kernel in `image_path`. The
+ * result is kept in a cache in the user's home directory, keyed on the
+ * identity of the image file, so relaunching with the same image does not
+ * read it again.
+ */
+Result<KernelConfig> ReadKernelConfigFromImage(const std::string& image_path);
+
+}  // namespace cuttlefish
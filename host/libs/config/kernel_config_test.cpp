@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <lz4.h>
+#include <zlib.h>
+
+#include "common/libs/utils/files.h"
+#include "host/libs/config/kernel_config.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kArm64Config[] =
+    "#\n"
+    "# Automatically generated file; DO NOT EDIT.\n"
+    "#\n"
+    "# CONFIG_ARM is not set\n"
+    "CONFIG_ARM64=y\n"
+    "CONFIG_BOOT_CONFIG=y\n";
+constexpr char kX86Config[] =
+    "#\n"
+    "# Automatically generated file; DO NOT EDIT.\n"
+    "#\n"
+    "CONFIG_X86_64=y\n"
+    "CONFIG_X86=y\n"
+    "# CONFIG_BOOT_CONFIG is not set\n";
+
+std::string Gzip(const std::string& data) {
+  z_stream stream{};
+  EXPECT_EQ(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED,
+                         16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY),
+            Z_OK);
+  std::string output(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(output.data());
+  stream.avail_out = output.size();
+  EXPECT_EQ(deflate(&stream, Z_FINISH), Z_STREAM_END);
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+  return output;
+}
+
+std::string Le32(std::uint32_t value) {
+  std::string bytes(4, '\0');
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+  return bytes;
+}
+
+// Same layout as `lz4 -l`, one block is enough for the test kernels.
+std::string Lz4Legacy(const std::string& data) {
+  std::string block(LZ4_compressBound(data.size()), '\0');
+  int size = LZ4_compress_default(data.data(), block.data(), data.size(),
+                                  block.size());
+  EXPECT_GT(size, 0);
+  block.resize(size);
+  return Le32(0x184c2102) + Le32(size) + block + Le32(data.size());
+}
+
+// Resembles the layout of a kernel built with CONFIG_IKCONFIG: code and data
+// around the compressed configuration.
+std::string Kernel(const std::string& config) {
+  std::string text;
+  for (int i = 0; i < 4096; i++) {
+    text += "kernel text " + std::to_string(i * 7919) + "\n";
+  }
+  // Stray gzip magic and a decoy marker that do not start a configuration.
+  text += std::string("\x1f\x8b\x08garbage", 10) + "IKCFG_STnot gzip";
+  return text + "IKCFG_ST" + Gzip(config) + "IKCFG_ED" + text;
+}
+
+std::string Extract(const std::string& image) {
+  auto config = ExtractIkconfig(image.data(), image.size());
+  EXPECT_TRUE(config.ok()) << config.error();
+  return config.ok() ? *config : "";
+}
+
+TEST(KernelConfigTest, UncompressedKernel) {
+  ASSERT_EQ(Extract(Kernel(kArm64Config)), kArm64Config);
+}
+
+TEST(KernelConfigTest, UncompressedKernelInBootImage) {
+  std::string boot_image = "ANDROID!" + std::string(4088, '\0') +
+                           Kernel(kArm64Config) + std::string(8192, 'r');
+  ASSERT_EQ(Extract(boot_image), kArm64Config);
+}
+
+TEST(KernelConfigTest, GzipKernel) {
+  std::string image = std::string(512, 'h') + Gzip(Kernel(kX86Config));
+  ASSERT_EQ(Extract(image), kX86Config);
+}
+
+TEST(KernelConfigTest, GzipKernelConfigAcrossChunks) {
+  // The kernel is decompressed in 1MB chunks, the marker or the compressed
+  // configuration straddling a chunk boundary must still be found.
+  for (std::size_t prefix : {(1u << 20) - 4, (1u << 20) - 13}) {
+    std::string kernel = std::string(prefix, 'k') + "IKCFG_ST" +
+                         Gzip(kArm64Config) + "IKCFG_ED" +
+                         std::string(2 << 20, 'k');
+    ASSERT_EQ(Extract(Gzip(kernel)), kArm64Config) << prefix;
+  }
+}
+
+TEST(KernelConfigTest, Lz4Kernel) {
+  std::string image = std::string(512, 'h') + Lz4Legacy(Kernel(kX86Config));
+  ASSERT_EQ(Extract(image), kX86Config);
+}
+
+TEST(KernelConfigTest, NoConfig) {
+  std::string image = Gzip(std::string(65536, 'k')) + "IKCFG_ST";
+  ASSERT_FALSE(ExtractIkconfig(image.data(), image.size()).ok());
+}
+
+TEST(KernelConfigTest, Parse) {
+  auto arm64 = ParseKernelConfig(kArm64Config);
+  ASSERT_TRUE(arm64.ok()) << arm64.error();
+  ASSERT_EQ(arm64->target_arch, Arch::Arm64);
+  ASSERT_TRUE(arm64->bootconfig_supported);
+
+  auto x86 = ParseKernelConfig(kX86Config);
+  ASSERT_TRUE(x86.ok()) << x86.error();
+  ASSERT_EQ(x86->target_arch, Arch::X86_64);
+  ASSERT_FALSE(x86->bootconfig_supported);
+
+  ASSERT_FALSE(ParseKernelConfig("# CONFIG_ARM64 is not set\n").ok());
+}
+
+TEST(KernelConfigTest, CacheFollowsImageChanges) {
+  TemporaryDir home;
+  setenv("HOME", home.path, 1);
+  std::string image = std::string(home.path) + "/kernel";
+
+  ASSERT_TRUE(android::base::WriteStringToFile(Kernel(kArm64Config), image));
+  auto config = ReadKernelConfigFromImage(image);
+  ASSERT_TRUE(config.ok()) << config.error();
+  ASSERT_EQ(config->target_arch, Arch::Arm64);
+  ASSERT_TRUE(FileExists(std::string(home.path) +
+                         "/.cache/cuttlefish/kernel_config.json"));
+
+  config = ReadKernelConfigFromImage(image);
+  ASSERT_TRUE(config.ok()) << config.error();
+  ASSERT_EQ(config->target_arch, Arch::Arm64);
+
+  ASSERT_TRUE(android::base::WriteStringToFile(Kernel(kX86Config), image));
+  config = ReadKernelConfigFromImage(image);
+  ASSERT_TRUE(config.ok()) << config.error();
+  ASSERT_EQ(config->target_arch, Arch::X86_64);
+  ASSERT_FALSE(config->bootconfig_supported);
+}
+
+}  // namespace
+}  // namespace cuttlefish
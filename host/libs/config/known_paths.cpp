@@ -32,10 +32,22 @@ std::string ConsoleForwarderBinary() {
   return HostBinaryPath("console_forwarder");
 }
 
+std::string DeviceControlBinary() {
+  return HostBinaryPath("device_control");
+}
+
+std::string FakeGuestBinary() {
+  return HostBinaryPath("fake_guest");
+}
+
 std::string GnssGrpcProxyBinary() {
   return HostBinaryPath("gnss_grpc_proxy");
 }
 
+std::string HostDaemonsBinary() {
+  return HostBinaryPath("host_daemons");
+}
+
 std::string KernelLogMonitorBinary() {
   return HostBinaryPath("kernel_log_monitor");
 }
@@ -81,6 +93,8 @@ std::string WebRtcSigServerProxyBinary() {
   return HostBinaryPath("operator_proxy");
 }
 
+std::string WifiApBinary() { return HostBinaryPath("wifi_ap"); }
+
 std::string WmediumdBinary() { return HostBinaryPath("wmediumd"); }
 
 std::string WmediumdGenConfigBinary() {
@@ -22,7 +22,10 @@ namespace cuttlefish {
 std::string AdbConnectorBinary();
 std::string ConfigServerBinary();
 std::string ConsoleForwarderBinary();
+std::string DeviceControlBinary();
+std::string FakeGuestBinary();
 std::string GnssGrpcProxyBinary();
+std::string HostDaemonsBinary();
 std::string KernelLogMonitorBinary();
 std::string LogcatReceiverBinary();
 std::string MetricsBinary();
@@ -34,6 +37,7 @@ std::string VehicleHalGrpcServerBinary();
 std::string WebRtcBinary();
 std::string WebRtcSigServerBinary();
 std::string WebRtcSigServerProxyBinary();
+std::string WifiApBinary();
 std::string WmediumdBinary();
 std::string WmediumdGenConfigBinary();
 
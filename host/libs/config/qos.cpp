@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/config/qos.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parsedouble.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kInteractive[] = "interactive";
+constexpr char kCi[] = "ci";
+constexpr char kBackground[] = "background";
+
+// Controllers used by QosLimits.
+const std::vector<std::string> kControllers = {"cpu", "io", "memory"};
+
+// Where the cgroup v2 hierarchy is mounted.
+constexpr char kCgroupMount[] = "/sys/fs/cgroup";
+
+// Room for the VMM itself and the host daemons of the instance.
+constexpr int kHostOverheadMb = 1024;
+constexpr int kCpuPeriodUs = 100000;
+
+Result<void> WriteCgroupFile(const std::string& path,
+                             const std::string& value) {
+  // Interface files always exist, creating one means the path is wrong.
+  auto fd = SharedFD::Open(path, O_WRONLY | O_CLOEXEC);
+  CF_EXPECT(fd->IsOpen(), "Could not open \"" << path << "\": "
+                                              << fd->StrError());
+  CF_EXPECT(WriteAll(fd, value) == static_cast<ssize_t>(value.size()),
+            "Could not write \"" << value << "\" to \"" << path
+                                 << "\": " << fd->StrError());
+  return {};
+}
+
+Result<std::string> ReadCgroupFile(const std::string& path) {
+  std::string contents;
+  CF_EXPECT(android::base::ReadFileToString(path, &contents),
+            "Could not read \"" << path << "\": " << strerror(errno));
+  return contents;
+}
+
+Result<PressureStats> ParsePressureLine(const std::string& line) {
+  PressureStats stats;
+  auto fields = android::base::Split(line, " ");
+  for (std::size_t i = 1; i < fields.size(); i++) {
+    auto key_value = android::base::Split(fields[i], "=");
+    CF_EXPECT(key_value.size() == 2, "Malformed pressure field: " << fields[i]);
+    const auto& key = key_value[0];
+    const auto& value = key_value[1];
+    if (key == "avg10") {
+      CF_EXPECT(android::base::ParseDouble(value, &stats.avg10));
+    } else if (key == "avg60") {
+      CF_EXPECT(android::base::ParseDouble(value, &stats.avg60));
+    } else if (key == "avg300") {
+      CF_EXPECT(android::base::ParseDouble(value, &stats.avg300));
+    } else if (key == "total") {
+      CF_EXPECT(android::base::ParseUint(value, &stats.total_us));
+    }
+  }
+  return stats;
+}
+
+Result<ResourcePressure> ReadPressure(const std::string& cgroup,
+                                      const std::string& resource) {
+  auto path = cgroup + "/" + resource + ".pressure";
+  CF_EXPECT(FileExists(path),
+            "No pressure information at \""
+                << path << "\", the kernel needs CONFIG_PSI and psi=1");
+  return CF_EXPECT(ParsePressure(CF_EXPECT(ReadCgroupFile(path))),
+                   "Failed to parse \"" << path << "\"");
+}
+
+// Writing to cgroup.procs is what moving processes in or out takes.
+bool CanMoveProcesses(const std::string& cgroup) {
+  return access((cgroup + "/cgroup.procs").c_str(), W_OK) == 0;
+}
+
+bool IsCgroup(const std::string& path) {
+  return FileExists(path + "/cgroup.procs");
+}
+
+bool Contains(const std::string& ancestor, const std::string& path) {
+  return path == ancestor || android::base::StartsWith(path, ancestor + "/");
+}
+
+}  // namespace
+
+Result<QosTier> ParseQosTier(const std::string& name) {
+  if (name == kInteractive) {
+    return QosTier::kInteractive;
+  } else if (name == kCi) {
+    return QosTier::kCi;
+  } else if (name == kBackground) {
+    return QosTier::kBackground;
+  }
+  return CF_ERR("Unknown QoS tier \"" << name << "\", expected one of "
+                                      << kInteractive << ", " << kCi << ", "
+                                      << kBackground);
+}
+
+std::string QosTierName(QosTier tier) {
+  switch (tier) {
+    case QosTier::kInteractive:
+      return kInteractive;
+    case QosTier::kCi:
+      return kCi;
+    case QosTier::kBackground:
+      return kBackground;
+  }
+}
+
+QosLimits QosLimitsForTier(QosTier tier, int cpus, int memory_mb) {
+  QosLimits limits;
+  switch (tier) {
+    case QosTier::kInteractive:
+      // Wins any contention against the other tiers, without capping what
+      // the lower tiers may use while it is idle.
+      limits.cpu_weight = "1000";
+      limits.cpu_max = "max";
+      limits.io_weight = "default 1000";
+      limits.memory_high = "max";
+      break;
+    case QosTier::kCi:
+      // The kernel defaults.
+      limits.cpu_weight = "100";
+      limits.cpu_max = "max";
+      limits.io_weight = "default 100";
+      limits.memory_high = "max";
+      break;
+    case QosTier::kBackground:
+      // Half of the vCPUs at most, and memory beyond the guest memory is
+      // reclaimed before that of the other tiers.
+      limits.cpu_weight = "10";
+      limits.cpu_max = std::to_string(std::max(cpus, 1) * kCpuPeriodUs / 2) +
+                       " " + std::to_string(kCpuPeriodUs);
+      limits.io_weight = "default 10";
+      limits.memory_high = "max";
+      if (memory_mb > 0) {
+        limits.memory_high = std::to_string(
+            static_cast<std::uint64_t>(memory_mb + kHostOverheadMb) << 20);
+      }
+      break;
+  }
+  return limits;
+}
+
+Result<ResourcePressure> ParsePressure(const std::string& contents) {
+  ResourcePressure pressure;
+  for (const auto& line : android::base::Split(contents, "\n")) {
+    if (android::base::StartsWith(line, "some ")) {
+      pressure.some = CF_EXPECT(ParsePressureLine(line));
+    } else if (android::base::StartsWith(line, "full ")) {
+      pressure.full = CF_EXPECT(ParsePressureLine(line));
+    } else if (!line.empty()) {
+      return CF_ERR("Unexpected pressure line: " << line);
+    }
+  }
+  return pressure;
+}
+
+InstanceCgroup::InstanceCgroup(std::string path) : path_(std::move(path)) {}
+
+Result<InstanceCgroup> InstanceCgroup::Create(const std::string& path) {
+  auto root = android::base::Dirname(path);
+  if (!DirectoryExists(root) && IsCgroup(android::base::Dirname(root))) {
+    CF_EXPECT(mkdir(root.c_str(), 0755) == 0 || errno == EEXIST,
+              "Could not create \"" << root << "\": " << strerror(errno));
+  }
+  CF_EXPECT(DirectoryExists(root),
+            "The QoS cgroup root \""
+                << root << "\" does not exist. It needs to be created in the "
+                << "cgroup v2 hierarchy and made writable by this user");
+
+  auto controllers = CF_EXPECT(ReadCgroupFile(root + "/cgroup.controllers"));
+  auto available = android::base::Split(android::base::Trim(controllers), " ");
+  for (const auto& controller : kControllers) {
+    if (std::find(available.begin(), available.end(), controller) ==
+        available.end()) {
+      LOG(WARNING) << "The " << controller
+                   << " controller is not available in \"" << root
+                   << "\", its QoS limits are ignored";
+      continue;
+    }
+    auto enabled =
+        WriteCgroupFile(root + "/cgroup.subtree_control", "+" + controller);
+    if (!enabled.ok()) {
+      LOG(WARNING) << "Could not enable the " << controller
+                   << " controller: " << enabled.error();
+    }
+  }
+
+  if (mkdir(path.c_str(), 0755) != 0) {
+    CF_EXPECT(errno == EEXIST,
+              "Could not create \"" << path << "\": " << strerror(errno));
+  }
+  return InstanceCgroup(path);
+}
+
+Result<InstanceCgroup> InstanceCgroup::Open(const std::string& path) {
+  CF_EXPECT(FileExists(path + "/cgroup.procs"),
+            "\"" << path << "\" is not a cgroup");
+  return InstanceCgroup(path);
+}
+
+Result<void> InstanceCgroup::Apply(const QosLimits& limits) const {
+  std::vector<std::pair<std::string, std::string>> files = {
+      {"cpu.weight", limits.cpu_weight},
+      {"cpu.max", limits.cpu_max},
+      {"io.weight", limits.io_weight},
+      {"memory.high", limits.memory_high},
+  };
+  for (const auto& [name, value] : files) {
+    auto file = path_ + "/" + name;
+    if (!FileExists(file)) {
+      LOG(WARNING) << "\"" << file << "\" does not exist, skipping it";
+      continue;
+    }
+    CF_EXPECT(WriteCgroupFile(file, value));
+  }
+  return {};
+}
+
+Result<void> InstanceCgroup::AddCurrentProcess() const {
+  // Writing 0 moves the writing process.
+  CF_EXPECT(WriteCgroupFile(path_ + "/cgroup.procs", "0"));
+  return {};
+}
+
+Result<std::optional<QosTier>> InstanceCgroup::Tier() const {
+  // Apply skips the files of controllers that aren't enabled, so the tier is
+  // recognized by whichever weight was written.
+  using QosLimitsField = std::string QosLimits::*;
+  const std::pair<std::string, QosLimitsField> weights[] = {
+      {"cpu.weight", &QosLimits::cpu_weight},
+      {"io.weight", &QosLimits::io_weight},
+  };
+  for (const auto& [name, field] : weights) {
+    auto file = path_ + "/" + name;
+    if (!FileExists(file)) {
+      continue;
+    }
+    auto weight = android::base::Trim(CF_EXPECT(ReadCgroupFile(file)));
+    for (auto tier :
+         {QosTier::kInteractive, QosTier::kCi, QosTier::kBackground}) {
+      if (QosLimitsForTier(tier, 1, 0).*field == weight) {
+        return tier;
+      }
+    }
+    return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+Result<QosPressure> InstanceCgroup::Pressure() const {
+  QosPressure pressure;
+  pressure.cpu = CF_EXPECT(ReadPressure(path_, "cpu"));
+  pressure.memory = CF_EXPECT(ReadPressure(path_, "memory"));
+  pressure.io = CF_EXPECT(ReadPressure(path_, "io"));
+  return pressure;
+}
+
+Result<void> RemoveCgroup(const std::string& path) {
+  if (rmdir(path.c_str()) != 0) {
+    CF_EXPECT(errno == ENOENT,
+              "Could not remove \"" << path << "\": " << strerror(errno));
+  }
+  return {};
+}
+
+Result<std::string> CurrentCgroup() {
+  auto contents = CF_EXPECT(ReadCgroupFile("/proc/self/cgroup"));
+  for (const auto& line : android::base::Split(contents, "\n")) {
+    // The cgroup v2 entry has hierarchy ID 0 and no controller list.
+    if (android::base::StartsWith(line, "0::")) {
+      auto path = line.substr(3);
+      return path == "/" ? std::string(kCgroupMount) : kCgroupMount + path;
+    }
+  }
+  return CF_ERR("This process is not in a cgroup v2 hierarchy");
+}
+
+Result<std::string> DelegatedCgroup(const std::string& cgroup) {
+  CF_EXPECT(CanMoveProcesses(cgroup),
+            "The cgroup \""
+                << cgroup << "\" was not delegated to this user. Run it "
+                << "through `systemd-run --user --scope` or pass a cgroup "
+                << "writable by this user");
+  auto delegated = cgroup;
+  while (delegated != "/") {
+    auto parent = android::base::Dirname(delegated);
+    if (!IsCgroup(parent) || !CanMoveProcesses(parent)) {
+      break;
+    }
+    delegated = parent;
+  }
+  return delegated;
+}
+
+Result<void> CheckCgroupMove(const std::string& from, const std::string& root) {
+  auto ancestor = root;
+  while (!Contains(ancestor, from)) {
+    CF_EXPECT(ancestor != "/" && ancestor != ".",
+              "\"" << root << "\" is not in the same hierarchy as \"" << from
+                   << "\"");
+    ancestor = android::base::Dirname(ancestor);
+  }
+  CF_EXPECT(IsCgroup(ancestor) && CanMoveProcesses(ancestor),
+            "Moving processes from \""
+                << from << "\" to \"" << root << "\" needs write access to \""
+                << ancestor << "/cgroup.procs\". Pick a QoS cgroup root in a "
+                << "subtree delegated to this user, and launch from inside it");
+  return {};
+}
+
+}  // namespace cuttlefish
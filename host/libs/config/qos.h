@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// How an instance competes for host resources with the other instances in
+// the same cgroup root.
+enum class QosTier {
+  // Devices streamed to a user, which should never stutter.
+  kInteractive,
+  // Devices driven by automated tests.
+  kCi,
+  // Devices nobody is waiting on, only using otherwise idle resources.
+  kBackground,
+};
+
+Result<QosTier> ParseQosTier(const std::string& name);
+std::string QosTierName(QosTier tier);
+
+// cgroup v2 interface file values, see
+// https://docs.kernel.org/admin-guide/cgroup-v2.html
+struct QosLimits {
+  std::string cpu_weight;
+  std::string cpu_max;
+  std::string io_weight;
+  std::string memory_high;
+};
+
+// Limits for an instance with `cpus` vCPUs and `memory_mb` of guest memory.
+QosLimits QosLimitsForTier(QosTier tier, int cpus, int memory_mb);
+
+// Pressure stall information of one resource, as in /proc/pressure.
+struct PressureStats {
+  double avg10 = 0;
+  double avg60 = 0;
+  double avg300 = 0;
+  std::uint64_t total_us = 0;
+};
+
+struct ResourcePressure {
+  // Share of time at least one task was stalled on the resource.
+  PressureStats some;
+  // Share of time all non-idle tasks were stalled at once.
+  PressureStats full;
+};
+
+Result<ResourcePressure> ParsePressure(const std::string& contents);
+
+struct QosPressure {
+  ResourcePressure cpu;
+  ResourcePressure memory;
+  ResourcePressure io;
+};
+
+/**
+ * The cgroup holding the host processes of one instance: the VMM and the
+ * daemons supporting it.
+ *
+ * Instance cgroups are created under a common root, which has to be in a cgroup
+ * v2 subtree writable by the user running the devices, for example one
+ * delegated by an administrator or by systemd with `Delegate=yes`. The
+ * launcher has to run in the same subtree to move itself into them, see
+ * CheckCgroupMove.
+ */
+class InstanceCgroup {
+ public:
+  // Creates the cgroup at `path` if needed, and enables the controllers the
+  // limits rely on in its parent, the root. The root is created too if its
+  // own parent is a cgroup.
+  static Result<InstanceCgroup> Create(const std::string& path);
+  // Opens the existing cgroup at `path`.
+  static Result<InstanceCgroup> Open(const std::string& path);
+
+  const std::string& path() const { return path_; }
+
+  // Controllers missing from the hierarchy are skipped with a warning, the
+  // instance then simply runs without that limit.
+  Result<void> Apply(const QosLimits& limits) const;
+
+  // Moves the calling process into the cgroup, processes started afterwards
+  // by it are placed there too.
+  Result<void> AddCurrentProcess() const;
+
+  // The tier whose limits were last applied, recognized by its CPU weight,
+  // or by its IO weight without the cpu controller. Empty when neither
+  // controller is enabled or the weight does not match any tier.
+  Result<std::optional<QosTier>> Tier() const;
+
+  Result<QosPressure> Pressure() const;
+
+ private:
+  InstanceCgroup(std::string path);
+
+  std::string path_;
+};
+
+// Removes an empty cgroup. Fails if processes are still running in it.
+Result<void> RemoveCgroup(const std::string& path);
+
+// The cgroup v2 directory the calling process runs in.
+Result<std::string> CurrentCgroup();
+
+// The top of the subtree delegated to this user that holds `cgroup`: its
+// highest ancestor whose processes this user may still move. Fails if that
+// isn't even true of `cgroup`, as for processes in a systemd login session
+// rather than under the user's own systemd instance.
+Result<std::string> DelegatedCgroup(const std::string& cgroup);
+
+// Checks that this user can move processes from the `from` cgroup into
+// cgroups created under `root`. The kernel requires write access to the
+// cgroup.procs file of the closest cgroup containing both.
+Result<void> CheckCgroupMove(const std::string& from, const std::string& root);
+
+}  // namespace cuttlefish
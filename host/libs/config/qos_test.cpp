@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+#include "host/libs/config/qos.h"
+
+namespace cuttlefish {
+namespace {
+
+TEST(QosTest, TierNames) {
+  for (auto tier :
+       {QosTier::kInteractive, QosTier::kCi, QosTier::kBackground}) {
+    auto parsed = ParseQosTier(QosTierName(tier));
+    ASSERT_TRUE(parsed.ok()) << parsed.error();
+    ASSERT_EQ(*parsed, tier);
+  }
+  ASSERT_FALSE(ParseQosTier("realtime").ok());
+}
+
+TEST(QosTest, BackgroundLimits) {
+  auto limits = QosLimitsForTier(QosTier::kBackground, 4, 2048);
+  ASSERT_EQ(limits.cpu_max, "200000 100000");
+  ASSERT_EQ(limits.memory_high, std::to_string(3072ull << 20));
+
+  ASSERT_EQ(QosLimitsForTier(QosTier::kBackground, 4, 0).memory_high, "max");
+  ASSERT_EQ(QosLimitsForTier(QosTier::kInteractive, 4, 2048).cpu_max, "max");
+}
+
+TEST(QosTest, ParsePressure) {
+  auto pressure = ParsePressure(
+      "some avg10=1.50 avg60=0.25 avg300=0.00 total=123456\n"
+      "full avg10=0.75 avg60=0.00 avg300=0.00 total=789\n");
+  ASSERT_TRUE(pressure.ok()) << pressure.error();
+  ASSERT_DOUBLE_EQ(pressure->some.avg10, 1.5);
+  ASSERT_DOUBLE_EQ(pressure->some.avg60, 0.25);
+  ASSERT_EQ(pressure->some.total_us, 123456);
+  ASSERT_DOUBLE_EQ(pressure->full.avg10, 0.75);
+  ASSERT_EQ(pressure->full.total_us, 789);
+
+  // Kernels before 5.13 have no "full" line for the cpu.
+  pressure = ParsePressure("some avg10=0.00 avg60=0.00 avg300=0.00 total=1\n");
+  ASSERT_TRUE(pressure.ok()) << pressure.error();
+  ASSERT_EQ(pressure->full.total_us, 0);
+
+  ASSERT_FALSE(ParsePressure("some avg10\n").ok());
+  ASSERT_FALSE(ParsePressure("most avg10=0.00\n").ok());
+}
+
+// Stands in for a cgroup v2 hierarchy, which tests cannot expect to be
+// delegated to them.
+class FakeCgroupTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = std::string(dir_.path) + "/root";
+    ASSERT_EQ(mkdir(root_.c_str(), 0755), 0);
+    Write(root_ + "/cgroup.controllers", "io memory\n");
+    Write(root_ + "/cgroup.subtree_control", "");
+  }
+
+  void Write(const std::string& path, const std::string& contents) {
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, path));
+  }
+
+  TemporaryDir dir_;
+  std::string root_;
+};
+
+TEST_F(FakeCgroupTest, CreateApplyAndRemove) {
+  auto cgroup = InstanceCgroup::Create(root_ + "/cvd-1");
+  ASSERT_TRUE(cgroup.ok()) << cgroup.error();
+  ASSERT_TRUE(DirectoryExists(root_ + "/cvd-1"));
+  // Only the available controllers are enabled, each with its own write.
+  ASSERT_EQ(ReadFile(root_ + "/cgroup.subtree_control"), "+memory");
+
+  for (const auto& file : {"cpu.weight", "cpu.max", "io.weight"}) {
+    Write(root_ + "/cvd-1/" + file, "");
+  }
+  auto limits = QosLimitsForTier(QosTier::kBackground, 2, 1024);
+  auto applied = cgroup->Apply(limits);
+  ASSERT_TRUE(applied.ok()) << applied.error();
+  ASSERT_EQ(ReadFile(root_ + "/cvd-1/cpu.weight"), limits.cpu_weight);
+  ASSERT_EQ(ReadFile(root_ + "/cvd-1/cpu.max"), limits.cpu_max);
+  ASSERT_EQ(ReadFile(root_ + "/cvd-1/io.weight"), limits.io_weight);
+  ASSERT_FALSE(FileExists(root_ + "/cvd-1/memory.high"));
+
+  auto tier = cgroup->Tier();
+  ASSERT_TRUE(tier.ok()) << tier.error();
+  ASSERT_EQ(*tier, QosTier::kBackground);
+
+  // Creating it again, as a restarted launcher does, is fine.
+  ASSERT_TRUE(InstanceCgroup::Create(root_ + "/cvd-1").ok());
+
+  for (const auto& file : {"cpu.weight", "cpu.max", "io.weight"}) {
+    ASSERT_EQ(unlink((root_ + "/cvd-1/" + file).c_str()), 0);
+  }
+  ASSERT_TRUE(RemoveCgroup(root_ + "/cvd-1").ok());
+  ASSERT_FALSE(DirectoryExists(root_ + "/cvd-1"));
+  ASSERT_TRUE(RemoveCgroup(root_ + "/cvd-1").ok());
+}
+
+TEST_F(FakeCgroupTest, TierWithoutCpuController) {
+  auto cgroup = InstanceCgroup::Create(root_ + "/cvd-1");
+  ASSERT_TRUE(cgroup.ok()) << cgroup.error();
+
+  // Neither weight file exists until a controller is enabled.
+  auto tier = cgroup->Tier();
+  ASSERT_TRUE(tier.ok()) << tier.error();
+  ASSERT_FALSE(tier->has_value());
+
+  Write(root_ + "/cvd-1/io.weight", "");
+  ASSERT_TRUE(cgroup->Apply(QosLimitsForTier(QosTier::kCi, 2, 1024)).ok());
+  tier = cgroup->Tier();
+  ASSERT_TRUE(tier.ok()) << tier.error();
+  ASSERT_EQ(*tier, QosTier::kCi);
+}
+
+TEST_F(FakeCgroupTest, MissingRoot) {
+  ASSERT_FALSE(InstanceCgroup::Create(root_ + "/missing/cvd-1").ok());
+  ASSERT_FALSE(InstanceCgroup::Open(root_ + "/cvd-1").ok());
+}
+
+TEST_F(FakeCgroupTest, CreatesRootInCgroup) {
+  Write(root_ + "/cgroup.procs", "");
+  // Not a cgroup yet, so the controllers can't be read.
+  ASSERT_FALSE(InstanceCgroup::Create(root_ + "/cuttlefish/cvd-1").ok());
+  ASSERT_TRUE(DirectoryExists(root_ + "/cuttlefish"));
+}
+
+TEST_F(FakeCgroupTest, DelegatedCgroup) {
+  ASSERT_EQ(mkdir((root_ + "/user").c_str(), 0755), 0);
+  ASSERT_EQ(mkdir((root_ + "/user/app").c_str(), 0755), 0);
+  Write(root_ + "/user/cgroup.procs", "");
+  Write(root_ + "/user/app/cgroup.procs", "");
+
+  // The climb stops below root_, which is no cgroup.
+  auto delegated = DelegatedCgroup(root_ + "/user/app");
+  ASSERT_TRUE(delegated.ok()) << delegated.error();
+  ASSERT_EQ(*delegated, root_ + "/user");
+  ASSERT_FALSE(DelegatedCgroup(root_).ok());
+
+  if (geteuid() == 0) {
+    GTEST_SKIP() << "root may write to any cgroup.procs";
+  }
+  Write(root_ + "/cgroup.procs", "");
+  ASSERT_EQ(chmod((root_ + "/cgroup.procs").c_str(), 0444), 0);
+  delegated = DelegatedCgroup(root_ + "/user/app");
+  ASSERT_TRUE(delegated.ok()) << delegated.error();
+  ASSERT_EQ(*delegated, root_ + "/user");
+
+  ASSERT_EQ(chmod((root_ + "/user/app/cgroup.procs").c_str(), 0444), 0);
+  ASSERT_FALSE(DelegatedCgroup(root_ + "/user/app").ok());
+}
+
+TEST_F(FakeCgroupTest, CheckCgroupMove) {
+  ASSERT_EQ(mkdir((root_ + "/user").c_str(), 0755), 0);
+  ASSERT_EQ(mkdir((root_ + "/session").c_str(), 0755), 0);
+  Write(root_ + "/cgroup.procs", "");
+  Write(root_ + "/user/cgroup.procs", "");
+  Write(root_ + "/session/cgroup.procs", "");
+
+  // The closest common ancestor is root_.
+  auto movable = CheckCgroupMove(root_ + "/session", root_ + "/user/cf");
+  ASSERT_TRUE(movable.ok()) << movable.error();
+  movable = CheckCgroupMove(root_ + "/user", root_ + "/user/cf");
+  ASSERT_TRUE(movable.ok()) << movable.error();
+  // Not even in a cgroup.
+  ASSERT_FALSE(CheckCgroupMove(root_ + "/user", dir_.path).ok());
+
+  if (geteuid() == 0) {
+    GTEST_SKIP() << "root may write to any cgroup.procs";
+  }
+  ASSERT_EQ(chmod((root_ + "/cgroup.procs").c_str(), 0444), 0);
+  ASSERT_FALSE(CheckCgroupMove(root_ + "/session", root_ + "/user/cf").ok());
+  movable = CheckCgroupMove(root_ + "/user/app", root_ + "/user/cf");
+  ASSERT_TRUE(movable.ok()) << movable.error();
+}
+
+TEST_F(FakeCgroupTest, Pressure) {
+  ASSERT_EQ(mkdir((root_ + "/cvd-1").c_str(), 0755), 0);
+  Write(root_ + "/cvd-1/cgroup.procs", "");
+  auto cgroup = InstanceCgroup::Open(root_ + "/cvd-1");
+  ASSERT_TRUE(cgroup.ok()) << cgroup.error();
+  ASSERT_FALSE(cgroup->Pressure().ok());
+
+  for (const auto& resource : {"cpu", "memory", "io"}) {
+    Write(root_ + "/cvd-1/" + resource + ".pressure",
+          "some avg10=2.00 avg60=1.00 avg300=0.50 total=42\n"
+          "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+  }
+  auto pressure = cgroup->Pressure();
+  ASSERT_TRUE(pressure.ok()) << pressure.error();
+  ASSERT_DOUBLE_EQ(pressure->memory.some.avg10, 2.0);
+  ASSERT_EQ(pressure->io.some.total_us, 42);
+}
+
+}  // namespace
+}  // namespace cuttlefish
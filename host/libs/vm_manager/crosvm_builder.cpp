@@ -89,7 +89,12 @@ void CrosvmBuilder::AddSerial(const std::string& output,
 }
 
 SharedFD CrosvmBuilder::AddTap(const std::string& tap_name) {
-  auto tap_fd = OpenTapInterface(tap_name);
+  return AddTap(tap_name, TapOptions());
+}
+
+SharedFD CrosvmBuilder::AddTap(const std::string& tap_name,
+                               const TapOptions& options) {
+  auto tap_fd = OpenTapInterface(tap_name, options);
   if (tap_fd->IsOpen()) {
     command_.AddParameter("--tap-fd=", tap_fd);
   } else {
@@ -19,6 +19,7 @@
 #include <utility>
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/network.h"
 #include "common/libs/utils/subprocess.h"
 
 namespace cuttlefish {
@@ -43,6 +44,7 @@ class CrosvmBuilder {
   void AddSerial(const std::string& output, const std::string& input);
 
   SharedFD AddTap(const std::string& tap_name);
+  SharedFD AddTap(const std::string& tap_name, const TapOptions& options);
 
   int HvcNum();
 
@@ -126,6 +126,35 @@ std::vector<Command> CrosvmManager::StartCommands(
     crosvm_cmd.Cmd().AddParameter("--vhost-net");
   }
 
+  std::vector<std::string> tap_names = {instance.mobile_tap_name(),
+                                        instance.ethernet_tap_name()};
+#ifndef ENFORCE_MAC80211_HWSIM
+  tap_names.push_back(instance.wifi_tap_name());
+#endif
+  // crosvm opens the queues beyond the first itself, which only multi queue
+  // taps allow. Missing taps are created as such when their first queue is
+  // opened. The setting applies to every network device.
+  int net_queues = config.net_queues();
+  if (net_queues > 1 && config.vhost_net()) {
+    LOG(WARNING) << "crosvm's vhost-net devices have a single queue pair";
+    net_queues = 1;
+  }
+  for (const auto& tap_name : tap_names) {
+    if (net_queues > 1 && NetworkInterfaceExists(tap_name) &&
+        !IsMultiQueueTap(tap_name)) {
+      LOG(WARNING) << tap_name << " is not a multi queue tap, using a single "
+                   << "queue pair for every network device";
+      net_queues = 1;
+    }
+  }
+  if (net_queues > 1) {
+    crosvm_cmd.Cmd().AddParameter("--net-vq-pairs=", net_queues);
+  }
+  TapOptions tap_options;
+  tap_options.offloads = config.tap_offloads();
+  tap_options.sndbuf = config.tap_sndbuf();
+  tap_options.queues = net_queues;
+
 #ifdef ENFORCE_MAC80211_HWSIM
   if (!config.vhost_user_mac80211_hwsim().empty()) {
     crosvm_cmd.Cmd().AddParameter("--vhost-user-mac80211-hwsim=",
@@ -203,13 +232,13 @@ std::vector<Command> CrosvmManager::StartCommands(
   // GPU capture can only support named files and not file descriptors due to
   // having to pass arguments to crosvm via a wrapper script.
   if (!gpu_capture_enabled) {
-    crosvm_cmd.AddTap(instance.mobile_tap_name());
-    crosvm_cmd.AddTap(instance.ethernet_tap_name());
+    crosvm_cmd.AddTap(instance.mobile_tap_name(), tap_options);
+    crosvm_cmd.AddTap(instance.ethernet_tap_name(), tap_options);
 
     // TODO(b/199103204): remove this as well when
     // PRODUCT_ENFORCE_MAC80211_HWSIM is removed
 #ifndef ENFORCE_MAC80211_HWSIM
-    wifi_tap = crosvm_cmd.AddTap(instance.wifi_tap_name());
+    wifi_tap = crosvm_cmd.AddTap(instance.wifi_tap_name(), tap_options);
 #endif
   }
 
@@ -223,6 +252,12 @@ std::vector<Command> CrosvmManager::StartCommands(
                                   instance.hwcomposer_pmem_path());
   }
 
+  // Read-only and mapped shared, so every instance reads the image through
+  // the same host page cache pages instead of caching it in guest memory.
+  if (!config.super_pmem_image().empty()) {
+    crosvm_cmd.Cmd().AddParameter("--pmem-device=", config.super_pmem_image());
+  }
+
   if (FileExists(instance.pstore_path())) {
     crosvm_cmd.Cmd().AddParameter("--pstore=path=", instance.pstore_path(),
                                   ",size=", FileSize(instance.pstore_path()));
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/vm_manager/fake_guest_manager.h"
+
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/subprocess.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/known_paths.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+
+bool FakeGuestManager::IsSupported() { return true; }
+
+std::vector<std::string> FakeGuestManager::ConfigureGraphics(
+    const CuttlefishConfig& config) {
+  // The fake guest presents frames in shared memory buffers, as the guest does
+  // when rendering with swiftshader.
+  if (config.gpu_mode() != kGpuModeGuestSwiftshader) {
+    return {};
+  }
+  return {"androidboot.hardware.hwcomposer=" + config.hwcomposer()};
+}
+
+std::string FakeGuestManager::ConfigureBootDevices(int num_disks) {
+  // Nothing reads it, but keeps the generated bootconfig well formed.
+  return ConfigureMultipleBootDevices("pci0000:00/0000:00:", 1, num_disks);
+}
+
+std::vector<Command> FakeGuestManager::StartCommands(
+    const CuttlefishConfig& config) {
+  auto stop = [](Subprocess* proc) {
+    return KillSubprocess(proc) == StopperResult::kStopSuccess
+               ? StopperResult::kStopCrash
+               : StopperResult::kStopFailure;
+  };
+  Command fake_guest(FakeGuestBinary(), stop);
+  if (!config.fake_guest_profile().empty()) {
+    fake_guest.AddParameter("--profile=", config.fake_guest_profile());
+  }
+  std::vector<Command> commands;
+  commands.emplace_back(std::move(fake_guest));
+  return commands;
+}
+
+} // namespace vm_manager
+} // namespace cuttlefish
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "host/libs/vm_manager/vm_manager.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+
+// Runs the fake_guest load generator in place of a VMM. It plays the guest
+// side of the sockets and FIFOs run_cvd sets up, so the host daemons can be
+// load tested without booting Android or needing virtualization support.
+class FakeGuestManager : public VmManager {
+ public:
+  static std::string name() { return "fake_guest"; }
+
+  virtual ~FakeGuestManager() = default;
+
+  bool IsSupported() override;
+  std::vector<std::string> ConfigureGraphics(
+      const CuttlefishConfig& config) override;
+  std::string ConfigureBootDevices(int num_disks) override;
+
+  std::vector<cuttlefish::Command> StartCommands(
+      const CuttlefishConfig& config) override;
+};
+
+} // namespace vm_manager
+} // namespace cuttlefish
@@ -24,6 +24,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <sstream>
 #include <string>
@@ -36,6 +37,7 @@
 
 #include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/files.h"
+#include "common/libs/utils/network.h"
 #include "common/libs/utils/subprocess.h"
 #include "common/libs/utils/users.h"
 #include "host/libs/config/cuttlefish_config.h"
@@ -285,6 +287,20 @@ std::vector<Command> QemuManager::StartCommands(
         << hwcomposer_pmem_size_bytes << ") not a multiple of 1MB";
   }
 
+  // memory-backend-file maps the whole file, QEMU rejects sizes that are not
+  // a multiple of the host huge page size.
+  uint64_t super_pmem_size_bytes = 0;
+  if (!config.super_pmem_image().empty()) {
+    CHECK(!is_arm) << "No pmem device to share the super image with on arm";
+    super_pmem_size_bytes = FileSize(config.super_pmem_image());
+    if ((super_pmem_size_bytes & (2 * 1024 * 1024 - 1)) != 0) {
+      LOG(WARNING) << config.super_pmem_image() << " file size ("
+                   << super_pmem_size_bytes << ") not a multiple of 2MB, "
+                   << "not sharing it with a pmem device";
+      super_pmem_size_bytes = 0;
+    }
+  }
+
   auto pstore_size_bytes = 0;
   if (FileExists(instance.pstore_path())) {
     pstore_size_bytes = FileSize(instance.pstore_path());
@@ -319,6 +335,7 @@ std::vector<Command> QemuManager::StartCommands(
   auto maxmem = config.memory_mb() +
                 (access_kregistry_size_bytes / 1024 / 1024) +
                 (hwcomposer_pmem_size_bytes / 1024 / 1024) +
+                (super_pmem_size_bytes / 1024 / 1024) +
                 (is_arm ? 0 : pstore_size_bytes / 1024 / 1024);
   auto slots = is_arm ? "" : ",slots=2";
   qemu_cmd.AddParameter("size=", config.memory_mb(), "M",
@@ -507,6 +524,16 @@ std::vector<Command> QemuManager::StartCommands(
       qemu_cmd.AddParameter(
           "virtio-pmem-pci,disable-legacy=on,memdev=objpmem2,id=pmem1");
     }
+    if (super_pmem_size_bytes > 0) {
+      qemu_cmd.AddParameter("-object");
+      qemu_cmd.AddParameter(
+          "memory-backend-file,id=objpmem3,share=on,readonly=on,mem-path=",
+          config.super_pmem_image(), ",size=", super_pmem_size_bytes);
+
+      qemu_cmd.AddParameter("-device");
+      qemu_cmd.AddParameter(
+          "virtio-pmem-pci,disable-legacy=on,memdev=objpmem3,id=pmem2");
+    }
   }
 
   qemu_cmd.AddParameter("-object");
@@ -526,30 +553,56 @@ std::vector<Command> QemuManager::StartCommands(
   qemu_cmd.AddParameter("-device");
   qemu_cmd.AddParameter("virtio-keyboard-pci,disable-legacy=on");
 
-  auto vhost_net = config.vhost_net() ? ",vhost=on" : "";
-
   qemu_cmd.AddParameter("-device");
   qemu_cmd.AddParameter("virtio-balloon-pci-non-transitional,id=balloon0");
 
-  qemu_cmd.AddParameter("-netdev");
-  qemu_cmd.AddParameter("tap,id=hostnet0,ifname=", instance.mobile_tap_name(),
-                        ",script=no,downscript=no", vhost_net);
-
-  qemu_cmd.AddParameter("-device");
-  qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet0,id=net0");
-
-  qemu_cmd.AddParameter("-netdev");
-  qemu_cmd.AddParameter("tap,id=hostnet1,ifname=", instance.ethernet_tap_name(),
-                        ",script=no,downscript=no", vhost_net);
+  auto add_net = [&config, &qemu_cmd](const std::string& tap_name, int index) {
+    // Queues beyond one per vCPU have no vCPU to process them.
+    int queues = std::max(std::min(config.net_queues(), config.cpus()), 1);
+    // qemu opens taps created as multi queue only when asked for several
+    // queues, and the others only with one. Missing taps are created the way
+    // qemu opens them. A multi queue tap serving a single queue pair is
+    // opened with two queues, of which the guest only ever enables the first.
+    int tap_queues = queues;
+    if (IsMultiQueueTap(tap_name)) {
+      tap_queues = std::max(queues, 2);
+    } else if (NetworkInterfaceExists(tap_name) && queues > 1) {
+      LOG(WARNING) << tap_name << " is not a multi queue tap, using a single "
+                   << "queue pair";
+      queues = tap_queues = 1;
+    }
+    std::string netdev_options = ",script=no,downscript=no";
+    if (config.vhost_net()) {
+      netdev_options += ",vhost=on";
+    }
+    if (config.tap_sndbuf() > 0) {
+      netdev_options += ",sndbuf=" + std::to_string(config.tap_sndbuf());
+    }
+    if (tap_queues > 1) {
+      netdev_options += ",queues=" + std::to_string(tap_queues);
+    }
+    std::string device_options;
+    if (queues > 1) {
+      // A vector for each queue of every pair, plus configuration and control.
+      device_options += ",mq=on,vectors=" + std::to_string(2 * queues + 2);
+    }
+    if (!config.tap_offloads()) {
+      device_options +=
+          ",guest_csum=off,guest_tso4=off,guest_tso6=off,guest_ecn=off,"
+          "guest_ufo=off";
+    }
+    qemu_cmd.AddParameter("-netdev");
+    qemu_cmd.AddParameter("tap,id=hostnet", index, ",ifname=", tap_name,
+                          netdev_options);
+    qemu_cmd.AddParameter("-device");
+    qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet",
+                          index, ",id=net", index, device_options);
+  };
 
-  qemu_cmd.AddParameter("-device");
-  qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet1,id=net1");
+  add_net(instance.mobile_tap_name(), 0);
+  add_net(instance.ethernet_tap_name(), 1);
 #ifndef ENFORCE_MAC80211_HWSIM
-  qemu_cmd.AddParameter("-netdev");
-  qemu_cmd.AddParameter("tap,id=hostnet2,ifname=", instance.wifi_tap_name(),
-                        ",script=no,downscript=no", vhost_net);
-  qemu_cmd.AddParameter("-device");
-  qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet2,id=net2");
+  add_net(instance.wifi_tap_name(), 2);
 #endif
 
   qemu_cmd.AddParameter("-cpu");
@@ -24,6 +24,7 @@
 
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
+#include "host/libs/vm_manager/fake_guest_manager.h"
 #include "host/libs/vm_manager/gem5_manager.h"
 #include "host/libs/vm_manager/qemu_manager.h"
 
@@ -38,6 +39,8 @@ std::unique_ptr<VmManager> GetVmManager(const std::string& name, Arch arch) {
     vmm.reset(new Gem5Manager(arch));
   } else if (name == CrosvmManager::name()) {
     vmm.reset(new CrosvmManager());
+  } else if (name == FakeGuestManager::name()) {
+    vmm.reset(new FakeGuestManager());
   }
   if (!vmm) {
     LOG(ERROR) << "Invalid VM manager: " << name;
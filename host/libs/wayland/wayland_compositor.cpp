@@ -105,6 +105,8 @@ void surface_damage(wl_client*,
                << " y=" << y
                << " w=" << w
                << " h=" << h;
+
+  GetUserData<Surface>(surface_resource)->Damage(Surface::Region{x, y, w, h});
 }
 
 void surface_frame(wl_client*, wl_resource* surface, uint32_t) {
@@ -167,6 +169,10 @@ void surface_damage_buffer(wl_client*,
                << " y=" << y
                << " w=" << w
                << " h=" << h;
+
+  // Buffer and surface coordinates match, as neither transforms nor scales
+  // are supported.
+  GetUserData<Surface>(surface_resource)->Damage(Surface::Region{x, y, w, h});
 }
 
 const struct wl_surface_interface surface_implementation = {
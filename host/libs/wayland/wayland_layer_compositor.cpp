@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/wayland/wayland_layer_compositor.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace wayland {
+namespace {
+
+constexpr std::size_t kMaxDamageRects = 8;
+
+int32_t Saturate(int64_t value) {
+  return static_cast<int32_t>(
+      std::clamp<int64_t>(value, INT32_MIN, INT32_MAX));
+}
+
+void CopyRows(const Layer& layer, const Rect& rect, uint8_t* frame,
+              uint32_t frame_stride) {
+  const uint8_t* src = layer.pixels +
+                       (rect.y - layer.rect.y) * layer.stride_bytes +
+                       (rect.x - layer.rect.x) * 4;
+  uint8_t* dst = frame + rect.y * frame_stride + rect.x * 4;
+  for (int32_t row = 0; row < rect.h; row++) {
+    memcpy(dst, src, rect.w * 4);
+    src += layer.stride_bytes;
+    dst += frame_stride;
+  }
+}
+
+// Porter-Duff "over" with premultiplied alpha.
+void BlendRows(const Layer& layer, const Rect& rect, uint8_t* frame,
+               uint32_t frame_stride) {
+  const uint8_t* src_row = layer.pixels +
+                           (rect.y - layer.rect.y) * layer.stride_bytes +
+                           (rect.x - layer.rect.x) * 4;
+  uint8_t* dst_row = frame + rect.y * frame_stride + rect.x * 4;
+  for (int32_t row = 0; row < rect.h; row++) {
+    const uint8_t* src = src_row;
+    uint8_t* dst = dst_row;
+    for (int32_t col = 0; col < rect.w; col++, src += 4, dst += 4) {
+      const uint32_t alpha = src[3];
+      if (alpha == 0xff) {
+        memcpy(dst, src, 4);
+      } else if (alpha != 0) {
+        const uint32_t inverse = 0xff - alpha;
+        for (int channel = 0; channel < 4; channel++) {
+          dst[channel] = src[channel] + (dst[channel] * inverse + 0x7f) / 0xff;
+        }
+      }
+    }
+    src_row += layer.stride_bytes;
+    dst_row += frame_stride;
+  }
+}
+
+}  // namespace
+
+// Rectangles come from clients, edges are computed in 64 bits so that
+// rectangles reaching past the int32_t range don't wrap around.
+bool Rect::Contains(const Rect& other) const {
+  return other.x >= x && other.y >= y &&
+         int64_t{other.x} + other.w <= int64_t{x} + w &&
+         int64_t{other.y} + other.h <= int64_t{y} + h;
+}
+
+Rect Rect::Intersect(const Rect& other) const {
+  const int64_t left = std::max(x, other.x);
+  const int64_t top = std::max(y, other.y);
+  const int64_t right = std::min(int64_t{x} + w, int64_t{other.x} + other.w);
+  const int64_t bottom =
+      std::min(int64_t{y} + h, int64_t{other.y} + other.h);
+  if (right <= left || bottom <= top) {
+    return Rect{};
+  }
+  return Rect{static_cast<int32_t>(left), static_cast<int32_t>(top),
+              Saturate(right - left), Saturate(bottom - top)};
+}
+
+Rect Rect::Union(const Rect& other) const {
+  if (Empty()) {
+    return other;
+  }
+  if (other.Empty()) {
+    return *this;
+  }
+  const int64_t left = std::min(x, other.x);
+  const int64_t top = std::min(y, other.y);
+  const int64_t right = std::max(int64_t{x} + w, int64_t{other.x} + other.w);
+  const int64_t bottom =
+      std::max(int64_t{y} + h, int64_t{other.y} + other.h);
+  return Rect{static_cast<int32_t>(left), static_cast<int32_t>(top),
+              Saturate(right - left), Saturate(bottom - top)};
+}
+
+Rect Rect::Translate(int32_t dx, int32_t dy) const {
+  return Rect{Saturate(int64_t{x} + dx), Saturate(int64_t{y} + dy), w, h};
+}
+
+void LayerCompositor::Resize(int32_t width, int32_t height) {
+  width_ = width;
+  height_ = height;
+  frame_.assign(static_cast<std::size_t>(width) * height * 4, 0);
+  damage_.assign(1, Rect{0, 0, width, height});
+}
+
+void LayerCompositor::AddDamage(const Rect& rect) {
+  Rect clipped = rect.Intersect(Rect{0, 0, width_, height_});
+  if (clipped.Empty()) {
+    return;
+  }
+  for (auto& damage : damage_) {
+    if (damage.Contains(clipped)) {
+      return;
+    }
+    if (!damage.Intersect(clipped).Empty()) {
+      damage = damage.Union(clipped);
+      return;
+    }
+  }
+  if (damage_.size() == kMaxDamageRects) {
+    for (std::size_t i = 1; i < damage_.size(); i++) {
+      damage_[0] = damage_[0].Union(damage_[i]);
+    }
+    damage_.resize(1);
+    damage_[0] = damage_[0].Union(clipped);
+    return;
+  }
+  damage_.push_back(clipped);
+}
+
+bool LayerCompositor::Compose(const std::vector<Layer>& layers) {
+  if (damage_.empty()) {
+    return false;
+  }
+  for (const auto& rect : damage_) {
+    ComposeRect(layers, rect);
+  }
+  damage_.clear();
+  return true;
+}
+
+void LayerCompositor::ComposeRect(const std::vector<Layer>& layers,
+                                  const Rect& rect) {
+  // Nothing below an opaque layer covering the whole rectangle is visible.
+  std::size_t bottom = layers.size();
+  while (bottom > 0) {
+    const Layer& layer = layers[bottom - 1];
+    if (layer.opaque && layer.rect.Contains(rect)) {
+      break;
+    }
+    bottom--;
+  }
+  if (bottom == 0) {
+    for (int32_t row = rect.y; row < rect.y + rect.h; row++) {
+      memset(frame_.data() + row * stride_bytes() + rect.x * 4, 0, rect.w * 4);
+    }
+  } else {
+    bottom--;
+  }
+
+  for (std::size_t i = bottom; i < layers.size(); i++) {
+    const Layer& layer = layers[i];
+    const Rect visible = layer.rect.Intersect(rect);
+    if (visible.Empty()) {
+      continue;
+    }
+    if (layer.opaque) {
+      CopyRows(layer, visible, frame_.data(), stride_bytes());
+    } else {
+      BlendRows(layer, visible, frame_.data(), stride_bytes());
+    }
+  }
+}
+
+}  // namespace wayland
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace wayland {
+
+struct Rect {
+  int32_t x = 0;
+  int32_t y = 0;
+  int32_t w = 0;
+  int32_t h = 0;
+
+  bool Empty() const { return w <= 0 || h <= 0; }
+  bool Contains(const Rect& other) const;
+  Rect Intersect(const Rect& other) const;
+  // Smallest rectangle containing both rectangles.
+  Rect Union(const Rect& other) const;
+  Rect Translate(int32_t dx, int32_t dy) const;
+};
+
+// A 32 bits per pixel image placed on the output frame. Pixels use
+// premultiplied alpha in the fourth byte, as with the wl_shm formats, unless
+// the layer is opaque. All layers of a frame must share the same channel
+// order.
+struct Layer {
+  const uint8_t* pixels = nullptr;
+  uint32_t stride_bytes = 0;
+  // Position and size of the layer in output coordinates.
+  Rect rect;
+  bool opaque = false;
+};
+
+// Blends layers into an output frame, redrawing only the damaged parts of the
+// frame. Not thread safe.
+class LayerCompositor {
+ public:
+  // Resizes the output frame, which damages all of it.
+  void Resize(int32_t width, int32_t height);
+
+  // Marks a part of the output frame, in output coordinates, for redrawing
+  // by the next call to Compose().
+  void AddDamage(const Rect& rect);
+
+  // Redraws the damaged parts of the output frame from `layers`, ordered
+  // bottom to top, and clears the damage. Layers outside of the damage are
+  // not touched. Returns false if nothing was damaged.
+  bool Compose(const std::vector<Layer>& layers);
+
+  int32_t width() const { return width_; }
+  int32_t height() const { return height_; }
+  uint32_t stride_bytes() const { return width_ * 4; }
+  uint8_t* frame() { return frame_.data(); }
+
+ private:
+  void ComposeRect(const std::vector<Layer>& layers, const Rect& rect);
+
+  int32_t width_ = 0;
+  int32_t height_ = 0;
+  std::vector<uint8_t> frame_;
+  // Disjoint updates, such as a cursor moving across the screen, are kept
+  // apart so the area between them is not redrawn.
+  std::vector<Rect> damage_;
+};
+
+}  // namespace wayland
@@ -0,0 +1,248 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/wayland/wayland_layer_compositor.h"
+
+#include <stdint.h>
+
+#include <array>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace wayland {
+namespace {
+
+using Pixel = std::array<uint8_t, 4>;
+
+// Pixels of a layer filled with a single color.
+class Image {
+ public:
+  Image(int32_t w, int32_t h, Pixel color)
+      : w_(w), pixels_(static_cast<std::size_t>(w) * h * 4) {
+    Fill(color);
+  }
+
+  void Fill(Pixel color) {
+    for (std::size_t i = 0; i < pixels_.size(); i += 4) {
+      std::copy(color.begin(), color.end(), pixels_.begin() + i);
+    }
+  }
+
+  Layer At(int32_t x, int32_t y, bool opaque) const {
+    Layer layer;
+    layer.pixels = pixels_.data();
+    layer.stride_bytes = w_ * 4;
+    layer.rect = Rect{x, y, w_, static_cast<int32_t>(pixels_.size() / 4 / w_)};
+    layer.opaque = opaque;
+    return layer;
+  }
+
+ private:
+  int32_t w_;
+  std::vector<uint8_t> pixels_;
+};
+
+Pixel FramePixel(LayerCompositor& compositor, int32_t x, int32_t y) {
+  const uint8_t* pixel =
+      compositor.frame() + y * compositor.stride_bytes() + x * 4;
+  return Pixel{pixel[0], pixel[1], pixel[2], pixel[3]};
+}
+
+constexpr Pixel kBlack = {0, 0, 0, 0};
+constexpr Pixel kRed = {0, 0, 0xff, 0xff};
+constexpr Pixel kBlue = {0xff, 0, 0, 0xff};
+
+TEST(RectTest, Intersect) {
+  Rect a{0, 0, 10, 10};
+  EXPECT_TRUE(a.Intersect(Rect{10, 0, 5, 5}).Empty());
+  Rect overlap = a.Intersect(Rect{5, -5, 10, 10});
+  EXPECT_EQ(overlap.x, 5);
+  EXPECT_EQ(overlap.y, 0);
+  EXPECT_EQ(overlap.w, 5);
+  EXPECT_EQ(overlap.h, 5);
+}
+
+TEST(RectTest, Union) {
+  Rect joined = Rect{0, 0, 2, 2}.Union(Rect{8, 4, 2, 2});
+  EXPECT_EQ(joined.x, 0);
+  EXPECT_EQ(joined.y, 0);
+  EXPECT_EQ(joined.w, 10);
+  EXPECT_EQ(joined.h, 6);
+  Rect unchanged = Rect{1, 2, 3, 4}.Union(Rect{});
+  EXPECT_EQ(unchanged.x, 1);
+  EXPECT_EQ(unchanged.w, 3);
+}
+
+TEST(RectTest, LargeRectsDoNotWrap) {
+  Rect huge{0, 0, INT32_MAX, INT32_MAX};
+  Rect far{INT32_MAX - 10, INT32_MAX - 10, 100, 100};
+  EXPECT_TRUE(huge.Contains(Rect{5, 5, 5, 5}));
+  EXPECT_FALSE(huge.Contains(far));
+  EXPECT_FALSE(far.Contains(Rect{0, 0, 1, 1}));
+
+  Rect overlap = far.Intersect(huge);
+  EXPECT_FALSE(overlap.Empty());
+  EXPECT_EQ(overlap.x, INT32_MAX - 10);
+  EXPECT_EQ(overlap.w, 10);
+
+  Rect joined = Rect{INT32_MIN, 0, 1, 1}.Union(Rect{INT32_MAX - 1, 0, 1, 1});
+  EXPECT_EQ(joined.x, INT32_MIN);
+  EXPECT_EQ(joined.w, INT32_MAX);
+
+  Rect moved = far.Translate(100, -100);
+  EXPECT_EQ(moved.x, INT32_MAX);
+  EXPECT_EQ(moved.y, INT32_MAX - 110);
+  EXPECT_EQ((Rect{INT32_MIN + 1, 0, 1, 1}.Translate(-5, 0).x), INT32_MIN);
+}
+
+TEST(LayerCompositorTest, ComposeOnlyWhenDamaged) {
+  LayerCompositor compositor;
+  compositor.Resize(4, 4);
+  Image image(4, 4, kRed);
+  EXPECT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+  EXPECT_EQ(FramePixel(compositor, 3, 3), kRed);
+  EXPECT_FALSE(compositor.Compose({image.At(0, 0, true)}));
+}
+
+TEST(LayerCompositorTest, ComposeRedrawsOnlyDamage) {
+  LayerCompositor compositor;
+  compositor.Resize(8, 8);
+  Image image(8, 8, kRed);
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+
+  image.Fill(kBlue);
+  compositor.AddDamage(Rect{2, 2, 2, 2});
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+  EXPECT_EQ(FramePixel(compositor, 2, 2), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 3, 3), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 1, 1), kRed);
+  EXPECT_EQ(FramePixel(compositor, 4, 4), kRed);
+}
+
+TEST(LayerCompositorTest, ClearsUncoveredArea) {
+  LayerCompositor compositor;
+  compositor.Resize(8, 8);
+  Image image(2, 2, kRed);
+  ASSERT_TRUE(compositor.Compose({image.At(6, 6, true)}));
+  EXPECT_EQ(FramePixel(compositor, 0, 0), kBlack);
+  EXPECT_EQ(FramePixel(compositor, 5, 5), kBlack);
+  EXPECT_EQ(FramePixel(compositor, 6, 6), kRed);
+}
+
+TEST(LayerCompositorTest, ClipsLayersToFrame) {
+  LayerCompositor compositor;
+  compositor.Resize(4, 4);
+  Image image(4, 4, kRed);
+  ASSERT_TRUE(compositor.Compose({image.At(-2, 2, true)}));
+  EXPECT_EQ(FramePixel(compositor, 1, 3), kRed);
+  EXPECT_EQ(FramePixel(compositor, 2, 3), kBlack);
+  EXPECT_EQ(FramePixel(compositor, 1, 1), kBlack);
+}
+
+TEST(LayerCompositorTest, OpaqueLayerHidesLayersBelow) {
+  LayerCompositor compositor;
+  compositor.Resize(4, 4);
+  Image top(4, 4, kBlue);
+  // Never read: composing would crash if the layer below was drawn.
+  Layer hidden;
+  hidden.rect = Rect{0, 0, 4, 4};
+  hidden.stride_bytes = 16;
+  hidden.opaque = true;
+  ASSERT_TRUE(compositor.Compose({hidden, top.At(0, 0, true)}));
+  EXPECT_EQ(FramePixel(compositor, 0, 0), kBlue);
+}
+
+TEST(LayerCompositorTest, PartiallyCoveringOpaqueLayerKeepsLayersBelow) {
+  LayerCompositor compositor;
+  compositor.Resize(4, 4);
+  Image bottom(4, 4, kRed);
+  Image top(2, 4, kBlue);
+  ASSERT_TRUE(compositor.Compose({bottom.At(0, 0, true), top.At(0, 0, true)}));
+  EXPECT_EQ(FramePixel(compositor, 1, 0), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 2, 0), kRed);
+}
+
+TEST(LayerCompositorTest, BlendsPremultipliedAlpha) {
+  LayerCompositor compositor;
+  compositor.Resize(3, 1);
+  Image bottom(3, 1, Pixel{200, 100, 50, 0xff});
+  std::vector<uint8_t> top_pixels = {
+      64, 0, 0, 128,   // Half transparent, premultiplied.
+      9, 9, 9, 0,      // Fully transparent, ignored.
+      1, 2, 3, 0xff,   // Opaque, replaces the pixel below.
+  };
+  Layer top;
+  top.pixels = top_pixels.data();
+  top.stride_bytes = 12;
+  top.rect = Rect{0, 0, 3, 1};
+  top.opaque = false;
+
+  ASSERT_TRUE(compositor.Compose({bottom.At(0, 0, true), top}));
+  // src + dst * (255 - src_alpha) / 255, rounded.
+  EXPECT_EQ(FramePixel(compositor, 0, 0), (Pixel{164, 50, 25, 0xff}));
+  EXPECT_EQ(FramePixel(compositor, 1, 0), (Pixel{200, 100, 50, 0xff}));
+  EXPECT_EQ(FramePixel(compositor, 2, 0), (Pixel{1, 2, 3, 0xff}));
+}
+
+TEST(LayerCompositorTest, KeepsDisjointDamageApart) {
+  LayerCompositor compositor;
+  compositor.Resize(32, 1);
+  Image image(32, 1, kRed);
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+
+  image.Fill(kBlue);
+  for (int32_t i = 0; i < 8; i++) {
+    compositor.AddDamage(Rect{i * 4, 0, 1, 1});
+  }
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+  EXPECT_EQ(FramePixel(compositor, 0, 0), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 28, 0), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 2, 0), kRed);
+}
+
+TEST(LayerCompositorTest, MergesDamageBeyondCap) {
+  LayerCompositor compositor;
+  compositor.Resize(64, 1);
+  Image image(64, 1, kRed);
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+
+  // One rectangle more than are tracked apart merges them all into their
+  // bounding box.
+  image.Fill(kBlue);
+  for (int32_t i = 0; i < 9; i++) {
+    compositor.AddDamage(Rect{i * 4, 0, 1, 1});
+  }
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+  EXPECT_EQ(FramePixel(compositor, 0, 0), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 2, 0), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 32, 0), kBlue);
+  EXPECT_EQ(FramePixel(compositor, 33, 0), kRed);
+}
+
+TEST(LayerCompositorTest, HugeDamageIsClippedToFrame) {
+  LayerCompositor compositor;
+  compositor.Resize(4, 4);
+  Image image(4, 4, kRed);
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+
+  image.Fill(kBlue);
+  compositor.AddDamage(Rect{0, 0, INT32_MAX, INT32_MAX});
+  ASSERT_TRUE(compositor.Compose({image.At(0, 0, true)}));
+  EXPECT_EQ(FramePixel(compositor, 3, 3), kBlue);
+}
+
+}  // namespace
+}  // namespace wayland
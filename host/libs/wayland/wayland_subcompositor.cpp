@@ -21,9 +21,18 @@
 #include <wayland-server-core.h>
 #include <wayland-server-protocol.h>
 
+#include "host/libs/wayland/wayland_surface.h"
+#include "host/libs/wayland/wayland_utils.h"
+
 namespace wayland {
 namespace {
 
+// The subsurface becomes inert, with no user data, once its surface is
+// destroyed.
+Surface* GetSubsurfaceSurface(wl_resource* subsurface) {
+  return static_cast<Surface*>(wl_resource_get_user_data(subsurface));
+}
+
 void subsurface_destroy(wl_client*, wl_resource* subsurface) {
   LOG(VERBOSE) << " subsurface=" << subsurface;
 
@@ -38,6 +47,11 @@ void subsurface_set_position(wl_client*,
                << " subsurface=" << subsurface
                << " x=" << x
                << " y=" << y;
+
+  Surface* surface = GetSubsurfaceSurface(subsurface);
+  if (surface != nullptr) {
+    surface->SetPosition(x, y);
+  }
 }
 
 void subsurface_place_above(wl_client*,
@@ -46,6 +60,13 @@ void subsurface_place_above(wl_client*,
   LOG(VERBOSE) << __FUNCTION__
                << " subsurface=" << subsurface
                << " surface=" << surface;
+
+  Surface* subsurface_surface = GetSubsurfaceSurface(subsurface);
+  if (subsurface_surface != nullptr &&
+      !subsurface_surface->PlaceAbove(GetUserData<Surface>(surface))) {
+    wl_resource_post_error(subsurface, WL_SUBSURFACE_ERROR_BAD_SURFACE,
+                           "surface is neither the parent nor a sibling");
+  }
 }
 
 void subsurface_place_below(wl_client*,
@@ -54,19 +75,41 @@ void subsurface_place_below(wl_client*,
   LOG(VERBOSE) << __FUNCTION__
                << " subsurface=" << subsurface
                << " surface=" << surface;
+
+  Surface* subsurface_surface = GetSubsurfaceSurface(subsurface);
+  if (subsurface_surface != nullptr &&
+      !subsurface_surface->PlaceBelow(GetUserData<Surface>(surface))) {
+    wl_resource_post_error(subsurface, WL_SUBSURFACE_ERROR_BAD_SURFACE,
+                           "surface is neither the parent nor a sibling");
+  }
 }
 
 void subsurface_set_sync(wl_client*, wl_resource* subsurface) {
   LOG(VERBOSE) << __FUNCTION__
                << " subsurface=" << subsurface;
+
+  Surface* surface = GetSubsurfaceSurface(subsurface);
+  if (surface != nullptr) {
+    surface->SetSync(true);
+  }
 }
 
 void subsurface_set_desync(wl_client*, wl_resource* subsurface) {
   LOG(VERBOSE) << __FUNCTION__
                << " subsurface=" << subsurface;
+
+  Surface* surface = GetSubsurfaceSurface(subsurface);
+  if (surface != nullptr) {
+    surface->SetSync(false);
+  }
 }
 
-void subsurface_destroy_resource_callback(struct wl_resource*) {}
+void subsurface_destroy_resource_callback(struct wl_resource* subsurface) {
+  Surface* surface = GetSubsurfaceSurface(subsurface);
+  if (surface != nullptr) {
+    surface->ClearParent();
+  }
+}
 
 const struct wl_subsurface_interface subsurface_implementation = {
     .destroy = subsurface_destroy,
@@ -97,8 +140,19 @@ void subcompositor_get_subsurface(wl_client* client,
   wl_resource* subsurface_resource =
       wl_resource_create(client, &wl_subsurface_interface, 1, id);
 
+  Surface* subsurface = GetUserData<Surface>(surface);
+  if (!subsurface->SetParent(GetUserData<Surface>(parent_surface),
+                             subsurface_resource)) {
+    wl_resource_set_implementation(subsurface_resource,
+                                   &subsurface_implementation, nullptr,
+                                   subsurface_destroy_resource_callback);
+    wl_resource_post_error(display, WL_SUBCOMPOSITOR_ERROR_BAD_SURFACE,
+                           "invalid surface or parent for a subsurface");
+    return;
+  }
+
   wl_resource_set_implementation(subsurface_resource,
-                                 &subsurface_implementation, nullptr,
+                                 &subsurface_implementation, subsurface,
                                  subsurface_destroy_resource_callback);
 }
 
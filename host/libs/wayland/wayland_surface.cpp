@@ -16,46 +16,306 @@
 
 #include "host/libs/wayland/wayland_surface.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <tuple>
+
 #include <android-base/logging.h>
 #include <wayland-server-protocol.h>
 
 #include "host/libs/wayland/wayland_surfaces.h"
 
 namespace wayland {
+namespace {
+
+// Keeps the arithmetic on client provided rectangles from overflowing, as
+// clients commonly damage (0, 0, INT32_MAX, INT32_MAX).
+constexpr int32_t kMaxCoordinate = 1 << 20;
+
+// Subsurfaces nest, so their offsets add up beyond kMaxCoordinate. Anything
+// that far out is off the output anyway.
+constexpr int64_t kMaxOffset = 1 << 30;
+
+int32_t AddOffset(int32_t offset, int32_t position) {
+  return static_cast<int32_t>(
+      std::clamp<int64_t>(int64_t{offset} + position, -kMaxOffset, kMaxOffset));
+}
+
+Rect ClampRect(int32_t x, int32_t y, int32_t w, int32_t h) {
+  return Rect{
+      std::clamp(x, -kMaxCoordinate, kMaxCoordinate),
+      std::clamp(y, -kMaxCoordinate, kMaxCoordinate),
+      std::clamp(w, 0, 2 * kMaxCoordinate),
+      std::clamp(h, 0, 2 * kMaxCoordinate),
+  };
+}
 
-Surface::Surface(Surfaces& surfaces) : surfaces_(surfaces) {}
+}  // namespace
+
+void Surface::PendingState::Merge(PendingState&& later) {
+  if (later.attached) {
+    if (attached && buffer != nullptr && buffer != later.buffer) {
+      // Replaced before it was ever shown.
+      wl_buffer_send_release(buffer);
+    }
+    attached = true;
+    buffer = later.buffer;
+  }
+  if (later.damage) {
+    damage = damage ? damage->Union(*later.damage) : *later.damage;
+  }
+}
+
+Surface::Surface(Surfaces& surfaces) : surfaces_(surfaces) {
+  stack_.push_back(this);
+  pending_stack_.push_back(this);
+}
+
+Surface::~Surface() {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  Surface* root = Root();
+  AddTreeDamage();
+  RemoveFromParent();
+  for (Surface* child : pending_stack_) {
+    if (child != this) {
+      // The children become inert until they are given a new parent.
+      child->subsurface_->parent = nullptr;
+    }
+  }
+  if (subsurface_ && subsurface_->resource != nullptr) {
+    wl_resource_set_user_data(subsurface_->resource, nullptr);
+  }
+  if (root != this) {
+    root->Compose();
+  }
+}
 
 void Surface::SetRegion(const Region& region) {
-  std::unique_lock<std::mutex> lock(state_mutex_);
-  state_.region = region;
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  region_ = region;
 }
 
 void Surface::Attach(struct wl_resource* buffer) {
-  std::unique_lock<std::mutex> lock(state_mutex_);
-  state_.pending_buffer = buffer;
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  pending_.attached = true;
+  pending_.buffer = buffer;
+}
+
+void Surface::Damage(const Region& region) {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  Rect rect = ClampRect(region.x, region.y, region.w, region.h);
+  pending_.damage = pending_.damage ? pending_.damage->Union(rect) : rect;
 }
 
 void Surface::Commit() {
-  std::unique_lock<std::mutex> lock(state_mutex_);
-  state_.current_buffer = state_.pending_buffer;
-  state_.pending_buffer = nullptr;
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  PendingState state = std::move(pending_);
+  pending_ = PendingState{};
+
+  if (subsurface_ && subsurface_->parent != nullptr && IsSynchronized()) {
+    if (subsurface_->cached) {
+      subsurface_->cached->Merge(std::move(state));
+    } else {
+      subsurface_->cached = std::move(state);
+    }
+    return;
+  }
+
+  Surface* root = Root();
+  if (root == this && !HasSubsurfaces()) {
+    contents_ = Contents{};
+    compositor_ = LayerCompositor{};
+    if (state.attached) {
+      PresentDirectly(state.buffer);
+    }
+    return;
+  }
+
+  // Whatever was cached while synchronized is applied along with this state.
+  if (subsurface_ && subsurface_->cached) {
+    PendingState cached = std::move(*subsurface_->cached);
+    subsurface_->cached.reset();
+    cached.Merge(std::move(state));
+    state = std::move(cached);
+  }
+  ApplyState(std::move(state));
+  root->Compose();
+}
+
+void Surface::SetVirtioGpuScanoutId(uint32_t scanout_id) {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  virtio_gpu_metadata_.scanout_id = scanout_id;
+}
 
-  if (state_.current_buffer == nullptr) {
+bool Surface::SetParent(Surface* parent, struct wl_resource* subsurface) {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  if (subsurface_ || parent == this || IsAncestorOf(parent)) {
+    return false;
+  }
+  subsurface_.emplace();
+  subsurface_->parent = parent;
+  subsurface_->resource = subsurface;
+  // Stacking changes are usually only applied by the parent's commit, except
+  // for new subsurfaces which are placed immediately.
+  parent->stack_.push_back(this);
+  parent->pending_stack_.push_back(this);
+  return true;
+}
+
+void Surface::ClearParent() {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  if (!subsurface_) {
     return;
   }
+  Surface* root = Root();
+  AddTreeDamage();
+  RemoveFromParent();
+  if (subsurface_->cached && subsurface_->cached->buffer != nullptr) {
+    wl_buffer_send_release(subsurface_->cached->buffer);
+  }
+  subsurface_.reset();
+  contents_ = Contents{};
+  if (root != this) {
+    root->Compose();
+  }
+}
 
-  if (state_.virtio_gpu_metadata_.scanout_id.has_value()) {
-    const uint32_t display_number = *state_.virtio_gpu_metadata_.scanout_id;
+void Surface::SetPosition(int32_t x, int32_t y) {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  if (subsurface_) {
+    subsurface_->pending_position =
+        std::make_pair(std::clamp(x, -kMaxCoordinate, kMaxCoordinate),
+                       std::clamp(y, -kMaxCoordinate, kMaxCoordinate));
+  }
+}
 
-    struct wl_shm_buffer* shm_buffer = wl_shm_buffer_get(state_.current_buffer);
+bool Surface::PlaceAbove(Surface* sibling) {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  return Place(sibling, true);
+}
+
+bool Surface::PlaceBelow(Surface* sibling) {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  return Place(sibling, false);
+}
+
+void Surface::SetSync(bool sync) {
+  std::unique_lock<std::mutex> lock(surfaces_.surfaces_mutex_);
+  if (subsurface_) {
+    // Cached state is applied by the next commit of either this surface or
+    // its parent, which the protocol allows.
+    subsurface_->sync = sync;
+  }
+}
+
+Surface* Surface::Root() {
+  Surface* surface = this;
+  while (surface->subsurface_ && surface->subsurface_->parent != nullptr) {
+    surface = surface->subsurface_->parent;
+  }
+  return surface;
+}
+
+bool Surface::IsSynchronized() const {
+  // A subsurface is synchronized if it or any of its ancestors is.
+  for (const Surface* surface = this;
+       surface->subsurface_ && surface->subsurface_->parent != nullptr;
+       surface = surface->subsurface_->parent) {
+    if (surface->subsurface_->sync) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Surface::IsAncestorOf(const Surface* surface) const {
+  while (surface->subsurface_ && surface->subsurface_->parent != nullptr) {
+    surface = surface->subsurface_->parent;
+    if (surface == this) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Surface::HasSubsurfaces() const {
+  return stack_.size() > 1 || pending_stack_.size() > 1;
+}
+
+bool Surface::Place(Surface* sibling, bool above) {
+  if (!subsurface_ || subsurface_->parent == nullptr || sibling == this) {
+    return false;
+  }
+  auto& stack = subsurface_->parent->pending_stack_;
+  auto sibling_it = std::find(stack.begin(), stack.end(), sibling);
+  if (sibling_it == stack.end()) {
+    return false;
+  }
+  stack.erase(std::find(stack.begin(), stack.end(), this));
+  sibling_it = std::find(stack.begin(), stack.end(), sibling);
+  stack.insert(above ? sibling_it + 1 : sibling_it, this);
+  return true;
+}
+
+void Surface::RemoveFromParent() {
+  if (!subsurface_ || subsurface_->parent == nullptr) {
+    return;
+  }
+  for (auto* stack : {&subsurface_->parent->stack_,
+                      &subsurface_->parent->pending_stack_}) {
+    stack->erase(std::remove(stack->begin(), stack->end(), this),
+                 stack->end());
+  }
+  subsurface_->parent = nullptr;
+}
+
+std::pair<int32_t, int32_t> Surface::Offset() const {
+  int32_t x = 0;
+  int32_t y = 0;
+  for (const Surface* surface = this;
+       surface->subsurface_ && surface->subsurface_->parent != nullptr;
+       surface = surface->subsurface_->parent) {
+    x = AddOffset(x, surface->subsurface_->x);
+    y = AddOffset(y, surface->subsurface_->y);
+  }
+  return {x, y};
+}
+
+void Surface::AddDamage(const Rect& rect) {
+  auto [x, y] = Offset();
+  Root()->compositor_.AddDamage(rect.Translate(x, y));
+}
+
+void Surface::AddTreeDamage() {
+  if (contents_.pixels.empty()) {
+    return;
+  }
+  AddDamage(Rect{0, 0, contents_.w, contents_.h});
+  for (Surface* child : stack_) {
+    if (child != this) {
+      child->AddTreeDamage();
+    }
+  }
+}
+
+void Surface::PresentDirectly(struct wl_resource* buffer) {
+  if (buffer == nullptr) {
+    return;
+  }
+
+  if (virtio_gpu_metadata_.scanout_id.has_value()) {
+    const uint32_t display_number = *virtio_gpu_metadata_.scanout_id;
+
+    struct wl_shm_buffer* shm_buffer = wl_shm_buffer_get(buffer);
     CHECK(shm_buffer != nullptr);
 
     wl_shm_buffer_begin_access(shm_buffer);
 
     const int32_t buffer_w = wl_shm_buffer_get_width(shm_buffer);
-    CHECK(buffer_w == state_.region.w);
+    CHECK(buffer_w == region_.w);
     const int32_t buffer_h = wl_shm_buffer_get_height(shm_buffer);
-    CHECK(buffer_h == state_.region.h);
+    CHECK(buffer_h == region_.h);
     const int32_t buffer_stride_bytes = wl_shm_buffer_get_stride(shm_buffer);
 
     uint8_t* buffer_pixels =
@@ -67,16 +327,144 @@ void Surface::Commit() {
     wl_shm_buffer_end_access(shm_buffer);
   }
 
-  wl_buffer_send_release(state_.current_buffer);
-  wl_client_flush(wl_resource_get_client(state_.current_buffer));
+  wl_buffer_send_release(buffer);
+  wl_client_flush(wl_resource_get_client(buffer));
 
-  state_.current_buffer = nullptr;
-  state_.current_frame_number++;
+  current_frame_number_++;
 }
 
-void Surface::SetVirtioGpuScanoutId(uint32_t scanout_id) {
-  std::unique_lock<std::mutex> lock(state_mutex_);
-  state_.virtio_gpu_metadata_.scanout_id = scanout_id;
+void Surface::ApplyState(PendingState state) {
+  if (state.attached) {
+    if (state.buffer == nullptr) {
+      // Attaching no buffer unmaps the surface along with its subsurfaces.
+      AddTreeDamage();
+      contents_ = Contents{};
+    } else {
+      CopyBuffer(state.buffer, state.damage);
+    }
+  }
+
+  // The position and stacking of subsurfaces belong to the parent's state.
+  for (Surface* child : pending_stack_) {
+    if (child == this || !child->subsurface_->pending_position) {
+      continue;
+    }
+    child->AddTreeDamage();
+    std::tie(child->subsurface_->x, child->subsurface_->y) =
+        *child->subsurface_->pending_position;
+    child->subsurface_->pending_position.reset();
+    child->AddTreeDamage();
+  }
+  if (stack_ != pending_stack_) {
+    for (Surface* child : stack_) {
+      if (child != this) {
+        child->AddTreeDamage();
+      }
+    }
+    stack_ = pending_stack_;
+  }
+
+  for (Surface* child : stack_) {
+    if (child == this || !child->subsurface_->cached ||
+        !child->IsSynchronized()) {
+      continue;
+    }
+    PendingState cached = std::move(*child->subsurface_->cached);
+    child->subsurface_->cached.reset();
+    child->ApplyState(std::move(cached));
+  }
+}
+
+void Surface::CopyBuffer(struct wl_resource* buffer,
+                         std::optional<Rect> damage) {
+  struct wl_shm_buffer* shm_buffer = wl_shm_buffer_get(buffer);
+  CHECK(shm_buffer != nullptr);
+
+  wl_shm_buffer_begin_access(shm_buffer);
+
+  const int32_t buffer_w = wl_shm_buffer_get_width(shm_buffer);
+  const int32_t buffer_h = wl_shm_buffer_get_height(shm_buffer);
+  const int32_t buffer_stride_bytes = wl_shm_buffer_get_stride(shm_buffer);
+  const uint32_t format = wl_shm_buffer_get_format(shm_buffer);
+  const uint8_t* buffer_pixels =
+      reinterpret_cast<const uint8_t*>(wl_shm_buffer_get_data(shm_buffer));
+
+  const Rect bounds{0, 0, buffer_w, buffer_h};
+  if (contents_.w != buffer_w || contents_.h != buffer_h) {
+    AddTreeDamage();
+    contents_.w = buffer_w;
+    contents_.h = buffer_h;
+    contents_.pixels.resize(static_cast<std::size_t>(buffer_w) * buffer_h * 4);
+    damage = bounds;
+  }
+  // Clients which do not report damage get it for the whole buffer.
+  const Rect copy = damage ? damage->Intersect(bounds) : bounds;
+
+  const bool opaque_format = format == WL_SHM_FORMAT_XRGB8888 ||
+                             format == WL_SHM_FORMAT_XBGR8888;
+  const Rect opaque_region =
+      ClampRect(region_.x, region_.y, region_.w, region_.h);
+  const bool opaque = opaque_format || opaque_region.Contains(bounds);
+  if (opaque != contents_.opaque) {
+    contents_.opaque = opaque;
+    AddTreeDamage();
+  }
+
+  for (int32_t row = copy.y; row < copy.y + copy.h; row++) {
+    memcpy(contents_.pixels.data() + (row * buffer_w + copy.x) * 4,
+           buffer_pixels + row * buffer_stride_bytes + copy.x * 4,
+           copy.w * 4);
+  }
+  AddDamage(copy);
+
+  wl_shm_buffer_end_access(shm_buffer);
+
+  wl_buffer_send_release(buffer);
+  wl_client_flush(wl_resource_get_client(buffer));
+
+  current_frame_number_++;
+}
+
+void Surface::CollectLayers(int32_t x, int32_t y,
+                            std::vector<Layer>* layers) const {
+  // Unmapped surfaces hide their subsurfaces.
+  if (contents_.pixels.empty()) {
+    return;
+  }
+  for (const Surface* surface : stack_) {
+    if (surface == this) {
+      Layer layer;
+      layer.pixels = contents_.pixels.data();
+      layer.stride_bytes = static_cast<uint32_t>(contents_.w) * 4;
+      layer.rect = Rect{x, y, contents_.w, contents_.h};
+      layer.opaque = contents_.opaque;
+      layers->push_back(layer);
+    } else {
+      surface->CollectLayers(AddOffset(x, surface->subsurface_->x),
+                             AddOffset(y, surface->subsurface_->y), layers);
+    }
+  }
+}
+
+void Surface::Compose() {
+  if (!virtio_gpu_metadata_.scanout_id.has_value() ||
+      contents_.pixels.empty()) {
+    return;
+  }
+  if (compositor_.width() != contents_.w ||
+      compositor_.height() != contents_.h) {
+    compositor_.Resize(contents_.w, contents_.h);
+  }
+
+  std::vector<Layer> layers;
+  CollectLayers(0, 0, &layers);
+  if (!compositor_.Compose(layers)) {
+    return;
+  }
+  surfaces_.HandleSurfaceFrame(*virtio_gpu_metadata_.scanout_id,
+                               compositor_.width(), compositor_.height(),
+                               compositor_.stride_bytes(),
+                               compositor_.frame());
 }
 
-}  // namespace wayland
\ No newline at end of file
+}  // namespace wayland
@@ -18,20 +18,28 @@
 #pragma once
 
 #include <stdint.h>
-#include <mutex>
 #include <optional>
+#include <utility>
+#include <vector>
 
 #include <wayland-server-core.h>
 
+#include "host/libs/wayland/wayland_layer_compositor.h"
+
 namespace wayland {
 
 class Surfaces;
 
 // Tracks the buffer associated with a Wayland surface.
+//
+// A surface with a virtio gpu scanout id and without subsurfaces hands its
+// buffers to the frame callback as they are committed. Once subsurfaces are
+// attached to it, the surface and its subsurfaces are blended into an output
+// frame on the host instead, redrawing only the damaged parts of it.
 class Surface {
  public:
   Surface(Surfaces& surfaces);
-  virtual ~Surface() = default;
+  virtual ~Surface();
 
   Surface(const Surface& rhs) = delete;
   Surface& operator=(const Surface& rhs) = delete;
@@ -51,35 +59,112 @@ class Surface {
   // Sets the buffer of the pending frame.
   void Attach(struct wl_resource* buffer);
 
+  // Adds to the damage of the pending frame, in surface coordinates.
+  void Damage(const Region& region);
+
   // Commits the pending frame state.
   void Commit();
 
   void SetVirtioGpuScanoutId(uint32_t scanout);
 
+  // Gives this surface the subsurface role, placed on top of `parent` and its
+  // other subsurfaces. `subsurface` is the wl_subsurface resource, whose user
+  // data is cleared when this surface is destroyed. Fails if the surface
+  // already has the role or if `parent` is this surface or one of its
+  // descendants.
+  bool SetParent(Surface* parent, struct wl_resource* subsurface);
+
+  // Removes the subsurface role, unmapping the surface.
+  void ClearParent();
+
+  // Subsurface requests, see the wl_subsurface protocol. The position and
+  // placement are applied with the next commit of the parent. Positions far
+  // outside of any output are clamped. Placement fails if `sibling` is
+  // neither the parent nor a sibling.
+  void SetPosition(int32_t x, int32_t y);
+  bool PlaceAbove(Surface* sibling);
+  bool PlaceBelow(Surface* sibling);
+  void SetSync(bool sync);
+
  private:
+  // Frame state which is double buffered by wl_surface.commit.
+  struct PendingState {
+    bool attached = false;
+    struct wl_resource* buffer = nullptr;
+    std::optional<Rect> damage;
+
+    // Merges later pending state into this state.
+    void Merge(PendingState&& later);
+  };
+
+  struct Subsurface {
+    Surface* parent = nullptr;
+    struct wl_resource* resource = nullptr;
+    bool sync = true;
+    int32_t x = 0;
+    int32_t y = 0;
+    std::optional<std::pair<int32_t, int32_t>> pending_position;
+    // Committed while synchronized, applied with the parent.
+    std::optional<PendingState> cached;
+  };
+
+  // Copy of the last committed buffer, kept while the surface is part of a
+  // composited tree since buffers are released as soon as they are read.
+  struct Contents {
+    std::vector<uint8_t> pixels;
+    int32_t w = 0;
+    int32_t h = 0;
+    bool opaque = false;
+  };
+
+  Surface* Root();
+  bool IsSynchronized() const;
+  bool IsAncestorOf(const Surface* surface) const;
+  bool HasSubsurfaces() const;
+  bool Place(Surface* sibling, bool above);
+  void RemoveFromParent();
+
+  // Output coordinates of this surface in its root.
+  std::pair<int32_t, int32_t> Offset() const;
+  // Damages the area covered by this surface, in surface coordinates.
+  void AddDamage(const Rect& rect);
+  // Damages the area covered by this surface and its subsurfaces.
+  void AddTreeDamage();
+
+  void PresentDirectly(struct wl_resource* buffer);
+  void ApplyState(PendingState state);
+  void CopyBuffer(struct wl_resource* buffer, std::optional<Rect> damage);
+  void CollectLayers(int32_t x, int32_t y, std::vector<Layer>* layers) const;
+  void Compose();
+
   Surfaces& surfaces_;
 
   struct VirtioGpuMetadata {
     std::optional<uint32_t> scanout_id;
   };
 
-  struct State {
-    uint32_t current_frame_number = 0;
+  uint32_t current_frame_number_ = 0;
 
-    // The buffer for the current committed frame.
-    struct wl_resource* current_buffer = nullptr;
+  // State for the next frame.
+  PendingState pending_;
 
-    // The buffer for the next frame.
-    struct wl_resource* pending_buffer = nullptr;
+  // The buffers expected dimensions.
+  Region region_ = {};
 
-    // The buffers expected dimensions.
-    Region region;
+  VirtioGpuMetadata virtio_gpu_metadata_;
 
-    VirtioGpuMetadata virtio_gpu_metadata_;
-  };
+  // Set while this surface has the subsurface role.
+  std::optional<Subsurface> subsurface_;
+
+  // This surface and its subsurfaces, bottom to top. Placement requests
+  // update the pending order, which is applied by the next commit.
+  std::vector<Surface*> stack_;
+  std::vector<Surface*> pending_stack_;
+
+  Contents contents_;
 
-  std::mutex state_mutex_;
-  State state_;
+  // Only used by the root of a composited tree.
+  LayerCompositor compositor_;
 };
 
 }  // namespace wayland
@@ -56,6 +56,10 @@ class Surfaces {
                           std::uint32_t frame_stride_bytes,  //
                           std::uint8_t* frame_bytes);
 
+  // Guards the state of every surface, as surfaces reference each other once
+  // subsurfaces are involved.
+  std::mutex surfaces_mutex_;
+
   std::mutex callback_mutex_;
   std::optional<FrameCallback> callback_;
 };
@@ -224,9 +224,8 @@ std::vector<Artifact> BuildApi::Artifacts(const DirectoryBuild& build) {
   return artifacts;
 }
 
-bool BuildApi::ArtifactToCallback(const DeviceBuild& build,
-                                  const std::string& artifact,
-                                  CurlWrapper::DataCallback callback) {
+std::string BuildApi::ArtifactUrl(const DeviceBuild& build,
+                                  const std::string& artifact) {
   std::string download_url_endpoint =
       BUILD_API + "/builds/" + curl.UrlEscape(build.id) + "/" +
       curl.UrlEscape(build.target) + "/attempts/latest/artifacts/" +
@@ -240,48 +239,37 @@ bool BuildApi::ArtifactToCallback(const DeviceBuild& build,
     LOG(ERROR) << "Error fetching the url of \"" << artifact << "\" for \""
                << build << "\". The server response was \"" << json
                << "\", and code was " << curl_response.http_code;
-    return false;
+    return "";
   }
   if (json.isMember("error")) {
     LOG(ERROR) << "Response had \"error\" but had http success status. "
                << "Received \"" << json << "\"";
-    return false;
+    return "";
   }
   if (!json.isMember("signedUrl")) {
     LOG(ERROR) << "URL endpoint did not have json path: " << json;
+    return "";
+  }
+  return json["signedUrl"].asString();
+}
+
+bool BuildApi::ArtifactToCallback(const DeviceBuild& build,
+                                  const std::string& artifact,
+                                  CurlWrapper::DataCallback callback) {
+  std::string url = ArtifactUrl(build, artifact);
+  if (url.empty()) {
     return false;
   }
-  std::string url = json["signedUrl"].asString();
   return curl.DownloadToCallback(callback, url).HttpSuccess();
 }
 
 bool BuildApi::ArtifactToFile(const DeviceBuild& build,
                               const std::string& artifact,
                               const std::string& path) {
-  std::string download_url_endpoint =
-      BUILD_API + "/builds/" + curl.UrlEscape(build.id) + "/" +
-      curl.UrlEscape(build.target) + "/attempts/latest/artifacts/" +
-      curl.UrlEscape(artifact) + "/url";
-  if (!api_key_.empty()) {
-    download_url_endpoint += "?key=" + curl.UrlEscape(api_key_);
-  }
-  auto curl_response = curl.DownloadToJson(download_url_endpoint, Headers());
-  const auto& json = curl_response.data;
-  if (!(curl_response.HttpSuccess() || curl_response.HttpRedirect())) {
-    LOG(ERROR) << "Error fetching the url of \"" << artifact << "\" for \""
-               << build << "\". The server response was \"" << json
-               << "\", and code was " << curl_response.http_code;
-    return false;
-  }
-  if (json.isMember("error")) {
-    LOG(ERROR) << "Response had \"error\" but had http success status. "
-               << "Received \"" << json << "\"";
-  }
-  if (!json.isMember("signedUrl")) {
-    LOG(ERROR) << "URL endpoint did not have json path: " << json;
+  std::string url = ArtifactUrl(build, artifact);
+  if (url.empty()) {
     return false;
   }
-  std::string url = json["signedUrl"].asString();
   return curl.DownloadToFile(url, path).HttpSuccess();
 }
 
@@ -95,6 +95,10 @@ class BuildApi {
 
   std::vector<Artifact> Artifacts(const DeviceBuild&);
 
+  // The signed URL the artifact downloads from, empty on failure.
+  std::string ArtifactUrl(const DeviceBuild& build,
+                          const std::string& artifact);
+
   bool ArtifactToCallback(const DeviceBuild& build, const std::string& artifact,
                           CurlWrapper::DataCallback callback);
 
@@ -104,6 +104,10 @@ void WmediumdMessageStartPcap::SerializeBody(std::string& buf) const {
   buf.push_back('\0');
 }
 
+void WmediumdMessageNetlink::SerializeBody(std::string& buf) const {
+  std::copy(std::begin(netlink_), std::end(netlink_), std::back_inserter(buf));
+}
+
 std::optional<WmediumdMessageStationsList> WmediumdMessageStationsList::Parse(
     const WmediumdMessageReply& reply) {
   size_t pos = 0;
@@ -143,6 +143,42 @@ class WmediumdMessageGetStations : public WmediumdMessage {
   }
 };
 
+// Registers the connection as a client of the medium. Frames for the radios
+// the client transmits from are then sent to it in kNetlink messages, each of
+// which it must acknowledge with a kAck.
+class WmediumdMessageRegister : public WmediumdMessage {
+ public:
+  WmediumdMessageRegister() = default;
+
+  WmediumdMessageType Type() const override {
+    return WmediumdMessageType::kRegister;
+  }
+};
+
+// A mac80211_hwsim generic netlink message, including its nlmsghdr.
+class WmediumdMessageNetlink : public WmediumdMessage {
+ public:
+  WmediumdMessageNetlink(const std::string& netlink) : netlink_(netlink) {}
+
+  WmediumdMessageType Type() const override {
+    return WmediumdMessageType::kNetlink;
+  }
+
+ private:
+  void SerializeBody(std::string& out) const override;
+
+  std::string netlink_;
+};
+
+class WmediumdMessageAck : public WmediumdMessage {
+ public:
+  WmediumdMessageAck() = default;
+
+  WmediumdMessageType Type() const override {
+    return WmediumdMessageType::kAck;
+  }
+};
+
 class WmediumdMessageReply : public WmediumdMessage {
  public:
   WmediumdMessageReply() = default;
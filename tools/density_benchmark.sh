@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# Compares the host memory used by N instances with and without the
+# experimental --share_super_image. Run it from a directory holding the host
+# package and the device images, as for launch_cvd.
+#
+# Only guest images whose fstab mounts the logical partitions from the pmem
+# device can show a difference. The guests built from this tree still read
+# super from the composite disk, so both runs should use the same memory.
+#
+#   tools/density_benchmark.sh [num_instances] [settle_seconds] [launch_cvd args]
+#
+# SUPER_IMAGE overrides the super image evicted from the page cache between
+# runs, it defaults to super.img next to the other device images.
+
+set -e
+
+NUM_INSTANCES=${1:-4}
+SETTLE_SECONDS=${2:-120}
+shift 2 || shift $#
+
+HOME=${HOME:-$(pwd)}
+BIN=${ANDROID_HOST_OUT:-$(pwd)}/bin
+SUPER_IMAGE=${SUPER_IMAGE:-${ANDROID_PRODUCT_OUT:-$(pwd)}/super.img}
+
+run() {
+  local label=$1
+  shift
+  echo "=== ${label}: ${NUM_INSTANCES} instances"
+  # launch_cvd --daemon returns once every instance has booted.
+  "${BIN}/launch_cvd" --daemon --num_instances="${NUM_INSTANCES}" \
+      --report_anonymous_usage_stats=n "$@" >/dev/null
+  # Let the guests finish the post boot work that pages in most of the system.
+  sleep "${SETTLE_SECONDS}"
+  "${BIN}/cvd_memory_usage"
+  free -m
+  "${BIN}/stop_cvd" >/dev/null
+  # Start the second run with the super image out of the page cache too.
+  # Only that file is evicted, which needs no privileges.
+  dd if="${SUPER_IMAGE}" iflag=nocache count=0 status=none || true
+}
+
+run "private super image" "$@"
+run "shared super image" --share_super_image "$@"
@@ -0,0 +1,90 @@
+#!/bin/bash
+
+# Measures the guest to host TCP throughput of the ethernet interface for
+# several --net_queues values, iperf style: the guest sends zeros over parallel
+# connections, which the host discards. More than one queue needs the taps to
+# be created as multi queue, e.g. `ip tuntap add ... multi_queue`. Run it from
+# a directory holding the host package and the device images, as for
+# launch_cvd.
+#
+#   tools/net_throughput_benchmark.sh [queue counts] [launch_cvd args]
+#
+# e.g. tools/net_throughput_benchmark.sh "1 2 4" --cpus=4 --vhost_net
+
+set -e
+
+QUEUES=${1:-"1 2 4"}
+shift 1 || shift $#
+
+HOME=${HOME:-$(pwd)}
+BIN=${ANDROID_HOST_OUT:-$(pwd)}/bin
+ADB="${BIN}/adb -s 0.0.0.0:6520"
+# The host's address on the bridge the guest's ethernet tap is part of.
+HOST_IP=${HOST_IP:-$(ip -4 -o addr show cvd-ebr | awk '{ split($4, a, "/"); print a[1] }')}
+PORT=${PORT:-5201}
+STREAMS=${STREAMS:-4}
+MEGABYTES=${MEGABYTES:-1024}
+
+# Accepts a connection per stream and prints the bytes per second over all of
+# them, from the first connection until the last one is closed.
+receive() {
+  python3 - "${HOST_IP}" "${PORT}" "${STREAMS}" <<'EOF'
+import socket, sys, threading, time
+
+host, port, streams = sys.argv[1], int(sys.argv[2]), int(sys.argv[3])
+server = socket.socket()
+server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+server.bind((host, port))
+server.listen(streams)
+received = [0] * streams
+
+def drain(index, connection):
+  while True:
+    data = connection.recv(1 << 20)
+    if not data:
+      break
+    received[index] += len(data)
+
+threads = []
+for i in range(streams):
+  connection, _ = server.accept()
+  if i == 0:
+    start = time.monotonic()
+  thread = threading.Thread(target=drain, args=(i, connection))
+  thread.start()
+  threads.append(thread)
+for thread in threads:
+  thread.join()
+print(sum(received) / (time.monotonic() - start))
+EOF
+}
+
+run() {
+  local queues=$1
+  shift
+  echo "=== --net_queues=${queues}"
+  # launch_cvd --daemon returns once the guest has booted.
+  "${BIN}/launch_cvd" --daemon --net_queues="${queues}" \
+      --report_anonymous_usage_stats=n "$@" >/dev/null
+  until ${ADB} shell ip -4 addr show eth0 2>/dev/null | grep -q inet; do
+    sleep 0.1
+  done
+
+  local result=$(mktemp)
+  receive >"${result}" &
+  local receiver=$!
+  sleep 1
+  local per_stream=$(( MEGABYTES / STREAMS ))
+  ${ADB} shell "for i in \$(seq ${STREAMS}); do \
+      dd if=/dev/zero bs=1048576 count=${per_stream} 2>/dev/null | \
+      nc -q 0 ${HOST_IP} ${PORT} & done; wait"
+  wait "${receiver}"
+  echo "throughput: $(echo "scale=2; $(cat "${result}") * 8 / 1000000000" | bc) Gbit/s"
+  rm "${result}"
+
+  "${BIN}/stop_cvd" >/dev/null
+}
+
+for queues in ${QUEUES}; do
+  run "${queues}" "$@"
+done
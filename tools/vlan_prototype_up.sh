@@ -36,7 +36,7 @@ create_interface() {
 	/sbin/brctl addif "${bridge}" "${tap}"
 }
 
-ip tuntap add dev cvd-net-01 mode tap group cvdnetwork
+ip tuntap add dev cvd-net-01 mode tap group cvdnetwork multi_queue
 ifconfig cvd-net-01 0.0.0.0 up
 
 create_interface w 1 192.168.93 11
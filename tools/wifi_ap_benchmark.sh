@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Compares the OpenWrt VM and the wifi_ap host process as the Wi-Fi access
+# point: the time from launch until the guest's wlan0 gets an address, and the
+# memory and CPU time the access point uses while the guest sits idle. Run it
+# from a directory holding the host package and the device images, as for
+# launch_cvd.
+#
+#   tools/wifi_ap_benchmark.sh [idle_seconds] [launch_cvd args]
+
+set -e
+
+IDLE_SECONDS=${1:-60}
+shift 1 || shift $#
+
+HOME=${HOME:-$(pwd)}
+BIN=${ANDROID_HOST_OUT:-$(pwd)}/bin
+ADB="${BIN}/adb -s 0.0.0.0:6520"
+CLOCK_TICKS=$(getconf CLK_TCK)
+
+ap_pid() {
+  case $1 in
+    openwrt) pgrep -f -n "crosvm.*ap_control.sock" ;;
+    host) pgrep -x -n wifi_ap ;;
+  esac
+}
+
+cpu_ticks() {
+  # utime and stime, the 14th and 15th fields
+  awk '{ print $14 + $15 }' "/proc/$1/stat"
+}
+
+run() {
+  local backend=$1
+  shift
+  echo "=== --ap_backend=${backend}"
+  local start=$(date +%s.%N)
+  # launch_cvd --daemon returns once the guest has booted.
+  "${BIN}/launch_cvd" --daemon --ap_backend="${backend}" \
+      --report_anonymous_usage_stats=n "$@" >/dev/null
+  local booted=$(date +%s.%N)
+  until ${ADB} shell ip -4 addr show wlan0 2>/dev/null | grep -q inet; do
+    sleep 0.1
+  done
+  local connected=$(date +%s.%N)
+  echo "boot: $(echo "${booted} - ${start}" | bc) s"
+  echo "wifi connected: $(echo "${connected} - ${start}" | bc) s"
+
+  local pid=$(ap_pid "${backend}")
+  local ticks=$(cpu_ticks "${pid}")
+  sleep "${IDLE_SECONDS}"
+  ticks=$(( $(cpu_ticks "${pid}") - ticks ))
+  echo "idle cpu: $(echo "scale=2; 100 * ${ticks} / ${CLOCK_TICKS} / ${IDLE_SECONDS}" | bc) %"
+  grep -E "^(Rss|Pss):" "/proc/${pid}/smaps_rollup"
+
+  "${BIN}/stop_cvd" >/dev/null
+}
+
+run openwrt "$@"
+run host "$@"